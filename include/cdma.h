@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef GRATE_CDMA_H
+#define GRATE_CDMA_H 1
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming decoder of host1x command streams. The stream may be fed in
+ * chunks of any size, an opcode whose data words are split across chunks
+ * is continued by the next call. Decoding doesn't allocate, gathers of
+ * commands are decoded recursively on the stack.
+ */
+
+enum cdma_opcode {
+	CDMA_OPCODE_SETCL,
+	CDMA_OPCODE_INCR,
+	CDMA_OPCODE_NONINCR,
+	CDMA_OPCODE_MASK,
+	CDMA_OPCODE_IMM,
+	CDMA_OPCODE_RESTART,
+	CDMA_OPCODE_GATHER,
+	CDMA_OPCODE_EXTEND = 14,
+	CDMA_OPCODE_CHDONE = 15,
+};
+
+/* the fields that don't apply to an opcode are 0 */
+struct cdma_op {
+	uint32_t word;
+	enum cdma_opcode opcode;
+	uint32_t classid;
+	uint32_t offset;
+	uint32_t count;
+	uint32_t mask;
+	uint32_t value;
+	uint32_t subop;
+
+	/* gathers, data words are written to offset if inserted */
+	uint32_t base;
+	bool insert;
+	bool incr;
+};
+
+struct cdma_visitor {
+	/* called for every opcode before its register writes */
+	void (*op)(void *user, const struct cdma_op *op);
+
+	void (*write)(void *user, uint32_t classid, uint32_t offset,
+		      uint32_t value);
+
+	/* returns the words of a gather or NULL to skip it */
+	const uint32_t *(*gather)(void *user, uint32_t base, uint32_t count);
+
+	/* an invalid opcode, decoding stops */
+	void (*error)(void *user, uint32_t word);
+};
+
+#define CDMA_MAX_GATHER_DEPTH	4
+
+enum cdma_data {
+	CDMA_DATA_NONE,
+	CDMA_DATA_INCR,
+	CDMA_DATA_NONINCR,
+	CDMA_DATA_MASK,
+	CDMA_DATA_GATHER,
+	CDMA_DATA_INVALID,
+};
+
+/* how the words following the opcode word are consumed */
+static const uint8_t cdma_opcode_data[16] = {
+	[CDMA_OPCODE_SETCL]	= CDMA_DATA_MASK,
+	[CDMA_OPCODE_INCR]	= CDMA_DATA_INCR,
+	[CDMA_OPCODE_NONINCR]	= CDMA_DATA_NONINCR,
+	[CDMA_OPCODE_MASK]	= CDMA_DATA_MASK,
+	[CDMA_OPCODE_IMM]	= CDMA_DATA_NONE,
+	[CDMA_OPCODE_RESTART]	= CDMA_DATA_NONE,
+	[CDMA_OPCODE_GATHER]	= CDMA_DATA_GATHER,
+	[7 ... 13]		= CDMA_DATA_INVALID,
+	[CDMA_OPCODE_EXTEND]	= CDMA_DATA_NONE,
+	[CDMA_OPCODE_CHDONE]	= CDMA_DATA_NONE,
+};
+
+static const char * const cdma_opcode_names[16] = {
+	[CDMA_OPCODE_SETCL]	= "HOST1X_OPCODE_SETCL",
+	[CDMA_OPCODE_INCR]	= "HOST1X_OPCODE_INCR",
+	[CDMA_OPCODE_NONINCR]	= "HOST1X_OPCODE_NONINCR",
+	[CDMA_OPCODE_MASK]	= "HOST1X_OPCODE_MASK",
+	[CDMA_OPCODE_IMM]	= "HOST1X_OPCODE_IMM",
+	[CDMA_OPCODE_RESTART]	= "HOST1X_OPCODE_RESTART",
+	[CDMA_OPCODE_GATHER]	= "HOST1X_OPCODE_GATHER",
+	[CDMA_OPCODE_EXTEND]	= "HOST1X_OPCODE_EXTEND",
+	[CDMA_OPCODE_CHDONE]	= "HOST1X_OPCODE_CHDONE",
+};
+
+struct cdma_decoder {
+	const struct cdma_visitor *visitor;
+	void *user;
+	uint32_t classid;
+	unsigned int depth;
+	bool failed;
+
+	/* the opcode whose data words are being consumed */
+	struct cdma_op op;
+	enum cdma_data data;
+	uint32_t remaining;
+	uint32_t mask;
+	uint32_t next_offset;
+};
+
+static inline void cdma_decoder_init(struct cdma_decoder *dec,
+				     const struct cdma_visitor *visitor,
+				     void *user, uint32_t classid)
+{
+	*dec = (struct cdma_decoder) {
+		.visitor = visitor,
+		.user = user,
+		.classid = classid,
+	};
+}
+
+static inline int cdma_decode(struct cdma_decoder *dec,
+			      const uint32_t *words, size_t count);
+
+static inline void cdma_decode_op(struct cdma_decoder *dec, uint32_t word)
+{
+	const struct cdma_visitor *v = dec->visitor;
+	struct cdma_op *op = &dec->op;
+
+	*op = (struct cdma_op) {
+		.word = word,
+		.opcode = word >> 28,
+		.offset = (word >> 16) & 0xfff,
+	};
+
+	dec->data = cdma_opcode_data[op->opcode];
+	dec->remaining = 0;
+	dec->mask = 0;
+
+	switch (op->opcode) {
+	case CDMA_OPCODE_SETCL:
+		op->classid = (word >> 6) & 0x3ff;
+		op->mask = word & 0x3f;
+		dec->classid = op->classid;
+		break;
+
+	case CDMA_OPCODE_INCR:
+	case CDMA_OPCODE_NONINCR:
+		op->count = word & 0xffff;
+		break;
+
+	case CDMA_OPCODE_MASK:
+		op->mask = word & 0xffff;
+		break;
+
+	case CDMA_OPCODE_IMM:
+		op->value = word & 0xffff;
+		break;
+
+	case CDMA_OPCODE_RESTART:
+		op->offset = (word & 0x0fffffff) << 4;
+		break;
+
+	case CDMA_OPCODE_GATHER:
+		op->count = word & 0x3fff;
+		op->insert = word & (1 << 15);
+		op->incr = word & (1 << 14);
+		dec->remaining = 1;
+		break;
+
+	case CDMA_OPCODE_EXTEND:
+		op->offset = 0;
+		op->subop = (word >> 24) & 0xf;
+		op->value = word & 0xffffff;
+		break;
+
+	case CDMA_OPCODE_CHDONE:
+		op->offset = 0;
+		break;
+
+	default:
+		dec->failed = true;
+
+		if (v->error)
+			v->error(dec->user, word);
+		return;
+	}
+
+	op->classid = dec->classid;
+	dec->next_offset = op->offset;
+	dec->mask = op->mask;
+
+	if (dec->data == CDMA_DATA_INCR || dec->data == CDMA_DATA_NONINCR)
+		dec->remaining = op->count;
+
+	if (dec->data == CDMA_DATA_MASK)
+		dec->remaining = __builtin_popcount(op->mask);
+
+	/* a gather is visited once its base is known */
+	if (op->opcode != CDMA_OPCODE_GATHER && v->op)
+		v->op(dec->user, op);
+
+	if (op->opcode == CDMA_OPCODE_IMM && v->write)
+		v->write(dec->user, dec->classid, op->offset, op->value);
+}
+
+static inline void cdma_decode_gather(struct cdma_decoder *dec,
+				      uint32_t base)
+{
+	const struct cdma_visitor *v = dec->visitor;
+	struct cdma_op *op = &dec->op;
+	struct cdma_decoder sub;
+	const uint32_t *words;
+	uint32_t i;
+
+	op->base = base;
+
+	if (v->op)
+		v->op(dec->user, op);
+
+	if (!v->gather || !op->count)
+		return;
+
+	words = v->gather(dec->user, base, op->count);
+	if (!words)
+		return;
+
+	if (op->insert) {
+		for (i = 0; i < op->count && v->write; i++)
+			v->write(dec->user, dec->classid,
+				 op->offset + (op->incr ? i : 0), words[i]);
+		return;
+	}
+
+	if (dec->depth == CDMA_MAX_GATHER_DEPTH) {
+		dec->failed = true;
+
+		if (v->error)
+			v->error(dec->user, op->word);
+		return;
+	}
+
+	cdma_decoder_init(&sub, v, dec->user, dec->classid);
+	sub.depth = dec->depth + 1;
+
+	if (cdma_decode(&sub, words, op->count) < 0 || sub.remaining)
+		dec->failed = true;
+
+	dec->classid = sub.classid;
+}
+
+/* returns -EINVAL once an invalid opcode was found */
+static inline int cdma_decode(struct cdma_decoder *dec,
+			      const uint32_t *words, size_t count)
+{
+	const struct cdma_visitor *v = dec->visitor;
+	const uint32_t *end = words + count;
+	uint32_t n;
+
+	while (words < end && !dec->failed) {
+		if (!dec->remaining) {
+			cdma_decode_op(dec, *words++);
+			continue;
+		}
+
+		switch (dec->data) {
+		case CDMA_DATA_INCR:
+		case CDMA_DATA_NONINCR:
+			n = end - words < dec->remaining ? end - words :
+							   dec->remaining;
+			dec->remaining -= n;
+
+			if (!v->write) {
+				words += n;
+				break;
+			}
+
+			while (n--)
+				v->write(dec->user, dec->classid,
+					 dec->data == CDMA_DATA_INCR ?
+					 dec->next_offset++ : dec->next_offset,
+					 *words++);
+			break;
+
+		case CDMA_DATA_MASK:
+			n = __builtin_ctz(dec->mask);
+			dec->mask &= dec->mask - 1;
+			dec->remaining--;
+
+			if (v->write)
+				v->write(dec->user, dec->classid,
+					 dec->next_offset + n, *words);
+			words++;
+			break;
+
+		case CDMA_DATA_GATHER:
+			dec->remaining = 0;
+			cdma_decode_gather(dec, *words++);
+			break;
+
+		default:
+			dec->remaining = 0;
+			break;
+		}
+	}
+
+	return dec->failed ? -EINVAL : 0;
+}
+
+/* returns -ENODATA if the stream ended within the data of an opcode */
+static inline int cdma_decode_end(struct cdma_decoder *dec)
+{
+	if (dec->failed)
+		return -EINVAL;
+
+	return dec->remaining ? -ENODATA : 0;
+}
+
+#endif
@@ -48,7 +48,9 @@
 	fprintf(stdout, "INFO: %s:%d: " fmt, __func__, __LINE__, ##args)
 
 enum host1x_class {
+	HOST1X_CLASS_HOST1X = 0x01,
 	HOST1X_CLASS_GR2D = 0x51,
+	HOST1X_CLASS_GR2D_SB = 0x52,
 	HOST1X_CLASS_GR3D = 0x60,
 };
 
@@ -61,6 +63,28 @@ enum host1x_class {
 #define NVHOST_BO_FLAG_SCRATCH		3
 #define NVHOST_BO_FLAG_ATTRIBUTES	4
 
+/*
+ * CPU mapping of a BO, ORed into the flags of host1x_bo_create(). Write
+ * combined mappings suit data streamed by the CPU to the GPU, cached ones
+ * data read back by the CPU, which needs host1x_bo_flush() before and
+ * host1x_bo_invalidate() after GPU accesses. The backend picks the mapping
+ * by default. The mapping lasts as long as the BO, cached BOs included.
+ */
+#define HOST1X_BO_MAP_DEFAULT		(0 << 12)
+#define HOST1X_BO_MAP_WRITE_COMBINE	(1 << 12)
+#define HOST1X_BO_MAP_CACHED		(2 << 12)
+#define HOST1X_BO_MAP_UNCACHED		(3 << 12)
+#define HOST1X_BO_MAP_MASK		(3 << 12)
+
+/*
+ * Memory accounting category of a BO, ORed into the flags of
+ * host1x_bo_create(). Without one the category follows from the kind of
+ * the BO, command buffers and attributes are accounted as such and
+ * framebuffer BOs as framebuffers. host1x_bo_set_category() retags a BO.
+ */
+#define HOST1X_BO_CATEGORY(c)		((unsigned long)(c) << 16)
+#define HOST1X_BO_CATEGORY_MASK		(0xful << 16)
+
 struct host1x_stream {
 	const uint32_t *words;
 	const uint32_t *ptr;
@@ -148,8 +172,27 @@ enum pixel_format {
 enum layout_format {
 	PIX_BUF_LAYOUT_LINEAR,
 	PIX_BUF_LAYOUT_TILED_16x16,
+	/*
+	 * Resolved when the pixelbuffer is created, pixelbuffers never have
+	 * this layout. Scanout buffers get the linear layout, others the
+	 * tiled one if it pays off, see host1x_pixelbuffer_auto_layout().
+	 */
+	PIX_BUF_LAYOUT_AUTO,
 };
 
+void host1x_tile_16x16(void *dst, unsigned dst_pitch,
+		       const void *src, unsigned src_pitch,
+		       unsigned width, unsigned height,
+		       enum pixel_format format);
+void host1x_detile_16x16(void *dst, unsigned dst_pitch,
+			 const void *src, unsigned src_pitch,
+			 unsigned width, unsigned height,
+			 enum pixel_format format);
+uint64_t host1x_hash_pixels(const void *data, unsigned pitch,
+			    unsigned width, unsigned height,
+			    enum pixel_format format,
+			    enum layout_format layout);
+
 struct host1x_pixelbuffer {
 	struct host1x_bo *bo;
 	enum pixel_format format;
@@ -158,6 +201,14 @@ struct host1x_pixelbuffer {
 	unsigned height;
 	unsigned pitch;
 	bool guarded;
+
+	/* the BO of a lazy pixelbuffer is allocated on its first use */
+	struct {
+		struct host1x *host1x;
+		size_t size;
+		unsigned long flags;
+		bool guard;
+	} lazy;
 };
 
 #define PIXBUF_GUARD_AREA_SIZE	0x4000
@@ -168,6 +219,22 @@ struct host1x_pixelbuffer *host1x_pixelbuffer_create(
 				unsigned pitch,
 				enum pixel_format format,
 				enum layout_format layout);
+struct host1x_pixelbuffer *host1x_pixelbuffer_create_lazy(
+				struct host1x *host1x,
+				unsigned width, unsigned height,
+				unsigned pitch,
+				enum pixel_format format,
+				enum layout_format layout);
+int host1x_pixelbuffer_alloc_bo(struct host1x_pixelbuffer *pixbuf);
+enum layout_format host1x_pixelbuffer_auto_layout(unsigned width,
+						 unsigned height,
+						 enum pixel_format format);
+struct host1x_pixelbuffer *host1x_pixelbuffer_wrap(
+				struct host1x_bo *bo,
+				unsigned width, unsigned height,
+				unsigned pitch,
+				enum pixel_format format,
+				enum layout_format layout);
 void host1x_pixelbuffer_free(struct host1x_pixelbuffer *pixbuf);
 int host1x_pixelbuffer_load_data(struct host1x *host1x,
 				 struct host1x_pixelbuffer *pixbuf,
@@ -176,11 +243,49 @@ int host1x_pixelbuffer_load_data(struct host1x *host1x,
 				 unsigned long data_size,
 				 enum pixel_format data_format,
 				 enum layout_format data_layout);
+int host1x_pixelbuffer_load_data_async(struct host1x *host1x,
+				       struct host1x_pixelbuffer *pixbuf,
+				       void *data,
+				       unsigned data_pitch,
+				       unsigned long data_size,
+				       enum pixel_format data_format,
+				       enum layout_format data_layout,
+				       uint32_t *fence);
+int host1x_pixelbuffer_read_data(struct host1x_pixelbuffer *pixbuf,
+				 void *data, unsigned data_pitch);
+int host1x_pixelbuffer_hash(struct host1x_pixelbuffer *pixbuf,
+			    uint64_t *hash);
 void host1x_pixelbuffer_setup_guard(struct host1x_pixelbuffer *pixbuf);
 void host1x_pixelbuffer_check_guard(struct host1x_pixelbuffer *pixbuf);
+void host1x_pixelbuffer_unguard(struct host1x_pixelbuffer *pixbuf);
 void host1x_pixelbuffer_disable_bo_guard(void);
 bool host1x_pixelbuffer_bo_guard_disabled(void);
 
+/*
+ * Guard areas surround the pixelbuffers created while the mode isn't OFF,
+ * changing the mode doesn't affect the existing pixelbuffers. Sampled
+ * mode checks every interval'th guard check, async mode leaves the checks
+ * to a background thread and checks in place if the thread lags behind.
+ */
+enum host1x_pixbuf_guard_mode {
+	HOST1X_PIXBUF_GUARD_OFF,
+	HOST1X_PIXBUF_GUARD_SYNC,
+	HOST1X_PIXBUF_GUARD_SAMPLED,
+	HOST1X_PIXBUF_GUARD_ASYNC,
+};
+
+void host1x_pixelbuffer_set_guard_mode(enum host1x_pixbuf_guard_mode mode,
+				       unsigned int interval);
+
+/* makes sure that a lazy pixelbuffer has its BO, call before any use */
+static inline int host1x_pixelbuffer_populate(struct host1x_pixelbuffer *pixbuf)
+{
+	if (pixbuf->bo)
+		return 0;
+
+	return host1x_pixelbuffer_alloc_bo(pixbuf);
+}
+
 enum tegra_soc_id {
 	TEGRA_UNKOWN_SOC,
 	TEGRA20_SOC,
@@ -198,6 +303,12 @@ struct host1x_options {
 	bool open_display;
 	int display_id;
 	int fd;
+	/* estimate the cost of jobs if the dummy backend is used */
+	bool model;
+	/* set GR2D and GR3D up on their first use instead of at open time */
+	bool lazy_init;
+	/* milliseconds a job may run before it's considered hung, 0 is 1s */
+	unsigned int job_timeout;
 	/* out */
 	struct host1x_chip_info chip_info;
 };
@@ -206,9 +317,90 @@ struct host1x *host1x_open(struct host1x_options *options);
 void host1x_close(struct host1x *host1x);
 
 struct host1x_display *host1x_get_display(struct host1x *host1x);
+struct host1x_display *host1x_open_display(struct host1x *host1x);
 struct host1x_gr2d *host1x_get_gr2d(struct host1x *host1x);
 struct host1x_gr3d *host1x_get_gr3d(struct host1x *host1x);
 
+struct host1x_client_stats {
+	uint64_t submits;
+	uint64_t words;
+	uint64_t relocs;
+	uint64_t waits;
+	/* time spent blocked in host1x_client_wait() */
+	uint64_t wait_time_us;
+	/* words dropped by the pushbuf optimizer */
+	uint64_t words_saved;
+	/* jobs that hung and were recovered from */
+	uint64_t hangs;
+
+	/* cost of the jobs estimated by the dummy backend, if enabled */
+	struct {
+		/* draws of GR3D, blits and fills of GR2D */
+		uint64_t ops;
+		uint64_t vertices;
+		uint64_t primitives;
+		uint64_t vp_instructions;
+		uint64_t fp_instructions;
+		uint64_t tex_fetches;
+		/* fill area bound by the scissor and the viewport */
+		uint64_t pixels;
+		uint64_t cycles;
+		uint64_t time_ns;
+	} model;
+};
+
+struct host1x_stats {
+	struct host1x_client_stats gr2d;
+	struct host1x_client_stats gr3d;
+
+	/* BOs handed out and given back, including BO cache hits */
+	uint64_t bo_creates;
+	uint64_t bo_frees;
+	/* BOs and bytes allocated from the kernel */
+	uint64_t bo_allocs;
+	uint64_t bo_bytes_allocated;
+};
+
+void host1x_get_stats(struct host1x *host1x, struct host1x_stats *stats);
+
+enum host1x_mem_category {
+	HOST1X_MEM_OTHER,
+	HOST1X_MEM_TEXTURE,
+	HOST1X_MEM_FRAMEBUFFER,
+	HOST1X_MEM_VERTEX,
+	HOST1X_MEM_COMMANDS,
+	/* guard areas of pixelbuffers, not part of the category of the BO */
+	HOST1X_MEM_GUARD,
+	/* released BOs kept by the BO cache */
+	HOST1X_MEM_CACHED,
+	HOST1X_MEM_NUM_CATEGORIES,
+};
+
+struct host1x_mem_category_stats {
+	uint64_t bytes;
+	uint64_t count;
+	/* high-water marks since host1x_open() */
+	uint64_t peak_bytes;
+	uint64_t peak_count;
+};
+
+/*
+ * Memory of the BOs allocated by libhost1x that is currently held, in
+ * the size classes the BOs were allocated from the kernel with. Imported
+ * and wrapped BOs aren't accounted.
+ */
+struct host1x_memory_stats {
+	/* "drm", "nvhost" or "dummy" */
+	const char *backend;
+	struct host1x_mem_category_stats categories[HOST1X_MEM_NUM_CATEGORIES];
+	struct host1x_mem_category_stats total;
+};
+
+void host1x_memory_stats(struct host1x *host1x,
+			 struct host1x_memory_stats *stats);
+void host1x_memory_stats_print(struct host1x *host1x, FILE *fp);
+const char *host1x_mem_category_name(enum host1x_mem_category category);
+
 struct host1x_framebuffer {
 	struct host1x_pixelbuffer *pixbuf;
 	unsigned long flags;
@@ -220,6 +412,24 @@ int host1x_display_get_resolution(struct host1x_display *display,
 int host1x_display_set(struct host1x_display *display,
 		       struct host1x_framebuffer *fb,
 		       bool vsync, bool reflect_y);
+int host1x_display_flip(struct host1x_display *display,
+			struct host1x_framebuffer *fb, bool reflect_y);
+int host1x_display_get_vblank(struct host1x_display *display,
+			      uint64_t *time, uint64_t *period);
+int host1x_display_wait_flip(struct host1x_display *display,
+			     uint32_t timeout);
+
+/* times are CLOCK_MONOTONIC in microseconds */
+struct host1x_display_events {
+	void (*flip)(void *data, uint64_t time);
+	void (*vblank)(void *data, uint64_t time);
+	void *data;
+};
+
+int host1x_display_get_event_fd(struct host1x_display *display);
+int host1x_display_request_vblank(struct host1x_display *display);
+int host1x_display_handle_events(struct host1x_display *display,
+				 const struct host1x_display_events *events);
 
 int host1x_overlay_create(struct host1x_overlay **overlayp,
 			  struct host1x_display *display);
@@ -228,6 +438,13 @@ int host1x_overlay_set(struct host1x_overlay *overlay,
 		       struct host1x_framebuffer *fb, unsigned int x,
 		       unsigned int y, unsigned int width,
 		       unsigned int height, bool vsync, bool reflect_y);
+int host1x_overlay_queue(struct host1x_overlay *overlay,
+			 struct host1x_framebuffer *fb, unsigned int x,
+			 unsigned int y, unsigned int width,
+			 unsigned int height, bool reflect_y);
+int host1x_overlay_wait(struct host1x_overlay *overlay, uint32_t timeout);
+bool host1x_overlay_supports(struct host1x_overlay *overlay,
+			     enum pixel_format format);
 
 struct host1x_bo *host1x_bo_create(struct host1x *host1x, size_t size,
 				   unsigned long flags);
@@ -239,8 +456,65 @@ int host1x_bo_invalidate(struct host1x_bo *bo, unsigned long offset,
 int host1x_bo_flush(struct host1x_bo *bo, unsigned long offset,
 		    size_t length);
 int host1x_bo_mmap(struct host1x_bo *bo, void **ptr);
+void host1x_bo_set_category(struct host1x_bo *bo,
+			    enum host1x_mem_category category);
+
+/*
+ * Flushes of BOs between begin and end are accumulated by backends that
+ * maintain the CPU caches by range, merged into one writeback per BO and
+ * issued right before the next submit or display flip, or by the end of
+ * the outermost batch. Batches nest.
+ */
+void host1x_bo_flush_batch_begin(struct host1x *host1x);
+int host1x_bo_flush_batch_end(struct host1x *host1x);
 int host1x_bo_export(struct host1x_bo *bo, uint32_t *handle);
+int host1x_bo_export_dmabuf(struct host1x_bo *bo, int *fd);
 struct host1x_bo *host1x_bo_import(struct host1x *host1x, uint32_t handle);
+struct host1x_bo *host1x_bo_import_dmabuf(struct host1x *host1x, int fd);
+
+/*
+ * Page-aligned memory the GPU can use without a copy, where the kernel
+ * allows it. host1x_bo_create_from_userptr() wraps memory of
+ * host1x_userptr_alloc() as a BO, other memory is copied into a new BO.
+ * The memory must outlive the BO.
+ */
+void *host1x_userptr_alloc(size_t size);
+void host1x_userptr_free(void *ptr);
+struct host1x_bo *host1x_bo_create_from_userptr(struct host1x *host1x,
+						void *ptr, size_t size,
+						unsigned long flags);
+
+/*
+ * View of a BO region. Unlike the wrapped BO it doesn't allocate anything
+ * and isn't freed, hence it can be placed on stack or embedded into other
+ * structures. The view is valid as long as the viewed BO is, offset is
+ * given relatively to the viewed BO, like for host1x_bo_wrap().
+ */
+struct host1x_bo_view {
+	struct host1x_bo *bo;
+	unsigned long offset;
+	size_t size;
+};
+
+static inline void host1x_bo_view_init(struct host1x_bo_view *view,
+				       struct host1x_bo *bo,
+				       unsigned long offset, size_t size)
+{
+	view->bo = bo;
+	view->offset = bo ? bo->offset + offset : 0;
+	view->size = size;
+}
+
+struct host1x_bo_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned int num_bos;
+	size_t size;
+};
+
+void host1x_bo_cache_get_stats(struct host1x *host1x,
+			       struct host1x_bo_cache_stats *stats);
+void host1x_bo_cache_trim(struct host1x *host1x);
 
 static inline struct host1x_bo *host1x_bo_create_helper(struct host1x *host1x,
 						size_t size, int flags,
@@ -301,6 +575,16 @@ static inline int host1x_bo_export_helper(struct host1x_bo *bo,
 	return err;
 }
 
+static inline int host1x_bo_export_dmabuf_helper(struct host1x_bo *bo,
+						 int *fd,
+						 const char *file, int line)
+{
+	int err = host1x_bo_export_dmabuf(bo, fd);
+	if (err)
+		host1x_error("host1x_bo_export_dmabuf() failed %d\n", err);
+	return err;
+}
+
 static inline struct host1x_bo *host1x_bo_import_helper(struct host1x *host1x,
 							uint32_t handle,
 							const char *file,
@@ -312,6 +596,16 @@ static inline struct host1x_bo *host1x_bo_import_helper(struct host1x *host1x,
 	return bo;
 }
 
+static inline struct host1x_bo *
+host1x_bo_import_dmabuf_helper(struct host1x *host1x, int fd,
+			       const char *file, int line)
+{
+	struct host1x_bo *bo = host1x_bo_import_dmabuf(host1x, fd);
+	if (!bo)
+		host1x_error("host1x_bo_import_dmabuf() failed\n");
+	return bo;
+}
+
 #define HOST1X_BO_CREATE(host1x, size, flags) \
 	host1x_bo_create_helper(host1x, size, flags, __FILE__, __LINE__)
 
@@ -330,9 +624,15 @@ static inline struct host1x_bo *host1x_bo_import_helper(struct host1x *host1x,
 #define HOST1X_BO_EXPORT(bo, handle) \
 	host1x_bo_export_helper(bo, handle, __FILE__, __LINE__)
 
+#define HOST1X_BO_EXPORT_DMABUF(bo, fd) \
+	host1x_bo_export_dmabuf_helper(bo, fd, __FILE__, __LINE__)
+
 #define HOST1X_BO_IMPORT(host1x, handle) \
 	host1x_bo_import_helper(host1x, handle, __FILE__, __LINE__)
 
+#define HOST1X_BO_IMPORT_DMABUF(host1x, fd) \
+	host1x_bo_import_dmabuf_helper(host1x, fd, __FILE__, __LINE__)
+
 #define HOST1X_OPCODE_SETCL(offset, classid, mask) \
 	((0x0 << 28) | (((offset) & 0xfff) << 16) | (((classid) & 0x3ff) << 6) | ((mask) & 0x3f))
 #define HOST1X_OPCODE_INCR(offset, count) \
@@ -351,6 +651,8 @@ struct host1x_pushbuf_reloc {
 	unsigned long target_handle;
 	unsigned long target_offset;
 	unsigned long shift;
+	/* BO that owns the memory, it is busy until the job is done */
+	struct host1x_bo *target;
 };
 
 struct host1x_pushbuf {
@@ -360,31 +662,96 @@ struct host1x_pushbuf {
 
 	struct host1x_pushbuf_reloc *relocs;
 	unsigned long num_relocs;
+	unsigned long max_relocs;
 
 	uint32_t *ptr;
+
+	/* the words run as a part of other jobs too, they can't be rewritten */
+	bool shared;
+
+	/* pushes past the end continue the pushbuf in a chained BO */
+	bool chainable;
+
+	/*
+	 * A pushbuf of a job that reaches the end of its memory continues in
+	 * chained command BOs, which are submitted right after it. Unbounded
+	 * if end is NULL.
+	 */
+	uint32_t *end;
+	struct host1x_pushbuf *chain;
+	unsigned int num_chain;
+	unsigned int max_chain;
+
+	/* the command being pushed, it's moved over to a chained BO whole */
+	uint32_t *cmd;
+	unsigned int pending;
+	uint32_t classid;
+
+	/* the chaining failed, words were dropped */
+	int error;
 };
 
 struct host1x_job {
 	uint32_t syncpt;
 	uint32_t syncpt_incrs;
+	/*
+	 * In milliseconds, 0 uses the timeout of the client. The hang
+	 * detection of host1x_client_wait() follows it on all backends, the
+	 * kernel enforces it on DRM only, nvhost channels have a timeout of
+	 * their own.
+	 */
+	uint32_t timeout;
 
 	struct host1x_pushbuf *pushbufs;
 	unsigned int num_pushbufs;
+	unsigned int max_pushbufs;
 };
 
 struct host1x_job *host1x_job_create(uint32_t syncpt, uint32_t increments);
+void host1x_job_reset(struct host1x_job *job);
 void host1x_job_free(struct host1x_job *job);
 struct host1x_pushbuf *host1x_job_append(struct host1x_job *job,
 					 struct host1x_bo *bo,
 					 unsigned long offset);
+struct host1x_pushbuf *host1x_job_append_pushbuf(struct host1x_job *job,
+						 const struct host1x_pushbuf *src);
 int host1x_pushbuf_push(struct host1x_pushbuf *pb, uint32_t word);
+uint32_t *host1x_pushbuf_cursor(struct host1x_pushbuf *pb);
+void host1x_pushbuf_count(struct host1x_pushbuf *pb, unsigned long *words,
+			  unsigned long *relocs);
 int host1x_pushbuf_relocate(struct host1x_pushbuf *pb, struct host1x_bo *target,
 			    unsigned long offset, unsigned long shift);
+int host1x_pushbuf_optimize(struct host1x_pushbuf *pb);
+void host1x_client_optimize_pushbufs(struct host1x_client *client,
+				     bool enable);
 int host1x_client_submit(struct host1x_client *client, struct host1x_job *job);
 int host1x_client_flush(struct host1x_client *client, uint32_t *fence);
 int host1x_client_wait(struct host1x_client *client, uint32_t fence,
 		       uint32_t timeout);
 
+struct host1x_fence {
+	struct host1x_client *client;
+	uint32_t value;
+};
+
+int host1x_client_read(struct host1x_client *client, uint32_t *value);
+int host1x_client_poll(struct host1x_client *client, uint32_t fence);
+int host1x_fences_wait(const struct host1x_fence *fences, unsigned int count,
+		       bool all, uint32_t timeout, uint32_t *elapsed);
+
+/* number of words pushed by host1x_pushbuf_wait() */
+#define HOST1X_PUSHBUF_WAIT_WORDS 4
+
+int host1x_pushbuf_wait(struct host1x_pushbuf *pb,
+			struct host1x_client *client, uint32_t fence,
+			uint32_t classid);
+
+int host1x_client_queue_start(struct host1x_client *client);
+void host1x_client_queue_stop(struct host1x_client *client);
+int host1x_client_queue_submit(struct host1x_client *client,
+			       struct host1x_job *job);
+int host1x_client_queue_drain(struct host1x_client *client, uint32_t *fence);
+
 static inline int host1x_pushbuf_push_float(struct host1x_pushbuf *pb, float f)
 {
 	union {
@@ -469,6 +836,11 @@ static inline int host1x_client_wait_helper(struct host1x_client *client,
 	host1x_pushbuf_relocate_helper(pb, target, offset, shift, \
 					__FILE__, __LINE__)
 
+#define HOST1X_PUSHBUF_RELOCATE_VIEW(pb, view, offset, shift) \
+	host1x_pushbuf_relocate_helper(pb, (view)->bo, \
+					(view)->offset + (offset), shift, \
+					__FILE__, __LINE__)
+
 #define HOST1X_CLIENT_SUBMIT(client, job) \
 	host1x_client_submit_helper(client, job, __FILE__, __LINE__)
 
@@ -489,6 +861,16 @@ int host1x_framebuffer_save(struct host1x *host1x,
 			    struct host1x_framebuffer *fb,
 			    const char *path);
 
+struct host1x_capture;
+
+struct host1x_capture *host1x_capture_create(struct host1x *host1x,
+					     unsigned int num_buffers);
+int host1x_capture_frame(struct host1x_capture *capture,
+			 struct host1x_framebuffer *fb, const char *path,
+			 struct host1x_fence *fence);
+int host1x_capture_flush(struct host1x_capture *capture);
+void host1x_capture_free(struct host1x_capture *capture);
+
 struct host1x_gr2d;
 struct host1x_gr3d;
 
@@ -506,6 +888,19 @@ int host1x_gr2d_blit(struct host1x_gr2d *gr2d,
 		     unsigned int sx, unsigned int sy,
 		     unsigned int dx, unsigned int dy,
 		     unsigned int width, int height);
+int host1x_gr2d_clear_rect_async(struct host1x_gr2d *gr2d,
+				 struct host1x_pixelbuffer *pixbuf,
+				 uint32_t color,
+				 unsigned x, unsigned y,
+				 unsigned width, unsigned height,
+				 uint32_t *fence);
+int host1x_gr2d_blit_async(struct host1x_gr2d *gr2d,
+			   struct host1x_pixelbuffer *src,
+			   struct host1x_pixelbuffer *dst,
+			   unsigned int sx, unsigned int sy,
+			   unsigned int dx, unsigned int dy,
+			   unsigned int width, int height,
+			   uint32_t *fence);
 int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 			     struct host1x_pixelbuffer *src,
 			     struct host1x_pixelbuffer *dst,
@@ -513,9 +908,143 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 			     unsigned int src_width, int src_height,
 			     unsigned int dx, unsigned int dy,
 			     unsigned int dst_width, int dst_height);
+int host1x_gr2d_surface_blit_async(struct host1x_gr2d *gr2d,
+				   struct host1x_pixelbuffer *src,
+				   struct host1x_pixelbuffer *dst,
+				   unsigned int sx, unsigned int sy,
+				   unsigned int src_width, int src_height,
+				   unsigned int dx, unsigned int dy,
+				   unsigned int dst_width, int dst_height,
+				   uint32_t *fence);
+
+/*
+ * Types of the GR2D fast rotate unit, the rotations are clockwise.
+ * Transpose mirrors along the main diagonal, anti-transpose along the
+ * other one.
+ */
+enum host1x_gr2d_rotation {
+	HOST1X_GR2D_FLIP_X,
+	HOST1X_GR2D_FLIP_Y,
+	HOST1X_GR2D_TRANSPOSE,
+	HOST1X_GR2D_ANTI_TRANSPOSE,
+	HOST1X_GR2D_ROTATE_90,
+	HOST1X_GR2D_ROTATE_180,
+	HOST1X_GR2D_ROTATE_270,
+	HOST1X_GR2D_ROTATE_0,
+};
+
+int host1x_gr2d_rotate_blit(struct host1x_gr2d *gr2d,
+			    struct host1x_pixelbuffer *src,
+			    struct host1x_pixelbuffer *dst,
+			    enum host1x_gr2d_rotation rotation,
+			    unsigned int sx, unsigned int sy,
+			    unsigned int dx, unsigned int dy,
+			    unsigned int width, unsigned int height);
+int host1x_gr2d_rotate_blit_async(struct host1x_gr2d *gr2d,
+				  struct host1x_pixelbuffer *src,
+				  struct host1x_pixelbuffer *dst,
+				  enum host1x_gr2d_rotation rotation,
+				  unsigned int sx, unsigned int sy,
+				  unsigned int dx, unsigned int dy,
+				  unsigned int width, unsigned int height,
+				  uint32_t *fence);
+
+int host1x_gr2d_upload(struct host1x_gr2d *gr2d,
+		       struct host1x_pixelbuffer *pixbuf,
+		       const void *data, unsigned data_pitch,
+		       unsigned long data_size,
+		       enum layout_format data_layout);
+int host1x_gr2d_upload_async(struct host1x_gr2d *gr2d,
+			     struct host1x_pixelbuffer *pixbuf,
+			     const void *data, unsigned data_pitch,
+			     unsigned long data_size,
+			     enum layout_format data_layout,
+			     uint32_t *fence);
+
+/*
+ * Planes of a YUV 4:2:0 frame as linear L8 pixelbuffers, the chroma planes
+ * are of half the size of the luma plane and have the same pitch. GR2D
+ * converts the frame to RGB while blitting it, with filtered scaling.
+ */
+struct host1x_yuv_frame {
+	struct host1x_pixelbuffer *y;
+	struct host1x_pixelbuffer *u;
+	struct host1x_pixelbuffer *v;
+};
+
+/* colour space of limited range YUV data */
+enum host1x_csc {
+	HOST1X_CSC_BT601,
+	HOST1X_CSC_BT709,
+};
+
+int host1x_gr2d_yuv_blit(struct host1x_gr2d *gr2d,
+			 const struct host1x_yuv_frame *src,
+			 enum host1x_csc csc,
+			 struct host1x_pixelbuffer *dst,
+			 unsigned int sx, unsigned int sy,
+			 unsigned int src_width, int src_height,
+			 unsigned int dx, unsigned int dy,
+			 unsigned int dst_width, int dst_height);
+int host1x_gr2d_yuv_blit_async(struct host1x_gr2d *gr2d,
+			       const struct host1x_yuv_frame *src,
+			       enum host1x_csc csc,
+			       struct host1x_pixelbuffer *dst,
+			       unsigned int sx, unsigned int sy,
+			       unsigned int src_width, int src_height,
+			       unsigned int dx, unsigned int dy,
+			       unsigned int dst_width, int dst_height,
+			       uint32_t *fence);
+
+struct host1x_gr2d_batch {
+	struct host1x_gr2d *gr2d;
+	struct host1x_job *job;
+	struct host1x_pushbuf *pb;
+};
+
+int host1x_gr2d_batch_begin(struct host1x_gr2d *gr2d,
+			    struct host1x_gr2d_batch *batch);
+int host1x_gr2d_batch_clear_rect(struct host1x_gr2d_batch *batch,
+				 struct host1x_pixelbuffer *pixbuf,
+				 uint32_t color,
+				 unsigned x, unsigned y,
+				 unsigned width, unsigned height);
+int host1x_gr2d_batch_blit(struct host1x_gr2d_batch *batch,
+			   struct host1x_pixelbuffer *src,
+			   struct host1x_pixelbuffer *dst,
+			   unsigned int sx, unsigned int sy,
+			   unsigned int dx, unsigned int dy,
+			   unsigned int width, int height);
+int host1x_gr2d_batch_surface_blit(struct host1x_gr2d_batch *batch,
+				   struct host1x_pixelbuffer *src,
+				   struct host1x_pixelbuffer *dst,
+				   unsigned int sx, unsigned int sy,
+				   unsigned int src_width, int src_height,
+				   unsigned int dx, unsigned int dy,
+				   unsigned int dst_width, int dst_height);
+int host1x_gr2d_batch_yuv_blit(struct host1x_gr2d_batch *batch,
+			       const struct host1x_yuv_frame *src,
+			       enum host1x_csc csc,
+			       struct host1x_pixelbuffer *dst,
+			       unsigned int sx, unsigned int sy,
+			       unsigned int src_width, int src_height,
+			       unsigned int dx, unsigned int dy,
+			       unsigned int dst_width, int dst_height);
+int host1x_gr2d_batch_rotate_blit(struct host1x_gr2d_batch *batch,
+				  struct host1x_pixelbuffer *src,
+				  struct host1x_pixelbuffer *dst,
+				  enum host1x_gr2d_rotation rotation,
+				  unsigned int sx, unsigned int sy,
+				  unsigned int dx, unsigned int dy,
+				  unsigned int width, unsigned int height);
+int host1x_gr2d_batch_submit(struct host1x_gr2d_batch *batch,
+			     uint32_t *fence);
 int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
 			 struct host1x_pixelbuffer *pixbuf);
 
+/* upper bound of words pushed by host1x_push_gr3d_reset() */
+#define HOST1X_GR3D_RESET_WORDS	512
+
 int host1x_push_gr3d_reset(struct host1x_pushbuf *pb);
 
 #endif
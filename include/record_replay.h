@@ -43,8 +43,22 @@ enum record_action {
 	REC_JOB_CTX_CREATE,
 	REC_JOB_CTX_DESTROY,
 	REC_JOB_SUBMIT,
+	REC_BO_LOAD_EXTENT,
+	REC_ZSTD_DICT,
+	REC_KEYFRAME,
+	REC_INDEX,
+	REC_INDEX_END,
+	REC_BO_LOAD_STORED,
 };
 
+/*
+ * Since version 7, the pages of every REC_BO_LOAD_EXTENT fill a ring of
+ * REC_PAGE_STORE_SIZE pages in record order and REC_BO_LOAD_STORED loads
+ * a page of the ring, which spares recording the same data again. The
+ * ring is emptied by every REC_KEYFRAME, replay may start at one.
+ */
+#define REC_PAGE_STORE_SIZE	4096
+
 struct __attribute__((packed)) record_gather {
 	uint16_t id;
 	uint16_t ctx_id;
@@ -64,6 +78,20 @@ enum record_compression {
 	REC_UNCOMPRESSED,
 	REC_ZLIB,
 	REC_LZ4,
+	REC_ZSTD,
+};
+
+enum record_index_type {
+	REC_INDEX_FRAME = 1,
+	REC_INDEX_JOB,
+	REC_INDEX_KEYFRAME,
+};
+
+/* file offset of an indexed action and the frame it belongs to */
+struct __attribute__((packed)) record_index_entry {
+	uint64_t offset;
+	uint32_t frame;
+	uint8_t type;
 };
 
 struct __attribute__((packed)) record_act {
@@ -109,6 +137,28 @@ struct __attribute__((packed)) record_act {
 			uint16_t data_size;
 		} bo_load;
 
+		/* since version 5, data_size 0 means uncompressed */
+		struct bo_load_extent {
+			uint16_t id;
+			uint16_t ctx_id;
+			uint32_t page_id;
+			uint32_t num_pages;
+			uint32_t data_size;
+		} bo_load_extent;
+
+		/* since version 7, a page of the ring of loaded pages */
+		struct bo_load_stored {
+			uint16_t id;
+			uint16_t ctx_id;
+			uint32_t page_id;
+			uint32_t slot;
+		} bo_load_stored;
+
+		/* followed by the dictionary used for REC_ZSTD extents */
+		struct zstd_dict {
+			uint32_t size;
+		} zstd_dict;
+
 		struct bo_set_flags {
 			uint16_t id;
 			uint16_t ctx_id;
@@ -130,9 +180,14 @@ struct __attribute__((packed)) record_act {
 			uint16_t ctx_id;
 		} del_framebuffer;
 
+		/*
+		 * Since version 6, CPU time in microseconds since the start
+		 * of recording.
+		 */
 		struct disp_framebuffer {
 			uint16_t bo_id;
 			uint16_t ctx_id;
+			uint64_t time;
 		} disp_framebuffer;
 
 		struct job_ctx_create {
@@ -144,12 +199,29 @@ struct __attribute__((packed)) record_act {
 			uint16_t id;
 		} job_ctx_destroy;
 
+		/* since version 6, time as of disp_framebuffer */
 		struct job_submit {
 			uint16_t job_ctx_id;
 			uint16_t num_gathers;
 			uint16_t num_relocs;
 			uint16_t num_syncpt_incrs;
+			uint64_t time;
 		} job_submit;
+
+		/* followed by loads of all non-zero pages of the live BOs */
+		struct keyframe {
+			uint32_t frame;
+		} keyframe;
+
+		/* followed by the entries, written when recording ends */
+		struct index {
+			uint32_t num_entries;
+		} index;
+
+		/* the last action of a record, points to REC_INDEX */
+		struct index_end {
+			uint64_t offset;
+		} index_end;
 	} data;
 };
 
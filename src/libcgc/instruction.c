@@ -33,42 +33,72 @@ struct instruction {
 	uint32_t *taken; /* bitmask of bits that are read */
 };
 
+static void instruction_init(struct instruction *inst, uint32_t *storage,
+			     const uint32_t *words, unsigned int count)
+{
+	unsigned int i;
+
+	inst->length = count * 32;
+	inst->bits = storage;
+	inst->taken = storage + count;
+
+	for (i = 0; i < count; i++)
+		inst->bits[i] = words[count - i - 1];
+}
+
 struct instruction *instruction_create_from_words(uint32_t *words,
 						  unsigned int count)
 {
 	struct instruction *inst;
-	unsigned int i;
 
-	inst = calloc(1, sizeof(*inst));
+	inst = calloc(1, sizeof(*inst) + sizeof(*words) * count * 2);
 	if (!inst)
 		return NULL;
 
-	inst->length = count * 32;
+	instruction_init(inst, (uint32_t *)(inst + 1), words, count);
 
-	inst->bits = malloc(sizeof(*words) * count);
-	if (!inst->bits) {
-		instruction_free(inst);
-		return NULL;
-	}
+	return inst;
+}
 
-	inst->taken = calloc(1, sizeof(*words) * count);
-	if (!inst->taken) {
-		instruction_free(inst);
+/*
+ * Decodes num instructions of count words each, which are laid out one
+ * after another, with a single allocation. The instructions are accessed
+ * with instruction_array_get() and freed with instruction_free_array().
+ */
+struct instruction *instruction_create_array(const uint32_t *words,
+					     unsigned int count,
+					     unsigned int num)
+{
+	struct instruction *insts;
+	uint32_t *storage;
+	unsigned int i;
+
+	insts = calloc(1, (sizeof(*insts) + sizeof(*words) * count * 2) * num);
+	if (!insts)
 		return NULL;
-	}
-	for (i = 0; i < count; i++)
-		inst->bits[i] = words[count - i - 1];
 
-	return inst;
+	storage = (uint32_t *)(insts + num);
+
+	for (i = 0; i < num; i++)
+		instruction_init(&insts[i], storage + i * count * 2,
+				 words + i * count, count);
+
+	return insts;
 }
 
-void instruction_free(struct instruction *inst)
+struct instruction *instruction_array_get(struct instruction *insts,
+					  unsigned int index)
 {
-	if (inst) {
-		free(inst->bits);
-		free(inst->taken);
-	}
+	return &insts[index];
+}
 
+void instruction_free_array(struct instruction *insts)
+{
+	free(insts);
+}
+
+void instruction_free(struct instruction *inst)
+{
 	free(inst);
 }
 
@@ -92,30 +122,35 @@ void instruction_print_unknown(struct instruction *inst)
 	printf(" |");
 }
 
-static unsigned int take(struct instruction *inst, unsigned int pos)
+static uint32_t field_mask(unsigned int bits)
 {
-	unsigned int word = pos / 32;
-	unsigned int bit = pos % 32;
-
-	inst->taken[word] |= (1u << bit);
-
-	return (inst->bits[word] & (1u << bit)) != 0;
+	return bits >= 32 ? ~0u : (1u << bits) - 1;
 }
 
 unsigned int instruction_get_bit(struct instruction *inst, unsigned int pos)
 {
+	unsigned int word = pos / 32;
+	unsigned int bit = pos % 32;
+
 	if (pos >= inst->length) {
 		fprintf(stderr, "WARNING: bit out of range: %u\n", pos);
 		return 0;
 	}
-	return take(inst, pos);
+
+	inst->taken[word] |= 1u << bit;
+
+	return (inst->bits[word] >> bit) & 1;
 }
 
+/* a field spans two words at most, the low part is in the first one */
 uint32_t instruction_extract(struct instruction *inst, unsigned int from,
 			     unsigned int to)
 {
-	unsigned int bits = to - from, i;
-	uint32_t value = 0;
+	unsigned int bits = to - from + 1;
+	unsigned int word = from / 32;
+	unsigned int shift = from % 32;
+	uint32_t mask = field_mask(bits);
+	uint32_t value;
 
 	if (to < from || bits > 32) {
 		fprintf(stderr, "WARNING: invalid bitfield: %u-%u\n", from,
@@ -128,11 +163,15 @@ uint32_t instruction_extract(struct instruction *inst, unsigned int from,
 		return 0;
 	}
 
-	for (i = from; i <= to; i++)
-		if (take(inst, i))
-			value |= 1u << (i - from);
+	value = inst->bits[word] >> shift;
+	inst->taken[word] |= mask << shift;
+
+	if (shift + bits > 32) {
+		value |= inst->bits[word + 1] << (32 - shift);
+		inst->taken[word + 1] |= mask >> (32 - shift);
+	}
 
-	return value;
+	return value & mask;
 }
 
 void instruction_set_bit(struct instruction *inst, unsigned int pos,
@@ -141,8 +180,10 @@ void instruction_set_bit(struct instruction *inst, unsigned int pos,
 	unsigned int word = pos / 32;
 	unsigned int bit = pos % 32;
 
-	if (pos >= inst->length)
+	if (pos >= inst->length) {
 		fprintf(stderr, "WARNING: bit out of range: %u\n", pos);
+		return;
+	}
 
 	inst->bits[word] &= ~(1u << bit);
 	inst->bits[word] |= (value & 1) << bit;
@@ -151,18 +192,29 @@ void instruction_set_bit(struct instruction *inst, unsigned int pos,
 void instruction_insert(struct instruction *inst, unsigned int from,
 			unsigned int to, uint32_t value)
 {
-	unsigned int bits = to - from, i;
+	unsigned int bits = to - from + 1;
+	unsigned int word = from / 32;
+	unsigned int shift = from % 32;
+	uint32_t mask = field_mask(bits);
 
-	if (to < from || bits > 32)
+	if (to < from || bits > 32) {
 		fprintf(stderr, "WARNING: invalid bitfield: %u-%u\n", from,
 			to);
+		return;
+	}
+
+	if (to >= inst->length) {
+		fprintf(stderr, "WARNING: bit out of range: %u\n", to);
+		return;
+	}
+
+	value &= mask;
 
-	for (i = from; i <= to; i++) {
-		unsigned int word = i / 32;
-		unsigned int bit = i % 32;
+	inst->bits[word] &= ~(mask << shift);
+	inst->bits[word] |= value << shift;
 
-		inst->bits[word] &= ~(1u << bit);
-		if (value & (1u << (i - from)))
-			inst->bits[word] |= (1u << bit);
+	if (shift + bits > 32) {
+		inst->bits[word + 1] &= ~(mask >> (32 - shift));
+		inst->bits[word + 1] |= value >> (32 - shift);
 	}
 }
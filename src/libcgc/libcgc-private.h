@@ -63,6 +63,12 @@ struct instruction;
 struct instruction *instruction_create_from_words(uint32_t *words,
 						  unsigned int count);
 void instruction_free(struct instruction *inst);
+struct instruction *instruction_create_array(const uint32_t *words,
+					     unsigned int count,
+					     unsigned int num);
+struct instruction *instruction_array_get(struct instruction *insts,
+					  unsigned int index);
+void instruction_free_array(struct instruction *insts);
 void instruction_print_raw(struct instruction *inst);
 void instruction_print_unknown(struct instruction *inst);
 unsigned int instruction_get_bit(struct instruction *inst, unsigned int pos);
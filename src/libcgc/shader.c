@@ -255,12 +255,18 @@ static void *memdup(const void *ptr, size_t size)
 static void vertex_shader_disassemble(struct cgc_shader *shader, FILE *fp)
 {
 	struct cgc_header *header = shader->binary;
+	struct instruction *insts;
 	const uint32_t *ptr;
 	unsigned int i, j;
 
 	ptr = shader->binary + header->binary_offset;
 	printf("  instructions:\n");
 
+	insts = instruction_create_array(ptr, 4,
+					 (header->binary_size + 15) / 16);
+	if (!insts)
+		return;
+
 	for (i = 0; i < header->binary_size; i += 16) {
 		uint32_t sx, sy, sz, sw, neg, op, constant, attribute, varying, abs;
 		uint32_t wx, wy, wz, ww, sat, write_varying, write_pred;
@@ -283,7 +289,7 @@ static void vertex_shader_disassemble(struct cgc_shader *shader, FILE *fp)
 
 		printf("\n");
 
-		inst = instruction_create_from_words(words, 4);
+		inst = instruction_array_get(insts, i / 16);
 
 		constant = instruction_extract(inst, 76, 83);
 		attribute = instruction_extract(inst, 72, 75);
@@ -540,9 +546,9 @@ static void vertex_shader_disassemble(struct cgc_shader *shader, FILE *fp)
 
 		if (instruction_get_bit(inst, 0))
 			printf("    done\n");
-
-		instruction_free(inst);
 	}
+
+	instruction_free_array(insts);
 }
 
 static uint32_t gpr_written[256];
@@ -22,20 +22,9 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include "cdma.h"
 #include "host1x.h"
 
-enum host1x_opcode {
-	HOST1X_OPCODE_SETCL,
-	HOST1X_OPCODE_INCR,
-	HOST1X_OPCODE_NONINCR,
-	HOST1X_OPCODE_MASK,
-	HOST1X_OPCODE_IMM,
-	HOST1X_OPCODE_RESTART,
-	HOST1X_OPCODE_GATHER,
-	HOST1X_OPCODE_EXTEND = 14,
-	HOST1X_OPCODE_CHDONE = 15,
-};
-
 void host1x_stream_init(struct host1x_stream *stream, const void *buffer,
 			size_t size)
 {
@@ -43,97 +32,49 @@ void host1x_stream_init(struct host1x_stream *stream, const void *buffer,
 	stream->end = buffer + size;
 }
 
-void host1x_stream_interpret(struct host1x_stream *stream)
+static void host1x_stream_op(void *user, const struct cdma_op *op)
 {
-	while (stream->ptr < stream->end) {
-		uint32_t instr = *stream->ptr++;
-		uint32_t opcode = (instr >> 28) & 0xf;
-		uint16_t offset, classid, count, mask, value, i;
-
-		switch (opcode) {
-		case HOST1X_OPCODE_SETCL:
-			offset = (instr >> 16) & 0xfff;
-			classid = (instr >> 6) & 0x3ff;
-			mask = instr & 0x3f;
-
-			stream->classid = classid;
-
-			for (i = 0; i < 16; i++)
-				if (mask & BIT(i))
-					stream->write_word(stream->user,
-					                   stream->classid,
-					                   offset + i,
-					                   *stream->ptr++);
-
-			break;
-
-		case HOST1X_OPCODE_INCR:
-			offset = (instr >> 16) & 0xfff;
-			count = instr & 0xffff;
-
-			for (i = 0; i < count; i++)
-				stream->write_word(stream->user,
-				                   stream->classid,
-				                   offset + i,
-				                   *stream->ptr++);
-
-			break;
-
-		case HOST1X_OPCODE_NONINCR:
-			offset = (instr >> 16) & 0xfff;
-			count = instr & 0xffff;
-
-			for (i = 0; i < count; i++)
-				stream->write_word(stream->user,
-				                   stream->classid,
-				                   offset,
-				                   *stream->ptr++);
-
-			break;
-
-		case HOST1X_OPCODE_MASK:
-			offset = (instr >> 16) & 0xfff;
-			mask = instr & 0xffff;
-
-			for (i = 0; i < 16; i++)
-				if (mask & BIT(i))
-					stream->write_word(stream->user,
-					                   stream->classid,
-					                   offset + i,
-					                   *stream->ptr++);
-
-			break;
+	switch (op->opcode) {
+	case CDMA_OPCODE_RESTART:
+	case CDMA_OPCODE_GATHER:
+	case CDMA_OPCODE_EXTEND:
+	case CDMA_OPCODE_CHDONE:
+		fprintf(stderr, "%s\n", cdma_opcode_names[op->opcode]);
+		break;
+
+	default:
+		break;
+	}
+}
 
-		case HOST1X_OPCODE_IMM:
-			offset = (instr >> 16) & 0xfff;
-			value = instr & 0xffff;
+static void host1x_stream_write(void *user, uint32_t classid,
+				uint32_t offset, uint32_t value)
+{
+	struct host1x_stream *stream = user;
 
-			stream->write_word(stream->user,
-			                   stream->classid,
-			                   offset,
-			                   value);
+	stream->write_word(stream->user, classid, offset, value);
+}
 
-			break;
+static void host1x_stream_error(void *user, uint32_t word)
+{
+	fprintf(stderr, "UNKNOWN: 0x%08x\n", word);
+}
 
-		case HOST1X_OPCODE_RESTART:
-			fprintf(stderr, "HOST1X_OPCODE_RESTART\n");
-			break;
+static const struct cdma_visitor host1x_stream_visitor = {
+	.op = host1x_stream_op,
+	.write = host1x_stream_write,
+	.error = host1x_stream_error,
+};
 
-		case HOST1X_OPCODE_GATHER:
-			fprintf(stderr, "HOST1X_OPCODE_GATHER\n");
-			break;
+void host1x_stream_interpret(struct host1x_stream *stream)
+{
+	struct cdma_decoder dec;
 
-		case HOST1X_OPCODE_EXTEND:
-			fprintf(stderr, "HOST1X_OPCODE_EXTEND\n");
-			break;
+	cdma_decoder_init(&dec, &host1x_stream_visitor, stream,
+			  stream->classid);
 
-		case HOST1X_OPCODE_CHDONE:
-			fprintf(stderr, "HOST1X_OPCODE_CHDONE\n");
-			break;
+	cdma_decode(&dec, stream->ptr, stream->end - stream->ptr);
 
-		default:
-			fprintf(stderr, "UNKNOWN: 0x%08x\n", instr);
-			return;
-		}
-	}
+	stream->classid = dec.classid;
+	stream->ptr = stream->end;
 }
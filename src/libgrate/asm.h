@@ -18,15 +18,20 @@
 #ifndef GRATE_ASM_H
 #define GRATE_ASM_H
 
+#include <stdbool.h>
+
 #include "fragment_asm.h"
 #include "linker_asm.h"
 #include "vpe_vliw.h"
 
 struct yy_buffer_state;
 
-extern struct yy_buffer_state *vertex_asm_scan_string(const char *);
-extern int vertex_asmparse(void);
-extern int vertex_asmlex_destroy(void);
+extern int vertex_asmlex_init(void **scanner);
+extern struct yy_buffer_state *vertex_asm_scan_string(const char *str,
+						      void *scanner);
+extern void vertex_asmset_lineno(int lineno, void *scanner);
+extern int vertex_asmparse(void *scanner);
+extern int vertex_asmlex_destroy(void *scanner);
 
 struct asm_vec_component {
 	uint32_t value;
@@ -53,42 +58,45 @@ typedef struct asm_in_out {
 	};
 } asm_in_out;
 
-extern vpe_instr128 asm_vs_instructions[256];
-extern asm_const asm_vs_constants[256];
-extern asm_in_out asm_vs_attributes[16];
-extern asm_in_out asm_vs_exports[16];
-extern asm_in_out asm_vs_uniforms[256];
-extern int asm_vs_instructions_nb;
+extern __thread vpe_instr128 asm_vs_instructions[256];
+extern __thread asm_const asm_vs_constants[256];
+extern __thread asm_in_out asm_vs_attributes[16];
+extern __thread asm_in_out asm_vs_exports[16];
+extern __thread asm_in_out asm_vs_uniforms[256];
+extern __thread int asm_vs_instructions_nb;
 
 const char * vpe_vliw_disassemble(const vpe_instr128 *ins);
 
-extern struct yy_buffer_state *fragment_asm_scan_string(const char *);
-extern int fragment_asmparse(void);
-extern int fragment_asmlex_destroy(void);
+extern int fragment_asmlex_init(void **scanner);
+extern struct yy_buffer_state *fragment_asm_scan_string(const char *str,
+							void *scanner);
+extern void fragment_asmset_lineno(int lineno, void *scanner);
+extern int fragment_asmparse(void *scanner);
+extern int fragment_asmlex_destroy(void *scanner);
 
-extern pseq_instr	asm_pseq_instructions[64];
-extern mfu_instr	asm_mfu_instructions[64];
-extern tex_instr	asm_tex_instructions[64];
-extern alu_instr	asm_alu_instructions[64];
-extern dw_instr		asm_dw_instructions[64];
+extern __thread pseq_instr	asm_pseq_instructions[64];
+extern __thread mfu_instr	asm_mfu_instructions[64];
+extern __thread tex_instr	asm_tex_instructions[64];
+extern __thread alu_instr	asm_alu_instructions[64];
+extern __thread dw_instr		asm_dw_instructions[64];
 
-extern instr_sched	asm_mfu_sched[64];
-extern instr_sched	asm_alu_sched[64];
+extern __thread instr_sched	asm_mfu_sched[64];
+extern __thread instr_sched	asm_alu_sched[64];
 
-extern uint32_t		asm_fs_constants[32];
+extern __thread uint32_t		asm_fs_constants[32];
 
 #define FS_UNIFORM_FX10_LOW	1
 #define FS_UNIFORM_FX10_HIGH	2
 #define FS_UNIFORM_FP20		3
 
-extern asm_in_out	asm_fs_uniforms[32 * 2];
+extern __thread asm_in_out	asm_fs_uniforms[32 * 2];
 
-extern unsigned asm_fs_instructions_nb;
-extern unsigned asm_mfu_instructions_nb;
-extern unsigned asm_alu_instructions_nb;
+extern __thread unsigned asm_fs_instructions_nb;
+extern __thread unsigned asm_mfu_instructions_nb;
+extern __thread unsigned asm_alu_instructions_nb;
 
-extern unsigned asm_alu_buffer_size;
-extern unsigned asm_pseq_to_dw_exec_nb;
+extern __thread unsigned asm_alu_buffer_size;
+extern __thread unsigned asm_pseq_to_dw_exec_nb;
 
 const char * fragment_pipeline_disassemble(
 	const pseq_instr *pseq,
@@ -97,16 +105,48 @@ const char * fragment_pipeline_disassemble(
 	const alu_instr *alu, unsigned alu_nb,
 	const dw_instr *dw);
 
-extern int asm_discards_fragment;
+extern __thread int asm_discards_fragment;
+
+/* fragment program decoded from the command stream of the assembler */
+#define FP_MAX_BATCHES		64
+#define FP_MAX_MFU		3
+#define FP_MAX_ALU		3
+
+struct fp_batch {
+	pseq_instr pseq;
+	mfu_instr mfu[FP_MAX_MFU];
+	unsigned mfu_nb;
+	tex_instr tex;
+	alu_instr alu[FP_MAX_ALU];
+	unsigned alu_nb;
+	uint32_t complement;
+	dw_instr dw;
+};
+
+struct fp_program {
+	struct fp_batch batches[FP_MAX_BATCHES];
+	unsigned batches_nb;
+	unsigned mfu_nb;
+	unsigned alu_nb;
+	bool t114;
+};
+
+struct grate_shader;
+
+int fp_program_decode(const struct grate_shader *fs, struct fp_program *prog);
+bool fp_alu_slot_nop(const union fragment_alu_instruction *slot);
 
-extern struct yy_buffer_state *linker_asm_scan_string(const char *);
-extern int linker_asmparse(void);
-extern int linker_asmlex_destroy(void);
+extern int linker_asmlex_init(void **scanner);
+extern struct yy_buffer_state *linker_asm_scan_string(const char *str,
+						      void *scanner);
+extern void linker_asmset_lineno(int lineno, void *scanner);
+extern int linker_asmparse(void *scanner);
+extern int linker_asmlex_destroy(void *scanner);
 
-extern link_instr	asm_linker_instructions[32];
+extern __thread link_instr	asm_linker_instructions[32];
 
-extern unsigned asm_linker_instructions_nb;
-extern unsigned asm_linker_used_tram_rows_nb;
+extern __thread unsigned asm_linker_instructions_nb;
+extern __thread unsigned asm_linker_used_tram_rows_nb;
 
 const char * linker_instruction_disassemble(const link_instr *instr);
 
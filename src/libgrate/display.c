@@ -22,6 +22,8 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <errno.h>
+
 #include "../libhost1x/host1x-private.h"
 #include "libgrate-private.h"
 
@@ -48,8 +50,12 @@ struct grate_display *grate_display_open(struct grate *grate)
 		return NULL;
 	}
 
-	if (display->base->needs_explicit_vsync)
+	if (display->base->needs_explicit_vsync) {
+		if (grate->options->present_mode == GRATE_PRESENT_IMMEDIATE)
+			grate->options->present_mode = GRATE_PRESENT_FIFO;
+
 		grate->options->vsync = true;
+	}
 
 	return display;
 }
@@ -72,6 +78,53 @@ void grate_display_show(struct grate_display *display,
 	host1x_display_set(display->base, fb->front, vsync, reflect_y);
 }
 
+void grate_display_flip(struct grate_display *display,
+			struct grate_framebuffer *fb, bool reflect_y)
+{
+	int err;
+
+	err = host1x_display_flip(display->base, fb->front, reflect_y);
+	if (err < 0)
+		grate_error("host1x_display_flip() failed: %d\n", err);
+}
+
+int grate_display_get_vblank(struct grate_display *display,
+			     uint64_t *time, uint64_t *period)
+{
+	return host1x_display_get_vblank(display->base, time, period);
+}
+
+int grate_display_get_event_fd(struct grate_display *display)
+{
+	return host1x_display_get_event_fd(display->base);
+}
+
+int grate_display_request_vblank(struct grate_display *display)
+{
+	return host1x_display_request_vblank(display->base);
+}
+
+int grate_display_handle_events(struct grate_display *display,
+				const struct host1x_display_events *events)
+{
+	return host1x_display_handle_events(display->base, events);
+}
+
+void grate_display_wait_flip(struct grate_display *display)
+{
+	int err;
+
+	err = host1x_display_wait_flip(display->base, 1000);
+	if (err < 0)
+		grate_error("host1x_display_wait_flip() failed: %d\n", err);
+}
+
+/* polls for the completion of the last flip without blocking */
+bool grate_display_flip_pending(struct grate_display *display)
+{
+	return host1x_display_wait_flip(display->base, 0) == -ETIMEDOUT;
+}
+
 struct grate_overlay *grate_overlay_create(struct grate_display *display)
 {
 	struct grate_overlay *overlay;
@@ -111,3 +164,25 @@ void grate_overlay_show(struct grate_overlay *overlay,
 	if (err < 0)
 		grate_error("host1x_overlay_set() failed: %d\n", err);
 }
+
+/* non-blocking, see host1x_overlay_queue() */
+int grate_overlay_queue(struct grate_overlay *overlay,
+			struct grate_framebuffer *fb, unsigned int x,
+			unsigned int y, unsigned int width,
+			unsigned int height, bool reflect_y)
+{
+	return host1x_overlay_queue(overlay->base, fb->front, x, y, width,
+				    height, reflect_y);
+}
+
+int grate_overlay_wait(struct grate_overlay *overlay, uint32_t timeout)
+{
+	return host1x_overlay_wait(overlay->base, timeout);
+}
+
+bool grate_overlay_supports(struct grate_overlay *overlay,
+			    struct grate_framebuffer *fb)
+{
+	return host1x_overlay_supports(overlay->base,
+				       fb->front->pixbuf->format);
+}
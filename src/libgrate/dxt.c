@@ -0,0 +1,521 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "host1x.h"
+
+#include "dxt.h"
+
+/*
+ * Range fit DXT encoder, a run-time alternative to squish for textures
+ * that don't need the best quality. Blocks are independent, so stripes of
+ * block rows are encoded by separate threads into disjoint parts of the
+ * output, which gives the same result as a single-threaded encode.
+ */
+
+#define DXT_MAX_THREADS		8
+#define DXT_MIN_ROWS_PER_THREAD	16
+
+struct dxt_encode_job {
+	const uint8_t *in;
+	unsigned int width;
+	unsigned int height;
+	unsigned int pitch;
+	enum dxt_format format;
+	enum dxt_quality quality;
+	uint8_t *out;
+	unsigned int row_start;
+	unsigned int row_stop;
+};
+
+static unsigned int dxt_block_size(enum dxt_format format)
+{
+	return format == DXT_FORMAT_DXT1 ? 8 : 16;
+}
+
+size_t dxt_get_encoded_data_size(unsigned int width, unsigned int height,
+				 enum dxt_format format)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) *
+	       dxt_block_size(format);
+}
+
+/* pixels outside of the image replicate the last column and row */
+static void dxt_fetch_block(const struct dxt_encode_job *job,
+			    unsigned int bx, unsigned int by,
+			    uint8_t px[16][4])
+{
+	unsigned int x, y, sx, sy;
+	const uint8_t *row;
+
+	for (y = 0; y < 4; y++) {
+		sy = MIN(by * 4 + y, job->height - 1);
+		row = job->in + (size_t)sy * job->pitch;
+
+		for (x = 0; x < 4; x++) {
+			sx = MIN(bx * 4 + x, job->width - 1);
+			memcpy(px[y * 4 + x], row + sx * 4, 4);
+		}
+	}
+}
+
+static uint16_t dxt_pack_565(const float color[3])
+{
+	int r = color[0] * 31.0f / 255.0f + 0.5f;
+	int g = color[1] * 63.0f / 255.0f + 0.5f;
+	int b = color[2] * 31.0f / 255.0f + 0.5f;
+
+	r = r < 0 ? 0 : r > 31 ? 31 : r;
+	g = g < 0 ? 0 : g > 63 ? 63 : g;
+	b = b < 0 ? 0 : b > 31 ? 31 : b;
+
+	return r << 11 | g << 5 | b;
+}
+
+static void dxt_unpack_565(uint16_t c, int color[3])
+{
+	color[0] = (c >> 11 << 3) | (c >> 13);
+	color[1] = ((c >> 5 & 0x3f) << 2) | (c >> 9 & 0x3);
+	color[2] = ((c & 0x1f) << 3) | (c >> 2 & 0x7);
+}
+
+/* the four color mode palette, c0 > c1 */
+static void dxt_palette(uint16_t c0, uint16_t c1, int palette[4][3])
+{
+	unsigned int i;
+
+	dxt_unpack_565(c0, palette[0]);
+	dxt_unpack_565(c1, palette[1]);
+
+	for (i = 0; i < 3; i++) {
+		palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+		palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+	}
+}
+
+#ifdef __ARM_NEON
+static inline int32x4_t dxt_lanes(uint8x16_t v, unsigned int i)
+{
+	uint16x8_t h = vmovl_u8(i < 2 ? vget_low_u8(v) : vget_high_u8(v));
+
+	return vreinterpretq_s32_u32(vmovl_u16(i & 1 ? vget_high_u16(h) :
+						       vget_low_u16(h)));
+}
+
+/* four pixels at a time against each palette entry */
+static uint32_t dxt_color_indices(const uint8_t px[16][4],
+				  const int palette[4][3],
+				  unsigned int *error)
+{
+	uint8x16x4_t p = vld4q_u8(&px[0][0]);
+	int32_t dist[16];
+	uint32_t idx[16];
+	uint32_t indices = 0;
+	unsigned int i, k;
+
+	*error = 0;
+
+	for (i = 0; i < 4; i++) {
+		int32x4_t r = dxt_lanes(p.val[0], i);
+		int32x4_t g = dxt_lanes(p.val[1], i);
+		int32x4_t b = dxt_lanes(p.val[2], i);
+		int32x4_t best = vdupq_n_s32(INT32_MAX);
+		uint32x4_t best_idx = vdupq_n_u32(0);
+
+		for (k = 0; k < 4; k++) {
+			int32x4_t dr = vsubq_s32(r, vdupq_n_s32(palette[k][0]));
+			int32x4_t dg = vsubq_s32(g, vdupq_n_s32(palette[k][1]));
+			int32x4_t db = vsubq_s32(b, vdupq_n_s32(palette[k][2]));
+			int32x4_t d = vmulq_s32(dr, dr);
+			uint32x4_t less;
+
+			d = vmlaq_s32(d, dg, dg);
+			d = vmlaq_s32(d, db, db);
+
+			less = vcltq_s32(d, best);
+			best = vbslq_s32(less, d, best);
+			best_idx = vbslq_u32(less, vdupq_n_u32(k), best_idx);
+		}
+
+		vst1q_s32(dist + i * 4, best);
+		vst1q_u32(idx + i * 4, best_idx);
+	}
+
+	for (i = 0; i < 16; i++) {
+		indices |= idx[i] << (i * 2);
+		*error += dist[i];
+	}
+
+	return indices;
+}
+#else
+static uint32_t dxt_color_indices(const uint8_t px[16][4],
+				  const int palette[4][3],
+				  unsigned int *error)
+{
+	uint32_t indices = 0;
+	unsigned int i, k;
+	int best, d, dr, dg, db;
+	uint32_t best_idx;
+
+	*error = 0;
+
+	for (i = 0; i < 16; i++) {
+		best = INT32_MAX;
+		best_idx = 0;
+
+		for (k = 0; k < 4; k++) {
+			dr = px[i][0] - palette[k][0];
+			dg = px[i][1] - palette[k][1];
+			db = px[i][2] - palette[k][2];
+			d = dr * dr + dg * dg + db * db;
+
+			if (d < best) {
+				best = d;
+				best_idx = k;
+			}
+		}
+
+		indices |= best_idx << (i * 2);
+		*error += best;
+	}
+
+	return indices;
+}
+#endif
+
+/*
+ * Endpoints of the range the block colors span along their principal
+ * axis, which is found by a few power iterations on the covariance.
+ */
+static void dxt_range_fit(const uint8_t px[16][4], float start[3],
+			  float end[3])
+{
+	float mean[3] = { 0 }, cov[6] = { 0 }, axis[3], v[3];
+	float min = 0.0f, max = 0.0f, d, len;
+	unsigned int i, k;
+
+	for (i = 0; i < 16; i++)
+		for (k = 0; k < 3; k++)
+			mean[k] += px[i][k] / 16.0f;
+
+	for (i = 0; i < 16; i++) {
+		for (k = 0; k < 3; k++)
+			v[k] = px[i][k] - mean[k];
+
+		cov[0] += v[0] * v[0];
+		cov[1] += v[0] * v[1];
+		cov[2] += v[0] * v[2];
+		cov[3] += v[1] * v[1];
+		cov[4] += v[1] * v[2];
+		cov[5] += v[2] * v[2];
+	}
+
+	axis[0] = axis[1] = axis[2] = 1.0f;
+
+	for (i = 0; i < 4; i++) {
+		v[0] = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		v[1] = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		v[2] = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+
+		len = MAX(MAX(fabsf(v[0]), fabsf(v[1])), fabsf(v[2]));
+		if (len < 1e-6f)
+			break;
+
+		for (k = 0; k < 3; k++)
+			axis[k] = v[k] / len;
+	}
+
+	for (i = 0; i < 16; i++) {
+		d = 0.0f;
+
+		for (k = 0; k < 3; k++)
+			d += (px[i][k] - mean[k]) * axis[k];
+
+		if (i == 0 || d < min)
+			min = d;
+		if (i == 0 || d > max)
+			max = d;
+	}
+
+	len = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+	for (k = 0; k < 3; k++) {
+		start[k] = mean[k] + axis[k] * max / len;
+		end[k] = mean[k] + axis[k] * min / len;
+	}
+}
+
+/* least squares endpoints for the chosen indices, false if degenerate */
+static bool dxt_refine(const uint8_t px[16][4], uint32_t indices,
+		       float start[3], float end[3])
+{
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3, 1.0f / 3 };
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f, det;
+	float ax[3] = { 0 }, bx[3] = { 0 };
+	unsigned int i, k;
+	float w;
+
+	for (i = 0; i < 16; i++) {
+		w = weights[indices >> (i * 2) & 0x3];
+
+		aa += w * w;
+		bb += (1.0f - w) * (1.0f - w);
+		ab += w * (1.0f - w);
+
+		for (k = 0; k < 3; k++) {
+			ax[k] += w * px[i][k];
+			bx[k] += (1.0f - w) * px[i][k];
+		}
+	}
+
+	det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f)
+		return false;
+
+	for (k = 0; k < 3; k++) {
+		start[k] = (ax[k] * bb - bx[k] * ab) / det;
+		end[k] = (bx[k] * aa - ax[k] * ab) / det;
+	}
+
+	return true;
+}
+
+static uint32_t dxt_encode_endpoints(const uint8_t px[16][4],
+				     const float start[3], const float end[3],
+				     uint16_t *c0, uint16_t *c1,
+				     unsigned int *error)
+{
+	int palette[4][3];
+	unsigned int i;
+	uint16_t tmp;
+
+	*c0 = dxt_pack_565(start);
+	*c1 = dxt_pack_565(end);
+
+	if (*c0 < *c1) {
+		tmp = *c0;
+		*c0 = *c1;
+		*c1 = tmp;
+	}
+
+	dxt_palette(*c0, *c1, palette);
+
+	/* equal endpoints select the three color mode, only c0 is used */
+	for (i = 1; *c0 == *c1 && i < 4; i++)
+		memcpy(palette[i], palette[0], sizeof(palette[0]));
+
+	return dxt_color_indices(px, palette, error);
+}
+
+static void dxt_encode_color_block(const uint8_t px[16][4],
+				   enum dxt_quality quality, uint8_t *out)
+{
+	unsigned int error, refined_error;
+	uint32_t indices, refined;
+	float start[3], end[3];
+	uint16_t c0, c1, r0, r1;
+
+	dxt_range_fit(px, start, end);
+	indices = dxt_encode_endpoints(px, start, end, &c0, &c1, &error);
+
+	if (quality == DXT_QUALITY_MEDIUM && error &&
+	    dxt_refine(px, indices, start, end)) {
+		refined = dxt_encode_endpoints(px, start, end, &r0, &r1,
+					       &refined_error);
+		if (refined_error < error) {
+			indices = refined;
+			c0 = r0;
+			c1 = r1;
+		}
+	}
+
+	out[0] = c0;
+	out[1] = c0 >> 8;
+	out[2] = c1;
+	out[3] = c1 >> 8;
+	out[4] = indices;
+	out[5] = indices >> 8;
+	out[6] = indices >> 16;
+	out[7] = indices >> 24;
+}
+
+/* explicit 4-bit alpha */
+static void dxt_encode_dxt3_alpha(const uint8_t px[16][4], uint8_t *out)
+{
+	unsigned int i, lo, hi;
+
+	for (i = 0; i < 8; i++) {
+		lo = (px[i * 2][3] * 15 + 127) / 255;
+		hi = (px[i * 2 + 1][3] * 15 + 127) / 255;
+		out[i] = hi << 4 | lo;
+	}
+}
+
+/* interpolated alpha in the eight value mode, a0 > a1 */
+static void dxt_encode_dxt5_alpha(const uint8_t px[16][4], uint8_t *out)
+{
+	unsigned int i, k, a0 = 0, a1 = 255, best, best_idx;
+	uint64_t indices = 0;
+	int palette[8], d;
+
+	for (i = 0; i < 16; i++) {
+		a0 = MAX(a0, px[i][3]);
+		a1 = MIN(a1, px[i][3]);
+	}
+
+	out[0] = a0;
+	out[1] = a1;
+
+	if (a0 != a1) {
+		palette[0] = a0;
+		palette[1] = a1;
+
+		for (k = 2; k < 8; k++)
+			palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+
+		for (i = 0; i < 16; i++) {
+			best = ~0u;
+			best_idx = 0;
+
+			for (k = 0; k < 8; k++) {
+				d = abs((int)px[i][3] - palette[k]);
+
+				if ((unsigned int)d < best) {
+					best = d;
+					best_idx = k;
+				}
+			}
+
+			indices |= (uint64_t)best_idx << (i * 3);
+		}
+	}
+
+	for (i = 0; i < 6; i++)
+		out[2 + i] = indices >> (i * 8);
+}
+
+static void dxt_encode_rows(const struct dxt_encode_job *job)
+{
+	unsigned int bw = (job->width + 3) / 4, bx, by;
+	unsigned int size = dxt_block_size(job->format);
+	uint8_t px[16][4];
+	uint8_t *out;
+
+	for (by = job->row_start; by < job->row_stop; by++) {
+		out = job->out + (size_t)by * bw * size;
+
+		for (bx = 0; bx < bw; bx++, out += size) {
+			dxt_fetch_block(job, bx, by, px);
+
+			switch (job->format) {
+			case DXT_FORMAT_DXT1:
+				dxt_encode_color_block(px, job->quality, out);
+				break;
+			case DXT_FORMAT_DXT3:
+				dxt_encode_dxt3_alpha(px, out);
+				dxt_encode_color_block(px, job->quality,
+						       out + 8);
+				break;
+			case DXT_FORMAT_DXT5:
+				dxt_encode_dxt5_alpha(px, out);
+				dxt_encode_color_block(px, job->quality,
+						       out + 8);
+				break;
+			}
+		}
+	}
+}
+
+static void *dxt_encode_thread(void *data)
+{
+	dxt_encode_rows(data);
+
+	return NULL;
+}
+
+int dxt_encode_image(const uint8_t *in, unsigned int width,
+		     unsigned int height, unsigned int pitch,
+		     enum dxt_format format, enum dxt_quality quality,
+		     uint8_t *out)
+{
+	struct dxt_encode_job jobs[DXT_MAX_THREADS + 1];
+	unsigned int rows = (height + 3) / 4;
+	pthread_t threads[DXT_MAX_THREADS];
+	bool started[DXT_MAX_THREADS];
+	unsigned int num_threads, row = 0, i;
+	long cpus;
+
+	if (!width || !height || format > DXT_FORMAT_DXT5 ||
+	    quality > DXT_QUALITY_MEDIUM)
+		return -EINVAL;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	num_threads = rows / DXT_MIN_ROWS_PER_THREAD;
+
+	if (cpus > 0 && num_threads >= (unsigned long)cpus)
+		num_threads = cpus - 1;
+
+	num_threads = MIN(num_threads, DXT_MAX_THREADS);
+
+	for (i = 0; i <= num_threads; i++) {
+		jobs[i].in = in;
+		jobs[i].width = width;
+		jobs[i].height = height;
+		jobs[i].pitch = pitch;
+		jobs[i].format = format;
+		jobs[i].quality = quality;
+		jobs[i].out = out;
+		jobs[i].row_start = row;
+
+		row += rows / (num_threads + 1);
+		jobs[i].row_stop = i == num_threads ? rows : row;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		started[i] = !pthread_create(&threads[i], NULL,
+					     dxt_encode_thread, &jobs[i]);
+		if (!started[i])
+			dxt_encode_rows(&jobs[i]);
+	}
+
+	/* the calling thread takes the last stripe */
+	dxt_encode_rows(&jobs[num_threads]);
+
+	for (i = 0; i < num_threads; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef GRATE_DXT_H
+#define GRATE_DXT_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum dxt_format {
+	DXT_FORMAT_DXT1,
+	DXT_FORMAT_DXT3,
+	DXT_FORMAT_DXT5,
+};
+
+enum dxt_quality {
+	/* endpoints of the principal axis of the block colors */
+	DXT_QUALITY_FAST,
+	/* the above, refined by a least squares fit to the chosen indices */
+	DXT_QUALITY_MEDIUM,
+};
+
+size_t dxt_get_encoded_data_size(unsigned int width, unsigned int height,
+				 enum dxt_format format);
+
+/*
+ * Encodes RGBA8888 data, the blocks are stored in the order of the input
+ * rows. Stripes of block rows are encoded in parallel.
+ */
+int dxt_encode_image(const uint8_t *in, unsigned int width,
+		     unsigned int height, unsigned int pitch,
+		     enum dxt_format format, enum dxt_quality quality,
+		     uint8_t *out);
+
+#endif
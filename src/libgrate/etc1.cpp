@@ -12,7 +12,14 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "etc1.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 /* From http://www.khronos.org/registry/gles/extensions/OES/OES_compressed_ETC1_RGB8_texture.txt
  The number of bits that represent a 4x4 texel block is 64 bits if
  <internalformat> is given by ETC1_RGB8_OES.
@@ -154,11 +161,51 @@ void decode_subblock(etc1_byte* pOut, int r, int g, int b, const int* table,
         *q++ = clamp(b + delta);
     }
 }
-// Input is an ETC1 compressed version of the data.
-// Output is a 4 x 4 square of 3-byte pixels in form R, G, B
-void etc1_decode_block(const etc1_byte* pIn, etc1_byte* pOut) {
-    etc1_uint32 high = (pIn[0] << 24) | (pIn[1] << 16) | (pIn[2] << 8) | pIn[3];
-    etc1_uint32 low = (pIn[4] << 24) | (pIn[5] << 16) | (pIn[6] << 8) | pIn[7];
+#ifdef __ARM_NEON
+// Lane p of the vectors below is the output pixel (x, y) = (p & 3, p >> 2),
+// whose index bits are bit k = y + x * 4 of either half of the low word.
+static const etc1_byte kPixelByte[16] = {
+    0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1 };
+static const etc1_byte kPixelMask[16] = {
+    1, 16, 1, 16, 2, 32, 2, 32, 4, 64, 4, 64, 8, 128, 8, 128 };
+static const etc1_byte kSecondColumns[16] = {
+    0, 0, 0xff, 0xff, 0, 0, 0xff, 0xff, 0, 0, 0xff, 0xff, 0, 0, 0xff, 0xff };
+static const etc1_byte kSecondRows[16] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+static inline uint8x16_t lookup16(uint8x8_t table, uint8x16_t index) {
+    return vcombine_u8(vtbl1_u8(table, vget_low_u8(index)),
+            vtbl1_u8(table, vget_high_u8(index)));
+}
+// Decodes both sub-blocks at once. The modifiers are applied to the base
+// colors with saturating byte arithmetic, which clamps like the scalar
+// version: the index MSB selects a negative modifier, the LSB a large one.
+static void decode_subblocks(etc1_byte* pOut, const int* rgb1,
+        const int* rgb2, const int* tableA, const int* tableB,
+        etc1_uint32 low, bool flipped) {
+    uint8x8_t bits = vcreate_u8(low);
+    uint8x16_t byteIndex = vld1q_u8(kPixelByte);
+    uint8x16_t mask = vld1q_u8(kPixelMask);
+    uint8x16_t lsb = vtstq_u8(lookup16(bits, byteIndex), mask);
+    uint8x16_t msb = vtstq_u8(lookup16(bits,
+            vaddq_u8(byteIndex, vdupq_n_u8(2))), mask);
+    uint8x16_t second = vld1q_u8(flipped ? kSecondRows : kSecondColumns);
+    const etc1_byte magnitudes[8] = {
+        (etc1_byte) tableA[0], (etc1_byte) tableA[1],
+        (etc1_byte) tableB[0], (etc1_byte) tableB[1], 0, 0, 0, 0 };
+    uint8x16_t magnitude = lookup16(vld1_u8(magnitudes),
+            vorrq_u8(vandq_u8(lsb, vdupq_n_u8(1)),
+                    vandq_u8(second, vdupq_n_u8(2))));
+    uint8x16x3_t pixels;
+    for (int c = 0; c < 3; c++) {
+        uint8x16_t base = vbslq_u8(second, vdupq_n_u8(rgb2[c]),
+                vdupq_n_u8(rgb1[c]));
+        pixels.val[c] = vbslq_u8(msb, vqsubq_u8(base, magnitude),
+                vqaddq_u8(base, magnitude));
+    }
+    vst3q_u8(pOut, pixels);
+}
+#endif
+static void decode_block(etc1_uint32 high, etc1_uint32 low, etc1_byte* pOut) {
     int r1, r2, g1, g2, b1, b2;
     if (high & 2) {
         // differential
@@ -185,8 +232,33 @@ void etc1_decode_block(const etc1_byte* pIn, etc1_byte* pOut) {
     const int* tableA = kModifierTable + tableIndexA * 4;
     const int* tableB = kModifierTable + tableIndexB * 4;
     bool flipped = (high & 1) != 0;
+#ifdef __ARM_NEON
+    const int rgb1[3] = { r1, g1, b1 };
+    const int rgb2[3] = { r2, g2, b2 };
+    decode_subblocks(pOut, rgb1, rgb2, tableA, tableB, low, flipped);
+#else
     decode_subblock(pOut, r1, g1, b1, tableA, low, false, flipped);
     decode_subblock(pOut, r2, g2, b2, tableB, low, true, flipped);
+#endif
+}
+// Input is an ETC1 compressed version of the data.
+// Output is a 4 x 4 square of 3-byte pixels in form R, G, B
+void etc1_decode_block(const etc1_byte* pIn, etc1_byte* pOut) {
+    etc1_decode_block_layout(pIn, pOut, ETC1_LAYOUT_STANDARD);
+}
+// Tegra blocks have all 8 bytes reversed, so both words are little-endian
+// and the low word comes first.
+void etc1_decode_block_layout(const etc1_byte* pIn, etc1_byte* pOut,
+        int layout) {
+    etc1_uint32 high, low;
+    if (layout == ETC1_LAYOUT_TEGRA) {
+        high = (pIn[7] << 24) | (pIn[6] << 16) | (pIn[5] << 8) | pIn[4];
+        low = (pIn[3] << 24) | (pIn[2] << 16) | (pIn[1] << 8) | pIn[0];
+    } else {
+        high = (pIn[0] << 24) | (pIn[1] << 16) | (pIn[2] << 8) | pIn[3];
+        low = (pIn[4] << 24) | (pIn[5] << 16) | (pIn[6] << 8) | pIn[7];
+    }
+    decode_block(high, low, pOut);
 }
 typedef struct {
     etc1_uint32 high;
@@ -248,6 +320,44 @@ static
 inline int square(int x) {
     return x * x;
 }
+#ifdef __ARM_NEON
+// Scores all four modifiers at once. The scalar version below skips a
+// modifier only when it can't strictly beat the best one so far, so taking
+// the first minimum of the full scores selects the same index.
+static etc1_uint32 chooseModifier(const etc1_byte* pBaseColors,
+        const etc1_byte* pIn, etc1_uint32 *pLow, int bitIndex,
+        const int* pModifierTable) {
+    const int32x4_t zero = vdupq_n_s32(0);
+    const int32x4_t max = vdupq_n_s32(255);
+    int32x4_t modifier = vld1q_s32(pModifierTable);
+    int32x4_t dr = vsubq_s32(vminq_s32(vmaxq_s32(vaddq_s32(
+            vdupq_n_s32(pBaseColors[0]), modifier), zero), max),
+            vdupq_n_s32(pIn[0]));
+    int32x4_t dg = vsubq_s32(vminq_s32(vmaxq_s32(vaddq_s32(
+            vdupq_n_s32(pBaseColors[1]), modifier), zero), max),
+            vdupq_n_s32(pIn[1]));
+    int32x4_t db = vsubq_s32(vminq_s32(vmaxq_s32(vaddq_s32(
+            vdupq_n_s32(pBaseColors[2]), modifier), zero), max),
+            vdupq_n_s32(pIn[2]));
+    int32x4_t score = vmulq_n_s32(vmulq_s32(dg, dg), 6);
+    score = vmlaq_n_s32(score, vmulq_s32(dr, dr), 3);
+    score = vmlaq_s32(score, db, db);
+    etc1_uint32 scores[4];
+    vst1q_u32(scores, vreinterpretq_u32_s32(score));
+    etc1_uint32 bestScore = scores[0];
+    int bestIndex = 0;
+    for (int i = 1; i < 4; i++) {
+        if (scores[i] < bestScore) {
+            bestScore = scores[i];
+            bestIndex = i;
+        }
+    }
+    etc1_uint32 lowMask = (((bestIndex >> 1) << 16) | (bestIndex & 1))
+            << bitIndex;
+    *pLow |= lowMask;
+    return bestScore;
+}
+#else
 static etc1_uint32 chooseModifier(const etc1_byte* pBaseColors,
         const etc1_byte* pIn, etc1_uint32 *pLow, int bitIndex,
         const int* pModifierTable) {
@@ -283,6 +393,7 @@ static etc1_uint32 chooseModifier(const etc1_byte* pBaseColors,
     *pLow |= lowMask;
     return bestScore;
 }
+#endif
 static
 void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
         etc_compressed* pCompressed, bool flipped, bool second,
@@ -371,17 +482,74 @@ static void etc_encodeBaseColors(etc1_byte* pBaseColors,
     pBaseColors[4] = g2;
     pBaseColors[5] = b2;
 }
+// Guess the modifier table of a sub-block from the mean deviation of its
+// pixels from the base color, instead of trying all of them.
+static int etc_guess_table(const etc1_byte* pIn, etc1_uint32 inMask,
+        const etc1_byte* pBaseColor, bool flipped, bool second) {
+    int deviation = 0;
+    int count = 0;
+    for (int i = 0; i < 16; i++) {
+        int x = i & 3;
+        int y = i >> 2;
+        if (((flipped ? y : x) >> 1) != (second ? 1 : 0)) {
+            continue;
+        }
+        if (inMask & (1 << i)) {
+            const etc1_byte* p = pIn + i * 3;
+            deviation += abs(p[0] - pBaseColor[0]) +
+                    2 * abs(p[1] - pBaseColor[1]) +
+                    abs(p[2] - pBaseColor[2]);
+            count += 4;
+        }
+    }
+    if (!count) {
+        return 0;
+    }
+    deviation /= count;
+    int bestTable = 0;
+    int bestDistance = ~0u >> 1;
+    for (int i = 0; i < 8; i++) {
+        int average = (kModifierTable[i * 4 + 2] + kModifierTable[i * 4 + 3]) / 2;
+        int distance = abs(average - deviation);
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            bestTable = i;
+        }
+    }
+    return bestTable;
+}
+// Range of modifier tables to search for a sub-block at the given quality.
+static void etc_table_range(const etc1_byte* pIn, etc1_uint32 inMask,
+        const etc1_byte* pBaseColor, bool flipped, bool second, int quality,
+        int* pFirst, int* pLast) {
+    if (quality == ETC1_QUALITY_HIGH) {
+        *pFirst = 0;
+        *pLast = 7;
+        return;
+    }
+    int guess = etc_guess_table(pIn, inMask, pBaseColor, flipped, second);
+    if (quality == ETC1_QUALITY_FAST) {
+        *pFirst = *pLast = guess;
+        return;
+    }
+    *pFirst = guess > 0 ? guess - 1 : 0;
+    *pLast = guess < 7 ? guess + 1 : 7;
+}
 static
 void etc_encode_block_helper(const etc1_byte* pIn, etc1_uint32 inMask,
-        const etc1_byte* pColors, etc_compressed* pCompressed, bool flipped) {
+        const etc1_byte* pColors, etc_compressed* pCompressed, bool flipped,
+        int quality) {
     pCompressed->score = ~0;
     pCompressed->high = (flipped ? 1 : 0);
     pCompressed->low = 0;
     etc1_byte pBaseColors[6];
     etc_encodeBaseColors(pBaseColors, pColors, pCompressed);
     int originalHigh = pCompressed->high;
-    const int* pModifierTable = kModifierTable;
-    for (int i = 0; i < 8; i++, pModifierTable += 4) {
+    int first, last;
+    etc_table_range(pIn, inMask, pBaseColors, flipped, false, quality,
+            &first, &last);
+    const int* pModifierTable = kModifierTable + first * 4;
+    for (int i = first; i <= last; i++, pModifierTable += 4) {
         etc_compressed temp;
         temp.score = 0;
         temp.high = originalHigh | (i << 5);
@@ -390,16 +558,18 @@ void etc_encode_block_helper(const etc1_byte* pIn, etc1_uint32 inMask,
                 pBaseColors, pModifierTable);
         take_best(pCompressed, &temp);
     }
-    pModifierTable = kModifierTable;
+    etc_table_range(pIn, inMask, pBaseColors + 3, flipped, true, quality,
+            &first, &last);
+    pModifierTable = kModifierTable + first * 4;
     etc_compressed firstHalf = *pCompressed;
-    for (int i = 0; i < 8; i++, pModifierTable += 4) {
+    for (int i = first; i <= last; i++, pModifierTable += 4) {
         etc_compressed temp;
         temp.score = firstHalf.score;
         temp.high = firstHalf.high | (i << 2);
         temp.low = firstHalf.low;
         etc_encode_subblock_helper(pIn, inMask, &temp, flipped, true,
                 pBaseColors + 3, pModifierTable);
-        if (i == 0) {
+        if (i == first) {
             *pCompressed = temp;
         } else {
             take_best(pCompressed, &temp);
@@ -418,16 +588,24 @@ static void writeBigEndian(etc1_byte* pOut, etc1_uint32 d) {
 // Output is an ETC1 compressed version of the data.
 void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
         etc1_byte* pOut) {
+    etc1_encode_block_quality(pIn, inMask, pOut, ETC1_QUALITY_HIGH);
+}
+void etc1_encode_block_quality(const etc1_byte* pIn, etc1_uint32 inMask,
+        etc1_byte* pOut, int quality) {
     etc1_byte colors[6];
-    etc1_byte flippedColors[6];
     etc_average_colors_subblock(pIn, inMask, colors, false, false);
     etc_average_colors_subblock(pIn, inMask, colors + 3, false, true);
-    etc_average_colors_subblock(pIn, inMask, flippedColors, true, false);
-    etc_average_colors_subblock(pIn, inMask, flippedColors + 3, true, true);
-    etc_compressed a, b;
-    etc_encode_block_helper(pIn, inMask, colors, &a, false);
-    etc_encode_block_helper(pIn, inMask, flippedColors, &b, true);
-    take_best(&a, &b);
+    etc_compressed a;
+    etc_encode_block_helper(pIn, inMask, colors, &a, false, quality);
+    // the fast mode doesn't search the flipped sub-block orientation
+    if (quality != ETC1_QUALITY_FAST) {
+        etc1_byte flippedColors[6];
+        etc_average_colors_subblock(pIn, inMask, flippedColors, true, false);
+        etc_average_colors_subblock(pIn, inMask, flippedColors + 3, true, true);
+        etc_compressed b;
+        etc_encode_block_helper(pIn, inMask, flippedColors, &b, true, quality);
+        take_best(&a, &b);
+    }
     writeBigEndian(pOut, a.high);
     writeBigEndian(pOut + 4, a.low);
 }
@@ -435,23 +613,18 @@ void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
 etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height) {
     return (((width + 3) & ~3) * ((height + 3) & ~3)) >> 1;
 }
-// Encode an entire image.
-// pIn - pointer to the image data. Formatted such that the Red component of
-//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset;
-// pOut - pointer to encoded data. Must be large enough to store entire encoded image.
-int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
-        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut) {
-    if (pixelSize < 2 || pixelSize > 3) {
-        return -1;
-    }
-    static const unsigned short kYMask[] = { 0x0, 0xf, 0xff, 0xfff, 0xffff };
-    static const unsigned short kXMask[] = { 0x0, 0x1111, 0x3333, 0x7777,
-            0xffff };
+static const unsigned short kYMask[] = { 0x0, 0xf, 0xff, 0xfff, 0xffff };
+static const unsigned short kXMask[] = { 0x0, 0x1111, 0x3333, 0x7777,
+        0xffff };
+// Encode the block rows between pixel rows yStart and yStop of an image.
+static void etc1_encode_rows(const etc1_byte* pIn, etc1_uint32 width,
+        etc1_uint32 height, etc1_uint32 pixelSize, etc1_uint32 stride,
+        etc1_byte* pOut, etc1_uint32 yStart, etc1_uint32 yStop, int quality) {
     etc1_byte block[ETC1_DECODED_BLOCK_SIZE];
     etc1_byte encoded[ETC1_ENCODED_BLOCK_SIZE];
     etc1_uint32 encodedWidth = (width + 3) & ~3;
-    etc1_uint32 encodedHeight = (height + 3) & ~3;
-    for (etc1_uint32 y = 0; y < encodedHeight; y += 4) {
+    pOut += (yStart / 4) * (encodedWidth / 4) * ETC1_ENCODED_BLOCK_SIZE;
+    for (etc1_uint32 y = yStart; y < yStop; y += 4) {
         etc1_uint32 yEnd = height - y;
         if (yEnd > 4) {
             yEnd = 4;
@@ -478,28 +651,107 @@ int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 heigh
                     }
                 }
             }
-            etc1_encode_block(block, mask, encoded);
+            etc1_encode_block_quality(block, mask, encoded, quality);
             memcpy(pOut, encoded, sizeof(encoded));
             pOut += sizeof(encoded);
         }
     }
-    return 0;
 }
-// Decode an entire image.
-// pIn - pointer to encoded data.
-// pOut - pointer to the image data. Will be written such that the Red component of
-//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset. Must be
-//        large enough to store entire image.
-int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
-        etc1_uint32 width, etc1_uint32 height,
-        etc1_uint32 pixelSize, etc1_uint32 stride) {
+// Images are split into bands of block rows that are encoded in parallel.
+// Bands are written to disjoint parts of pOut, so the output is the same
+// as that of a single-threaded encode. Decoding is split the same way.
+#define ETC1_MAX_THREADS 8
+#define ETC1_MIN_ROWS_PER_THREAD 16
+// Number of threads to start besides the calling one.
+static etc1_uint32 etc1_num_threads(etc1_uint32 blockRows) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    etc1_uint32 numThreads = blockRows / ETC1_MIN_ROWS_PER_THREAD;
+    if (cpus > 0 && numThreads > (etc1_uint32) cpus) {
+        numThreads = cpus;
+    }
+    if (numThreads > ETC1_MAX_THREADS) {
+        numThreads = ETC1_MAX_THREADS;
+    }
+    return numThreads;
+}
+struct etc1_encode_job {
+    const etc1_byte* pIn;
+    etc1_uint32 width;
+    etc1_uint32 height;
+    etc1_uint32 pixelSize;
+    etc1_uint32 stride;
+    etc1_byte* pOut;
+    etc1_uint32 yStart;
+    etc1_uint32 yStop;
+    int quality;
+};
+static void* etc1_encode_thread(void* data) {
+    etc1_encode_job* job = (etc1_encode_job*) data;
+    etc1_encode_rows(job->pIn, job->width, job->height, job->pixelSize,
+            job->stride, job->pOut, job->yStart, job->yStop, job->quality);
+    return NULL;
+}
+// Encode an entire image.
+// pIn - pointer to the image data. Formatted such that the Red component of
+//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset;
+// pOut - pointer to encoded data. Must be large enough to store entire encoded image.
+int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut) {
+    return etc1_encode_image_quality(pIn, width, height, pixelSize, stride,
+            pOut, ETC1_QUALITY_HIGH);
+}
+int etc1_encode_image_quality(const etc1_byte* pIn, etc1_uint32 width,
+        etc1_uint32 height, etc1_uint32 pixelSize, etc1_uint32 stride,
+        etc1_byte* pOut, int quality) {
+    if (quality < ETC1_QUALITY_FAST || quality > ETC1_QUALITY_HIGH) {
+        return -1;
+    }
     if (pixelSize < 2 || pixelSize > 3) {
         return -1;
     }
+    etc1_uint32 blockRows = ((height + 3) & ~3) / 4;
+    etc1_uint32 numThreads = etc1_num_threads(blockRows);
+    etc1_encode_job jobs[ETC1_MAX_THREADS];
+    pthread_t threads[ETC1_MAX_THREADS];
+    bool started[ETC1_MAX_THREADS];
+    etc1_uint32 row = 0;
+    for (etc1_uint32 i = 0; i < numThreads; i++) {
+        etc1_uint32 rows = blockRows / (numThreads + 1);
+        jobs[i].pIn = pIn;
+        jobs[i].width = width;
+        jobs[i].height = height;
+        jobs[i].pixelSize = pixelSize;
+        jobs[i].stride = stride;
+        jobs[i].pOut = pOut;
+        jobs[i].yStart = row * 4;
+        jobs[i].yStop = (row + rows) * 4;
+        jobs[i].quality = quality;
+        row += rows;
+        started[i] = pthread_create(&threads[i], NULL, etc1_encode_thread,
+                &jobs[i]) == 0;
+        if (!started[i]) {
+            etc1_encode_thread(&jobs[i]);
+        }
+    }
+    // the calling thread takes the last band
+    etc1_encode_rows(pIn, width, height, pixelSize, stride, pOut, row * 4,
+            blockRows * 4, quality);
+    for (etc1_uint32 i = 0; i < numThreads; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    return 0;
+}
+// Decode the block rows between pixel rows yStart and yStop of an image.
+static void etc1_decode_rows(const etc1_byte* pIn, etc1_byte* pOut,
+        etc1_uint32 width, etc1_uint32 height, etc1_uint32 pixelSize,
+        etc1_uint32 stride, etc1_uint32 yStart, etc1_uint32 yStop,
+        int layout) {
     etc1_byte block[ETC1_DECODED_BLOCK_SIZE];
     etc1_uint32 encodedWidth = (width + 3) & ~3;
-    etc1_uint32 encodedHeight = (height + 3) & ~3;
-    for (etc1_uint32 y = 0; y < encodedHeight; y += 4) {
+    pIn += (yStart / 4) * (encodedWidth / 4) * ETC1_ENCODED_BLOCK_SIZE;
+    for (etc1_uint32 y = yStart; y < yStop; y += 4) {
         etc1_uint32 yEnd = height - y;
         if (yEnd > 4) {
             yEnd = 4;
@@ -509,7 +761,7 @@ int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
             if (xEnd > 4) {
                 xEnd = 4;
             }
-            etc1_decode_block(pIn, block);
+            etc1_decode_block_layout(pIn, block, layout);
             pIn += ETC1_ENCODED_BLOCK_SIZE;
             for (etc1_uint32 cy = 0; cy < yEnd; cy++) {
                 const etc1_byte* q = block + (cy * 4) * 3;
@@ -529,8 +781,135 @@ int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
             }
         }
     }
+}
+struct etc1_decode_job {
+    const etc1_byte* pIn;
+    etc1_byte* pOut;
+    etc1_uint32 width;
+    etc1_uint32 height;
+    etc1_uint32 pixelSize;
+    etc1_uint32 stride;
+    etc1_uint32 yStart;
+    etc1_uint32 yStop;
+    int layout;
+};
+static void* etc1_decode_thread(void* data) {
+    etc1_decode_job* job = (etc1_decode_job*) data;
+    etc1_decode_rows(job->pIn, job->pOut, job->width, job->height,
+            job->pixelSize, job->stride, job->yStart, job->yStop,
+            job->layout);
+    return NULL;
+}
+// Decode an entire image.
+// pIn - pointer to encoded data.
+// pOut - pointer to the image data. Will be written such that the Red component of
+//       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset. Must be
+//        large enough to store entire image.
+int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
+        etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride) {
+    return etc1_decode_image_layout(pIn, pOut, width, height, pixelSize,
+            stride, ETC1_LAYOUT_STANDARD);
+}
+int etc1_decode_image_layout(const etc1_byte* pIn, etc1_byte* pOut,
+        etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, int layout) {
+    if (layout < ETC1_LAYOUT_STANDARD || layout > ETC1_LAYOUT_TEGRA) {
+        return -1;
+    }
+    if (pixelSize < 2 || pixelSize > 3) {
+        return -1;
+    }
+    etc1_uint32 blockRows = ((height + 3) & ~3) / 4;
+    etc1_uint32 numThreads = etc1_num_threads(blockRows);
+    etc1_decode_job jobs[ETC1_MAX_THREADS];
+    pthread_t threads[ETC1_MAX_THREADS];
+    bool started[ETC1_MAX_THREADS];
+    etc1_uint32 row = 0;
+    for (etc1_uint32 i = 0; i < numThreads; i++) {
+        etc1_uint32 rows = blockRows / (numThreads + 1);
+        jobs[i].pIn = pIn;
+        jobs[i].pOut = pOut;
+        jobs[i].width = width;
+        jobs[i].height = height;
+        jobs[i].pixelSize = pixelSize;
+        jobs[i].stride = stride;
+        jobs[i].yStart = row * 4;
+        jobs[i].yStop = (row + rows) * 4;
+        jobs[i].layout = layout;
+        row += rows;
+        started[i] = pthread_create(&threads[i], NULL, etc1_decode_thread,
+                &jobs[i]) == 0;
+        if (!started[i]) {
+            etc1_decode_thread(&jobs[i]);
+        }
+    }
+    // the calling thread takes the last band
+    etc1_decode_rows(pIn, pOut, width, height, pixelSize, stride, row * 4,
+            blockRows * 4, layout);
+    for (etc1_uint32 i = 0; i < numThreads; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
     return 0;
 }
+// Compute the PSNR in dB of an encoded image against its source, over the
+// RGB channels in 8 bits per channel. Returns -1 on invalid arguments and
+// INFINITY if the images are identical.
+double etc1_compute_psnr(const etc1_byte* pIn, const etc1_byte* pEncoded,
+        etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride) {
+    if (pixelSize < 2 || pixelSize > 3 || !width || !height) {
+        return -1;
+    }
+    etc1_byte block[ETC1_DECODED_BLOCK_SIZE];
+    etc1_uint32 encodedWidth = (width + 3) & ~3;
+    etc1_uint32 encodedHeight = (height + 3) & ~3;
+    double error = 0;
+    for (etc1_uint32 y = 0; y < encodedHeight; y += 4) {
+        etc1_uint32 yEnd = height - y;
+        if (yEnd > 4) {
+            yEnd = 4;
+        }
+        for (etc1_uint32 x = 0; x < encodedWidth; x += 4) {
+            etc1_uint32 xEnd = width - x;
+            if (xEnd > 4) {
+                xEnd = 4;
+            }
+            etc1_decode_block(pEncoded, block);
+            pEncoded += ETC1_ENCODED_BLOCK_SIZE;
+            etc1_uint32 blockError = 0;
+            for (etc1_uint32 cy = 0; cy < yEnd; cy++) {
+                const etc1_byte* q = block + (cy * 4) * 3;
+                const etc1_byte* p = pIn + pixelSize * x + stride * (y + cy);
+                for (etc1_uint32 cx = 0; cx < xEnd; cx++) {
+                    int r, g, b;
+                    if (pixelSize == 3) {
+                        r = p[0];
+                        g = p[1];
+                        b = p[2];
+                    } else {
+                        int pixel = (p[1] << 8) | p[0];
+                        r = convert5To8(pixel >> 11);
+                        g = convert6To8(pixel >> 5);
+                        b = convert5To8(pixel);
+                    }
+                    blockError += square(r - q[0]) + square(g - q[1]) +
+                            square(b - q[2]);
+                    p += pixelSize;
+                    q += 3;
+                }
+            }
+            error += blockError;
+        }
+    }
+    if (error == 0) {
+        return INFINITY;
+    }
+    double mse = error / ((double) width * height * 3);
+    return 10 * log10(255.0 * 255.0 / mse);
+}
 static const char kMagic[] = { 'P', 'K', 'M', ' ', '1', '0' };
 static const etc1_uint32 ETC1_PKM_FORMAT_OFFSET = 6;
 static const etc1_uint32 ETC1_PKM_ENCODED_WIDTH_OFFSET = 8;
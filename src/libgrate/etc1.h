@@ -21,6 +21,20 @@
 typedef unsigned char etc1_byte;
 typedef int etc1_bool;
 typedef unsigned int etc1_uint32;
+// Encoder quality levels. FAST guesses the modifier table of each
+// sub-block and doesn't search flipped blocks, MEDIUM searches the tables
+// next to the guess in both orientations and HIGH is an exhaustive search.
+enum {
+    ETC1_QUALITY_FAST,
+    ETC1_QUALITY_MEDIUM,
+    ETC1_QUALITY_HIGH,
+};
+// Block layouts. STANDARD is the big-endian layout of the spec and of PKM
+// files, TEGRA the layout GR3D samples, with all 8 bytes of a block reversed.
+enum {
+    ETC1_LAYOUT_STANDARD,
+    ETC1_LAYOUT_TEGRA,
+};
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -35,6 +49,9 @@ extern "C" {
 //
 // pOut is an ETC1 compressed version of the data.
 void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 validPixelMask, etc1_byte* pOut);
+// Encode a block of pixels at the given ETC1_QUALITY_* level.
+void etc1_encode_block_quality(const etc1_byte* pIn, etc1_uint32 validPixelMask,
+        etc1_byte* pOut, int quality);
 // Decode a block of pixels.
 //
 // pIn is an ETC1 compressed version of the data.
@@ -43,6 +60,9 @@ void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 validPixelMask, etc1_by
 // 4 x 4 square of 3-byte pixels in form R, G, B. Byte (3 * (x + 4 * y) is the R
 // value of pixel (x, y).
 void etc1_decode_block(const etc1_byte* pIn, etc1_byte* pOut);
+// Decode a block of pixels stored in the given ETC1_LAYOUT_* layout.
+void etc1_decode_block_layout(const etc1_byte* pIn, etc1_byte* pOut,
+        int layout);
 // Return the size of the encoded image data (does not include size of PKM header).
 etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height);
 // Encode an entire image.
@@ -53,6 +73,10 @@ etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height);
 // returns non-zero if there is an error.
 int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
         etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut);
+// Encode an entire image at the given ETC1_QUALITY_* level.
+int etc1_encode_image_quality(const etc1_byte* pIn, etc1_uint32 width,
+        etc1_uint32 height, etc1_uint32 pixelSize, etc1_uint32 stride,
+        etc1_byte* pOut, int quality);
 // Decode an entire image.
 // pIn - pointer to encoded data.
 // pOut - pointer to the image data. Will be written such that
@@ -63,6 +87,16 @@ int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 heigh
 int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
         etc1_uint32 width, etc1_uint32 height,
         etc1_uint32 pixelSize, etc1_uint32 stride);
+// Decode an entire image stored in the given ETC1_LAYOUT_* layout, such as
+// the contents of a pixbuf GR3D samples from.
+int etc1_decode_image_layout(const etc1_byte* pIn, etc1_byte* pOut,
+        etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride, int layout);
+// Compute the PSNR in dB of encoded data against the source image, which is
+// laid out as in etc1_encode_image(). Returns a negative value on error.
+double etc1_compute_psnr(const etc1_byte* pIn, const etc1_byte* pEncoded,
+        etc1_uint32 width, etc1_uint32 height,
+        etc1_uint32 pixelSize, etc1_uint32 stride);
 // Size of a PKM header, in bytes.
 #define ETC_PKM_HEADER_SIZE 16
 // Format a PKM header
@@ -27,43 +27,44 @@
 #include <string.h>
 
 #include "asm.h"
+#include "grate-float.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
-#define PARSE_ERROR(txt)	\
-	{			\
-		yyerror(txt);	\
-		YYABORT;	\
+#define PARSE_ERROR(txt)		\
+	{				\
+		yyerror(scanner, txt);	\
+		YYABORT;		\
 	}
 
-extern int fragment_asmlex(void);
-extern int fragment_asmlineno;
+extern int fragment_asmget_lineno(void *scanner);
 
-void __attribute__((weak)) yyerror(char *err)
+void __attribute__((weak)) yyerror(void *scanner, char *err)
 {
-	fprintf(stderr, "fs: line %d: %s\n", fragment_asmlineno, err);
+	fprintf(stderr, "fs: line %d: %s\n",
+		fragment_asmget_lineno(scanner), err);
 }
 
-pseq_instr	asm_pseq_instructions[64];
-mfu_instr	asm_mfu_instructions[64];
-tex_instr	asm_tex_instructions[64];
-alu_instr	asm_alu_instructions[64];
-dw_instr	asm_dw_instructions[64];
+__thread pseq_instr	asm_pseq_instructions[64];
+__thread mfu_instr	asm_mfu_instructions[64];
+__thread tex_instr	asm_tex_instructions[64];
+__thread alu_instr	asm_alu_instructions[64];
+__thread dw_instr	asm_dw_instructions[64];
 
-instr_sched	asm_mfu_sched[64];
-instr_sched	asm_alu_sched[64];
+__thread instr_sched	asm_mfu_sched[64];
+__thread instr_sched	asm_alu_sched[64];
 
-uint32_t	asm_fs_constants[32];
-asm_in_out	asm_fs_uniforms[32 * 2];
+__thread uint32_t	asm_fs_constants[32];
+__thread asm_in_out	asm_fs_uniforms[32 * 2];
 
-unsigned asm_fs_instructions_nb;
-unsigned asm_mfu_instructions_nb;
-unsigned asm_alu_instructions_nb;
+__thread unsigned asm_fs_instructions_nb;
+__thread unsigned asm_mfu_instructions_nb;
+__thread unsigned asm_alu_instructions_nb;
 
-unsigned asm_alu_buffer_size;
-unsigned asm_pseq_to_dw_exec_nb;
+__thread unsigned asm_alu_buffer_size;
+__thread unsigned asm_pseq_to_dw_exec_nb;
 
-int asm_discards_fragment;
+__thread int asm_discards_fragment;
 
 static void reset_fragment_asm_parser_state(void)
 {
@@ -92,42 +93,17 @@ static void reset_fragment_asm_parser_state(void)
 	asm_pseq_to_dw_exec_nb = 1;
 
 	asm_discards_fragment = 0;
-
-	fragment_asmlineno = 1;
 }
+%}
 
-static uint32_t float_to_fp20(float f)
-{
-	uint32_t sign, mantissa, exponent;
-	union {
-		uint32_t u;
-		float f;
-	} value;
-
-	if (f == 0.0f)
-		return 0;
-
-	value.f = f;
-
-	sign = (value.u >> 31) & 0x1;
-	exponent = (value.u >> 23) & 0xff;
-	mantissa = (value.u >>  0) & 0x7fffff;
-
-	if (exponent == 0xff)
-		exponent = 0x3f;
-	else
-		exponent = (exponent - 127 + 31) & 0x3f;
+%define api.pure full
+%lex-param {void *scanner}
+%parse-param {void *scanner}
 
-	return (sign << 19) | (exponent << 13) | (mantissa >> (23 - 13));
+%code {
+extern int fragment_asmlex(YYSTYPE *lval, void *scanner);
 }
 
-static uint32_t float_to_fx10(float f)
-{
-	uint32_t u = f * 256.0f;
-	return u & 0x3ff;
-}
-%}
-
 %token T_ASM
 %token T_CONSTANTS
 %token T_UNIFORMS
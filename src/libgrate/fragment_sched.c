@@ -0,0 +1,635 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm.h"
+#include "grate.h"
+#include "host1x.h"
+#include "libgrate-private.h"
+
+/*
+ * Scheduler of fragment programs in the layout written by the fragment
+ * assembler. Every exec batch passes the pipeline stages in order, a later
+ * stage sees the results of an earlier one within the same batch:
+ *
+ * - consecutive batches are merged if all the stages used by the first come
+ *   before the stages used by the second, e.g. a batch doing only MFU
+ *   interpolation is merged with a following TEX / ALU batch;
+ * - a batch ending with ALU instructions takes over the ALU instructions of
+ *   the next batch as long as at most 3 of them are left;
+ * - ALU instructions of a batch are fused if the slots used by one of them
+ *   are free in the other and they don't depend on each other.
+ *
+ * Batches carrying PSEQ instructions are never touched. ALU instructions
+ * aren't fused if anything reads the ALU result registers, since those
+ * refer to the previous ALU instruction, or uses embedded immediates, which
+ * share their bits with the ALU3 slot.
+ */
+
+enum fp_stage {
+	FP_STAGE_MFU,
+	FP_STAGE_TEX,
+	FP_STAGE_ALU,
+	FP_STAGE_DW,
+};
+
+/* returns the payload of a NONINCR to the given register, NULL if absent */
+static const uint32_t *fp_section(const struct grate_shader *fs,
+				  unsigned *pos, unsigned offset,
+				  unsigned *count)
+{
+	uint32_t word;
+
+	if (*pos >= fs->num_words)
+		return NULL;
+
+	word = fs->words[*pos];
+
+	if (word >> 28 != 2 || ((word >> 16) & 0xfff) != offset)
+		return NULL;
+
+	*count = word & 0xffff;
+
+	if (*pos + 1 + *count > fs->num_words)
+		return NULL;
+
+	*pos += 1 + *count;
+
+	return &fs->words[*pos - *count];
+}
+
+static bool fp_sched_decode(const struct fp_program *prog, uint32_t data,
+			    bool alu, unsigned *address, unsigned *nb)
+{
+	if (alu && prog->t114) {
+		alu_instr_sched_t114 sched = { .data = data };
+
+		*address = sched.address;
+		*nb = sched.instructions_nb;
+	} else {
+		instr_sched sched = { .data = data };
+
+		*address = sched.address;
+		*nb = sched.instructions_nb;
+	}
+
+	return *nb <= (alu ? FP_MAX_ALU : FP_MAX_MFU);
+}
+
+int fp_program_decode(const struct grate_shader *fs, struct fp_program *prog)
+{
+	const uint32_t *pseq, *mfu_sched, *mfu, *tex, *alu_sched, *alu;
+	const uint32_t *complement, *dw;
+	unsigned pos = 0, n, count, i, k, address, nb;
+
+	prog->t114 = grate_chip_info()->soc_id == TEGRA114_SOC;
+
+	pseq = fp_section(fs, &pos, 0x541, &n);
+	if (!pseq || !n || n > FP_MAX_BATCHES)
+		return -EINVAL;
+
+	if (pos >= fs->num_words ||
+	    fs->words[pos++] != HOST1X_OPCODE_IMM(0x500, 0x0))
+		return -EINVAL;
+
+	mfu_sched = fp_section(fs, &pos, 0x601, &count);
+	if (!mfu_sched || count != n)
+		return -EINVAL;
+
+	mfu = fp_section(fs, &pos, 0x604, &count);
+	if (!mfu || count % 2)
+		return -EINVAL;
+
+	prog->mfu_nb = count / 2;
+
+	tex = fp_section(fs, &pos, 0x701, &count);
+	if (!tex || count != n)
+		return -EINVAL;
+
+	alu_sched = fp_section(fs, &pos, 0x801, &count);
+	if (!alu_sched || count != n)
+		return -EINVAL;
+
+	alu = fp_section(fs, &pos, 0x804, &count);
+	if (!alu || count % 8)
+		return -EINVAL;
+
+	prog->alu_nb = count / 8;
+
+	complement = fp_section(fs, &pos, 0x806, &count);
+	if (!complement || count != n)
+		return -EINVAL;
+
+	dw = fp_section(fs, &pos, 0x901, &count);
+	if (!dw || count != n || pos != fs->num_words)
+		return -EINVAL;
+
+	prog->batches_nb = n;
+
+	for (i = 0; i < n; i++) {
+		struct fp_batch *batch = &prog->batches[i];
+
+		batch->pseq.data = pseq[i];
+		batch->tex.data = tex[i];
+		batch->complement = complement[i];
+		batch->dw.data = dw[i];
+
+		if (!fp_sched_decode(prog, mfu_sched[i], false, &address, &nb) ||
+		    address + nb > prog->mfu_nb)
+			return -EINVAL;
+
+		batch->mfu_nb = nb;
+
+		for (k = 0; k < nb; k++) {
+			batch->mfu[k].part1 = mfu[(address + k) * 2 + 0];
+			batch->mfu[k].part0 = mfu[(address + k) * 2 + 1];
+		}
+
+		if (!fp_sched_decode(prog, alu_sched[i], true, &address, &nb) ||
+		    address + nb > prog->alu_nb)
+			return -EINVAL;
+
+		batch->alu_nb = nb;
+
+		for (k = 0; k < nb; k++) {
+			const uint32_t *words = &alu[(address + k) * 8];
+			alu_instr *instr = &batch->alu[k];
+
+			instr->part1 = words[0];
+			instr->part0 = words[1];
+			instr->part3 = words[2];
+			instr->part2 = words[3];
+			instr->part5 = words[4];
+			instr->part4 = words[5];
+			instr->part7 = words[6];
+			instr->part6 = words[7];
+		}
+	}
+
+	return 0;
+}
+
+bool fp_alu_slot_nop(const union fragment_alu_instruction *slot)
+{
+	return slot->dst_reg == FRAGMENT_LOWP_VEC2_0_1 &&
+	       slot->condition_code == ALU_CC_NOP &&
+	       !slot->accumulate_result_this &&
+	       !slot->accumulate_result_other;
+}
+
+static bool fp_alu_nop(const alu_instr *instr)
+{
+	unsigned k;
+
+	for (k = 0; k < 4; k++)
+		if (!fp_alu_slot_nop(&instr->a[k]))
+			return false;
+
+	return true;
+}
+
+static bool fp_mfu_nop(const mfu_instr *instr)
+{
+	return !instr->part0 && !instr->part1;
+}
+
+/* drops instructions doing nothing, returns the mask of the used stages */
+static unsigned fp_batch_stages(struct fp_batch *batch)
+{
+	unsigned stages = 0, i, k;
+
+	for (i = 0, k = 0; i < batch->mfu_nb; i++)
+		if (!fp_mfu_nop(&batch->mfu[i]))
+			batch->mfu[k++] = batch->mfu[i];
+
+	batch->mfu_nb = k;
+
+	/* the meaning of the complement is unknown, keep its instructions */
+	if (!batch->complement) {
+		for (i = 0, k = 0; i < batch->alu_nb; i++)
+			if (!fp_alu_nop(&batch->alu[i]))
+				batch->alu[k++] = batch->alu[i];
+
+		batch->alu_nb = k;
+	}
+
+	if (batch->mfu_nb)
+		stages |= BIT(FP_STAGE_MFU);
+
+	if (batch->tex.data)
+		stages |= BIT(FP_STAGE_TEX);
+
+	if (batch->alu_nb || batch->complement)
+		stages |= BIT(FP_STAGE_ALU);
+
+	if (batch->dw.data)
+		stages |= BIT(FP_STAGE_DW);
+
+	return stages;
+}
+
+static void fp_alu_slot_reads(const union fragment_alu_instruction *slot,
+			      uint8_t regs[128])
+{
+	regs[slot->rA_reg_select] = 1;
+	regs[slot->rB_reg_select] = 1;
+	regs[slot->rC_reg_select] = 1;
+}
+
+/* whether the instruction reads ALU results or embedded immediates */
+static bool fp_alu_reads_special(const alu_instr *instr)
+{
+	uint8_t regs[128] = { 0 };
+	unsigned k, reg;
+
+	for (k = 0; k < 4; k++)
+		if (!fp_alu_slot_nop(&instr->a[k]))
+			fp_alu_slot_reads(&instr->a[k], regs);
+
+	for (reg = FRAGMENT_ALU_RESULT_REG_0;
+	     reg <= FRAGMENT_EMBEDDED_CONSTANT_2; reg++)
+		if (regs[reg])
+			return true;
+
+	return false;
+}
+
+static bool fp_alu_accumulates(const alu_instr *instr)
+{
+	unsigned k;
+
+	for (k = 0; k < 4; k++)
+		if (instr->a[k].accumulate_result_this ||
+		    instr->a[k].accumulate_result_other)
+			return true;
+
+	return false;
+}
+
+/* whether the ALU slots of the second instruction can join the first */
+static bool fp_alu_can_fuse(const alu_instr *first, const alu_instr *second)
+{
+	uint8_t reads[2][128] = { { 0 } }, writes[2][128] = { { 0 } };
+	const alu_instr *instr[2] = { first, second };
+	unsigned i, k, reg;
+
+	if (fp_alu_reads_special(first) || fp_alu_reads_special(second) ||
+	    fp_alu_accumulates(first) || fp_alu_accumulates(second))
+		return false;
+
+	for (k = 0; k < 4; k++) {
+		if (!fp_alu_slot_nop(&first->a[k]) &&
+		    !fp_alu_slot_nop(&second->a[k]))
+			return false;
+	}
+
+	for (i = 0; i < 2; i++) {
+		for (k = 0; k < 4; k++) {
+			const union fragment_alu_instruction *slot;
+
+			slot = &instr[i]->a[k];
+
+			if (fp_alu_slot_nop(slot))
+				continue;
+
+			fp_alu_slot_reads(slot, reads[i]);
+			writes[i][slot->dst_reg] = 1;
+		}
+	}
+
+	/* lowp sub-registers are tracked as whole registers */
+	for (reg = 0; reg < 128; reg++) {
+		if (writes[0][reg] && (reads[1][reg] || writes[1][reg]))
+			return false;
+
+		if (writes[1][reg] && reads[0][reg])
+			return false;
+	}
+
+	return true;
+}
+
+static void fp_alu_fuse(alu_instr *first, const alu_instr *second)
+{
+	unsigned k;
+
+	for (k = 0; k < 4; k++)
+		if (!fp_alu_slot_nop(&second->a[k]))
+			first->a[k] = second->a[k];
+}
+
+static unsigned fp_fuse_alu(struct fp_batch *batch)
+{
+	unsigned fused = 0, i, k;
+
+	for (i = 0; i + 1 < batch->alu_nb; ) {
+		if (!fp_alu_can_fuse(&batch->alu[i], &batch->alu[i + 1])) {
+			i++;
+			continue;
+		}
+
+		fp_alu_fuse(&batch->alu[i], &batch->alu[i + 1]);
+
+		for (k = i + 1; k + 1 < batch->alu_nb; k++)
+			batch->alu[k] = batch->alu[k + 1];
+
+		batch->alu_nb--;
+		fused++;
+	}
+
+	return fused;
+}
+
+static bool fp_program_reads_alu_results(const struct fp_program *prog)
+{
+	uint8_t regs[128];
+	unsigned i, n, k, reg;
+
+	for (i = 0; i < prog->batches_nb; i++) {
+		const struct fp_batch *batch = &prog->batches[i];
+
+		for (n = 0; n < batch->alu_nb; n++) {
+			memset(regs, 0, sizeof(regs));
+
+			for (k = 0; k < 4; k++)
+				if (!fp_alu_slot_nop(&batch->alu[n].a[k]))
+					fp_alu_slot_reads(&batch->alu[n].a[k],
+							  regs);
+
+			for (reg = FRAGMENT_ALU_RESULT_REG_0;
+			     reg <= FRAGMENT_ALU_RESULT_REG_3; reg++)
+				if (regs[reg])
+					return true;
+		}
+	}
+
+	return false;
+}
+
+static bool fp_can_merge(const struct fp_batch *first, unsigned first_stages,
+			 const struct fp_batch *second, unsigned second_stages,
+			 bool alu_chaining)
+{
+	unsigned last, next;
+
+	if (first->pseq.data || second->pseq.data)
+		return false;
+
+	if (!first_stages || !second_stages)
+		return true;
+
+	last = 31 - __builtin_clz(first_stages);
+	next = __builtin_ctz(second_stages);
+
+	if (last < next)
+		return true;
+
+	/* ALU instructions of both batches execute one after another */
+	if (!alu_chaining || last != FP_STAGE_ALU || next != FP_STAGE_ALU ||
+	    first->alu_nb + second->alu_nb > FP_MAX_ALU)
+		return false;
+
+	return !first->complement || !second->complement ||
+	       first->complement == second->complement;
+}
+
+static void fp_merge(struct fp_batch *first, const struct fp_batch *second)
+{
+	unsigned i;
+
+	for (i = 0; i < second->mfu_nb; i++)
+		first->mfu[first->mfu_nb++] = second->mfu[i];
+
+	if (second->tex.data)
+		first->tex = second->tex;
+
+	for (i = 0; i < second->alu_nb; i++)
+		first->alu[first->alu_nb++] = second->alu[i];
+
+	if (second->complement)
+		first->complement = second->complement;
+
+	if (second->dw.data)
+		first->dw = second->dw;
+}
+
+/*
+ * Merges batches in place, map[] gets the new index of every original
+ * batch. Returns the new number of batches.
+ */
+static unsigned fp_merge_batches(struct fp_program *prog, bool alu_chaining,
+				 unsigned map[FP_MAX_BATCHES])
+{
+	struct fp_batch *batches = prog->batches;
+	unsigned stages[FP_MAX_BATCHES];
+	unsigned i, n = 0;
+
+	for (i = 0; i < prog->batches_nb; i++)
+		stages[i] = fp_batch_stages(&batches[i]);
+
+	for (i = 0; i < prog->batches_nb; i++) {
+		if (n && fp_can_merge(&batches[n - 1], stages[n - 1],
+				      &batches[i], stages[i], alu_chaining)) {
+			fp_merge(&batches[n - 1], &batches[i]);
+			stages[n - 1] |= stages[i];
+
+			/* ALU slots of the joined batches may share a slot */
+			if (alu_chaining)
+				fp_fuse_alu(&batches[n - 1]);
+
+			map[i] = n - 1;
+			continue;
+		}
+
+		if (n != i) {
+			batches[n] = batches[i];
+			stages[n] = stages[i];
+		}
+
+		map[i] = n++;
+	}
+
+	return n;
+}
+
+static struct grate_shader *fp_encode(struct grate_shader *fs,
+				      const struct fp_program *prog)
+{
+	struct grate_shader *shader;
+	unsigned n = prog->batches_nb, mfu_nb = 0, alu_nb = 0;
+	unsigned i, k, words = 0, mfu_address = 0, alu_address = 0;
+	uint32_t *w;
+
+	for (i = 0; i < n; i++) {
+		mfu_nb += prog->batches[i].mfu_nb;
+		alu_nb += prog->batches[i].alu_nb;
+	}
+
+	shader = grate_shader_copy(fs, 9 + n * 6 + mfu_nb * 2 + alu_nb * 8);
+	if (!shader)
+		return NULL;
+
+	w = shader->words;
+
+	w[words++] = HOST1X_OPCODE_NONINCR(0x541, n);
+	for (i = 0; i < n; i++)
+		w[words++] = prog->batches[i].pseq.data;
+
+	w[words++] = HOST1X_OPCODE_IMM(0x500, 0x0);
+
+	w[words++] = HOST1X_OPCODE_NONINCR(0x601, n);
+	for (i = 0; i < n; i++) {
+		instr_sched sched = { .data = 0 };
+
+		/* like the assembler, batches without MFU get a zero entry */
+		if (prog->batches[i].mfu_nb) {
+			sched.instructions_nb = prog->batches[i].mfu_nb;
+			sched.address = mfu_address;
+		}
+
+		mfu_address += prog->batches[i].mfu_nb;
+		w[words++] = sched.data;
+	}
+
+	w[words++] = HOST1X_OPCODE_NONINCR(0x604, mfu_nb * 2);
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < prog->batches[i].mfu_nb; k++) {
+			w[words++] = prog->batches[i].mfu[k].part1;
+			w[words++] = prog->batches[i].mfu[k].part0;
+		}
+	}
+
+	w[words++] = HOST1X_OPCODE_NONINCR(0x701, n);
+	for (i = 0; i < n; i++)
+		w[words++] = prog->batches[i].tex.data;
+
+	w[words++] = HOST1X_OPCODE_NONINCR(0x801, n);
+	for (i = 0; i < n; i++) {
+		instr_sched sched = { .data = 0 };
+
+		if (prog->batches[i].alu_nb) {
+			sched.instructions_nb = prog->batches[i].alu_nb;
+			sched.address = alu_address;
+		}
+
+		alu_address += prog->batches[i].alu_nb;
+
+		if (prog->t114)
+			w[words++] = to_114_alu_sched(sched.data).data;
+		else
+			w[words++] = sched.data;
+	}
+
+	w[words++] = HOST1X_OPCODE_NONINCR(0x804, alu_nb * 8);
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < prog->batches[i].alu_nb; k++) {
+			const alu_instr *instr = &prog->batches[i].alu[k];
+
+			w[words++] = instr->part1;
+			w[words++] = instr->part0;
+			w[words++] = instr->part3;
+			w[words++] = instr->part2;
+			w[words++] = instr->part5;
+			w[words++] = instr->part4;
+			w[words++] = instr->part7;
+			w[words++] = instr->part6;
+		}
+	}
+
+	w[words++] = HOST1X_OPCODE_NONINCR(0x806, n);
+	for (i = 0; i < n; i++)
+		w[words++] = prog->batches[i].complement;
+
+	w[words++] = HOST1X_OPCODE_NONINCR(0x901, n);
+	for (i = 0; i < n; i++)
+		w[words++] = prog->batches[i].dw.data;
+
+	return shader;
+}
+
+int grate_fragment_schedule(struct grate_program *program)
+{
+	struct grate_shader *fs = program->fs, *shader;
+	unsigned map[FP_MAX_BATCHES];
+	unsigned batches_nb, alu_nb, i;
+	struct fp_program *prog;
+	bool alu_chaining;
+	int err;
+
+	prog = calloc(1, sizeof(*prog));
+	if (!prog)
+		return -ENOMEM;
+
+	/* programs not produced by the assembler are left alone */
+	err = fp_program_decode(fs, prog);
+	if (err < 0) {
+		free(prog);
+		return 0;
+	}
+
+	batches_nb = prog->batches_nb;
+	alu_nb = prog->alu_nb;
+	alu_chaining = !fp_program_reads_alu_results(prog);
+
+	if (alu_chaining)
+		for (i = 0; i < prog->batches_nb; i++)
+			fp_fuse_alu(&prog->batches[i]);
+
+	prog->batches_nb = fp_merge_batches(prog, alu_chaining, map);
+
+	for (i = 0, prog->alu_nb = 0; i < prog->batches_nb; i++)
+		prog->alu_nb += prog->batches[i].alu_nb;
+
+	if (prog->batches_nb == batches_nb && prog->alu_nb == alu_nb) {
+		free(prog);
+		return 0;
+	}
+
+	shader = fp_encode(fs, prog);
+	if (!shader) {
+		free(prog);
+		return -ENOMEM;
+	}
+
+	shader->pseq_inst_nb = prog->batches_nb;
+
+	if (fs->pseq_to_dw_nb && fs->pseq_to_dw_nb <= batches_nb)
+		shader->pseq_to_dw_nb = map[fs->pseq_to_dw_nb - 1] + 1;
+
+	grate_info("fragment program: %u -> %u instructions, "
+		   "%u -> %u ALU instructions\n", batches_nb,
+		   prog->batches_nb, alu_nb, prog->alu_nb);
+
+	free(prog);
+
+	/* the original may be shared, leave it intact */
+	grate_shader_free(program->fs);
+	program->fs = shader;
+
+	return 0;
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "host1x.h"
+
+#include "frustum.h"
+
+/*
+ * Objects are split into stripes tested by separate threads, each stripe
+ * writes its indices to its own part of the output which is compacted
+ * afterwards, hence the order is that of a single-threaded cull.
+ */
+
+#define FRUSTUM_MAX_THREADS		8
+#define FRUSTUM_MIN_PER_THREAD		16384
+
+enum frustum_object {
+	FRUSTUM_BOXES,
+	FRUSTUM_SPHERES,
+};
+
+struct frustum_job {
+	const struct frustum *f;
+	enum frustum_object type;
+	const void *objects;
+	unsigned int *visible;
+	unsigned int start;
+	unsigned int stop;
+	unsigned int count;
+};
+
+static void frustum_set_plane(struct frustum *f, unsigned int i,
+			      float a, float b, float c, float d)
+{
+	float len = sqrtf(a * a + b * b + c * c);
+
+	if (len > 0.0f) {
+		a /= len;
+		b /= len;
+		c /= len;
+		d /= len;
+	}
+
+	f->nx[i] = a;
+	f->ny[i] = b;
+	f->nz[i] = c;
+	f->d[i] = d;
+	f->ax[i] = fabsf(a);
+	f->ay[i] = fabsf(b);
+	f->az[i] = fabsf(c);
+}
+
+/* planes of the rows of the matrix, -w <= x, y, z <= w in clip space */
+void frustum_from_mat4(struct frustum *f, const struct mat4 *m)
+{
+	unsigned int i;
+
+	frustum_set_plane(f, 0, m->wx + m->xx, m->wy + m->xy,
+			  m->wz + m->xz, m->ww + m->xw);
+	frustum_set_plane(f, 1, m->wx - m->xx, m->wy - m->xy,
+			  m->wz - m->xz, m->ww - m->xw);
+	frustum_set_plane(f, 2, m->wx + m->yx, m->wy + m->yy,
+			  m->wz + m->yz, m->ww + m->yw);
+	frustum_set_plane(f, 3, m->wx - m->yx, m->wy - m->yy,
+			  m->wz - m->yz, m->ww - m->yw);
+	frustum_set_plane(f, 4, m->wx + m->zx, m->wy + m->zy,
+			  m->wz + m->zz, m->ww + m->zw);
+	frustum_set_plane(f, 5, m->wx - m->zx, m->wy - m->zy,
+			  m->wz - m->zz, m->ww - m->zw);
+
+	for (i = 6; i < 8; i++)
+		frustum_set_plane(f, i, f->nx[0], f->ny[0], f->nz[0], f->d[0]);
+}
+
+/*
+ * The center is outside if it is further behind a plane than the extent
+ * of the box along the normal of the plane plus the radius.
+ */
+static bool frustum_test(const struct frustum *f, const float c[3],
+			 const float e[3], float r)
+{
+#ifdef __ARM_NEON
+	uint32x4_t out = vdupq_n_u32(0);
+	uint32x2_t any;
+	unsigned int i;
+
+	for (i = 0; i < 8; i += 4) {
+		float32x4_t dist = vld1q_f32(f->d + i);
+
+		dist = vmlaq_n_f32(dist, vld1q_f32(f->nx + i), c[0]);
+		dist = vmlaq_n_f32(dist, vld1q_f32(f->ny + i), c[1]);
+		dist = vmlaq_n_f32(dist, vld1q_f32(f->nz + i), c[2]);
+		dist = vmlaq_n_f32(dist, vld1q_f32(f->ax + i), e[0]);
+		dist = vmlaq_n_f32(dist, vld1q_f32(f->ay + i), e[1]);
+		dist = vmlaq_n_f32(dist, vld1q_f32(f->az + i), e[2]);
+		dist = vaddq_f32(dist, vdupq_n_f32(r));
+
+		out = vorrq_u32(out, vcltq_f32(dist, vdupq_n_f32(0.0f)));
+	}
+
+	any = vorr_u32(vget_low_u32(out), vget_high_u32(out));
+
+	return !(vget_lane_u32(any, 0) | vget_lane_u32(any, 1));
+#else
+	unsigned int i;
+
+	for (i = 0; i < 6; i++) {
+		float dist = f->d[i] + r;
+
+		dist += f->nx[i] * c[0] + f->ny[i] * c[1] + f->nz[i] * c[2];
+		dist += f->ax[i] * e[0] + f->ay[i] * e[1] + f->az[i] * e[2];
+
+		if (dist < 0.0f)
+			return false;
+	}
+
+	return true;
+#endif
+}
+
+static void frustum_cull_stripe(struct frustum_job *job)
+{
+	const struct aabb *boxes = job->objects;
+	const struct sphere *spheres = job->objects;
+	unsigned int *visible = job->visible + job->start;
+	float c[3], e[3], r;
+	unsigned int i;
+
+	job->count = 0;
+
+	for (i = job->start; i < job->stop; i++) {
+		if (job->type == FRUSTUM_BOXES) {
+			c[0] = (boxes[i].min.x + boxes[i].max.x) * 0.5f;
+			c[1] = (boxes[i].min.y + boxes[i].max.y) * 0.5f;
+			c[2] = (boxes[i].min.z + boxes[i].max.z) * 0.5f;
+			e[0] = (boxes[i].max.x - boxes[i].min.x) * 0.5f;
+			e[1] = (boxes[i].max.y - boxes[i].min.y) * 0.5f;
+			e[2] = (boxes[i].max.z - boxes[i].min.z) * 0.5f;
+			r = 0.0f;
+		} else {
+			c[0] = spheres[i].center.x;
+			c[1] = spheres[i].center.y;
+			c[2] = spheres[i].center.z;
+			e[0] = e[1] = e[2] = 0.0f;
+			r = spheres[i].radius;
+		}
+
+		if (frustum_test(job->f, c, e, r))
+			visible[job->count++] = i;
+	}
+}
+
+static void *frustum_cull_thread(void *data)
+{
+	frustum_cull_stripe(data);
+
+	return NULL;
+}
+
+static unsigned int frustum_cull(const struct frustum *f,
+				 enum frustum_object type,
+				 const void *objects, unsigned int count,
+				 unsigned int *visible)
+{
+	struct frustum_job jobs[FRUSTUM_MAX_THREADS + 1];
+	pthread_t threads[FRUSTUM_MAX_THREADS];
+	bool started[FRUSTUM_MAX_THREADS];
+	unsigned int num_threads, start = 0, num_visible, i;
+	long cpus;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	num_threads = count / FRUSTUM_MIN_PER_THREAD;
+
+	if (cpus > 0 && num_threads >= (unsigned long)cpus)
+		num_threads = cpus - 1;
+
+	num_threads = MIN(num_threads, FRUSTUM_MAX_THREADS);
+
+	for (i = 0; i <= num_threads; i++) {
+		jobs[i].f = f;
+		jobs[i].type = type;
+		jobs[i].objects = objects;
+		jobs[i].visible = visible;
+		jobs[i].start = start;
+
+		start += count / (num_threads + 1);
+		jobs[i].stop = i == num_threads ? count : start;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		started[i] = !pthread_create(&threads[i], NULL,
+					     frustum_cull_thread, &jobs[i]);
+		if (!started[i])
+			frustum_cull_stripe(&jobs[i]);
+	}
+
+	/* the calling thread takes the last stripe */
+	frustum_cull_stripe(&jobs[num_threads]);
+
+	for (i = 0; i < num_threads; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+
+	num_visible = jobs[0].count;
+
+	for (i = 1; i <= num_threads; i++) {
+		memmove(visible + num_visible, visible + jobs[i].start,
+			jobs[i].count * sizeof(*visible));
+		num_visible += jobs[i].count;
+	}
+
+	return num_visible;
+}
+
+unsigned int frustum_cull_boxes(const struct frustum *f,
+				const struct aabb *boxes, unsigned int count,
+				unsigned int *visible)
+{
+	return frustum_cull(f, FRUSTUM_BOXES, boxes, count, visible);
+}
+
+unsigned int frustum_cull_spheres(const struct frustum *f,
+				  const struct sphere *spheres,
+				  unsigned int count, unsigned int *visible)
+{
+	return frustum_cull(f, FRUSTUM_SPHERES, spheres, count, visible);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Avionic Design GmbH
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef GRATE_FRUSTUM_H
+#define GRATE_FRUSTUM_H 1
+
+#include "matrix.h"
+
+struct aabb {
+	struct vec3 min;
+	struct vec3 max;
+};
+
+struct sphere {
+	struct vec3 center;
+	float radius;
+};
+
+/*
+ * Normalized planes of the clip volume, padded to eight planes with
+ * copies of the first so that they are tested four at a time.
+ */
+struct frustum {
+	float nx[8], ny[8], nz[8], d[8];
+	float ax[8], ay[8], az[8];
+};
+
+void frustum_from_mat4(struct frustum *f, const struct mat4 *view_projection);
+
+/*
+ * Write the indices of the objects that intersect the frustum to visible,
+ * in increasing order, and return their number. The tests are
+ * conservative, objects near a corner of the frustum may be kept. Large
+ * arrays are tested in parallel.
+ */
+unsigned int frustum_cull_boxes(const struct frustum *f,
+				const struct aabb *boxes, unsigned int count,
+				unsigned int *visible);
+unsigned int frustum_cull_spheres(const struct frustum *f,
+				  const struct sphere *spheres,
+				  unsigned int count, unsigned int *visible);
+
+#endif
@@ -22,6 +22,9 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <string.h>
+
 #include "../libhost1x/host1x-private.h"
 #include "libgrate-private.h"
 
@@ -36,14 +39,190 @@ void grate_clear_color(struct grate *grate, float red, float green,
 	grate->clear.a = alpha;
 }
 
+void grate_clear_depth(struct grate *grate, float depth)
+{
+	grate->clear_depth = depth;
+}
+
+void grate_clear_stencil(struct grate *grate, uint8_t stencil)
+{
+	grate->clear_stencil = stencil;
+}
+
+static uint32_t grate_clear_color_value(const struct grate_color *clear,
+					struct host1x_pixelbuffer *pixbuf)
+{
+	if (PIX_BUF_FORMAT_BITS(pixbuf->format) == 16)
+		return ((uint32_t)(clear->r * 31) << 11) |
+		       ((uint32_t)(clear->g * 63) <<  5) |
+		       ((uint32_t)(clear->b * 31) <<  0);
+
+	return ((uint32_t)(clear->a * 255) << 24) |
+	       ((uint32_t)(clear->b * 255) << 16) |
+	       ((uint32_t)(clear->g * 255) <<  8) |
+	       ((uint32_t)(clear->r * 255) <<  0);
+}
+
+/*
+ * The depth value is written as a 16-bit fixed point number, which is
+ * exact for the linear format. For the non-linear format only the 0.0
+ * and 1.0 values (the common cases) are represented exactly.
+ */
+static uint32_t grate_clear_depth_value(float depth)
+{
+	if (depth < 0.0f)
+		depth = 0.0f;
+
+	if (depth > 1.0f)
+		depth = 1.0f;
+
+	return (uint32_t)(depth * 0xffff);
+}
+
+/* fill the damaged regions of the surface, or all of it */
+static int grate_clear_surface(const struct grate_damage *damage,
+			       struct host1x_gr2d_batch *batch,
+			       struct host1x_pixelbuffer *pixbuf,
+			       uint32_t value)
+{
+	unsigned int i;
+	int err;
+
+	if (!damage || damage->full)
+		return host1x_gr2d_batch_clear_rect(batch, pixbuf, value, 0, 0,
+						    pixbuf->width,
+						    pixbuf->height);
+
+	for (i = 0; i < damage->count; i++) {
+		const struct grate_rect *rect = &damage->rects[i];
+		unsigned int width, height;
+
+		if (rect->x >= pixbuf->width || rect->y >= pixbuf->height)
+			continue;
+
+		/* depth and stencil buffers may be smaller than the fb */
+		width = MIN(rect->width, pixbuf->width - rect->x);
+		height = MIN(rect->height, pixbuf->height - rect->y);
+
+		err = host1x_gr2d_batch_clear_rect(batch, pixbuf, value,
+						   rect->x, rect->y,
+						   width, height);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Fill the surfaces using GR2D fills recorded into a single job. GR3D
+ * waits for the job in-stream, so no CPU stall happens.
+ */
+static int grate_clear_surfaces(struct grate *grate,
+				const struct grate_damage *damage,
+				struct host1x_pixelbuffer **surfaces,
+				const uint32_t *values, unsigned int count)
+{
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
+	struct host1x_gr2d_batch batch;
+	struct grate_fence fence;
+	uint64_t start = grate_trace_now(grate);
+	unsigned int i;
+	int err;
+
+	if (!count)
+		return 0;
+
+	err = host1x_gr2d_batch_begin(gr2d, &batch);
+	if (err < 0) {
+		grate_error("host1x_gr2d_batch_begin() failed: %d\n", err);
+		return err;
+	}
+
+	for (i = 0; i < count; i++) {
+		grate_transient_wait(grate, surfaces[i]);
+
+		err = grate_clear_surface(damage, &batch, surfaces[i],
+					  values[i]);
+		if (err < 0) {
+			grate_error("clear failed: %d\n", err);
+			host1x_gr2d_batch_submit(&batch, NULL);
+			return err;
+		}
+	}
+
+	memset(&fence, 0, sizeof(fence));
+	fence.client = gr2d->client;
+
+	err = host1x_gr2d_batch_submit(&batch, &fence.value);
+	if (err < 0) {
+		grate_error("host1x_gr2d_batch_submit() failed: %d\n", err);
+		return err;
+	}
+
+	for (i = 0; i < count; i++)
+		fence.pixbufs[i] = surfaces[i];
+
+	fence.num_pixbufs = count;
+
+	err = grate_3d_wait_fence(grate, &fence);
+	if (err < 0)
+		grate_error("grate_3d_wait_fence() failed: %d\n", err);
+
+	grate_trace_cpu(grate, "gr2d clear", start);
+
+	return err;
+}
+
+/*
+ * Clear the colour buffer of the bound framebuffer and the depth and
+ * stencil buffers bound to the context.
+ */
+void grate_clear_buffers(struct grate *grate, struct grate_3d_ctx *ctx,
+			 unsigned int mask)
+{
+	struct host1x_pixelbuffer *surfaces[3];
+	struct host1x_pixelbuffer *pixbuf;
+	uint32_t values[3];
+	unsigned int count = 0;
+
+	if (!grate->fb) {
+		grate_error("no framebuffer bound to state\n");
+		return;
+	}
+
+	if (mask & GRATE_CLEAR_COLOR) {
+		pixbuf = grate_get_draw_pixbuf(grate->fb);
+		values[count] = grate_clear_color_value(&grate->clear, pixbuf);
+		surfaces[count++] = pixbuf;
+	}
+
+	if (ctx && (mask & GRATE_CLEAR_DEPTH)) {
+		pixbuf = ctx->render_targets[0].pixbuf;
+		if (pixbuf) {
+			values[count] = grate_clear_depth_value(
+						grate->clear_depth);
+			surfaces[count++] = pixbuf;
+		}
+	}
+
+	if (ctx && (mask & GRATE_CLEAR_STENCIL)) {
+		pixbuf = ctx->render_targets[2].pixbuf;
+		if (pixbuf) {
+			values[count] = grate->clear_stencil;
+			surfaces[count++] = pixbuf;
+		}
+	}
+
+	grate_clear_surfaces(grate, &grate->fb->damage, surfaces, values,
+			     count);
+}
+
 void grate_clear(struct grate *grate)
 {
 	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
-	struct host1x_framebuffer *front = grate->fb->front;
-	struct host1x_framebuffer *back = grate->fb->back;
 	struct host1x_pixelbuffer *pixbuf;
-	struct grate_color *clear = &grate->clear;
-	uint32_t color;
+	uint64_t start;
 	int err;
 
 	if (!grate->fb) {
@@ -51,20 +230,349 @@ void grate_clear(struct grate *grate)
 		return;
 	}
 
-	pixbuf = back ? back->pixbuf : front->pixbuf;
-
-	if (PIX_BUF_FORMAT_BITS(pixbuf->format) == 16) {
-		color = ((uint32_t)(clear->r * 31) << 11) |
-			((uint32_t)(clear->g * 63) <<  5) |
-			((uint32_t)(clear->b * 31) <<  0);
-	} else {
-		color = ((uint32_t)(clear->a * 255) << 24) |
-			((uint32_t)(clear->b * 255) << 16) |
-			((uint32_t)(clear->g * 255) <<  8) |
-			((uint32_t)(clear->r * 255) <<  0);
+	if (!grate->fb->damage.full) {
+		grate_clear_buffers(grate, NULL, GRATE_CLEAR_COLOR);
+		return;
 	}
 
-	err = host1x_gr2d_clear(gr2d, pixbuf, color);
+	pixbuf = grate_get_draw_pixbuf(grate->fb);
+	start = grate_trace_now(grate);
+
+	err = host1x_gr2d_clear(gr2d, pixbuf,
+				grate_clear_color_value(&grate->clear, pixbuf));
 	if (err < 0)
 		grate_error("host1x_gr2d_clear() failed: %d\n", err);
+
+	grate_trace_cpu(grate, "gr2d clear", start);
+}
+
+/*
+ * A clear is skipped if it can't be observed, that is the content of the
+ * attachment is discarded at the end of the pass and the pass doesn't
+ * read the attachment.
+ */
+static bool grate_pass_clear_needed(const struct grate_3d_ctx *ctx,
+				    const struct grate_attachment_ops *ops,
+				    unsigned int index)
+{
+	if (ops->load != GRATE_LOAD_ACTION_CLEAR)
+		return false;
+
+	if (ops->store != GRATE_STORE_ACTION_DISCARD || !ctx)
+		return true;
+
+	switch (index) {
+	case 0:
+		return ctx->depth_test;
+	case 2:
+		return ctx->stencil_test;
+	default:
+		return ctx->render_targets_enable_mask & (1 << index);
+	}
+}
+
+/*
+ * Render pass names its attachments once, the colour buffer bound to the
+ * render target 1 of the context, or the framebuffer, and the depth and
+ * stencil buffers of the context. Their clears are issued as one GR2D job
+ * that GR3D waits for in-stream, followed by the draws of the pass batched
+ * into one GR3D job that is submitted by grate_render_pass_end().
+ */
+int grate_render_pass_begin(struct grate *grate, struct grate_3d_ctx *ctx,
+			    const struct grate_render_pass *pass)
+{
+	const struct grate_damage *damage = NULL;
+	struct host1x_pixelbuffer *surfaces[3];
+	struct host1x_pixelbuffer *color;
+	struct grate_color clear;
+	uint32_t values[3];
+	unsigned int count = 0;
+	int err;
+
+	if (grate->pass_active) {
+		grate_error("render pass is already active\n");
+		return -EBUSY;
+	}
+
+	color = ctx ? ctx->render_targets[1].pixbuf : NULL;
+
+	/* the framebuffer needs only its damaged regions to be cleared */
+	if (grate->fb) {
+		if (!color)
+			color = grate_get_draw_pixbuf(grate->fb);
+
+		if (color == grate_get_draw_pixbuf(grate->fb))
+			damage = &grate->fb->damage;
+	}
+
+	if (color && grate_pass_clear_needed(ctx, &pass->color, 1)) {
+		clear.r = pass->clear_color[0];
+		clear.g = pass->clear_color[1];
+		clear.b = pass->clear_color[2];
+		clear.a = pass->clear_color[3];
+
+		values[count] = grate_clear_color_value(&clear, color);
+		surfaces[count++] = color;
+	}
+
+	if (ctx && ctx->render_targets[0].pixbuf &&
+	    grate_pass_clear_needed(ctx, &pass->depth, 0)) {
+		values[count] = grate_clear_depth_value(pass->clear_depth);
+		surfaces[count++] = ctx->render_targets[0].pixbuf;
+	}
+
+	if (ctx && ctx->render_targets[2].pixbuf &&
+	    grate_pass_clear_needed(ctx, &pass->stencil, 2)) {
+		values[count] = pass->clear_stencil;
+		surfaces[count++] = ctx->render_targets[2].pixbuf;
+	}
+
+	err = grate_clear_surfaces(grate, damage, surfaces, values, count);
+	if (err < 0)
+		return err;
+
+	/* draws issued within an outer batch stay in it */
+	grate->pass_batched = grate->batch.active;
+	grate->pass_active = true;
+
+	if (!grate->pass_batched)
+		grate_3d_begin_batch(grate);
+
+	return 0;
+}
+
+int grate_render_pass_end(struct grate *grate, struct grate_fence *fence)
+{
+	if (!grate->pass_active) {
+		grate_error("no render pass is active\n");
+		return -EINVAL;
+	}
+
+	grate->pass_active = false;
+
+	if (grate->pass_batched)
+		return 0;
+
+	return grate_3d_end_batch(grate, fence);
+}
+
+struct grate_video_frame {
+	struct host1x_yuv_frame yuv;
+};
+
+struct grate_video_frame *grate_video_frame_create(struct grate *grate,
+						   unsigned width,
+						   unsigned height)
+{
+	struct host1x_pixelbuffer *planes[3];
+	struct grate_video_frame *frame;
+	unsigned i, w, h, pitch;
+
+	frame = calloc(1, sizeof(*frame));
+	if (!frame)
+		return NULL;
+
+	for (i = 0; i < 3; i++) {
+		/* the chroma planes are subsampled in both directions */
+		w = i ? (width + 1) / 2 : width;
+		h = i ? (height + 1) / 2 : height;
+		pitch = ALIGN(w, PIX_BUF_FORMAT_ALIGNMENT(PIX_BUF_FMT_L8));
+
+		planes[i] = host1x_pixelbuffer_create(grate->host1x, w, h, pitch,
+						      PIX_BUF_FMT_L8,
+						      PIX_BUF_LAYOUT_LINEAR);
+		if (!planes[i]) {
+			while (i--)
+				host1x_pixelbuffer_free(planes[i]);
+
+			free(frame);
+			return NULL;
+		}
+
+		host1x_bo_set_category(planes[i]->bo, HOST1X_MEM_TEXTURE);
+	}
+
+	frame->yuv.y = planes[0];
+	frame->yuv.u = planes[1];
+	frame->yuv.v = planes[2];
+
+	return frame;
+}
+
+void grate_video_frame_free(struct grate_video_frame *frame)
+{
+	host1x_pixelbuffer_free(frame->yuv.y);
+	host1x_pixelbuffer_free(frame->yuv.u);
+	host1x_pixelbuffer_free(frame->yuv.v);
+	free(frame);
+}
+
+/* uploads the Y, U and V planes of a decoded frame */
+int grate_video_frame_load(struct grate *grate,
+			   struct grate_video_frame *frame,
+			   void *planes[3], const unsigned pitches[3])
+{
+	struct host1x_pixelbuffer *pixbufs[3] = {
+		frame->yuv.y, frame->yuv.u, frame->yuv.v,
+	};
+	unsigned i;
+	int err;
+
+	for (i = 0; i < 3; i++) {
+		err = host1x_pixelbuffer_load_data(grate->host1x, pixbufs[i],
+						   planes[i], pitches[i],
+						   pitches[i] *
+						   pixbufs[i]->height,
+						   PIX_BUF_FMT_L8,
+						   PIX_BUF_LAYOUT_LINEAR);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Blit the whole frame into the rectangle of the bound framebuffer. The
+ * blit is recorded into a GR2D job that GR3D waits for in-stream, like
+ * the clears.
+ */
+int grate_video_blit(struct grate *grate, struct grate_video_frame *frame,
+		     enum host1x_csc csc, unsigned x, unsigned y,
+		     unsigned width, unsigned height)
+{
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
+	struct host1x_pixelbuffer *src = frame->yuv.y;
+	struct host1x_pixelbuffer *dst;
+	struct host1x_gr2d_batch batch;
+	struct grate_fence fence;
+	uint64_t start = grate_trace_now(grate);
+	int err;
+
+	if (!grate->fb) {
+		grate_error("no framebuffer bound to state\n");
+		return -EINVAL;
+	}
+
+	dst = grate_get_draw_pixbuf(grate->fb);
+
+	if (x + width > dst->width || y + height > dst->height)
+		return -EINVAL;
+
+	err = host1x_gr2d_batch_begin(gr2d, &batch);
+	if (err < 0) {
+		grate_error("host1x_gr2d_batch_begin() failed: %d\n", err);
+		return err;
+	}
+
+	/* framebuffers are stored bottom-up, frames top-down */
+	err = host1x_gr2d_batch_yuv_blit(&batch, &frame->yuv, csc, dst,
+					 0, 0, src->width, src->height,
+					 x, dst->height - y - height,
+					 width, -(int)height);
+	if (err < 0) {
+		grate_error("YUV blit failed: %d\n", err);
+		host1x_gr2d_batch_submit(&batch, NULL);
+		return err;
+	}
+
+	memset(&fence, 0, sizeof(fence));
+	fence.client = gr2d->client;
+
+	err = host1x_gr2d_batch_submit(&batch, &fence.value);
+	if (err < 0) {
+		grate_error("host1x_gr2d_batch_submit() failed: %d\n", err);
+		return err;
+	}
+
+	fence.pixbufs[0] = dst;
+	fence.num_pixbufs = 1;
+
+	err = grate_3d_wait_fence(grate, &fence);
+	if (err < 0)
+		grate_error("grate_3d_wait_fence() failed: %d\n", err);
+
+	grate_trace_cpu(grate, "gr2d video blit", start);
+
+	return err;
+}
+
+/*
+ * Framebuffers are stored bottom-up, rotating a bottom-up image by 90
+ * degrees clockwise is a rotation by 270 degrees of its memory and so on.
+ */
+static const enum host1x_gr2d_rotation grate_rotation_bottom_up[] = {
+	[HOST1X_GR2D_FLIP_X] = HOST1X_GR2D_FLIP_X,
+	[HOST1X_GR2D_FLIP_Y] = HOST1X_GR2D_FLIP_Y,
+	[HOST1X_GR2D_TRANSPOSE] = HOST1X_GR2D_ANTI_TRANSPOSE,
+	[HOST1X_GR2D_ANTI_TRANSPOSE] = HOST1X_GR2D_TRANSPOSE,
+	[HOST1X_GR2D_ROTATE_90] = HOST1X_GR2D_ROTATE_270,
+	[HOST1X_GR2D_ROTATE_180] = HOST1X_GR2D_ROTATE_180,
+	[HOST1X_GR2D_ROTATE_270] = HOST1X_GR2D_ROTATE_90,
+	[HOST1X_GR2D_ROTATE_0] = HOST1X_GR2D_ROTATE_0,
+};
+
+/*
+ * Rotate the whole draw buffer of src into the draw buffer of the bound
+ * framebuffer by GR2D, which is how a frame rendered in portrait is
+ * presented on a landscape display without a GR3D pass. Both have to be
+ * linear, GR3D waits for the blit in-stream.
+ */
+int grate_framebuffer_rotate(struct grate *grate,
+			     struct grate_framebuffer *src,
+			     enum host1x_gr2d_rotation rotation)
+{
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
+	struct host1x_pixelbuffer *src_pixbuf, *dst_pixbuf;
+	uint64_t start = grate_trace_now(grate);
+	struct host1x_gr2d_batch batch;
+	struct grate_fence fence;
+	int err;
+
+	if (!grate->fb) {
+		grate_error("no framebuffer bound to state\n");
+		return -EINVAL;
+	}
+
+	if (rotation > HOST1X_GR2D_ROTATE_0)
+		return -EINVAL;
+
+	src_pixbuf = grate_get_draw_pixbuf(src);
+	dst_pixbuf = grate_get_draw_pixbuf(grate->fb);
+
+	err = host1x_gr2d_batch_begin(gr2d, &batch);
+	if (err < 0) {
+		grate_error("host1x_gr2d_batch_begin() failed: %d\n", err);
+		return err;
+	}
+
+	err = host1x_gr2d_batch_rotate_blit(&batch, src_pixbuf, dst_pixbuf,
+					    grate_rotation_bottom_up[rotation],
+					    0, 0, 0, 0, src_pixbuf->width,
+					    src_pixbuf->height);
+	if (err < 0) {
+		grate_error("rotate blit failed: %d\n", err);
+		host1x_gr2d_batch_submit(&batch, NULL);
+		return err;
+	}
+
+	memset(&fence, 0, sizeof(fence));
+	fence.client = gr2d->client;
+
+	err = host1x_gr2d_batch_submit(&batch, &fence.value);
+	if (err < 0) {
+		grate_error("host1x_gr2d_batch_submit() failed: %d\n", err);
+		return err;
+	}
+
+	fence.pixbufs[0] = dst_pixbuf;
+	fence.num_pixbufs = 1;
+
+	err = grate_3d_wait_fence(grate, &fence);
+	if (err < 0)
+		grate_error("grate_3d_wait_fence() failed: %d\n", err);
+
+	grate_trace_cpu(grate, "gr2d rotate", start);
+
+	return err;
 }
@@ -23,41 +23,73 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 #include "libgrate-private.h"
 #include "grate-3d.h"
+#include "grate-float.h"
 #include "tgr_3d.xml.h"
 
-static uint32_t float_to_fp20(float f)
+struct grate_3d_ctx_saved {
+	struct grate_3d_ctx_saved *next;
+	struct grate_3d_ctx ctx;
+};
+
+/* four floats at a time, using the same rules as float_to_fp20() */
+void float_to_fp20_array(uint32_t *dst, const float *src, unsigned count)
 {
-	uint32_t sign, mantissa, exponent;
-	union {
-		uint32_t u;
-		float f;
-	} value;
+	unsigned i = 0;
 
-	if (f == 0.0f)
-		return 0;
+#ifdef __ARM_NEON
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t f = vld1q_f32(src + i);
+		uint32x4_t u = vreinterpretq_u32_f32(f);
+		uint32x4_t sign, exponent, mantissa, value;
 
-	value.f = f;
+		sign = vshlq_n_u32(vshrq_n_u32(u, 31), 19);
+		exponent = vandq_u32(vshrq_n_u32(u, 23), vdupq_n_u32(0xff));
+		mantissa = vshrq_n_u32(vandq_u32(u, vdupq_n_u32(0x7fffff)), 10);
 
-	sign = (value.u >> 31) & 0x1;
-	exponent = (value.u >> 23) & 0xff;
-	mantissa = (value.u >>  0) & 0x7fffff;
+		/* infinity and NaN keep the maximum exponent */
+		exponent = vbslq_u32(vceqq_u32(exponent, vdupq_n_u32(0xff)),
+				     vdupq_n_u32(0x3f),
+				     vandq_u32(vsubq_u32(exponent,
+							 vdupq_n_u32(96)),
+					       vdupq_n_u32(0x3f)));
 
-	if (exponent == 0xff)
-		exponent = 0x3f;
-	else
-		exponent = (exponent - 127 + 31) & 0x3f;
+		value = vorrq_u32(vorrq_u32(sign, vshlq_n_u32(exponent, 13)),
+				  mantissa);
 
-	return (sign << 19) | (exponent << 13) | (mantissa >> (23 - 13));
+		/* both of the zeros are encoded as 0 */
+		value = vbicq_u32(value, vceqq_f32(f, vdupq_n_f32(0.0f)));
+
+		vst1q_u32(dst + i, value);
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = float_to_fp20(src[i]);
 }
 
-static uint32_t float_to_fx10(float f)
+void float_to_fx10_array(uint32_t *dst, const float *src, unsigned count)
 {
-	uint32_t u = f * 256.0f;
-	return u & 0x3ff;
+	unsigned i = 0;
+
+#ifdef __ARM_NEON
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t f = vmulq_n_f32(vld1q_f32(src + i), 256.0f);
+		uint32x4_t value = vreinterpretq_u32_s32(vcvtq_s32_f32(f));
+
+		vst1q_u32(dst + i, vandq_u32(value, vdupq_n_u32(0x3ff)));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = float_to_fx10(src[i]);
 }
 
 struct grate_3d_ctx * grate_3d_alloc_ctx(struct grate *grate)
@@ -70,14 +102,301 @@ struct grate_3d_ctx * grate_3d_alloc_ctx(struct grate *grate)
 	}
 
 	ctx->grate = grate;
+	ctx->depth_test_mode = GRATE_3D_CTX_DEPTH_TEST_AUTO;
+	grate_3d_ctx_invalidate(ctx);
 
 	return ctx;
 }
 
+void grate_3d_free_ctx(struct grate_3d_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	grate_3d_ctx_release(ctx);
+	free(ctx);
+}
+
+struct grate_3d_consts *grate_3d_consts_create(unsigned start, unsigned end)
+{
+	struct grate_3d_consts *consts;
+
+	consts = calloc(1, sizeof(*consts) + (end - start) * 16);
+	if (!consts)
+		return NULL;
+
+	consts->refcount = 1;
+	consts->start = start;
+	consts->end = end;
+
+	return consts;
+}
+
+void grate_3d_consts_put(struct grate_3d_consts *consts)
+{
+	if (consts && !__sync_sub_and_fetch(&consts->refcount, 1))
+		free(consts);
+}
+
+/*
+ * Snapshot of a context. The constants are shared with the source until
+ * either of the contexts writes them, the copy must be released with
+ * grate_3d_ctx_release() once it is no longer needed.
+ */
+void grate_3d_ctx_copy(struct grate_3d_ctx *dst,
+		       const struct grate_3d_ctx *src)
+{
+	*dst = *src;
+	dst->saved = NULL;
+	grate_3d_consts_get(dst->vs_uniforms);
+}
+
+void grate_3d_ctx_release(struct grate_3d_ctx *ctx)
+{
+	struct grate_3d_ctx_saved *saved;
+
+	while ((saved = ctx->saved)) {
+		ctx->saved = saved->next;
+		grate_3d_ctx_release(&saved->ctx);
+		free(saved);
+	}
+
+	grate_3d_consts_put(ctx->vs_uniforms);
+	ctx->vs_uniforms = NULL;
+}
+
+/*
+ * Make the constants of the context writable for the vec4 range
+ * [start, end), un-sharing and growing the block as needed.
+ */
+static uint32_t *grate_3d_ctx_write_consts(struct grate_3d_ctx *ctx,
+					   unsigned start, unsigned end)
+{
+	struct grate_3d_consts *consts = ctx->vs_uniforms, *copy;
+
+	if (consts && consts->refcount == 1 &&
+	    start >= consts->start && end <= consts->end)
+		return &consts->values[(start - consts->start) * 4];
+
+	if (consts) {
+		start = MIN(start, consts->start);
+		end = MAX(end, consts->end);
+	}
+
+	copy = grate_3d_consts_create(start, end);
+	if (!copy)
+		return NULL;
+
+	if (consts) {
+		memcpy(&copy->values[(consts->start - start) * 4],
+		       consts->values, (consts->end - consts->start) * 16);
+		grate_3d_consts_put(consts);
+	}
+
+	ctx->vs_uniforms = copy;
+
+	return &copy->values[(start - copy->start) * 4];
+}
+
+void grate_3d_ctx_invalidate(struct grate_3d_ctx *ctx)
+{
+	static unsigned int ids;
+
+	/*
+	 * Context with a new ID isn't resident in hardware, hence all of
+	 * its state will be emitted on the next draw. Contexts may be
+	 * created by multiple recording threads.
+	 */
+	ctx->id = __sync_add_and_fetch(&ids, 1);
+	ctx->dirty = GRATE_3D_CTX_DIRTY_ALL;
+	ctx->textures_dirty_mask = 0xffff;
+	ctx->vs_uniforms_dirty_start = 0;
+	ctx->vs_uniforms_dirty_end = 0;
+}
+
+#define GRATE_3D_CTX_FIELD(field, dirty)				\
+	{ offsetof(struct grate_3d_ctx, field),				\
+	  sizeof(((struct grate_3d_ctx *)0)->field), dirty }
+
+/* fields restored by grate_3d_ctx_pop() and the state they belong to */
+static const struct {
+	size_t offset;
+	size_t size;
+	uint32_t dirty;
+} grate_3d_ctx_fields[] = {
+	GRATE_3D_CTX_FIELD(fs_uniforms, GRATE_3D_CTX_DIRTY_FS_UNIFORMS),
+	GRATE_3D_CTX_FIELD(program, GRATE_3D_CTX_DIRTY_PROGRAM),
+	GRATE_3D_CTX_FIELD(render_targets, GRATE_3D_CTX_DIRTY_RENDER_TARGETS),
+	GRATE_3D_CTX_FIELD(render_targets_enable_mask,
+			   GRATE_3D_CTX_DIRTY_RENDER_TARGETS),
+	GRATE_3D_CTX_FIELD(vtx_attributes, GRATE_3D_CTX_DIRTY_ATTRIBUTES),
+	GRATE_3D_CTX_FIELD(attributes_enable_mask,
+			   GRATE_3D_CTX_DIRTY_ATTRIBUTES),
+	GRATE_3D_CTX_FIELD(depth_range_near, GRATE_3D_CTX_DIRTY_DEPTH_RANGE),
+	GRATE_3D_CTX_FIELD(depth_range_far, GRATE_3D_CTX_DIRTY_DEPTH_RANGE),
+	GRATE_3D_CTX_FIELD(point_size, GRATE_3D_CTX_DIRTY_POINT),
+	GRATE_3D_CTX_FIELD(point_coord_range_min_s, GRATE_3D_CTX_DIRTY_POINT),
+	GRATE_3D_CTX_FIELD(point_coord_range_min_t, GRATE_3D_CTX_DIRTY_POINT),
+	GRATE_3D_CTX_FIELD(point_coord_range_max_s, GRATE_3D_CTX_DIRTY_POINT),
+	GRATE_3D_CTX_FIELD(point_coord_range_max_t, GRATE_3D_CTX_DIRTY_POINT),
+	GRATE_3D_CTX_FIELD(point_params, GRATE_3D_CTX_DIRTY_POINT),
+	GRATE_3D_CTX_FIELD(line_width, GRATE_3D_CTX_DIRTY_LINE),
+	GRATE_3D_CTX_FIELD(line_params, GRATE_3D_CTX_DIRTY_LINE),
+	GRATE_3D_CTX_FIELD(viewport_x_bias, GRATE_3D_CTX_DIRTY_VIEWPORT),
+	GRATE_3D_CTX_FIELD(viewport_y_bias, GRATE_3D_CTX_DIRTY_VIEWPORT),
+	GRATE_3D_CTX_FIELD(viewport_z_bias, GRATE_3D_CTX_DIRTY_VIEWPORT),
+	GRATE_3D_CTX_FIELD(viewport_x_scale, GRATE_3D_CTX_DIRTY_VIEWPORT),
+	GRATE_3D_CTX_FIELD(viewport_y_scale, GRATE_3D_CTX_DIRTY_VIEWPORT),
+	GRATE_3D_CTX_FIELD(viewport_z_scale, GRATE_3D_CTX_DIRTY_VIEWPORT),
+	GRATE_3D_CTX_FIELD(guarband_enabled, GRATE_3D_CTX_DIRTY_VIEWPORT),
+	GRATE_3D_CTX_FIELD(polygon_offset_units,
+			   GRATE_3D_CTX_DIRTY_POLYGON_OFFSET),
+	GRATE_3D_CTX_FIELD(polygon_offset_factor,
+			   GRATE_3D_CTX_DIRTY_POLYGON_OFFSET),
+	/* emitted with every draw */
+	GRATE_3D_CTX_FIELD(provoking_vtx_last, 0),
+	GRATE_3D_CTX_FIELD(tri_face_front_cw, GRATE_3D_CTX_DIRTY_CULL_FACE),
+	GRATE_3D_CTX_FIELD(cull_face, GRATE_3D_CTX_DIRTY_CULL_FACE),
+	GRATE_3D_CTX_FIELD(depth_test, GRATE_3D_CTX_DIRTY_DEPTH_TEST |
+				       GRATE_3D_CTX_DIRTY_RENDER_TARGETS),
+	GRATE_3D_CTX_FIELD(depth_write, GRATE_3D_CTX_DIRTY_DEPTH_TEST),
+	GRATE_3D_CTX_FIELD(depth_func, GRATE_3D_CTX_DIRTY_DEPTH_TEST),
+	GRATE_3D_CTX_FIELD(depth_test_mode, GRATE_3D_CTX_DIRTY_DEPTH_TEST),
+	GRATE_3D_CTX_FIELD(stencil_test, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_func_front, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_fail_op_front, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_zfail_op_front, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_zpass_op_front, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_func_back, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_fail_op_back, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_zfail_op_back, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_zpass_op_back, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_ref_front, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_ref_back, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_mask_front, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(stencil_mask_back, GRATE_3D_CTX_DIRTY_STENCIL),
+	GRATE_3D_CTX_FIELD(dither_unk, GRATE_3D_CTX_DIRTY_DITHER),
+	GRATE_3D_CTX_FIELD(scissor_x, GRATE_3D_CTX_DIRTY_SCISSOR),
+	GRATE_3D_CTX_FIELD(scissor_y, GRATE_3D_CTX_DIRTY_SCISSOR),
+	GRATE_3D_CTX_FIELD(scissor_width, GRATE_3D_CTX_DIRTY_SCISSOR),
+	GRATE_3D_CTX_FIELD(scissor_heigth, GRATE_3D_CTX_DIRTY_SCISSOR),
+	/* pre-pass bookkeeping, the state it swaps has entries of its own */
+	GRATE_3D_CTX_FIELD(prepass, 0),
+};
+
+/*
+ * Saves the state of the context, to be restored by grate_3d_ctx_pop().
+ * Unlike a copy, the context keeps its ID and thus stays resident in
+ * hardware, state changed in between is emitted as usual.
+ */
+int grate_3d_ctx_push(struct grate_3d_ctx *ctx)
+{
+	struct grate_3d_ctx_saved *saved;
+
+	saved = malloc(sizeof(*saved));
+	if (!saved) {
+		grate_error("Failed to allocate saved state\n");
+		return -1;
+	}
+
+	grate_3d_ctx_copy(&saved->ctx, ctx);
+	saved->next = ctx->saved;
+	ctx->saved = saved;
+
+	return 0;
+}
+
+/*
+ * Restores the state saved by the last grate_3d_ctx_push(). Only the
+ * state that differs from the saved one is marked dirty, hence a draw
+ * after the pop re-emits just what was changed in between.
+ */
+int grate_3d_ctx_pop(struct grate_3d_ctx *ctx)
+{
+	struct grate_3d_ctx_saved *saved = ctx->saved;
+	const uint8_t *src;
+	uint8_t *dst;
+	unsigned int i;
+
+	if (!saved) {
+		grate_error("No saved state\n");
+		return -1;
+	}
+
+	src = (const uint8_t *)&saved->ctx;
+	dst = (uint8_t *)ctx;
+
+	for (i = 0; i < ARRAY_SIZE(grate_3d_ctx_fields); i++) {
+		size_t offset = grate_3d_ctx_fields[i].offset;
+		size_t size = grate_3d_ctx_fields[i].size;
+
+		if (!memcmp(dst + offset, src + offset, size))
+			continue;
+
+		memcpy(dst + offset, src + offset, size);
+		ctx->dirty |= grate_3d_ctx_fields[i].dirty;
+	}
+
+	/*
+	 * The versions tell what was emitted for the units, a unit emitted
+	 * in between is emitted again rather than restoring its version.
+	 */
+	for (i = 0; i < 16; i++) {
+		if (ctx->textures[i] == saved->ctx.textures[i] &&
+		    ctx->samplers[i] == saved->ctx.samplers[i] &&
+		    ctx->textures_version[i] == saved->ctx.textures_version[i])
+			continue;
+
+		ctx->textures[i] = saved->ctx.textures[i];
+		ctx->samplers[i] = saved->ctx.samplers[i];
+		ctx->textures_dirty_mask |= 1u << i;
+	}
+
+	/* constants are un-shared from the saved ones once written */
+	if (ctx->vs_uniforms != saved->ctx.vs_uniforms) {
+		grate_3d_consts_put(ctx->vs_uniforms);
+		ctx->vs_uniforms = saved->ctx.vs_uniforms;
+		saved->ctx.vs_uniforms = NULL;
+
+		if (ctx->vs_uniforms)
+			grate_3d_ctx_vs_uniforms_dirty(ctx,
+						       ctx->vs_uniforms->start,
+						       ctx->vs_uniforms->end);
+		if (ctx->program)
+			grate_3d_ctx_vs_uniforms_dirty(ctx,
+					ctx->program->vs_constants_start,
+					ctx->program->vs_constants_end);
+	}
+
+	ctx->saved = saved->next;
+	grate_3d_ctx_release(&saved->ctx);
+	free(saved);
+
+	return 0;
+}
+
 int grate_3d_ctx_vertex_attrib_pointer(struct grate_3d_ctx *ctx,
 				       unsigned location, unsigned size,
 				       unsigned type, unsigned stride,
 				       struct host1x_bo *data_bo)
+{
+	struct host1x_bo_view view;
+
+	if (!data_bo) {
+		grate_error("Invalid data BO ptr\n");
+		return -1;
+	}
+
+	host1x_bo_view_init(&view, data_bo, 0, data_bo->size);
+
+	return grate_3d_ctx_vertex_attrib_pointer_view(ctx, location, size,
+						       type, stride, &view);
+}
+
+int grate_3d_ctx_vertex_attrib_pointer_view(struct grate_3d_ctx *ctx,
+					    unsigned location, unsigned size,
+					    unsigned type, unsigned stride,
+					    const struct host1x_bo_view *view)
 {
 	struct grate_vtx_attribute *attr;
 
@@ -108,23 +427,19 @@ int grate_3d_ctx_vertex_attrib_pointer(struct grate_3d_ctx *ctx,
 		return -1;
 	}
 
-	if (!data_bo) {
+	if (!view->bo) {
 		grate_error("Invalid data BO ptr\n");
 		return -1;
 	}
 
-	attr = calloc(1, sizeof(*attr));
-	if (!attr) {
-		grate_error("Allocation failed\n");
-		return -1;
-	}
-
+	attr = &ctx->vtx_attributes[location];
 	attr->stride = stride;
 	attr->type = type;
 	attr->size = size;
-	attr->bo = data_bo;
+	attr->bo = view->bo;
+	attr->offset = view->offset;
 
-	ctx->vtx_attributes[location] = attr;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_ATTRIBUTES;
 
 	return 0;
 }
@@ -139,6 +454,8 @@ int grate_3d_ctx_enable_vertex_attrib_array(struct grate_3d_ctx *ctx,
 
 	ctx->attributes_enable_mask |= 1u << location;
 
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_ATTRIBUTES;
+
 	return 0;
 }
 
@@ -152,38 +469,120 @@ int grate_3d_ctx_disable_vertex_attrib_array(struct grate_3d_ctx *ctx,
 
 	ctx->attributes_enable_mask &= ~(1u << target);
 
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_ATTRIBUTES;
+
 	return 0;
 }
 
-int grate_3d_ctx_bind_render_target(struct grate_3d_ctx *ctx,
-				    unsigned target,
-				    struct host1x_pixelbuffer *pixbuf)
+/*
+ * Encode the RT_PARAMS word of a render target, done once when the
+ * pixbuf is bound instead of on every draw.
+ */
+static int grate_3d_ctx_encode_render_target(struct grate_render_target *rt)
 {
+	struct host1x_pixelbuffer *pixbuf = rt->pixbuf;
+	unsigned pixel_format;
+	uint32_t value = 0;
+	bool dither;
+
 	switch (pixbuf->format) {
 	case PIX_BUF_FMT_A8:
+		pixel_format = TGR3D_PIXEL_FORMAT_A8;
+		break;
 	case PIX_BUF_FMT_L8:
+		pixel_format = TGR3D_PIXEL_FORMAT_L8;
+		break;
 	case PIX_BUF_FMT_S8:
+		pixel_format = TGR3D_PIXEL_FORMAT_S8;
+		break;
 	case PIX_BUF_FMT_LA88:
+		pixel_format = TGR3D_PIXEL_FORMAT_LA88;
+		break;
 	case PIX_BUF_FMT_RGB565:
+		pixel_format = TGR3D_PIXEL_FORMAT_RGB565;
+		break;
 	case PIX_BUF_FMT_RGBA5551:
+		pixel_format = TGR3D_PIXEL_FORMAT_RGBA5551;
+		break;
 	case PIX_BUF_FMT_RGBA4444:
+		pixel_format = TGR3D_PIXEL_FORMAT_RGBA4444;
+		break;
 	case PIX_BUF_FMT_D16_LINEAR:
+		pixel_format = TGR3D_PIXEL_FORMAT_D16_LINEAR;
+		break;
 	case PIX_BUF_FMT_D16_NONLINEAR:
+		pixel_format = TGR3D_PIXEL_FORMAT_D16_NONLINEAR;
+		break;
 	case PIX_BUF_FMT_RGBA8888:
+		pixel_format = TGR3D_PIXEL_FORMAT_RGBA8888;
+		break;
 	case PIX_BUF_FMT_BGRA8888:
+		pixel_format = TGR3D_PIXEL_FORMAT_BGRA8888;
+		break;
 	case PIX_BUF_FMT_RGBA_FP32:
+		pixel_format = TGR3D_PIXEL_FORMAT_RGBA_FP32;
 		break;
 	default:
 		grate_error("Invalid format %u\n", pixbuf->format);
 		return -1;
 	}
 
+	switch (pixbuf->layout) {
+	case PIX_BUF_LAYOUT_LINEAR:
+	case PIX_BUF_LAYOUT_TILED_16x16:
+		break;
+	default:
+		grate_error("Invalid layout %u\n", pixbuf->layout);
+		return -1;
+	}
+
+	switch (pixbuf->format) {
+	case PIX_BUF_FMT_RGB565:
+	case PIX_BUF_FMT_RGBA5551:
+	case PIX_BUF_FMT_RGBA4444:
+		/* banding of the 16 bit gradients is apparent otherwise */
+		dither = rt->dither_set ? rt->dither_enabled : true;
+		break;
+	default:
+		dither = rt->dither_enabled;
+		break;
+	}
+
+	value |= TGR3D_BOOL(RT_PARAMS, DITHER_ENABLE, dither);
+	value |= TGR3D_VAL(RT_PARAMS, FORMAT, pixel_format);
+	value |= TGR3D_VAL(RT_PARAMS, PITCH, pixbuf->pitch);
+	value |= TGR3D_BOOL(RT_PARAMS, TILED,
+			    pixbuf->layout == PIX_BUF_LAYOUT_TILED_16x16);
+
+	rt->pixel_format = pixel_format;
+	rt->params = value;
+
+	return 0;
+}
+
+int grate_3d_ctx_bind_render_target(struct grate_3d_ctx *ctx,
+				    unsigned target,
+				    struct host1x_pixelbuffer *pixbuf)
+{
+	struct grate_render_target rt;
+
 	if (target >= 16) {
 		grate_error("Invalid target location %u\n", target);
 		return -1;
 	}
 
-	ctx->render_targets[target].pixbuf = pixbuf;
+	if (pixbuf && host1x_pixelbuffer_populate(pixbuf) < 0)
+		return -1;
+
+	rt = ctx->render_targets[target];
+	rt.pixbuf = pixbuf;
+
+	if (grate_3d_ctx_encode_render_target(&rt))
+		return -1;
+
+	ctx->render_targets[target] = rt;
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
 
 	return 0;
 }
@@ -198,6 +597,12 @@ int grate_3d_ctx_set_render_target_dither(struct grate_3d_ctx *ctx,
 	}
 
 	ctx->render_targets[target].dither_enabled = enable;
+	ctx->render_targets[target].dither_set = true;
+
+	if (ctx->render_targets[target].pixbuf)
+		grate_3d_ctx_encode_render_target(&ctx->render_targets[target]);
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
 
 	return 0;
 }
@@ -212,6 +617,8 @@ int grate_3d_ctx_enable_render_target(struct grate_3d_ctx *ctx,
 
 	ctx->render_targets_enable_mask |= 1u << target;
 
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
+
 	return 0;
 }
 
@@ -225,6 +632,51 @@ int grate_3d_ctx_disable_render_target(struct grate_3d_ctx *ctx,
 
 	ctx->render_targets_enable_mask &= ~(1u << target);
 
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
+
+	return 0;
+}
+
+int grate_3d_ctx_bind_outputs(struct grate_3d_ctx *ctx,
+			      struct host1x_pixelbuffer **pixbufs,
+			      unsigned int count)
+{
+	uint32_t mask = ctx->render_targets_enable_mask;
+	unsigned int i, target;
+	uint32_t missing;
+
+	if (count > GRATE_3D_CTX_MAX_OUTPUTS) {
+		grate_error("Invalid outputs count %u\n", count);
+		return -1;
+	}
+
+	for (i = 0; i < GRATE_3D_CTX_MAX_OUTPUTS; i++) {
+		target = GRATE_3D_CTX_OUTPUT_RT(i);
+
+		if (i >= count) {
+			mask &= ~(1u << target);
+			continue;
+		}
+
+		if (grate_3d_ctx_bind_render_target(ctx, target, pixbufs[i]))
+			return -1;
+
+		mask |= 1u << target;
+	}
+
+	ctx->render_targets_enable_mask = mask;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
+
+	if (!ctx->program)
+		return 0;
+
+	/* stores to disabled targets are dropped silently */
+	missing = grate_program_render_targets(ctx->program) & ~mask &
+		  ~((1u << 0) | (1u << 2));
+	if (missing)
+		grate_error("Program outputs to disabled targets %#x\n",
+			    missing);
+
 	return 0;
 }
 
@@ -238,12 +690,19 @@ int grate_3d_ctx_bind_program(struct grate_3d_ctx *ctx,
 
 	ctx->program = program;
 
-	memcpy(ctx->vs_uniforms, program->vs_constants,
-	       sizeof(ctx->vs_uniforms));
+	/* the constants are copied only once a uniform is set */
+	grate_3d_consts_put(ctx->vs_uniforms);
+	ctx->vs_uniforms = grate_3d_consts_get(program->vs_constants);
 
 	memcpy(ctx->fs_uniforms, program->fs_constants,
 	       sizeof(ctx->fs_uniforms));
 
+	grate_3d_ctx_vs_uniforms_dirty(ctx, program->vs_constants_start,
+				       program->vs_constants_end);
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_PROGRAM |
+		      GRATE_3D_CTX_DIRTY_FS_UNIFORMS;
+
 	return 0;
 }
 
@@ -251,6 +710,8 @@ int grate_3d_ctx_set_vertex_uniform(struct grate_3d_ctx *ctx,
 				    unsigned location, unsigned nb,
 				    float *values)
 {
+	uint32_t *consts;
+
 	if (!ctx->program) {
 		grate_error("No program bound\n");
 		return -1;
@@ -261,7 +722,17 @@ int grate_3d_ctx_set_vertex_uniform(struct grate_3d_ctx *ctx,
 		return -1;
 	}
 
-	memcpy(&ctx->vs_uniforms[location * 4], values, nb * sizeof(float));
+	consts = grate_3d_ctx_write_consts(ctx, location,
+					   location + (nb + 3) / 4);
+	if (!consts) {
+		grate_error("Failed to allocate constants\n");
+		return -1;
+	}
+
+	memcpy(consts, values, nb * sizeof(float));
+
+	grate_3d_ctx_vs_uniforms_dirty(ctx, location,
+				       location + (nb + 3) / 4);
 
 	return 0;
 }
@@ -273,20 +744,20 @@ int grate_3d_ctx_set_vertex_mat4_uniform(struct grate_3d_ctx *ctx,
 					       16, (float *) mat);
 }
 
-int grate_3d_ctx_set_fragment_uniform(struct grate_3d_ctx *ctx,
-				      unsigned location, unsigned nb,
-				      float *value)
+/*
+ * Converts the values of the fragment uniform at the location into the
+ * registers, used for the context and for the constants of specialised
+ * programs.
+ */
+int grate_3d_fragment_uniform_store(uint32_t *fs_uniforms,
+				    unsigned location, unsigned nb,
+				    const float *value)
 {
 	bool lowp = !!(location & 0x8000);
 	unsigned components_mask = (location >> 8) & 0xF;
 	unsigned components_nb = 0;
 	unsigned i;
 
-	if (!ctx->program) {
-		grate_error("No program bound\n");
-		return -1;
-	}
-
 	if (location == ~0u) {
 		grate_error("Invalid location %u\n", location);
 		return -1;
@@ -334,14 +805,14 @@ int grate_3d_ctx_set_fragment_uniform(struct grate_3d_ctx *ctx,
 			uint32_t fx10_val = float_to_fx10(value[i]);
 
 			if (fx10_high) {
-				ctx->fs_uniforms[position] &= 0x3ff;
-				ctx->fs_uniforms[position] |= fx10_val << 10;
+				fs_uniforms[position] &= 0x3ff;
+				fs_uniforms[position] |= fx10_val << 10;
 			} else {
-				ctx->fs_uniforms[position] &= ~0x3ff;
-				ctx->fs_uniforms[position] |= fx10_val;
+				fs_uniforms[position] &= ~0x3ff;
+				fs_uniforms[position] |= fx10_val;
 			}
 		} else {
-			ctx->fs_uniforms[position] = float_to_fp20(value[i]);
+			fs_uniforms[position] = float_to_fp20(value[i]);
 		}
 
 		location += lowp ? 1 : 2;
@@ -350,6 +821,81 @@ int grate_3d_ctx_set_fragment_uniform(struct grate_3d_ctx *ctx,
 	return 0;
 }
 
+int grate_3d_ctx_set_fragment_uniform(struct grate_3d_ctx *ctx,
+				      unsigned location, unsigned nb,
+				      float *value)
+{
+	int err;
+
+	if (!ctx->program) {
+		grate_error("No program bound\n");
+		return -1;
+	}
+
+	err = grate_3d_fragment_uniform_store(ctx->fs_uniforms, location,
+					      nb, value);
+	if (err < 0)
+		return err;
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_FS_UNIFORMS;
+
+	return 0;
+}
+
+/*
+ * Uploads count consecutive scalar registers starting at location, the
+ * components mask of the location is ignored. Highp registers are fp20,
+ * lowp are pairs of fx10 halves packed into one register.
+ */
+int grate_3d_ctx_set_fragment_uniform_array(struct grate_3d_ctx *ctx,
+					    unsigned location, unsigned count,
+					    const float *values)
+{
+	bool lowp = !!(location & 0x8000);
+	uint32_t fx10[64];
+	unsigned i;
+
+	if (!ctx->program) {
+		grate_error("No program bound\n");
+		return -1;
+	}
+
+	if (location == ~0u) {
+		grate_error("Invalid location %u\n", location);
+		return -1;
+	}
+
+	location &= 0xFF;
+
+	if (lowp ? location + count > 64 : (location >> 1) + count > 32) {
+		grate_error("Invalid location %u for %u values\n",
+			    location, count);
+		return -1;
+	}
+
+	if (!lowp) {
+		float_to_fp20_array(ctx->fs_uniforms + (location >> 1),
+				    values, count);
+		goto out;
+	}
+
+	float_to_fx10_array(fx10, values, count);
+
+	for (i = 0; i < count; i++, location++) {
+		uint32_t *reg = &ctx->fs_uniforms[location >> 1];
+
+		if (location & 1)
+			*reg = (*reg & 0x3ff) | fx10[i] << 10;
+		else
+			*reg = (*reg & ~0x3ff) | fx10[i];
+	}
+
+out:
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_FS_UNIFORMS;
+
+	return 0;
+}
+
 int grate_3d_ctx_set_fragment_float_uniform(struct grate_3d_ctx *ctx,
 					    unsigned location, float value)
 {
@@ -361,11 +907,13 @@ void grate_3d_ctx_set_depth_range(struct grate_3d_ctx *ctx,
 {
 	ctx->depth_range_near = near;
 	ctx->depth_range_far = far;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_DEPTH_RANGE;
 }
 
 void grate_3d_ctx_set_dither(struct grate_3d_ctx *ctx, uint32_t unk)
 {
 	ctx->dither_unk = unk;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_DITHER;
 }
 
 void grate_3d_ctx_set_viewport_bias(struct grate_3d_ctx *ctx,
@@ -374,6 +922,7 @@ void grate_3d_ctx_set_viewport_bias(struct grate_3d_ctx *ctx,
 	ctx->viewport_x_bias = x;
 	ctx->viewport_y_bias = y;
 	ctx->viewport_z_bias = z;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_VIEWPORT;
 }
 
 void grate_3d_ctx_set_viewport_scale(struct grate_3d_ctx *ctx,
@@ -382,31 +931,37 @@ void grate_3d_ctx_set_viewport_scale(struct grate_3d_ctx *ctx,
 	ctx->viewport_x_scale = width;
 	ctx->viewport_y_scale = height;
 	ctx->viewport_z_scale = depth;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_VIEWPORT;
 }
 
 void grate_3d_ctx_set_point_params(struct grate_3d_ctx *ctx, uint32_t params)
 {
 	ctx->point_params = params;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_POINT;
 }
 
 void grate_3d_ctx_set_point_size(struct grate_3d_ctx *ctx, float size)
 {
 	ctx->point_size = size;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_POINT;
 }
 
 void grate_3d_ctx_set_line_params(struct grate_3d_ctx *ctx, uint32_t params)
 {
 	ctx->line_params = params;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_LINE;
 }
 
 void grate_3d_ctx_set_line_width(struct grate_3d_ctx *ctx, float width)
 {
 	ctx->line_width = width;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_LINE;
 }
 
 void grate_3d_ctx_use_guardband(struct grate_3d_ctx *ctx, bool enabled)
 {
 	ctx->guarband_enabled = enabled;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_VIEWPORT;
 }
 
 void grate_3d_ctx_set_front_direction_is_cw(struct grate_3d_ctx *ctx,
@@ -433,6 +988,7 @@ void grate_3d_ctx_set_front_direction_is_cw(struct grate_3d_ctx *ctx,
 	}
 
 	ctx->tri_face_front_cw = front_cw;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_CULL_FACE;
 }
 
 void grate_3d_ctx_set_cull_face(struct grate_3d_ctx *ctx,
@@ -462,6 +1018,8 @@ void grate_3d_ctx_set_cull_face(struct grate_3d_ctx *ctx,
 	default:
 		grate_error("Invalid cull face %u\n", cull_face);
 	}
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_CULL_FACE;
 }
 
 void grate_3d_ctx_set_scissor(struct grate_3d_ctx *ctx,
@@ -472,6 +1030,7 @@ void grate_3d_ctx_set_scissor(struct grate_3d_ctx *ctx,
 	ctx->scissor_y = y;
 	ctx->scissor_width = width;
 	ctx->scissor_heigth = height;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_SCISSOR;
 }
 
 void grate_3d_ctx_set_point_coord_range(struct grate_3d_ctx *ctx,
@@ -482,6 +1041,7 @@ void grate_3d_ctx_set_point_coord_range(struct grate_3d_ctx *ctx,
 	ctx->point_coord_range_max_s = max_s;
 	ctx->point_coord_range_min_t = min_t;
 	ctx->point_coord_range_max_t = max_t;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_POINT;
 }
 
 void grate_3d_ctx_set_polygon_offset(struct grate_3d_ctx *ctx,
@@ -489,6 +1049,7 @@ void grate_3d_ctx_set_polygon_offset(struct grate_3d_ctx *ctx,
 {
 	ctx->polygon_offset_units = units;
 	ctx->polygon_offset_factor = factor;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_POLYGON_OFFSET;
 }
 
 void grate_3d_ctx_set_provoking_vtx_last(struct grate_3d_ctx *ctx, bool last)
@@ -505,7 +1066,30 @@ int grate_3d_ctx_bind_texture(struct grate_3d_ctx *ctx,
 		return -1;
 	}
 
+	/* an evicted texture is reloaded when it's drawn with */
+	if (tex && tex->resident)
+		grate_texture_residency_touch(tex);
+
 	ctx->textures[location] = tex;
+	ctx->textures_dirty_mask |= 1u << location;
+
+	return 0;
+}
+
+int grate_3d_ctx_bind_sampler(struct grate_3d_ctx *ctx,
+			      unsigned location,
+			      const struct grate_sampler *sampler)
+{
+	if (location >= 16) {
+		grate_error("Invalid location %u\n", location);
+		return -1;
+	}
+
+	if (ctx->samplers[location] == sampler)
+		return 0;
+
+	ctx->samplers[location] = sampler;
+	ctx->textures_dirty_mask |= 1u << location;
 
 	return 0;
 }
@@ -548,22 +1132,144 @@ void grate_3d_ctx_set_depth_func(struct grate_3d_ctx *ctx,
 	default:
 		grate_error("Invalid depth function %u\n", func);
 	}
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_DEPTH_TEST;
 }
 
 void grate_3d_ctx_perform_depth_test(struct grate_3d_ctx *ctx, bool enable)
 {
 	ctx->depth_test = enable;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_DEPTH_TEST |
+		      GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
 }
 
 void grate_3d_ctx_perform_depth_write(struct grate_3d_ctx *ctx, bool enable)
 {
 	ctx->depth_write = enable;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_DEPTH_TEST;
+}
+
+void grate_3d_ctx_set_depth_test_mode(struct grate_3d_ctx *ctx,
+				      enum grate_3d_ctx_depth_test_mode mode)
+{
+	switch (mode) {
+	case GRATE_3D_CTX_DEPTH_TEST_AUTO:
+	case GRATE_3D_CTX_DEPTH_TEST_EARLY:
+	case GRATE_3D_CTX_DEPTH_TEST_LATE:
+		break;
+	default:
+		grate_error("Invalid depth test mode %u\n", mode);
+		return;
+	}
+
+	ctx->depth_test_mode = mode;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_DEPTH_TEST;
+}
+
+/*
+ * Swaps the program without resetting the uniforms like binding does, the
+ * vertex programs are the same and the vertex uniforms stay valid.
+ */
+static void grate_3d_ctx_swap_program(struct grate_3d_ctx *ctx,
+				      struct grate_program *program,
+				      const uint32_t *fs_uniforms)
+{
+	ctx->program = program;
+
+	memcpy(ctx->fs_uniforms, fs_uniforms, sizeof(ctx->fs_uniforms));
+
+	grate_3d_ctx_vs_uniforms_dirty(ctx, program->vs_constants_start,
+				       program->vs_constants_end);
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_PROGRAM |
+		      GRATE_3D_CTX_DIRTY_FS_UNIFORMS;
+}
+
+int grate_3d_ctx_begin_depth_prepass(struct grate_3d_ctx *ctx,
+				     struct grate_program *depth_program)
+{
+	if (!depth_program || !ctx->program) {
+		grate_error("Bad program ptr\n");
+		return -1;
+	}
+
+	if (ctx->prepass.active) {
+		grate_error("Depth pre-pass is active already\n");
+		return -1;
+	}
+
+	ctx->prepass.program = ctx->program;
+	ctx->prepass.render_targets_enable_mask =
+					ctx->render_targets_enable_mask;
+	ctx->prepass.depth_func = ctx->depth_func;
+	ctx->prepass.depth_write = ctx->depth_write;
+	ctx->prepass.active = true;
+
+	memcpy(ctx->prepass.fs_uniforms, ctx->fs_uniforms,
+	       sizeof(ctx->prepass.fs_uniforms));
+
+	grate_3d_ctx_swap_program(ctx, depth_program,
+				  depth_program->fs_constants);
+
+	/* only the depth and stencil buffers are written */
+	ctx->render_targets_enable_mask &= (1u << 0) | (1u << 2);
+	ctx->depth_test = true;
+	ctx->depth_write = true;
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_DEPTH_TEST |
+		      GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
+
+	return 0;
+}
+
+int grate_3d_ctx_begin_shading_pass(struct grate_3d_ctx *ctx)
+{
+	if (!ctx->prepass.active) {
+		grate_error("Depth pre-pass isn't active\n");
+		return -1;
+	}
+
+	grate_3d_ctx_swap_program(ctx, ctx->prepass.program,
+				  ctx->prepass.fs_uniforms);
+
+	ctx->render_targets_enable_mask =
+				ctx->prepass.render_targets_enable_mask;
+	ctx->depth_func = TGR3D_COMPARE_FUNC_EQUAL;
+	ctx->depth_write = false;
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_DEPTH_TEST |
+		      GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
+
+	return 0;
+}
+
+void grate_3d_ctx_end_depth_prepass(struct grate_3d_ctx *ctx)
+{
+	if (!ctx->prepass.active)
+		return;
+
+	/* the shading pass may have been skipped */
+	if (ctx->program != ctx->prepass.program) {
+		grate_3d_ctx_swap_program(ctx, ctx->prepass.program,
+					  ctx->prepass.fs_uniforms);
+
+		ctx->render_targets_enable_mask =
+				ctx->prepass.render_targets_enable_mask;
+	}
+
+	ctx->depth_func = ctx->prepass.depth_func;
+	ctx->depth_write = ctx->prepass.depth_write;
+	ctx->prepass.active = false;
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_DEPTH_TEST |
+		      GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
 }
 
 int grate_3d_ctx_bind_depth_buffer(struct grate_3d_ctx *ctx,
 				   struct host1x_pixelbuffer *pixbuf)
 {
 	ctx->render_targets[0].pixbuf = NULL;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
 
 	switch (pixbuf->format) {
 	case PIX_BUF_FMT_D16_LINEAR:
@@ -585,12 +1291,14 @@ int grate_3d_ctx_bind_depth_buffer(struct grate_3d_ctx *ctx,
 
 	ctx->render_targets[0].pixbuf = pixbuf;
 
-	return 0;
+	return grate_3d_ctx_encode_render_target(&ctx->render_targets[0]);
 }
 
 void grate_3d_ctx_perform_stencil_test(struct grate_3d_ctx *ctx, bool enable)
 {
 	ctx->stencil_test = enable;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_STENCIL |
+		      GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
 }
 
 void grate_3d_ctx_set_stencil_func(struct grate_3d_ctx *ctx,
@@ -656,6 +1364,8 @@ void grate_3d_ctx_set_stencil_func(struct grate_3d_ctx *ctx,
 		ctx->stencil_mask_back = mask;
 		ctx->stencil_ref_back  = ref;
 	}
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_STENCIL;
 }
 
 static int get_stencil_op(enum grate_3d_ctx_stencil_operation op)
@@ -729,12 +1439,15 @@ void grate_3d_ctx_set_stencil_ops(struct grate_3d_ctx *ctx,
 		ctx->stencil_zfail_op_back = stencil_zfail_op;
 		ctx->stencil_zpass_op_back = stencil_zpass_op;
 	}
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_STENCIL;
 }
 
 int grate_3d_ctx_bind_stencil_buffer(struct grate_3d_ctx *ctx,
 				     struct host1x_pixelbuffer *pixbuf)
 {
 	ctx->render_targets[2].pixbuf = NULL;
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_RENDER_TARGETS;
 
 	switch (pixbuf->format) {
 	case PIX_BUF_FMT_S8:
@@ -755,5 +1468,5 @@ int grate_3d_ctx_bind_stencil_buffer(struct grate_3d_ctx *ctx,
 
 	ctx->render_targets[2].pixbuf = pixbuf;
 
-	return 0;
+	return grate_3d_ctx_encode_render_target(&ctx->render_targets[2]);
 }
@@ -29,6 +29,7 @@
 struct grate;
 struct grate_program;
 struct grate_texture;
+struct grate_sampler;
 struct grate_3d_ctx;
 struct mat4;
 
@@ -79,13 +80,43 @@ enum grate_3d_ctx_stencil_operation {
 	GRATE_3D_CTX_STENCIL_OP_DECR_WRAP	= 0xE008,
 };
 
+/*
+ * Early testing rejects fragments before they are shaded, late testing
+ * runs after the fragment program, which is needed if discarded fragments
+ * mustn't update the depth and stencil buffers. Auto tests late only if
+ * the program discards and the stencil test is enabled.
+ */
+enum grate_3d_ctx_depth_test_mode {
+	GRATE_3D_CTX_DEPTH_TEST_AUTO		= 0xF001,
+	GRATE_3D_CTX_DEPTH_TEST_EARLY		= 0xF002,
+	GRATE_3D_CTX_DEPTH_TEST_LATE		= 0xF003,
+};
+
 struct grate_3d_ctx * grate_3d_alloc_ctx(struct grate *grate);
 
+void grate_3d_free_ctx(struct grate_3d_ctx *ctx);
+
+void grate_3d_ctx_copy(struct grate_3d_ctx *dst,
+		       const struct grate_3d_ctx *src);
+
+void grate_3d_ctx_release(struct grate_3d_ctx *ctx);
+
+void grate_3d_ctx_invalidate(struct grate_3d_ctx *ctx);
+
+/* saves the state and restores it, re-emitting only what was changed */
+int grate_3d_ctx_push(struct grate_3d_ctx *ctx);
+int grate_3d_ctx_pop(struct grate_3d_ctx *ctx);
+
 int grate_3d_ctx_vertex_attrib_pointer(struct grate_3d_ctx *ctx,
 				       unsigned location, unsigned size,
 				       unsigned type, unsigned stride,
 				       struct host1x_bo *data_bo);
 
+int grate_3d_ctx_vertex_attrib_pointer_view(struct grate_3d_ctx *ctx,
+					    unsigned location, unsigned size,
+					    unsigned type, unsigned stride,
+					    const struct host1x_bo_view *view);
+
 #define grate_3d_ctx_vertex_attrib_float_pointer(ctx, location, size, bo)\
 	grate_3d_ctx_vertex_attrib_pointer(ctx, location, size,		\
 					   TGR3D_ATTRIB_TYPE_FLOAT32,	\
@@ -94,6 +125,43 @@ int grate_3d_ctx_vertex_attrib_pointer(struct grate_3d_ctx *ctx,
 int grate_3d_ctx_enable_vertex_attrib_array(struct grate_3d_ctx *ctx,
 					    unsigned target);
 
+/*
+ * Attributes interleaved into a single BO. An attribute is given as size
+ * floats per vertex and stored in the most compact type that represents
+ * all of its values within the tolerance, 0 asks for exact values.
+ * Attributes with a negative location are skipped.
+ */
+struct grate_vertex_attrib_data {
+	int location;
+	unsigned int size;
+	const float *data;
+	float tolerance;
+};
+
+struct grate_vertex_buffer {
+	struct grate *grate;
+	struct host1x_bo *bo;
+	unsigned int stride;
+	unsigned int num_attribs;
+	struct {
+		int location;
+		unsigned int size;
+		unsigned int type;
+		unsigned int offset;
+	} attribs[16];
+};
+
+int grate_vertex_buffer_init(struct grate *grate,
+			     struct grate_vertex_buffer *vb,
+			     const struct grate_vertex_attrib_data *attribs,
+			     unsigned int num_attribs,
+			     unsigned int num_vertices);
+void grate_vertex_buffer_release(struct grate_vertex_buffer *vb);
+
+/* sets up and enables all attributes of the buffer */
+int grate_3d_ctx_bind_vertex_buffer(struct grate_3d_ctx *ctx,
+				    const struct grate_vertex_buffer *vb);
+
 int grate_3d_ctx_disable_vertex_attrib_array(struct grate_3d_ctx *ctx,
 					     unsigned target);
 
@@ -111,6 +179,19 @@ int grate_3d_ctx_enable_render_target(struct grate_3d_ctx *ctx,
 int grate_3d_ctx_disable_render_target(struct grate_3d_ctx *ctx,
 				       unsigned target);
 
+/* render target of colour output n of a fragment program */
+#define GRATE_3D_CTX_OUTPUT_RT(n)	((n) ? (n) + 2 : 1)
+#define GRATE_3D_CTX_MAX_OUTPUTS	14
+
+/*
+ * Binds and enables the render targets of outputs [0, count) and disables
+ * those of the other outputs, depth and stencil are left as they are.
+ * Stores of the bound program to targets left disabled are reported.
+ */
+int grate_3d_ctx_bind_outputs(struct grate_3d_ctx *ctx,
+			      struct host1x_pixelbuffer **pixbufs,
+			      unsigned int count);
+
 int grate_3d_ctx_bind_program(struct grate_3d_ctx *ctx,
 			      struct grate_program *program);
 
@@ -125,6 +206,10 @@ int grate_3d_ctx_set_fragment_uniform(struct grate_3d_ctx *ctx,
 				      unsigned location, unsigned nb,
 				      float *value);
 
+int grate_3d_ctx_set_fragment_uniform_array(struct grate_3d_ctx *ctx,
+					    unsigned location, unsigned count,
+					    const float *values);
+
 int grate_3d_ctx_set_fragment_float_uniform(struct grate_3d_ctx *ctx,
 					    unsigned location, float value);
 
@@ -172,6 +257,14 @@ int grate_3d_ctx_bind_texture(struct grate_3d_ctx *ctx,
 			      unsigned location,
 			      struct grate_texture *tex);
 
+/*
+ * Samples the texture of a unit with the filtering and wrapping of the
+ * sampler instead of its own, NULL goes back to those of the texture.
+ */
+int grate_3d_ctx_bind_sampler(struct grate_3d_ctx *ctx,
+			      unsigned location,
+			      const struct grate_sampler *sampler);
+
 void grate_3d_ctx_set_depth_func(struct grate_3d_ctx *ctx,
 				 enum grate_3d_ctx_depth_function func);
 
@@ -179,6 +272,23 @@ void grate_3d_ctx_perform_depth_test(struct grate_3d_ctx *ctx, bool enable);
 
 void grate_3d_ctx_perform_depth_write(struct grate_3d_ctx *ctx, bool enable);
 
+void grate_3d_ctx_set_depth_test_mode(struct grate_3d_ctx *ctx,
+				      enum grate_3d_ctx_depth_test_mode mode);
+
+/*
+ * Depth pre-pass for scenes with overdraw: the draws following
+ * grate_3d_ctx_begin_depth_prepass() lay the depth down with the colour
+ * targets disabled and the cheap depth_program bound, the same draws
+ * following grate_3d_ctx_begin_shading_pass() shade only the pixels of
+ * equal depth, hence every pixel once. The vertex program of depth_program
+ * must be the one of the bound program, which mustn't discard fragments.
+ * grate_3d_ctx_end_depth_prepass() restores the depth test state.
+ */
+int grate_3d_ctx_begin_depth_prepass(struct grate_3d_ctx *ctx,
+				     struct grate_program *depth_program);
+int grate_3d_ctx_begin_shading_pass(struct grate_3d_ctx *ctx);
+void grate_3d_ctx_end_depth_prepass(struct grate_3d_ctx *ctx);
+
 int grate_3d_ctx_bind_depth_buffer(struct grate_3d_ctx *ctx,
 				   struct host1x_pixelbuffer *pixbuf);
 
@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Render queue defers draws and emits them sorted by a key of the render
+ * target, translucency, program, textures and depth through the batching
+ * path. Render targets are kept in the order they were first drawn to,
+ * since a later target may sample an earlier one. Within a target opaque
+ * draws go first, grouped by program and textures to minimise the state
+ * switches and front-to-back within a group to minimise overdraw, then the
+ * translucent ones back-to-front.
+ *
+ * The state of a draw is snapshotted when it is queued and consecutive
+ * draws of an unchanged context share the snapshot, hence sorted draws of
+ * the same snapshot emit no state in between and may be coalesced. The
+ * BOs referenced by the queued draws must be kept until the queue is
+ * flushed.
+ */
+
+#define QUEUE_MAX_TARGETS	256
+#define QUEUE_MAX_IDS		4096
+#define QUEUE_DEPTH_BITS	24
+
+#define KEY_TARGET_SHIFT	56
+#define KEY_TRANSLUCENT		(1ull << 55)
+#define KEY_OPAQUE_PROGRAM	43
+#define KEY_OPAQUE_TEXTURES	31
+#define KEY_OPAQUE_DEPTH	7
+#define KEY_TRANSLUCENT_DEPTH	31
+#define KEY_TRANSLUCENT_PROGRAM	19
+#define KEY_TRANSLUCENT_TEXTURES 7
+
+struct grate_3d_queue_snapshot {
+	struct grate_3d_ctx ctx;
+	const struct grate_3d_ctx *source;
+	unsigned int target;
+	unsigned int program;
+	unsigned int textures;
+};
+
+struct grate_3d_queue_draw {
+	uint64_t key;
+	unsigned int seq;
+	unsigned int snapshot;
+	unsigned int primitive_type;
+	unsigned int index_mode;
+	unsigned int vtx_count;
+	struct host1x_bo_view indices;
+};
+
+struct grate_3d_queue_targets {
+	struct host1x_pixelbuffer *pixbufs[16];
+};
+
+struct grate_3d_queue_textures {
+	struct grate_texture *textures[16];
+	const struct grate_sampler *samplers[16];
+};
+
+struct grate_3d_queue {
+	struct grate *grate;
+
+	struct grate_3d_queue_draw *draws;
+	unsigned int num_draws;
+	unsigned int max_draws;
+
+	struct grate_3d_queue_snapshot *snapshots;
+	unsigned int num_snapshots;
+	unsigned int max_snapshots;
+
+	/* distinct state of the queued draws, numbered as first seen */
+	struct grate_3d_queue_targets targets[QUEUE_MAX_TARGETS];
+	unsigned int num_targets;
+	struct grate_program **programs;
+	unsigned int num_programs;
+	struct grate_3d_queue_textures *textures;
+	unsigned int num_textures;
+};
+
+struct grate_3d_queue *grate_3d_queue_create(struct grate *grate)
+{
+	struct grate_3d_queue *queue;
+
+	queue = calloc(1, sizeof(*queue));
+	if (!queue)
+		return NULL;
+
+	queue->programs = calloc(QUEUE_MAX_IDS, sizeof(*queue->programs));
+	queue->textures = calloc(QUEUE_MAX_IDS, sizeof(*queue->textures));
+	if (!queue->programs || !queue->textures) {
+		grate_3d_queue_free(queue);
+		return NULL;
+	}
+
+	queue->grate = grate;
+
+	return queue;
+}
+
+static void grate_3d_queue_reset(struct grate_3d_queue *queue)
+{
+	unsigned int i;
+
+	for (i = 0; i < queue->num_snapshots; i++)
+		grate_3d_ctx_release(&queue->snapshots[i].ctx);
+
+	queue->num_draws = 0;
+	queue->num_snapshots = 0;
+	queue->num_targets = 0;
+	queue->num_programs = 0;
+	queue->num_textures = 0;
+}
+
+void grate_3d_queue_free(struct grate_3d_queue *queue)
+{
+	if (!queue)
+		return;
+
+	grate_3d_queue_reset(queue);
+	free(queue->snapshots);
+	free(queue->draws);
+	free(queue->programs);
+	free(queue->textures);
+	free(queue);
+}
+
+static int grate_3d_queue_target(struct grate_3d_queue *queue,
+				 const struct grate_3d_ctx *ctx)
+{
+	struct grate_3d_queue_targets targets;
+	unsigned int i;
+
+	memset(&targets, 0, sizeof(targets));
+
+	for (i = 0; i < 16; i++)
+		if (ctx->render_targets_enable_mask & (1 << i))
+			targets.pixbufs[i] = ctx->render_targets[i].pixbuf;
+
+	for (i = 0; i < queue->num_targets; i++)
+		if (!memcmp(&queue->targets[i], &targets, sizeof(targets)))
+			return i;
+
+	if (queue->num_targets == QUEUE_MAX_TARGETS)
+		return -ENOSPC;
+
+	queue->targets[queue->num_targets] = targets;
+
+	return queue->num_targets++;
+}
+
+/* ids beyond the key range share the last one, which only costs sorting */
+static unsigned int grate_3d_queue_program(struct grate_3d_queue *queue,
+					   struct grate_program *program)
+{
+	unsigned int i;
+
+	for (i = 0; i < queue->num_programs; i++)
+		if (queue->programs[i] == program)
+			return i;
+
+	if (queue->num_programs == QUEUE_MAX_IDS)
+		return QUEUE_MAX_IDS - 1;
+
+	queue->programs[queue->num_programs] = program;
+
+	return queue->num_programs++;
+}
+
+static unsigned int grate_3d_queue_textures(struct grate_3d_queue *queue,
+					    const struct grate_3d_ctx *ctx)
+{
+	const size_t size = sizeof(ctx->textures);
+	struct grate_3d_queue_textures *set;
+	unsigned int i;
+
+	for (i = 0; i < queue->num_textures; i++) {
+		set = &queue->textures[i];
+
+		if (!memcmp(set->textures, ctx->textures, size) &&
+		    !memcmp(set->samplers, ctx->samplers,
+			    sizeof(ctx->samplers)))
+			return i;
+	}
+
+	if (queue->num_textures == QUEUE_MAX_IDS)
+		return QUEUE_MAX_IDS - 1;
+
+	set = &queue->textures[queue->num_textures];
+	memcpy(set->textures, ctx->textures, size);
+	memcpy(set->samplers, ctx->samplers, sizeof(ctx->samplers));
+
+	return queue->num_textures++;
+}
+
+static int grate_3d_queue_snapshot(struct grate_3d_queue *queue,
+				   struct grate_3d_ctx *ctx)
+{
+	struct grate_3d_queue_snapshot *snapshot, *snapshots;
+	unsigned int i, max;
+	int target;
+
+	/* the state tracking of the context follows the state itself */
+	for (i = queue->num_snapshots; i > 0; i--) {
+		snapshot = &queue->snapshots[i - 1];
+
+		if (snapshot->source != ctx)
+			continue;
+
+		if (!memcmp(&snapshot->ctx, ctx,
+			    offsetof(struct grate_3d_ctx, id)))
+			return i - 1;
+
+		break;
+	}
+
+	target = grate_3d_queue_target(queue, ctx);
+	if (target < 0)
+		return target;
+
+	if (queue->num_snapshots == queue->max_snapshots) {
+		max = queue->max_snapshots * 2 ?: 16;
+
+		snapshots = realloc(queue->snapshots,
+				    max * sizeof(*snapshots));
+		if (!snapshots)
+			return -ENOMEM;
+
+		queue->snapshots = snapshots;
+		queue->max_snapshots = max;
+	}
+
+	snapshot = &queue->snapshots[queue->num_snapshots];
+	snapshot->source = ctx;
+	snapshot->target = target;
+	snapshot->program = grate_3d_queue_program(queue, ctx->program);
+	snapshot->textures = grate_3d_queue_textures(queue, ctx);
+
+	/* a new context id makes the first draw of the snapshot emit all */
+	grate_3d_ctx_copy(&snapshot->ctx, ctx);
+	grate_3d_ctx_invalidate(&snapshot->ctx);
+
+	return queue->num_snapshots++;
+}
+
+static uint64_t grate_3d_queue_key(const struct grate_3d_queue_snapshot *s,
+				   float depth, bool translucent)
+{
+	uint64_t key = (uint64_t)s->target << KEY_TARGET_SHIFT;
+	uint64_t z;
+
+	if (!(depth > 0.0f))
+		depth = 0.0f;
+	else if (depth > 1.0f)
+		depth = 1.0f;
+
+	z = depth * ((1 << QUEUE_DEPTH_BITS) - 1);
+
+	if (translucent) {
+		z = ((1 << QUEUE_DEPTH_BITS) - 1) - z;
+
+		key |= KEY_TRANSLUCENT;
+		key |= z << KEY_TRANSLUCENT_DEPTH;
+		key |= (uint64_t)s->program << KEY_TRANSLUCENT_PROGRAM;
+		key |= (uint64_t)s->textures << KEY_TRANSLUCENT_TEXTURES;
+	} else {
+		key |= (uint64_t)s->program << KEY_OPAQUE_PROGRAM;
+		key |= (uint64_t)s->textures << KEY_OPAQUE_TEXTURES;
+		key |= z << KEY_OPAQUE_DEPTH;
+	}
+
+	return key;
+}
+
+/*
+ * Queues a draw of the current state of the context. The depth is the
+ * distance of the draw from the viewer, clamped to [0, 1].
+ */
+int grate_3d_queue_draw_elements(struct grate_3d_queue *queue,
+				 struct grate_3d_ctx *ctx,
+				 unsigned primitive_type,
+				 const struct host1x_bo_view *indices,
+				 unsigned index_mode,
+				 unsigned vtx_count,
+				 float depth, bool translucent)
+{
+	struct grate_3d_queue_draw *draw, *draws;
+	unsigned int max;
+	int snapshot;
+	int err;
+
+	if (!ctx->program) {
+		grate_error("no program bound\n");
+		return -EINVAL;
+	}
+
+	if (queue->num_draws == queue->max_draws) {
+		max = queue->max_draws * 2 ?: 64;
+
+		draws = realloc(queue->draws, max * sizeof(*draws));
+		if (!draws)
+			return -ENOMEM;
+
+		queue->draws = draws;
+		queue->max_draws = max;
+	}
+
+	snapshot = grate_3d_queue_snapshot(queue, ctx);
+
+	/* out of render target ids, the queued draws don't depend on it */
+	if (snapshot == -ENOSPC) {
+		err = grate_3d_queue_flush(queue, NULL);
+		if (err < 0)
+			return err;
+
+		snapshot = grate_3d_queue_snapshot(queue, ctx);
+	}
+
+	if (snapshot < 0)
+		return snapshot;
+
+	draw = &queue->draws[queue->num_draws];
+	draw->key = grate_3d_queue_key(&queue->snapshots[snapshot], depth,
+				       translucent);
+	draw->seq = queue->num_draws;
+	draw->snapshot = snapshot;
+	draw->primitive_type = primitive_type;
+	draw->index_mode = index_mode;
+	draw->vtx_count = vtx_count;
+	draw->indices = *indices;
+
+	queue->num_draws++;
+
+	return 0;
+}
+
+/* draws with equal keys are emitted in the order they were queued */
+static int grate_3d_queue_compare(const void *a, const void *b)
+{
+	const struct grate_3d_queue_draw *da = a, *db = b;
+
+	if (da->key != db->key)
+		return da->key < db->key ? -1 : 1;
+
+	return da->seq < db->seq ? -1 : da->seq > db->seq;
+}
+
+/*
+ * Emits the queued draws sorted. Outside of a batch they are submitted as
+ * a batch of their own, whose fence is returned. Within a batch the fence
+ * is the batched one.
+ */
+int grate_3d_queue_flush(struct grate_3d_queue *queue,
+			 struct grate_fence *fence)
+{
+	struct grate *grate = queue->grate;
+	bool batched = grate->batch.active;
+	struct grate_3d_queue_draw *draw;
+	unsigned int i;
+	int err = 0;
+
+	qsort(queue->draws, queue->num_draws, sizeof(*queue->draws),
+	      grate_3d_queue_compare);
+
+	if (!batched)
+		grate_3d_begin_batch(grate);
+
+	for (i = 0; i < queue->num_draws; i++) {
+		draw = &queue->draws[i];
+
+		err = grate_3d_draw_elements_view_async(
+				&queue->snapshots[draw->snapshot].ctx,
+				draw->primitive_type, &draw->indices,
+				draw->index_mode, draw->vtx_count,
+				batched ? fence : NULL);
+		if (err < 0)
+			break;
+	}
+
+	if (!batched) {
+		int ret = grate_3d_end_batch(grate, err < 0 ? NULL : fence);
+
+		if (!err)
+			err = ret;
+	}
+
+	/* the commands of the snapshots are recorded, they may go now */
+	grate_3d_queue_reset(queue);
+
+	return err;
+}
@@ -23,7 +23,9 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <errno.h>
 #include <math.h>
+#include <string.h>
 
 #include "../libhost1x/host1x-private.h"
 #include "libgrate-private.h"
@@ -33,39 +35,90 @@
 #include "grate-3d.h"
 #include "tgr_3d.xml.h"
 
-#define TGR3D_VAL(reg_name, field_name, value) \
-	(((value) << TGR3D_ ## reg_name ## _ ## field_name ## __SHIFT) & \
-		     TGR3D_ ## reg_name ## _ ## field_name ## __MASK)
+/* upper bound of words per draw, excluding the shaders */
+#define GRATE_3D_DRAW_WORDS	2048
 
-#define TGR3D_BOOL(reg_name, field_name, boolean) \
-	((boolean) ? TGR3D_ ## reg_name ## _ ## field_name : 0)
+/* upper bound of words of the one-time engine initialisation */
+#define GRATE_3D_INIT_WORDS	32
 
-static void grate_shader_emit(struct host1x_pushbuf *pb,
-			      struct grate_shader *shader)
+/* upper bound of words per draw with a pre-recorded state */
+#define GRATE_3D_STATE_DRAW_WORDS	64
+
+/* size of the ring reservation for a batch of draws */
+#define GRATE_3D_BATCH_WORDS	16384
+
+/*
+ * What differs between the SoCs in the emitted state. The table of the
+ * SoC is selected once by grate_3d_select_chip(), the emitters use it
+ * instead of checking the chip on every draw.
+ */
+struct grate_3d_chip {
+	/* full scale of the depth range registers */
+	unsigned int depth_range_scale;
+	/* the depth test params are written to 0xe45 as well */
+	bool mirror_depth_test;
+	/* constant words appended to FP_PSEQ_DW_CFG and to the init stream */
+	const uint32_t *pseq_dw_cfg_words;
+	unsigned int num_pseq_dw_cfg_words;
+	const uint32_t *init_words;
+	unsigned int num_init_words;
+};
+
+static const uint32_t grate_3d_t114_pseq_dw_cfg_words[] = {
+	/* XXX: maybe not needed */
+	HOST1X_OPCODE_INCR(0x547, 0x0002),
+	0xc0000000,
+	0x00000000,
+};
+
+static const uint32_t grate_3d_t114_init_words[] = {
+	HOST1X_OPCODE_IMM(0x41a, 0xa00),
+	HOST1X_OPCODE_IMM(0x416, 0x140),
+};
+
+static const struct grate_3d_chip grate_3d_t20_chip = {
+	.depth_range_scale = 0xFFFFF,
+};
+
+static const struct grate_3d_chip grate_3d_t114_chip = {
+	.depth_range_scale = 0xFFFFFF,
+	.mirror_depth_test = true,
+	.pseq_dw_cfg_words = grate_3d_t114_pseq_dw_cfg_words,
+	.num_pseq_dw_cfg_words = ARRAY_SIZE(grate_3d_t114_pseq_dw_cfg_words),
+	.init_words = grate_3d_t114_init_words,
+	.num_init_words = ARRAY_SIZE(grate_3d_t114_init_words),
+};
+
+/* Tegra30 programs GR3D like Tegra20 */
+static const struct grate_3d_chip *grate_3d_chip = &grate_3d_t20_chip;
+
+void grate_3d_select_chip(enum tegra_soc_id soc_id)
+{
+	if (soc_id == TEGRA114_SOC)
+		grate_3d_chip = &grate_3d_t114_chip;
+	else
+		grate_3d_chip = &grate_3d_t20_chip;
+}
+
+static void grate_3d_emit_words(struct host1x_pushbuf *pb,
+				const uint32_t *words, unsigned int count)
 {
 	unsigned i;
 
-	for (i = 0; i < shader->num_words; i++)
-		host1x_pushbuf_push(pb, shader->words[i]);
+	for (i = 0; i < count; i++)
+		host1x_pushbuf_push(pb, words[i]);
 }
 
-static void grate_3d_begin(struct host1x_pushbuf *pb)
+static void grate_shader_emit(struct host1x_pushbuf *pb,
+			      struct grate_shader *shader)
 {
-	host1x_pushbuf_push(pb,
-			    HOST1X_OPCODE_SETCL(0x0, HOST1X_CLASS_GR3D, 0x0));
-
-	host1x_push_gr3d_reset(pb);
+	grate_3d_emit_words(pb, shader->words, shader->num_words);
 }
 
 static void grate_3d_set_depth_range(struct host1x_pushbuf *pb,
 				     struct grate_3d_ctx *ctx)
 {
-	unsigned int scale;
-
-	if (grate_chip_info()->soc_id == TEGRA114_SOC)
-		scale = 0xFFFFFF;
-	else
-		scale = 0xFFFFF;
+	unsigned int scale = grate_3d_chip->depth_range_scale;
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(TGR3D_DEPTH_RANGE_NEAR, 2));
 	host1x_pushbuf_push(pb, (uint32_t)(scale * ctx->depth_range_near));
@@ -199,94 +252,33 @@ static int grate_3d_set_render_target_params(struct host1x_pushbuf *pb,
 					     unsigned index,
 					     bool depth_test,
 					     bool stencil_test,
-					     bool enable_dither,
-					     struct host1x_pixelbuffer *pixbuf)
+					     struct grate_render_target *rt)
 {
-	unsigned pixel_format;
-	uint32_t value = 0;
-
-	switch (pixbuf->format) {
-	case PIX_BUF_FMT_A8:
-		pixel_format = TGR3D_PIXEL_FORMAT_A8;
-		break;
-	case PIX_BUF_FMT_L8:
-		pixel_format = TGR3D_PIXEL_FORMAT_L8;
-		break;
-	case PIX_BUF_FMT_S8:
-		pixel_format = TGR3D_PIXEL_FORMAT_S8;
-		break;
-	case PIX_BUF_FMT_LA88:
-		pixel_format = TGR3D_PIXEL_FORMAT_LA88;
-		break;
-	case PIX_BUF_FMT_RGB565:
-		pixel_format = TGR3D_PIXEL_FORMAT_RGB565;
-		break;
-	case PIX_BUF_FMT_RGBA5551:
-		pixel_format = TGR3D_PIXEL_FORMAT_RGBA5551;
-		break;
-	case PIX_BUF_FMT_RGBA4444:
-		pixel_format = TGR3D_PIXEL_FORMAT_RGBA4444;
-		break;
-	case PIX_BUF_FMT_D16_LINEAR:
-		pixel_format = TGR3D_PIXEL_FORMAT_D16_LINEAR;
-		break;
-	case PIX_BUF_FMT_D16_NONLINEAR:
-		pixel_format = TGR3D_PIXEL_FORMAT_D16_NONLINEAR;
-		break;
-	case PIX_BUF_FMT_RGBA8888:
-		pixel_format = TGR3D_PIXEL_FORMAT_RGBA8888;
-		break;
-	case PIX_BUF_FMT_BGRA8888:
-		pixel_format = TGR3D_PIXEL_FORMAT_BGRA8888;
-		break;
-	case PIX_BUF_FMT_RGBA_FP32:
-		pixel_format = TGR3D_PIXEL_FORMAT_RGBA_FP32;
-		break;
-	default:
-		grate_error("Invalid format %u\n", pixbuf->format);
-		return -1;
-	}
-
 	if (index == 0 && depth_test) {
-		switch (pixel_format) {
+		switch (rt->pixel_format) {
 		case TGR3D_PIXEL_FORMAT_D16_LINEAR:
 		case TGR3D_PIXEL_FORMAT_D16_NONLINEAR:
 			break;
 		default:
 			grate_error("Invalid depth buffer format %u\n",
-				    pixbuf->format);
+				    rt->pixbuf->format);
 			return -1;
 		}
 	}
 
 	if (index == 2 && stencil_test) {
-		switch (pixel_format) {
+		switch (rt->pixel_format) {
 		case TGR3D_PIXEL_FORMAT_S8:
 			break;
 		default:
 			grate_error("Invalid stencil buffer format %u\n",
-				    pixbuf->format);
+				    rt->pixbuf->format);
 			return -1;
 		}
 	}
 
-	switch (pixbuf->layout) {
-	case PIX_BUF_LAYOUT_LINEAR:
-	case PIX_BUF_LAYOUT_TILED_16x16:
-		break;
-	default:
-		grate_error("Invalid layout %u\n", pixbuf->layout);
-		return -1;
-	}
-
-	value |= TGR3D_BOOL(RT_PARAMS, DITHER_ENABLE, enable_dither);
-	value |= TGR3D_VAL(RT_PARAMS, FORMAT, pixel_format);
-	value |= TGR3D_VAL(RT_PARAMS, PITCH, pixbuf->pitch);
-	value |= TGR3D_BOOL(RT_PARAMS, TILED,
-			    pixbuf->layout == PIX_BUF_LAYOUT_TILED_16x16);
-
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(TGR3D_RT_PARAMS(index), 1));
-	host1x_pushbuf_push(pb, value);
+	host1x_pushbuf_push(pb, rt->params);
 
 	return 0;
 }
@@ -347,12 +339,8 @@ static void grate_3d_set_pseq_dw_cfg(struct host1x_pushbuf *pb,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(TGR3D_FP_PSEQ_DW_CFG, 1));
 	host1x_pushbuf_push(pb, value);
 
-	if (grate_chip_info()->soc_id == TEGRA114_SOC) {
-		/* XXX: maybe not needed */
-		host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0x547, 0x0002));
-		host1x_pushbuf_push(pb, 0xc0000000);
-		host1x_pushbuf_push(pb, 0x00000000);
-	}
+	grate_3d_emit_words(pb, grate_3d_chip->pseq_dw_cfg_words,
+			    grate_3d_chip->num_pseq_dw_cfg_words);
 }
 
 static void grate_3d_set_used_tram_rows_nb(struct host1x_pushbuf *pb,
@@ -372,16 +360,38 @@ static void grate_3d_set_used_tram_rows_nb(struct host1x_pushbuf *pb,
 static void grate_3d_upload_vp_constants(struct host1x_pushbuf *pb,
 					 struct grate_3d_ctx *ctx)
 {
+	struct grate_3d_consts *consts = ctx->vs_uniforms;
+	unsigned start = ctx->vs_uniforms_dirty_start;
+	const uint32_t *values;
+	unsigned end = ctx->vs_uniforms_dirty_end;
 	unsigned i;
 
+	/* only the stored range is known, the rest is left as is */
+	if (consts) {
+		start = MAX(start, consts->start);
+		end = MIN(end, consts->end);
+	}
+
+	if (!consts || start >= end) {
+		ctx->vs_uniforms_dirty_start = 0;
+		ctx->vs_uniforms_dirty_end = 0;
+		return;
+	}
+
 	host1x_pushbuf_push(pb,
-			HOST1X_OPCODE_IMM(TGR3D_VP_UPLOAD_CONST_ID, 0));
+			HOST1X_OPCODE_IMM(TGR3D_VP_UPLOAD_CONST_ID, start));
 
 	host1x_pushbuf_push(pb,
-			HOST1X_OPCODE_NONINCR(TGR3D_VP_UPLOAD_CONST, 256 * 4));
+			HOST1X_OPCODE_NONINCR(TGR3D_VP_UPLOAD_CONST,
+					      (end - start) * 4));
 
-	for (i = 0; i < 256 * 4; i++)
-		host1x_pushbuf_push(pb, ctx->vs_uniforms[i]);
+	values = &consts->values[(start - consts->start) * 4];
+
+	for (i = 0; i < (end - start) * 4; i++)
+		host1x_pushbuf_push(pb, values[i]);
+
+	ctx->vs_uniforms_dirty_start = 0;
+	ctx->vs_uniforms_dirty_end = 0;
 }
 
 static void grate_3d_upload_fp_constants(struct host1x_pushbuf *pb,
@@ -473,10 +483,8 @@ static void grate_3d_init(struct host1x_pushbuf *pb)
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0xa08, 0x100));
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x40c, 0x06));
 
-	if (grate_chip_info()->soc_id == TEGRA114_SOC) {
-		host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x41a, 0xa00));
-		host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x416, 0x140));
-	}
+	grate_3d_emit_words(pb, grate_3d_chip->init_words,
+			    grate_3d_chip->num_init_words);
 }
 
 static void grate_3d_reset_program(struct host1x_pushbuf *pb)
@@ -507,8 +515,17 @@ static void grate_3d_set_late_test(struct host1x_pushbuf *pb,
 	bool discard = ctx->program->fs->discards_fragment;
 	uint32_t value = 0x48;
 
-	if (discard && ctx->stencil_test)
+	switch (ctx->depth_test_mode) {
+	case GRATE_3D_CTX_DEPTH_TEST_LATE:
 		value = 0x60;
+		break;
+	case GRATE_3D_CTX_DEPTH_TEST_EARLY:
+		break;
+	default:
+		if (discard && ctx->stencil_test)
+			value = 0x60;
+		break;
+	}
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_IMM(0x40f, value));
 }
@@ -526,7 +543,7 @@ static void grate_3d_set_depth_buffer(struct host1x_pushbuf *pb,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(TGR3D_DEPTH_TEST_PARAMS, 1));
 	host1x_pushbuf_push(pb, value);
 
-	if (grate_chip_info()->soc_id == TEGRA114_SOC) {
+	if (grate_3d_chip->mirror_depth_test) {
 		host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(0xe45, 1));
 		host1x_pushbuf_push(pb, value);
 	}
@@ -610,19 +627,19 @@ static void grate_3d_setup_attributes(struct host1x_pushbuf *pb,
 	in_mask &= ctx->attributes_enable_mask;
 
 	for (i = 0; i < 16; i++) {
-		struct grate_vtx_attribute *attr = ctx->vtx_attributes[i];
+		struct grate_vtx_attribute *attr = &ctx->vtx_attributes[i];
 
 		if (!(in_mask & (1u << i)))
 			continue;
 
-		if (!attr) {
+		if (!attr->bo) {
 			in_mask &= ~(1u << i);
 			continue;
 		}
 
 		grate_3d_set_attribute(pb, i,
 				       attr->bo,
-				       attr->bo->offset,
+				       attr->offset,
 				       attr->type,
 				       attr->size,
 				       attr->stride);
@@ -659,8 +676,7 @@ pixbuf_check:
 		if (grate_3d_set_render_target_params(pb, i,
 						      ctx->depth_test,
 						      ctx->stencil_test,
-						      rt->dither_enabled,
-						      rt->pixbuf))
+						      rt))
 			continue;
 
 		grate_3d_relocate_render_target(pb, i,
@@ -687,18 +703,44 @@ static void grate_3d_relocate_texture(struct host1x_pushbuf *pb,
 	host1x_pushbuf_push(pb, 0xdeadbeef);
 }
 
-static void grate_3d_set_texture_desc(struct host1x_pushbuf *pb,
-				      unsigned index,
-				      struct host1x_pixelbuffer *pixbuf,
-				      unsigned max_lod,
-				      bool wrap_t_clamp_to_edge,
-				      bool wrap_s_clamp_to_edge,
-				      bool wrap_t_mirrored_repeat,
-				      bool wrap_s_mirrored_repeat,
-				      bool mipmap_enabled,
-				      bool min_filter_enabled,
-				      bool mip_filter_enabled,
-				      bool mag_filter_enabled)
+/* filter and wrap bits of TEXTURE_DESC1, the ones a sampler replaces */
+#define GRATE_3D_SAMPLER_DESC1_MASK				\
+	(TGR3D_TEXTURE_DESC1_MINFILTER_LINEAR_WITHIN |		\
+	 TGR3D_TEXTURE_DESC1_MINFILTER_LINEAR_BETWEEN |		\
+	 TGR3D_TEXTURE_DESC1_MAGFILTER_LINEAR |			\
+	 TGR3D_TEXTURE_DESC1_WRAP_T_CLAMP_TO_EDGE |		\
+	 TGR3D_TEXTURE_DESC1_WRAP_S_CLAMP_TO_EDGE |		\
+	 TGR3D_TEXTURE_DESC1_WRAP_T_MIRRORED_REPEAT |		\
+	 TGR3D_TEXTURE_DESC1_WRAP_S_MIRRORED_REPEAT)
+
+uint32_t grate_3d_encode_sampler_desc(const struct grate_texture *tex)
+{
+	uint32_t value;
+
+	value  = TGR3D_BOOL(TEXTURE_DESC1, MINFILTER_LINEAR_WITHIN,
+			    tex->min_filter_enabled);
+	value |= TGR3D_BOOL(TEXTURE_DESC1, MINFILTER_LINEAR_BETWEEN,
+			    tex->mip_filter_enabled);
+	value |= TGR3D_BOOL(TEXTURE_DESC1, MAGFILTER_LINEAR,
+			    tex->mag_filter_enabled);
+	value |= TGR3D_BOOL(TEXTURE_DESC1, WRAP_T_CLAMP_TO_EDGE,
+			    tex->wrap_t_clamp_to_edge);
+	value |= TGR3D_BOOL(TEXTURE_DESC1, WRAP_S_CLAMP_TO_EDGE,
+			    tex->wrap_s_clamp_to_edge);
+	value |= TGR3D_BOOL(TEXTURE_DESC1, WRAP_T_MIRRORED_REPEAT,
+			    tex->wrap_t_mirrored_repeat);
+	value |= TGR3D_BOOL(TEXTURE_DESC1, WRAP_S_MIRRORED_REPEAT,
+			    tex->wrap_s_mirrored_repeat);
+
+	return value;
+}
+
+/* encode the TEXTURE_DESC1 and TEXTURE_DESC2 words of a texture */
+static int grate_3d_encode_texture_desc(uint32_t *desc,
+					struct host1x_pixelbuffer *pixbuf,
+					unsigned max_lod,
+					bool mipmap_enabled,
+					uint32_t sampler)
 {
 	int log2_width = log2_size(pixbuf->width);
 	int log2_height = log2_size(pixbuf->height);
@@ -761,7 +803,7 @@ static void grate_3d_set_texture_desc(struct host1x_pushbuf *pb,
 		break;
 	default:
 		grate_error("Invalid format %u\n", pixbuf->format);
-		return;
+		return -EINVAL;
 	}
 
 	switch (pixbuf->layout) {
@@ -769,33 +811,17 @@ static void grate_3d_set_texture_desc(struct host1x_pushbuf *pb,
 		break;
 	default:
 		grate_error("Invalid layout %u\n", pixbuf->layout);
-		return;
+		return -EINVAL;
 	}
 
-	host1x_pushbuf_push(pb,
-			    HOST1X_OPCODE_INCR(TGR3D_TEXTURE_DESC1(index), 2));
-
 	value  = TGR3D_VAL(TEXTURE_DESC1, FORMAT, pixel_format);
 
 	value |= TGR3D_BOOL(TEXTURE_DESC1, COMPRESSED,
 			    compressed);
-	value |= TGR3D_BOOL(TEXTURE_DESC1, MINFILTER_LINEAR_WITHIN,
-			    min_filter_enabled);
-	value |= TGR3D_BOOL(TEXTURE_DESC1, MINFILTER_LINEAR_BETWEEN,
-			    mip_filter_enabled);
-	value |= TGR3D_BOOL(TEXTURE_DESC1, MAGFILTER_LINEAR,
-			    mag_filter_enabled);
-	value |= TGR3D_BOOL(TEXTURE_DESC1, WRAP_T_CLAMP_TO_EDGE,
-			    wrap_t_clamp_to_edge);
-	value |= TGR3D_BOOL(TEXTURE_DESC1, WRAP_S_CLAMP_TO_EDGE,
-			    wrap_s_clamp_to_edge);
-	value |= TGR3D_BOOL(TEXTURE_DESC1, WRAP_T_MIRRORED_REPEAT,
-			    wrap_t_mirrored_repeat);
-	value |= TGR3D_BOOL(TEXTURE_DESC1, WRAP_S_MIRRORED_REPEAT,
-			    wrap_s_mirrored_repeat);
+	value |= sampler;
 // 	value |= 0x50;
 
-	host1x_pushbuf_push(pb, value);
+	desc[0] = value;
 
 	value = TGR3D_BOOL(TEXTURE_DESC2, MIPMAP_DISABLE, !mipmap_enabled);
 
@@ -810,100 +836,275 @@ static void grate_3d_set_texture_desc(struct host1x_pushbuf *pb,
 		value |= TGR3D_VAL(TEXTURE_DESC2, HEIGHT, pixbuf->height);
 	}
 
-	host1x_pushbuf_push(pb, value);
+	desc[1] = value;
+
+	return 0;
+}
+
+/* re-encode the cached descriptor after the texture has been changed */
+static int grate_3d_update_texture_desc(struct grate_texture *tex)
+{
+	struct host1x_pixelbuffer *pixbuf, base;
+	int err;
+
+	if (tex->mipmap_enabled || tex->base_lod)
+		pixbuf = tex->mipmap_pixbuf;
+	else
+		pixbuf = tex->pixbuf;
+
+	if (!pixbuf)
+		return -EINVAL;
+
+	err = host1x_pixelbuffer_populate(pixbuf);
+	if (err < 0)
+		return err;
+
+	/* view of the chain from the finest level streamed so far */
+	if (tex->base_lod) {
+		base = *pixbuf;
+		base.width = MAX(pixbuf->width >> tex->base_lod, 1);
+		base.height = MAX(pixbuf->height >> tex->base_lod, 1);
+		pixbuf = &base;
+	}
+
+	err = grate_3d_encode_texture_desc(tex->desc, pixbuf,
+					   tex->max_lod - MIN(tex->base_lod,
+							      tex->max_lod),
+					   tex->mipmap_enabled,
+					   grate_3d_encode_sampler_desc(tex));
+	if (err)
+		return err;
+
+	tex->desc_bo = pixbuf->bo;
+	tex->desc_offset = pixbuf->bo->offset + tex->base_offset;
+	tex->desc_version = tex->version;
+
+	return 0;
+}
+
+/*
+ * Replaces the filter and wrap bits of a texture descriptor with those of
+ * a sampler. Mipmapping needs the mip chain in the descriptor, a texture
+ * that is sampled without it stays at its base level.
+ */
+static void grate_3d_apply_sampler(const struct grate_texture *tex,
+				   const struct grate_sampler *sampler,
+				   uint32_t *desc)
+{
+	bool mipmapped = sampler->mipmap_enabled &&
+			 (tex->mipmap_enabled || tex->base_lod);
+
+	desc[0] &= ~GRATE_3D_SAMPLER_DESC1_MASK;
+	desc[0] |= sampler->desc1;
+
+	if (!mipmapped)
+		desc[0] &= ~TGR3D_TEXTURE_DESC1_MINFILTER_LINEAR_BETWEEN;
+
+	desc[1] &= ~TGR3D_TEXTURE_DESC2_MIPMAP_DISABLE;
+	desc[1] |= TGR3D_BOOL(TEXTURE_DESC2, MIPMAP_DISABLE, !mipmapped);
 }
 
 static void grate_3d_setup_textures(struct host1x_pushbuf *pb,
 				    struct grate_3d_ctx *ctx)
 {
+	uint32_t desc[2];
 	unsigned i;
 
 	for (i = 0; i < 16; i++) {
 		struct grate_texture *tex = ctx->textures[i];
-		struct host1x_pixelbuffer *pixbuf;
 
 		if (!tex)
 			continue;
 
-		if (tex->mipmap_enabled)
-			pixbuf = tex->mipmap_pixbuf;
-		else
-			pixbuf = tex->pixbuf;
+		if (tex->stream)
+			grate_texture_stream_update(tex);
+
+		/* evicted textures are reloaded, the draw samples nothing */
+		if (tex->resident && grate_texture_make_resident(tex, false))
+			continue;
 
-		if (!pixbuf)
+		if (!(ctx->textures_dirty_mask & (1u << i)) &&
+		    ctx->textures_version[i] == tex->version)
 			continue;
 
-		grate_3d_relocate_texture(pb, i,
-					  pixbuf->bo,
-					  pixbuf->bo->offset);
+		if (tex->desc_version != tex->version &&
+		    grate_3d_update_texture_desc(tex))
+			continue;
+
+		grate_3d_relocate_texture(pb, i, tex->desc_bo,
+					  tex->desc_offset);
+
+		desc[0] = tex->desc[0];
+		desc[1] = tex->desc[1];
+
+		if (ctx->samplers[i])
+			grate_3d_apply_sampler(tex, ctx->samplers[i], desc);
 
-		grate_3d_set_texture_desc(pb, i,
-					  pixbuf,
-					  tex->max_lod,
-					  tex->wrap_t_clamp_to_edge,
-					  tex->wrap_s_clamp_to_edge,
-					  tex->wrap_t_mirrored_repeat,
-					  tex->wrap_s_mirrored_repeat,
-					  tex->mipmap_enabled,
-					  tex->min_filter_enabled,
-					  tex->mip_filter_enabled,
-					  tex->mag_filter_enabled);
+		host1x_pushbuf_push(pb,
+				    HOST1X_OPCODE_INCR(TGR3D_TEXTURE_DESC1(i),
+						       2));
+		host1x_pushbuf_push(pb, desc[0]);
+		host1x_pushbuf_push(pb, desc[1]);
+
+		ctx->textures_version[i] = tex->version;
 	}
+
+	ctx->textures_dirty_mask = 0;
 }
 
 static void grate_3d_setup_indices(struct host1x_pushbuf *pb,
-				   struct host1x_bo *bo,
+				   const struct host1x_bo_view *indices,
 				   unsigned index_mode)
 {
 	if (index_mode == TGR3D_INDEX_MODE_NONE)
 		return;
 
-	grate_3d_relocate_primitive_indices(pb, bo, bo->offset);
+	grate_3d_relocate_primitive_indices(pb, indices->bo, indices->offset);
 }
 
 static void grate_3d_setup_context(struct host1x_pushbuf *pb,
-				   struct grate_3d_ctx *ctx)
+				   struct grate_3d_ctx *ctx,
+				   struct grate_3d_resident *resident)
 {
-	grate_3d_begin(pb);
-	grate_3d_init(pb);
+	struct grate_emit_mark mark;
+	uint32_t dirty = ctx->dirty;
+
+	grate_emit_stats_begin(&mark, ctx->grate->emit_stats, pb);
+
+	host1x_pushbuf_push(pb,
+			    HOST1X_OPCODE_SETCL(0x0, HOST1X_CLASS_GR3D, 0x0));
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_CLASS);
+
+	/*
+	 * GR3D retains its state between the draws of a job, hence if the
+	 * context is resident in hardware, only the state that was changed
+	 * since the last draw needs to be emitted.
+	 */
+	if (resident->ctx_id != ctx->id) {
+		grate_3d_ctx_vs_uniforms_dirty(ctx,
+					       ctx->program->vs_constants_start,
+					       ctx->program->vs_constants_end);
+
+		dirty = GRATE_3D_CTX_DIRTY_ALL;
+		ctx->textures_dirty_mask = 0xffff;
+	}
+
+	/* program is still resident, no need to re-upload it */
+	if (resident->program_id == ctx->program->id)
+		dirty &= ~GRATE_3D_CTX_DIRTY_PROGRAM;
+
+	if (dirty & GRATE_3D_CTX_DIRTY_DITHER)
+		grate_3d_set_dither(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_DITHER);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_SCISSOR)
+		grate_3d_set_scissor(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_SCISSOR);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_VIEWPORT)
+		grate_3d_set_guardband(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_GUARDBAND);
+
+	if (dirty & (GRATE_3D_CTX_DIRTY_STENCIL | GRATE_3D_CTX_DIRTY_PROGRAM |
+		     GRATE_3D_CTX_DIRTY_DEPTH_TEST))
+		grate_3d_set_late_test(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_LATE_TEST);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_POINT)
+		grate_3d_set_point_size(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_POINT);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_LINE) {
+		grate_3d_set_line_width(pb, ctx);
+		grate_3d_set_line_params(pb, ctx);
+	}
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_LINE);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_PROGRAM)
+		grate_3d_set_pseq_dw_cfg(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_PSEQ_DW_CFG);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_DEPTH_RANGE)
+		grate_3d_set_depth_range(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_DEPTH_RANGE);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_POINT)
+		grate_3d_set_point_params(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_POINT);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_DEPTH_TEST)
+		grate_3d_set_depth_buffer(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_DEPTH_BUFFER);
+
+	if (dirty & (GRATE_3D_CTX_DIRTY_STENCIL | GRATE_3D_CTX_DIRTY_PROGRAM))
+		grate_3d_set_stencil_test(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_STENCIL);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_POLYGON_OFFSET)
+		grate_3d_set_polygon_offset(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_POLYGON_OFFSET);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_PROGRAM) {
+		grate_3d_set_alu_buffer_size(pb, ctx);
+		grate_3d_startup_pseq_engine(pb, ctx);
+	}
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_PSEQ);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_POINT)
+		grate_3d_set_point_coord_range(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_POINT);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_PROGRAM)
+		grate_3d_set_used_tram_rows_nb(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_TRAM_ROWS);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_VIEWPORT)
+		grate_3d_set_viewport_bias_scale(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_VIEWPORT);
+
+	if (dirty & (GRATE_3D_CTX_DIRTY_CULL_FACE | GRATE_3D_CTX_DIRTY_PROGRAM))
+		grate_3d_set_cull_face_and_linker_inst_nb(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_CULL_FACE);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_VS_UNIFORMS)
+		grate_3d_upload_vp_constants(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_VS_UNIFORMS);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_FS_UNIFORMS)
+		grate_3d_upload_fp_constants(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_FS_UNIFORMS);
+
+	if (dirty & (GRATE_3D_CTX_DIRTY_ATTRIBUTES | GRATE_3D_CTX_DIRTY_PROGRAM))
+		grate_3d_setup_attributes(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_ATTRIBUTES);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_RENDER_TARGETS)
+		grate_3d_setup_render_targets(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_RENDER_TARGETS);
 
-	grate_3d_set_dither(pb, ctx);
-	grate_3d_set_scissor(pb, ctx);
-	grate_3d_set_guardband(pb, ctx);
-	grate_3d_set_late_test(pb, ctx);
-	grate_3d_set_point_size(pb, ctx);
-	grate_3d_set_line_width(pb, ctx);
-	grate_3d_set_line_params(pb, ctx);
-	grate_3d_set_pseq_dw_cfg(pb, ctx);
-	grate_3d_set_depth_range(pb, ctx);
-	grate_3d_set_point_params(pb, ctx);
-	grate_3d_set_depth_buffer(pb, ctx);
-	grate_3d_set_stencil_test(pb, ctx);
-	grate_3d_set_polygon_offset(pb, ctx);
-	grate_3d_set_alu_buffer_size(pb, ctx);
-	grate_3d_startup_pseq_engine(pb, ctx);
-	grate_3d_set_point_coord_range(pb, ctx);
-	grate_3d_set_used_tram_rows_nb(pb, ctx);
-	grate_3d_set_viewport_bias_scale(pb, ctx);
-	grate_3d_set_cull_face_and_linker_inst_nb(pb, ctx);
-
-	grate_3d_upload_vp_constants(pb, ctx);
-	grate_3d_upload_fp_constants(pb, ctx);
-
-	grate_3d_setup_attributes(pb, ctx);
-	grate_3d_setup_render_targets(pb, ctx);
 	grate_3d_setup_textures(pb, ctx);
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_TEXTURES);
+
+	if (dirty & GRATE_3D_CTX_DIRTY_PROGRAM) {
+		grate_3d_reset_program(pb);
+		grate_shader_emit(pb, ctx->program->vs);
+		grate_shader_emit(pb, ctx->program->fs);
+		grate_shader_emit(pb, ctx->program->linker);
+	}
+	grate_emit_stats_account(&mark, pb, GRATE_EMIT_SHADERS);
 
-	grate_3d_reset_program(pb);
-	grate_shader_emit(pb, ctx->program->vs);
-	grate_shader_emit(pb, ctx->program->fs);
-	grate_shader_emit(pb, ctx->program->linker);
+	resident->program_id = ctx->program->id;
+	resident->ctx_id = ctx->id;
+	ctx->dirty = 0;
 }
 
-static void grate_3d_check_render_targets_guard(struct grate_3d_ctx *ctx)
+static void grate_3d_fence_add_render_targets(struct grate_fence *fence,
+					      struct grate_3d_ctx *ctx)
 {
 	unsigned i;
 
+	fence->num_pixbufs = 0;
+
 	for (i = 0; i < 16; i++) {
 		struct grate_render_target *rt = &ctx->render_targets[i];
 
@@ -923,91 +1124,1428 @@ pixbuf_check:
 		if (!rt->pixbuf)
 			continue;
 
-		host1x_pixelbuffer_check_guard(rt->pixbuf);
+		fence->pixbufs[fence->num_pixbufs++] = rt->pixbuf;
 	}
 }
 
-void grate_3d_draw_elements(struct grate_3d_ctx *ctx,
-			    unsigned primitive_type,
-			    struct host1x_bo *indices_bo,
-			    unsigned index_mode,
-			    unsigned vtx_count)
+/* the batch fence guards the targets of all draws recorded into the job */
+static void grate_3d_batch_add_render_targets(struct grate_3d_batch *batch,
+					      struct grate_3d_ctx *ctx)
 {
-	struct grate *grate = ctx->grate;
-	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
-	struct host1x_syncpt *syncpt = &gr3d->client->syncpts[0];
-	struct host1x_pushbuf *pb;
-	struct host1x_job *job;
-	uint32_t fence;
-	int err;
+	struct grate_fence *targets = &batch->targets;
+	struct grate_fence draw;
+	unsigned i, k;
 
-	if (!ctx->program) {
-		grate_error("No program bound\n");
-		return;
-	}
+	grate_3d_fence_add_render_targets(&draw, ctx);
 
-	if (!ctx->program->vs || !ctx->program->fs || !ctx->program->linker) {
-		grate_error("Program wasn't compiled\n");
-		return;
-	}
+	for (i = 0; i < draw.num_pixbufs; i++) {
+		for (k = 0; k < targets->num_pixbufs; k++) {
+			if (targets->pixbufs[k] == draw.pixbufs[i])
+				break;
+		}
 
-	switch (primitive_type) {
-	case TGR3D_PRIMITIVE_TYPE_POINTS:
-	case TGR3D_PRIMITIVE_TYPE_LINES:
-	case TGR3D_PRIMITIVE_TYPE_LINE_STRIP:
-	case TGR3D_PRIMITIVE_TYPE_LINE_LOOP:
-	case TGR3D_PRIMITIVE_TYPE_TRIANGLES:
-	case TGR3D_PRIMITIVE_TYPE_TRIANGLE_STRIP:
-	case TGR3D_PRIMITIVE_TYPE_TRIANGLE_FAN:
-		break;
-	default:
-		grate_error("Unsupported primitive type: %d\n", primitive_type);
-		return;
-	}
+		if (k < targets->num_pixbufs || k == 16)
+			continue;
 
-	switch (index_mode) {
-	case TGR3D_INDEX_MODE_NONE:
-	case TGR3D_INDEX_MODE_UINT8:
-	case TGR3D_INDEX_MODE_UINT16:
-		break;
-	default:
-		grate_error("Invalid index buffer mode: %u\n", index_mode);
-		return;
+		targets->pixbufs[targets->num_pixbufs++] = draw.pixbufs[i];
 	}
+}
 
-	job = HOST1X_JOB_CREATE(syncpt->id, 1);
-	if (!job)
-		return;
+static void grate_fence_check_guard(struct grate_fence *fence)
+{
+	unsigned i;
 
-	pb = HOST1X_JOB_APPEND(job, gr3d->commands, 0);
-	if (!pb) {
-		host1x_job_free(job);
-		return;
-	}
+	for (i = 0; i < fence->num_pixbufs; i++)
+		host1x_pixelbuffer_check_guard(fence->pixbufs[i]);
 
-	grate_3d_setup_context(pb, ctx);
-	grate_3d_setup_indices(pb, indices_bo, index_mode);
-	grate_3d_set_draw_params(pb, ctx, primitive_type, index_mode);
-	grate_3d_draw_primitives(pb, vtx_count);
+	fence->num_pixbufs = 0;
+}
 
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 0x01));
-	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+int grate_fence_wait(struct grate_fence *fence, uint32_t timeout)
+{
+	int err;
 
-	err = HOST1X_CLIENT_SUBMIT(gr3d->client, job);
-	if (err < 0) {
-		host1x_job_free(job);
-		return;
-	}
+	if (fence->signaled)
+		return 0;
 
-	host1x_job_free(job);
+	err = grate_fence_resolve(fence);
+	if (err < 0)
+		return err;
 
-	err = HOST1X_CLIENT_FLUSH(gr3d->client, &fence);
+	err = HOST1X_CLIENT_WAIT(fence->client, fence->value, timeout);
 	if (err < 0)
-		return;
+		return err;
+
+	fence->signaled = true;
+	grate_fence_check_guard(fence);
+
+	return 0;
+}
+
+int grate_fence_poll(struct grate_fence *fence)
+{
+	int err;
+
+	if (fence->signaled)
+		return 1;
+
+	err = grate_fence_resolve(fence);
+	if (err < 0)
+		return err;
+
+	err = host1x_client_poll(fence->client, fence->value);
+	if (err < 0) {
+		grate_error("host1x_client_poll() failed %d\n", err);
+		return err;
+	}
+
+	if (!err)
+		return 0;
+
+	fence->signaled = true;
+	grate_fence_check_guard(fence);
+
+	return 1;
+}
+
+/*
+ * Waits for all or for any of the fences, see host1x_fences_wait(). Returns
+ * the index of a signaled fence when waiting for any of them.
+ */
+int grate_fences_wait(struct grate_fence **fences, unsigned int count,
+		      bool all, uint32_t timeout, uint32_t *elapsed)
+{
+	struct host1x_fence *pending;
+	unsigned int *indices;
+	unsigned int num = 0;
+	unsigned int i;
+	int err;
+
+	if (elapsed)
+		*elapsed = 0;
+
+	if (!count)
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		if (fences[i]->signaled && !all)
+			return i;
+	}
+
+	pending = calloc(count, sizeof(*pending));
+	indices = calloc(count, sizeof(*indices));
+	if (!pending || !indices) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (fences[i]->signaled)
+			continue;
+
+		err = grate_fence_resolve(fences[i]);
+		if (err < 0)
+			goto out;
+
+		pending[num].client = fences[i]->client;
+		pending[num].value = fences[i]->value;
+		indices[num++] = i;
+	}
+
+	err = host1x_fences_wait(pending, num, all, timeout, elapsed);
+	if (err < 0)
+		goto out;
+
+	if (all) {
+		for (i = 0; i < num; i++) {
+			fences[indices[i]]->signaled = true;
+			grate_fence_check_guard(fences[indices[i]]);
+		}
+	} else {
+		fences[indices[err]]->signaled = true;
+		grate_fence_check_guard(fences[indices[err]]);
+		err = indices[err];
+	}
+
+out:
+	free(indices);
+	free(pending);
+
+	return err;
+}
+
+static int grate_3d_build_init(struct grate *grate)
+{
+	struct host1x_pushbuf *pb = &grate->gr3d_init;
+
+	grate->gr3d_init_bo = grate_bo_create_and_map(grate,
+					NVHOST_BO_FLAG_COMMAND_BUFFER |
+					HOST1X_BO_MAP_WRITE_COMBINE,
+					GRATE_3D_INIT_WORDS * 4, NULL);
+	if (!grate->gr3d_init_bo)
+		return -ENOMEM;
+
+	memset(pb, 0, sizeof(*pb));
+	pb->bo = grate->gr3d_init_bo;
+	pb->ptr = grate->gr3d_init_bo->ptr;
+
+	host1x_pushbuf_push(pb,
+			    HOST1X_OPCODE_SETCL(0x0, HOST1X_CLASS_GR3D, 0x0));
+	grate_3d_init(pb);
+
+	HOST1X_BO_FLUSH(grate->gr3d_init_bo, grate->gr3d_init_bo->offset,
+			pb->length * 4);
+
+	return 0;
+}
+
+/*
+ * The one-time channel initialisation, that is the GR3D reset followed by
+ * the engine setup, is pre-built and executed only once for the first job,
+ * after a failed submission and after the engine recovered from a hang.
+ */
+static int grate_3d_job_init(struct grate *grate, struct host1x_job *job)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	unsigned int resets;
+	int err;
+
+	resets = __atomic_load_n(&gr3d->client->resets, __ATOMIC_ACQUIRE);
+	if (resets != grate->gr3d_resets) {
+		grate->gr3d_resets = resets;
+		grate->gr3d_initialized = false;
+	}
+
+	if (grate->gr3d_initialized)
+		return 0;
+
+	if (!grate->gr3d_init_bo) {
+		err = grate_3d_build_init(grate);
+		if (err < 0)
+			return err;
+	}
+
+	if (gr3d->reset.length && !host1x_job_append_pushbuf(job, &gr3d->reset))
+		return -ENOMEM;
+
+	if (!host1x_job_append_pushbuf(job, &grate->gr3d_init))
+		return -ENOMEM;
+
+	/* registers were reset, nothing is resident anymore */
+	grate->gr3d_initialized = true;
+	grate->gr3d_resident.ctx_id = 0;
+	grate->gr3d_resident.program_id = 0;
+
+	return 0;
+}
+
+static struct host1x_job *grate_3d_job_create(struct grate *grate)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct host1x_syncpt *syncpt = &gr3d->client->syncpts[0];
+	struct host1x_job *job;
+
+	job = HOST1X_JOB_CREATE(syncpt->id, 1);
+	if (!job)
+		return NULL;
+
+	if (grate_3d_job_init(grate, job) < 0) {
+		host1x_job_free(job);
+		return NULL;
+	}
+
+	return job;
+}
+
+/*
+ * Fences of other engines, that GR3D should wait for, are accumulated and
+ * waited for by the channel at the beginning of the next draw.
+ */
+int grate_3d_wait_fence(struct grate *grate, struct grate_fence *fence)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct grate_3d_wait *wait;
+	int err;
+
+	if (fence->signaled)
+		return 0;
+
+	/* GR3D jobs are executed in-order, batched draws are GR3D jobs */
+	if (fence->client == gr3d->client || !fence->client)
+		return 0;
+
+	if (grate->num_gr3d_waits == GRATE_3D_MAX_WAITS) {
+		err = grate_fence_wait(fence, ~0u);
+		if (err < 0)
+			return err;
+
+		return 0;
+	}
+
+	wait = &grate->gr3d_waits[grate->num_gr3d_waits++];
+	wait->client = fence->client;
+	wait->value = fence->value;
+
+	return 0;
+}
+
+static void grate_3d_push_waits(struct grate *grate,
+				struct host1x_pushbuf *pb)
+{
+	unsigned int i;
+
+	for (i = 0; i < grate->num_gr3d_waits; i++)
+		host1x_pushbuf_wait(pb, grate->gr3d_waits[i].client,
+				    grate->gr3d_waits[i].value,
+				    HOST1X_CLASS_GR3D);
+
+	grate->num_gr3d_waits = 0;
+}
+
+/* waits for the pending fences on CPU, used where no pushbuf precedes GR3D */
+static int grate_3d_flush_waits(struct grate *grate)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < grate->num_gr3d_waits; i++) {
+		err = HOST1X_CLIENT_WAIT(grate->gr3d_waits[i].client,
+					 grate->gr3d_waits[i].value, ~0u);
+		if (err < 0)
+			return err;
+	}
+
+	grate->num_gr3d_waits = 0;
+
+	return 0;
+}
+
+/* prologue is an optional pre-recorded pushbuf executed before the job */
+static struct host1x_pushbuf *grate_3d_job_begin(struct grate *grate,
+						 struct host1x_job **jobp,
+						 size_t words,
+						 const struct host1x_pushbuf *prologue)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+
+	job = grate_3d_job_create(grate);
+	if (!job)
+		return NULL;
+
+	if (grate->profile)
+		grate_profile_job_begin(grate->profile);
+
+	if (prologue && !host1x_job_append_pushbuf(job, prologue)) {
+		host1x_job_free(job);
+		return NULL;
+	}
+
+	pb = host1x_ring_append(&gr3d->ring, job, words);
+	if (!pb) {
+		host1x_job_free(job);
+		return NULL;
+	}
+
+	*jobp = job;
+
+	return pb;
+}
+
+static int grate_3d_job_submit(struct grate *grate, struct host1x_job *job,
+			       struct host1x_pushbuf *pb,
+			       struct grate_fence *fence)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct host1x_syncpt *syncpt = &gr3d->client->syncpts[0];
+	uint64_t start;
+	uint32_t value;
+	int err;
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 0x01));
+	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+
+	if (grate->profile)
+		grate_profile_job_submit(grate->profile);
+
+	/*
+	 * Nothing stays resident past the job: another GR3D user may run in
+	 * between and relocations may be re-pinned for every job, leaving
+	 * the addresses of the skipped state stale.
+	 */
+	grate->gr3d_resident.ctx_id = 0;
+	grate->gr3d_resident.program_id = 0;
+
+	start = grate_trace_now(grate);
+
+	err = HOST1X_CLIENT_SUBMIT(gr3d->client, job);
+	if (err < 0)
+		goto invalidate;
+
+	err = HOST1X_CLIENT_FLUSH(gr3d->client, &value);
+	if (err < 0)
+		goto invalidate;
+
+	err = host1x_ring_commit(&gr3d->ring, pb, value);
+	host1x_job_free(job);
+	if (err < 0)
+		return err;
+
+	grate->gr3d_fence = value;
+
+	if (grate->profile)
+		grate_profile_job_submitted(grate->profile, gr3d->client,
+					    value);
+
+	grate_trace_cpu(grate, "gr3d submit", start);
+	grate_trace_gr3d_job(grate, gr3d->client, value);
+
+	if (fence) {
+		fence->value = value;
+		fence->client = gr3d->client;
+		fence->signaled = false;
+	}
+
+	return 0;
+
+invalidate:
+	/* hardware state is unknown, re-initialise it on the next draw */
+	grate->gr3d_initialized = false;
+	host1x_job_free(job);
+
+	return err;
+}
+
+/* the fences of a failed batch fail for as long as they are kept */
+static void grate_3d_batch_failed(struct grate_3d_batch *batch)
+{
+	unsigned int max = batch->max_failed * 2 ?: 16;
+	uint64_t *failed;
+
+	if (batch->num_failed == batch->max_failed) {
+		failed = realloc(batch->failed, max * sizeof(*failed));
+		if (!failed) {
+			grate_error("failed to record failed batch\n");
+			return;
+		}
+
+		batch->failed = failed;
+		batch->max_failed = max;
+	}
+
+	batch->failed[batch->num_failed++] = batch->seq;
+}
+
+static bool grate_3d_batch_has_failed(struct grate_3d_batch *batch,
+				      uint64_t seq)
+{
+	unsigned int first = 0, last = batch->num_failed;
+
+	while (first < last) {
+		unsigned int middle = first + (last - first) / 2;
+
+		if (batch->failed[middle] == seq)
+			return true;
+
+		if (batch->failed[middle] < seq)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	return false;
+}
+
+static int grate_3d_batch_submit(struct grate *grate,
+				 struct grate_fence *fence)
+{
+	struct grate_3d_batch *batch = &grate->batch;
+	int err;
+
+	err = grate_3d_job_submit(grate, batch->job, batch->pb, fence);
+	if (!err && fence) {
+		memcpy(fence->pixbufs, batch->targets.pixbufs,
+		       sizeof(fence->pixbufs));
+		fence->num_pixbufs = batch->targets.num_pixbufs;
+	}
+
+	if (err < 0)
+		grate_3d_batch_failed(batch);
+	else
+		batch->value = grate->gr3d_fence;
+
+	batch->submitted = batch->seq;
+	batch->job = NULL;
+	batch->pb = NULL;
+	batch->targets.num_pixbufs = 0;
+	memset(&batch->last, 0, sizeof(batch->last));
+
+	return err;
+}
+
+/*
+ * Turns the fence of a batched draw into the fence of its batch, submitting
+ * the batch if it wasn't yet. A batch submitted earlier resolves to the
+ * latest batch submission, which is reached no sooner than its own.
+ */
+int grate_fence_resolve(struct grate_fence *fence)
+{
+	struct grate *grate = fence->batch;
+	struct grate_3d_batch *batch;
+	int err;
+
+	if (fence->signaled || fence->client)
+		return 0;
+
+	if (!grate)
+		return -EINVAL;
+
+	batch = &grate->batch;
+
+	if (batch->job && fence->seq == batch->seq) {
+		err = grate_3d_batch_submit(grate, NULL);
+		if (err < 0)
+			return err;
+	}
+
+	if (grate_3d_batch_has_failed(batch, fence->seq))
+		return -EIO;
+
+	fence->client = host1x_get_gr3d(grate->host1x)->client;
+	fence->value = batch->value;
+
+	return 0;
+}
+
+int grate_3d_wait_idle(struct grate *grate)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	uint64_t start;
+	int err;
+
+	if (grate->batch.job) {
+		err = grate_3d_batch_submit(grate, NULL);
+		if (err < 0)
+			return err;
+	}
+
+	start = grate_trace_now(grate);
+	err = host1x_ring_wait_idle(&gr3d->ring);
+	grate_trace_cpu(grate, "gr3d wait", start);
+
+	return err;
+}
+
+/* submits the batched draws, the batch stays active */
+int grate_3d_flush_batch(struct grate *grate)
+{
+	if (!grate->batch.job)
+		return 0;
+
+	return grate_3d_batch_submit(grate, NULL);
+}
+
+/*
+ * Draws issued between grate_3d_begin_batch() and grate_3d_end_batch() are
+ * recorded into a shared job that is submitted with a single syncpoint
+ * increment. The job is submitted earlier if it runs out of space or if
+ * GR3D is waited for.
+ */
+void grate_3d_begin_batch(struct grate *grate)
+{
+	grate->batch.active = true;
+}
+
+/*
+ * With coalescing, a batched draw that changes no state and continues the
+ * index range of the previous one is merged into it by extending the index
+ * count of the already recorded draw.
+ */
+void grate_3d_set_draw_coalescing(struct grate *grate, bool enable)
+{
+	grate->batch.coalesce = enable;
+	memset(&grate->batch.last, 0, sizeof(grate->batch.last));
+}
+
+int grate_3d_end_batch(struct grate *grate, struct grate_fence *fence)
+{
+	struct grate_3d_batch *batch = &grate->batch;
+
+	batch->active = false;
+
+	if (!batch->job) {
+		if (fence) {
+			fence->value = grate->gr3d_fence;
+			fence->client = host1x_get_gr3d(grate->host1x)->client;
+			fence->num_pixbufs = 0;
+			fence->signaled = false;
+		}
+
+		return 0;
+	}
+
+	return grate_3d_batch_submit(grate, fence);
+}
+
+static int grate_3d_batch_reserve(struct grate *grate, size_t words,
+				  struct host1x_pushbuf **pbp)
+{
+	struct grate_3d_batch *batch = &grate->batch;
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	int err;
+
+	/* two words are kept for the syncpoint increment */
+	if (words + 2 > GRATE_3D_BATCH_WORDS) {
+		grate_error("Draw of %zu words doesn't fit a batch\n", words);
+		return -EINVAL;
+	}
+
+	if (batch->job &&
+	    batch->pb->length + words + 2 > gr3d->ring.reserved) {
+		err = grate_3d_batch_submit(grate, NULL);
+		if (err < 0)
+			return err;
+	}
+
+	if (!batch->job) {
+		batch->pb = grate_3d_job_begin(grate, &batch->job,
+					       GRATE_3D_BATCH_WORDS, NULL);
+		if (!batch->pb)
+			return -ENOMEM;
+
+		batch->seq++;
+	}
+
+	*pbp = batch->pb;
+
+	return 0;
+}
+
+static int grate_3d_check_program(struct grate_3d_ctx *ctx)
+{
+	if (!ctx->program) {
+		grate_error("No program bound\n");
+		return -EINVAL;
+	}
+
+	if (!ctx->program->vs || !ctx->program->fs || !ctx->program->linker) {
+		grate_error("Program wasn't compiled\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int grate_3d_check_draw(unsigned primitive_type,
+			       const struct host1x_bo_view *indices,
+			       unsigned index_mode)
+{
+	switch (primitive_type) {
+	case TGR3D_PRIMITIVE_TYPE_POINTS:
+	case TGR3D_PRIMITIVE_TYPE_LINES:
+	case TGR3D_PRIMITIVE_TYPE_LINE_STRIP:
+	case TGR3D_PRIMITIVE_TYPE_LINE_LOOP:
+	case TGR3D_PRIMITIVE_TYPE_TRIANGLES:
+	case TGR3D_PRIMITIVE_TYPE_TRIANGLE_STRIP:
+	case TGR3D_PRIMITIVE_TYPE_TRIANGLE_FAN:
+		break;
+	default:
+		grate_error("Unsupported primitive type: %d\n", primitive_type);
+		return -EINVAL;
+	}
+
+	switch (index_mode) {
+	case TGR3D_INDEX_MODE_NONE:
+		break;
+	case TGR3D_INDEX_MODE_UINT8:
+	case TGR3D_INDEX_MODE_UINT16:
+		if (!indices->bo) {
+			grate_error("No index buffer\n");
+			return -EINVAL;
+		}
+		break;
+	default:
+		grate_error("Invalid index buffer mode: %u\n", index_mode);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* the fence of a batched draw is known only on submission */
+static void grate_3d_batched_fence(struct grate *grate,
+				   struct grate_fence *fence,
+				   struct grate_3d_ctx *ctx)
+{
+	if (fence) {
+		grate_3d_fence_add_render_targets(fence, ctx);
+		fence->client = NULL;
+		fence->batch = grate;
+		fence->seq = grate->batch.seq;
+		fence->signaled = false;
+	}
+}
+
+static bool grate_3d_textures_changed(struct grate_3d_ctx *ctx)
+{
+	unsigned int i;
+
+	if (ctx->textures_dirty_mask)
+		return true;
+
+	for (i = 0; i < 16; i++) {
+		struct grate_texture *tex = ctx->textures[i];
+
+		if (!tex)
+			continue;
+
+		/* a streamed texture may advance on every draw */
+		if (tex->stream || ctx->textures_version[i] != tex->version)
+			return true;
+	}
+
+	return false;
+}
+
+static bool grate_3d_coalesce_draw(struct grate_3d_ctx *ctx,
+				   unsigned primitive_type,
+				   const struct host1x_bo_view *indices,
+				   unsigned index_mode,
+				   unsigned vtx_count)
+{
+	struct grate *grate = ctx->grate;
+	struct grate_3d_batch_draw *last = &grate->batch.last;
+	unsigned int index_size;
+	uint32_t value;
+
+	if (!grate->batch.coalesce || !grate->batch.job || !last->params)
+		return false;
+
+	/* only lists can be concatenated */
+	switch (primitive_type) {
+	case TGR3D_PRIMITIVE_TYPE_POINTS:
+	case TGR3D_PRIMITIVE_TYPE_LINES:
+	case TGR3D_PRIMITIVE_TYPE_TRIANGLES:
+		break;
+	default:
+		return false;
+	}
+
+	switch (index_mode) {
+	case TGR3D_INDEX_MODE_UINT8:
+		index_size = 1;
+		break;
+	case TGR3D_INDEX_MODE_UINT16:
+		index_size = 2;
+		break;
+	default:
+		return false;
+	}
+
+	/* the provoking vertex is a draw parameter, it isn't dirty tracked */
+	if (last->ctx != ctx || last->primitive_type != primitive_type ||
+	    last->index_mode != index_mode || last->indices != indices->bo ||
+	    last->provoking_vtx_last != ctx->provoking_vtx_last ||
+	    last->offset + last->count * index_size != indices->offset)
+		return false;
+
+	value = TGR3D_DRAW_PRIMITIVES_INDEX_COUNT__MASK >>
+		TGR3D_DRAW_PRIMITIVES_INDEX_COUNT__SHIFT;
+
+	if (last->count + vtx_count - 1 > value)
+		return false;
+
+	if (ctx->dirty || grate_3d_textures_changed(ctx) ||
+	    grate->num_gr3d_waits ||
+	    grate->gr3d_resident.ctx_id != ctx->id ||
+	    grate->gr3d_resident.program_id != ctx->program->id)
+		return false;
+
+	last->count += vtx_count;
+
+	value = TGR3D_VAL(DRAW_PRIMITIVES, INDEX_COUNT, last->count - 1);
+	value |= TGR3D_VAL(DRAW_PRIMITIVES, OFFSET, 0);
+	*last->params = value;
+
+	return true;
+}
+
+int grate_3d_draw_elements_view_async(struct grate_3d_ctx *ctx,
+				      unsigned primitive_type,
+				      const struct host1x_bo_view *indices,
+				      unsigned index_mode,
+				      unsigned vtx_count,
+				      struct grate_fence *fence)
+{
+	struct grate *grate = ctx->grate;
+	uint64_t start = grate_trace_now(grate);
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	size_t words;
+	int err;
+
+	err = grate_3d_check_program(ctx);
+	if (err < 0)
+		return err;
+
+	err = grate_3d_check_draw(primitive_type, indices, index_mode);
+	if (err < 0)
+		return err;
+
+	words = GRATE_3D_DRAW_WORDS;
+	words += GRATE_3D_MAX_WAITS * HOST1X_PUSHBUF_WAIT_WORDS;
+	words += ctx->program->vs->num_words;
+	words += ctx->program->fs->num_words;
+	words += ctx->program->linker->num_words;
+
+	if (grate->batch.active &&
+	    grate_3d_coalesce_draw(ctx, primitive_type, indices, index_mode,
+				   vtx_count)) {
+		grate_3d_batched_fence(grate, fence, ctx);
+		grate_trace_cpu(grate, "draw", start);
+
+		return 0;
+	}
+
+	if (grate->batch.active) {
+		err = grate_3d_batch_reserve(grate, words, &pb);
+		if (err < 0)
+			return err;
+	} else {
+		pb = grate_3d_job_begin(grate, &job, words, NULL);
+		if (!pb)
+			return -ENOMEM;
+	}
+
+	grate_3d_push_waits(grate, pb);
+	grate_3d_setup_context(pb, ctx, &grate->gr3d_resident);
+	grate_3d_setup_indices(pb, indices, index_mode);
+	grate_3d_set_draw_params(pb, ctx, primitive_type, index_mode);
+	grate_3d_draw_primitives(pb, vtx_count);
+
+	if (grate->batch.active) {
+		struct grate_3d_batch_draw *last = &grate->batch.last;
+
+		last->ctx = ctx;
+		last->indices = indices->bo;
+		last->offset = indices->offset;
+		last->primitive_type = primitive_type;
+		last->index_mode = index_mode;
+		last->count = vtx_count;
+		last->provoking_vtx_last = ctx->provoking_vtx_last;
+		last->params = host1x_pushbuf_cursor(pb) - 1;
+
+		grate_3d_batch_add_render_targets(&grate->batch, ctx);
+		grate_3d_batched_fence(grate, fence, ctx);
+		grate_trace_cpu(grate, "draw", start);
+
+		return 0;
+	}
+
+	err = grate_3d_job_submit(grate, job, pb, fence);
+	if (err < 0)
+		return err;
+
+	if (fence)
+		grate_3d_fence_add_render_targets(fence, ctx);
+
+	grate_trace_cpu(grate, "draw", start);
+
+	return 0;
+}
+
+/*
+ * Draws instance_count copies of the same mesh. GR3D has no instancing,
+ * hence the copies are separate draws sharing the state and differing
+ * only by the vertex constants [location, location + nb / 4), which are
+ * re-uploaded from values before each of them. The draws are recorded into
+ * the batch job, or into a batch of their own, so an instance costs the
+ * constants and four words.
+ */
+int grate_3d_draw_instanced(struct grate_3d_ctx *ctx,
+			    unsigned primitive_type,
+			    const struct host1x_bo_view *indices,
+			    unsigned index_mode,
+			    unsigned vtx_count,
+			    unsigned location, unsigned nb,
+			    const float *values,
+			    unsigned instance_count,
+			    struct grate_fence *fence)
+{
+	struct grate *grate = ctx->grate;
+	uint64_t start = grate_trace_now(grate);
+	bool batched = grate->batch.active;
+	unsigned int i, j, k, count, vec4s = nb / 4;
+	struct host1x_pushbuf *pb;
+	size_t words, per_instance;
+	const uint32_t *data;
+	int err;
+
+	err = grate_3d_check_program(ctx);
+	if (err < 0)
+		return err;
+
+	err = grate_3d_check_draw(primitive_type, indices, index_mode);
+	if (err < 0)
+		return err;
+
+	if (!nb || nb % 4 || location + vec4s > 256) {
+		grate_error("Invalid instance constants %u:%u\n", location, nb);
+		return -EINVAL;
+	}
+
+	words = GRATE_3D_DRAW_WORDS;
+	words += GRATE_3D_MAX_WAITS * HOST1X_PUSHBUF_WAIT_WORDS;
+	words += ctx->program->vs->num_words;
+	words += ctx->program->fs->num_words;
+	words += ctx->program->linker->num_words;
+
+	per_instance = 4 + nb;
+
+	/* two words of the batch are kept for the syncpoint increment */
+	if (words + per_instance + 2 > GRATE_3D_BATCH_WORDS)
+		return -EINVAL;
+
+	if (!batched)
+		grate_3d_begin_batch(grate);
+
+	/* the hardware is left with the constants of the last instance */
+	data = (const uint32_t *)values;
+
+	for (i = 0; i < instance_count; i += count) {
+		count = (GRATE_3D_BATCH_WORDS - 2 - words) / per_instance;
+		count = MIN(count, instance_count - i);
+
+		err = grate_3d_batch_reserve(grate, words + count * per_instance,
+					     &pb);
+		if (err < 0)
+			break;
+
+		grate_3d_push_waits(grate, pb);
+		grate_3d_setup_context(pb, ctx, &grate->gr3d_resident);
+		grate_3d_setup_indices(pb, indices, index_mode);
+		grate_3d_set_draw_params(pb, ctx, primitive_type, index_mode);
+
+		for (j = 0; j < count; j++) {
+			host1x_pushbuf_push(pb,
+				HOST1X_OPCODE_IMM(TGR3D_VP_UPLOAD_CONST_ID,
+						  location));
+			host1x_pushbuf_push(pb,
+				HOST1X_OPCODE_NONINCR(TGR3D_VP_UPLOAD_CONST,
+						      nb));
+			for (k = 0; k < nb; k++)
+				host1x_pushbuf_push(pb, *data++);
+
+			grate_3d_draw_primitives(pb, vtx_count);
+		}
+
+		grate_3d_batch_add_render_targets(&grate->batch, ctx);
+	}
+
+	grate_3d_ctx_vs_uniforms_dirty(ctx, location, location + vec4s);
+	memset(&grate->batch.last, 0, sizeof(grate->batch.last));
+
+	if (!batched) {
+		int ret = grate_3d_end_batch(grate, err < 0 ? NULL : fence);
+
+		if (!err)
+			err = ret;
+	} else {
+		grate_3d_batched_fence(grate, fence, ctx);
+	}
+
+	grate_trace_cpu(grate, "draw instanced", start);
+
+	return err;
+}
+
+/*
+ * State object is a snapshot of the context, which state is recorded once
+ * into a command buffer. Drawing with it executes the recorded commands as
+ * a separate gather of the job, followed by only the per-draw words. The
+ * gather is skipped entirely if the state is still resident in hardware.
+ */
+struct grate_3d_state *grate_3d_state_create(struct grate_3d_ctx *ctx)
+{
+	struct grate_3d_resident resident = { 0, 0 };
+	struct grate *grate = ctx->grate;
+	struct grate_3d_state *state;
+	struct host1x_pushbuf *pb;
+	size_t words;
+	void *map;
+
+	if (grate_3d_check_program(ctx) < 0)
+		return NULL;
+
+	state = calloc(1, sizeof(*state));
+	if (!state)
+		return NULL;
+
+	grate_3d_ctx_copy(&state->ctx, ctx);
+	grate_3d_ctx_invalidate(&state->ctx);
+
+	words = GRATE_3D_DRAW_WORDS;
+	words += GRATE_3D_MAX_WAITS * HOST1X_PUSHBUF_WAIT_WORDS;
+	words += ctx->program->vs->num_words;
+	words += ctx->program->fs->num_words;
+	words += ctx->program->linker->num_words;
+
+	state->bo = grate_bo_create_and_map(grate,
+					    NVHOST_BO_FLAG_COMMAND_BUFFER |
+					    HOST1X_BO_MAP_WRITE_COMBINE,
+					    words * 4, &map);
+	if (!state->bo)
+		goto err_free_state;
+
+	state->job = HOST1X_JOB_CREATE(0, 0);
+	if (!state->job)
+		goto err_free_bo;
+
+	pb = HOST1X_JOB_APPEND(state->job, state->bo, 0);
+	if (!pb)
+		goto err_free_job;
+
+	/* recording doesn't change what is resident in hardware */
+	grate_3d_setup_context(pb, &state->ctx, &resident);
+
+	HOST1X_BO_FLUSH(state->bo, state->bo->offset, pb->length * 4);
+
+	return state;
+
+err_free_job:
+	host1x_job_free(state->job);
+err_free_bo:
+	host1x_bo_free(state->bo);
+err_free_state:
+	grate_3d_ctx_release(&state->ctx);
+	free(state);
+
+	return NULL;
+}
+
+void grate_3d_state_free(struct grate_3d_state *state)
+{
+	struct grate *grate;
+
+	if (!state)
+		return;
+
+	grate = state->ctx.grate;
+
+	/* the commands may be still in use by hardware */
+	grate_3d_wait_idle(grate);
+
+	if (grate->gr3d_resident.ctx_id == state->ctx.id)
+		grate->gr3d_resident.ctx_id = 0;
+
+	host1x_job_free(state->job);
+	host1x_bo_free(state->bo);
+	grate_3d_ctx_release(&state->ctx);
+	free(state);
+}
+
+int grate_3d_draw_state_elements_async(struct grate_3d_state *state,
+				       unsigned primitive_type,
+				       const struct host1x_bo_view *indices,
+				       unsigned index_mode,
+				       unsigned vtx_count,
+				       struct grate_fence *fence)
+{
+	struct grate_3d_ctx *ctx = &state->ctx;
+	const struct host1x_pushbuf *prologue = NULL;
+	struct grate *grate = ctx->grate;
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	int err;
+
+	err = grate_3d_check_draw(primitive_type, indices, index_mode);
+	if (err < 0)
+		return err;
+
+	/* state gathers aren't batched, submit the pending draws first */
+	if (grate->batch.job) {
+		err = grate_3d_batch_submit(grate, NULL);
+		if (err < 0)
+			return err;
+	}
+
+	if (grate->gr3d_resident.ctx_id != ctx->id)
+		prologue = &state->job->pushbufs[0];
+
+	pb = grate_3d_job_begin(grate, &job, GRATE_3D_STATE_DRAW_WORDS +
+				GRATE_3D_MAX_WAITS * HOST1X_PUSHBUF_WAIT_WORDS,
+				prologue);
+	if (!pb)
+		return -ENOMEM;
+
+	/* the prologue only loads registers, memory is accessed by the draw */
+	grate_3d_push_waits(grate, pb);
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0x0, HOST1X_CLASS_GR3D, 0x0));
+	grate_3d_setup_indices(pb, indices, index_mode);
+	grate_3d_set_draw_params(pb, ctx, primitive_type, index_mode);
+	grate_3d_draw_primitives(pb, vtx_count);
+
+	grate->gr3d_resident.ctx_id = ctx->id;
+	grate->gr3d_resident.program_id = ctx->program->id;
+
+	err = grate_3d_job_submit(grate, job, pb, fence);
+	if (err < 0)
+		return err;
+
+	if (fence)
+		grate_3d_fence_add_render_targets(fence, ctx);
+
+	return 0;
+}
+
+/*
+ * Command list records draws independently of the command stream, hence
+ * lists may be recorded by multiple threads in parallel, each thread using
+ * its own contexts. Nothing is assumed to be resident at the start of a
+ * list, so its first draw emits the full context state. Recorded lists are
+ * executed in order as separate pushbufs of a single job, a list may be
+ * executed any number of times until it's reset. The BOs referenced by the
+ * draws must be kept until the list is reset or freed.
+ */
+struct grate_3d_cmdlist *grate_3d_cmdlist_create(struct grate *grate,
+						 size_t words)
+{
+	struct grate_3d_cmdlist *list;
+	void *map;
+
+	list = calloc(1, sizeof(*list));
+	if (!list)
+		return NULL;
+
+	list->bo = grate_bo_create_and_map(grate,
+					   NVHOST_BO_FLAG_COMMAND_BUFFER |
+					   HOST1X_BO_MAP_WRITE_COMBINE,
+					   words * 4, &map);
+	if (!list->bo)
+		goto err_free_list;
+
+	list->job = HOST1X_JOB_CREATE(0, 0);
+	if (!list->job)
+		goto err_free_bo;
+
+	list->pb = HOST1X_JOB_APPEND(list->job, list->bo, 0);
+	if (!list->pb)
+		goto err_free_job;
+
+	list->grate = grate;
+	list->words = words;
+
+	return list;
+
+err_free_job:
+	host1x_job_free(list->job);
+err_free_bo:
+	host1x_bo_free(list->bo);
+err_free_list:
+	free(list);
+
+	return NULL;
+}
+
+void grate_3d_cmdlist_free(struct grate_3d_cmdlist *list)
+{
+	struct host1x_gr3d *gr3d;
+
+	if (!list)
+		return;
+
+	gr3d = host1x_get_gr3d(list->grate->host1x);
+
+	if (list->executed)
+		HOST1X_CLIENT_WAIT(gr3d->client, list->fence, ~0u);
+
+	host1x_job_free(list->job);
+	host1x_bo_free(list->bo);
+	free(list);
+}
+
+int grate_3d_cmdlist_reset(struct grate_3d_cmdlist *list)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(list->grate->host1x);
+	int err;
+
+	/* the commands may be still in use by hardware */
+	if (list->executed) {
+		err = HOST1X_CLIENT_WAIT(gr3d->client, list->fence, ~0u);
+		if (err < 0)
+			return err;
+
+		list->executed = false;
+	}
+
+	host1x_job_reset(list->job);
+
+	list->pb = HOST1X_JOB_APPEND(list->job, list->bo, 0);
+	if (!list->pb)
+		return -ENOMEM;
+
+	list->resident.ctx_id = 0;
+	list->resident.program_id = 0;
+	list->targets.num_pixbufs = 0;
+	list->num_patches = 0;
+	list->num_recorded = 0;
+
+	return 0;
+}
+
+/*
+ * Adds a patch point of nb vertex uniforms at the vec4 location to the
+ * next recorded draw. The draw uploads the values of its context there,
+ * which grate_3d_cmdlist_patch() rewrites in the recorded commands, hence
+ * e.g. a transform changes without recording the list again.
+ */
+int grate_3d_cmdlist_add_patch(struct grate_3d_cmdlist *list,
+			       unsigned location, unsigned nb)
+{
+	struct grate_3d_cmdlist_patch *patch;
+
+	if (!nb || location >= 256 || location + (nb + 3) / 4 > 256) {
+		grate_error("Invalid location %u\n", location);
+		return -EINVAL;
+	}
+
+	if (list->num_patches == GRATE_3D_CMDLIST_MAX_PATCHES)
+		return -ENOSPC;
+
+	patch = &list->patches[list->num_patches];
+	patch->location = location;
+	patch->nb = nb;
+	patch->values = NULL;
+
+	return list->num_patches++;
+}
+
+/*
+ * The upload follows the state of the draw, so that it isn't overridden
+ * by the uniforms of the context, which are restored by the next draw.
+ */
+static void grate_3d_cmdlist_emit_patches(struct grate_3d_cmdlist *list,
+					  struct grate_3d_ctx *ctx)
+{
+	struct grate_3d_consts *consts = ctx->vs_uniforms;
+	struct host1x_pushbuf *pb = list->pb;
+	unsigned int i, j, start, end;
+	uint32_t value;
+
+	for (i = list->num_recorded; i < list->num_patches; i++) {
+		struct grate_3d_cmdlist_patch *patch = &list->patches[i];
+
+		start = patch->location;
+		end = start + (patch->nb + 3) / 4;
+
+		host1x_pushbuf_push(pb,
+			HOST1X_OPCODE_IMM(TGR3D_VP_UPLOAD_CONST_ID, start));
+		host1x_pushbuf_push(pb,
+			HOST1X_OPCODE_NONINCR(TGR3D_VP_UPLOAD_CONST,
+					      (end - start) * 4));
+
+		patch->values = host1x_pushbuf_cursor(pb);
+
+		for (j = start * 4; j < end * 4; j++) {
+			value = 0;
+
+			if (consts && j >= consts->start * 4 &&
+			    j < consts->end * 4)
+				value = consts->values[j - consts->start * 4];
+
+			host1x_pushbuf_push(pb, value);
+		}
+
+		grate_3d_ctx_vs_uniforms_dirty(ctx, start, end);
+	}
+
+	list->num_recorded = list->num_patches;
+}
+
+/*
+ * Rewrites the uniforms of a patch point, waiting for the executions of
+ * the list that may still read them. The change takes effect with the
+ * next execution.
+ */
+int grate_3d_cmdlist_patch(struct grate_3d_cmdlist *list, int index,
+			   const float *values)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(list->grate->host1x);
+	struct grate_3d_cmdlist_patch *patch;
+	int err;
+
+	if (index < 0 || (unsigned int)index >= list->num_recorded) {
+		grate_error("Invalid patch %d\n", index);
+		return -EINVAL;
+	}
+
+	patch = &list->patches[index];
+
+	if (list->executed) {
+		err = HOST1X_CLIENT_WAIT(gr3d->client, list->fence, ~0u);
+		if (err < 0)
+			return err;
+	}
+
+	memcpy(patch->values, values, patch->nb * sizeof(*values));
+
+	return 0;
+}
+
+int grate_3d_cmdlist_draw_elements(struct grate_3d_cmdlist *list,
+				   struct grate_3d_ctx *ctx,
+				   unsigned primitive_type,
+				   const struct host1x_bo_view *indices,
+				   unsigned index_mode,
+				   unsigned vtx_count)
+{
+	unsigned int i;
+	size_t words;
+	int err;
+
+	err = grate_3d_check_program(ctx);
+	if (err < 0)
+		return err;
+
+	err = grate_3d_check_draw(primitive_type, indices, index_mode);
+	if (err < 0)
+		return err;
+
+	if (list->executed) {
+		grate_error("Command list wasn't reset after execution\n");
+		return -EBUSY;
+	}
+
+	words = GRATE_3D_DRAW_WORDS;
+	words += GRATE_3D_MAX_WAITS * HOST1X_PUSHBUF_WAIT_WORDS;
+	words += ctx->program->vs->num_words;
+	words += ctx->program->fs->num_words;
+	words += ctx->program->linker->num_words;
+
+	for (i = list->num_recorded; i < list->num_patches; i++)
+		words += 2 + (list->patches[i].nb + 3) / 4 * 4;
+
+	if (list->pb->length + words > list->words)
+		return -ENOSPC;
+
+	grate_3d_setup_context(list->pb, ctx, &list->resident);
+	grate_3d_cmdlist_emit_patches(list, ctx);
+	grate_3d_setup_indices(list->pb, indices, index_mode);
+	grate_3d_set_draw_params(list->pb, ctx, primitive_type, index_mode);
+	grate_3d_draw_primitives(list->pb, vtx_count);
+
+	grate_3d_fence_add_render_targets(&list->targets, ctx);
+
+	return 0;
+}
+
+int grate_3d_cmdlist_execute(struct grate *grate,
+			     struct grate_3d_cmdlist **lists,
+			     unsigned int count,
+			     struct grate_fence *fence)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	unsigned int i;
+	int err;
+
+	if (!count)
+		return 0;
+
+	/* preserve ordering with the draws recorded so far */
+	if (grate->batch.job) {
+		err = grate_3d_batch_submit(grate, NULL);
+		if (err < 0)
+			return err;
+	}
+
+	/* lists are executed before the ring pushbuf, wait on CPU instead */
+	err = grate_3d_flush_waits(grate);
+	if (err < 0)
+		return err;
+
+	job = grate_3d_job_create(grate);
+	if (!job)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		HOST1X_BO_FLUSH(lists[i]->bo, lists[i]->bo->offset,
+				lists[i]->pb->length * 4);
+
+		if (!host1x_job_append_pushbuf(job, lists[i]->pb)) {
+			host1x_job_free(job);
+			return -ENOMEM;
+		}
+	}
+
+	/* only the syncpoint increment goes into the ring */
+	pb = host1x_ring_append(&gr3d->ring, job, 2);
+	if (!pb) {
+		host1x_job_free(job);
+		return -ENOMEM;
+	}
+
+	err = grate_3d_job_submit(grate, job, pb, fence);
+	if (err < 0)
+		return err;
+
+	/* state left by the last list isn't tracked */
+	grate->gr3d_resident.ctx_id = 0;
+	grate->gr3d_resident.program_id = 0;
+
+	for (i = 0; i < count; i++) {
+		lists[i]->fence = grate->gr3d_fence;
+		lists[i]->executed = true;
+	}
+
+	if (fence) {
+		fence->num_pixbufs = 0;
+
+		for (i = 0; i < count; i++) {
+			struct grate_fence *targets = &lists[i]->targets;
+			unsigned int j;
+
+			for (j = 0; j < targets->num_pixbufs &&
+				    fence->num_pixbufs < 16; j++)
+				fence->pixbufs[fence->num_pixbufs++] =
+					targets->pixbufs[j];
+		}
+	}
+
+	return 0;
+}
+
+int grate_3d_draw_elements_async(struct grate_3d_ctx *ctx,
+				 unsigned primitive_type,
+				 struct host1x_bo *indices_bo,
+				 unsigned index_mode,
+				 unsigned vtx_count,
+				 struct grate_fence *fence)
+{
+	struct host1x_bo_view indices;
+
+	host1x_bo_view_init(&indices, indices_bo, 0,
+			    indices_bo ? indices_bo->size : 0);
+
+	return grate_3d_draw_elements_view_async(ctx, primitive_type, &indices,
+						 index_mode, vtx_count, fence);
+}
+
+void grate_3d_draw_elements(struct grate_3d_ctx *ctx,
+			    unsigned primitive_type,
+			    struct host1x_bo *indices_bo,
+			    unsigned index_mode,
+			    unsigned vtx_count)
+{
+	struct grate_fence fence;
+	int err;
 
-	err = HOST1X_CLIENT_WAIT(gr3d->client, fence, ~0u);
+	err = grate_3d_draw_elements_async(ctx, primitive_type, indices_bo,
+					   index_mode, vtx_count, &fence);
 	if (err < 0)
 		return;
 
-	grate_3d_check_render_targets_guard(ctx);
+	grate_fence_wait(&fence, ~0u);
 }
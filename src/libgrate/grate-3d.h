@@ -5,6 +5,13 @@
 
 #define log2_size(s)		(31 - __builtin_clz(s))
 
+#define TGR3D_VAL(reg_name, field_name, value) \
+	(((value) << TGR3D_ ## reg_name ## _ ## field_name ## __SHIFT) & \
+		     TGR3D_ ## reg_name ## _ ## field_name ## __MASK)
+
+#define TGR3D_BOOL(reg_name, field_name, boolean) \
+	((boolean) ? TGR3D_ ## reg_name ## _ ## field_name : 0)
+
 struct host1x_bo;
 struct cgc_shader;
 
@@ -23,6 +30,9 @@ struct grate_shader {
 	unsigned num_words;
 	uint32_t *words;
 
+	/* references of a shader shared by the asm file cache, 0 if unshared */
+	unsigned int refcount;
+
 	union {
 		struct {
 			unsigned alu_buf_size;
@@ -38,6 +48,18 @@ struct grate_shader {
 	};
 };
 
+/*
+ * Vertex program constants of the vec4 range [start, end). A block is
+ * shared by the program and by the contexts it is bound to, including
+ * their snapshots, and is copied on the first write to a shared block.
+ */
+struct grate_3d_consts {
+	unsigned int refcount;
+	unsigned start;
+	unsigned end;
+	uint32_t values[];
+};
+
 struct grate_program {
 	struct grate_shader *vs;
 	struct grate_shader *fs;
@@ -53,22 +75,76 @@ struct grate_program {
 	struct grate_uniform *fs_uniforms;
 	unsigned num_fs_uniforms;
 
-	uint32_t vs_constants[256 * 4];
+	struct grate_3d_consts *vs_constants;
 	uint32_t fs_constants[32];
+
+	unsigned int id;
+
+	/* the linker shader is freed with the program if it was loaded */
+	bool owns_linker;
+
+	/* range of vec4 constants used by the vertex program */
+	unsigned vs_constants_start;
+	unsigned vs_constants_end;
+
+	/* uniforms folded into the constants by grate_program_link() */
+	struct grate_specialization *specs;
+	unsigned num_specs;
 };
 
 struct grate_render_target {
 	struct host1x_pixelbuffer *pixbuf;
 	bool dither_enabled;
+	/* otherwise dithering is enabled for 16 bit colour formats */
+	bool dither_set;
+	/* encoded when the pixbuf is bound */
+	unsigned pixel_format;
+	uint32_t params;
 };
 
 struct grate_vtx_attribute {
 	struct host1x_bo *bo;
+	unsigned long offset;
 	unsigned long stride;
 	unsigned size;
 	unsigned type;
 };
 
+/* what is known to be loaded into GR3D at a point of the command stream */
+struct grate_3d_resident {
+	unsigned int ctx_id;
+	unsigned int program_id;
+};
+
+/* vertex uniforms of a recorded draw that are rewritten in place */
+#define GRATE_3D_CMDLIST_MAX_PATCHES	16
+
+struct grate_3d_cmdlist_patch {
+	unsigned int location;
+	unsigned int nb;
+	uint32_t *values;
+};
+
+struct grate_3d_cmdlist {
+	struct grate *grate;
+	struct host1x_bo *bo;
+	struct host1x_job *job;
+	struct host1x_pushbuf *pb;
+	size_t words;
+
+	/* residency as seen by the list's own command stream */
+	struct grate_3d_resident resident;
+	struct grate_fence targets;
+
+	uint32_t fence;
+	bool executed;
+
+	/* patches past num_recorded belong to the next draw */
+	struct grate_3d_cmdlist_patch patches[GRATE_3D_CMDLIST_MAX_PATCHES];
+	unsigned int num_patches;
+	unsigned int num_recorded;
+};
+
 struct grate_texture {
 	struct host1x_pixelbuffer *pixbuf;
 	struct host1x_pixelbuffer *mipmap_pixbuf;
@@ -81,18 +157,62 @@ struct grate_texture {
 	bool min_filter_enabled;
 	bool mip_filter_enabled;
 	bool mipmap_enabled;
+	unsigned version;
+	float psnr;
+	/* streamed textures sample the mip chain starting at base_lod */
+	struct grate_texture_stream *stream;
+	unsigned base_lod;
+	unsigned long base_offset;
+	/* encoded descriptor, valid while desc_version matches version */
+	uint32_t desc[2];
+	struct host1x_bo *desc_bo;
+	unsigned long desc_offset;
+	unsigned desc_version;
+	/* reference of grate_texture_get(), NULL if the texture isn't shared */
+	struct grate_texture_shared *shared;
+	/* residency of a texture loaded from a file, NULL if unmanaged */
+	struct grate_texture_resident *resident;
 };
 
+/* filtering and wrapping of a texture unit, encoded once */
+struct grate_sampler {
+	uint32_t desc1;
+	bool mipmap_enabled;
+};
+
+uint32_t grate_3d_encode_sampler_desc(const struct grate_texture *tex);
+
+#define GRATE_3D_CTX_DIRTY_DEPTH_RANGE		(1 << 0)
+#define GRATE_3D_CTX_DIRTY_DITHER		(1 << 1)
+#define GRATE_3D_CTX_DIRTY_VIEWPORT		(1 << 2)
+#define GRATE_3D_CTX_DIRTY_SCISSOR		(1 << 3)
+#define GRATE_3D_CTX_DIRTY_POINT		(1 << 4)
+#define GRATE_3D_CTX_DIRTY_LINE			(1 << 5)
+#define GRATE_3D_CTX_DIRTY_CULL_FACE		(1 << 6)
+#define GRATE_3D_CTX_DIRTY_POLYGON_OFFSET	(1 << 7)
+#define GRATE_3D_CTX_DIRTY_DEPTH_TEST		(1 << 8)
+#define GRATE_3D_CTX_DIRTY_STENCIL		(1 << 9)
+#define GRATE_3D_CTX_DIRTY_PROGRAM		(1 << 10)
+#define GRATE_3D_CTX_DIRTY_VS_UNIFORMS		(1 << 11)
+#define GRATE_3D_CTX_DIRTY_FS_UNIFORMS		(1 << 12)
+#define GRATE_3D_CTX_DIRTY_ATTRIBUTES		(1 << 13)
+#define GRATE_3D_CTX_DIRTY_RENDER_TARGETS	(1 << 14)
+#define GRATE_3D_CTX_DIRTY_ALL			(~0u)
+
+struct grate_3d_ctx_saved;
+
 struct grate_3d_ctx {
-	uint32_t vs_uniforms[256 * 4];
+	struct grate_3d_consts *vs_uniforms;
 	uint32_t fs_uniforms[32];
 
 	struct grate *grate;
 	struct grate_program *program;
 
 	struct grate_render_target render_targets[16];
-	struct grate_vtx_attribute *vtx_attributes[16];
+	struct grate_vtx_attribute vtx_attributes[16];
 	struct grate_texture *textures[16];
+	/* override the filtering and wrapping of the textures, if set */
+	const struct grate_sampler *samplers[16];
 
 	float depth_range_near;
 	float depth_range_far;
@@ -141,6 +261,74 @@ struct grate_3d_ctx {
 	uint8_t stencil_ref_back;
 	uint8_t stencil_mask_front;
 	uint8_t stencil_mask_back;
+
+	unsigned depth_test_mode;
+
+	/* state replaced for the duration of a depth pre-pass */
+	struct {
+		struct grate_program *program;
+		uint32_t fs_uniforms[32];
+		uint16_t render_targets_enable_mask;
+		unsigned depth_func;
+		bool depth_write;
+		bool active;
+	} prepass;
+
+	/* state that differs from the hardware state */
+	unsigned int id;
+	uint32_t dirty;
+	uint16_t textures_dirty_mask;
+	uint16_t vs_uniforms_dirty_start;
+	uint16_t vs_uniforms_dirty_end;
+	unsigned textures_version[16];
+
+	/* states saved by grate_3d_ctx_push() */
+	struct grate_3d_ctx_saved *saved;
 };
 
+struct grate_3d_state {
+	struct grate_3d_ctx ctx;
+	struct host1x_bo *bo;
+	struct host1x_job *job;
+};
+
+int grate_3d_fragment_uniform_store(uint32_t *fs_uniforms,
+				    unsigned location, unsigned nb,
+				    const float *value);
+
+struct grate_3d_consts *grate_3d_consts_create(unsigned start,
+					       unsigned end);
+void grate_3d_consts_put(struct grate_3d_consts *consts);
+
+static inline struct grate_3d_consts *
+grate_3d_consts_get(struct grate_3d_consts *consts)
+{
+	if (consts)
+		__sync_add_and_fetch(&consts->refcount, 1);
+
+	return consts;
+}
+
+static inline void
+grate_3d_ctx_vs_uniforms_dirty(struct grate_3d_ctx *ctx,
+			       unsigned start, unsigned end)
+{
+	if (start >= end)
+		return;
+
+	if (!(ctx->dirty & GRATE_3D_CTX_DIRTY_VS_UNIFORMS) ||
+	    ctx->vs_uniforms_dirty_start >= ctx->vs_uniforms_dirty_end) {
+		ctx->vs_uniforms_dirty_start = start;
+		ctx->vs_uniforms_dirty_end = end;
+	} else {
+		if (start < ctx->vs_uniforms_dirty_start)
+			ctx->vs_uniforms_dirty_start = start;
+
+		if (end > ctx->vs_uniforms_dirty_end)
+			ctx->vs_uniforms_dirty_end = end;
+	}
+
+	ctx->dirty |= GRATE_3D_CTX_DIRTY_VS_UNIFORMS;
+}
+
 #endif
@@ -25,6 +25,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <locale.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -72,28 +74,498 @@ cleanup:
 	return data;
 }
 
-struct grate_shader *grate_shader_parse_vertex_asm_from_file(const char *path)
+/*
+ * Shaders assembled from files are shared. They are looked up by path,
+ * the file identity, size and modification time, so an edited source is
+ * assembled again, and are kept with a reference count until the last
+ * user frees them. A shared shader must be treated as immutable.
+ */
+enum grate_asm_type {
+	GRATE_ASM_VERTEX,
+	GRATE_ASM_FRAGMENT,
+	GRATE_ASM_LINKER,
+};
+
+struct grate_asm_cache_entry {
+	struct grate_asm_cache_entry *next;
+	enum grate_asm_type type;
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct grate_shader *shader;
+};
+
+static struct grate_asm_cache_entry *grate_asm_cache;
+static pthread_mutex_t grate_asm_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool grate_asm_cache_match(struct grate_asm_cache_entry *entry,
+				  enum grate_asm_type type, const char *path,
+				  const struct stat *sb)
 {
-	char *asm_txt = read_file(path);
-	struct grate_shader *shader = grate_shader_parse_vertex_asm(asm_txt);
-	free(asm_txt);
+	return entry->type == type && entry->dev == sb->st_dev &&
+	       entry->ino == sb->st_ino && entry->size == sb->st_size &&
+	       entry->mtime.tv_sec == sb->st_mtim.tv_sec &&
+	       entry->mtime.tv_nsec == sb->st_mtim.tv_nsec &&
+	       !strcmp(entry->path, path);
+}
+
+static struct grate_shader *grate_asm_cache_get(enum grate_asm_type type,
+						const char *path,
+						const struct stat *sb)
+{
+	struct grate_asm_cache_entry *entry;
+	struct grate_shader *shader = NULL;
+
+	pthread_mutex_lock(&grate_asm_cache_lock);
+
+	for (entry = grate_asm_cache; entry; entry = entry->next) {
+		if (grate_asm_cache_match(entry, type, path, sb)) {
+			shader = entry->shader;
+			shader->refcount++;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&grate_asm_cache_lock);
+
 	return shader;
 }
 
-struct grate_shader *grate_shader_parse_fragment_asm_from_file(const char *path)
+/*
+ * Returns the shader that ends up in the cache: if another thread added the
+ * same file meanwhile, the given shader is freed and the cached one used.
+ */
+static struct grate_shader *grate_asm_cache_add(enum grate_asm_type type,
+						const char *path,
+						const struct stat *sb,
+						struct grate_shader *shader)
 {
-	char *asm_txt = read_file(path);
-	struct grate_shader *shader = grate_shader_parse_fragment_asm(asm_txt);
-	free(asm_txt);
+	struct grate_asm_cache_entry *entry;
+	struct grate_shader *cached;
+
+	cached = grate_asm_cache_get(type, path, sb);
+	if (cached) {
+		grate_shader_free(shader);
+		return cached;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return shader;
+
+	entry->path = strdup(path);
+	if (!entry->path) {
+		free(entry);
+		return shader;
+	}
+
+	entry->type = type;
+	entry->dev = sb->st_dev;
+	entry->ino = sb->st_ino;
+	entry->size = sb->st_size;
+	entry->mtime = sb->st_mtim;
+	entry->shader = shader;
+
+	shader->refcount = 1;
+
+	pthread_mutex_lock(&grate_asm_cache_lock);
+	entry->next = grate_asm_cache;
+	grate_asm_cache = entry;
+	pthread_mutex_unlock(&grate_asm_cache_lock);
+
 	return shader;
 }
 
-struct grate_shader *grate_shader_parse_linker_asm_from_file(const char *path)
+/*
+ * Drops a reference of a cached shader, returns true when it was the last
+ * one and the shader has to be freed.
+ */
+bool grate_asm_cache_put(struct grate_shader *shader)
+{
+	struct grate_asm_cache_entry **ptr, *entry;
+	bool last;
+
+	pthread_mutex_lock(&grate_asm_cache_lock);
+
+	last = --shader->refcount == 0;
+
+	for (ptr = &grate_asm_cache; last && *ptr; ptr = &(*ptr)->next) {
+		entry = *ptr;
+
+		if (entry->shader == shader) {
+			*ptr = entry->next;
+			free(entry->path);
+			free(entry);
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&grate_asm_cache_lock);
+
+	return last;
+}
+
+static struct grate_shader *
+grate_shader_parse_asm_from_file(enum grate_asm_type type, const char *path)
 {
-	char *asm_txt = read_file(path);
-	struct grate_shader *shader = grate_shader_parse_linker_asm(asm_txt);
+	struct grate_shader *shader;
+	struct stat sb;
+	char *asm_txt;
+
+	if (stat(path, &sb) == -1) {
+		grate_error("Failed to get stat %s: %s\n",
+			    path, strerror(errno));
+		return NULL;
+	}
+
+	shader = grate_asm_cache_get(type, path, &sb);
+	if (shader)
+		return shader;
+
+	asm_txt = read_file(path);
+
+	switch (type) {
+	case GRATE_ASM_VERTEX:
+		shader = grate_shader_parse_vertex_asm(asm_txt);
+		break;
+
+	case GRATE_ASM_FRAGMENT:
+		shader = grate_shader_parse_fragment_asm(asm_txt);
+		break;
+
+	case GRATE_ASM_LINKER:
+		shader = grate_shader_parse_linker_asm(asm_txt);
+		break;
+	}
+
 	free(asm_txt);
-	return shader;
+
+	if (!shader)
+		return NULL;
+
+	return grate_asm_cache_add(type, path, &sb, shader);
+}
+
+struct grate_shader *grate_shader_parse_vertex_asm_from_file(const char *path)
+{
+	return grate_shader_parse_asm_from_file(GRATE_ASM_VERTEX, path);
+}
+
+struct grate_shader *grate_shader_parse_fragment_asm_from_file(const char *path)
+{
+	return grate_shader_parse_asm_from_file(GRATE_ASM_FRAGMENT, path);
+}
+
+struct grate_shader *grate_shader_parse_linker_asm_from_file(const char *path)
+{
+	return grate_shader_parse_asm_from_file(GRATE_ASM_LINKER, path);
+}
+
+/*
+ * The scanners and parsers are reentrant and keep their results in
+ * thread-local state, so several threads can assemble shaders at once.
+ */
+struct grate_asm_parser {
+	int (*init)(void **scanner);
+	struct yy_buffer_state *(*scan)(const char *str, void *scanner);
+	void (*set_lineno)(int lineno, void *scanner);
+	int (*parse)(void *scanner);
+	int (*destroy)(void *scanner);
+};
+
+static const struct grate_asm_parser vertex_asm_parser = {
+	.init = vertex_asmlex_init,
+	.scan = vertex_asm_scan_string,
+	.set_lineno = vertex_asmset_lineno,
+	.parse = vertex_asmparse,
+	.destroy = vertex_asmlex_destroy,
+};
+
+static const struct grate_asm_parser fragment_asm_parser = {
+	.init = fragment_asmlex_init,
+	.scan = fragment_asm_scan_string,
+	.set_lineno = fragment_asmset_lineno,
+	.parse = fragment_asmparse,
+	.destroy = fragment_asmlex_destroy,
+};
+
+static const struct grate_asm_parser linker_asm_parser = {
+	.init = linker_asmlex_init,
+	.scan = linker_asm_scan_string,
+	.set_lineno = linker_asmset_lineno,
+	.parse = linker_asmparse,
+	.destroy = linker_asmlex_destroy,
+};
+
+static int grate_asm_parse(const struct grate_asm_parser *parser,
+			   const char *asm_txt)
+{
+	locale_t c_locale, locale;
+	void *scanner;
+	int err;
+
+	/*
+	 * atof() delimiter is locale-dependent! Switch only the calling
+	 * thread to the C locale, setlocale() would affect all of them.
+	 */
+	c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+	if (c_locale == (locale_t)0)
+		return -ENOMEM;
+
+	locale = uselocale(c_locale);
+
+	err = parser->init(&scanner);
+	if (err == 0) {
+		parser->scan(asm_txt, scanner);
+		parser->set_lineno(1, scanner);
+		err = parser->parse(scanner);
+		parser->destroy(scanner);
+	}
+
+	uselocale(locale);
+	freelocale(c_locale);
+
+	return err;
+}
+
+static uint32_t vs_constant_value(const asm_const *constant,
+				  unsigned int component)
+{
+	switch (component) {
+	case 0:
+		return constant->vector.x.value;
+	case 1:
+		return constant->vector.y.value;
+	case 2:
+		return constant->vector.z.value;
+	default:
+		return constant->vector.w.value;
+	}
+}
+
+/* operands reading the constant selected by uniform_fetch_index */
+static unsigned int vs_constant_operands(const vpe_instr128 *ins)
+{
+	unsigned int operands = 0;
+
+	if (ins->rA_type == REG_TYPE_UNIFORM)
+		operands |= BIT(0);
+
+	if (ins->rB_type == REG_TYPE_UNIFORM)
+		operands |= BIT(1);
+
+	if (ins->rC_type == REG_TYPE_UNIFORM)
+		operands |= BIT(2);
+
+	return operands;
+}
+
+static void vs_get_swizzle(const vpe_instr128 *ins, unsigned int operand,
+			   unsigned int swizzle[4])
+{
+	switch (operand) {
+	case 0:
+		swizzle[0] = ins->rA_swizzle_x;
+		swizzle[1] = ins->rA_swizzle_y;
+		swizzle[2] = ins->rA_swizzle_z;
+		swizzle[3] = ins->rA_swizzle_w;
+		break;
+	case 1:
+		swizzle[0] = ins->rB_swizzle_x;
+		swizzle[1] = ins->rB_swizzle_y;
+		swizzle[2] = ins->rB_swizzle_z;
+		swizzle[3] = ins->rB_swizzle_w;
+		break;
+	default:
+		swizzle[0] = ins->rC_swizzle_x;
+		swizzle[1] = ins->rC_swizzle_y;
+		swizzle[2] = ins->rC_swizzle_z;
+		swizzle[3] = ins->rC_swizzle_w;
+		break;
+	}
+}
+
+static void vs_set_swizzle(vpe_instr128 *ins, unsigned int operand,
+			   const unsigned int swizzle[4])
+{
+	switch (operand) {
+	case 0:
+		ins->rA_swizzle_x = swizzle[0];
+		ins->rA_swizzle_y = swizzle[1];
+		ins->rA_swizzle_z = swizzle[2];
+		ins->rA_swizzle_w = swizzle[3];
+		break;
+	case 1:
+		ins->rB_swizzle_x = swizzle[0];
+		ins->rB_swizzle_y = swizzle[1];
+		ins->rB_swizzle_z = swizzle[2];
+		ins->rB_swizzle_w = swizzle[3];
+		break;
+	default:
+		ins->rC_swizzle_x = swizzle[0];
+		ins->rC_swizzle_y = swizzle[1];
+		ins->rC_swizzle_z = swizzle[2];
+		ins->rC_swizzle_w = swizzle[3];
+		break;
+	}
+}
+
+/*
+ * Find the components of an already placed constant holding the values
+ * of the read components of another one, the same component is preferred
+ * to keep the swizzle intact.
+ */
+static bool vs_constant_share(const asm_const *placed, const asm_const *c,
+			      unsigned int reads, unsigned int map[4])
+{
+	unsigned int i, k;
+
+	for (i = 0; i < 4; i++) {
+		map[i] = i;
+
+		if (!(reads & BIT(i)))
+			continue;
+
+		if (vs_constant_value(placed, i) == vs_constant_value(c, i))
+			continue;
+
+		for (k = 0; k < 4; k++) {
+			if (vs_constant_value(placed, k) ==
+			    vs_constant_value(c, i))
+				break;
+		}
+
+		if (k == 4)
+			return false;
+
+		map[i] = k;
+	}
+
+	return true;
+}
+
+/*
+ * Literal constants share the 256 vec4 space with the uniforms and only
+ * the range of both used by the program is uploaded. Duplicated literals
+ * are folded into a single vec4, literals whose read components are found
+ * in another one are read from it through the swizzle, and the remaining
+ * ones are moved into the freed slots. Uniforms keep their location, and
+ * nothing is moved if the constants are addressed relatively.
+ */
+static void vs_share_constants(void)
+{
+	unsigned int map[256][4], reads[256] = { 0 }, swizzle[4], location[256];
+	bool taken[256] = { false };
+	unsigned int base = 256, slot, ops, i, k, op;
+	asm_const placed[256];
+	vpe_instr128 *ins;
+
+	for (i = 0; i < asm_vs_instructions_nb; i++) {
+		ins = &asm_vs_instructions[i];
+
+		if (ins->constant_relative_addressing_enable)
+			return;
+
+		ops = vs_constant_operands(ins);
+		if (!ops || ins->uniform_fetch_index > 255)
+			continue;
+
+		/* slots read without a literal behind them stay put */
+		if (!asm_vs_constants[ins->uniform_fetch_index].used ||
+		    asm_vs_uniforms[ins->uniform_fetch_index].used)
+			taken[ins->uniform_fetch_index] = true;
+
+		for (op = 0; op < 3; op++) {
+			if (!(ops & BIT(op)))
+				continue;
+
+			vs_get_swizzle(ins, op, swizzle);
+
+			for (k = 0; k < 4; k++)
+				reads[ins->uniform_fetch_index] |=
+							BIT(swizzle[k]);
+		}
+	}
+
+	memset(placed, 0, sizeof(placed));
+
+	for (i = 0; i < 256; i++) {
+		if (asm_vs_uniforms[i].used)
+			taken[i] = true;
+
+		if (asm_vs_uniforms[i].used || asm_vs_constants[i].used)
+			base = MIN(base, i);
+
+		if (asm_vs_constants[i].used && taken[i])
+			placed[i] = asm_vs_constants[i];
+	}
+
+	for (i = 0; i < 256; i++) {
+		location[i] = i;
+
+		for (k = 0; k < 4; k++)
+			map[i][k] = k;
+
+		/* literals clashing with a uniform are left as they are */
+		if (!asm_vs_constants[i].used || taken[i])
+			continue;
+
+		/* literals that are never read aren't uploaded at all */
+		if (!reads[i])
+			continue;
+
+		for (slot = base; slot < i; slot++) {
+			if (!placed[slot].used || asm_vs_uniforms[slot].used)
+				continue;
+
+			if (vs_constant_share(&placed[slot],
+					      &asm_vs_constants[i], reads[i],
+					      map[i]))
+				break;
+		}
+
+		if (slot == i) {
+			for (slot = base; slot < i; slot++) {
+				if (!placed[slot].used && !taken[slot])
+					break;
+			}
+
+			placed[slot] = asm_vs_constants[i];
+
+			for (k = 0; k < 4; k++)
+				map[i][k] = k;
+		}
+
+		location[i] = slot;
+	}
+
+	for (i = 0; i < asm_vs_instructions_nb; i++) {
+		ins = &asm_vs_instructions[i];
+
+		ops = vs_constant_operands(ins);
+		if (!ops || ins->uniform_fetch_index > 255)
+			continue;
+
+		slot = ins->uniform_fetch_index;
+
+		for (op = 0; op < 3; op++) {
+			if (!(ops & BIT(op)))
+				continue;
+
+			vs_get_swizzle(ins, op, swizzle);
+
+			for (k = 0; k < 4; k++)
+				swizzle[k] = map[slot][swizzle[k]];
+
+			vs_set_swizzle(ins, op, swizzle);
+		}
+
+		ins->uniform_fetch_index = location[slot];
+	}
+
+	memcpy(asm_vs_constants, placed, sizeof(placed));
 }
 
 struct grate_shader *grate_shader_parse_vertex_asm(const char *asm_txt)
@@ -101,7 +573,6 @@ struct grate_shader *grate_shader_parse_vertex_asm(const char *asm_txt)
 	struct grate_shader *shader;
 	struct cgc_symbol *symbols;
 	struct cgc_shader *cgc;
-	char *locale;
 	int words = 0;
 	int err;
 	int i;
@@ -109,20 +580,7 @@ struct grate_shader *grate_shader_parse_vertex_asm(const char *asm_txt)
 	if (!asm_txt)
 		return NULL;
 
-	locale = strdup( setlocale(LC_ALL, NULL) );
-	if (!locale)
-		return NULL;
-
-	/* atof() delimiter is locale-dependent! */
-	setlocale(LC_ALL, "C");
-
-	vertex_asm_scan_string(asm_txt);
-	err = vertex_asmparse();
-	vertex_asmlex_destroy();
-
-	/* restore locale */
-	setlocale(LC_ALL, locale);
-	free(locale);
+	err = grate_asm_parse(&vertex_asm_parser, asm_txt);
 
 	if (err != 0)
 		return NULL;
@@ -145,6 +603,8 @@ struct grate_shader *grate_shader_parse_vertex_asm(const char *asm_txt)
 
 	asm_vs_instructions[asm_vs_instructions_nb - 1].end_of_program = 1;
 
+	vs_share_constants();
+
 	shader->words[words++] = HOST1X_OPCODE_IMM(0x205, 0x00);
 
 	shader->words[words++] =
@@ -325,7 +785,6 @@ struct grate_shader *grate_shader_parse_fragment_asm(const char *asm_txt)
 	struct grate_shader *shader;
 	struct cgc_symbol *symbols;
 	struct cgc_shader *cgc;
-	char *locale;
 	int words = 0;
 	int err;
 	int i;
@@ -333,20 +792,7 @@ struct grate_shader *grate_shader_parse_fragment_asm(const char *asm_txt)
 	if (!asm_txt)
 		return NULL;
 
-	locale = strdup( setlocale(LC_ALL, NULL) );
-	if (!locale)
-		return NULL;
-
-	/* atof() delimiter is locale-dependent! */
-	setlocale(LC_ALL, "C");
-
-	fragment_asm_scan_string(asm_txt);
-	err = fragment_asmparse();
-	fragment_asmlex_destroy();
-
-	/* restore locale */
-	setlocale(LC_ALL, locale);
-	free(locale);
+	err = grate_asm_parse(&fragment_asm_parser, asm_txt);
 
 	if (err != 0)
 		return NULL;
@@ -518,6 +964,45 @@ struct grate_shader *grate_shader_parse_fragment_asm(const char *asm_txt)
 	return shader;
 }
 
+unsigned int grate_shader_render_targets(struct grate_shader *shader)
+{
+	unsigned int mask = 0;
+	unsigned int i, k;
+
+	for (i = 0; i < shader->num_words; i++) {
+		uint32_t host1x_command = shader->words[i];
+		unsigned int host1x_opcode = host1x_command >> 28;
+		unsigned int offset = (host1x_command >> 16) & 0xfff;
+		unsigned int count = host1x_command & 0xffff;
+		dw_instr dw;
+
+		switch (host1x_opcode) {
+		case 1: /* INCR */
+			i += count;
+			break;
+		case 2: /* NONINCR */
+			for (k = 0; offset == 0x901 && k < count; k++) {
+				if (i + 1 + k >= shader->num_words)
+					break;
+
+				dw.data = shader->words[i + 1 + k];
+				if (dw.enable)
+					mask |= 1u << dw.render_target_index;
+			}
+
+			i += count;
+			break;
+		case 3: /* MASK */
+			i += __builtin_popcount(count);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return mask;
+}
+
 const char *grate_shader_disasm_fs(struct grate_shader *shader)
 {
 	const char *error = NULL;
@@ -797,9 +1282,7 @@ struct grate_shader *grate_shader_parse_linker_asm(const char *asm_txt)
 	if (!asm_txt)
 		return NULL;
 
-	linker_asm_scan_string(asm_txt);
-	err = linker_asmparse();
-	linker_asmlex_destroy();
+	err = grate_asm_parse(&linker_asm_parser, asm_txt);
 
 	if (err != 0)
 		return NULL;
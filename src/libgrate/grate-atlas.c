@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Texture atlas. Images are packed into a single RGBA8888 texture with a
+ * bottom-left skyline packer. Every image is surrounded by a border of its
+ * replicated edge pixels and placed on an aligned position, so that
+ * filtering and the first mip levels of the atlas don't bleed neighbouring
+ * images into each other.
+ */
+
+#define GRATE_ATLAS_MAX_SEGMENTS 512
+
+struct grate_atlas_segment {
+	unsigned x;
+	unsigned y;
+	unsigned width;
+};
+
+struct grate_atlas {
+	struct grate *grate;
+	unsigned width;
+	unsigned height;
+	unsigned padding;
+	unsigned align;
+	uint32_t *pixels;
+
+	struct grate_atlas_segment segments[GRATE_ATLAS_MAX_SEGMENTS];
+	unsigned num_segments;
+};
+
+/*
+ * The padding is the number of border pixels around each image and the
+ * alignment is a power of two that image positions are rounded up to,
+ * typically 1 << (mip levels that must stay separated).
+ */
+struct grate_atlas *grate_atlas_create(struct grate *grate,
+				       unsigned width, unsigned height,
+				       unsigned padding, unsigned align)
+{
+	struct grate_atlas *atlas;
+
+	if (!width || !height || !align || (align & (align - 1))) {
+		grate_error("invalid atlas %ux%u alignment %u\n",
+			    width, height, align);
+		return NULL;
+	}
+
+	atlas = calloc(1, sizeof(*atlas));
+	if (!atlas)
+		return NULL;
+
+	atlas->pixels = calloc(width * height, sizeof(*atlas->pixels));
+	if (!atlas->pixels) {
+		free(atlas);
+		return NULL;
+	}
+
+	atlas->grate = grate;
+	atlas->width = width;
+	atlas->height = height;
+	atlas->padding = padding;
+	atlas->align = align;
+
+	atlas->segments[0].width = width;
+	atlas->num_segments = 1;
+
+	return atlas;
+}
+
+void grate_atlas_free(struct grate_atlas *atlas)
+{
+	if (!atlas)
+		return;
+
+	free(atlas->pixels);
+	free(atlas);
+}
+
+/* lowest y at which a w x h box starting at segment i fits, or -1 */
+static int grate_atlas_fit(struct grate_atlas *atlas, unsigned i,
+			   unsigned width, unsigned height)
+{
+	unsigned x = atlas->segments[i].x;
+	unsigned y = 0;
+	int left = width;
+
+	if (x + width > atlas->width)
+		return -1;
+
+	while (left > 0) {
+		if (i == atlas->num_segments)
+			return -1;
+
+		y = MAX(y, atlas->segments[i].y);
+		left -= atlas->segments[i].width;
+		i++;
+	}
+
+	y = ALIGN(y, atlas->align);
+
+	if (y + height > atlas->height)
+		return -1;
+
+	return y;
+}
+
+static int grate_atlas_insert(struct grate_atlas *atlas, unsigned index,
+			      unsigned x, unsigned y, unsigned width)
+{
+	struct grate_atlas_segment *segments = atlas->segments;
+	unsigned i;
+
+	if (atlas->num_segments == GRATE_ATLAS_MAX_SEGMENTS)
+		return -ENOSPC;
+
+	memmove(&segments[index + 1], &segments[index],
+		(atlas->num_segments - index) * sizeof(*segments));
+	atlas->num_segments++;
+
+	segments[index].x = x;
+	segments[index].y = y;
+	segments[index].width = width;
+
+	/* trim the segments that are covered by the new one */
+	for (i = index + 1; i < atlas->num_segments; i++) {
+		unsigned end = x + width;
+
+		if (segments[i].x >= end)
+			break;
+
+		if (segments[i].x + segments[i].width <= end) {
+			memmove(&segments[i], &segments[i + 1],
+				(atlas->num_segments - i - 1) *
+				sizeof(*segments));
+			atlas->num_segments--;
+			i--;
+			continue;
+		}
+
+		segments[i].width -= end - segments[i].x;
+		segments[i].x = end;
+		break;
+	}
+
+	/* merge neighbours of the same height */
+	for (i = 0; i + 1 < atlas->num_segments; i++) {
+		if (segments[i].y != segments[i + 1].y)
+			continue;
+
+		segments[i].width += segments[i + 1].width;
+		memmove(&segments[i + 1], &segments[i + 2],
+			(atlas->num_segments - i - 2) * sizeof(*segments));
+		atlas->num_segments--;
+		i--;
+	}
+
+	return 0;
+}
+
+static int grate_atlas_pack(struct grate_atlas *atlas, unsigned width,
+			    unsigned height, unsigned *px, unsigned *py)
+{
+	unsigned best_bottom = ~0u, best_width = ~0u;
+	int best = -1, y;
+	unsigned i;
+
+	width = ALIGN(width, atlas->align);
+	height = ALIGN(height, atlas->align);
+
+	for (i = 0; i < atlas->num_segments; i++) {
+		/* positions of the skyline are aligned by construction */
+		y = grate_atlas_fit(atlas, i, width, height);
+		if (y < 0)
+			continue;
+
+		if (y + height < best_bottom ||
+		    (y + height == best_bottom &&
+		     atlas->segments[i].width < best_width)) {
+			best_bottom = y + height;
+			best_width = atlas->segments[i].width;
+			best = i;
+			*px = atlas->segments[i].x;
+			*py = y;
+		}
+	}
+
+	if (best < 0)
+		return -ENOSPC;
+
+	return grate_atlas_insert(atlas, best, *px, *py + height, width);
+}
+
+/*
+ * Add RGBA8888 image data to the atlas. The data is expected bottom-up,
+ * as with all other texture loads. Returns -ENOSPC if it didn't fit.
+ */
+int grate_atlas_add_data(struct grate_atlas *atlas, const void *data,
+			 unsigned width, unsigned height, unsigned pitch,
+			 struct grate_atlas_rect *rect)
+{
+	unsigned pad = atlas->padding;
+	unsigned x, y, bx, by;
+	int err;
+
+	if (!width || !height)
+		return -EINVAL;
+
+	err = grate_atlas_pack(atlas, width + pad * 2, height + pad * 2,
+			       &bx, &by);
+	if (err < 0)
+		return err;
+
+	/* the border replicates the edge pixels of the image */
+	for (y = 0; y < height + pad * 2; y++) {
+		unsigned sy = MIN(MAX(y, pad) - pad, height - 1);
+		const uint32_t *src = (const uint32_t *)((const uint8_t *)data +
+							 sy * pitch);
+		uint32_t *dst = atlas->pixels + (by + y) * atlas->width + bx;
+
+		for (x = 0; x < width + pad * 2; x++)
+			dst[x] = src[MIN(MAX(x, pad) - pad, width - 1)];
+	}
+
+	rect->x = bx + pad;
+	rect->y = by + pad;
+	rect->width = width;
+	rect->height = height;
+	rect->u0 = rect->x / (float)atlas->width;
+	rect->v0 = rect->y / (float)atlas->height;
+	rect->u1 = (rect->x + width) / (float)atlas->width;
+	rect->v1 = (rect->y + height) / (float)atlas->height;
+
+	return 0;
+}
+
+int grate_atlas_add(struct grate_atlas *atlas, const char *path,
+		    struct grate_atlas_rect *rect)
+{
+	unsigned width, height;
+	void *data;
+	int err;
+
+	data = grate_texture_decode(path, true, &width, &height);
+	if (!data)
+		return -EINVAL;
+
+	err = grate_atlas_add_data(atlas, data, width, height, width * 4,
+				   rect);
+	if (err == -ENOSPC)
+		grate_error("\"%s\" doesn't fit the atlas\n", path);
+
+	free(data);
+
+	return err;
+}
+
+/*
+ * Create the atlas texture. The atlas can be added to afterwards and
+ * uploaded again with grate_atlas_update().
+ */
+struct grate_texture *grate_atlas_create_texture(struct grate_atlas *atlas)
+{
+	struct grate_texture *tex;
+
+	tex = grate_create_texture(atlas->grate, atlas->width, atlas->height,
+				   PIX_BUF_FMT_RGBA8888,
+				   PIX_BUF_LAYOUT_LINEAR);
+	if (!tex)
+		return NULL;
+
+	if (grate_atlas_update(atlas, tex)) {
+		grate_texture_free(tex);
+		return NULL;
+	}
+
+	return tex;
+}
+
+int grate_atlas_update(struct grate_atlas *atlas, struct grate_texture *tex)
+{
+	return host1x_pixelbuffer_load_data(atlas->grate->host1x, tex->pixbuf,
+					    atlas->pixels, atlas->width * 4,
+					    atlas->width * atlas->height * 4,
+					    PIX_BUF_FMT_RGBA8888,
+					    PIX_BUF_LAYOUT_LINEAR);
+}
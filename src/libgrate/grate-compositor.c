@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Layer compositor. Layers are stacked on top of the bound framebuffer and
+ * each is put on a hardware overlay plane if the plane can scan it out as
+ * is, so that the display controller does the composition. Layers that
+ * don't fit a plane are blitted into the framebuffer by GR2D instead.
+ */
+
+#define GRATE_COMPOSITOR_MAX_LAYERS	8
+/* the display windows can't shrink their input more than this */
+#define GRATE_COMPOSITOR_MAX_DOWNSCALE	2
+/* a queued plane update is applied within a frame */
+#define GRATE_COMPOSITOR_WAIT_MS	100
+
+struct grate_compositor_layer {
+	struct grate_framebuffer *fb;
+	struct grate_overlay *overlay;
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+
+	/* frames of the layer are queued, rather than shown by updates */
+	bool async;
+	/* the front buffer is on the plane or waits for the fence to go */
+	bool shown;
+	bool queued;
+	struct grate_fence fence;
+};
+
+struct grate_compositor {
+	struct grate *grate;
+	struct grate_compositor_layer layers[GRATE_COMPOSITOR_MAX_LAYERS];
+	unsigned int num_layers;
+	/* don't retry plane allocation until a plane got released */
+	bool planes_exhausted;
+};
+
+struct grate_compositor *grate_compositor_create(struct grate *grate)
+{
+	struct grate_compositor *compositor;
+
+	compositor = calloc(1, sizeof(*compositor));
+	if (!compositor)
+		return NULL;
+
+	compositor->grate = grate;
+
+	return compositor;
+}
+
+static void grate_compositor_release(struct grate_compositor *compositor,
+				     struct grate_compositor_layer *layer)
+{
+	if (!layer->overlay)
+		return;
+
+	grate_overlay_free(layer->overlay);
+	layer->overlay = NULL;
+	layer->shown = false;
+	compositor->planes_exhausted = false;
+}
+
+void grate_compositor_free(struct grate_compositor *compositor)
+{
+	unsigned int i;
+
+	if (!compositor)
+		return;
+
+	for (i = 0; i < compositor->num_layers; i++)
+		grate_compositor_release(compositor, &compositor->layers[i]);
+
+	free(compositor);
+}
+
+/*
+ * Add a layer on top of the previously added ones, the position is given
+ * in display coordinates. Returns the index of the layer.
+ */
+int grate_compositor_add_layer(struct grate_compositor *compositor,
+			       struct grate_framebuffer *fb,
+			       unsigned int x, unsigned int y,
+			       unsigned int width, unsigned int height)
+{
+	struct grate_compositor_layer *layer;
+
+	if (compositor->num_layers == GRATE_COMPOSITOR_MAX_LAYERS)
+		return -ENOSPC;
+
+	layer = &compositor->layers[compositor->num_layers];
+	layer->fb = fb;
+
+	grate_compositor_move_layer(compositor, compositor->num_layers,
+				    x, y, width, height);
+
+	return compositor->num_layers++;
+}
+
+int grate_compositor_move_layer(struct grate_compositor *compositor,
+				unsigned int index,
+				unsigned int x, unsigned int y,
+				unsigned int width, unsigned int height)
+{
+	struct grate_compositor_layer *layer;
+
+	if (index >= GRATE_COMPOSITOR_MAX_LAYERS)
+		return -EINVAL;
+
+	layer = &compositor->layers[index];
+	layer->x = x;
+	layer->y = y;
+	layer->width = width;
+	layer->height = height;
+
+	return 0;
+}
+
+static bool grate_compositor_fits(struct grate_compositor *compositor,
+				  struct grate_compositor_layer *layer)
+{
+	struct host1x_pixelbuffer *pixbuf = layer->fb->front->pixbuf;
+	struct grate *grate = compositor->grate;
+	unsigned int width, height;
+
+	grate_display_get_resolution(grate->display, &width, &height);
+
+	if (layer->x + layer->width > width ||
+	    layer->y + layer->height > height)
+		return false;
+
+	if (layer->width * GRATE_COMPOSITOR_MAX_DOWNSCALE < pixbuf->width ||
+	    layer->height * GRATE_COMPOSITOR_MAX_DOWNSCALE < pixbuf->height)
+		return false;
+
+	if (!layer->overlay) {
+		if (compositor->planes_exhausted)
+			return false;
+
+		layer->overlay = grate_overlay_create(grate->display);
+		if (!layer->overlay) {
+			compositor->planes_exhausted = true;
+			return false;
+		}
+	}
+
+	return grate_overlay_supports(layer->overlay, layer->fb);
+}
+
+static int grate_compositor_blit(struct grate_compositor *compositor,
+				 struct grate_compositor_layer *layer)
+{
+	struct grate *grate = compositor->grate;
+	struct host1x_pixelbuffer *src = layer->fb->front->pixbuf;
+	struct host1x_pixelbuffer *dst = grate_get_draw_pixbuf(grate->fb);
+	unsigned int y;
+
+	if (layer->x + layer->width > dst->width ||
+	    layer->y + layer->height > dst->height)
+		return -EINVAL;
+
+	/* framebuffers are stored bottom-up and shown reflected */
+	y = dst->height - layer->y - layer->height;
+
+	return host1x_gr2d_surface_blit(host1x_get_gr2d(grate->host1x),
+					src, dst,
+					0, 0, src->width, src->height,
+					layer->x, y,
+					layer->width, layer->height);
+}
+
+/*
+ * Compose the layers for the next frame, this has to be called before
+ * grate_swap_buffers(). Layers are given planes from the top down. Once a
+ * layer is blitted, the layers below it are blitted as well, since planes
+ * are always stacked above the framebuffer.
+ */
+int grate_compositor_update(struct grate_compositor *compositor, bool vsync)
+{
+	struct grate *grate = compositor->grate;
+	bool planes = grate->display && !grate->overlay;
+	int i, blit = -1, err;
+
+	for (i = compositor->num_layers - 1; i >= 0; i--) {
+		struct grate_compositor_layer *layer = &compositor->layers[i];
+
+		if (planes && grate_compositor_fits(compositor, layer))
+			continue;
+
+		grate_compositor_release(compositor, layer);
+		planes = false;
+
+		if (blit < 0)
+			blit = i;
+	}
+
+	if (blit >= 0) {
+		/* the blits go on top of the rendered frame */
+		err = grate_3d_wait_idle(grate);
+		if (err < 0)
+			return err;
+
+		for (i = 0; i <= blit; i++) {
+			err = grate_compositor_blit(compositor,
+						    &compositor->layers[i]);
+			if (err < 0)
+				return err;
+		}
+	}
+
+	for (i = blit + 1; i < (int)compositor->num_layers; i++) {
+		struct grate_compositor_layer *layer = &compositor->layers[i];
+
+		/* queued frames go to their plane by themselves */
+		if (layer->async && (layer->shown || layer->queued))
+			continue;
+
+		grate_overlay_show(layer->overlay, layer->fb,
+				   layer->x, layer->y,
+				   layer->width, layer->height,
+				   vsync, true);
+		layer->shown = true;
+		/* only the first plane update waits for vblank */
+		vsync = false;
+	}
+
+	err = grate_compositor_dispatch(compositor);
+
+	return err < 0 ? err : 0;
+}
+
+/*
+ * Present the frame drawn into the back buffer of a layer's framebuffer
+ * once the fence is reached, NULL if it's drawn already. A layer on a
+ * plane gets the frame at the vblank that follows, regardless of
+ * grate_compositor_update() and grate_swap_buffers(), a blitted layer with
+ * the next update. A queued frame that hasn't been presented yet is
+ * replaced. The buffer rotated in may be scanned out until the previous
+ * frame is applied, hence layers need triple buffering to not tear.
+ */
+int grate_compositor_queue_layer(struct grate_compositor *compositor,
+				 unsigned int index,
+				 struct grate_fence *fence)
+{
+	struct grate_compositor_layer *layer;
+	int err;
+
+	if (index >= compositor->num_layers)
+		return -EINVAL;
+
+	layer = &compositor->layers[index];
+
+	if (layer->queued) {
+		grate_framebuffer_replace(layer->fb);
+	} else {
+		if (layer->overlay && layer->shown) {
+			err = grate_overlay_wait(layer->overlay,
+						 GRATE_COMPOSITOR_WAIT_MS);
+			if (err < 0 && err != -ETIMEDOUT)
+				return err;
+		}
+
+		grate_framebuffer_swap(layer->fb);
+	}
+
+	if (fence) {
+		layer->fence = *fence;
+	} else {
+		memset(&layer->fence, 0, sizeof(layer->fence));
+		layer->fence.signaled = true;
+	}
+
+	layer->async = true;
+	layer->queued = true;
+
+	err = grate_compositor_dispatch(compositor);
+
+	return err < 0 ? err : 0;
+}
+
+/*
+ * Hand the queued frames whose fences were reached over to the planes,
+ * without blocking. Frames the display can't take yet stay queued for the
+ * next call, which the application makes from its loop, for example after
+ * grate_event_loop_dispatch(). Returns the number of frames handed over.
+ */
+int grate_compositor_dispatch(struct grate_compositor *compositor)
+{
+	unsigned int i, count = 0;
+	int err, ret = 0;
+
+	for (i = 0; i < compositor->num_layers; i++) {
+		struct grate_compositor_layer *layer = &compositor->layers[i];
+
+		if (!layer->queued)
+			continue;
+
+		/* blitted layers are composed by grate_compositor_update() */
+		if (!layer->overlay) {
+			layer->queued = false;
+			continue;
+		}
+
+		err = grate_fence_poll(&layer->fence);
+		if (err == 0)
+			continue;
+
+		if (err > 0) {
+			err = grate_overlay_queue(layer->overlay, layer->fb,
+						  layer->x, layer->y,
+						  layer->width, layer->height,
+						  true);
+			if (err == -EBUSY)
+				continue;
+
+			if (err == -ENOTSUP) {
+				grate_overlay_show(layer->overlay, layer->fb,
+						   layer->x, layer->y,
+						   layer->width,
+						   layer->height,
+						   false, true);
+				err = 0;
+			}
+		}
+
+		layer->queued = false;
+
+		if (err < 0) {
+			ret = err;
+			continue;
+		}
+
+		layer->shown = true;
+		count++;
+	}
+
+	return ret ?: (int)count;
+}
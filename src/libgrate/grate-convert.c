@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "libgrate-private.h"
+
+/*
+ * Conversion of RGBA8888 data into the uncompressed texture formats. The
+ * NEON code converts eight pixels at a time and rounds exactly like the
+ * C code, which converts the rest of a row.
+ */
+
+/* x / 255 rounded to the nearest, for x <= 255 * 255 */
+static inline unsigned int grate_div255(unsigned int x)
+{
+	return (x + ((x + 128) >> 8) + 128) >> 8;
+}
+
+static inline unsigned int grate_luma(const uint8_t *p)
+{
+	return (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+}
+
+static inline void grate_store16(uint8_t *dst, uint16_t value)
+{
+	memcpy(dst, &value, sizeof(value));
+}
+
+static void grate_convert_pixel(enum pixel_format format, const uint8_t *src,
+				uint8_t *dst, bool premultiply)
+{
+	uint8_t p[4] = { src[0], src[1], src[2], src[3] };
+	unsigned int i;
+
+	for (i = 0; premultiply && i < 3; i++)
+		p[i] = grate_div255(p[i] * p[3]);
+
+	switch (format) {
+	case PIX_BUF_FMT_A8:
+		dst[0] = p[3];
+		break;
+	case PIX_BUF_FMT_L8:
+		dst[0] = grate_luma(p);
+		break;
+	case PIX_BUF_FMT_LA88:
+		dst[0] = grate_luma(p);
+		dst[1] = p[3];
+		break;
+	case PIX_BUF_FMT_RGB565:
+		grate_store16(dst, grate_div255(p[0] * 31) << 11 |
+				   grate_div255(p[1] * 63) << 5 |
+				   grate_div255(p[2] * 31));
+		break;
+	case PIX_BUF_FMT_RGBA5551:
+		grate_store16(dst, grate_div255(p[0] * 31) << 11 |
+				   grate_div255(p[1] * 31) << 6 |
+				   grate_div255(p[2] * 31) << 1 |
+				   p[3] >> 7);
+		break;
+	case PIX_BUF_FMT_RGBA4444:
+		grate_store16(dst, grate_div255(p[0] * 15) << 12 |
+				   grate_div255(p[1] * 15) << 8 |
+				   grate_div255(p[2] * 15) << 4 |
+				   grate_div255(p[3] * 15));
+		break;
+	case PIX_BUF_FMT_BGRA8888:
+		dst[0] = p[2];
+		dst[1] = p[1];
+		dst[2] = p[0];
+		dst[3] = p[3];
+		break;
+	default:
+		memcpy(dst, p, 4);
+		break;
+	}
+}
+
+#ifdef __ARM_NEON
+static inline uint8x8_t grate_neon_div255(uint16x8_t x)
+{
+	return vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+}
+
+static inline uint16x8_t grate_neon_scale(uint8x8_t c, uint8_t max,
+					  unsigned int shift)
+{
+	uint8x8_t v = grate_neon_div255(vmull_u8(c, vdup_n_u8(max)));
+
+	return vshlq_u16(vmovl_u8(v), vdupq_n_s16(shift));
+}
+
+static inline uint8x8_t grate_neon_luma(uint8x8x4_t p)
+{
+	uint16x8_t x = vmull_u8(p.val[0], vdup_n_u8(77));
+
+	x = vmlal_u8(x, p.val[1], vdup_n_u8(150));
+	x = vmlal_u8(x, p.val[2], vdup_n_u8(29));
+
+	return vrshrn_n_u16(x, 8);
+}
+
+static void grate_convert_neon(enum pixel_format format, const uint8_t *src,
+			       uint8_t *dst, bool premultiply)
+{
+	uint8x8x4_t p = vld4_u8(src);
+	uint8x8x2_t la;
+	uint16x8_t v;
+	uint8x8_t t;
+	unsigned int i;
+
+	for (i = 0; premultiply && i < 3; i++)
+		p.val[i] = grate_neon_div255(vmull_u8(p.val[i], p.val[3]));
+
+	switch (format) {
+	case PIX_BUF_FMT_A8:
+		vst1_u8(dst, p.val[3]);
+		break;
+	case PIX_BUF_FMT_L8:
+		vst1_u8(dst, grate_neon_luma(p));
+		break;
+	case PIX_BUF_FMT_LA88:
+		la.val[0] = grate_neon_luma(p);
+		la.val[1] = p.val[3];
+		vst2_u8(dst, la);
+		break;
+	case PIX_BUF_FMT_RGB565:
+		v = grate_neon_scale(p.val[0], 31, 11);
+		v = vorrq_u16(v, grate_neon_scale(p.val[1], 63, 5));
+		v = vorrq_u16(v, grate_neon_scale(p.val[2], 31, 0));
+		vst1q_u8(dst, vreinterpretq_u8_u16(v));
+		break;
+	case PIX_BUF_FMT_RGBA5551:
+		v = grate_neon_scale(p.val[0], 31, 11);
+		v = vorrq_u16(v, grate_neon_scale(p.val[1], 31, 6));
+		v = vorrq_u16(v, grate_neon_scale(p.val[2], 31, 1));
+		v = vorrq_u16(v, vmovl_u8(vshr_n_u8(p.val[3], 7)));
+		vst1q_u8(dst, vreinterpretq_u8_u16(v));
+		break;
+	case PIX_BUF_FMT_RGBA4444:
+		v = grate_neon_scale(p.val[0], 15, 12);
+		v = vorrq_u16(v, grate_neon_scale(p.val[1], 15, 8));
+		v = vorrq_u16(v, grate_neon_scale(p.val[2], 15, 4));
+		v = vorrq_u16(v, grate_neon_scale(p.val[3], 15, 0));
+		vst1q_u8(dst, vreinterpretq_u8_u16(v));
+		break;
+	case PIX_BUF_FMT_BGRA8888:
+		t = p.val[0];
+		p.val[0] = p.val[2];
+		p.val[2] = t;
+		vst4_u8(dst, p);
+		break;
+	default:
+		vst4_u8(dst, p);
+		break;
+	}
+}
+#endif
+
+bool grate_convert_supported(enum pixel_format format)
+{
+	switch (format) {
+	case PIX_BUF_FMT_A8:
+	case PIX_BUF_FMT_L8:
+	case PIX_BUF_FMT_LA88:
+	case PIX_BUF_FMT_RGB565:
+	case PIX_BUF_FMT_RGBA5551:
+	case PIX_BUF_FMT_RGBA4444:
+	case PIX_BUF_FMT_RGBA8888:
+	case PIX_BUF_FMT_BGRA8888:
+		return true;
+	default:
+		return false;
+	}
+}
+
+int grate_convert_rgba(enum pixel_format format, bool premultiply,
+		       const void *src, unsigned int src_pitch,
+		       void *dst, unsigned int dst_pitch,
+		       unsigned int width, unsigned int height)
+{
+	unsigned int bpp = PIX_BUF_FORMAT_BYTES(format), x, y;
+	const uint8_t *in;
+	uint8_t *out;
+
+	if (!grate_convert_supported(format))
+		return -EINVAL;
+
+	for (y = 0; y < height; y++) {
+		in = (const uint8_t *)src + (size_t)y * src_pitch;
+		out = (uint8_t *)dst + (size_t)y * dst_pitch;
+		x = 0;
+
+#ifdef __ARM_NEON
+		for (; x + 8 <= width; x += 8)
+			grate_convert_neon(format, in + x * 4, out + x * bpp,
+					   premultiply);
+#endif
+
+		for (; x < width; x++)
+			grate_convert_pixel(format, in + x * 4, out + x * bpp,
+					    premultiply);
+	}
+
+	return 0;
+}
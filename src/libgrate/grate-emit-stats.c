@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Words and relocations that grate_3d_setup_context() emits per group of
+ * state, enabled by --emit-stats. The counts are taken from the pushbuf
+ * after each group, so a group that emits nothing costs two loads. Command
+ * lists are recorded by multiple threads, hence the baseline is kept by
+ * the caller and the counts are added atomically.
+ */
+
+static const char * const grate_emit_group_names[] = {
+	[GRATE_EMIT_CLASS]		= "class",
+	[GRATE_EMIT_DITHER]		= "dither",
+	[GRATE_EMIT_SCISSOR]		= "scissor",
+	[GRATE_EMIT_GUARDBAND]		= "guardband",
+	[GRATE_EMIT_LATE_TEST]		= "late test",
+	[GRATE_EMIT_POINT]		= "point",
+	[GRATE_EMIT_LINE]		= "line",
+	[GRATE_EMIT_PSEQ_DW_CFG]	= "pseq dw cfg",
+	[GRATE_EMIT_DEPTH_RANGE]	= "depth range",
+	[GRATE_EMIT_DEPTH_BUFFER]	= "depth buffer",
+	[GRATE_EMIT_STENCIL]		= "stencil",
+	[GRATE_EMIT_POLYGON_OFFSET]	= "polygon offset",
+	[GRATE_EMIT_PSEQ]		= "pseq",
+	[GRATE_EMIT_TRAM_ROWS]		= "tram rows",
+	[GRATE_EMIT_VIEWPORT]		= "viewport",
+	[GRATE_EMIT_CULL_FACE]		= "cull face",
+	[GRATE_EMIT_VS_UNIFORMS]	= "vs uniforms",
+	[GRATE_EMIT_FS_UNIFORMS]	= "fs uniforms",
+	[GRATE_EMIT_ATTRIBUTES]		= "attributes",
+	[GRATE_EMIT_RENDER_TARGETS]	= "render targets",
+	[GRATE_EMIT_TEXTURES]		= "textures",
+	[GRATE_EMIT_SHADERS]		= "shaders",
+};
+
+struct grate_emit_count {
+	uint64_t words;
+	uint64_t relocs;
+};
+
+struct grate_emit_stats {
+	struct grate_emit_count total[GRATE_EMIT_NUM_GROUPS];
+	struct grate_emit_count frame[GRATE_EMIT_NUM_GROUPS];
+	uint64_t draws;
+	uint64_t frames;
+};
+
+struct grate_emit_stats *grate_emit_stats_create(void)
+{
+	return calloc(1, sizeof(struct grate_emit_stats));
+}
+
+void grate_emit_stats_free(struct grate_emit_stats *stats)
+{
+	free(stats);
+}
+
+void grate_emit_stats_begin(struct grate_emit_mark *mark,
+			    struct grate_emit_stats *stats,
+			    struct host1x_pushbuf *pb)
+{
+	mark->stats = stats;
+
+	if (!stats)
+		return;
+
+	host1x_pushbuf_count(pb, &mark->words, &mark->relocs);
+	__atomic_fetch_add(&stats->draws, 1, __ATOMIC_RELAXED);
+}
+
+void grate_emit_stats_account(struct grate_emit_mark *mark,
+			      struct host1x_pushbuf *pb,
+			      enum grate_emit_group group)
+{
+	struct grate_emit_stats *stats = mark->stats;
+	unsigned long words, relocs;
+
+	if (!stats)
+		return;
+
+	host1x_pushbuf_count(pb, &words, &relocs);
+
+	__atomic_fetch_add(&stats->frame[group].words, words - mark->words,
+			   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->frame[group].relocs, relocs - mark->relocs,
+			   __ATOMIC_RELAXED);
+	mark->words = words;
+	mark->relocs = relocs;
+}
+
+/* the counts of the frame are put on the trace as counters */
+void grate_emit_stats_frame(struct grate *grate)
+{
+	struct grate_emit_stats *stats = grate->emit_stats;
+	uint64_t words[GRATE_EMIT_NUM_GROUPS];
+	unsigned int i;
+
+	if (!stats)
+		return;
+
+	for (i = 0; i < GRATE_EMIT_NUM_GROUPS; i++) {
+		struct grate_emit_count *frame = &stats->frame[i];
+
+		words[i] = __atomic_exchange_n(&frame->words, 0,
+					       __ATOMIC_RELAXED);
+		stats->total[i].words += words[i];
+		stats->total[i].relocs += __atomic_exchange_n(&frame->relocs, 0,
+							      __ATOMIC_RELAXED);
+	}
+
+	grate_trace_counters(grate, "emitted words", grate_emit_group_names,
+			     words, GRATE_EMIT_NUM_GROUPS);
+
+	stats->frames++;
+}
+
+void grate_emit_stats_print(struct grate_emit_stats *stats, FILE *fp)
+{
+	double draws, frames;
+	uint64_t words = 0, relocs = 0;
+	unsigned int i;
+
+	if (!stats || !stats->draws)
+		return;
+
+	/* a run without swaps has the draws of a single frame */
+	draws = stats->draws;
+	frames = stats->frames ?: 1;
+
+	if (!stats->frames)
+		memcpy(stats->total, stats->frame, sizeof(stats->total));
+
+	fprintf(fp, "%-16s %12s %12s %10s %10s %10s %10s\n", "group",
+		"words", "relocs", "words/d", "relocs/d", "words/f",
+		"relocs/f");
+
+	for (i = 0; i < GRATE_EMIT_NUM_GROUPS; i++) {
+		struct grate_emit_count *count = &stats->total[i];
+
+		fprintf(fp, "%-16s %12llu %12llu %10.1f %10.2f %10.1f %10.2f\n",
+			grate_emit_group_names[i],
+			(unsigned long long)count->words,
+			(unsigned long long)count->relocs,
+			count->words / draws, count->relocs / draws,
+			count->words / frames, count->relocs / frames);
+
+		words += count->words;
+		relocs += count->relocs;
+	}
+
+	fprintf(fp, "%-16s %12llu %12llu %10.1f %10.2f %10.1f %10.2f\n",
+		"total", (unsigned long long)words,
+		(unsigned long long)relocs, words / draws, relocs / draws,
+		words / frames, relocs / frames);
+	fprintf(fp, "%llu draws, %llu frames\n",
+		(unsigned long long)stats->draws,
+		(unsigned long long)stats->frames);
+}
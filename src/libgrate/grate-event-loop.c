@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Event loop. Flip completions and vblanks of the display, fence
+ * completions and key presses are multiplexed by an epoll fd, which can
+ * be slept on by grate_event_loop_dispatch() or added to the epoll of the
+ * application. The kernel interface has no fds for fences, so a waiter
+ * thread blocks on them and signals an eventfd. All callbacks run on the
+ * thread calling grate_event_loop_dispatch().
+ */
+
+#define GRATE_EVENT_LOOP_MAX_FENCES	64
+
+/* fences added meanwhile are picked up by the waiter this often */
+#define GRATE_EVENT_LOOP_WAIT_SLICE_MS	10
+
+enum grate_event_source {
+	GRATE_EVENT_DISPLAY,
+	GRATE_EVENT_FENCE,
+	GRATE_EVENT_INPUT,
+};
+
+struct grate_event_fence {
+	struct grate_fence *fence;
+	grate_fence_done_t done;
+	void *data;
+	/* fences are waited for in the order they were added */
+	uint64_t seq;
+	bool used;
+	bool signaled;
+	int err;
+};
+
+struct grate_event_loop {
+	struct grate *grate;
+	struct grate_event_loop_callbacks callbacks;
+	int epoll_fd;
+	int fence_fd;
+	bool display;
+	bool input;
+
+	pthread_t waiter;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+
+	struct grate_event_fence fences[GRATE_EVENT_LOOP_MAX_FENCES];
+	uint64_t seq;
+};
+
+static struct grate_event_fence *
+grate_event_loop_next_fence(struct grate_event_loop *loop)
+{
+	struct grate_event_fence *next = NULL, *f;
+	unsigned int i;
+
+	for (i = 0; i < GRATE_EVENT_LOOP_MAX_FENCES; i++) {
+		f = &loop->fences[i];
+
+		if (f->used && !f->signaled && (!next || f->seq < next->seq))
+			next = f;
+	}
+
+	return next;
+}
+
+static void *grate_event_loop_waiter(void *arg)
+{
+	struct grate_event_loop *loop = arg;
+	struct grate_event_fence *f;
+	struct host1x_client *client;
+	uint64_t seq, one = 1;
+	uint32_t value;
+	int err;
+
+	pthread_mutex_lock(&loop->lock);
+
+	while (!loop->stop) {
+		f = grate_event_loop_next_fence(loop);
+		if (!f) {
+			pthread_cond_wait(&loop->cond, &loop->lock);
+			continue;
+		}
+
+		client = f->fence->client;
+		value = f->fence->value;
+		seq = f->seq;
+
+		pthread_mutex_unlock(&loop->lock);
+		err = host1x_client_wait(client, value,
+					 GRATE_EVENT_LOOP_WAIT_SLICE_MS);
+		pthread_mutex_lock(&loop->lock);
+
+		if (err == -EAGAIN || err == -ETIMEDOUT)
+			continue;
+
+		/* the slot is released only by dispatch once signaled */
+		if (f->used && f->seq == seq) {
+			f->signaled = true;
+			f->err = err;
+		}
+
+		if (write(loop->fence_fd, &one, sizeof(one)) < 0)
+			grate_error("write() failed: %m\n");
+	}
+
+	pthread_mutex_unlock(&loop->lock);
+
+	return NULL;
+}
+
+static int grate_event_loop_watch(struct grate_event_loop *loop, int fd,
+				  enum grate_event_source source)
+{
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.u32 = source,
+	};
+
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * Display events are watched if the display can report them. Input is
+ * watched only with an on-screen display, as grate_key_pressed() does.
+ */
+struct grate_event_loop *
+grate_event_loop_create(struct grate *grate,
+			const struct grate_event_loop_callbacks *callbacks)
+{
+	struct grate_event_loop *loop;
+	int fd;
+
+	loop = calloc(1, sizeof(*loop));
+	if (!loop)
+		return NULL;
+
+	loop->grate = grate;
+	loop->fence_fd = -1;
+	pthread_mutex_init(&loop->lock, NULL);
+	pthread_cond_init(&loop->cond, NULL);
+
+	if (callbacks)
+		loop->callbacks = *callbacks;
+
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0)
+		goto free;
+
+	loop->fence_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (loop->fence_fd < 0)
+		goto close;
+
+	if (grate_event_loop_watch(loop, loop->fence_fd,
+				   GRATE_EVENT_FENCE) < 0)
+		goto close;
+
+	if (grate->display && !grate->overlay) {
+		fd = grate_display_get_event_fd(grate->display);
+		if (fd >= 0)
+			loop->display = grate_event_loop_watch(loop, fd,
+						GRATE_EVENT_DISPLAY) == 0;
+	}
+
+	if (grate->display || grate->overlay) {
+		grate_input_raw();
+		loop->input = grate_event_loop_watch(loop, STDIN_FILENO,
+						     GRATE_EVENT_INPUT) == 0;
+	}
+
+	if (pthread_create(&loop->waiter, NULL, grate_event_loop_waiter,
+			   loop))
+		goto close;
+
+	return loop;
+
+close:
+	if (loop->fence_fd >= 0)
+		close(loop->fence_fd);
+
+	close(loop->epoll_fd);
+free:
+	grate_error("failed to create event loop\n");
+	free(loop);
+	return NULL;
+}
+
+/* callbacks of fences that are still pending aren't called */
+void grate_event_loop_free(struct grate_event_loop *loop)
+{
+	if (!loop)
+		return;
+
+	pthread_mutex_lock(&loop->lock);
+	loop->stop = true;
+	pthread_cond_signal(&loop->cond);
+	pthread_mutex_unlock(&loop->lock);
+
+	pthread_join(loop->waiter, NULL);
+
+	close(loop->fence_fd);
+	close(loop->epoll_fd);
+	pthread_cond_destroy(&loop->cond);
+	pthread_mutex_destroy(&loop->lock);
+	free(loop);
+}
+
+/* becomes readable when grate_event_loop_dispatch() has work to do */
+int grate_event_loop_get_fd(struct grate_event_loop *loop)
+{
+	return loop->epoll_fd;
+}
+
+/* the vblank callback is called once for the next vblank */
+int grate_event_loop_request_vblank(struct grate_event_loop *loop)
+{
+	if (!loop->display)
+		return -ENOTSUP;
+
+	return grate_display_request_vblank(loop->grate->display);
+}
+
+/*
+ * The done callback is called once the fence is reached, with the error
+ * of the wait if it failed. The fence must stay valid until then.
+ */
+int grate_event_loop_add_fence(struct grate_event_loop *loop,
+			       struct grate_fence *fence,
+			       grate_fence_done_t done, void *data)
+{
+	struct grate_event_fence *f = NULL;
+	uint64_t one = 1;
+	unsigned int i;
+	int err;
+
+	/* the waiter thread can't submit a batch of a batched draw */
+	err = grate_fence_resolve(fence);
+	if (err < 0)
+		return err;
+
+	pthread_mutex_lock(&loop->lock);
+
+	for (i = 0; i < GRATE_EVENT_LOOP_MAX_FENCES; i++) {
+		if (!loop->fences[i].used) {
+			f = &loop->fences[i];
+			break;
+		}
+	}
+
+	if (!f) {
+		pthread_mutex_unlock(&loop->lock);
+		return -EBUSY;
+	}
+
+	f->fence = fence;
+	f->done = done;
+	f->data = data;
+	f->seq = loop->seq++;
+	f->used = true;
+	f->err = 0;
+
+	/* signaled fences go straight to the next dispatch */
+	f->signaled = fence->signaled;
+
+	if (f->signaled) {
+		if (write(loop->fence_fd, &one, sizeof(one)) < 0)
+			grate_error("write() failed: %m\n");
+	} else {
+		pthread_cond_signal(&loop->cond);
+	}
+
+	pthread_mutex_unlock(&loop->lock);
+
+	return 0;
+}
+
+static int grate_event_loop_dispatch_fences(struct grate_event_loop *loop)
+{
+	struct grate_event_fence done[GRATE_EVENT_LOOP_MAX_FENCES];
+	unsigned int i, count = 0;
+	uint64_t value;
+	int err;
+
+	if (read(loop->fence_fd, &value, sizeof(value)) < 0 &&
+	    errno != EAGAIN)
+		return -errno;
+
+	pthread_mutex_lock(&loop->lock);
+
+	for (i = 0; i < GRATE_EVENT_LOOP_MAX_FENCES; i++) {
+		if (loop->fences[i].used && loop->fences[i].signaled) {
+			done[count++] = loop->fences[i];
+			loop->fences[i].used = false;
+		}
+	}
+
+	pthread_mutex_unlock(&loop->lock);
+
+	/* callbacks may add fences */
+	for (i = 0; i < count; i++) {
+		err = done[i].err;
+
+		/* marks the fence signaled and checks its guards */
+		if (!err && grate_fence_poll(done[i].fence) < 0)
+			err = -EIO;
+
+		if (done[i].done)
+			done[i].done(done[i].data, done[i].fence, err);
+	}
+
+	return count;
+}
+
+static int grate_event_loop_dispatch_input(struct grate_event_loop *loop)
+{
+	uint8_t key[3];
+	ssize_t count;
+
+	count = read(STDIN_FILENO, key, sizeof(key));
+	tcflush(STDIN_FILENO, TCIFLUSH);
+
+	if (count <= 0)
+		return 0;
+
+	if (loop->callbacks.input)
+		loop->callbacks.input(loop->callbacks.data, key[count - 1]);
+
+	return 1;
+}
+
+/*
+ * Waits up to timeout milliseconds for events, -1 waits forever and 0
+ * polls, then runs their callbacks. Returns the number of events or a
+ * negative error code.
+ */
+int grate_event_loop_dispatch(struct grate_event_loop *loop, int timeout)
+{
+	struct host1x_display_events events = {
+		.flip = loop->callbacks.flip,
+		.vblank = loop->callbacks.vblank,
+		.data = loop->callbacks.data,
+	};
+	struct epoll_event ready[3];
+	int count = 0, err, num, i;
+
+	num = epoll_wait(loop->epoll_fd, ready, 3, timeout);
+	if (num < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (i = 0; i < num; i++) {
+		switch (ready[i].data.u32) {
+		case GRATE_EVENT_FENCE:
+			err = grate_event_loop_dispatch_fences(loop);
+			break;
+
+		case GRATE_EVENT_INPUT:
+			err = grate_event_loop_dispatch_input(loop);
+			break;
+
+		default:
+			err = 0;
+			break;
+		}
+
+		if (err < 0)
+			return err;
+
+		count += err;
+	}
+
+	/* flips waited for by grate_swap_buffers() are reported as well */
+	if (loop->display)
+		count += grate_display_handle_events(loop->grate->display,
+						     &events);
+
+	return count;
+}
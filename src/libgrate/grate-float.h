@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef GRATE_FLOAT_H
+#define GRATE_FLOAT_H 1
+
+#include <stdint.h>
+
+/*
+ * Conversions of floats into the formats of the fragment unit: fp20 is
+ * an s6e13 float with the exponent biased by 31, fx10 is a signed 2.8
+ * fixed point number. Zero is flushed to an all-zero encoding, infinity
+ * and NaN keep the maximum exponent.
+ */
+static inline uint32_t float_to_fp20(float f)
+{
+	uint32_t sign, mantissa, exponent;
+	union {
+		uint32_t u;
+		float f;
+	} value;
+
+	if (f == 0.0f)
+		return 0;
+
+	value.f = f;
+
+	sign = (value.u >> 31) & 0x1;
+	exponent = (value.u >> 23) & 0xff;
+	mantissa = (value.u >>  0) & 0x7fffff;
+
+	if (exponent == 0xff)
+		exponent = 0x3f;
+	else
+		exponent = (exponent - 127 + 31) & 0x3f;
+
+	return (sign << 19) | (exponent << 13) | (mantissa >> (23 - 13));
+}
+
+static inline uint32_t float_to_fx10(float f)
+{
+	/* two's complement, the conversion to unsigned is undefined */
+	int32_t i = f * 256.0f;
+
+	return (uint32_t)i & 0x3ff;
+}
+
+void float_to_fp20_array(uint32_t *dst, const float *src, unsigned count);
+void float_to_fx10_array(uint32_t *dst, const float *src, unsigned count);
+
+#endif
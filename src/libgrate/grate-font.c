@@ -22,6 +22,7 @@
 
 #define _GNU_SOURCE
 
+#include <errno.h>
 #include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
@@ -126,6 +127,21 @@ static int parse_config(struct character *chars, const char *config_path)
 	return nb == 0;
 }
 
+/* two triangles per character quad */
+static void grate_font_fill_indices(uint16_t *indices, unsigned chars_nb)
+{
+	unsigned i;
+
+	for (i = 0; i < chars_nb; i++) {
+		indices[0 + i * 6] = 0 + i * 4;
+		indices[1 + i * 6] = 1 + i * 4;
+		indices[2 + i * 6] = 2 + i * 4;
+		indices[3 + i * 6] = 0 + i * 4;
+		indices[4 + i * 6] = 2 + i * 4;
+		indices[5 + i * 6] = 3 + i * 4;
+	}
+}
+
 struct grate_font *grate_create_font(struct grate *grate,
 				     const char *font_path,
 				     const char *config_path)
@@ -138,7 +154,6 @@ struct grate_font *grate_create_font(struct grate *grate,
 	uint16_t *indices;
 	void *map;
 	int err;
-	int i;
 
 	vs = grate_shader_parse_vertex_asm(vs_asm);
 	if (!vs) {
@@ -183,7 +198,8 @@ struct grate_font *grate_create_font(struct grate *grate,
 	}
 
 	bo = HOST1X_BO_CREATE(grate->host1x, MAX_CHARS * CHAR_SZ,
-			      NVHOST_BO_FLAG_ATTRIBUTES);
+			      NVHOST_BO_FLAG_ATTRIBUTES |
+			      HOST1X_BO_MAP_WRITE_COMBINE);
 	if (!bo)
 		return NULL;
 
@@ -204,15 +220,7 @@ struct grate_font *grate_create_font(struct grate *grate,
 		return NULL;
 
 	indices = map + MAX_CHARS * 64;
-
-	for (i = 0; i < MAX_CHARS; i++) {
-		indices[0 + i * 6] = 0 + i * 4;
-		indices[1 + i * 6] = 1 + i * 4;
-		indices[2 + i * 6] = 2 + i * 4;
-		indices[3 + i * 6] = 0 + i * 4;
-		indices[4 + i * 6] = 2 + i * 4;
-		indices[5 + i * 6] = 3 + i * 4;
-	}
+	grate_font_fill_indices(indices, MAX_CHARS);
 
 	HOST1X_BO_FLUSH(font->indices_bo, font->indices_bo->offset,
 			MAX_CHARS * sizeof(indices));
@@ -222,26 +230,138 @@ struct grate_font *grate_create_font(struct grate *grate,
 	font->texture = texture;
 	font->program = program;
 
+	/* the glyphs are laid out by the pixbuf of the texture */
+	grate_texture_make_resident(texture, true);
+
 	return font;
 }
 
+/*
+ * Lay out a single character at the pen position, writing the quad of the
+ * glyph into the vertices and UV arrays. Returns false if the character
+ * only moves the pen.
+ */
+static bool grate_font_glyph(struct grate_font *font, unsigned code,
+			     float *x, float *y, float orig_x, float scale,
+			     float fb_w, float fb_h, float *vertices, float *uv)
+{
+	struct host1x_pixelbuffer *tex_pixbuf = font->texture->pixbuf;
+	float left, right, top, bottom, tex_w, tex_h;
+	struct character *ch = &font->ch[code];
+	int offt;
+
+	switch (code) {
+	case '\n':
+		ch = &font->ch[' '];
+		*y -= ch->orig_height / fb_h * scale;
+		*x  = orig_x;
+		return false;
+	case ' ':
+		*x += ch->orig_width / fb_w * scale;
+		return false;
+	default:
+		if (code > 127)
+			ch = &font->ch['?'];
+		break;
+	}
+
+	tex_w = tex_pixbuf->width;
+	tex_h = tex_pixbuf->height;
+
+	left   = ch->pos_x / tex_w;
+	right  = ch->width / tex_w + left;
+	top    = ch->pos_y / tex_h;
+	bottom = ch->height / tex_h + top;
+
+	uv[0] = left;
+	uv[1] = 1.0f - top;
+	uv[2] = right;
+	uv[3] = 1.0f - top;
+	uv[4] = right;
+	uv[5] = 1.0f - bottom;
+	uv[6] = left;
+	uv[7] = 1.0f - bottom;
+
+	offt = ch->orig_height - ch->off_y - ch->height;
+
+	left   = *x   +  ch->off_x / fb_w * scale;
+	right  = left +  ch->width / fb_w * scale;
+	top    = *y   +       offt / fb_h * scale;
+	bottom = top  + ch->height / fb_h * scale;
+
+	vertices[0] = left;
+	vertices[1] = bottom;
+	vertices[2] = right;
+	vertices[3] = bottom;
+	vertices[4] = right;
+	vertices[5] = top;
+	vertices[6] = left;
+	vertices[7] = top;
+
+	*x += ch->orig_width / fb_w * scale;
+
+	return true;
+}
+
+static void grate_font_setup_ctx(struct grate_font *font,
+				 struct grate_3d_ctx *ctx,
+				 unsigned render_target,
+				 struct host1x_pixelbuffer *fb_pixbuf,
+				 const struct host1x_bo_view *vertices,
+				 const struct host1x_bo_view *uv)
+{
+	unsigned location, i;
+
+	grate_3d_ctx_perform_depth_test(ctx, false);
+	grate_3d_ctx_perform_depth_write(ctx, false);
+	grate_3d_ctx_perform_stencil_test(ctx, false);
+	grate_3d_ctx_set_cull_face(ctx, GRATE_3D_CTX_CULL_FACE_NONE);
+	grate_3d_ctx_bind_program(ctx, font->program);
+
+	for (i = 0; i < 16; i++) {
+		grate_3d_ctx_disable_vertex_attrib_array(ctx, i);
+		grate_3d_ctx_disable_render_target(ctx, i);
+		grate_3d_ctx_bind_texture(ctx, i, NULL);
+	}
+
+	location = grate_get_attribute_location(font->program, "position");
+	grate_3d_ctx_vertex_attrib_pointer_view(ctx, location, 2,
+						TGR3D_ATTRIB_TYPE_FLOAT32,
+						2 * sizeof(float), vertices);
+	grate_3d_ctx_enable_vertex_attrib_array(ctx, location);
+
+	location = grate_get_attribute_location(font->program, "texcoord");
+	grate_3d_ctx_vertex_attrib_pointer_view(ctx, location, 2,
+						TGR3D_ATTRIB_TYPE_FLOAT32,
+						2 * sizeof(float), uv);
+	grate_3d_ctx_enable_vertex_attrib_array(ctx, location);
+
+	grate_3d_ctx_bind_texture(ctx, 0, font->texture);
+	grate_texture_set_wrap_t(font->texture, GRATE_TEXTURE_MIRRORED_REPEAT);
+	grate_texture_set_mag_filter(font->texture, GRATE_TEXTURE_LINEAR);
+
+	grate_3d_ctx_bind_render_target(ctx, render_target, fb_pixbuf);
+	grate_3d_ctx_enable_render_target(ctx, render_target);
+}
+
+/*
+ * The state of the context is changed for the text and restored on
+ * return, so it stays resident in hardware.
+ */
 void grate_3d_printf(struct grate *grate,
-		     const struct grate_3d_ctx *ctx,
+		     struct grate_3d_ctx *ctx,
 		     struct grate_font *font,
 		     unsigned render_target,
 		     float x, float y, float scale,
 		     const char *fmt, ...)
 {
 	struct host1x_pixelbuffer *fb_pixbuf;
-	struct host1x_pixelbuffer *tex_pixbuf;
-	struct grate_3d_ctx ctx_copy;
-	struct character *ch;
+	struct host1x_bo_view vertices, uv;
 	va_list ap;
-	unsigned code, chars_nb, chars_nb_to_draw = 0, location, i;
-	float left, right, top, bottom, tex_w, tex_h, fb_w, fb_h, orig_x = x;
+	unsigned chars_nb, chars_nb_to_draw = 0, i;
+	float fb_w, fb_h, orig_x = x;
 	char *text = NULL;
-	int offt, ret;
-	bool skip;
+	int ret;
 
 	va_start(ap, fmt);
 	ret = vasprintf(&text, fmt, ap);
@@ -255,108 +375,30 @@ void grate_3d_printf(struct grate *grate,
 		goto out;
 
 	fb_pixbuf = ctx->render_targets[render_target].pixbuf;
-	tex_pixbuf = font->texture->pixbuf;
 
 	if (render_target > 15 || !fb_pixbuf) {
 		grate_error("Invalid render target %u\n", render_target);
 		goto out;
 	}
 
-	ctx_copy = *ctx;
-	grate_3d_ctx_perform_depth_test(&ctx_copy, false);
-	grate_3d_ctx_perform_depth_write(&ctx_copy, false);
-	grate_3d_ctx_perform_stencil_test(&ctx_copy, false);
-	grate_3d_ctx_set_cull_face(&ctx_copy, GRATE_3D_CTX_CULL_FACE_NONE);
-	grate_3d_ctx_bind_program(&ctx_copy, font->program);
-
-	for (i = 0; i < 16; i++) {
-		grate_3d_ctx_disable_vertex_attrib_array(&ctx_copy, i);
-		grate_3d_ctx_disable_render_target(&ctx_copy, i);
-		grate_3d_ctx_bind_texture(&ctx_copy, i, NULL);
-	}
-
-	location = grate_get_attribute_location(font->program, "position");
-	grate_3d_ctx_vertex_attrib_float_pointer(&ctx_copy, location,
-						 2, font->vertices_bo);
-	grate_3d_ctx_enable_vertex_attrib_array(&ctx_copy, location);
+	host1x_bo_view_init(&vertices, font->vertices_bo, 0,
+			    font->vertices_bo->size);
+	host1x_bo_view_init(&uv, font->uv_bo, 0, font->uv_bo->size);
 
-	location = grate_get_attribute_location(font->program, "texcoord");
-	grate_3d_ctx_vertex_attrib_float_pointer(&ctx_copy, location,
-						 2, font->uv_bo);
-	grate_3d_ctx_enable_vertex_attrib_array(&ctx_copy, location);
-
-	grate_3d_ctx_bind_texture(&ctx_copy, 0, font->texture);
-	grate_texture_set_wrap_t(font->texture, GRATE_TEXTURE_MIRRORED_REPEAT);
-	grate_texture_set_mag_filter(font->texture, GRATE_TEXTURE_LINEAR);
+	if (grate_3d_ctx_push(ctx) < 0)
+		goto out;
 
-	grate_3d_ctx_bind_render_target(&ctx_copy, render_target, fb_pixbuf);
-	grate_3d_ctx_enable_render_target(&ctx_copy, render_target);
+	grate_font_setup_ctx(font, ctx, render_target, fb_pixbuf,
+			     &vertices, &uv);
 
 	fb_w = fb_pixbuf->width;
 	fb_h = fb_pixbuf->height;
 
-	tex_w = tex_pixbuf->width;
-	tex_h = tex_pixbuf->height;
-
-	for (i = 0, skip = false; i < chars_nb; i++, skip = false) {
-		code = text[i];
-		ch = &font->ch[code];
-
-		switch (code) {
-		case '\n':
-			ch = &font->ch[' '];
-			y -= ch->orig_height / fb_h * scale;
-			x  = orig_x;
-			skip = true;
-			break;
-		case ' ':
-			x += ch->orig_width / fb_w * scale;
-			skip = true;
-			break;
-		default:
-			if (code > 127)
-				ch = &font->ch['?'];
-			break;
-		}
-
-		if (!skip) {
-			left   = ch->pos_x / tex_w;
-			right  = ch->width / tex_w + left;
-			top    = ch->pos_y / tex_h;
-			bottom = ch->height / tex_h + top;
-
-			font->uv[0 + chars_nb_to_draw * 8] = left;
-			font->uv[1 + chars_nb_to_draw * 8] = 1.0f - top;
-			font->uv[2 + chars_nb_to_draw * 8] = right;
-			font->uv[3 + chars_nb_to_draw * 8] = 1.0f - top;
-			font->uv[4 + chars_nb_to_draw * 8] = right;
-			font->uv[5 + chars_nb_to_draw * 8] = 1.0f - bottom;
-			font->uv[6 + chars_nb_to_draw * 8] = left;
-			font->uv[7 + chars_nb_to_draw * 8] = 1.0f - bottom;
-
-			offt = ch->orig_height - ch->off_y - ch->height;
-
-			left   = x    +  ch->off_x / fb_w * scale;
-			right  = left +  ch->width / fb_w * scale;
-			top    = y    +       offt / fb_h * scale;
-			bottom = top  + ch->height / fb_h * scale;
-
-			font->vertices[0 + chars_nb_to_draw * 8] = left;
-			font->vertices[1 + chars_nb_to_draw * 8] = bottom;
-			font->vertices[2 + chars_nb_to_draw * 8] = right;
-			font->vertices[3 + chars_nb_to_draw * 8] = bottom;
-			font->vertices[4 + chars_nb_to_draw * 8] = right;
-			font->vertices[5 + chars_nb_to_draw * 8] = top;
-			font->vertices[6 + chars_nb_to_draw * 8] = left;
-			font->vertices[7 + chars_nb_to_draw * 8] = top;
-
-			x += ch->orig_width / fb_w * scale;
-		}
-
-		if (skip && i != chars_nb - 1)
-			continue;
-
-		if (!skip)
+	for (i = 0; i < chars_nb; i++) {
+		if (grate_font_glyph(font, (unsigned char)text[i], &x, &y,
+				     orig_x, scale, fb_w, fb_h,
+				     font->vertices + chars_nb_to_draw * 8,
+				     font->uv + chars_nb_to_draw * 8))
 			chars_nb_to_draw++;
 
 		if (chars_nb_to_draw == 0)
@@ -370,7 +412,7 @@ void grate_3d_printf(struct grate *grate,
 		HOST1X_BO_FLUSH(font->vertices_bo, font->vertices_bo->offset,
 				chars_nb_to_draw * 32);
 
-		grate_3d_draw_elements(&ctx_copy,
+		grate_3d_draw_elements(ctx,
 				       TGR3D_PRIMITIVE_TYPE_TRIANGLES,
 				       font->indices_bo,
 				       TGR3D_INDEX_MODE_UINT16,
@@ -379,6 +421,535 @@ void grate_3d_printf(struct grate *grate,
 
 		chars_nb_to_draw = 0;
 	}
+
+	grate_3d_ctx_pop(ctx);
 out:
 	free(text);
 }
+
+/*
+ * Glyph geometry owned by the text objects: the vertices, UVs and indices
+ * of up to max_chars characters, laid out like the buffer of the font.
+ */
+struct grate_glyph_bo {
+	struct host1x_bo *bo;
+	float *vertices;
+	float *uv;
+	unsigned max_chars;
+	struct host1x_bo_view vertices_view;
+	struct host1x_bo_view uv_view;
+	struct host1x_bo_view indices_view;
+};
+
+static void grate_glyph_bo_free(struct grate_glyph_bo *glyphs)
+{
+	if (glyphs->bo)
+		host1x_bo_free(glyphs->bo);
+
+	memset(glyphs, 0, sizeof(*glyphs));
+}
+
+/* the hardware must be done with the current geometry */
+static int grate_glyph_bo_reserve(struct grate *grate,
+				  struct grate_glyph_bo *glyphs,
+				  unsigned chars_nb)
+{
+	unsigned max_chars = glyphs->max_chars ?: 16;
+	void *map;
+
+	if (chars_nb <= glyphs->max_chars)
+		return 0;
+
+	/* indices are 16-bit, 4 vertices per character */
+	if (chars_nb > 0x10000 / 4)
+		return -EINVAL;
+
+	while (max_chars < chars_nb)
+		max_chars *= 2;
+
+	grate_glyph_bo_free(glyphs);
+
+	glyphs->bo = grate_bo_create_and_map(grate,
+					     NVHOST_BO_FLAG_ATTRIBUTES |
+					     HOST1X_BO_MAP_WRITE_COMBINE,
+					     max_chars * CHAR_SZ, &map);
+	if (!glyphs->bo)
+		return -ENOMEM;
+
+	host1x_bo_view_init(&glyphs->vertices_view, glyphs->bo, 0,
+			    max_chars * 32);
+	host1x_bo_view_init(&glyphs->uv_view, glyphs->bo, max_chars * 32,
+			    max_chars * 32);
+	host1x_bo_view_init(&glyphs->indices_view, glyphs->bo,
+			    max_chars * 64, max_chars * 12);
+
+	grate_font_fill_indices(map + max_chars * 64, max_chars);
+	HOST1X_BO_FLUSH(glyphs->bo, glyphs->indices_view.offset,
+			max_chars * 12);
+
+	glyphs->vertices = map;
+	glyphs->uv = glyphs->vertices + max_chars * 8;
+	glyphs->max_chars = max_chars;
+
+	return 0;
+}
+
+static void grate_glyph_bo_flush(struct grate_glyph_bo *glyphs,
+				 unsigned first, unsigned chars_nb)
+{
+	if (!chars_nb)
+		return;
+
+	HOST1X_BO_FLUSH(glyphs->bo, glyphs->vertices_view.offset + first * 32,
+			chars_nb * 32);
+	HOST1X_BO_FLUSH(glyphs->bo, glyphs->uv_view.offset + first * 32,
+			chars_nb * 32);
+}
+
+static unsigned grate_glyph_bo_layout(struct grate_glyph_bo *glyphs,
+				      unsigned first, struct grate_font *font,
+				      const char *string, float x, float y,
+				      float scale, float fb_w, float fb_h)
+{
+	unsigned chars_nb = first;
+	float orig_x = x;
+
+	for (; *string; string++) {
+		if (grate_font_glyph(font, (unsigned char)*string, &x, &y,
+				     orig_x, scale, fb_w, fb_h,
+				     glyphs->vertices + chars_nb * 8,
+				     glyphs->uv + chars_nb * 8))
+			chars_nb++;
+	}
+
+	return chars_nb - first;
+}
+
+/* views of the geometry of the characters starting at the given one */
+static void grate_glyph_bo_views(struct grate_glyph_bo *glyphs,
+				 unsigned first,
+				 struct host1x_bo_view *vertices,
+				 struct host1x_bo_view *uv)
+{
+	host1x_bo_view_init(vertices, glyphs->bo, first * 32,
+			    (glyphs->max_chars - first) * 32);
+	host1x_bo_view_init(uv, glyphs->bo, glyphs->max_chars * 32 + first * 32,
+			    (glyphs->max_chars - first) * 32);
+}
+
+/*
+ * Retained text. The glyph quads of the string are laid out once into a
+ * BO owned by the text object, together with a context that is set up on
+ * the first draw. Redrawing an unchanged string is a single asynchronous
+ * draw that re-emits only the render target, the geometry is rebuilt only
+ * if the string, its position or the size of the render target changes.
+ */
+struct grate_text {
+	struct grate *grate;
+	struct grate_font *font;
+	struct grate_3d_ctx ctx;
+	bool ctx_valid;
+	unsigned render_target;
+
+	struct grate_glyph_bo glyphs;
+	unsigned num_chars;
+
+	char *string;
+	float x, y, scale;
+	unsigned fb_w, fb_h;
+	bool dirty;
+	/* geometry may be in use by the hardware */
+	bool busy;
+};
+
+struct grate_text *grate_text_create(struct grate *grate,
+				     struct grate_font *font)
+{
+	struct grate_text *text;
+
+	text = calloc(1, sizeof(*text));
+	if (!text)
+		return NULL;
+
+	text->grate = grate;
+	text->font = font;
+
+	return text;
+}
+
+static int grate_text_idle(struct grate_text *text)
+{
+	int err;
+
+	if (!text->busy)
+		return 0;
+
+	err = grate_3d_wait_idle(text->grate);
+	if (err < 0)
+		return err;
+
+	text->busy = false;
+
+	return 0;
+}
+
+void grate_text_free(struct grate_text *text)
+{
+	if (!text)
+		return;
+
+	grate_text_idle(text);
+	grate_glyph_bo_free(&text->glyphs);
+	grate_3d_ctx_release(&text->ctx);
+	free(text->string);
+	free(text);
+}
+
+int grate_text_printf(struct grate_text *text, float x, float y,
+		      float scale, const char *fmt, ...)
+{
+	char *string = NULL;
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vasprintf(&string, fmt, ap);
+	va_end(ap);
+
+	if (ret < 0)
+		return -ENOMEM;
+
+	if (text->string && !strcmp(text->string, string) &&
+	    text->x == x && text->y == y && text->scale == scale) {
+		free(string);
+		return 0;
+	}
+
+	free(text->string);
+	text->string = string;
+	text->x = x;
+	text->y = y;
+	text->scale = scale;
+	text->dirty = true;
+
+	return 0;
+}
+
+static int grate_text_layout(struct grate_text *text,
+			     struct host1x_pixelbuffer *fb_pixbuf)
+{
+	unsigned max_chars = text->glyphs.max_chars;
+	int err;
+
+	/* the hardware may still read the previous geometry */
+	err = grate_text_idle(text);
+	if (err < 0)
+		return err;
+
+	err = grate_glyph_bo_reserve(text->grate, &text->glyphs,
+				     strlen(text->string));
+	if (err < 0)
+		return err;
+
+	/* the views bound to the context are gone with the old BO */
+	if (text->glyphs.max_chars != max_chars)
+		text->ctx_valid = false;
+
+	text->num_chars = grate_glyph_bo_layout(&text->glyphs, 0, text->font,
+						text->string, text->x, text->y,
+						text->scale, fb_pixbuf->width,
+						fb_pixbuf->height);
+	grate_glyph_bo_flush(&text->glyphs, 0, text->num_chars);
+
+	text->fb_w = fb_pixbuf->width;
+	text->fb_h = fb_pixbuf->height;
+	text->dirty = false;
+
+	return 0;
+}
+
+/*
+ * Draw the text into the given render target. The state of the context,
+ * like the viewport, is captured on the first draw and whenever the
+ * render target index changes.
+ */
+int grate_text_draw(struct grate_text *text, const struct grate_3d_ctx *ctx,
+		    unsigned render_target)
+{
+	struct host1x_pixelbuffer *fb_pixbuf;
+	int err;
+
+	if (render_target > 15)
+		return -EINVAL;
+
+	fb_pixbuf = ctx->render_targets[render_target].pixbuf;
+	if (!fb_pixbuf) {
+		grate_error("Invalid render target %u\n", render_target);
+		return -EINVAL;
+	}
+
+	if (!text->string)
+		return 0;
+
+	if (text->dirty || text->fb_w != fb_pixbuf->width ||
+	    text->fb_h != fb_pixbuf->height) {
+		err = grate_text_layout(text, fb_pixbuf);
+		if (err < 0)
+			return err;
+	}
+
+	if (!text->num_chars)
+		return 0;
+
+	if (!text->ctx_valid || text->render_target != render_target) {
+		grate_3d_ctx_release(&text->ctx);
+		grate_3d_ctx_copy(&text->ctx, ctx);
+		grate_3d_ctx_invalidate(&text->ctx);
+		grate_font_setup_ctx(text->font, &text->ctx, render_target,
+				     fb_pixbuf, &text->glyphs.vertices_view,
+				     &text->glyphs.uv_view);
+		text->render_target = render_target;
+		text->ctx_valid = true;
+	} else if (text->ctx.render_targets[render_target].pixbuf !=
+		   fb_pixbuf) {
+		grate_3d_ctx_bind_render_target(&text->ctx, render_target,
+						fb_pixbuf);
+	}
+
+	err = grate_3d_draw_elements_view_async(&text->ctx,
+						TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+						&text->glyphs.indices_view,
+						TGR3D_INDEX_MODE_UINT16,
+						text->num_chars * 6, NULL);
+	if (err < 0)
+		return err;
+
+	text->busy = true;
+
+	return 0;
+}
+
+/*
+ * Text batch. Strings printed into the batch are only recorded, on flush
+ * the glyphs of all of them are laid out into one vertex stream, grouped
+ * by font, and drawn with a single indexed draw per font. The geometry
+ * alternates between two BOs, so flushing doesn't wait for the draws of
+ * the previous flush.
+ */
+#define GRATE_TEXT_BATCH_BUFFERS	2
+
+struct grate_text_entry {
+	struct grate_font *font;
+	char *string;
+	float x, y, scale;
+};
+
+struct grate_text_batch {
+	struct grate *grate;
+	struct grate_3d_ctx ctx;
+
+	struct grate_text_entry *entries;
+	unsigned num_entries;
+	unsigned max_entries;
+	unsigned num_chars;
+
+	struct grate_glyph_bo glyphs[GRATE_TEXT_BATCH_BUFFERS];
+	struct grate_fence fences[GRATE_TEXT_BATCH_BUFFERS];
+	bool busy[GRATE_TEXT_BATCH_BUFFERS];
+	unsigned next;
+};
+
+struct grate_text_batch *grate_text_batch_create(struct grate *grate)
+{
+	struct grate_text_batch *batch;
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+
+	batch->grate = grate;
+
+	return batch;
+}
+
+static void grate_text_batch_reset(struct grate_text_batch *batch)
+{
+	unsigned i;
+
+	for (i = 0; i < batch->num_entries; i++)
+		free(batch->entries[i].string);
+
+	batch->num_entries = 0;
+	batch->num_chars = 0;
+}
+
+void grate_text_batch_free(struct grate_text_batch *batch)
+{
+	unsigned i;
+
+	if (!batch)
+		return;
+
+	for (i = 0; i < GRATE_TEXT_BATCH_BUFFERS; i++) {
+		if (batch->busy[i]) {
+			grate_3d_wait_idle(batch->grate);
+			break;
+		}
+	}
+
+	for (i = 0; i < GRATE_TEXT_BATCH_BUFFERS; i++)
+		grate_glyph_bo_free(&batch->glyphs[i]);
+
+	grate_text_batch_reset(batch);
+	grate_3d_ctx_release(&batch->ctx);
+	free(batch->entries);
+	free(batch);
+}
+
+int grate_text_batch_printf(struct grate_text_batch *batch,
+			    struct grate_font *font, float x, float y,
+			    float scale, const char *fmt, ...)
+{
+	struct grate_text_entry *entry;
+	char *string = NULL;
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vasprintf(&string, fmt, ap);
+	va_end(ap);
+
+	if (ret < 0)
+		return -ENOMEM;
+
+	if (batch->num_entries == batch->max_entries) {
+		unsigned max_entries = batch->max_entries ?: 16;
+
+		entry = realloc(batch->entries,
+				max_entries * 2 * sizeof(*entry));
+		if (!entry) {
+			free(string);
+			return -ENOMEM;
+		}
+
+		batch->entries = entry;
+		batch->max_entries = max_entries * 2;
+	}
+
+	entry = &batch->entries[batch->num_entries++];
+	entry->font = font;
+	entry->string = string;
+	entry->x = x;
+	entry->y = y;
+	entry->scale = scale;
+
+	batch->num_chars += ret;
+
+	return 0;
+}
+
+static int grate_text_batch_idle(struct grate_text_batch *batch,
+				 unsigned index)
+{
+	struct grate_fence *fence = &batch->fences[index];
+	int err;
+
+	if (!batch->busy[index])
+		return 0;
+
+	err = grate_fence_wait(fence, ~0u);
+	if (err < 0)
+		return err;
+
+	batch->busy[index] = false;
+
+	return 0;
+}
+
+/*
+ * Draw all strings printed since the last flush into the given render
+ * target, using the state of the context.
+ */
+int grate_text_batch_flush(struct grate_text_batch *batch,
+			   const struct grate_3d_ctx *ctx,
+			   unsigned render_target)
+{
+	unsigned index = batch->next, first = 0, count, i, j;
+	struct host1x_pixelbuffer *fb_pixbuf;
+	struct host1x_bo_view vertices, uv;
+	struct grate_glyph_bo *glyphs;
+	struct grate_font *font;
+	int err = 0;
+
+	if (render_target > 15 || !ctx->render_targets[render_target].pixbuf) {
+		grate_error("Invalid render target %u\n", render_target);
+		err = -EINVAL;
+		goto out;
+	}
+
+	if (!batch->num_chars)
+		goto out;
+
+	fb_pixbuf = ctx->render_targets[render_target].pixbuf;
+	glyphs = &batch->glyphs[index];
+
+	err = grate_text_batch_idle(batch, index);
+	if (err < 0)
+		goto out;
+
+	err = grate_glyph_bo_reserve(batch->grate, glyphs, batch->num_chars);
+	if (err < 0)
+		goto out;
+
+	for (i = 0; i < batch->num_entries; i++) {
+		font = batch->entries[i].font;
+		if (!font)
+			continue;
+
+		/* lay out all strings of the font next to each other */
+		for (j = i, count = 0; j < batch->num_entries; j++) {
+			struct grate_text_entry *entry = &batch->entries[j];
+
+			if (entry->font != font)
+				continue;
+
+			count += grate_glyph_bo_layout(glyphs, first + count,
+						       font, entry->string,
+						       entry->x, entry->y,
+						       entry->scale,
+						       fb_pixbuf->width,
+						       fb_pixbuf->height);
+			entry->font = NULL;
+		}
+
+		if (!count)
+			continue;
+
+		grate_glyph_bo_flush(glyphs, first, count);
+		grate_glyph_bo_views(glyphs, first, &vertices, &uv);
+
+		grate_3d_ctx_release(&batch->ctx);
+		grate_3d_ctx_copy(&batch->ctx, ctx);
+		grate_3d_ctx_invalidate(&batch->ctx);
+		grate_font_setup_ctx(font, &batch->ctx, render_target,
+				     fb_pixbuf, &vertices, &uv);
+
+		err = grate_3d_draw_elements_view_async(&batch->ctx,
+						TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+						&glyphs->indices_view,
+						TGR3D_INDEX_MODE_UINT16,
+						count * 6, &batch->fences[index]);
+		if (err < 0)
+			goto out;
+
+		batch->busy[index] = true;
+		first += count;
+	}
+
+	batch->next = (index + 1) % GRATE_TEXT_BATCH_BUFFERS;
+
+out:
+	grate_text_batch_reset(batch);
+
+	return err;
+}
@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libhost1x/host1x-private.h"
+#include "libgrate-private.h"
+
+#include "grate.h"
+#include "host1x.h"
+
+/*
+ * Render graph of the passes of a frame. Each pass runs on an engine and
+ * declares the pixbufs it reads and writes, a pass depends on the earlier
+ * passes that write what it reads or that access what it writes. Passes
+ * are executed in an order that keeps the dependencies and, among the
+ * ready ones, prefers the engine of the previous pass, hence GR3D passes
+ * are merged into a single batched job and independent GR2D passes don't
+ * interrupt it.
+ *
+ * Waits are inserted only for real dependencies. GR3D waits for GR2D
+ * in-stream. GR2D, which can't wait in-stream, and the CPU wait for GR3D
+ * after its pending draws are submitted. Transient pixbufs are put right
+ * after the last pass that uses them.
+ */
+
+#define GRATE_GRAPH_MAX_RESOURCES	8
+
+struct grate_graph_resource {
+	struct host1x_pixelbuffer *pixbuf;
+	bool write;
+};
+
+struct grate_graph_pass {
+	enum grate_graph_engine engine;
+	grate_graph_run_t run;
+	void *data;
+
+	struct grate_graph_resource resources[GRATE_GRAPH_MAX_RESOURCES];
+	unsigned int num_resources;
+
+	/* scheduling state of grate_graph_execute() */
+	unsigned int num_deps;
+	struct grate_fence fence;
+	bool done;
+};
+
+struct grate_graph {
+	struct grate *grate;
+
+	struct grate_graph_pass **passes;
+	unsigned int num_passes;
+	unsigned int max_passes;
+
+	struct host1x_pixelbuffer **transients;
+	unsigned int num_transients;
+	unsigned int max_transients;
+};
+
+struct grate_graph *grate_graph_create(struct grate *grate)
+{
+	struct grate_graph *graph;
+
+	graph = calloc(1, sizeof(*graph));
+	if (!graph)
+		return NULL;
+
+	graph->grate = grate;
+
+	return graph;
+}
+
+static void grate_graph_reset(struct grate_graph *graph)
+{
+	unsigned int i;
+
+	for (i = 0; i < graph->num_passes; i++)
+		free(graph->passes[i]);
+
+	graph->num_passes = 0;
+	graph->num_transients = 0;
+}
+
+void grate_graph_free(struct grate_graph *graph)
+{
+	if (!graph)
+		return;
+
+	grate_graph_reset(graph);
+	free(graph->transients);
+	free(graph->passes);
+	free(graph);
+}
+
+struct grate_graph_pass *grate_graph_add_pass(struct grate_graph *graph,
+					      enum grate_graph_engine engine,
+					      grate_graph_run_t run,
+					      void *data)
+{
+	struct grate_graph_pass *pass, **passes;
+	unsigned int max;
+
+	if (graph->num_passes == graph->max_passes) {
+		max = graph->max_passes * 2 ?: 16;
+
+		passes = realloc(graph->passes, max * sizeof(*passes));
+		if (!passes)
+			return NULL;
+
+		graph->passes = passes;
+		graph->max_passes = max;
+	}
+
+	pass = calloc(1, sizeof(*pass));
+	if (!pass)
+		return NULL;
+
+	pass->engine = engine;
+	pass->run = run;
+	pass->data = data;
+
+	graph->passes[graph->num_passes++] = pass;
+
+	return pass;
+}
+
+static int grate_graph_access(struct grate_graph_pass *pass,
+			      struct host1x_pixelbuffer *pixbuf, bool write)
+{
+	struct grate_graph_resource *res;
+	unsigned int i;
+
+	for (i = 0; i < pass->num_resources; i++) {
+		if (pass->resources[i].pixbuf == pixbuf) {
+			pass->resources[i].write |= write;
+			return 0;
+		}
+	}
+
+	if (pass->num_resources == GRATE_GRAPH_MAX_RESOURCES)
+		return -ENOSPC;
+
+	res = &pass->resources[pass->num_resources++];
+	res->pixbuf = pixbuf;
+	res->write = write;
+
+	return 0;
+}
+
+int grate_graph_read(struct grate_graph_pass *pass,
+		     struct host1x_pixelbuffer *pixbuf)
+{
+	return grate_graph_access(pass, pixbuf, false);
+}
+
+int grate_graph_write(struct grate_graph_pass *pass,
+		      struct host1x_pixelbuffer *pixbuf)
+{
+	return grate_graph_access(pass, pixbuf, true);
+}
+
+/* the pixbuf of grate_transient_pixbuf_get() is put by the execution */
+int grate_graph_transient(struct grate_graph *graph,
+			  struct host1x_pixelbuffer *pixbuf)
+{
+	struct host1x_pixelbuffer **transients;
+	unsigned int max;
+
+	if (graph->num_transients == graph->max_transients) {
+		max = graph->max_transients * 2 ?: 8;
+
+		transients = realloc(graph->transients,
+				     max * sizeof(*transients));
+		if (!transients)
+			return -ENOMEM;
+
+		graph->transients = transients;
+		graph->max_transients = max;
+	}
+
+	graph->transients[graph->num_transients++] = pixbuf;
+
+	return 0;
+}
+
+static bool grate_graph_uses(const struct grate_graph_pass *pass,
+			     struct host1x_pixelbuffer *pixbuf)
+{
+	unsigned int i;
+
+	for (i = 0; i < pass->num_resources; i++)
+		if (pass->resources[i].pixbuf == pixbuf)
+			return true;
+
+	return false;
+}
+
+/* whether pass b, following pass a, depends on it */
+static bool grate_graph_depends(const struct grate_graph_pass *a,
+				const struct grate_graph_pass *b)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < a->num_resources; i++) {
+		for (j = 0; j < b->num_resources; j++) {
+			if (a->resources[i].pixbuf != b->resources[j].pixbuf)
+				continue;
+
+			if (a->resources[i].write || b->resources[j].write)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/* the GR3D work recorded so far, the pending draws are submitted */
+static int grate_graph_gr3d_fence(struct grate *grate,
+				  struct grate_fence *fence)
+{
+	int err;
+
+	err = grate_3d_flush_batch(grate);
+	if (err < 0)
+		return err;
+
+	memset(fence, 0, sizeof(*fence));
+	fence->client = host1x_get_gr3d(grate->host1x)->client;
+	fence->value = grate->gr3d_fence;
+
+	return 0;
+}
+
+static int grate_graph_wait(struct grate *grate,
+			    struct grate_graph_pass *pass,
+			    struct grate_graph_pass *dep)
+{
+	struct grate_fence fence;
+	int err;
+
+	if (dep->engine == GRATE_GRAPH_GR3D) {
+		/* GR3D jobs are executed in order */
+		if (pass->engine == GRATE_GRAPH_GR3D)
+			return 0;
+
+		err = grate_graph_gr3d_fence(grate, &fence);
+		if (err < 0)
+			return err;
+
+		return grate_fence_wait(&fence, ~0u);
+	}
+
+	/* so are GR2D jobs */
+	if (pass->engine == GRATE_GRAPH_GR2D &&
+	    dep->engine == GRATE_GRAPH_GR2D)
+		return 0;
+
+	if (pass->engine == GRATE_GRAPH_GR3D)
+		return grate_3d_wait_fence(grate, &dep->fence);
+
+	return grate_fence_wait(&dep->fence, ~0u);
+}
+
+static int grate_graph_run(struct grate_graph *graph, unsigned int index,
+			   const bool *deps)
+{
+	struct grate_graph_pass *pass = graph->passes[index];
+	struct grate *grate = graph->grate;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < index; i++) {
+		if (!deps[i * graph->num_passes + index])
+			continue;
+
+		err = grate_graph_wait(grate, pass, graph->passes[i]);
+		if (err < 0)
+			return err;
+	}
+
+	if (pass->engine == GRATE_GRAPH_GR3D && !grate->batch.active)
+		grate_3d_begin_batch(grate);
+
+	memset(&pass->fence, 0, sizeof(pass->fence));
+	pass->fence.signaled = true;
+
+	err = pass->run(grate, pass->data, &pass->fence);
+	if (err < 0)
+		return err;
+
+	pass->done = true;
+
+	return 0;
+}
+
+/* puts the transients whose last user is done */
+static void grate_graph_put_transients(struct grate_graph *graph)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < graph->num_transients; i++) {
+		struct host1x_pixelbuffer *pixbuf = graph->transients[i];
+
+		if (!pixbuf)
+			continue;
+
+		for (j = 0; j < graph->num_passes; j++)
+			if (!graph->passes[j]->done &&
+			    grate_graph_uses(graph->passes[j], pixbuf))
+				break;
+
+		if (j < graph->num_passes)
+			continue;
+
+		grate_transient_pixbuf_put(graph->grate, pixbuf);
+		graph->transients[i] = NULL;
+	}
+}
+
+static int grate_graph_next(struct grate_graph *graph,
+			    enum grate_graph_engine engine)
+{
+	struct grate_graph_pass *pass;
+	int next = -1;
+	unsigned int i;
+
+	for (i = 0; i < graph->num_passes; i++) {
+		pass = graph->passes[i];
+
+		if (pass->done || pass->num_deps)
+			continue;
+
+		if (pass->engine == engine)
+			return i;
+
+		if (next < 0)
+			next = i;
+	}
+
+	return next;
+}
+
+/*
+ * Executes the passes and empties the graph. The fence is of the last GR3D
+ * work, or of the last pass if there was no GR3D pass.
+ */
+int grate_graph_execute(struct grate_graph *graph, struct grate_fence *fence)
+{
+	struct grate *grate = graph->grate;
+	bool batched = grate->batch.active;
+	unsigned int n = graph->num_passes;
+	enum grate_graph_engine engine = GRATE_GRAPH_GR3D;
+	struct grate_graph_pass *last = NULL;
+	bool gr3d = false;
+	unsigned int i, j;
+	bool *deps;
+	int err = 0;
+	int next;
+
+	deps = calloc(n * n + 1, sizeof(*deps));
+	if (!deps)
+		return -ENOMEM;
+
+	for (j = 0; j < n; j++) {
+		for (i = 0; i < j; i++) {
+			if (!grate_graph_depends(graph->passes[i],
+						 graph->passes[j]))
+				continue;
+
+			deps[i * n + j] = true;
+			graph->passes[j]->num_deps++;
+		}
+	}
+
+	while ((next = grate_graph_next(graph, engine)) >= 0) {
+		err = grate_graph_run(graph, next, deps);
+		if (err < 0)
+			break;
+
+		last = graph->passes[next];
+		engine = last->engine;
+		gr3d |= engine == GRATE_GRAPH_GR3D;
+
+		for (j = 0; j < n; j++)
+			if (deps[next * n + j])
+				graph->passes[j]->num_deps--;
+
+		grate_graph_put_transients(graph);
+	}
+
+	free(deps);
+
+	if (!batched && grate->batch.active) {
+		int ret = grate_3d_end_batch(grate, err < 0 ? NULL : fence);
+
+		if (!err)
+			err = ret;
+	} else if (!err && fence) {
+		if (gr3d)
+			err = grate_graph_gr3d_fence(grate, fence);
+		else if (last)
+			*fence = last->fence;
+		else
+			grate_graph_gr3d_fence(grate, fence);
+	}
+
+	/* the transients of failed passes are put with the frame */
+	grate_graph_reset(graph);
+
+	return err;
+}
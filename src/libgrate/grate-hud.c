@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../libhost1x/host1x-private.h"
+#include "libgrate-private.h"
+#include "grate-3d.h"
+
+/*
+ * Heads-up display. Shows the frame rate, a graph of the recent frame
+ * times and the host1x counters on top of the rendered frame. The graph
+ * bars are filled by GR2D within a single job that GR3D waits for
+ * in-stream, the text is drawn by GR3D, so the CPU isn't stalled by the
+ * HUD itself.
+ */
+
+#define GRATE_HUD_HISTORY	64
+
+/* geometry of the graph, in pixels */
+#define GRATE_HUD_BAR_WIDTH	3
+#define GRATE_HUD_GRAPH_HEIGHT	48
+#define GRATE_HUD_GRAPH_MARGIN	8
+
+/* frame time mapped to the full height of the graph */
+#define GRATE_HUD_GRAPH_RANGE	50000
+
+struct grate_hud {
+	struct grate *grate;
+	struct grate_font *font;
+
+	uint64_t frame_times[GRATE_HUD_HISTORY];
+	unsigned int num_frame_times;
+	unsigned int next_frame_time;
+	uint64_t last_frame;
+
+	struct host1x_stats stats;
+	uint64_t submits;
+	uint64_t words;
+	uint64_t wait_time;
+
+	/* CPU time spent in the last grate_hud_draw() */
+	uint64_t cost;
+};
+
+static uint64_t grate_hud_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+struct grate_hud *grate_hud_create(struct grate *grate)
+{
+	struct grate_hud *hud;
+
+	hud = calloc(1, sizeof(*hud));
+	if (!hud)
+		return NULL;
+
+	hud->font = grate_create_font(grate, "data/font.png", "data/font.fnt");
+	if (!hud->font) {
+		grate_error("failed to load HUD font\n");
+		free(hud);
+		return NULL;
+	}
+
+	hud->grate = grate;
+	host1x_get_stats(grate->host1x, &hud->stats);
+
+	return hud;
+}
+
+void grate_hud_free(struct grate_hud *hud)
+{
+	free(hud);
+}
+
+static uint32_t grate_hud_color(struct host1x_pixelbuffer *pixbuf,
+				uint8_t r, uint8_t g, uint8_t b)
+{
+	if (PIX_BUF_FORMAT_BITS(pixbuf->format) == 16)
+		return ((uint32_t)(r >> 3) << 11) |
+		       ((uint32_t)(g >> 2) <<  5) |
+		       ((uint32_t)(b >> 3) <<  0);
+
+	return 0xff000000 | b << 16 | g << 8 | r;
+}
+
+static void grate_hud_record(struct grate_hud *hud, uint64_t now)
+{
+	if (hud->last_frame) {
+		hud->frame_times[hud->next_frame_time] = now - hud->last_frame;
+		hud->next_frame_time = (hud->next_frame_time + 1) %
+				       GRATE_HUD_HISTORY;
+
+		if (hud->num_frame_times < GRATE_HUD_HISTORY)
+			hud->num_frame_times++;
+	}
+
+	hud->last_frame = now;
+}
+
+static int grate_hud_graph(struct grate_hud *hud,
+			   struct host1x_pixelbuffer *pixbuf,
+			   struct grate_fence *fence)
+{
+	struct grate *grate = hud->grate;
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
+	unsigned int width = GRATE_HUD_HISTORY * GRATE_HUD_BAR_WIDTH;
+	unsigned int x, y, i, index, height;
+	struct host1x_gr2d_batch batch;
+	uint64_t time;
+	uint32_t color;
+	int err;
+
+	if (pixbuf->width < width + GRATE_HUD_GRAPH_MARGIN * 2 ||
+	    pixbuf->height < GRATE_HUD_GRAPH_HEIGHT + GRATE_HUD_GRAPH_MARGIN)
+		return 0;
+
+	x = GRATE_HUD_GRAPH_MARGIN;
+	y = pixbuf->height - GRATE_HUD_GRAPH_MARGIN - GRATE_HUD_GRAPH_HEIGHT;
+
+	err = host1x_gr2d_batch_begin(gr2d, &batch);
+	if (err < 0)
+		return err;
+
+	err = host1x_gr2d_batch_clear_rect(&batch, pixbuf,
+					   grate_hud_color(pixbuf, 32, 32, 32),
+					   x, y, width, GRATE_HUD_GRAPH_HEIGHT);
+	if (err < 0)
+		goto abort;
+
+	/* oldest frame on the left */
+	for (i = 0; i < hud->num_frame_times; i++) {
+		index = (hud->next_frame_time + GRATE_HUD_HISTORY -
+			 hud->num_frame_times + i) % GRATE_HUD_HISTORY;
+		time = MIN(hud->frame_times[index], GRATE_HUD_GRAPH_RANGE);
+
+		height = time * GRATE_HUD_GRAPH_HEIGHT / GRATE_HUD_GRAPH_RANGE;
+		if (!height)
+			continue;
+
+		/* green within 60 Hz, yellow within 30 Hz, red otherwise */
+		if (time <= 16667)
+			color = grate_hud_color(pixbuf, 0, 224, 0);
+		else if (time <= 33333)
+			color = grate_hud_color(pixbuf, 224, 224, 0);
+		else
+			color = grate_hud_color(pixbuf, 224, 0, 0);
+
+		err = host1x_gr2d_batch_clear_rect(&batch, pixbuf, color,
+				x + i * GRATE_HUD_BAR_WIDTH,
+				y + GRATE_HUD_GRAPH_HEIGHT - height,
+				GRATE_HUD_BAR_WIDTH - 1, height);
+		if (err < 0)
+			goto abort;
+	}
+
+	memset(fence, 0, sizeof(*fence));
+	fence->client = gr2d->client;
+
+	err = host1x_gr2d_batch_submit(&batch, &fence->value);
+	if (err < 0)
+		return err;
+
+	fence->pixbufs[0] = pixbuf;
+	fence->num_pixbufs = 1;
+
+	return grate_3d_wait_fence(grate, fence);
+
+abort:
+	host1x_gr2d_batch_submit(&batch, NULL);
+	return err;
+}
+
+/*
+ * Draw the HUD into the given render target of the context. Must be
+ * called once per frame after the frame has been rendered and before
+ * the buffers are swapped, the interval between the calls is used as
+ * the frame time.
+ */
+void grate_hud_draw(struct grate_hud *hud, struct grate_3d_ctx *ctx,
+		    unsigned int render_target)
+{
+	struct grate *grate = hud->grate;
+	struct host1x_pixelbuffer *pixbuf;
+	uint64_t now = grate_hud_now(), start, sum = 0, max = 0;
+	struct host1x_stats stats;
+	struct grate_fence fence;
+	unsigned int i;
+	float fps = 0.0f;
+	int err;
+
+	grate_hud_record(hud, now);
+
+	if (render_target > 15)
+		return;
+
+	pixbuf = ctx->render_targets[render_target].pixbuf;
+	if (!pixbuf)
+		return;
+
+	for (i = 0; i < hud->num_frame_times; i++) {
+		sum += hud->frame_times[i];
+		max = MAX(max, hud->frame_times[i]);
+	}
+
+	if (sum)
+		fps = hud->num_frame_times * 1000000.0f / sum;
+
+	/* the GR2D fills must land on top of the completed frame */
+	err = grate_3d_wait_idle(grate);
+	if (err < 0)
+		return;
+
+	start = grate_hud_now();
+
+	err = grate_hud_graph(hud, pixbuf, &fence);
+	if (err < 0)
+		grate_error("failed to draw HUD graph: %d\n", err);
+
+	/* per-frame deltas of the driver counters */
+	host1x_get_stats(grate->host1x, &stats);
+
+	hud->submits = stats.gr2d.submits + stats.gr3d.submits -
+		       hud->stats.gr2d.submits - hud->stats.gr3d.submits;
+	hud->words = stats.gr2d.words + stats.gr3d.words -
+		     hud->stats.gr2d.words - hud->stats.gr3d.words;
+	hud->wait_time = stats.gr2d.wait_time_us + stats.gr3d.wait_time_us -
+			 hud->stats.gr2d.wait_time_us -
+			 hud->stats.gr3d.wait_time_us;
+	hud->stats = stats;
+
+	grate_3d_printf(grate, ctx, hud->font, render_target,
+			-0.95f, 0.9f, 0.5f,
+			"%.1f fps  avg %.2f ms  max %.2f ms\n"
+			"submits %llu  words %llu  waits %.2f ms\n"
+			"bo %llu live  %llu KiB  hud %.2f ms",
+			fps,
+			hud->num_frame_times ?
+				sum / 1000.0f / hud->num_frame_times : 0.0f,
+			max / 1000.0f,
+			(unsigned long long)hud->submits,
+			(unsigned long long)hud->words,
+			hud->wait_time / 1000.0f,
+			(unsigned long long)(stats.bo_creates -
+					     stats.bo_frees),
+			(unsigned long long)(stats.bo_bytes_allocated / 1024),
+			hud->cost / 1000.0f);
+
+	hud->cost = grate_hud_now() - start;
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "../libhost1x/host1x-private.h"
+#include "libgrate-private.h"
+
+#include "host1x.h"
+#include "grate.h"
+
+/*
+ * Asynchronous initialisation. host1x is opened right away, then GR2D,
+ * GR3D, the display with its modesetting and the loads of the application
+ * are brought up by a worker each, concurrently. The grate may be used by
+ * the caller once grate_init_wait() returned, the eventfd of
+ * grate_init_get_fd() becomes readable at that point and lets the wait be
+ * polled for.
+ */
+
+enum grate_init_worker {
+	GRATE_INIT_GR2D,
+	GRATE_INIT_GR3D,
+	GRATE_INIT_DISPLAY,
+	GRATE_INIT_LOADS,
+	GRATE_INIT_WORKERS,
+};
+
+struct grate_init;
+
+struct grate_init_thread {
+	struct grate_init *init;
+	enum grate_init_worker worker;
+	pthread_t thread;
+	bool started;
+};
+
+struct grate_init {
+	struct grate *grate;
+	struct grate_init_load *loads;
+	unsigned int num_loads;
+
+	struct grate_init_thread threads[GRATE_INIT_WORKERS];
+	unsigned int pending;
+	bool joined;
+	/* the first error of the workers */
+	int err;
+	int fd;
+};
+
+static int grate_init_run_loads(struct grate_init *init)
+{
+	unsigned int i;
+	int err = 0;
+
+	/* the loads are independent, a failed one doesn't stop the others */
+	for (i = 0; i < init->num_loads; i++) {
+		int ret = init->loads[i].load(init->grate, init->loads[i].data);
+
+		if (ret < 0 && !err)
+			err = ret;
+	}
+
+	return err;
+}
+
+static int grate_init_run(struct grate_init *init,
+			  enum grate_init_worker worker)
+{
+	struct grate *grate = init->grate;
+	struct host1x_gr3d *gr3d;
+
+	switch (worker) {
+	case GRATE_INIT_GR2D:
+		return host1x_get_gr2d(grate->host1x) ? 0 : -ENODEV;
+
+	case GRATE_INIT_GR3D:
+		gr3d = host1x_get_gr3d(grate->host1x);
+		if (!gr3d)
+			return -ENODEV;
+
+		if (grate->options->optimize_pushbufs)
+			host1x_client_optimize_pushbufs(gr3d->client, true);
+
+		return 0;
+
+	case GRATE_INIT_DISPLAY:
+		if (!grate->options->nodisplay)
+			host1x_open_display(grate->host1x);
+
+		grate_open_display(grate);
+		return 0;
+
+	case GRATE_INIT_LOADS:
+		return grate_init_run_loads(init);
+
+	default:
+		return -EINVAL;
+	}
+}
+
+static void grate_init_done(struct grate_init *init, int err)
+{
+	int expected = 0;
+	uint64_t value = 1;
+
+	if (err < 0)
+		__atomic_compare_exchange_n(&init->err, &expected, err, false,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED);
+
+	/* the last worker signals the readiness */
+	if (__atomic_sub_fetch(&init->pending, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	if (write(init->fd, &value, sizeof(value)) != sizeof(value))
+		grate_error("failed to signal the initialisation\n");
+}
+
+static void *grate_init_thread(void *arg)
+{
+	struct grate_init_thread *thread = arg;
+	struct grate_init *init = thread->init;
+
+	grate_init_done(init, grate_init_run(init, thread->worker));
+
+	return NULL;
+}
+
+struct grate *grate_init_async(struct grate_options *options, int fd,
+			       const struct grate_init_load *loads,
+			       unsigned int num_loads)
+{
+	struct grate_init_thread *thread;
+	struct grate_init *init;
+	struct grate *grate;
+	unsigned int i;
+
+	init = calloc(1, sizeof(*init));
+	if (!init)
+		return NULL;
+
+	init->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (init->fd < 0) {
+		free(init);
+		return NULL;
+	}
+
+	if (num_loads) {
+		init->loads = calloc(num_loads, sizeof(*loads));
+		if (!init->loads) {
+			grate_init_free(init);
+			return NULL;
+		}
+
+		memcpy(init->loads, loads, num_loads * sizeof(*loads));
+		init->num_loads = num_loads;
+	}
+
+	grate = grate_open(options, fd, true);
+	if (!grate) {
+		grate_init_free(init);
+		return NULL;
+	}
+
+	init->grate = grate;
+	init->pending = GRATE_INIT_WORKERS;
+	grate->init = init;
+
+	for (i = 0; i < GRATE_INIT_WORKERS; i++) {
+		thread = &init->threads[i];
+		thread->init = init;
+		thread->worker = i;
+
+		thread->started = !pthread_create(&thread->thread, NULL,
+						  grate_init_thread, thread);
+
+		/* bring it up on the calling thread if no worker started */
+		if (!thread->started)
+			grate_init_done(init, grate_init_run(init, i));
+	}
+
+	return grate;
+}
+
+/* readable once the initialisation is done, returns -1 if not async */
+int grate_init_get_fd(struct grate *grate)
+{
+	return grate->init ? grate->init->fd : -1;
+}
+
+int grate_init_wait(struct grate *grate)
+{
+	struct grate_init *init = grate->init;
+	unsigned int i;
+
+	if (!init)
+		return 0;
+
+	if (!init->joined) {
+		for (i = 0; i < GRATE_INIT_WORKERS; i++)
+			if (init->threads[i].started)
+				pthread_join(init->threads[i].thread, NULL);
+
+		init->joined = true;
+	}
+
+	return __atomic_load_n(&init->err, __ATOMIC_RELAXED);
+}
+
+void grate_init_free(struct grate_init *init)
+{
+	close(init->fd);
+	free(init->loads);
+	free(init);
+}
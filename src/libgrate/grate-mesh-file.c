@@ -0,0 +1,604 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libgrate-private.h"
+#include "tgr_3d.xml.h"
+
+#include "grate.h"
+#include "host1x.h"
+
+/*
+ * Binary meshes that are mapped and uploaded chunk by chunk. A file is all
+ * little-endian: the header, its attributes, the chunk table and the data
+ * the table points to. The vertices of a chunk are interleaved with the
+ * stride of the header and its triangles are uint16 indices into them, so
+ * that a chunk has at most 64K vertices. Each chunk gets a BO holding its
+ * vertices followed by its indices, the first chunk is uploaded right away
+ * and the others by a worker thread, straight from the mapped file. Draws
+ * use the chunks uploaded so far.
+ */
+#define GRATE_MESH_FILE_MAGIC		"GMSH"
+#define GRATE_MESH_FILE_VERSION		1
+#define GRATE_MESH_FILE_ALIGN		16
+
+struct grate_mesh_file_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t stride;
+	uint32_t num_attribs;
+	uint32_t num_chunks;
+	uint32_t reserved;
+};
+
+struct grate_mesh_file_attrib {
+	uint32_t size;
+	uint32_t type;
+	uint32_t offset;
+};
+
+struct grate_mesh_file_chunk {
+	uint32_t num_vertices;
+	uint32_t num_indices;
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+};
+
+struct grate_mesh_chunk {
+	struct host1x_bo *bo;
+	void *map;
+	struct host1x_bo_view vertices;
+	struct host1x_bo_view indices;
+	unsigned int num_indices;
+};
+
+struct grate_mesh_file {
+	struct grate *grate;
+	const uint8_t *data;
+	size_t size;
+
+	unsigned int stride;
+	unsigned int num_attribs;
+	struct grate_mesh_file_attrib attribs[16];
+
+	const struct grate_mesh_file_chunk *table;
+	struct grate_mesh_chunk *chunks;
+	unsigned int num_chunks;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	bool started;
+	/* chunks uploaded so far, in the order of the file */
+	unsigned int ready;
+	int error;
+};
+
+static size_t grate_mesh_chunk_size(const struct grate_mesh_file *mesh,
+				    const struct grate_mesh_file_chunk *chunk)
+{
+	return ALIGN(chunk->num_vertices * mesh->stride,
+		     GRATE_MESH_FILE_ALIGN) + chunk->num_indices * 2;
+}
+
+static int grate_mesh_file_check(struct grate_mesh_file *mesh)
+{
+	const struct grate_mesh_file_header *header;
+	const struct grate_mesh_file_chunk *chunk;
+	size_t offset, size;
+	unsigned int i;
+
+	header = (const void *)mesh->data;
+
+	if (mesh->size < sizeof(*header) ||
+	    memcmp(header->magic, GRATE_MESH_FILE_MAGIC, 4) ||
+	    header->version != GRATE_MESH_FILE_VERSION)
+		return -EINVAL;
+
+	if (!header->stride || !header->num_chunks ||
+	    header->num_attribs > ARRAY_SIZE(mesh->attribs))
+		return -EINVAL;
+
+	offset = sizeof(*header) +
+		 header->num_attribs * sizeof(struct grate_mesh_file_attrib);
+	size = (size_t)header->num_chunks * sizeof(*chunk);
+
+	if (offset + size > mesh->size)
+		return -EINVAL;
+
+	mesh->stride = header->stride;
+	mesh->num_attribs = header->num_attribs;
+	memcpy(mesh->attribs, mesh->data + sizeof(*header),
+	       mesh->num_attribs * sizeof(*mesh->attribs));
+	mesh->table = (const void *)(mesh->data + offset);
+	mesh->num_chunks = header->num_chunks;
+
+	for (i = 0; i < mesh->num_attribs; i++)
+		if (mesh->attribs[i].offset >= mesh->stride)
+			return -EINVAL;
+
+	for (i = 0; i < mesh->num_chunks; i++) {
+		chunk = &mesh->table[i];
+
+		if (!chunk->num_vertices || chunk->num_vertices > 65536 ||
+		    chunk->num_indices % 3)
+			return -EINVAL;
+
+		if (chunk->vertex_offset > mesh->size ||
+		    mesh->size - chunk->vertex_offset <
+				(uint64_t)chunk->num_vertices * mesh->stride)
+			return -EINVAL;
+
+		if (chunk->index_offset > mesh->size ||
+		    mesh->size - chunk->index_offset <
+				(uint64_t)chunk->num_indices * 2)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int grate_mesh_file_upload(struct grate_mesh_file *mesh,
+				  unsigned int index)
+{
+	const struct grate_mesh_file_chunk *src = &mesh->table[index];
+	struct grate_mesh_chunk *chunk = &mesh->chunks[index];
+	size_t vertices = (size_t)src->num_vertices * mesh->stride;
+	size_t indices = (size_t)src->num_indices * 2;
+	uintptr_t start, end;
+
+	memcpy(chunk->map, mesh->data + src->vertex_offset, vertices);
+	memcpy((uint8_t *)chunk->map + chunk->indices.offset -
+	       chunk->bo->offset,
+	       mesh->data + src->index_offset, indices);
+
+	/* the vertices of the file aren't read again */
+	start = (uintptr_t)(mesh->data + src->vertex_offset);
+	end = start + vertices;
+	start &= ~(uintptr_t)(getpagesize() - 1);
+	madvise((void *)start, end - start, MADV_DONTNEED);
+
+	return HOST1X_BO_FLUSH(chunk->bo, chunk->bo->offset,
+			       grate_mesh_chunk_size(mesh, src));
+}
+
+static void *grate_mesh_file_thread(void *data)
+{
+	struct grate_mesh_file *mesh = data;
+	unsigned int i;
+	int err = 0;
+
+	for (i = 1; i < mesh->num_chunks; i++) {
+		err = grate_mesh_file_upload(mesh, i);
+		if (err)
+			break;
+
+		pthread_mutex_lock(&mesh->lock);
+		mesh->ready = i + 1;
+		pthread_mutex_unlock(&mesh->lock);
+	}
+
+	pthread_mutex_lock(&mesh->lock);
+	mesh->error = err;
+	pthread_mutex_unlock(&mesh->lock);
+
+	return NULL;
+}
+
+void grate_mesh_file_free(struct grate_mesh_file *mesh)
+{
+	unsigned int i;
+
+	if (!mesh)
+		return;
+
+	if (mesh->started)
+		pthread_join(mesh->thread, NULL);
+
+	for (i = 0; mesh->chunks && i < mesh->num_chunks; i++)
+		if (mesh->chunks[i].bo)
+			grate_bo_free(mesh->grate, mesh->chunks[i].bo);
+
+	if (mesh->data)
+		munmap((void *)mesh->data, mesh->size);
+
+	pthread_mutex_destroy(&mesh->lock);
+	free(mesh->chunks);
+	free(mesh);
+}
+
+/*
+ * Maps a mesh file and allocates the BOs of its chunks. The first chunk is
+ * available once this returns, the others are uploaded in the background.
+ */
+struct grate_mesh_file *grate_mesh_file_open(struct grate *grate,
+					     const char *path)
+{
+	const struct grate_mesh_file_chunk *src;
+	struct grate_mesh_chunk *chunk;
+	struct grate_mesh_file *mesh;
+	unsigned long offset, vertices;
+	struct stat st;
+	unsigned int i;
+	void *data;
+	int fd, err;
+
+	mesh = calloc(1, sizeof(*mesh));
+	if (!mesh)
+		return NULL;
+
+	mesh->grate = grate;
+	pthread_mutex_init(&mesh->lock, NULL);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		grate_error("failed to open %s: %m\n", path);
+		goto fail;
+	}
+
+	if (fstat(fd, &st) < 0 || !st.st_size) {
+		close(fd);
+		goto fail;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		grate_error("failed to map %s: %m\n", path);
+		goto fail;
+	}
+
+	mesh->data = data;
+	mesh->size = st.st_size;
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	if (grate_mesh_file_check(mesh) < 0) {
+		grate_error("%s isn't a valid mesh\n", path);
+		goto fail;
+	}
+
+	mesh->chunks = calloc(mesh->num_chunks, sizeof(*mesh->chunks));
+	if (!mesh->chunks)
+		goto fail;
+
+	for (i = 0; i < mesh->num_chunks; i++) {
+		src = &mesh->table[i];
+		chunk = &mesh->chunks[i];
+
+		chunk->bo = grate_bo_create_and_map(grate,
+					NVHOST_BO_FLAG_ATTRIBUTES |
+					HOST1X_BO_MAP_WRITE_COMBINE,
+					grate_mesh_chunk_size(mesh, src),
+					&chunk->map);
+		if (!chunk->bo)
+			goto fail;
+
+		vertices = (unsigned long)src->num_vertices * mesh->stride;
+		offset = ALIGN(vertices, GRATE_MESH_FILE_ALIGN);
+
+		host1x_bo_view_init(&chunk->vertices, chunk->bo, 0, vertices);
+		host1x_bo_view_init(&chunk->indices, chunk->bo, offset,
+				    src->num_indices * 2);
+		chunk->num_indices = src->num_indices;
+	}
+
+	err = grate_mesh_file_upload(mesh, 0);
+	if (err)
+		goto fail;
+
+	mesh->ready = 1;
+
+	if (mesh->num_chunks > 1) {
+		err = pthread_create(&mesh->thread, NULL,
+				     grate_mesh_file_thread, mesh);
+		if (err) {
+			grate_error("failed to create mesh thread: %d\n", err);
+			goto fail;
+		}
+
+		mesh->started = true;
+	}
+
+	return mesh;
+
+fail:
+	grate_mesh_file_free(mesh);
+
+	return NULL;
+}
+
+/* number of chunks that can be drawn, negative if the upload failed */
+int grate_mesh_file_ready(struct grate_mesh_file *mesh)
+{
+	unsigned int ready;
+	int err;
+
+	pthread_mutex_lock(&mesh->lock);
+	ready = mesh->ready;
+	err = mesh->error;
+	pthread_mutex_unlock(&mesh->lock);
+
+	return err ?: (int)ready;
+}
+
+int grate_mesh_file_wait(struct grate_mesh_file *mesh)
+{
+	if (mesh->started) {
+		pthread_join(mesh->thread, NULL);
+		mesh->started = false;
+	}
+
+	return mesh->error;
+}
+
+/*
+ * Draws the triangles of the chunks uploaded so far in one batch. The
+ * attributes of the file are bound to the given locations, negative ones
+ * are skipped. Returns the number of chunks drawn.
+ */
+int grate_mesh_file_draw(struct grate_mesh_file *mesh,
+			 struct grate_3d_ctx *ctx, const int *locations,
+			 struct grate_fence *fence)
+{
+	struct grate *grate = mesh->grate;
+	bool batch = !grate->batch.active;
+	struct grate_mesh_chunk *chunk;
+	struct host1x_bo_view view;
+	int ready, err = 0;
+	unsigned int i, k;
+
+	ready = grate_mesh_file_ready(mesh);
+	if (ready < 0)
+		return ready;
+
+	if (batch)
+		grate_3d_begin_batch(grate);
+
+	for (i = 0; i < (unsigned int)ready && !err; i++) {
+		chunk = &mesh->chunks[i];
+
+		for (k = 0; k < mesh->num_attribs && !err; k++) {
+			if (locations[k] < 0)
+				continue;
+
+			view = chunk->vertices;
+			view.offset += mesh->attribs[k].offset;
+			view.size -= mesh->attribs[k].offset;
+
+			err = grate_3d_ctx_vertex_attrib_pointer_view(ctx,
+						locations[k],
+						mesh->attribs[k].size,
+						mesh->attribs[k].type,
+						mesh->stride, &view);
+			if (!err)
+				err = grate_3d_ctx_enable_vertex_attrib_array(
+							ctx, locations[k]);
+		}
+
+		if (!err)
+			err = grate_3d_draw_elements_view_async(ctx,
+						TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+						&chunk->indices,
+						TGR3D_INDEX_MODE_UINT16,
+						chunk->num_indices,
+						batch ? NULL : fence);
+	}
+
+	if (batch) {
+		if (err)
+			grate_3d_end_batch(grate, NULL);
+		else
+			err = grate_3d_end_batch(grate, fence);
+	}
+
+	return err ?: ready;
+}
+
+/*
+ * Takes the triangles from start on while their vertices fit into a chunk,
+ * returns the number of indices taken. The remap table maps the vertices
+ * of the mesh to those of the chunk, the chunk ones are stored in order.
+ */
+static unsigned int grate_mesh_file_split(const uint32_t *indices,
+					  unsigned int num_indices,
+					  unsigned int start, uint32_t *remap,
+					  uint32_t *vertices, uint16_t *chunk,
+					  unsigned int *num_vertices)
+{
+	unsigned int count, fresh, used = 0, k;
+	uint32_t *v;
+
+	for (count = 0; start + count < num_indices; count += 3) {
+		for (k = 0, fresh = 0; k < 3; k++)
+			fresh += remap[indices[start + count + k]] == ~0u;
+
+		if (used + fresh > 65536)
+			break;
+
+		for (k = 0; k < 3; k++) {
+			v = &remap[indices[start + count + k]];
+
+			if (*v == ~0u) {
+				if (vertices)
+					vertices[used] =
+						indices[start + count + k];
+				*v = used++;
+			}
+
+			if (chunk)
+				chunk[count + k] = *v;
+		}
+	}
+
+	/* only the vertices of this chunk were remapped */
+	for (k = 0; k < count; k++)
+		remap[indices[start + k]] = ~0u;
+
+	*num_vertices = used;
+
+	return count;
+}
+
+/*
+ * Splits indexed triangles into chunks of at most 64K vertices and writes
+ * them as a mesh file, a vertex used by several chunks is stored in each.
+ */
+int grate_mesh_file_write(const char *path, unsigned int stride,
+			  const struct grate_mesh_attrib *attribs,
+			  unsigned int num_attribs, const void *vertices,
+			  unsigned int num_vertices, const uint32_t *indices,
+			  unsigned int num_indices)
+{
+	static const uint8_t pad[GRATE_MESH_FILE_ALIGN];
+	struct grate_mesh_file_chunk *table = NULL;
+	struct grate_mesh_file_header header;
+	struct grate_mesh_file_attrib attrib;
+	uint32_t *remap, *chunk_vertices;
+	unsigned int num_chunks = 0;
+	unsigned int i, k, count, used;
+	uint16_t *chunk_indices;
+	int err = -ENOMEM;
+	uint64_t offset;
+	FILE *fp;
+
+	if (!stride || !num_indices || num_attribs > 16 || num_indices % 3)
+		return -EINVAL;
+
+	for (i = 0; i < num_attribs; i++)
+		if (attribs[i].offset >= stride)
+			return -EINVAL;
+
+	for (i = 0; i < num_indices; i++)
+		if (indices[i] >= num_vertices)
+			return -EINVAL;
+
+	remap = malloc(num_vertices * sizeof(*remap));
+	chunk_vertices = malloc(65536 * sizeof(*chunk_vertices));
+	chunk_indices = malloc(num_indices * sizeof(*chunk_indices));
+	if (!remap || !chunk_vertices || !chunk_indices)
+		goto out_free;
+
+	memset(remap, 0xff, num_vertices * sizeof(*remap));
+
+	/* the table precedes the data, so the chunks are counted first */
+	for (i = 0; i < num_indices; num_chunks++)
+		i += grate_mesh_file_split(indices, num_indices, i, remap,
+					   NULL, NULL, &used);
+
+	table = calloc(num_chunks, sizeof(*table));
+	if (!table)
+		goto out_free;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		err = -errno;
+		goto out_free;
+	}
+
+	err = -EIO;
+
+	offset = sizeof(header) + num_attribs * sizeof(attrib) +
+		 num_chunks * sizeof(*table);
+	if (fseek(fp, offset, SEEK_SET) < 0)
+		goto out;
+
+	for (i = 0, k = 0; i < num_indices; k++) {
+		unsigned int n;
+
+		count = grate_mesh_file_split(indices, num_indices, i, remap,
+					      chunk_vertices, chunk_indices,
+					      &used);
+
+		table[k].num_vertices = used;
+		table[k].num_indices = count;
+		table[k].vertex_offset = offset;
+
+		for (n = 0; n < used; n++)
+			if (fwrite((const uint8_t *)vertices +
+				   (size_t)chunk_vertices[n] * stride,
+				   stride, 1, fp) != 1)
+				goto out;
+
+		offset += (uint64_t)used * stride;
+
+		/* keeps the indices of the file aligned as in the BO */
+		n = ALIGN(offset, GRATE_MESH_FILE_ALIGN) - offset;
+		if (n && fwrite(pad, 1, n, fp) != n)
+			goto out;
+
+		offset += n;
+		table[k].index_offset = offset;
+
+		if (fwrite(chunk_indices, 2, count, fp) != count)
+			goto out;
+
+		offset += count * 2;
+		i += count;
+	}
+
+	memcpy(header.magic, GRATE_MESH_FILE_MAGIC, 4);
+	header.version = GRATE_MESH_FILE_VERSION;
+	header.stride = stride;
+	header.num_attribs = num_attribs;
+	header.num_chunks = num_chunks;
+	header.reserved = 0;
+
+	rewind(fp);
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+		goto out;
+
+	for (i = 0; i < num_attribs; i++) {
+		attrib.size = attribs[i].size;
+		attrib.type = attribs[i].type;
+		attrib.offset = attribs[i].offset;
+
+		if (fwrite(&attrib, sizeof(attrib), 1, fp) != 1)
+			goto out;
+	}
+
+	if (fwrite(table, sizeof(*table), num_chunks, fp) != num_chunks)
+		goto out;
+
+	err = 0;
+out:
+	if (fclose(fp) && !err)
+		err = -EIO;
+out_free:
+	free(chunk_indices);
+	free(chunk_vertices);
+	free(remap);
+	free(table);
+
+	return err;
+}
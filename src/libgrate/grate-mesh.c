@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Index buffer optimisation for the post-transform vertex cache. Triangles
+ * are reordered with Tipsify (Sander, Nehab and Barczak, 2007): triangles
+ * are emitted as fans around a vertex, the next fan is the most recently
+ * used vertex that still has triangles left and, by estimate, is still
+ * cached once they are emitted. Vertices can then be renumbered in the order
+ * of their first use, so that the attribute fetches walk the vertex buffers
+ * sequentially. The cache is modelled as a FIFO, only triangle lists are
+ * handled.
+ */
+
+#define GRATE_MESH_CACHE_SIZE	16
+
+struct grate_mesh_adjacency {
+	unsigned int *offsets;
+	unsigned int *triangles;
+	unsigned int *live;
+};
+
+static unsigned int grate_mesh_num_vertices(const uint16_t *indices,
+					    unsigned int count)
+{
+	unsigned int i, num = 0;
+
+	for (i = 0; i < count; i++)
+		num = MAX(num, indices[i] + 1u);
+
+	return num;
+}
+
+float grate_mesh_acmr(const uint16_t *indices, unsigned int count,
+		      unsigned int cache_size)
+{
+	unsigned int num_vertices, misses = 0, i;
+	unsigned int *stamps;
+
+	if (count < 3)
+		return 0.0f;
+
+	if (!cache_size)
+		cache_size = GRATE_MESH_CACHE_SIZE;
+
+	num_vertices = grate_mesh_num_vertices(indices, count);
+
+	stamps = calloc(num_vertices, sizeof(*stamps));
+	if (!stamps)
+		return 0.0f;
+
+	/* stamps are 1-based, 0 means never cached */
+	for (i = 0; i < count; i++) {
+		unsigned int stamp = stamps[indices[i]];
+
+		if (stamp && misses + 1 - stamp <= cache_size)
+			continue;
+
+		stamps[indices[i]] = ++misses;
+	}
+
+	free(stamps);
+
+	return (float)misses / (count / 3);
+}
+
+static int grate_mesh_adjacency_init(struct grate_mesh_adjacency *adj,
+				     const uint16_t *indices,
+				     unsigned int count,
+				     unsigned int num_vertices)
+{
+	unsigned int i;
+
+	adj->offsets = calloc(num_vertices + 1, sizeof(*adj->offsets));
+	adj->triangles = malloc(count * sizeof(*adj->triangles));
+	adj->live = calloc(num_vertices, sizeof(*adj->live));
+
+	if (!adj->offsets || !adj->triangles || !adj->live) {
+		free(adj->offsets);
+		free(adj->triangles);
+		free(adj->live);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < count; i++)
+		adj->live[indices[i]]++;
+
+	for (i = 0; i < num_vertices; i++)
+		adj->offsets[i + 1] = adj->offsets[i] + adj->live[i];
+
+	/* offsets[v] is advanced while filling and moved back afterwards */
+	for (i = 0; i < count; i++)
+		adj->triangles[adj->offsets[indices[i]]++] = i / 3;
+
+	for (i = num_vertices; i > 0; i--)
+		adj->offsets[i] = adj->offsets[i - 1];
+
+	adj->offsets[0] = 0;
+
+	return 0;
+}
+
+static void grate_mesh_adjacency_fini(struct grate_mesh_adjacency *adj)
+{
+	free(adj->offsets);
+	free(adj->triangles);
+	free(adj->live);
+}
+
+int grate_mesh_optimize_indices(uint16_t *indices, unsigned int count,
+				unsigned int cache_size,
+				struct grate_mesh_stats *stats)
+{
+	unsigned int num_vertices, num_candidates, stack_size = 0;
+	unsigned int *candidates, *stack, *cache_time;
+	unsigned int time, cursor = 0, emitted = 0;
+	struct grate_mesh_adjacency adj;
+	uint16_t *output;
+	bool *done;
+	int fan = 0;
+	int err;
+
+	if (count % 3)
+		return -EINVAL;
+
+	if (!cache_size)
+		cache_size = GRATE_MESH_CACHE_SIZE;
+
+	if (stats)
+		stats->acmr_before = grate_mesh_acmr(indices, count, cache_size);
+
+	if (!count)
+		goto out;
+
+	num_vertices = grate_mesh_num_vertices(indices, count);
+
+	err = grate_mesh_adjacency_init(&adj, indices, count, num_vertices);
+	if (err < 0)
+		return err;
+
+	candidates = malloc(count * sizeof(*candidates));
+	stack = malloc(count * sizeof(*stack));
+	cache_time = calloc(num_vertices, sizeof(*cache_time));
+	output = malloc(count * sizeof(*output));
+	done = calloc(count / 3, sizeof(*done));
+
+	if (!candidates || !stack || !cache_time || !output || !done) {
+		err = -ENOMEM;
+		goto cleanup;
+	}
+
+	fan = indices[0];
+	time = cache_size + 1;
+
+	while (fan >= 0) {
+		unsigned int i, k, best_priority = 0;
+		int best = -1;
+
+		num_candidates = 0;
+
+		for (i = adj.offsets[fan]; i < adj.offsets[fan + 1]; i++) {
+			unsigned int triangle = adj.triangles[i];
+
+			if (done[triangle])
+				continue;
+
+			for (k = 0; k < 3; k++) {
+				unsigned int v = indices[triangle * 3 + k];
+
+				output[emitted++] = v;
+				stack[stack_size++] = v;
+				candidates[num_candidates++] = v;
+				adj.live[v]--;
+
+				if (time - cache_time[v] > cache_size)
+					cache_time[v] = time++;
+			}
+
+			done[triangle] = true;
+		}
+
+		/* prefer the candidate that will stay cached the longest */
+		for (i = 0; i < num_candidates; i++) {
+			unsigned int v = candidates[i], priority = 0;
+
+			if (!adj.live[v])
+				continue;
+
+			if (time - cache_time[v] + 2 * adj.live[v] <= cache_size)
+				priority = time - cache_time[v];
+
+			if (best < 0 || priority > best_priority) {
+				best_priority = priority;
+				best = v;
+			}
+		}
+
+		if (best >= 0) {
+			fan = best;
+			continue;
+		}
+
+		/* dead end, resume at a recently used vertex, then in order */
+		fan = -1;
+
+		while (stack_size) {
+			unsigned int v = stack[--stack_size];
+
+			if (adj.live[v]) {
+				fan = v;
+				break;
+			}
+		}
+
+		while (fan < 0 && cursor < num_vertices) {
+			if (adj.live[cursor])
+				fan = cursor;
+
+			cursor++;
+		}
+	}
+
+	memcpy(indices, output, count * sizeof(*output));
+	err = 0;
+
+cleanup:
+	grate_mesh_adjacency_fini(&adj);
+	free(candidates);
+	free(stack);
+	free(cache_time);
+	free(output);
+	free(done);
+
+	if (err < 0)
+		return err;
+
+out:
+	if (stats)
+		stats->acmr_after = grate_mesh_acmr(indices, count, cache_size);
+
+	return 0;
+}
+
+int grate_mesh_optimize_vertex_fetch(uint16_t *indices, unsigned int count,
+				     unsigned int num_vertices,
+				     uint16_t *remap)
+{
+	unsigned int next = 0, i;
+
+	if (num_vertices > 65536)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		if (indices[i] >= num_vertices)
+			return -EINVAL;
+	}
+
+	memset(remap, 0xff, num_vertices * sizeof(*remap));
+
+	for (i = 0; i < count; i++) {
+		if (remap[indices[i]] == 0xffff)
+			remap[indices[i]] = next++;
+
+		indices[i] = remap[indices[i]];
+	}
+
+	/* vertices that aren't referenced are moved to the end */
+	for (i = 0; i < num_vertices; i++) {
+		if (remap[i] == 0xffff)
+			remap[i] = next++;
+	}
+
+	return 0;
+}
+
+int grate_mesh_remap_vertices(void *vertices, unsigned int stride,
+			      unsigned int num_vertices,
+			      const uint16_t *remap)
+{
+	uint8_t *copy, *data = vertices;
+	unsigned int i;
+
+	copy = malloc(num_vertices * stride);
+	if (!copy)
+		return -ENOMEM;
+
+	memcpy(copy, data, num_vertices * stride);
+
+	for (i = 0; i < num_vertices; i++)
+		memcpy(data + remap[i] * stride, copy + i * stride, stride);
+
+	free(copy);
+
+	return 0;
+}
+
+/*
+ * Triangle of the given vertex continuing the oriented edge (u, v), it is
+ * marked with the stamp and its third vertex is returned.
+ */
+static int grate_mesh_strip_next(const struct grate_mesh_adjacency *adj,
+				 const uint16_t *indices, const bool *done,
+				 unsigned int *marks, unsigned int stamp,
+				 unsigned int u, unsigned int v,
+				 unsigned int *triangle)
+{
+	unsigned int i, k;
+
+	for (i = adj->offsets[v]; i < adj->offsets[v + 1]; i++) {
+		const uint16_t *t = &indices[adj->triangles[i] * 3];
+
+		if (done[adj->triangles[i]] ||
+		    marks[adj->triangles[i]] == stamp)
+			continue;
+
+		for (k = 0; k < 3; k++) {
+			if (t[k] == u && t[(k + 1) % 3] == v) {
+				*triangle = adj->triangles[i];
+				marks[*triangle] = stamp;
+				return t[(k + 2) % 3];
+			}
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Grow a strip from the triangle, starting at the given edge of it. The
+ * triangles of the strip are only marked as done if it is committed.
+ */
+static unsigned int
+grate_mesh_strip_grow(const struct grate_mesh_adjacency *adj,
+		      const uint16_t *indices, bool *done, unsigned int *marks,
+		      unsigned int stamp, unsigned int triangle,
+		      unsigned int rotation, bool commit, uint16_t *strip)
+{
+	unsigned int length = 3, k;
+	int next;
+
+	for (k = 0; k < 3; k++)
+		strip[k] = indices[triangle * 3 + (rotation + k) % 3];
+
+	marks[triangle] = stamp;
+	done[triangle] = commit;
+
+	while (true) {
+		/* every other triangle of a strip is wound the other way */
+		if (!(length % 2))
+			next = grate_mesh_strip_next(adj, indices, done, marks,
+						     stamp, strip[length - 2],
+						     strip[length - 1],
+						     &triangle);
+		else
+			next = grate_mesh_strip_next(adj, indices, done, marks,
+						     stamp, strip[length - 1],
+						     strip[length - 2],
+						     &triangle);
+
+		if (next < 0)
+			break;
+
+		done[triangle] = commit;
+		strip[length++] = next;
+	}
+
+	return length;
+}
+
+int grate_mesh_stripify(const uint16_t *indices, unsigned int count,
+			uint16_t *strip, unsigned int *strip_count)
+{
+	unsigned int num_vertices, stamp = 0, length, n = 0, i, k;
+	struct grate_mesh_adjacency adj;
+	unsigned int *marks;
+	uint16_t *current;
+	bool *done;
+	int err;
+
+	if (count % 3)
+		return -EINVAL;
+
+	*strip_count = 0;
+
+	if (!count)
+		return 0;
+
+	num_vertices = grate_mesh_num_vertices(indices, count);
+
+	err = grate_mesh_adjacency_init(&adj, indices, count, num_vertices);
+	if (err < 0)
+		return err;
+
+	marks = calloc(count / 3, sizeof(*marks));
+	current = malloc((count / 3 + 2) * sizeof(*current));
+	done = calloc(count / 3, sizeof(*done));
+
+	if (!marks || !current || !done) {
+		err = -ENOMEM;
+		goto cleanup;
+	}
+
+	/*
+	 * Strips are started in the order of the triangles, which keeps the
+	 * locality of a list optimised by grate_mesh_optimize_indices().
+	 */
+	for (i = 0; i < count / 3; i++) {
+		unsigned int best = 0, best_length = 0;
+
+		if (done[i])
+			continue;
+
+		for (k = 0; k < 3; k++) {
+			length = grate_mesh_strip_grow(&adj, indices, done,
+						       marks, ++stamp, i, k, false,
+						       current);
+			if (length > best_length) {
+				best_length = length;
+				best = k;
+			}
+		}
+
+		length = grate_mesh_strip_grow(&adj, indices, done, marks,
+					       ++stamp, i, best, true,
+					       current);
+
+		/*
+		 * Stitch to the previous strip with degenerate triangles, the
+		 * strip has to start at an even position to keep its winding.
+		 */
+		if (n) {
+			strip[n] = strip[n - 1];
+			n++;
+			strip[n++] = current[0];
+
+			if (n % 2)
+				strip[n++] = current[0];
+		}
+
+		memcpy(strip + n, current, length * sizeof(*current));
+		n += length;
+	}
+
+	*strip_count = n;
+	err = 0;
+
+cleanup:
+	grate_mesh_adjacency_fini(&adj);
+	free(marks);
+	free(current);
+	free(done);
+
+	return err;
+}
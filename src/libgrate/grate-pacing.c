@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Frame pacing. Instead of rendering right after the flip and showing a
+ * frame that has gone stale by the next vblank, the start of every frame
+ * is delayed until just enough time is left to render it before the
+ * vblank. The render time is predicted from the slowest of the recent
+ * frames plus a safety margin.
+ */
+
+#define GRATE_PACER_HISTORY	16
+
+struct grate_pacer {
+	struct grate *grate;
+	uint64_t margin;
+
+	uint64_t render_times[GRATE_PACER_HISTORY];
+	unsigned int num_render_times;
+	unsigned int next_render_time;
+
+	uint64_t frame_start;
+	uint64_t deadline;
+
+	unsigned int frames;
+	unsigned int missed;
+};
+
+static uint64_t grate_pacer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void grate_pacer_sleep_until(uint64_t time)
+{
+	struct timespec ts;
+
+	ts.tv_sec = time / 1000000;
+	ts.tv_nsec = (time % 1000000) * 1000;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+/* margin is the slack in microseconds kept in front of the vblank */
+struct grate_pacer *grate_pacer_create(struct grate *grate, unsigned margin)
+{
+	struct grate_pacer *pacer;
+
+	pacer = calloc(1, sizeof(*pacer));
+	if (!pacer)
+		return NULL;
+
+	pacer->grate = grate;
+	pacer->margin = margin;
+
+	return pacer;
+}
+
+void grate_pacer_free(struct grate_pacer *pacer)
+{
+	free(pacer);
+}
+
+static uint64_t grate_pacer_predict(struct grate_pacer *pacer)
+{
+	uint64_t max = 0;
+	unsigned int i;
+
+	for (i = 0; i < pacer->num_render_times; i++)
+		max = MAX(max, pacer->render_times[i]);
+
+	return max + pacer->margin;
+}
+
+/*
+ * Wait until it's time to start rendering the next frame. Returns
+ * immediately if the display doesn't report vblank timings.
+ */
+void grate_pacer_begin_frame(struct grate_pacer *pacer)
+{
+	struct grate *grate = pacer->grate;
+	uint64_t vblank, period, predict, now;
+	int err = -ENODEV;
+
+	if (grate->display && !grate->overlay)
+		err = grate_display_get_vblank(grate->display, &vblank,
+					       &period);
+
+	now = grate_pacer_now();
+
+	if (err < 0 || !period) {
+		pacer->frame_start = now;
+		pacer->deadline = 0;
+		return;
+	}
+
+	predict = grate_pacer_predict(pacer);
+
+	/* the first vblank that can be made when starting right now */
+	vblank += period;
+	if (vblank < now + predict)
+		vblank += (now + predict - vblank + period - 1) / period *
+			  period;
+
+	if (vblank - predict > now)
+		grate_pacer_sleep_until(vblank - predict);
+
+	pacer->frame_start = grate_pacer_now();
+	pacer->deadline = vblank;
+}
+
+/*
+ * Mark the end of the frame's rendering, to be called right before
+ * grate_swap_buffers(). Waits for the GPU to finish the frame.
+ */
+void grate_pacer_end_frame(struct grate_pacer *pacer)
+{
+	uint64_t now;
+
+	grate_3d_wait_idle(pacer->grate);
+
+	now = grate_pacer_now();
+
+	pacer->render_times[pacer->next_render_time] = now -
+						       pacer->frame_start;
+	pacer->next_render_time = (pacer->next_render_time + 1) %
+				  GRATE_PACER_HISTORY;
+	if (pacer->num_render_times < GRATE_PACER_HISTORY)
+		pacer->num_render_times++;
+
+	pacer->frames++;
+
+	if (pacer->deadline && now > pacer->deadline)
+		pacer->missed++;
+}
+
+void grate_pacer_get_stats(struct grate_pacer *pacer, unsigned int *frames,
+			   unsigned int *missed, unsigned int *render_time)
+{
+	if (frames)
+		*frames = pacer->frames;
+
+	if (missed)
+		*missed = pacer->missed;
+
+	if (render_time)
+		*render_time = grate_pacer_predict(pacer) - pacer->margin;
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libhost1x/host1x-private.h"
+#include "libgrate-private.h"
+#include "tgr_3d.xml.h"
+
+/*
+ * Particle systems drawn as point sprites. The particles of a frame are
+ * written straight into a streaming vertex buffer, one vertex each, and
+ * drawn as TGR3D_PRIMITIVE_TYPE_POINTS of the given size, the rasterizer
+ * spans the point coordinates over the whole texture of every sprite.
+ * That is a quarter of the vertices of expanded quads and a fifth of
+ * their data, without expanding anything on the CPU.
+ *
+ * The program takes "position" as vec3 in clip space and optionally
+ * "color" as normalized vec4, and samples texture 0 at the point
+ * coordinates.
+ */
+
+/* the index count of a draw is a 12-bit field */
+#define GRATE_PARTICLES_MAX_DRAW	4096
+#define GRATE_PARTICLES_CHUNK_SIZE	(256 * 1024)
+
+struct grate_particles {
+	struct grate *grate;
+	struct grate_3d_ctx ctx;
+	struct grate_stream *stream;
+
+	/* particles written since the last draw */
+	struct host1x_bo_view view;
+	unsigned int count;
+};
+
+struct grate_particles *grate_particles_create(struct grate *grate)
+{
+	struct grate_particles *particles;
+
+	particles = calloc(1, sizeof(*particles));
+	if (!particles)
+		return NULL;
+
+	particles->grate = grate;
+
+	particles->stream = grate_stream_create(grate,
+						GRATE_PARTICLES_CHUNK_SIZE, 2);
+	if (!particles->stream) {
+		free(particles);
+		return NULL;
+	}
+
+	return particles;
+}
+
+void grate_particles_free(struct grate_particles *particles)
+{
+	if (!particles)
+		return;
+
+	grate_stream_free(particles->stream);
+	grate_3d_ctx_release(&particles->ctx);
+	free(particles);
+}
+
+/*
+ * Returns the memory of count particles to be drawn by the next
+ * grate_particles_draw(), replacing the particles returned before.
+ */
+struct grate_particle *grate_particles_alloc(struct grate_particles *particles,
+					     unsigned int count)
+{
+	struct grate_particle *data;
+
+	count = MIN(count, GRATE_PARTICLES_CHUNK_SIZE / sizeof(*data));
+
+	data = grate_stream_alloc(particles->stream, count * sizeof(*data),
+				  &particles->view);
+	if (!data) {
+		particles->count = 0;
+		return NULL;
+	}
+
+	particles->count = count;
+
+	return data;
+}
+
+static void grate_particles_bind(struct grate_particles *particles,
+				 const char *name, unsigned size,
+				 unsigned type, unsigned long offset)
+{
+	struct grate_3d_ctx *ctx = &particles->ctx;
+	struct host1x_bo_view view = particles->view;
+	int location;
+
+	location = grate_get_attribute_location(ctx->program, name);
+	if (location < 0)
+		return;
+
+	view.offset += offset;
+	view.size -= offset;
+
+	grate_3d_ctx_vertex_attrib_pointer_view(ctx, location, size, type,
+						sizeof(struct grate_particle),
+						&view);
+	grate_3d_ctx_enable_vertex_attrib_array(ctx, location);
+}
+
+/*
+ * Draws the allocated particles with the state of the context, which is
+ * captured on every draw. The draws form a batch of their own, or are
+ * recorded into the active batch.
+ */
+int grate_particles_draw(struct grate_particles *particles,
+			 const struct grate_3d_ctx *ctx,
+			 struct grate_program *program,
+			 struct grate_texture *texture,
+			 float size, struct grate_fence *fence)
+{
+	struct grate *grate = particles->grate;
+	bool batched = grate->batch.active;
+	struct grate_3d_ctx *pctx = &particles->ctx;
+	const size_t stride = sizeof(struct grate_particle);
+	struct host1x_bo_view base = particles->view;
+	struct host1x_bo_view no_indices = { 0 };
+	struct grate_fence done;
+	unsigned int i, count;
+	int err = 0;
+
+	if (!program) {
+		grate_error("No program given\n");
+		return -EINVAL;
+	}
+
+	if (!particles->count)
+		return 0;
+
+	grate_stream_flush(particles->stream);
+
+	grate_3d_ctx_release(pctx);
+	grate_3d_ctx_copy(pctx, ctx);
+	grate_3d_ctx_invalidate(pctx);
+	grate_3d_ctx_bind_program(pctx, program);
+	grate_3d_ctx_bind_texture(pctx, 0, texture);
+	grate_3d_ctx_set_point_size(pctx, size);
+	grate_3d_ctx_set_point_coord_range(pctx, 0.0f, 1.0f, 0.0f, 1.0f);
+	grate_3d_ctx_set_cull_face(pctx, GRATE_3D_CTX_CULL_FACE_NONE);
+
+	for (i = 0; i < 16; i++)
+		grate_3d_ctx_disable_vertex_attrib_array(pctx, i);
+
+	if (!batched)
+		grate_3d_begin_batch(grate);
+
+	for (i = 0; i < particles->count; i += count) {
+		count = MIN(particles->count - i, GRATE_PARTICLES_MAX_DRAW);
+
+		particles->view.offset = base.offset + i * stride;
+		particles->view.size = count * stride;
+
+		grate_particles_bind(particles, "position", 3,
+				     TGR3D_ATTRIB_TYPE_FLOAT32,
+				     offsetof(struct grate_particle, position));
+		grate_particles_bind(particles, "color", 4,
+				     TGR3D_ATTRIB_TYPE_UBYTE_NORM,
+				     offsetof(struct grate_particle, color));
+
+		err = grate_3d_draw_elements_view_async(pctx,
+						TGR3D_PRIMITIVE_TYPE_POINTS,
+						&no_indices,
+						TGR3D_INDEX_MODE_NONE,
+						count, NULL);
+		if (err < 0)
+			break;
+	}
+
+	particles->count = 0;
+
+	/* the particles are released with the fence of the draws */
+	if (!batched) {
+		int ret = grate_3d_end_batch(grate, &done);
+
+		if (!err)
+			err = ret;
+	} else {
+		int ret = grate_3d_flush_batch(grate);
+
+		if (!err)
+			err = ret;
+
+		memset(&done, 0, sizeof(done));
+		done.client = host1x_get_gr3d(grate->host1x)->client;
+		done.value = grate->gr3d_fence;
+	}
+
+	if (done.client)
+		grate_stream_fence(particles->stream, &done);
+
+	if (fence && !err)
+		*fence = done;
+
+	return err;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Program binaries hold the serialised vertex, fragment and linker shaders,
+ * including their symbol tables. Loading one maps the file and decodes the
+ * shaders without compiling or assembling anything, the attribute and
+ * uniform tables and the default constants are then rebuilt from the
+ * symbols by grate_program_link().
+ */
+
+#define GRATE_PROGRAM_MAGIC	0x50475247 /* "GRGP" */
+#define GRATE_PROGRAM_VERSION	1
+
+struct grate_program_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_shaders;
+	uint32_t reserved;
+};
+
+int grate_program_save(struct grate_program *program, const char *path)
+{
+	struct grate_shader *shaders[] = {
+		program->vs, program->fs, program->linker,
+	};
+	struct grate_program_header header;
+	unsigned int i;
+	int err = 0;
+	FILE *fp;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = GRATE_PROGRAM_MAGIC;
+	header.version = GRATE_PROGRAM_VERSION;
+	header.num_shaders = ARRAY_SIZE(shaders);
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		grate_error("failed to create \"%s\": %d\n", path, -errno);
+		return -errno;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+		err = -EIO;
+
+	for (i = 0; !err && i < ARRAY_SIZE(shaders); i++)
+		err = grate_shader_write(fp, shaders[i]);
+
+	if (fclose(fp) && !err)
+		err = -EIO;
+
+	if (err) {
+		grate_error("failed to write \"%s\": %d\n", path, err);
+		unlink(path);
+	}
+
+	return err;
+}
+
+struct grate_program *grate_program_load(struct grate *grate,
+					 const char *path)
+{
+	struct grate_shader *shaders[3] = { NULL };
+	const struct grate_program_header *header;
+	struct grate_program *program = NULL;
+	size_t offset, consumed;
+	unsigned int i;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		grate_error("failed to open \"%s\": %d\n", path, -errno);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*header)) {
+		grate_error("invalid program binary \"%s\"\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		grate_error("failed to map \"%s\": %d\n", path, -errno);
+		return NULL;
+	}
+
+	header = map;
+	offset = sizeof(*header);
+
+	if (header->magic != GRATE_PROGRAM_MAGIC ||
+	    header->version != GRATE_PROGRAM_VERSION ||
+	    header->num_shaders != ARRAY_SIZE(shaders)) {
+		grate_error("invalid program binary \"%s\"\n", path);
+		goto out;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(shaders); i++) {
+		shaders[i] = grate_shader_read((const uint8_t *)map + offset,
+					       st.st_size - offset, &consumed);
+		if (!shaders[i]) {
+			grate_error("corrupted program binary \"%s\"\n", path);
+			goto out;
+		}
+
+		offset += consumed;
+	}
+
+	program = grate_program_new(grate, shaders[0], shaders[1], shaders[2]);
+	if (!program)
+		goto out;
+
+	program->owns_linker = true;
+	grate_program_link(program);
+
+out:
+	if (!program) {
+		for (i = 0; i < ARRAY_SIZE(shaders); i++)
+			grate_shader_free(shaders[i]);
+	}
+
+	munmap(map, st.st_size);
+
+	return program;
+}
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Serialised form of a shader: the command stream words, the metadata
+ * and the symbol table followed by the string table of symbol names. It
+ * is used by the on-disk shader cache and by the program binaries, the
+ * decoded shaders are built the same way as the assembled ones and are
+ * freed like them.
+ */
+
+struct grate_shader_blob {
+	uint32_t size;
+	uint32_t num_words;
+	/* the linker fields alias the first two of the fragment ones */
+	uint32_t alu_buf_size;
+	uint32_t pseq_inst_nb;
+	uint32_t pseq_to_dw_nb;
+	uint32_t discards_fragment;
+	uint32_t num_symbols;
+	uint32_t names_size;
+};
+
+struct grate_shader_blob_symbol {
+	int32_t location;
+	uint32_t kind;
+	uint32_t type;
+	uint32_t name;
+	uint8_t input;
+	uint8_t used;
+	uint16_t reserved;
+	uint32_t vector[4];
+};
+
+int grate_shader_write(FILE *fp, struct grate_shader *shader)
+{
+	struct grate_shader_blob_symbol symbol;
+	struct cgc_shader *cgc = shader->cgc;
+	struct grate_shader_blob blob;
+	uint32_t name = 0;
+	unsigned int i;
+
+	memset(&blob, 0, sizeof(blob));
+	blob.num_words = shader->num_words;
+	blob.alu_buf_size = shader->alu_buf_size;
+	blob.pseq_inst_nb = shader->pseq_inst_nb;
+	blob.pseq_to_dw_nb = shader->pseq_to_dw_nb;
+	blob.discards_fragment = shader->discards_fragment;
+	blob.num_symbols = cgc ? cgc->num_symbols : 0;
+
+	for (i = 0; i < blob.num_symbols; i++)
+		blob.names_size += strlen(cgc->symbols[i].name) + 1;
+
+	blob.size = sizeof(blob) + blob.num_words * 4 +
+		    blob.num_symbols * sizeof(symbol) + blob.names_size;
+
+	if (fwrite(&blob, sizeof(blob), 1, fp) != 1 ||
+	    fwrite(shader->words, 4, blob.num_words, fp) != blob.num_words)
+		return -EIO;
+
+	for (i = 0; i < blob.num_symbols; i++) {
+		const struct cgc_symbol *src = &cgc->symbols[i];
+
+		memset(&symbol, 0, sizeof(symbol));
+		symbol.location = src->location;
+		symbol.kind = src->kind;
+		symbol.type = src->type;
+		symbol.name = name;
+		symbol.input = src->input;
+		symbol.used = src->used;
+		memcpy(symbol.vector, src->vector, sizeof(symbol.vector));
+
+		if (fwrite(&symbol, sizeof(symbol), 1, fp) != 1)
+			return -EIO;
+
+		name += strlen(src->name) + 1;
+	}
+
+	/* string table, in the same order as the symbols */
+	for (i = 0; i < blob.num_symbols; i++) {
+		const char *name = cgc->symbols[i].name;
+
+		if (fwrite(name, strlen(name) + 1, 1, fp) != 1)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static struct grate_shader *
+grate_shader_decode(const struct grate_shader_blob *blob)
+{
+	const struct grate_shader_blob_symbol *symbols;
+	struct grate_shader *shader;
+	struct cgc_shader *cgc;
+	const uint32_t *words;
+	const char *names;
+	unsigned int i;
+
+	words = (const uint32_t *)(blob + 1);
+	symbols = (const void *)(words + blob->num_words);
+	names = (const char *)(symbols + blob->num_symbols);
+
+	shader = calloc(1, sizeof(*shader));
+	cgc = calloc(1, sizeof(*cgc));
+	if (!shader || !cgc)
+		goto err;
+
+	shader->cgc = cgc;
+
+	shader->words = malloc(blob->num_words * 4);
+	cgc->symbols = calloc(blob->num_symbols, sizeof(*cgc->symbols));
+	if (!shader->words || (blob->num_symbols && !cgc->symbols))
+		goto err;
+
+	memcpy(shader->words, words, blob->num_words * 4);
+	shader->num_words = blob->num_words;
+	shader->alu_buf_size = blob->alu_buf_size;
+	shader->pseq_inst_nb = blob->pseq_inst_nb;
+	shader->pseq_to_dw_nb = blob->pseq_to_dw_nb;
+	shader->discards_fragment = blob->discards_fragment;
+
+	for (i = 0; i < blob->num_symbols; i++) {
+		struct cgc_symbol *symbol = &cgc->symbols[i];
+
+		symbol->name = strdup(names + symbols[i].name);
+		if (!symbol->name)
+			goto err;
+
+		cgc->num_symbols++;
+
+		symbol->location = symbols[i].location;
+		symbol->kind = symbols[i].kind;
+		symbol->type = symbols[i].type;
+		symbol->input = symbols[i].input;
+		symbol->used = symbols[i].used;
+		memcpy(symbol->vector, symbols[i].vector,
+		       sizeof(symbol->vector));
+	}
+
+	return shader;
+
+err:
+	if (cgc) {
+		while (cgc->num_symbols--)
+			free(cgc->symbols[cgc->num_symbols].name);
+		free(cgc->symbols);
+	}
+
+	if (shader)
+		free(shader->words);
+
+	free(cgc);
+	free(shader);
+
+	return NULL;
+}
+
+/*
+ * Decode a shader from size bytes of data, the number of bytes it occupies
+ * is returned in consumed. Returns NULL if the data is truncated or
+ * malformed.
+ */
+struct grate_shader *grate_shader_read(const void *data, size_t size,
+				       size_t *consumed)
+{
+	const struct grate_shader_blob *blob = data;
+	const struct grate_shader_blob_symbol *symbols;
+	const char *names;
+	unsigned int i;
+
+	if (size < sizeof(*blob) || blob->size > size ||
+	    blob->size != sizeof(*blob) + (size_t)blob->num_words * 4 +
+			  (size_t)blob->num_symbols * sizeof(*symbols) +
+			  blob->names_size)
+		return NULL;
+
+	symbols = (const void *)((const uint32_t *)(blob + 1) +
+				 blob->num_words);
+	names = (const char *)(symbols + blob->num_symbols);
+
+	/* every name has to be terminated within the string table */
+	if (blob->num_symbols &&
+	    (!blob->names_size || names[blob->names_size - 1]))
+		return NULL;
+
+	for (i = 0; i < blob->num_symbols; i++)
+		if (symbols[i].name >= blob->names_size)
+			return NULL;
+
+	*consumed = blob->size;
+
+	return grate_shader_decode(blob);
+}
+
+/*
+ * On-disk cache of compiled shaders. Entries are named after a hash of the
+ * shader type and source, so a warm start neither compiles nor needs the
+ * proprietary compiler at all.
+ */
+
+#define GRATE_SHADER_CACHE_MAGIC	0x53475247 /* "GRGS" */
+#define GRATE_SHADER_CACHE_VERSION	2
+
+struct grate_shader_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+};
+
+static void grate_shader_cache_path(const char *dir, uint64_t key,
+				    char *path, size_t size)
+{
+	snprintf(path, size, "%s/%016llx.gsc", dir, (unsigned long long)key);
+}
+
+uint64_t grate_shader_cache_key(enum cgc_shader_type type, const char *code,
+				size_t length)
+{
+	uint32_t params[2] = { type, GRATE_SHADER_CACHE_VERSION };
+	uint64_t hash = GRATE_FNV1A_INIT;
+
+	hash = grate_fnv1a(hash, params, sizeof(params));
+
+	return grate_fnv1a(hash, code, length);
+}
+
+static void *grate_shader_cache_read(const char *path, size_t *size)
+{
+	void *data = NULL;
+	long length;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+
+	if (fseek(fp, 0, SEEK_END) < 0 || (length = ftell(fp)) < 0 ||
+	    fseek(fp, 0, SEEK_SET) < 0)
+		goto out;
+
+	data = malloc(length ? length : 1);
+	if (!data)
+		goto out;
+
+	if (fread(data, 1, length, fp) != (size_t)length) {
+		free(data);
+		data = NULL;
+		goto out;
+	}
+
+	*size = length;
+out:
+	fclose(fp);
+
+	return data;
+}
+
+struct grate_shader *grate_shader_cache_lookup(struct grate *grate,
+					       uint64_t key)
+{
+	const struct grate_shader_cache_header *header;
+	struct grate_shader *shader = NULL;
+	size_t size, consumed;
+	char path[PATH_MAX];
+	void *data;
+
+	grate_shader_cache_path(grate->shader_cache, key, path, sizeof(path));
+
+	data = grate_shader_cache_read(path, &size);
+	if (!data)
+		return NULL;
+
+	header = data;
+
+	if (size >= sizeof(*header) &&
+	    header->magic == GRATE_SHADER_CACHE_MAGIC &&
+	    header->version == GRATE_SHADER_CACHE_VERSION &&
+	    header->key == key)
+		shader = grate_shader_read(header + 1, size - sizeof(*header),
+					   &consumed);
+
+	if (!shader)
+		grate_error("stale shader cache entry \"%s\"\n", path);
+
+	free(data);
+
+	return shader;
+}
+
+/*
+ * Entries are written to a temporary file that is renamed into place, so
+ * concurrent loaders never see a partially written entry.
+ */
+static int grate_shader_cache_write(const char *dir, uint64_t key,
+				    struct grate_shader *shader)
+{
+	struct grate_shader_cache_header header;
+	char path[PATH_MAX], tmp[PATH_MAX + 16];
+	int err = 0;
+	FILE *fp;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = GRATE_SHADER_CACHE_MAGIC;
+	header.version = GRATE_SHADER_CACHE_VERSION;
+	header.key = key;
+
+	grate_shader_cache_path(dir, key, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+	fp = fopen(tmp, "wb");
+	if (!fp) {
+		grate_error("failed to create \"%s\": %d\n", tmp, -errno);
+		return -errno;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+		err = -EIO;
+
+	if (!err)
+		err = grate_shader_write(fp, shader);
+
+	if (fclose(fp) && !err)
+		err = -EIO;
+
+	if (!err && rename(tmp, path) < 0)
+		err = -errno;
+
+	if (err) {
+		grate_error("failed to write \"%s\": %d\n", path, err);
+		unlink(tmp);
+	}
+
+	return err;
+}
+
+int grate_shader_cache_store(struct grate *grate, uint64_t key,
+			     struct grate_shader *shader)
+{
+	return grate_shader_cache_write(grate->shader_cache, key, shader);
+}
+
+/*
+ * Compiles a shader ahead of time into the cache directory, under the key
+ * grate_shader_new() looks it up by when given the same source. Entries
+ * that exist already are left as they are.
+ */
+int grate_shader_cache_compile(const char *dir, enum grate_shader_type type,
+			       const char *code)
+{
+	enum cgc_shader_type shader_type;
+	struct grate_shader *shader;
+	struct cgc_shader *cgc;
+	char path[PATH_MAX];
+	size_t length;
+	uint64_t key;
+	int err;
+
+	switch (type) {
+	case GRATE_SHADER_VERTEX:
+		shader_type = CGC_SHADER_VERTEX;
+		break;
+
+	case GRATE_SHADER_FRAGMENT:
+		shader_type = CGC_SHADER_FRAGMENT;
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	length = strlen(code);
+	key = grate_shader_cache_key(shader_type, code, length);
+
+	grate_shader_cache_path(dir, key, path, sizeof(path));
+	if (!access(path, R_OK))
+		return 0;
+
+	cgc = cgc_compile(shader_type, code, length);
+	if (!cgc)
+		return -EINVAL;
+
+	shader = grate_shader_from_cgc(cgc);
+	if (!shader)
+		return -ENOMEM;
+
+	err = grate_shader_cache_write(dir, key, shader);
+	grate_shader_free(shader);
+
+	return err;
+}
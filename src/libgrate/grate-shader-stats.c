@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm.h"
+#include "grate.h"
+#include "host1x.h"
+#include "libgrate-private.h"
+
+/*
+ * Static analysis of programs for shader authors. The model is deliberately
+ * simple: control flow is ignored and the program is treated as straight
+ * line code, latencies of the units are unknown and not accounted for.
+ */
+
+#define VPE_REG_TEMPORARY	1
+#define VPE_REG_NONE		63
+
+static unsigned vpe_operand_mask(unsigned x, unsigned y, unsigned z,
+				 unsigned w)
+{
+	return BIT(x) | BIT(y) | BIT(z) | BIT(w);
+}
+
+/* temporary components read by the instruction, indexed by register */
+static void vpe_stats_reads(const vpe_instr128 *ins, uint8_t reads[64])
+{
+	bool vector = ins->vector_opcode != VECTOR_OPCODE_NOP;
+	bool scalar = ins->scalar_opcode != SCALAR_OPCODE_NOP;
+
+	memset(reads, 0, 64);
+
+	if (vector && ins->rA_type == VPE_REG_TEMPORARY)
+		reads[ins->rA_index] |= vpe_operand_mask(ins->rA_swizzle_x,
+							 ins->rA_swizzle_y,
+							 ins->rA_swizzle_z,
+							 ins->rA_swizzle_w);
+
+	if (vector && ins->rB_type == VPE_REG_TEMPORARY)
+		reads[ins->rB_index] |= vpe_operand_mask(ins->rB_swizzle_x,
+							 ins->rB_swizzle_y,
+							 ins->rB_swizzle_z,
+							 ins->rB_swizzle_w);
+
+	if ((vector || scalar) && ins->rC_type == VPE_REG_TEMPORARY)
+		reads[ins->rC_index] |= vpe_operand_mask(ins->rC_swizzle_x,
+							 ins->rC_swizzle_y,
+							 ins->rC_swizzle_z,
+							 ins->rC_swizzle_w);
+}
+
+static void vpe_stats_writes(const vpe_instr128 *ins, uint8_t writes[64])
+{
+	memset(writes, 0, 64);
+
+	if (ins->vector_opcode != VECTOR_OPCODE_NOP &&
+	    ins->vector_rD_index != VPE_REG_NONE)
+		writes[ins->vector_rD_index] |=
+			ins->vector_op_write_x_enable << 0 |
+			ins->vector_op_write_y_enable << 1 |
+			ins->vector_op_write_z_enable << 2 |
+			ins->vector_op_write_w_enable << 3;
+
+	if (ins->scalar_opcode != SCALAR_OPCODE_NOP &&
+	    ins->scalar_rD_index != VPE_REG_NONE)
+		writes[ins->scalar_rD_index] |=
+			ins->scalar_op_write_x_enable << 0 |
+			ins->scalar_op_write_y_enable << 1 |
+			ins->scalar_op_write_z_enable << 2 |
+			ins->scalar_op_write_w_enable << 3;
+}
+
+static void vpe_stats(struct grate_shader *vs,
+		      struct grate_program_stats *stats)
+{
+	uint8_t reads[64], writes[64], live[64] = { 0 };
+	unsigned depth[64][4] = { { 0 } };
+	unsigned i, count, reg, c, n, d;
+	vpe_instr128 *prog;
+
+	if (vs->num_words < 6 || (vs->num_words - 2) % 4 ||
+	    vs->words[0] != HOST1X_OPCODE_IMM(0x205, 0x00) ||
+	    vs->words[1] != HOST1X_OPCODE_NONINCR(0x206, vs->num_words - 2))
+		return;
+
+	count = (vs->num_words - 2) / 4;
+
+	prog = calloc(count, sizeof(*prog));
+	if (!prog)
+		return;
+
+	for (i = 0; i < count; i++) {
+		prog[i].part3 = vs->words[2 + i * 4];
+		prog[i].part2 = vs->words[3 + i * 4];
+		prog[i].part1 = vs->words[4 + i * 4];
+		prog[i].part0 = vs->words[5 + i * 4];
+	}
+
+	stats->vs_instructions = count;
+	stats->vs_cycles = count;
+
+	for (i = 0; i < count; i++) {
+		const vpe_instr128 *ins = &prog[i];
+
+		if (ins->vector_opcode != VECTOR_OPCODE_NOP)
+			stats->vs_vector_ops++;
+
+		if (ins->scalar_opcode != SCALAR_OPCODE_NOP)
+			stats->vs_scalar_ops++;
+
+		if (ins->vector_opcode == VECTOR_OPCODE_TXL)
+			stats->vs_texture_fetches++;
+
+		/* longest chain of dependent instructions */
+		vpe_stats_reads(ins, reads);
+		vpe_stats_writes(ins, writes);
+
+		for (reg = 0, d = 0; reg < 64; reg++)
+			for (c = 0; c < 4; c++)
+				if (reads[reg] & BIT(c))
+					d = MAX(d, depth[reg][c]);
+
+		d++;
+
+		for (reg = 0; reg < 64; reg++)
+			for (c = 0; c < 4; c++)
+				if (writes[reg] & BIT(c))
+					depth[reg][c] = d;
+
+		stats->vs_critical_path = MAX(stats->vs_critical_path, d);
+	}
+
+	/* registers holding a value that is read later on */
+	for (i = count; i--; ) {
+		vpe_stats_reads(&prog[i], reads);
+		vpe_stats_writes(&prog[i], writes);
+
+		for (reg = 0, n = 0; reg < 64; reg++) {
+			live[reg] &= ~writes[reg];
+			live[reg] |= reads[reg];
+
+			if (live[reg])
+				n++;
+		}
+
+		stats->vs_max_live_temporaries =
+			MAX(stats->vs_max_live_temporaries, n);
+	}
+
+	free(prog);
+}
+
+static void fp_stats_mark(uint8_t regs[128], unsigned reg)
+{
+	if (reg < 128)
+		regs[reg] = 1;
+}
+
+/* registers read and written by the stages of a batch */
+static void fp_stats_batch(const struct fp_batch *batch, uint8_t reads[128],
+			   uint8_t writes[128], unsigned *alu_ops)
+{
+	unsigned i, k;
+
+	memset(reads, 0, 128);
+	memset(writes, 0, 128);
+
+	for (i = 0; i < batch->mfu_nb; i++) {
+		const mfu_instr *mfu = &batch->mfu[i];
+
+		if (mfu->var0_opcode != MFU_VAR_NOP)
+			fp_stats_mark(writes, FRAGMENT_ROW_REG(0));
+		if (mfu->var1_opcode != MFU_VAR_NOP)
+			fp_stats_mark(writes, FRAGMENT_ROW_REG(1));
+		if (mfu->var2_opcode != MFU_VAR_NOP)
+			fp_stats_mark(writes, FRAGMENT_ROW_REG(2));
+		if (mfu->var3_opcode != MFU_VAR_NOP)
+			fp_stats_mark(writes, FRAGMENT_ROW_REG(3));
+
+		if (mfu->opcode != MFU_NOP)
+			fp_stats_mark(reads, mfu->reg);
+
+		if (mfu->mul0_dst >= MFU_MUL_DST_ROW_REG_0)
+			fp_stats_mark(writes, FRAGMENT_ROW_REG(mfu->mul0_dst -
+						MFU_MUL_DST_ROW_REG_0));
+		if (mfu->mul1_dst >= MFU_MUL_DST_ROW_REG_0)
+			fp_stats_mark(writes, FRAGMENT_ROW_REG(mfu->mul1_dst -
+						MFU_MUL_DST_ROW_REG_0));
+	}
+
+	if (batch->tex.enable) {
+		unsigned src = batch->tex.src_regs_select ? 2 : 0;
+		unsigned dst = batch->tex.sample_dst_regs_select ? 2 : 0;
+
+		for (k = 0; k < 3; k++)
+			fp_stats_mark(reads, FRAGMENT_ROW_REG((src + k) % 4));
+
+		if (batch->tex.enable_bias)
+			fp_stats_mark(reads, FRAGMENT_ROW_REG((src + 3) % 4));
+
+		fp_stats_mark(writes, FRAGMENT_ROW_REG(dst));
+		fp_stats_mark(writes, FRAGMENT_ROW_REG(dst + 1));
+	}
+
+	for (i = 0; i < batch->alu_nb; i++) {
+		for (k = 0; k < 4; k++) {
+			const union fragment_alu_instruction *slot;
+
+			slot = &batch->alu[i].a[k];
+
+			if (fp_alu_slot_nop(slot))
+				continue;
+
+			fp_stats_mark(reads, slot->rA_reg_select);
+			fp_stats_mark(reads, slot->rB_reg_select);
+			fp_stats_mark(reads, slot->rC_reg_select);
+			fp_stats_mark(writes, slot->dst_reg);
+			(*alu_ops)++;
+		}
+	}
+
+	if (batch->dw.enable) {
+		unsigned src = batch->dw.src_regs_select ? 2 : 0;
+
+		fp_stats_mark(reads, FRAGMENT_ROW_REG(src));
+		fp_stats_mark(reads, FRAGMENT_ROW_REG(src + 1));
+	}
+}
+
+static void fp_stats(struct grate_shader *fs,
+		     struct grate_program_stats *stats)
+{
+	uint8_t reads[128], writes[128], used[128] = { 0 };
+	unsigned depth[128] = { 0 };
+	struct fp_program *prog;
+	unsigned i, reg, d;
+
+	prog = calloc(1, sizeof(*prog));
+	if (!prog)
+		return;
+
+	if (fp_program_decode(fs, prog) < 0) {
+		free(prog);
+		return;
+	}
+
+	stats->fs_instructions = prog->batches_nb;
+
+	for (i = 0; i < prog->batches_nb; i++) {
+		const struct fp_batch *batch = &prog->batches[i];
+
+		stats->fs_mfu_instructions += batch->mfu_nb;
+		stats->fs_alu_instructions += batch->alu_nb;
+
+		if (batch->tex.enable)
+			stats->fs_texture_fetches++;
+
+		/* the busiest stage bounds the throughput of the batch */
+		stats->fs_cycles += MAX(1, MAX(batch->mfu_nb, batch->alu_nb));
+
+		fp_stats_batch(batch, reads, writes, &stats->fs_alu_ops);
+
+		for (reg = 0, d = 0; reg < 128; reg++)
+			if (reads[reg])
+				d = MAX(d, depth[reg]);
+
+		d++;
+
+		for (reg = 0; reg < 128; reg++) {
+			if (writes[reg])
+				depth[reg] = d;
+
+			used[reg] |= reads[reg] | writes[reg];
+		}
+
+		stats->fs_critical_path = MAX(stats->fs_critical_path, d);
+	}
+
+	/* row and global registers, the rest isn't allocated per fragment */
+	for (reg = FRAGMENT_ROW_REG_0; reg <= FRAGMENT_GENERAL_PURPOSE_REG_7;
+	     reg++)
+		if (used[reg])
+			stats->fs_registers++;
+
+	free(prog);
+}
+
+void grate_program_get_stats(struct grate_program *program,
+			     struct grate_program_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	vpe_stats(program->vs, stats);
+	fp_stats(program->fs, stats);
+
+	stats->linker_instructions = program->linker->linker_inst_nb;
+	stats->tram_rows = program->linker->used_tram_rows_nb;
+}
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libhost1x/host1x-private.h"
+#include "libgrate-private.h"
+#include "tgr_3d.xml.h"
+
+/*
+ * Sprite batch. Sprites are recorded together with the program and the
+ * texture they are drawn with, on flush their quads are written into a
+ * streaming vertex buffer and every run of consecutive sprites sharing
+ * the program and the texture is drawn with a single indexed draw of the
+ * pre-built quad indices. The sprites are drawn in the order they were
+ * added, blending is up to the program.
+ *
+ * The program takes "position" and "texcoord" as vec2 and optionally
+ * "color" as normalized vec4. Positions are given in pixels of the render
+ * target, with the origin in the top-left corner.
+ */
+
+/* indices are 16-bit, 4 vertices per quad */
+#define GRATE_SPRITE_MAX_RUN	(0x10000 / 4)
+#define GRATE_SPRITE_CHUNK_SIZE	(256 * 1024)
+
+struct grate_sprite_vertex {
+	float position[2];
+	float texcoord[2];
+	uint8_t color[4];
+};
+
+struct grate_sprite_entry {
+	struct grate_program *program;
+	struct grate_texture *texture;
+	struct grate_sprite sprite;
+};
+
+struct grate_sprite_batch {
+	struct grate *grate;
+	struct grate_3d_ctx ctx;
+	struct grate_stream *stream;
+	struct host1x_bo *indices_bo;
+
+	struct grate_sprite_entry *entries;
+	unsigned int num_entries;
+	unsigned int max_entries;
+};
+
+struct grate_sprite_batch *grate_sprite_batch_create(struct grate *grate)
+{
+	struct grate_sprite_batch *batch;
+	uint16_t *indices;
+	unsigned int i;
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+
+	batch->grate = grate;
+
+	batch->stream = grate_stream_create(grate, GRATE_SPRITE_CHUNK_SIZE, 2);
+	if (!batch->stream)
+		goto err_free;
+
+	batch->indices_bo = grate_bo_create_and_map(grate,
+						NVHOST_BO_FLAG_ATTRIBUTES |
+						HOST1X_BO_MAP_WRITE_COMBINE,
+						GRATE_SPRITE_MAX_RUN * 12,
+						(void **)&indices);
+	if (!batch->indices_bo)
+		goto err_free;
+
+	/* two triangles per quad */
+	for (i = 0; i < GRATE_SPRITE_MAX_RUN; i++) {
+		indices[i * 6 + 0] = i * 4 + 0;
+		indices[i * 6 + 1] = i * 4 + 1;
+		indices[i * 6 + 2] = i * 4 + 2;
+		indices[i * 6 + 3] = i * 4 + 0;
+		indices[i * 6 + 4] = i * 4 + 2;
+		indices[i * 6 + 5] = i * 4 + 3;
+	}
+
+	HOST1X_BO_FLUSH(batch->indices_bo, batch->indices_bo->offset,
+			GRATE_SPRITE_MAX_RUN * 12);
+
+	return batch;
+
+err_free:
+	grate_sprite_batch_free(batch);
+
+	return NULL;
+}
+
+void grate_sprite_batch_free(struct grate_sprite_batch *batch)
+{
+	if (!batch)
+		return;
+
+	/* the stream waits for its chunks, the indices may be in use too */
+	grate_stream_free(batch->stream);
+
+	if (batch->indices_bo) {
+		grate_3d_wait_idle(batch->grate);
+		host1x_bo_free(batch->indices_bo);
+	}
+
+	grate_3d_ctx_release(&batch->ctx);
+	free(batch->entries);
+	free(batch);
+}
+
+int grate_sprite_batch_add(struct grate_sprite_batch *batch,
+			   struct grate_program *program,
+			   struct grate_texture *texture,
+			   const struct grate_sprite *sprite)
+{
+	struct grate_sprite_entry *entry;
+	unsigned int max;
+
+	if (!program) {
+		grate_error("No program given\n");
+		return -EINVAL;
+	}
+
+	if (batch->num_entries == batch->max_entries) {
+		max = batch->max_entries * 2 ?: 64;
+
+		entry = realloc(batch->entries, max * sizeof(*entry));
+		if (!entry)
+			return -ENOMEM;
+
+		batch->entries = entry;
+		batch->max_entries = max;
+	}
+
+	entry = &batch->entries[batch->num_entries++];
+	entry->program = program;
+	entry->texture = texture;
+	entry->sprite = *sprite;
+
+	return 0;
+}
+
+static uint8_t grate_sprite_unorm8(float value)
+{
+	if (!(value > 0.0f))
+		return 0;
+
+	if (value >= 1.0f)
+		return 255;
+
+	return value * 255.0f + 0.5f;
+}
+
+static void grate_sprite_write(struct grate_sprite_vertex *v,
+			       const struct grate_sprite *sprite,
+			       float sx, float sy)
+{
+	float x0 = sprite->x * sx - 1.0f;
+	float y0 = 1.0f - sprite->y * sy;
+	float x1 = (sprite->x + sprite->width) * sx - 1.0f;
+	float y1 = 1.0f - (sprite->y + sprite->height) * sy;
+	uint8_t color[4];
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		color[i] = grate_sprite_unorm8(sprite->color[i]);
+
+	/* top-left, bottom-left, bottom-right, top-right */
+	v[0].position[0] = x0;
+	v[0].position[1] = y0;
+	v[0].texcoord[0] = sprite->u0;
+	v[0].texcoord[1] = sprite->v0;
+
+	v[1].position[0] = x0;
+	v[1].position[1] = y1;
+	v[1].texcoord[0] = sprite->u0;
+	v[1].texcoord[1] = sprite->v1;
+
+	v[2].position[0] = x1;
+	v[2].position[1] = y1;
+	v[2].texcoord[0] = sprite->u1;
+	v[2].texcoord[1] = sprite->v1;
+
+	v[3].position[0] = x1;
+	v[3].position[1] = y0;
+	v[3].texcoord[0] = sprite->u1;
+	v[3].texcoord[1] = sprite->v0;
+
+	for (i = 0; i < 4; i++)
+		memcpy(v[i].color, color, sizeof(color));
+}
+
+static void grate_sprite_bind(struct grate_3d_ctx *ctx,
+			      struct grate_program *program,
+			      const char *name, unsigned size, unsigned type,
+			      const struct host1x_bo_view *view)
+{
+	const unsigned stride = sizeof(struct grate_sprite_vertex);
+	int location = grate_get_attribute_location(program, name);
+
+	if (location < 0)
+		return;
+
+	grate_3d_ctx_vertex_attrib_pointer_view(ctx, location, size, type,
+						stride, view);
+	grate_3d_ctx_enable_vertex_attrib_array(ctx, location);
+}
+
+static int grate_sprite_batch_draw(struct grate_sprite_batch *batch,
+				   const struct grate_sprite_entry *run,
+				   unsigned int count, float sx, float sy)
+{
+	struct grate_3d_ctx *ctx = &batch->ctx;
+	struct host1x_bo_view vertices, view, indices;
+	struct grate_sprite_vertex *v;
+	unsigned int i;
+
+	v = grate_stream_alloc(batch->stream, count * 4 * sizeof(*v),
+			       &vertices);
+	if (!v)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++)
+		grate_sprite_write(v + i * 4, &run[i].sprite, sx, sy);
+
+	grate_stream_flush(batch->stream);
+
+	for (i = 0; i < 16; i++)
+		grate_3d_ctx_disable_vertex_attrib_array(ctx, i);
+
+	grate_3d_ctx_bind_program(ctx, run->program);
+	grate_3d_ctx_bind_texture(ctx, 0, run->texture);
+
+	view = vertices;
+	grate_sprite_bind(ctx, run->program, "position", 2,
+			  TGR3D_ATTRIB_TYPE_FLOAT32, &view);
+
+	view.offset = vertices.offset + 8;
+	view.size = vertices.size - 8;
+	grate_sprite_bind(ctx, run->program, "texcoord", 2,
+			  TGR3D_ATTRIB_TYPE_FLOAT32, &view);
+
+	view.offset = vertices.offset + 16;
+	view.size = vertices.size - 16;
+	grate_sprite_bind(ctx, run->program, "color", 4,
+			  TGR3D_ATTRIB_TYPE_UBYTE_NORM, &view);
+
+	host1x_bo_view_init(&indices, batch->indices_bo, 0, count * 12);
+
+	return grate_3d_draw_elements_view_async(ctx,
+						 TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+						 &indices,
+						 TGR3D_INDEX_MODE_UINT16,
+						 count * 6, NULL);
+}
+
+/*
+ * Draws the sprites added since the last flush into the given render
+ * target, using the viewport and scissor of the context. The draws form
+ * a batch of their own, or are recorded into the active batch.
+ */
+int grate_sprite_batch_flush(struct grate_sprite_batch *batch,
+			     const struct grate_3d_ctx *ctx,
+			     unsigned render_target,
+			     struct grate_fence *fence)
+{
+	const size_t quad_size = 4 * sizeof(struct grate_sprite_vertex);
+	unsigned int max_run = MIN(GRATE_SPRITE_MAX_RUN,
+				   GRATE_SPRITE_CHUNK_SIZE / quad_size);
+	struct grate *grate = batch->grate;
+	bool batched = grate->batch.active;
+	struct host1x_pixelbuffer *pixbuf;
+	struct grate_fence done;
+	unsigned int i, count;
+	float sx, sy;
+	int err = 0;
+
+	if (render_target > 15 || !ctx->render_targets[render_target].pixbuf) {
+		grate_error("Invalid render target %u\n", render_target);
+		batch->num_entries = 0;
+		return -EINVAL;
+	}
+
+	if (!batch->num_entries)
+		return 0;
+
+	pixbuf = ctx->render_targets[render_target].pixbuf;
+	sx = 2.0f / pixbuf->width;
+	sy = 2.0f / pixbuf->height;
+
+	grate_3d_ctx_release(&batch->ctx);
+	grate_3d_ctx_copy(&batch->ctx, ctx);
+	grate_3d_ctx_invalidate(&batch->ctx);
+	grate_3d_ctx_perform_depth_test(&batch->ctx, false);
+	grate_3d_ctx_perform_depth_write(&batch->ctx, false);
+	grate_3d_ctx_perform_stencil_test(&batch->ctx, false);
+	grate_3d_ctx_set_cull_face(&batch->ctx, GRATE_3D_CTX_CULL_FACE_NONE);
+
+	for (i = 0; i < 16; i++) {
+		grate_3d_ctx_disable_render_target(&batch->ctx, i);
+		grate_3d_ctx_bind_texture(&batch->ctx, i, NULL);
+	}
+
+	grate_3d_ctx_enable_render_target(&batch->ctx, render_target);
+
+	if (!batched)
+		grate_3d_begin_batch(grate);
+
+	for (i = 0; i < batch->num_entries; i += count) {
+		const struct grate_sprite_entry *run = &batch->entries[i];
+
+		for (count = 1; i + count < batch->num_entries &&
+				count < max_run; count++) {
+			if (run[count].program != run->program ||
+			    run[count].texture != run->texture)
+				break;
+		}
+
+		err = grate_sprite_batch_draw(batch, run, count, sx, sy);
+		if (err < 0)
+			break;
+	}
+
+	batch->num_entries = 0;
+
+	/* the vertices are released with the fence of the draws */
+	if (!batched) {
+		int ret = grate_3d_end_batch(grate, &done);
+
+		if (!err)
+			err = ret;
+	} else {
+		int ret = grate_3d_flush_batch(grate);
+
+		if (!err)
+			err = ret;
+
+		memset(&done, 0, sizeof(done));
+		done.client = host1x_get_gr3d(grate->host1x)->client;
+		done.value = grate->gr3d_fence;
+	}
+
+	if (done.client)
+		grate_stream_fence(batch->stream, &done);
+
+	if (fence && !err)
+		*fence = done;
+
+	return err;
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libhost1x/host1x-private.h"
+#include "libgrate-private.h"
+
+#include "grate.h"
+#include "host1x.h"
+
+/*
+ * Streaming buffer for data that is rebuilt for every frame, like dynamic
+ * geometry or indices. The buffer consists of persistently mapped chunks,
+ * allocations are carved out of the current chunk linearly and all the
+ * allocations of a chunk are released at once when the fence recorded
+ * for the chunk is reached. If no chunk is free, a new one is created
+ * instead of waiting ("orphaning"), hence after warming up the stream
+ * neither allocates nor waits.
+ */
+#define GRATE_STREAM_ALIGN	16
+
+struct grate_stream_chunk {
+	struct list_head list;
+	struct host1x_bo *bo;
+	void *map;
+	size_t used;
+	size_t flushed;
+	struct host1x_client *client;
+	uint32_t fence;
+	/* has allocations that weren't fenced yet */
+	bool pending;
+};
+
+struct grate_stream {
+	struct grate *grate;
+	struct list_head chunks;
+	struct grate_stream_chunk *current;
+	unsigned long flags;
+	size_t chunk_size;
+};
+
+static struct grate_stream_chunk *
+grate_stream_chunk_create(struct grate_stream *stream)
+{
+	struct grate_stream_chunk *chunk;
+
+	chunk = calloc(1, sizeof(*chunk));
+	if (!chunk)
+		return NULL;
+
+	chunk->bo = grate_bo_create_and_map(stream->grate, stream->flags,
+					    stream->chunk_size, &chunk->map);
+	if (!chunk->bo) {
+		free(chunk);
+		return NULL;
+	}
+
+	list_add_tail(&chunk->list, &stream->chunks);
+
+	return chunk;
+}
+
+static void grate_stream_chunk_free(struct grate_stream_chunk *chunk)
+{
+	list_del(&chunk->list);
+	host1x_bo_free(chunk->bo);
+	free(chunk);
+}
+
+static bool grate_stream_chunk_idle(struct grate_stream_chunk *chunk)
+{
+	if (chunk->pending)
+		return false;
+
+	if (!chunk->client)
+		return true;
+
+	return host1x_client_poll(chunk->client, chunk->fence) == 1;
+}
+
+struct grate_stream *grate_stream_create(struct grate *grate,
+					 size_t chunk_size,
+					 unsigned int num_chunks)
+{
+	struct grate_stream_chunk *chunk;
+	struct grate_stream *stream;
+	unsigned int i;
+
+	stream = calloc(1, sizeof(*stream));
+	if (!stream)
+		return NULL;
+
+	INIT_LIST_HEAD(&stream->chunks);
+	stream->grate = grate;
+	stream->flags = NVHOST_BO_FLAG_ATTRIBUTES | HOST1X_BO_MAP_WRITE_COMBINE;
+	stream->chunk_size = ALIGN(chunk_size, GRATE_STREAM_ALIGN);
+
+	for (i = 0; i < MAX(num_chunks, 1u); i++) {
+		chunk = grate_stream_chunk_create(stream);
+		if (!chunk) {
+			grate_stream_free(stream);
+			return NULL;
+		}
+
+		if (!stream->current)
+			stream->current = chunk;
+	}
+
+	return stream;
+}
+
+void grate_stream_free(struct grate_stream *stream)
+{
+	struct grate_stream_chunk *chunk, *tmp;
+
+	if (!stream)
+		return;
+
+	list_for_each_entry_safe(chunk, tmp, &stream->chunks, list) {
+		if (chunk->client)
+			host1x_client_wait(chunk->client, chunk->fence, ~0u);
+
+		grate_stream_chunk_free(chunk);
+	}
+
+	free(stream);
+}
+
+static struct grate_stream_chunk *grate_stream_next(struct grate_stream *stream)
+{
+	struct grate_stream_chunk *chunk;
+
+	grate_stream_flush(stream);
+
+	list_for_each_entry(chunk, &stream->chunks, list) {
+		if (chunk == stream->current)
+			continue;
+
+		if (grate_stream_chunk_idle(chunk)) {
+			chunk->used = 0;
+			chunk->flushed = 0;
+			chunk->client = NULL;
+			return chunk;
+		}
+	}
+
+	return grate_stream_chunk_create(stream);
+}
+
+/*
+ * Returns CPU pointer to "size" bytes of the stream and the view of the
+ * same memory for the GPU. Data written via the pointer must be flushed
+ * with grate_stream_flush() before it is used by the GPU.
+ */
+void *grate_stream_alloc(struct grate_stream *stream, size_t size,
+			 struct host1x_bo_view *view)
+{
+	struct grate_stream_chunk *chunk = stream->current;
+	size_t offset;
+
+	if (size > stream->chunk_size) {
+		grate_error("Allocation of %zu bytes exceeds chunk of %zu\n",
+			    size, stream->chunk_size);
+		return NULL;
+	}
+
+	offset = ALIGN(chunk->used, GRATE_STREAM_ALIGN);
+
+	if (offset + size > stream->chunk_size) {
+		chunk = grate_stream_next(stream);
+		if (!chunk)
+			return NULL;
+
+		stream->current = chunk;
+		offset = 0;
+	}
+
+	chunk->used = offset + size;
+	chunk->pending = true;
+
+	host1x_bo_view_init(view, chunk->bo, offset, size);
+
+	return chunk->map + offset;
+}
+
+int grate_stream_upload(struct grate_stream *stream, const void *data,
+			size_t size, struct host1x_bo_view *view)
+{
+	void *ptr;
+
+	ptr = grate_stream_alloc(stream, size, view);
+	if (!ptr)
+		return -ENOMEM;
+
+	memcpy(ptr, data, size);
+
+	return 0;
+}
+
+/* flushes data written to the current chunk since the previous flush */
+void grate_stream_flush(struct grate_stream *stream)
+{
+	struct grate_stream_chunk *chunk = stream->current;
+
+	if (chunk->used == chunk->flushed)
+		return;
+
+	HOST1X_BO_FLUSH(chunk->bo, chunk->bo->offset + chunk->flushed,
+			chunk->used - chunk->flushed);
+
+	chunk->flushed = chunk->used;
+}
+
+/*
+ * Records the fence of the job that consumed the allocations made so far.
+ * Fence of a batched draw submits the batch to get its fence.
+ */
+int grate_stream_fence(struct grate_stream *stream,
+		       const struct grate_fence *fence)
+{
+	struct grate_fence resolved = *fence;
+	struct grate_stream_chunk *chunk;
+	int err;
+
+	err = grate_fence_resolve(&resolved);
+	if (err < 0)
+		return err;
+
+	fence = &resolved;
+
+	if (!fence->client) {
+		grate_error("Fence isn't associated with a job\n");
+		return -EINVAL;
+	}
+
+	list_for_each_entry(chunk, &stream->chunks, list) {
+		if (!chunk->pending)
+			continue;
+
+		chunk->client = fence->client;
+		chunk->fence = fence->value;
+		chunk->pending = false;
+	}
+
+	return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "../libhost1x/host1x-private.h"
+#include "libgrate-private.h"
+
+#include "grate.h"
+#include "host1x.h"
+
+/*
+ * Small buffers are carved out of large "slab" BOs using BO wrapping,
+ * allocations are never freed individually. Once all allocations of a slab
+ * are released, the batch that was recorded by then is submitted and the
+ * submitted jobs referencing the slab are done, the whole slab is recycled
+ * at once. The allocations must be freed with grate_bo_free().
+ */
+#define GRATE_SLAB_ALIGN	64
+
+static struct grate_slab *grate_slab_create(struct grate *grate,
+					    unsigned long flags)
+{
+	struct grate_slab *slab;
+
+	slab = calloc(1, sizeof(*slab));
+	if (!slab)
+		return NULL;
+
+	slab->bo = grate_bo_create_and_map(grate, flags, GRATE_SLAB_SIZE,
+					   &slab->map);
+	if (!slab->bo) {
+		free(slab);
+		return NULL;
+	}
+
+	slab->flags = flags;
+	list_add_tail(&slab->list, &grate->slabs);
+
+	return slab;
+}
+
+static void grate_slab_free(struct grate_slab *slab)
+{
+	list_del(&slab->list);
+	host1x_bo_free(slab->bo);
+	free(slab);
+}
+
+static bool grate_slab_idle(struct grate *grate, struct grate_slab *slab)
+{
+	if (slab->refs)
+		return false;
+
+	if (slab->batch > grate->batch.submitted)
+		return false;
+
+	/* relocations mark the slab busy when their jobs are submitted */
+	return !host1x_bo_is_busy(slab->bo);
+}
+
+struct host1x_bo *grate_bo_suballoc(struct grate *grate, size_t size,
+				    unsigned long flags, void **map)
+{
+	struct grate_slab *slab, *found = NULL;
+	struct host1x_bo *bo;
+	size_t offset;
+
+	size = (size + GRATE_SLAB_ALIGN - 1) & ~(GRATE_SLAB_ALIGN - 1ul);
+
+	if (size > GRATE_SLAB_SIZE)
+		return NULL;
+
+	list_for_each_entry(slab, &grate->slabs, list) {
+		if (slab->flags != flags)
+			continue;
+
+		if (slab->used + size <= GRATE_SLAB_SIZE) {
+			found = slab;
+			break;
+		}
+
+		if (grate_slab_idle(grate, slab)) {
+			slab->used = 0;
+			found = slab;
+			break;
+		}
+	}
+
+	if (!found) {
+		found = grate_slab_create(grate, flags);
+		if (!found)
+			return NULL;
+	}
+
+	offset = found->used;
+
+	bo = HOST1X_BO_WRAP(found->bo, offset, size);
+	if (!bo)
+		return NULL;
+
+	found->used += size;
+	found->refs++;
+
+	if (map)
+		*map = found->map + offset;
+
+	return bo;
+}
+
+void grate_bo_free(struct grate *grate, struct host1x_bo *bo)
+{
+	struct grate_slab *slab;
+
+	if (!bo)
+		return;
+
+	list_for_each_entry(slab, &grate->slabs, list) {
+		if (bo->wrapped != slab->bo)
+			continue;
+
+		/* draws recorded into the batch aren't marked busy yet */
+		if (--slab->refs == 0)
+			slab->batch = grate->batch.job ? grate->batch.seq : 0;
+
+		break;
+	}
+
+	host1x_bo_free(bo);
+}
+
+void grate_suballoc_exit(struct grate *grate)
+{
+	struct grate_slab *slab, *tmp;
+
+	list_for_each_entry_safe(slab, tmp, &grate->slabs, list)
+		grate_slab_free(slab);
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libgrate-private.h"
+
+/*
+ * On-disk cache of texture data in the form that is handed to
+ * host1x_pixelbuffer_load_data(): decoded, scaled and compressed (including
+ * the GR3D ETC1 word order). Entries are named after a hash of the source
+ * file contents and of the load parameters, so a modified source simply
+ * misses the cache.
+ */
+
+#define GRATE_TEXTURE_CACHE_MAGIC	0x43545247 /* "GRTC" */
+#define GRATE_TEXTURE_CACHE_VERSION	1
+
+struct grate_texture_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t pitch;
+	uint64_t size;
+};
+
+static void grate_texture_cache_path(struct grate *grate, uint64_t key,
+				     char *path, size_t size)
+{
+	snprintf(path, size, "%s/%016llx.gtc", grate->texture_cache,
+		 (unsigned long long)key);
+}
+
+/*
+ * Compute the cache key of a texture load. The width and height are those
+ * the image is scaled to, 0 when it is loaded at its own size.
+ */
+int grate_texture_cache_key(struct grate *grate, const char *path,
+			    enum pixel_format format,
+			    enum layout_format layout,
+			    unsigned int width, unsigned int height,
+			    uint64_t *key)
+{
+	uint32_t params[5] = { format, layout, width, height, 0 };
+	uint64_t hash = GRATE_FNV1A_INIT;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (format == PIX_BUF_FMT_ETC1)
+		params[4] = grate->etc1_quality;
+	else if (PIX_BUF_FORMAT_COMPRESSED(format))
+		params[4] = grate->dxt_quality;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -errno;
+	}
+
+	if (st.st_size) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			return -errno;
+		}
+
+		hash = grate_fnv1a(hash, map, st.st_size);
+		munmap(map, st.st_size);
+	}
+
+	close(fd);
+
+	*key = grate_fnv1a(hash, params, sizeof(params));
+
+	return 0;
+}
+
+int grate_texture_cache_lookup(struct grate *grate, uint64_t key,
+			       struct grate_texture_cache_entry *entry)
+{
+	struct grate_texture_cache_header *header;
+	char path[PATH_MAX];
+	struct stat st;
+	void *map;
+	int fd;
+
+	grate_texture_cache_path(grate, key, path, sizeof(path));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*header)) {
+		close(fd);
+		return -ENOENT;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -errno;
+
+	header = map;
+
+	if (header->magic != GRATE_TEXTURE_CACHE_MAGIC ||
+	    header->version != GRATE_TEXTURE_CACHE_VERSION ||
+	    header->key != key ||
+	    header->size != st.st_size - sizeof(*header)) {
+		grate_error("stale texture cache entry \"%s\"\n", path);
+		munmap(map, st.st_size);
+		return -ENOENT;
+	}
+
+	entry->map = map;
+	entry->map_size = st.st_size;
+	entry->data = (uint8_t *)map + sizeof(*header);
+	entry->size = header->size;
+	entry->format = header->format;
+	entry->width = header->width;
+	entry->height = header->height;
+	entry->pitch = header->pitch;
+
+	return 0;
+}
+
+void grate_texture_cache_release(struct grate_texture_cache_entry *entry)
+{
+	munmap(entry->map, entry->map_size);
+}
+
+/*
+ * Entries are written to a temporary file that is renamed into place, so
+ * concurrent loaders never see a partially written entry.
+ */
+int grate_texture_cache_store(struct grate *grate, uint64_t key,
+			      enum pixel_format format,
+			      unsigned int width, unsigned int height,
+			      unsigned int pitch, const void *data,
+			      size_t size)
+{
+	struct grate_texture_cache_header header;
+	char path[PATH_MAX], tmp[PATH_MAX + 16];
+	FILE *fp;
+	int err = 0;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = GRATE_TEXTURE_CACHE_MAGIC;
+	header.version = GRATE_TEXTURE_CACHE_VERSION;
+	header.key = key;
+	header.format = format;
+	header.width = width;
+	header.height = height;
+	header.pitch = pitch;
+	header.size = size;
+
+	grate_texture_cache_path(grate, key, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+	fp = fopen(tmp, "wb");
+	if (!fp) {
+		grate_error("failed to create \"%s\": %d\n", tmp, -errno);
+		return -errno;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	    fwrite(data, size, 1, fp) != 1)
+		err = -EIO;
+
+	if (fclose(fp) && !err)
+		err = -EIO;
+
+	if (!err && rename(tmp, path) < 0)
+		err = -errno;
+
+	if (err) {
+		grate_error("failed to write \"%s\": %d\n", path, err);
+		unlink(tmp);
+	}
+
+	return err;
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "etc1.h"
+#include "libgrate-private.h"
+
+/*
+ * Parsers for pre-compressed texture containers. The mip levels are
+ * referenced in place in a private read/write mapping of the file, so the
+ * caller may convert them in place before uploading.
+ */
+
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT		0x83f0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT	0x83f1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT	0x83f2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT	0x83f3
+
+#define KTX_ENDIANNESS		0x04030201
+#define KTX_HEADER_SIZE		64
+
+#define DDS_MAGIC		0x20534444 /* "DDS " */
+#define DDS_HEADER_SIZE		124
+#define DDS_PF_FOURCC		0x4
+#define FOURCC(a, b, c, d)	((a) | (b) << 8 | (c) << 16 | (d) << 24)
+
+static const uint8_t ktx_identifier[12] = {
+	0xab, 'K', 'T', 'X', ' ', '1', '1', 0xbb, '\r', '\n', 0x1a, '\n',
+};
+
+static uint32_t read_le32(const uint8_t *ptr)
+{
+	return ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (uint32_t)ptr[3] << 24;
+}
+
+static size_t grate_texture_level_size(enum pixel_format format,
+				       unsigned int width,
+				       unsigned int height)
+{
+	unsigned int tw = PIX_BUF_FORMAT_TEXEL_WIDTH(format);
+	unsigned int th = PIX_BUF_FORMAT_TEXEL_HEIGHT(format);
+
+	return (size_t)((width + tw - 1) / tw) * ((height + th - 1) / th) *
+	       PIX_BUF_FORMAT_BYTES(format);
+}
+
+static int grate_texture_parse_pkm(struct grate_texture_container *container)
+{
+	const uint8_t *data = container->map;
+
+	if (container->map_size < ETC_PKM_HEADER_SIZE ||
+	    !etc1_pkm_is_valid(data))
+		return -EINVAL;
+
+	container->format = PIX_BUF_FMT_ETC1;
+	container->width = etc1_pkm_get_width(data);
+	container->height = etc1_pkm_get_height(data);
+	container->num_levels = 1;
+	container->levels[0].data = (uint8_t *)container->map +
+				    ETC_PKM_HEADER_SIZE;
+	container->levels[0].size = etc1_get_encoded_data_size(
+						container->width,
+						container->height);
+
+	if (container->levels[0].size >
+	    container->map_size - ETC_PKM_HEADER_SIZE)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int grate_texture_parse_ktx(struct grate_texture_container *container)
+{
+	uint8_t *data = container->map;
+	size_t offset = KTX_HEADER_SIZE;
+	unsigned int width, height, i;
+	uint32_t levels;
+
+	if (container->map_size < KTX_HEADER_SIZE)
+		return -EINVAL;
+
+	if (read_le32(data + 12) != KTX_ENDIANNESS) {
+		grate_error("big-endian KTX files aren't supported\n");
+		return -EINVAL;
+	}
+
+	switch (read_le32(data + 28)) {
+	case ETC1_RGB8_OES:
+		container->format = PIX_BUF_FMT_ETC1;
+		break;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+		container->format = PIX_BUF_FMT_DXT1;
+		break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+		container->format = PIX_BUF_FMT_DXT3;
+		break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		container->format = PIX_BUF_FMT_DXT5;
+		break;
+	default:
+		grate_error("unsupported KTX internal format 0x%04x\n",
+			    read_le32(data + 28));
+		return -EINVAL;
+	}
+
+	container->width = read_le32(data + 36);
+	container->height = read_le32(data + 40);
+
+	/* no 3D textures, arrays or cube maps */
+	if (read_le32(data + 44) > 1 || read_le32(data + 48) > 1 ||
+	    read_le32(data + 52) > 1) {
+		grate_error("only plain 2D KTX textures are supported\n");
+		return -EINVAL;
+	}
+
+	levels = MAX(read_le32(data + 56), 1);
+	offset += read_le32(data + 60);
+
+	width = container->width;
+	height = container->height;
+
+	for (i = 0; i < MIN(levels, GRATE_TEXTURE_MAX_LEVELS); i++) {
+		size_t size;
+
+		if (offset + 4 > container->map_size)
+			return -EINVAL;
+
+		size = read_le32(data + offset);
+		offset += 4;
+
+		if (size < grate_texture_level_size(container->format,
+						    width, height) ||
+		    size > container->map_size - offset)
+			return -EINVAL;
+
+		container->levels[i].data = data + offset;
+		container->levels[i].size = size;
+
+		offset += ALIGN(size, 4);
+		width = MAX(width >> 1, 1);
+		height = MAX(height >> 1, 1);
+	}
+
+	container->num_levels = i;
+
+	return 0;
+}
+
+static int grate_texture_parse_dds(struct grate_texture_container *container)
+{
+	uint8_t *data = container->map;
+	size_t offset = 4 + DDS_HEADER_SIZE;
+	unsigned int width, height, i;
+	uint32_t levels;
+
+	if (container->map_size < offset ||
+	    read_le32(data + 4) != DDS_HEADER_SIZE)
+		return -EINVAL;
+
+	if (!(read_le32(data + 80) & DDS_PF_FOURCC)) {
+		grate_error("uncompressed DDS files aren't supported\n");
+		return -EINVAL;
+	}
+
+	switch (read_le32(data + 84)) {
+	case FOURCC('D', 'X', 'T', '1'):
+		container->format = PIX_BUF_FMT_DXT1;
+		break;
+	case FOURCC('D', 'X', 'T', '3'):
+		container->format = PIX_BUF_FMT_DXT3;
+		break;
+	case FOURCC('D', 'X', 'T', '5'):
+		container->format = PIX_BUF_FMT_DXT5;
+		break;
+	default:
+		grate_error("unsupported DDS FourCC 0x%08x\n",
+			    read_le32(data + 84));
+		return -EINVAL;
+	}
+
+	container->height = read_le32(data + 12);
+	container->width = read_le32(data + 16);
+	levels = MAX(read_le32(data + 28), 1);
+
+	width = container->width;
+	height = container->height;
+
+	for (i = 0; i < MIN(levels, GRATE_TEXTURE_MAX_LEVELS); i++) {
+		size_t size = grate_texture_level_size(container->format,
+						       width, height);
+
+		if (size > container->map_size - offset)
+			return -EINVAL;
+
+		container->levels[i].data = data + offset;
+		container->levels[i].size = size;
+
+		offset += size;
+		width = MAX(width >> 1, 1);
+		height = MAX(height >> 1, 1);
+	}
+
+	container->num_levels = i;
+
+	return 0;
+}
+
+/*
+ * Returns -ENOTSUP if the file isn't one of the supported containers, so
+ * that the caller can fall back to decoding it.
+ */
+int grate_texture_container_open(const char *path,
+				 struct grate_texture_container *container)
+{
+	struct stat st;
+	uint8_t *data;
+	int err, fd;
+
+	memset(container, 0, sizeof(*container));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	if (st.st_size < 16) {
+		close(fd);
+		return -ENOTSUP;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		    fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return -errno;
+
+	container->map = data;
+	container->map_size = st.st_size;
+
+	if (!memcmp(data, "PKM ", 4))
+		err = grate_texture_parse_pkm(container);
+	else if (!memcmp(data, ktx_identifier, sizeof(ktx_identifier)))
+		err = grate_texture_parse_ktx(container);
+	else if (read_le32(data) == DDS_MAGIC)
+		err = grate_texture_parse_dds(container);
+	else
+		err = -ENOTSUP;
+
+	if (err == -EINVAL)
+		grate_error("\"%s\" is malformed\n", path);
+
+	if (err < 0) {
+		munmap(container->map, container->map_size);
+		container->map = NULL;
+	}
+
+	return err;
+}
+
+void grate_texture_container_close(struct grate_texture_container *container)
+{
+	if (container->map)
+		munmap(container->map, container->map_size);
+}
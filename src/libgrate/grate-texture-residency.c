@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Residency of the textures loaded from files. Each texture records the
+ * frame it was last bound or drawn with. When the textures exceed the
+ * budget, or an allocation fails, the least recently used ones are evicted
+ * by freeing their pixbufs and are reloaded from their file, and thus from
+ * the texture cache, once they are used again. Textures used by the frame
+ * being drawn are never evicted, the GPU may still read the freed BOs of
+ * the ones that are, which is covered by deferred freeing of busy BOs.
+ *
+ * A texture whose content is modified doesn't match its file anymore and
+ * isn't managed from then on, neither are mipmapped and streamed ones.
+ */
+
+struct grate_texture_resident {
+	struct list_head list;
+	struct grate *grate;
+	struct grate_texture *tex;
+	char *path;
+	unsigned int width;
+	unsigned int height;
+	enum pixel_format format;
+	enum layout_format layout;
+	size_t size;
+	uint64_t last_frame;
+	bool evicted;
+};
+
+/* protects the list and the accounting, loads may run on other threads */
+static pthread_mutex_t grate_residency_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void grate_texture_evict(struct grate_texture_resident *res)
+{
+	struct grate *grate = res->grate;
+	struct grate_texture *tex = res->tex;
+
+	grate_info("evicting texture \"%s\" of %zu bytes\n", res->path,
+		   res->size);
+
+	host1x_pixelbuffer_free(tex->pixbuf);
+	tex->pixbuf = NULL;
+	tex->desc_bo = NULL;
+	tex->version++;
+
+	res->evicted = true;
+	grate->texture_resident_bytes -= res->size;
+	grate->texture_evictions++;
+}
+
+/* evicts until size more bytes fit into the budget, all if reclaiming */
+static bool grate_texture_residency_trim_locked(struct grate *grate,
+						size_t size, bool reclaim)
+{
+	struct grate_texture_resident *res, *oldest;
+	bool evicted = false;
+
+	while (reclaim || (grate->texture_budget &&
+			   grate->texture_resident_bytes + size >
+			   grate->texture_budget)) {
+		oldest = NULL;
+
+		list_for_each_entry(res, &grate->resident_textures, list) {
+			if (res->evicted || res->last_frame >= grate->frame)
+				continue;
+
+			if (!oldest || res->last_frame < oldest->last_frame)
+				oldest = res;
+		}
+
+		if (!oldest)
+			break;
+
+		grate_texture_evict(oldest);
+		evicted = true;
+	}
+
+	return evicted;
+}
+
+void grate_texture_residency_trim(struct grate *grate)
+{
+	pthread_mutex_lock(&grate_residency_lock);
+	grate_texture_residency_trim_locked(grate, 0, false);
+	pthread_mutex_unlock(&grate_residency_lock);
+}
+
+bool grate_texture_residency_reclaim(struct grate *grate)
+{
+	bool evicted;
+
+	pthread_mutex_lock(&grate_residency_lock);
+	evicted = grate_texture_residency_trim_locked(grate, 0, true);
+	pthread_mutex_unlock(&grate_residency_lock);
+
+	return evicted;
+}
+
+void grate_texture_residency_add(struct grate *grate,
+				 struct grate_texture *tex,
+				 const char *path)
+{
+	struct host1x_pixelbuffer *pixbuf = tex->pixbuf;
+	struct grate_texture_resident *res;
+
+	if (tex->resident || tex->stream || tex->mipmap_pixbuf)
+		return;
+
+	res = calloc(1, sizeof(*res));
+	if (!res)
+		return;
+
+	res->path = strdup(path);
+	if (!res->path) {
+		free(res);
+		return;
+	}
+
+	res->grate = grate;
+	res->tex = tex;
+	res->width = pixbuf->width;
+	res->height = pixbuf->height;
+	res->format = pixbuf->format;
+	res->layout = pixbuf->layout;
+	res->size = pixbuf->bo->size;
+	res->last_frame = grate->frame;
+
+	pthread_mutex_lock(&grate_residency_lock);
+
+	list_add_tail(&res->list, &grate->resident_textures);
+	grate->texture_resident_bytes += res->size;
+	tex->resident = res;
+
+	grate_texture_residency_trim_locked(grate, 0, false);
+
+	pthread_mutex_unlock(&grate_residency_lock);
+}
+
+void grate_texture_residency_remove(struct grate_texture *tex)
+{
+	struct grate_texture_resident *res = tex->resident;
+	struct grate *grate = res->grate;
+
+	pthread_mutex_lock(&grate_residency_lock);
+
+	list_del(&res->list);
+	if (!res->evicted)
+		grate->texture_resident_bytes -= res->size;
+
+	tex->resident = NULL;
+
+	pthread_mutex_unlock(&grate_residency_lock);
+
+	free(res->path);
+	free(res);
+}
+
+static int grate_texture_restore(struct grate_texture_resident *res)
+{
+	struct grate *grate = res->grate;
+	struct grate_texture *tex = res->tex;
+	struct host1x_pixelbuffer *pixbuf;
+	int err;
+
+	pthread_mutex_lock(&grate_residency_lock);
+	grate_texture_residency_trim_locked(grate, res->size, false);
+	pthread_mutex_unlock(&grate_residency_lock);
+
+	pixbuf = grate_texture_create_pixbuf(grate, res->width, res->height,
+					     res->format, res->layout);
+	if (!pixbuf)
+		return -ENOMEM;
+
+	tex->pixbuf = pixbuf;
+
+	pthread_mutex_lock(&grate_residency_lock);
+	res->evicted = false;
+	grate->texture_resident_bytes += res->size;
+	grate->texture_reloads++;
+	pthread_mutex_unlock(&grate_residency_lock);
+
+	err = grate_texture_load(grate, tex, res->path);
+	if (err < 0)
+		grate_error("failed to reload texture \"%s\": %d\n",
+			    res->path, err);
+
+	return err;
+}
+
+void grate_texture_residency_touch(struct grate_texture *tex)
+{
+	tex->resident->last_frame = tex->resident->grate->frame;
+}
+
+/*
+ * Called before the texture is used, the content of a texture that is
+ * written doesn't match its file anymore, it isn't managed from then on.
+ */
+int grate_texture_make_resident(struct grate_texture *tex, bool write)
+{
+	struct grate_texture_resident *res = tex->resident;
+	int err = 0;
+
+	if (!res)
+		return 0;
+
+	res->last_frame = res->grate->frame;
+
+	if (res->evicted)
+		err = grate_texture_restore(res);
+
+	if (write && !err)
+		grate_texture_residency_remove(tex);
+
+	return err;
+}
+
+void grate_set_texture_budget(struct grate *grate, size_t size)
+{
+	pthread_mutex_lock(&grate_residency_lock);
+	grate->texture_budget = size;
+	grate_texture_residency_trim_locked(grate, 0, false);
+	pthread_mutex_unlock(&grate_residency_lock);
+}
+
+void grate_texture_residency_stats(struct grate *grate,
+				   struct grate_texture_residency_stats *stats)
+{
+	struct grate_texture_resident *res;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&grate_residency_lock);
+
+	list_for_each_entry(res, &grate->resident_textures, list) {
+		if (res->evicted) {
+			stats->evicted++;
+			stats->evicted_bytes += res->size;
+		} else {
+			stats->resident++;
+		}
+	}
+
+	stats->budget = grate->texture_budget;
+	stats->resident_bytes = grate->texture_resident_bytes;
+	stats->evictions = grate->texture_evictions;
+	stats->reloads = grate->texture_reloads;
+
+	pthread_mutex_unlock(&grate_residency_lock);
+}
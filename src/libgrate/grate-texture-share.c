@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Textures shared by the loads of identical content. They are keyed by the
+ * texture cache key, a hash of the file content and of the parameters of
+ * the load, so the same image under different paths is shared too.
+ */
+
+struct grate_texture_shared {
+	struct list_head list;
+	struct grate_texture *tex;
+	uint64_t key;
+	unsigned int refcount;
+};
+
+static pthread_mutex_t grate_texture_share_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct grate_texture *grate_texture_share_ref(struct grate *grate,
+						     uint64_t key)
+{
+	struct grate_texture_shared *shared;
+
+	list_for_each_entry(shared, &grate->shared_textures, list) {
+		if (shared->key == key) {
+			shared->refcount++;
+			grate->texture_share_hits++;
+			return shared->tex;
+		}
+	}
+
+	return NULL;
+}
+
+struct grate_texture *grate_texture_get(struct grate *grate,
+					const char *path,
+					enum pixel_format format,
+					enum layout_format layout)
+{
+	struct grate_texture_shared *shared;
+	struct grate_texture *tex, *found;
+	uint64_t key;
+	int err;
+
+	err = grate_texture_cache_key(grate, path, format, layout, 0, 0, &key);
+	if (err < 0) {
+		grate_error("\"%s\" can't be read: %d\n", path, err);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&grate_texture_share_lock);
+	found = grate_texture_share_ref(grate, key);
+	pthread_mutex_unlock(&grate_texture_share_lock);
+
+	if (found)
+		return found;
+
+	/* loaded unlocked, a concurrent load of the same content may win */
+	tex = grate_create_texture2(grate, path, format, layout);
+	if (!tex)
+		return NULL;
+
+	shared = calloc(1, sizeof(*shared));
+	if (!shared)
+		return tex;
+
+	shared->tex = tex;
+	shared->key = key;
+	shared->refcount = 1;
+
+	pthread_mutex_lock(&grate_texture_share_lock);
+
+	found = grate_texture_share_ref(grate, key);
+	if (!found) {
+		list_add_tail(&shared->list, &grate->shared_textures);
+		tex->shared = shared;
+	}
+
+	pthread_mutex_unlock(&grate_texture_share_lock);
+
+	if (found) {
+		grate_texture_free(tex);
+		free(shared);
+		return found;
+	}
+
+	return tex;
+}
+
+/* drops a reference, returns true if it was the last one */
+bool grate_texture_unshare(struct grate_texture *tex)
+{
+	struct grate_texture_shared *shared = tex->shared;
+	bool last;
+
+	pthread_mutex_lock(&grate_texture_share_lock);
+
+	last = !--shared->refcount;
+	if (last) {
+		list_del(&shared->list);
+		tex->shared = NULL;
+	}
+
+	pthread_mutex_unlock(&grate_texture_share_lock);
+
+	if (last)
+		free(shared);
+
+	return last;
+}
+
+void grate_texture_share_stats(struct grate *grate,
+			       struct grate_texture_share_stats *stats)
+{
+	struct grate_texture_shared *shared;
+	size_t size;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&grate_texture_share_lock);
+
+	list_for_each_entry(shared, &grate->shared_textures, list) {
+		/* an evicted or a never used lazy texture takes no memory */
+		if (!shared->tex->pixbuf || !shared->tex->pixbuf->bo)
+			continue;
+
+		size = shared->tex->pixbuf->bo->size;
+
+		stats->textures++;
+		stats->references += shared->refcount;
+		stats->bytes += size;
+		stats->bytes_saved += size * (shared->refcount - 1);
+	}
+
+	stats->hits = grate->texture_share_hits;
+
+	pthread_mutex_unlock(&grate_texture_share_lock);
+}
+
+void grate_texture_share_exit(struct grate *grate)
+{
+	struct grate_texture_shared *shared, *tmp;
+
+	list_for_each_entry_safe(shared, tmp, &grate->shared_textures, list) {
+		grate_info("shared texture still has %u references\n",
+			   shared->refcount);
+
+		shared->tex->shared = NULL;
+		grate_texture_free(shared->tex);
+		list_del(&shared->list);
+		free(shared);
+	}
+}
@@ -23,26 +23,39 @@
 
 #include <assert.h>
 #include <byteswap.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <IL/il.h>
 #include <IL/ilu.h>
 
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "../libhost1x/host1x-private.h"
+
+#include "dxt.h"
 #include "etc1.h"
 #include "grate.h"
 #include "grate-3d.h"
 
 #include "libgrate-private.h"
 
-struct grate_texture *grate_create_texture(struct grate *grate,
-					   unsigned width, unsigned height,
-					   enum pixel_format format,
-					   enum layout_format layout)
+static int grate_texture_check_format(enum pixel_format format,
+				      enum layout_format layout)
 {
-	struct grate_texture *tex;
-	unsigned pitch;
-
 	switch (format) {
+	case PIX_BUF_FMT_A8:
+	case PIX_BUF_FMT_L8:
+	case PIX_BUF_FMT_LA88:
+	case PIX_BUF_FMT_RGB565:
+	case PIX_BUF_FMT_RGBA5551:
+	case PIX_BUF_FMT_RGBA4444:
+	case PIX_BUF_FMT_BGRA8888:
 	case PIX_BUF_FMT_S8:
 	case PIX_BUF_FMT_RGBA8888:
 	case PIX_BUF_FMT_D16_LINEAR:
@@ -54,38 +67,261 @@ struct grate_texture *grate_create_texture(struct grate *grate,
 		break;
 	default:
 		grate_error("Invalid format %u\n", format);
-		return NULL;
+		return -EINVAL;
 	}
 
 	switch (layout) {
 	case PIX_BUF_LAYOUT_LINEAR:
 	case PIX_BUF_LAYOUT_TILED_16x16:
+	case PIX_BUF_LAYOUT_AUTO:
 		break;
 	default:
 		grate_error("Invalid layout %u\n", layout);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static unsigned grate_texture_pitch(unsigned width, enum pixel_format format)
+{
+	unsigned pitch;
+
+	pitch = PIX_BUF_FORMAT_BYTES(format) * width;
+	pitch = pitch / PIX_BUF_FORMAT_TEXEL_WIDTH(format);
+
+	return ALIGN(pitch, PIX_BUF_FORMAT_ALIGNMENT(format));
+}
+
+/* evicts unused textures and retries if the memory ran out */
+struct host1x_pixelbuffer *grate_texture_create_pixbuf(struct grate *grate,
+						unsigned width, unsigned height,
+						enum pixel_format format,
+						enum layout_format layout)
+{
+	struct host1x_pixelbuffer *pixbuf;
+	unsigned pitch = grate_texture_pitch(width, format);
+
+	do {
+		pixbuf = host1x_pixelbuffer_create(grate->host1x, width,
+						   height, pitch, format,
+						   layout);
+	} while (!pixbuf && grate_texture_residency_reclaim(grate));
+
+	if (!pixbuf) {
+		grate_error("failed to allocate texture %ux%u bpp:%u pitch:%u\n",
+			    width, height, PIX_BUF_FORMAT_BYTES(format), pitch);
 		return NULL;
 	}
 
+	host1x_bo_set_category(pixbuf->bo, HOST1X_MEM_TEXTURE);
+
+	return pixbuf;
+}
+
+struct grate_texture *grate_create_texture(struct grate *grate,
+					   unsigned width, unsigned height,
+					   enum pixel_format format,
+					   enum layout_format layout)
+{
+	struct grate_texture *tex;
+	unsigned pitch;
+
+	if (grate_texture_check_format(format, layout))
+		return NULL;
+
 	tex = calloc(1, sizeof(*tex));
 	if (!tex)
 		return NULL;
 
-	pitch = PIX_BUF_FORMAT_BYTES(format) * width;
-	pitch = pitch / PIX_BUF_FORMAT_TEXEL_WIDTH(format);
-	pitch = ALIGN(pitch, PIX_BUF_FORMAT_ALIGNMENT(format));
+	/* the BO is allocated once the texture is drawn to or with */
+	if (grate->lazy_pixbufs) {
+		pitch = grate_texture_pitch(width, format);
+		tex->pixbuf = host1x_pixelbuffer_create_lazy(grate->host1x,
+							     width, height,
+							     pitch, format,
+							     layout);
+		if (tex->pixbuf)
+			tex->pixbuf->lazy.flags |=
+				HOST1X_BO_CATEGORY(HOST1X_MEM_TEXTURE);
+	} else {
+		tex->pixbuf = grate_texture_create_pixbuf(grate, width, height,
+							  format, layout);
+	}
 
-	tex->pixbuf = host1x_pixelbuffer_create(grate->host1x, width, height,
-						pitch, format, layout);
 	if (!tex->pixbuf) {
-		grate_error("failed to allocate texture %ux%u bpp:%u pitch:%u\n",
-			    width, height, PIX_BUF_FORMAT_BYTES(format), pitch);
 		free(tex);
 		return NULL;
 	}
 
+	tex->desc_version = ~0u;
+
+	return tex;
+}
+
+/*
+ * Create a texture that samples an external dma-buf in place, such as a
+ * camera or video decoder frame, instead of copying it into a new BO. The
+ * fd stays owned by the caller and may be closed once this returns.
+ */
+struct grate_texture *grate_texture_import_dmabuf(struct grate *grate, int fd,
+						  unsigned width,
+						  unsigned height,
+						  unsigned pitch,
+						  enum pixel_format format,
+						  enum layout_format layout)
+{
+	struct grate_texture *tex;
+	struct host1x_bo *bo;
+
+	if (grate_texture_check_format(format, layout))
+		return NULL;
+
+	if (pitch % PIX_BUF_FORMAT_ALIGNMENT(format)) {
+		grate_error("dma-buf pitch %u isn't aligned to %u\n",
+			    pitch, PIX_BUF_FORMAT_ALIGNMENT(format));
+		return NULL;
+	}
+
+	tex = calloc(1, sizeof(*tex));
+	if (!tex)
+		return NULL;
+
+	bo = HOST1X_BO_IMPORT_DMABUF(grate->host1x, fd);
+	if (!bo) {
+		free(tex);
+		return NULL;
+	}
+
+	tex->pixbuf = host1x_pixelbuffer_wrap(bo, width, height, pitch,
+					      format, layout);
+	if (!tex->pixbuf) {
+		host1x_bo_free(bo);
+		free(tex);
+		return NULL;
+	}
+
+	tex->desc_version = ~0u;
+
 	return tex;
 }
 
+/*
+ * Tegra's GR3D uses a different layout for ETC1 data: the two big-endian
+ * words of each block are byte-swapped and exchanged, which amounts to
+ * reversing the order of all 8 bytes of the block.
+ */
+static void grate_etc1_swap(void *data, size_t size)
+{
+	uint64_t *blocks = data;
+	size_t count = size / 8;
+	size_t i = 0;
+
+#ifdef __ARM_NEON
+	uint8_t *ptr = data;
+
+	for (; i + 2 <= count; i += 2)
+		vst1q_u8(ptr + i * 8, vrev64q_u8(vld1q_u8(ptr + i * 8)));
+#endif
+
+	for (; i < count; i++)
+		blocks[i] = bswap_64(blocks[i]);
+}
+
+static int grate_etc1_quality(struct grate *grate)
+{
+	switch (grate->etc1_quality) {
+	case GRATE_ETC1_QUALITY_FAST:
+		return ETC1_QUALITY_FAST;
+	case GRATE_ETC1_QUALITY_MEDIUM:
+		return ETC1_QUALITY_MEDIUM;
+	default:
+		return ETC1_QUALITY_HIGH;
+	}
+}
+
+static enum dxt_quality grate_dxt_quality(struct grate *grate)
+{
+	switch (grate->dxt_quality) {
+	case GRATE_DXT_QUALITY_FAST:
+		return DXT_QUALITY_FAST;
+	default:
+		return DXT_QUALITY_MEDIUM;
+	}
+}
+
+#define GRATE_TEXTURE_LOAD_THREADS 8
+
+/* DevIL has a single global context, it has to be serialized */
+static pthread_once_t grate_il_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t grate_il_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void grate_il_init(void)
+{
+	pthread_once(&grate_il_once, ilInit);
+}
+
+/*
+ * Load a texture from the on-disk cache. Returns -ENOENT on a cache miss,
+ * in which case the key to store the loaded data under is returned.
+ */
+static int grate_texture_load_cached(struct grate *grate,
+				     struct grate_texture **tex,
+				     const char *path, bool create,
+				     enum pixel_format format,
+				     enum layout_format layout,
+				     uint64_t *key)
+{
+	struct grate_texture_cache_entry entry;
+	unsigned width = 0, height = 0;
+	int err;
+
+	if (!create) {
+		width = (*tex)->pixbuf->width;
+		height = (*tex)->pixbuf->height;
+	}
+
+	err = grate_texture_cache_key(grate, path, format, layout,
+				      width, height, key);
+	if (err < 0) {
+		grate_error("\"%s\" can't be read: %d\n", path, err);
+		return err;
+	}
+
+	err = grate_texture_cache_lookup(grate, *key, &entry);
+	if (err < 0)
+		return -ENOENT;
+
+	if (create) {
+		*tex = grate_create_texture(grate, entry.width, entry.height,
+					    format, layout);
+		if (!(*tex)) {
+			grate_texture_cache_release(&entry);
+			return -ENOMEM;
+		}
+	}
+
+	err = host1x_pixelbuffer_load_data(grate->host1x, (*tex)->pixbuf,
+					   (void *)entry.data, entry.pitch,
+					   entry.size, format,
+					   PIX_BUF_LAYOUT_LINEAR);
+	grate_texture_cache_release(&entry);
+
+	if (err)
+		grate_error("failed to load \"%s\" from cache\n", path);
+	else
+		grate_info("loaded \"%s\" from cache\n", path);
+
+	return err;
+}
+
+static int grate_texture_load_container(struct grate *grate,
+					struct grate_texture **tex,
+					const char *path, bool create,
+					enum pixel_format format,
+					enum layout_format layout,
+					struct grate_texture_container *container);
+
 static int grate_texture_load_internal(struct grate *grate,
 				       struct grate_texture **tex,
 				       const char *path, bool create,
@@ -95,22 +331,51 @@ static int grate_texture_load_internal(struct grate *grate,
 	unsigned tex_pitch;
 	unsigned tex_bpp;
 	unsigned tw, bpp;
+	void *converted = NULL;
 	void *tex_data;
 	ILuint tex_size;
 	ILuint ImageTex;
+	struct grate_texture_container container;
+	uint64_t cache_key;
+	bool cache = false;
 	ILenum il_fmt;
-	unsigned i;
 	int err;
 
 	grate_info("loading \"%s\" pixbuf format 0x%08x layout %u\n",
 		   path, format, layout);
 
+	err = grate_texture_container_open(path, &container);
+	if (err != -ENOTSUP) {
+		if (!err) {
+			err = grate_texture_load_container(grate, tex, path,
+							   create, format,
+							   layout, &container);
+			grate_texture_container_close(&container);
+		}
+
+		if (err)
+			grate_error("failed to load \"%s\"\n", path);
+		else
+			grate_info("loaded \"%s\"\n", path);
+
+		return err;
+	}
+
+	if (grate->texture_cache) {
+		err = grate_texture_load_cached(grate, tex, path, create,
+						format, layout, &cache_key);
+		if (err != -ENOENT)
+			return err;
+
+		cache = true;
+	}
+
 	if (format == PIX_BUF_FMT_ETC1)
 		il_fmt = IL_RGB;
 	else
 		il_fmt = IL_RGBA;
 
-	ilInit();
+	grate_il_init();
 	ilGenImages(1, &ImageTex);
 	ilBindImage(ImageTex);
 	ilLoadImage(path);
@@ -156,7 +421,9 @@ static int grate_texture_load_internal(struct grate *grate,
 	tex_pitch = ilGetInteger(IL_IMAGE_WIDTH) * tex_bpp;
 
 	if (PIX_BUF_FORMAT_COMPRESSED(format)) {
+		enum dxt_format dxt_format;
 		etc1_byte *etc1_data;
+		uint8_t *dxt_data;
 		ILenum DXTCFormat;
 		ILuint dxtSize;
 
@@ -164,14 +431,17 @@ static int grate_texture_load_internal(struct grate *grate,
 		case PIX_BUF_FMT_DXT1:
 			grate_info("compressing data to DXT1\n");
 			DXTCFormat = IL_DXT1;
+			dxt_format = DXT_FORMAT_DXT1;
 			break;
 		case PIX_BUF_FMT_DXT3:
 			grate_info("compressing data to DXT3\n");
 			DXTCFormat = IL_DXT3;
+			dxt_format = DXT_FORMAT_DXT3;
 			break;
 		case PIX_BUF_FMT_DXT5:
 			grate_info("compressing data to DXT5\n");
 			DXTCFormat = IL_DXT5;
+			dxt_format = DXT_FORMAT_DXT5;
 			break;
 		case PIX_BUF_FMT_ETC1:
 			grate_info("compressing data to ETC1\n");
@@ -185,21 +455,21 @@ static int grate_texture_load_internal(struct grate *grate,
 				goto out;
 			}
 
-			err = etc1_encode_image(tex_data,
+			err = etc1_encode_image_quality(tex_data,
 						ilGetInteger(IL_IMAGE_WIDTH),
 						ilGetInteger(IL_IMAGE_HEIGHT),
-						tex_bpp, tex_pitch, etc1_data);
+						tex_bpp, tex_pitch, etc1_data,
+						grate_etc1_quality(grate));
 			if (err)
 				goto err_compression;
 
-			/* Tegra's GR3D uses a different layout for ETC1 data */
-			for (i = 0; i < dxtSize / 8; i++) {
-				uint64_t *etc1_word64 = (uint64_t*) etc1_data;
-				uint64_t a = bswap_32(etc1_word64[i] >> 32);
-				uint64_t b = bswap_32(etc1_word64[i]);
+			(*tex)->psnr = etc1_compute_psnr(tex_data, etc1_data,
+						ilGetInteger(IL_IMAGE_WIDTH),
+						ilGetInteger(IL_IMAGE_HEIGHT),
+						tex_bpp, tex_pitch);
+			grate_info("ETC1 PSNR %.2f dB\n", (*tex)->psnr);
 
-				etc1_word64[i] = (b << 32) | a;
-			}
+			grate_etc1_swap(etc1_data, dxtSize);
 
 			tex_data = etc1_data;
 
@@ -211,6 +481,33 @@ static int grate_texture_load_internal(struct grate *grate,
 			goto out;
 		}
 
+		/* squish is single-threaded, the range fit encodes stripes */
+		if (grate->dxt_quality != GRATE_DXT_QUALITY_HIGH) {
+			dxtSize = dxt_get_encoded_data_size(
+						ilGetInteger(IL_IMAGE_WIDTH),
+						ilGetInteger(IL_IMAGE_HEIGHT),
+						dxt_format);
+
+			dxt_data = malloc(dxtSize);
+			if (!dxt_data) {
+				err = -1;
+				goto out;
+			}
+
+			err = dxt_encode_image(tex_data,
+					       ilGetInteger(IL_IMAGE_WIDTH),
+					       ilGetInteger(IL_IMAGE_HEIGHT),
+					       tex_pitch, dxt_format,
+					       grate_dxt_quality(grate),
+					       dxt_data);
+			if (err)
+				goto err_compression;
+
+			tex_data = dxt_data;
+
+			goto done_compression;
+		}
+
 		ilEnable(IL_SQUISH_COMPRESS);
 
 		tex_data = ilCompressDXT(tex_data,
@@ -232,13 +529,39 @@ done_compression:
 		bpp       = PIX_BUF_FORMAT_BYTES(format);
 		tex_pitch = ALIGN(ilGetInteger(IL_IMAGE_WIDTH), tw) / tw * bpp;
 		tex_size  = dxtSize;
+	} else if (format != PIX_BUF_FMT_RGBA8888 &&
+		   grate_convert_supported(format)) {
+		bpp = PIX_BUF_FORMAT_BYTES(format);
+
+		converted = malloc((size_t)ilGetInteger(IL_IMAGE_WIDTH) * bpp *
+				   ilGetInteger(IL_IMAGE_HEIGHT));
+		if (!converted) {
+			err = -ENOMEM;
+			goto out;
+		}
+
+		grate_convert_rgba(format, false, tex_data, tex_pitch,
+				   converted, ilGetInteger(IL_IMAGE_WIDTH) * bpp,
+				   ilGetInteger(IL_IMAGE_WIDTH),
+				   ilGetInteger(IL_IMAGE_HEIGHT));
+
+		tex_data  = converted;
+		tex_pitch = ilGetInteger(IL_IMAGE_WIDTH) * bpp;
+		tex_size  = tex_pitch * ilGetInteger(IL_IMAGE_HEIGHT);
 	}
 
+	if (cache)
+		grate_texture_cache_store(grate, cache_key, format,
+					  ilGetInteger(IL_IMAGE_WIDTH),
+					  ilGetInteger(IL_IMAGE_HEIGHT),
+					  tex_pitch, tex_data, tex_size);
+
 	err = host1x_pixelbuffer_load_data(grate->host1x, (*tex)->pixbuf,
 					   tex_data, tex_pitch, tex_size,
 					   format, PIX_BUF_LAYOUT_LINEAR);
 out:
 	ilDeleteImage(ImageTex);
+	free(converted);
 
 	if (err)
 		grate_error("failed to load \"%s\"\n", path);
@@ -251,9 +574,22 @@ out:
 int grate_texture_load(struct grate *grate, struct grate_texture *tex,
 		       const char *path)
 {
-	return grate_texture_load_internal(grate, &tex, path, false,
-					   tex->pixbuf->format,
-					   tex->pixbuf->layout);
+	uint64_t start = grate_trace_now(grate);
+	int err;
+
+	err = grate_texture_make_resident(tex, false);
+	if (err < 0)
+		return err;
+
+	err = grate_texture_load_internal(grate, &tex, path, false,
+					  tex->pixbuf->format,
+					  tex->pixbuf->layout);
+	grate_trace_cpu(grate, "texture load", start);
+
+	if (!err)
+		grate_texture_residency_add(grate, tex, path);
+
+	return err;
 }
 
 struct grate_texture *grate_create_texture2(struct grate *grate,
@@ -261,31 +597,73 @@ struct grate_texture *grate_create_texture2(struct grate *grate,
 					    enum pixel_format format,
 					    enum layout_format layout)
 {
+	uint64_t start = grate_trace_now(grate);
 	struct grate_texture *tex;
 	int err;
 
 	err = grate_texture_load_internal(grate, &tex, path, true,
 					  format, layout);
+	grate_trace_cpu(grate, "texture load", start);
 	if (err)
 		return NULL;
 
+	grate_texture_residency_add(grate, tex, path);
+
 	return tex;
 }
 
+/* the caller may modify the pixbuf, so the texture stays resident */
 struct host1x_pixelbuffer *grate_texture_pixbuf(struct grate_texture *tex)
 {
+	if (grate_texture_make_resident(tex, true) < 0)
+		return NULL;
+
+	if (host1x_pixelbuffer_populate(tex->pixbuf) < 0)
+		return NULL;
+
 	return tex->pixbuf;
 }
 
 void grate_texture_free(struct grate_texture *tex)
 {
-	host1x_pixelbuffer_free(tex->pixbuf);
+	/* shared textures go with their last reference */
+	if (tex->shared && !grate_texture_unshare(tex))
+		return;
+
+	if (tex->resident)
+		grate_texture_residency_remove(tex);
+
+	grate_texture_stream_wait(tex);
+
+	/* evicted textures have no pixbuf */
+	if (tex->pixbuf)
+		host1x_pixelbuffer_free(tex->pixbuf);
+
 	free(tex);
 }
 
+void grate_set_etc1_quality(struct grate *grate,
+			    enum grate_etc1_quality quality)
+{
+	grate->etc1_quality = quality;
+}
+
+void grate_set_dxt_quality(struct grate *grate,
+			   enum grate_dxt_quality quality)
+{
+	grate->dxt_quality = quality;
+}
+
+/* PSNR of the last lossy ETC1 load, 0 if the texture wasn't ETC1-encoded */
+float grate_texture_psnr(struct grate_texture *tex)
+{
+	return tex->psnr;
+}
+
 void grate_texture_set_max_lod(struct grate_texture *tex, unsigned max_lod)
 {
 	tex->max_lod = max_lod;
+	tex->version++;
 }
 
 void grate_texture_set_wrap_s(struct grate_texture *tex,
@@ -305,6 +683,8 @@ void grate_texture_set_wrap_s(struct grate_texture *tex,
 		tex->wrap_s_mirrored_repeat = false;
 		break;
 	}
+
+	tex->version++;
 }
 
 void grate_texture_set_wrap_t(struct grate_texture *tex,
@@ -324,6 +704,8 @@ void grate_texture_set_wrap_t(struct grate_texture *tex,
 		tex->wrap_t_mirrored_repeat = false;
 		break;
 	}
+
+	tex->version++;
 }
 
 void grate_texture_set_min_filter(struct grate_texture *tex,
@@ -361,6 +743,8 @@ void grate_texture_set_min_filter(struct grate_texture *tex,
 		tex->mipmap_enabled = true;
 		break;
 	}
+
+	tex->version++;
 }
 
 void grate_texture_set_mag_filter(struct grate_texture *tex,
@@ -376,6 +760,44 @@ void grate_texture_set_mag_filter(struct grate_texture *tex,
 	default:
 		grate_error("Invalid filter: %d\n", filter);
 	}
+
+	tex->version++;
+}
+
+struct grate_sampler *grate_sampler_create(
+				enum grate_textute_wrap_mode wrap_s,
+				enum grate_textute_wrap_mode wrap_t,
+				enum grate_textute_filter min_filter,
+				enum grate_textute_filter mag_filter)
+{
+	struct grate_texture tex = { 0 };
+	struct grate_sampler *sampler;
+
+	if (mag_filter != GRATE_TEXTURE_NEAREST &&
+	    mag_filter != GRATE_TEXTURE_LINEAR) {
+		grate_error("Invalid filter: %d\n", mag_filter);
+		return NULL;
+	}
+
+	sampler = calloc(1, sizeof(*sampler));
+	if (!sampler)
+		return NULL;
+
+	/* same translation as the settings of a texture */
+	grate_texture_set_wrap_s(&tex, wrap_s);
+	grate_texture_set_wrap_t(&tex, wrap_t);
+	grate_texture_set_min_filter(&tex, min_filter);
+	grate_texture_set_mag_filter(&tex, mag_filter);
+
+	sampler->desc1 = grate_3d_encode_sampler_desc(&tex);
+	sampler->mipmap_enabled = tex.mipmap_enabled;
+
+	return sampler;
+}
+
+void grate_sampler_free(struct grate_sampler *sampler)
+{
+	free(sampler);
 }
 
 void grate_texture_clear(struct grate *grate, struct grate_texture *tex,
@@ -384,6 +806,10 @@ void grate_texture_clear(struct grate *grate, struct grate_texture *tex,
 	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
 	int err;
 
+	err = grate_texture_make_resident(tex, true);
+	if (err < 0)
+		return;
+
 	err = host1x_gr2d_clear(gr2d, tex->pixbuf, color);
 	if (err < 0)
 		grate_error("host1x_gr2d_clear() failed: %d\n", err);
@@ -394,23 +820,97 @@ void grate_texture_clear_rect(struct grate *grate, struct grate_texture *tex,
 			      unsigned width, unsigned height)
 {
 	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
+	uint64_t start = grate_trace_now(grate);
 	int err;
 
+	err = grate_texture_make_resident(tex, true);
+	if (err < 0)
+		return;
+
 	err = host1x_gr2d_clear_rect(gr2d, tex->pixbuf, color,
 				     x, y, width, height);
 	if (err < 0)
 		grate_error("host1x_gr2d_clear() failed: %d\n", err);
+
+	grate_trace_cpu(grate, "gr2d clear", start);
+}
+
+static void grate_texture_fence_init(struct grate_fence *fence,
+				     struct host1x_gr2d *gr2d,
+				     struct grate_texture *tex,
+				     uint32_t value)
+{
+	fence->client = gr2d->client;
+	fence->pixbufs[0] = tex->pixbuf;
+	fence->num_pixbufs = 1;
+	fence->value = value;
+	fence->signaled = false;
+}
+
+/*
+ * The asynchronous GR2D operations may be waited for by GR3D using
+ * grate_3d_wait_fence(), without stalling the CPU.
+ */
+int grate_texture_clear_rect_async(struct grate *grate,
+				   struct grate_texture *tex,
+				   uint32_t color, unsigned x, unsigned y,
+				   unsigned width, unsigned height,
+				   struct grate_fence *fence)
+{
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
+	uint32_t value;
+	int err;
+
+	err = grate_texture_make_resident(tex, true);
+	if (err < 0)
+		return err;
+
+	err = host1x_gr2d_clear_rect_async(gr2d, tex->pixbuf, color,
+					   x, y, width, height, &value);
+	if (err < 0) {
+		grate_error("host1x_gr2d_clear_rect_async() failed: %d\n", err);
+		return err;
+	}
+
+	grate_texture_fence_init(fence, gr2d, tex, value);
+
+	return 0;
+}
+
+/* mip levels of compressed formats are stored in rows of texel blocks */
+static unsigned lod_pitch(enum pixel_format format, unsigned width)
+{
+	unsigned tw = PIX_BUF_FORMAT_TEXEL_WIDTH(format);
+
+	return ALIGN((width + tw - 1) / tw * PIX_BUF_FORMAT_BYTES(format), 16);
+}
+
+static unsigned lod_size(enum pixel_format format, unsigned width,
+			 unsigned height, unsigned *pitch)
+{
+	unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(format);
+	unsigned lpitch = lod_pitch(format, width);
+
+	if (pitch)
+		*pitch = lpitch;
+
+	return lpitch * ((height + th - 1) / th);
 }
 
 static int alloc_mipmap(struct grate *grate, struct grate_texture *tex)
 {
-	struct host1x_pixelbuffer *pixbuf = tex->pixbuf;
+	struct host1x_pixelbuffer *pixbuf;
 	struct host1x_bo *bo;
 	unsigned log2_width, log2_height;
 	unsigned lod, lod_levels, size;
-	unsigned w, h, bpp;
+	unsigned w, h;
+
+	/* the levels are derived from the content or replace it */
+	if (grate_texture_make_resident(tex, true) < 0)
+		return -1;
 
-	if (!tex->pixbuf)
+	pixbuf = tex->pixbuf;
+	if (!pixbuf)
 		return -1;
 
 	if (tex->mipmap_pixbuf)
@@ -424,8 +924,6 @@ static int alloc_mipmap(struct grate *grate, struct grate_texture *tex)
 	grate_info("Texture size w: %u h: %u max LOD %u\n",
 		   pixbuf->width, pixbuf->height, lod_levels);
 
-	bpp = PIX_BUF_FORMAT_BYTES(pixbuf->format);
-
 	for (size = 0, lod = 0; lod <= lod_levels; lod++) {
 		w = MAX(1 << log2_width >> lod, 1);
 		h = MAX(1 << log2_height >> lod, 1);
@@ -433,13 +931,15 @@ static int alloc_mipmap(struct grate *grate, struct grate_texture *tex)
 		grate_info("LOD %u w: %u h: %u\toffset 0x%08X\n",
 			   lod, w, h, size);
 
-		size += ALIGN(w * bpp, 16) * h;
+		size += lod_size(pixbuf->format, w, h, NULL);
 	}
 
 	if (!host1x_pixelbuffer_bo_guard_disabled())
 		size += PIXBUF_GUARD_AREA_SIZE * 2;
 
-	bo = HOST1X_BO_CREATE(grate->host1x, size, NVHOST_BO_FLAG_FRAMEBUFFER);
+	bo = HOST1X_BO_CREATE(grate->host1x, size,
+			      NVHOST_BO_FLAG_FRAMEBUFFER |
+			      HOST1X_BO_CATEGORY(HOST1X_MEM_TEXTURE));
 	if (!bo)
 		return -1;
 
@@ -453,11 +953,13 @@ static int alloc_mipmap(struct grate *grate, struct grate_texture *tex)
 	tex->mipmap_pixbuf->bo     = bo;
 	tex->mipmap_pixbuf->width  = 1 << log2_width;
 	tex->mipmap_pixbuf->height = 1 << log2_height;
-	tex->mipmap_pixbuf->pitch  = tex->mipmap_pixbuf->width * bpp;
+	tex->mipmap_pixbuf->pitch  = lod_pitch(pixbuf->format,
+					       tex->mipmap_pixbuf->width);
 	tex->mipmap_pixbuf->format = pixbuf->format;
 	tex->mipmap_pixbuf->layout = pixbuf->layout;
 
 	tex->max_lod = lod_levels;
+	tex->version++;
 
 	host1x_pixelbuffer_setup_guard(tex->mipmap_pixbuf);
 
@@ -470,17 +972,15 @@ static void setup_lod_pixbuf(struct host1x_pixelbuffer *mipmap,
 {
 	unsigned long offset = 0;
 	unsigned long size = 0;
-	unsigned w, h, bpp;
+	unsigned w, h, pitch;
 	unsigned i;
 
 	memset(dst, 0, sizeof(*dst));
 
-	bpp = PIX_BUF_FORMAT_BYTES(mipmap->format);
-
 	for (i = 0; i <= level; i++) {
 		w = MAX(mipmap->width >> i, 1);
 		h = MAX(mipmap->height >> i, 1);
-		size = ALIGN(w * bpp, 16) * h;
+		size = lod_size(mipmap->format, w, h, &pitch);
 		offset += size;
 	}
 
@@ -489,64 +989,240 @@ static void setup_lod_pixbuf(struct host1x_pixelbuffer *mipmap,
 	dst->layout = mipmap->layout;
 	dst->width  = MAX(mipmap->width >> level, 1);
 	dst->height = MAX(mipmap->height >> level, 1);
-	dst->pitch  = ALIGN(dst->width * bpp, 16);
+	dst->pitch  = pitch;
 
 	assert(dst->bo != NULL);
 }
 
-int grate_texture_generate_mipmap(struct grate *grate,
-				  struct grate_texture *tex)
+/*
+ * The whole chain is recorded into a single GR2D batch, each level being
+ * downscaled from the previous one. GR2D executes the blits in-order, so
+ * the chain completes behind the single returned fence.
+ */
+int grate_texture_generate_mipmap_async(struct grate *grate,
+					struct grate_texture *tex,
+					struct grate_fence *fence)
 {
 	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
-	struct host1x_pixelbuffer *pixbuf = tex->pixbuf;
-	struct host1x_pixelbuffer src_pixbuf, dst_pixbuf;
-	int lod;
+	struct host1x_pixelbuffer lods[GRATE_TEXTURE_MAX_LEVELS];
+	struct host1x_pixelbuffer *pixbuf;
+	struct host1x_gr2d_batch batch;
+	unsigned lod, num_lods;
+	uint32_t value;
 	int err;
 
 	err = alloc_mipmap(grate, tex);
 	if (err)
 		return err;
 
-	/* Setup base level. */
-	setup_lod_pixbuf(tex->mipmap_pixbuf, &dst_pixbuf, 0);
+	pixbuf = tex->pixbuf;
+
+	num_lods = MIN(tex->max_lod + 1, GRATE_TEXTURE_MAX_LEVELS);
+
+	err = host1x_gr2d_batch_begin(gr2d, &batch);
+	if (err < 0)
+		return err;
+
+	/* the level BOs must stay alive until the batch is submitted */
+	for (lod = 0; lod < num_lods; lod++)
+		setup_lod_pixbuf(tex->mipmap_pixbuf, &lods[lod], lod);
 
+	/* Setup base level. */
 	/* XXX: GR2D can't handle all possible scale ratios? */
-	err = host1x_gr2d_surface_blit(gr2d, pixbuf, &dst_pixbuf,
-				       0, 0,
-				       pixbuf->width,
-				       pixbuf->height,
-				       0, 0,
-				       dst_pixbuf.width,
-				       dst_pixbuf.height);
-	host1x_bo_free(dst_pixbuf.bo);
+	err = host1x_gr2d_batch_surface_blit(&batch, pixbuf, &lods[0],
+					     0, 0,
+					     pixbuf->width,
+					     pixbuf->height,
+					     0, 0,
+					     lods[0].width,
+					     lods[0].height);
 
 	/* Setup mip levels. */
-	for (lod = 1; err == 0 && lod <= tex->max_lod; lod++) {
-		setup_lod_pixbuf(tex->mipmap_pixbuf, &src_pixbuf, lod - 1);
-		setup_lod_pixbuf(tex->mipmap_pixbuf, &dst_pixbuf, lod);
-
+	for (lod = 1; err == 0 && lod < num_lods; lod++) {
 		grate_info("LOD %u w: %u h: %u\toffset 0x%08lX -> 0x%08lX\n",
 			   lod,
-			   dst_pixbuf.width,
-			   dst_pixbuf.height,
-			   src_pixbuf.bo->offset,
-			   dst_pixbuf.bo->offset);
-
-		err = host1x_gr2d_surface_blit(gr2d, &src_pixbuf, &dst_pixbuf,
-					       0, 0,
-					       src_pixbuf.width,
-					       src_pixbuf.height,
-					       0, 0,
-					       dst_pixbuf.width,
-					       dst_pixbuf.height);
-		host1x_bo_free(src_pixbuf.bo);
-		host1x_bo_free(dst_pixbuf.bo);
+			   lods[lod].width,
+			   lods[lod].height,
+			   lods[lod - 1].bo->offset,
+			   lods[lod].bo->offset);
+
+		err = host1x_gr2d_batch_surface_blit(&batch, &lods[lod - 1],
+						     &lods[lod],
+						     0, 0,
+						     lods[lod - 1].width,
+						     lods[lod - 1].height,
+						     0, 0,
+						     lods[lod].width,
+						     lods[lod].height);
 	}
 
-	if (err)
-		grate_error("Mipmap generation failed\n");
+	/* levels recorded before a failure are submitted regardless */
+	if (host1x_gr2d_batch_submit(&batch, &value) < 0 && !err)
+		err = -EIO;
 
-	return err;
+	for (lod = 0; lod < num_lods; lod++)
+		host1x_bo_free(lods[lod].bo);
+
+	if (err) {
+		grate_error("Mipmap generation failed\n");
+		return err;
+	}
+
+	grate_texture_fence_init(fence, gr2d, tex, value);
+	fence->pixbufs[0] = tex->mipmap_pixbuf;
+
+	return 0;
+}
+
+int grate_texture_generate_mipmap(struct grate *grate,
+				  struct grate_texture *tex)
+{
+	struct grate_fence fence;
+	int err;
+
+	err = grate_texture_generate_mipmap_async(grate, tex, &fence);
+	if (err)
+		return err;
+
+	return grate_fence_wait(&fence, ~0u);
+}
+
+/*
+ * Upload linear data of the given size to a pixbuf, repacking the rows (of
+ * texel blocks for compressed formats) to the pitch of the pixbuf first.
+ */
+static int grate_texture_upload(struct grate *grate,
+				struct host1x_pixelbuffer *pixbuf,
+				const void *data, unsigned width,
+				unsigned height)
+{
+	unsigned tw = PIX_BUF_FORMAT_TEXEL_WIDTH(pixbuf->format);
+	unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(pixbuf->format);
+	unsigned pitch = (width + tw - 1) / tw *
+			 PIX_BUF_FORMAT_BYTES(pixbuf->format);
+	unsigned rows = (height + th - 1) / th;
+	void *buffer = (void *)data;
+	unsigned i;
+	int err;
+
+	if (pitch != pixbuf->pitch) {
+		buffer = calloc(rows, pixbuf->pitch);
+		if (!buffer)
+			return -ENOMEM;
+
+		for (i = 0; i < rows; i++)
+			memcpy(buffer + i * pixbuf->pitch,
+			       data + i * pitch, pitch);
+	}
+
+	err = host1x_pixelbuffer_load_data(grate->host1x, pixbuf, buffer,
+					   pixbuf->pitch, pixbuf->pitch * rows,
+					   pixbuf->format,
+					   PIX_BUF_LAYOUT_LINEAR);
+	if (buffer != data)
+		free(buffer);
+
+	return err;
+}
+
+static int grate_texture_upload_lod(struct grate *grate,
+				    struct grate_texture *tex,
+				    unsigned level, const void *data,
+				    unsigned width, unsigned height)
+{
+	struct host1x_pixelbuffer dst_pixbuf;
+	int err;
+
+	err = alloc_mipmap(grate, tex);
+	if (err)
+		return err;
+
+	setup_lod_pixbuf(tex->mipmap_pixbuf, &dst_pixbuf,
+			 MIN(level, tex->max_lod));
+
+	if (width != dst_pixbuf.width || height != dst_pixbuf.height) {
+		grate_error("LOD %u is %ux%u, expected %ux%u\n", level,
+			    width, height, dst_pixbuf.width,
+			    dst_pixbuf.height);
+		err = -EINVAL;
+		goto out;
+	}
+
+	grate_info("Loading texture w: %u h: %u to LOD %u\toffset 0x%08lX\n",
+		   dst_pixbuf.width, dst_pixbuf.height, level,
+		   dst_pixbuf.bo->offset);
+
+	err = grate_texture_upload(grate, &dst_pixbuf, data, width, height);
+out:
+	host1x_bo_free(dst_pixbuf.bo);
+
+	return err;
+}
+
+/*
+ * Pre-compressed containers are uploaded as stored, without the vertical
+ * flip that is applied to decoded images, so their data must already be
+ * in bottom-up order.
+ */
+static int grate_texture_load_container(struct grate *grate,
+					struct grate_texture **tex,
+					const char *path, bool create,
+					enum pixel_format format,
+					enum layout_format layout,
+					struct grate_texture_container *container)
+{
+	unsigned width = container->width;
+	unsigned height = container->height;
+	unsigned i;
+	int err;
+
+	if (container->format != format) {
+		grate_error("\"%s\" holds format 0x%08x, 0x%08x requested\n",
+			    path, container->format, format);
+		return -EINVAL;
+	}
+
+	if (create) {
+		*tex = grate_create_texture(grate, width, height, format,
+					    layout);
+		if (!(*tex))
+			return -ENOMEM;
+	} else if ((*tex)->pixbuf->width != width ||
+		   (*tex)->pixbuf->height != height) {
+		grate_error("\"%s\" is %ux%u and can't be scaled to %ux%u\n",
+			    path, width, height, (*tex)->pixbuf->width,
+			    (*tex)->pixbuf->height);
+		return -EINVAL;
+	}
+
+	if (format == PIX_BUF_FMT_ETC1)
+		for (i = 0; i < container->num_levels; i++)
+			grate_etc1_swap(container->levels[i].data,
+					container->levels[i].size);
+
+	err = grate_texture_upload(grate, (*tex)->pixbuf,
+				   container->levels[0].data, width, height);
+	if (err || container->num_levels < 2)
+		return err;
+
+	if ((width & (width - 1)) || (height & (height - 1))) {
+		grate_info("\"%s\" mip levels ignored, size isn't a power of two\n",
+			   path);
+		return 0;
+	}
+
+	for (i = 0; i < container->num_levels; i++) {
+		err = grate_texture_upload_lod(grate, *tex, i,
+					       container->levels[i].data,
+					       MAX(width >> i, 1),
+					       MAX(height >> i, 1));
+		if (err)
+			return err;
+	}
+
+	grate_texture_set_max_lod(*tex, container->num_levels - 1);
+
+	return 0;
 }
 
 int grate_texture_load_miplevel(struct grate *grate,
@@ -561,9 +1237,12 @@ int grate_texture_load_miplevel(struct grate *grate,
 	if (err)
 		return err;
 
+	/* only for the size of the level */
 	setup_lod_pixbuf(tex->mipmap_pixbuf, &dst_pixbuf,
 			 MIN(level, tex->max_lod));
-	ilInit();
+	host1x_bo_free(dst_pixbuf.bo);
+
+	grate_il_init();
 	ilGenImages(1, &ImageTex);
 	ilBindImage(ImageTex);
 	ilLoadImage(path);
@@ -582,23 +1261,27 @@ int grate_texture_load_miplevel(struct grate *grate,
 		goto out;
 	}
 
-	grate_info("Loading texture w: %u h: %u to LOD %u\toffset 0x%08lX\n",
-		   dst_pixbuf.width, dst_pixbuf.height, level,
-		   dst_pixbuf.bo->offset);
-
-	err = host1x_pixelbuffer_load_data(grate->host1x, &dst_pixbuf,
-					   ilGetData(),
-					   ilGetInteger(IL_IMAGE_WIDTH) * 4,
-					   ilGetInteger(IL_IMAGE_SIZE_OF_DATA),
-					   dst_pixbuf.format,
-					   dst_pixbuf.layout);
+	err = grate_texture_upload_lod(grate, tex, level, ilGetData(),
+				       ilGetInteger(IL_IMAGE_WIDTH),
+				       ilGetInteger(IL_IMAGE_HEIGHT));
 out:
-	host1x_bo_free(dst_pixbuf.bo);
 	ilDeleteImage(ImageTex);
 
 	return err;
 }
 
+static int grate_texture_blit_prepare(struct grate_texture *src_tex,
+				      struct grate_texture *dst_tex)
+{
+	int err;
+
+	err = grate_texture_make_resident(src_tex, false);
+	if (err < 0)
+		return err;
+
+	return grate_texture_make_resident(dst_tex, true);
+}
+
 int grate_texture_blit(struct grate *grate,
 		       struct grate_texture *src_tex,
 		       struct grate_texture *dst_tex,
@@ -606,10 +1289,17 @@ int grate_texture_blit(struct grate *grate,
 		       unsigned dx, unsigned dy, unsigned dw, signed dh)
 {
 	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
-	struct host1x_pixelbuffer *src_pixbuf = src_tex->pixbuf;
-	struct host1x_pixelbuffer *dst_pixbuf = dst_tex->pixbuf;
+	struct host1x_pixelbuffer *src_pixbuf, *dst_pixbuf;
+	uint64_t start = grate_trace_now(grate);
 	int err;
 
+	err = grate_texture_blit_prepare(src_tex, dst_tex);
+	if (err < 0)
+		return err;
+
+	src_pixbuf = src_tex->pixbuf;
+	dst_pixbuf = dst_tex->pixbuf;
+
 	if (sw == dw && sh == dh)
 		err = host1x_gr2d_blit(gr2d, src_pixbuf, dst_pixbuf,
 				       sx, sy, dx, dy, dw, dh);
@@ -617,5 +1307,871 @@ int grate_texture_blit(struct grate *grate,
 		err = host1x_gr2d_surface_blit(gr2d, src_pixbuf, dst_pixbuf,
 					       sx, sy, sw, sh, dx, dy, dw, dh);
 
+	grate_trace_cpu(grate, "gr2d blit", start);
+
+	return err;
+}
+
+int grate_texture_blit_async(struct grate *grate,
+			     struct grate_texture *src_tex,
+			     struct grate_texture *dst_tex,
+			     unsigned sx, unsigned sy,
+			     unsigned dx, unsigned dy,
+			     unsigned width, signed height,
+			     struct grate_fence *fence)
+{
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
+	uint32_t value;
+	int err;
+
+	err = grate_texture_blit_prepare(src_tex, dst_tex);
+	if (err < 0)
+		return err;
+
+	err = host1x_gr2d_blit_async(gr2d, src_tex->pixbuf, dst_tex->pixbuf,
+				     sx, sy, dx, dy, width, height, &value);
+	if (err < 0)
+		return err;
+
+	grate_texture_fence_init(fence, gr2d, dst_tex, value);
+
+	return 0;
+}
+
+/*
+ * Uploads the whole texture. The data may be reused straight away, GR2D
+ * blits it out of a staging buffer if it needs to be re-laid out. Fit for
+ * textures that are updated every frame.
+ */
+int grate_texture_upload_async(struct grate *grate,
+			       struct grate_texture *tex,
+			       const void *data, unsigned pitch,
+			       enum layout_format layout,
+			       struct grate_fence *fence)
+{
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
+	struct host1x_pixelbuffer *pixbuf;
+	uint32_t value = 0;
+	unsigned th, rows;
+	int err;
+
+	err = grate_texture_make_resident(tex, true);
+	if (err < 0)
+		return err;
+
+	pixbuf = tex->pixbuf;
+	th = PIX_BUF_FORMAT_TEXEL_HEIGHT(pixbuf->format);
+	rows = pixbuf->height;
+
+	if (PIX_BUF_FORMAT_COMPRESSED(pixbuf->format))
+		rows = (rows + th - 1) / th;
+	else if (layout == PIX_BUF_LAYOUT_TILED_16x16)
+		rows = ALIGN(rows, 16);
+
+	err = host1x_pixelbuffer_load_data_async(grate->host1x, pixbuf,
+						 (void *)data, pitch,
+						 (unsigned long)pitch * rows,
+						 pixbuf->format, layout,
+						 &value);
+	if (err < 0)
+		return err;
+
+	grate_texture_fence_init(fence, gr2d, tex, value);
+	fence->signaled = !err;
+
+	return 0;
+}
+
+/*
+ * Converts RGBA8888 data into the format of the texture, optionally with
+ * premultiplied alpha, and uploads it like grate_texture_upload_async().
+ */
+int grate_texture_upload_rgba(struct grate *grate,
+			      struct grate_texture *tex,
+			      const void *data, unsigned pitch,
+			      bool premultiply,
+			      struct grate_fence *fence)
+{
+	struct host1x_pixelbuffer *pixbuf;
+	unsigned bpp, dst_pitch;
+	void *converted;
+	int err;
+
+	err = grate_texture_make_resident(tex, true);
+	if (err < 0)
+		return err;
+
+	pixbuf = tex->pixbuf;
+	bpp = PIX_BUF_FORMAT_BYTES(pixbuf->format);
+	dst_pitch = pixbuf->width * bpp;
+
+	if (!grate_convert_supported(pixbuf->format)) {
+		grate_error("Invalid format %u\n", pixbuf->format);
+		return -EINVAL;
+	}
+
+	converted = malloc((size_t)dst_pitch * pixbuf->height);
+	if (!converted)
+		return -ENOMEM;
+
+	grate_convert_rgba(pixbuf->format, premultiply, data, pitch,
+			   converted, dst_pitch, pixbuf->width,
+			   pixbuf->height);
+
+	/* the data is staged, it may be freed before the blit is done */
+	err = grate_texture_upload_async(grate, tex, converted, dst_pitch,
+					 PIX_BUF_LAYOUT_LINEAR, fence);
+	free(converted);
+
+	return err;
+}
+
+/*
+ * Streamed textures. The full mip chain is allocated up front and the
+ * levels are uploaded from the smallest to the largest by a background
+ * thread. GR3D has no base level clamp, so until the chain is complete
+ * draws sample a view of the chain that starts at the finest uploaded
+ * level. The thread only writes to CPU mappings, GR2D isn't used by it.
+ */
+
+struct grate_texture_stream_level {
+	void *data;		/* linear source data, owned or borrowed */
+	bool owned;
+	unsigned width;
+	unsigned height;
+	unsigned long offset;	/* within the mipmap BO */
+	unsigned pitch;
+};
+
+struct grate_texture_stream {
+	struct grate_texture *tex;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	bool started;
+
+	struct grate_texture_container container;
+	struct grate_texture_stream_level levels[GRATE_TEXTURE_MAX_LEVELS];
+	unsigned num_levels;
+	unsigned pixel_size;	/* of decoded source data, 0 if pre-encoded */
+	int etc1_quality;
+	void *mipmap_map;
+	void *base_map;
+
+	unsigned ready_lod;	/* finest uploaded level */
+	int error;
+};
+
+static unsigned long lod_offset(struct host1x_pixelbuffer *mipmap,
+				unsigned level)
+{
+	unsigned long offset = 0;
+	unsigned i;
+
+	for (i = 0; i < level; i++)
+		offset += lod_size(mipmap->format,
+				   MAX(mipmap->width >> i, 1),
+				   MAX(mipmap->height >> i, 1), NULL);
+
+	return offset;
+}
+
+/* 2x2 box filter of a decoded level */
+static void *grate_texture_downscale(const uint8_t *src, unsigned width,
+				     unsigned height, unsigned pixel_size)
+{
+	unsigned dst_width = MAX(width >> 1, 1);
+	unsigned dst_height = MAX(height >> 1, 1);
+	unsigned x, y, c;
+	uint8_t *dst;
+
+	dst = malloc(dst_width * dst_height * pixel_size);
+	if (!dst)
+		return NULL;
+
+	for (y = 0; y < dst_height; y++) {
+		const uint8_t *row0 = src + MIN(y * 2, height - 1) *
+					    width * pixel_size;
+		const uint8_t *row1 = src + MIN(y * 2 + 1, height - 1) *
+					    width * pixel_size;
+
+		for (x = 0; x < dst_width; x++) {
+			unsigned x0 = MIN(x * 2, width - 1) * pixel_size;
+			unsigned x1 = MIN(x * 2 + 1, width - 1) * pixel_size;
+			uint8_t *p = dst + (y * dst_width + x) * pixel_size;
+
+			for (c = 0; c < pixel_size; c++)
+				p[c] = (row0[x0 + c] + row0[x1 + c] +
+					row1[x0 + c] + row1[x1 + c] + 2) >> 2;
+		}
+	}
+
+	return dst;
+}
+
+static int grate_texture_stream_write(struct grate_texture_stream *stream,
+				      void *map, unsigned long offset,
+				      unsigned pitch,
+				      struct grate_texture_stream_level *level)
+{
+	struct host1x_pixelbuffer *mipmap = stream->tex->mipmap_pixbuf;
+	enum pixel_format format = mipmap->format;
+	unsigned tw = PIX_BUF_FORMAT_TEXEL_WIDTH(format);
+	unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(format);
+	unsigned src_pitch = (level->width + tw - 1) / tw *
+			     PIX_BUF_FORMAT_BYTES(format);
+	unsigned rows = (level->height + th - 1) / th;
+	uint8_t *data = level->data;
+	uint8_t *encoded = NULL;
+	unsigned i;
+
+	if (format == PIX_BUF_FMT_ETC1 && stream->pixel_size) {
+		size_t size = etc1_get_encoded_data_size(level->width,
+							 level->height);
+
+		encoded = malloc(size);
+		if (!encoded)
+			return -ENOMEM;
+
+		if (etc1_encode_image_quality(level->data, level->width,
+					      level->height, 3,
+					      level->width * 3, encoded,
+					      stream->etc1_quality)) {
+			free(encoded);
+			return -EINVAL;
+		}
+
+		grate_etc1_swap(encoded, size);
+		data = encoded;
+	}
+
+	for (i = 0; i < rows; i++)
+		memcpy((uint8_t *)map + offset + i * pitch,
+		       data + i * src_pitch, src_pitch);
+
+	free(encoded);
+
+	return 0;
+}
+
+static int grate_texture_stream_upload(struct grate_texture_stream *stream,
+				       unsigned lod)
+{
+	struct grate_texture *tex = stream->tex;
+	struct grate_texture_stream_level *level = &stream->levels[lod];
+	struct host1x_bo *bo = tex->mipmap_pixbuf->bo;
+	int err;
+
+	err = grate_texture_stream_write(stream, stream->mipmap_map,
+					 bo->offset + level->offset,
+					 level->pitch, level);
+	if (err)
+		return err;
+
+	err = HOST1X_BO_FLUSH(bo, bo->offset + level->offset,
+			      lod_size(tex->mipmap_pixbuf->format,
+				       level->width, level->height, NULL));
+	if (err)
+		return err;
+
+	/* the finest level goes to the base pixbuf as well */
+	if (lod == 0) {
+		bo = tex->pixbuf->bo;
+
+		err = grate_texture_stream_write(stream, stream->base_map,
+						 bo->offset,
+						 tex->pixbuf->pitch, level);
+		if (err)
+			return err;
+
+		err = HOST1X_BO_FLUSH(bo, bo->offset, bo->size);
+	}
+
+	return err;
+}
+
+static void *grate_texture_stream_thread(void *data)
+{
+	struct grate_texture_stream *stream = data;
+	int lod, err = 0;
+
+	for (lod = stream->num_levels - 2; lod >= 0; lod--) {
+		err = grate_texture_stream_upload(stream, lod);
+		if (err)
+			break;
+
+		pthread_mutex_lock(&stream->lock);
+		stream->ready_lod = lod;
+		pthread_mutex_unlock(&stream->lock);
+	}
+
+	pthread_mutex_lock(&stream->lock);
+	stream->error = err;
+	pthread_mutex_unlock(&stream->lock);
+
+	return NULL;
+}
+
+static void grate_texture_stream_free(struct grate_texture_stream *stream)
+{
+	unsigned i;
+
+	for (i = 0; i < stream->num_levels; i++)
+		if (stream->levels[i].owned)
+			free(stream->levels[i].data);
+
+	grate_texture_container_close(&stream->container);
+	pthread_mutex_destroy(&stream->lock);
+	free(stream);
+}
+
+/* decode an image with DevIL into bottom-up linear RGB(A) data */
+void *grate_texture_decode(const char *path, bool alpha,
+			   unsigned *width, unsigned *height)
+{
+	ILuint ImageTex;
+	void *data = NULL;
+	size_t size;
+	int err;
+
+	grate_il_init();
+	pthread_mutex_lock(&grate_il_lock);
+	ilGenImages(1, &ImageTex);
+	ilBindImage(ImageTex);
+	ilLoadImage(path);
+	ilConvertImage(alpha ? IL_RGBA : IL_RGB, IL_UNSIGNED_BYTE);
+	iluRotate(180.0f);
+
+	err = ilGetError();
+	if (err != IL_NO_ERROR) {
+		grate_error("\"%s\" load failed 0x%04X\n", path, err);
+		goto out;
+	}
+
+	*width = ilGetInteger(IL_IMAGE_WIDTH);
+	*height = ilGetInteger(IL_IMAGE_HEIGHT);
+	size = ilGetInteger(IL_IMAGE_SIZE_OF_DATA);
+
+	data = malloc(size);
+	if (data)
+		memcpy(data, ilGetData(), size);
+out:
+	ilDeleteImage(ImageTex);
+	pthread_mutex_unlock(&grate_il_lock);
+
+	return data;
+}
+
+static int grate_texture_stream_setup(struct grate *grate,
+				      struct grate_texture_stream *stream,
+				      const char *path,
+				      enum pixel_format format,
+				      unsigned *width, unsigned *height)
+{
+	struct grate_texture_container *container = &stream->container;
+	unsigned i, levels;
+	int err;
+
+	err = grate_texture_container_open(path, container);
+	if (err == 0) {
+		if (container->format != format)
+			return -ENOTSUP;
+
+		*width = container->width;
+		*height = container->height;
+		levels = log2_size(MAX(*width, *height)) + 1;
+
+		/* the full chain is needed to stream */
+		if (container->num_levels < levels)
+			return -ENOTSUP;
+
+		if (format == PIX_BUF_FMT_ETC1)
+			for (i = 0; i < levels; i++)
+				grate_etc1_swap(container->levels[i].data,
+						container->levels[i].size);
+
+		for (i = 0; i < levels; i++)
+			stream->levels[i].data = container->levels[i].data;
+
+		stream->num_levels = levels;
+
+		return 0;
+	}
+
+	if (err != -ENOTSUP)
+		return err;
+
+	/* DXT encoding by DevIL can't run off the calling thread */
+	switch (format) {
+	case PIX_BUF_FMT_RGBA8888:
+		stream->pixel_size = 4;
+		break;
+	case PIX_BUF_FMT_ETC1:
+		stream->pixel_size = 3;
+		stream->etc1_quality = grate_etc1_quality(grate);
+		break;
+	default:
+		return -ENOTSUP;
+	}
+
+	stream->levels[0].data = grate_texture_decode(path,
+						stream->pixel_size == 4,
+						width, height);
+	if (!stream->levels[0].data)
+		return -EINVAL;
+
+	stream->levels[0].owned = true;
+	stream->num_levels = 1;
+	levels = log2_size(MAX(*width, *height)) + 1;
+
+	if (levels > GRATE_TEXTURE_MAX_LEVELS)
+		return -ENOTSUP;
+
+	for (i = 1; i < levels; i++) {
+		stream->levels[i].data = grate_texture_downscale(
+					stream->levels[i - 1].data,
+					MAX(*width >> (i - 1), 1),
+					MAX(*height >> (i - 1), 1),
+					stream->pixel_size);
+		if (!stream->levels[i].data) {
+			stream->num_levels = i;
+			return -ENOMEM;
+		}
+
+		stream->levels[i].owned = true;
+	}
+
+	stream->num_levels = levels;
+
+	return 0;
+}
+
+/*
+ * Create a texture whose mip levels are uploaded in the background, the
+ * smallest level is available once this returns. Pre-compressed containers
+ * with a full mip chain and RGBA8888 or ETC1 textures of power-of-two size
+ * are streamed; anything else is loaded synchronously.
+ */
+struct grate_texture *grate_create_texture_streamed(struct grate *grate,
+						    const char *path,
+						    enum pixel_format format,
+						    enum layout_format layout)
+{
+	struct grate_texture_stream *stream;
+	struct grate_texture *tex = NULL;
+	unsigned width, height, i;
+	int err;
+
+	/* rows arrive one chunk after another, which needs linear layout */
+	if (layout == PIX_BUF_LAYOUT_AUTO)
+		layout = PIX_BUF_LAYOUT_LINEAR;
+
+	if (layout != PIX_BUF_LAYOUT_LINEAR)
+		return grate_create_texture2(grate, path, format, layout);
+
+	stream = calloc(1, sizeof(*stream));
+	if (!stream)
+		return NULL;
+
+	pthread_mutex_init(&stream->lock, NULL);
+
+	err = grate_texture_stream_setup(grate, stream, path, format,
+					 &width, &height);
+	if (err == 0 && ((width & (width - 1)) || (height & (height - 1))))
+		err = -ENOTSUP;
+
+	if (err == -ENOTSUP) {
+		grate_info("\"%s\" can't be streamed, loading it\n", path);
+		grate_texture_stream_free(stream);
+		return grate_create_texture2(grate, path, format, layout);
+	}
+
+	if (err)
+		goto fail;
+
+	tex = grate_create_texture(grate, width, height, format, layout);
+	if (!tex)
+		goto fail;
+
+	err = alloc_mipmap(grate, tex);
+	if (err)
+		goto fail;
+
+	err = HOST1X_BO_MMAP(tex->mipmap_pixbuf->bo, &stream->mipmap_map);
+	if (err)
+		goto fail;
+
+	err = host1x_pixelbuffer_populate(tex->pixbuf);
+	if (err)
+		goto fail;
+
+	err = HOST1X_BO_MMAP(tex->pixbuf->bo, &stream->base_map);
+	if (err)
+		goto fail;
+
+	for (i = 0; i < stream->num_levels; i++) {
+		stream->levels[i].width = MAX(width >> i, 1);
+		stream->levels[i].height = MAX(height >> i, 1);
+		stream->levels[i].offset = lod_offset(tex->mipmap_pixbuf, i);
+		stream->levels[i].pitch = lod_pitch(format,
+						    stream->levels[i].width);
+	}
+
+	stream->tex = tex;
+
+	/* the smallest level is uploaded right away */
+	err = grate_texture_stream_upload(stream, stream->num_levels - 1);
+	if (err)
+		goto fail;
+
+	stream->ready_lod = stream->num_levels - 1;
+
+	tex->stream = stream;
+	tex->base_lod = stream->ready_lod;
+	tex->base_offset = stream->levels[tex->base_lod].offset;
+	tex->version++;
+
+	if (stream->num_levels > 1) {
+		err = pthread_create(&stream->thread, NULL,
+				     grate_texture_stream_thread, stream);
+		if (err) {
+			grate_error("failed to create stream thread: %d\n",
+				    err);
+			tex->stream = NULL;
+			goto fail;
+		}
+
+		stream->started = true;
+	}
+
+	return tex;
+
+fail:
+	grate_error("failed to stream \"%s\"\n", path);
+	grate_texture_stream_free(stream);
+	if (tex)
+		grate_texture_free(tex);
+
+	return NULL;
+}
+
+/*
+ * Make the levels uploaded so far visible to draws. Called on every draw
+ * that uses the texture, returns the streaming error if there was one.
+ */
+int grate_texture_stream_update(struct grate_texture *tex)
+{
+	struct grate_texture_stream *stream = tex->stream;
+	unsigned lod;
+	int err;
+
+	if (!stream)
+		return 0;
+
+	pthread_mutex_lock(&stream->lock);
+	lod = stream->ready_lod;
+	err = stream->error;
+	pthread_mutex_unlock(&stream->lock);
+
+	if (lod != tex->base_lod) {
+		tex->base_lod = lod;
+		tex->base_offset = stream->levels[lod].offset;
+		tex->version++;
+	}
+
+	if (lod == 0 || err) {
+		if (stream->started)
+			pthread_join(stream->thread, NULL);
+
+		grate_texture_stream_free(stream);
+		tex->stream = NULL;
+	}
+
+	return err;
+}
+
+/* Wait for all levels of a streamed texture to be uploaded. */
+int grate_texture_stream_wait(struct grate_texture *tex)
+{
+	struct grate_texture_stream *stream = tex->stream;
+
+	if (!stream)
+		return 0;
+
+	if (stream->started) {
+		pthread_join(stream->thread, NULL);
+		stream->started = false;
+	}
+
+	return grate_texture_stream_update(tex);
+}
+
+struct grate_texture_load_job {
+	const char *path;
+	uint64_t cache_key;
+	bool cache;
+	bool sync;
+
+	void *data;
+	unsigned width;
+	unsigned height;
+	unsigned pitch;
+	size_t size;
+	float psnr;
+	int err;
+};
+
+struct grate_texture_loader {
+	struct grate_texture_load_job *jobs;
+	unsigned count;
+	unsigned next;
+	pthread_mutex_t lock;
+
+	enum pixel_format format;
+	int etc1_quality;
+};
+
+static int grate_texture_load_job_run(struct grate_texture_loader *loader,
+				      struct grate_texture_load_job *job)
+{
+	unsigned width, height, pitch;
+	etc1_byte *etc1_data;
+	size_t size;
+	void *data;
+	int err;
+
+	data = grate_texture_decode(job->path,
+				    loader->format == PIX_BUF_FMT_RGBA8888,
+				    &width, &height);
+	if (!data)
+		return -EINVAL;
+
+	job->width = width;
+	job->height = height;
+
+	if (loader->format == PIX_BUF_FMT_RGBA8888) {
+		job->data = data;
+		job->pitch = width * 4;
+		job->size = job->pitch * height;
+
+		return 0;
+	}
+
+	size = etc1_get_encoded_data_size(width, height);
+	pitch = ALIGN(width, 4) / 4 * 8;
+
+	etc1_data = malloc(size);
+	if (!etc1_data) {
+		free(data);
+		return -ENOMEM;
+	}
+
+	err = etc1_encode_image_quality(data, width, height, 3, width * 3,
+					etc1_data, loader->etc1_quality);
+	if (err) {
+		grate_error("\"%s\" compression failed\n", job->path);
+		free(etc1_data);
+		free(data);
+		return -EINVAL;
+	}
+
+	job->psnr = etc1_compute_psnr(data, etc1_data, width, height, 3,
+				      width * 3);
+	free(data);
+
+	grate_etc1_swap(etc1_data, size);
+
+	job->data = etc1_data;
+	job->pitch = pitch;
+	job->size = size;
+
+	return 0;
+}
+
+static void *grate_texture_loader_thread(void *data)
+{
+	struct grate_texture_loader *loader = data;
+	struct grate_texture_load_job *job;
+
+	while (true) {
+		pthread_mutex_lock(&loader->lock);
+		while (loader->next < loader->count &&
+		       loader->jobs[loader->next].sync)
+			loader->next++;
+
+		job = NULL;
+		if (loader->next < loader->count)
+			job = &loader->jobs[loader->next++];
+		pthread_mutex_unlock(&loader->lock);
+
+		if (!job)
+			break;
+
+		job->err = grate_texture_load_job_run(loader, job);
+	}
+
+	return NULL;
+}
+
+/* containers and cached textures are cheap to load on the calling thread */
+static bool grate_texture_load_job_sync(struct grate *grate,
+					struct grate_texture_load_job *job,
+					enum pixel_format format,
+					enum layout_format layout)
+{
+	struct grate_texture_container container;
+	struct grate_texture_cache_entry entry;
+	int err;
+
+	err = grate_texture_container_open(job->path, &container);
+	if (err != -ENOTSUP) {
+		if (!err)
+			grate_texture_container_close(&container);
+
+		return true;
+	}
+
+	if (!grate->texture_cache)
+		return false;
+
+	err = grate_texture_cache_key(grate, job->path, format, layout,
+				      0, 0, &job->cache_key);
+	if (err < 0)
+		return true;
+
+	err = grate_texture_cache_lookup(grate, job->cache_key, &entry);
+	if (err == 0) {
+		grate_texture_cache_release(&entry);
+		return true;
+	}
+
+	job->cache = true;
+
+	return false;
+}
+
+static struct grate_texture *
+grate_texture_load_job_finish(struct grate *grate,
+			      struct grate_texture_load_job *job,
+			      enum pixel_format format,
+			      enum layout_format layout)
+{
+	struct grate_texture *tex;
+	int err;
+
+	if (job->sync)
+		return grate_create_texture2(grate, job->path, format, layout);
+
+	if (job->err)
+		goto fail;
+
+	tex = grate_create_texture(grate, job->width, job->height,
+				   format, layout);
+	if (!tex)
+		goto fail;
+
+	if (job->cache)
+		grate_texture_cache_store(grate, job->cache_key, format,
+					  job->width, job->height,
+					  job->pitch, job->data, job->size);
+
+	err = host1x_pixelbuffer_load_data(grate->host1x, tex->pixbuf,
+					   job->data, job->pitch, job->size,
+					   format, PIX_BUF_LAYOUT_LINEAR);
+	if (err) {
+		grate_texture_free(tex);
+		goto fail;
+	}
+
+	tex->psnr = job->psnr;
+	grate_info("loaded \"%s\"\n", job->path);
+
+	return tex;
+
+fail:
+	grate_error("failed to load \"%s\"\n", job->path);
+
+	return NULL;
+}
+
+/*
+ * Load a batch of textures. Images are decoded and compressed by a pool of
+ * worker threads, while the texture allocation and upload stay on the
+ * calling thread. DevIL decoding itself is serialized since DevIL has a
+ * single global context, the ETC1 encoding runs in parallel. Textures that
+ * failed to load are set to NULL and the first error is returned.
+ */
+int grate_texture_load_many(struct grate *grate, const char * const *paths,
+			    unsigned count, enum pixel_format format,
+			    enum layout_format layout,
+			    struct grate_texture **textures)
+{
+	pthread_t threads[GRATE_TEXTURE_LOAD_THREADS];
+	uint64_t start = grate_trace_now(grate);
+	struct grate_texture_loader loader;
+	unsigned num_threads = 0, i;
+	bool parallel;
+	long cpus;
+	int err = 0;
+
+	memset(&loader, 0, sizeof(loader));
+
+	loader.jobs = calloc(count, sizeof(*loader.jobs));
+	if (!loader.jobs)
+		return -ENOMEM;
+
+	loader.count = count;
+	loader.format = format;
+	loader.etc1_quality = grate_etc1_quality(grate);
+	pthread_mutex_init(&loader.lock, NULL);
+
+	/* DXT compression is done by DevIL and can't be parallelized */
+	parallel = format == PIX_BUF_FMT_RGBA8888 ||
+		   format == PIX_BUF_FMT_ETC1;
+
+	for (i = 0; i < count; i++) {
+		loader.jobs[i].path = paths[i];
+		loader.jobs[i].sync = !parallel ||
+			grate_texture_load_job_sync(grate, &loader.jobs[i],
+						    format, layout);
+	}
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpus = MIN(MAX(cpus, 1), GRATE_TEXTURE_LOAD_THREADS);
+
+	grate_il_init();
+
+	if (parallel) {
+		for (i = 0; i < MIN((unsigned long)cpus, count); i++) {
+			if (pthread_create(&threads[i], NULL,
+					   grate_texture_loader_thread,
+					   &loader))
+				break;
+
+			num_threads++;
+		}
+
+		/* load on the calling thread if no worker could be started */
+		if (!num_threads)
+			grate_texture_loader_thread(&loader);
+
+		for (i = 0; i < num_threads; i++)
+			pthread_join(threads[i], NULL);
+	}
+
+	for (i = 0; i < count; i++) {
+		textures[i] = grate_texture_load_job_finish(grate,
+							    &loader.jobs[i],
+							    format, layout);
+		if (!textures[i] && !err)
+			err = loader.jobs[i].err ?: -EINVAL;
+
+		free(loader.jobs[i].data);
+	}
+
+	pthread_mutex_destroy(&loader.lock);
+	free(loader.jobs);
+
+	grate_trace_cpu(grate, "texture load many", start);
+
 	return err;
 }
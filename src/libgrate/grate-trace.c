@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Opt-in tracing into the Chrome trace event format, which is readable by
+ * chrome://tracing and the Perfetto UI. CPU-side operations are written as
+ * complete events on the CPU track. Submitted GR3D jobs are put on a GPU
+ * track once their syncpoint is observed as reached, starting from their
+ * submission or from the completion of the previous job, whichever is
+ * later, since jobs execute in order.
+ */
+
+#define GRATE_TRACE_MAX_JOBS	64
+
+#define GRATE_TRACE_TID_CPU	1
+#define GRATE_TRACE_TID_GR3D	2
+
+struct grate_trace_job {
+	uint64_t submitted;
+	uint32_t fence;
+};
+
+struct grate_trace {
+	FILE *fp;
+	uint64_t epoch;
+	int pid;
+
+	struct host1x_client *client;
+	struct grate_trace_job jobs[GRATE_TRACE_MAX_JOBS];
+	unsigned int first_job;
+	unsigned int num_jobs;
+	uint64_t last_done;
+};
+
+static uint64_t grate_trace_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void grate_trace_thread_name(struct grate_trace *trace, int tid,
+				    const char *name)
+{
+	fprintf(trace->fp, "{\"name\":\"thread_name\",\"ph\":\"M\","
+		"\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+		trace->pid, tid, name);
+}
+
+static void grate_trace_event(struct grate_trace *trace, int tid,
+			      const char *name, uint64_t start, uint64_t end)
+{
+	fprintf(trace->fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+		"\"tid\":%d,\"ts\":%llu,\"dur\":%llu},\n", name, trace->pid,
+		tid, (unsigned long long)(start - trace->epoch),
+		(unsigned long long)(end - start));
+}
+
+static int grate_trace_retire(struct grate_trace *trace, bool wait)
+{
+	struct grate_trace_job *job;
+	uint64_t done, start;
+	int err;
+
+	while (trace->num_jobs) {
+		job = &trace->jobs[trace->first_job];
+
+		if (wait) {
+			err = HOST1X_CLIENT_WAIT(trace->client, job->fence,
+						 ~0u);
+			if (err < 0)
+				return err;
+		} else {
+			err = host1x_client_poll(trace->client, job->fence);
+			if (err <= 0)
+				return err;
+		}
+
+		done = grate_trace_clock();
+		start = MAX(job->submitted, trace->last_done);
+		grate_trace_event(trace, GRATE_TRACE_TID_GR3D, "gr3d job",
+				  start, done);
+		trace->last_done = done;
+
+		trace->first_job = (trace->first_job + 1) %
+						GRATE_TRACE_MAX_JOBS;
+		trace->num_jobs--;
+	}
+
+	return 0;
+}
+
+int grate_trace_open(struct grate *grate, const char *path)
+{
+	struct grate_trace *trace;
+	int err;
+
+	trace = calloc(1, sizeof(*trace));
+	if (!trace)
+		return -ENOMEM;
+
+	trace->fp = fopen(path, "w");
+	if (!trace->fp) {
+		err = -errno;
+		grate_error("failed to open %s: %m\n", path);
+		free(trace);
+		return err;
+	}
+
+	trace->epoch = grate_trace_clock();
+	trace->pid = getpid();
+
+	/* a trailing comma and a missing "]" are accepted by the viewers */
+	fprintf(trace->fp, "[\n");
+	grate_trace_thread_name(trace, GRATE_TRACE_TID_CPU, "CPU");
+	grate_trace_thread_name(trace, GRATE_TRACE_TID_GR3D, "GR3D");
+
+	grate->trace = trace;
+
+	return 0;
+}
+
+void grate_trace_close(struct grate *grate)
+{
+	struct grate_trace *trace = grate->trace;
+
+	if (!trace)
+		return;
+
+	grate_trace_retire(trace, true);
+
+	fprintf(trace->fp, "{\"name\":\"end\",\"ph\":\"i\",\"s\":\"g\","
+		"\"pid\":%d,\"tid\":%d,\"ts\":%llu}\n]\n", trace->pid,
+		GRATE_TRACE_TID_CPU,
+		(unsigned long long)(grate_trace_clock() - trace->epoch));
+	fclose(trace->fp);
+	free(trace);
+
+	grate->trace = NULL;
+}
+
+uint64_t grate_trace_now(struct grate *grate)
+{
+	return grate->trace ? grate_trace_clock() : 0;
+}
+
+/* emit a CPU event that started at the time given by grate_trace_now() */
+void grate_trace_cpu(struct grate *grate, const char *name, uint64_t start)
+{
+	if (grate->trace)
+		grate_trace_event(grate->trace, GRATE_TRACE_TID_CPU, name,
+				  start, grate_trace_clock());
+}
+
+void grate_trace_gr3d_job(struct grate *grate, struct host1x_client *client,
+			  uint32_t fence)
+{
+	struct grate_trace *trace = grate->trace;
+	struct grate_trace_job *job;
+	unsigned int index;
+
+	if (!trace)
+		return;
+
+	trace->client = client;
+
+	if (trace->num_jobs)
+		grate_trace_retire(trace, false);
+
+	if (trace->num_jobs == GRATE_TRACE_MAX_JOBS &&
+	    grate_trace_retire(trace, true) < 0)
+		return;
+
+	index = (trace->first_job + trace->num_jobs++) % GRATE_TRACE_MAX_JOBS;
+	job = &trace->jobs[index];
+	job->submitted = grate_trace_clock();
+	job->fence = fence;
+}
+
+/* a counter event with one series per name, stacked by the viewers */
+void grate_trace_counters(struct grate *grate, const char *name,
+			  const char * const *names, const uint64_t *values,
+			  unsigned int count)
+{
+	struct grate_trace *trace = grate->trace;
+	unsigned int i;
+
+	if (!trace)
+		return;
+
+	fprintf(trace->fp, "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":%d,"
+		"\"ts\":%llu,\"args\":{", name, trace->pid,
+		(unsigned long long)(grate_trace_clock() - trace->epoch));
+
+	for (i = 0; i < count; i++)
+		fprintf(trace->fp, "%s\"%s\":%llu", i ? "," : "", names[i],
+			(unsigned long long)values[i]);
+
+	fprintf(trace->fp, "}},\n");
+}
+
+/* observe the completed GR3D jobs without blocking */
+void grate_trace_poll(struct grate *grate)
+{
+	if (grate->trace && grate->trace->num_jobs)
+		grate_trace_retire(grate->trace, false);
+}
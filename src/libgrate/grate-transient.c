@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "../libhost1x/host1x-private.h"
+#include "libgrate-private.h"
+
+#include "grate.h"
+#include "host1x.h"
+
+/*
+ * Transient render targets live only within the passes of a frame, like
+ * depth and stencil buffers or intermediate targets of post-processing.
+ * They are carved out of pooled BOs of the framebuffer kind, a BO is
+ * given to the smallest fitting target and is free for the next one once
+ * the target is put, hence targets of non-overlapping lifetimes alias the
+ * same memory. GR3D executes in order, so its reuse of the memory needs
+ * no synchronisation. GR2D clears of a reused BO wait for the GR3D work
+ * of the previous target, see grate_transient_wait().
+ */
+
+#define GRATE_TRANSIENT_MAX_AGE		60
+
+struct grate_transient {
+	struct list_head list;
+	struct host1x_bo *bo;
+	unsigned long flags;
+	size_t size;
+	/* target carved out of the BO, NULL if the BO is free */
+	struct host1x_pixelbuffer *pixbuf;
+	/* GR3D fence of the work of the last target */
+	uint32_t fence;
+	uint64_t frame;
+};
+
+static struct grate_transient *grate_transient_find(struct grate *grate,
+						    size_t size,
+						    unsigned long flags)
+{
+	struct grate_transient *transient, *found = NULL;
+
+	list_for_each_entry(transient, &grate->transients, list) {
+		if (transient->pixbuf || transient->flags != flags ||
+		    transient->size < size)
+			continue;
+
+		if (!found || transient->size < found->size)
+			found = transient;
+	}
+
+	return found;
+}
+
+static struct grate_transient *grate_transient_create(struct grate *grate,
+						      size_t size,
+						      unsigned long flags)
+{
+	struct grate_transient *transient;
+
+	transient = calloc(1, sizeof(*transient));
+	if (!transient)
+		return NULL;
+
+	transient->bo = HOST1X_BO_CREATE(grate->host1x, size, flags);
+	if (!transient->bo) {
+		free(transient);
+		return NULL;
+	}
+
+	transient->flags = flags;
+	transient->size = size;
+	transient->fence = grate->gr3d_fence;
+	list_add_tail(&transient->list, &grate->transients);
+
+	grate->transient_bytes += size;
+
+	return transient;
+}
+
+/*
+ * Returns a render target that is valid until it is put or the frame is
+ * swapped, whichever comes first. Its content is undefined.
+ */
+struct host1x_pixelbuffer *
+grate_transient_pixbuf_get(struct grate *grate, unsigned width,
+			   unsigned height, enum pixel_format format,
+			   enum layout_format layout)
+{
+	unsigned long flags = NVHOST_BO_FLAG_FRAMEBUFFER |
+			      HOST1X_BO_CREATE_FLAG_BOTTOM_UP;
+	struct grate_transient *transient;
+	struct host1x_pixelbuffer *pixbuf;
+	struct host1x_bo *bo;
+	unsigned pitch, rows = height;
+	size_t size;
+
+	if (layout == PIX_BUF_LAYOUT_AUTO)
+		layout = host1x_pixelbuffer_auto_layout(width, height, format);
+
+	pitch = PIX_BUF_FORMAT_BYTES(format) * width;
+	pitch = ALIGN(pitch, PIX_BUF_FORMAT_ALIGNMENT(format));
+
+	if (layout == PIX_BUF_LAYOUT_TILED_16x16) {
+		flags |= HOST1X_BO_CREATE_FLAG_TILED;
+		pitch = ALIGN(pitch, 256);
+		rows = ALIGN(height, 16);
+	}
+
+	size = (size_t)pitch * rows;
+
+	transient = grate_transient_find(grate, size, flags);
+	if (!transient) {
+		transient = grate_transient_create(grate, size, flags);
+		if (!transient)
+			return NULL;
+	}
+
+	bo = HOST1X_BO_WRAP(transient->bo, 0, size);
+	if (!bo)
+		return NULL;
+
+	pixbuf = host1x_pixelbuffer_wrap(bo, width, height, pitch, format,
+					 layout);
+	if (!pixbuf) {
+		host1x_bo_free(bo);
+		return NULL;
+	}
+
+	transient->pixbuf = pixbuf;
+	transient->frame = grate->frame;
+
+	return pixbuf;
+}
+
+static void grate_transient_release(struct grate *grate,
+				    struct grate_transient *transient)
+{
+	/* the draws of the target must be submitted to have a fence */
+	if (grate_3d_flush_batch(grate) < 0)
+		grate_3d_wait_idle(grate);
+
+	transient->fence = grate->gr3d_fence;
+
+	host1x_pixelbuffer_free(transient->pixbuf);
+	transient->pixbuf = NULL;
+}
+
+/* ends the lifetime of the target, its BO may be given to the next one */
+void grate_transient_pixbuf_put(struct grate *grate,
+				struct host1x_pixelbuffer *pixbuf)
+{
+	struct grate_transient *transient;
+
+	if (!pixbuf)
+		return;
+
+	list_for_each_entry(transient, &grate->transients, list) {
+		if (transient->pixbuf == pixbuf) {
+			grate_transient_release(grate, transient);
+			return;
+		}
+	}
+
+	grate_error("%p isn't a transient pixbuf\n", pixbuf);
+}
+
+/*
+ * GR2D can't wait for GR3D in-stream, hence the CPU waits for the GR3D work
+ * of the previous target of the BO before the BO is written by GR2D. The
+ * targets that aren't cleared by GR2D never wait.
+ */
+void grate_transient_wait(struct grate *grate,
+			  struct host1x_pixelbuffer *pixbuf)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct grate_transient *transient;
+
+	list_for_each_entry(transient, &grate->transients, list) {
+		if (transient->pixbuf == pixbuf) {
+			host1x_client_wait(gr3d->client, transient->fence, ~0u);
+			return;
+		}
+	}
+}
+
+/* the targets are put at the end of the frame, unused BOs are freed */
+void grate_transient_frame_end(struct grate *grate)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct grate_transient *transient, *tmp;
+
+	list_for_each_entry_safe(transient, tmp, &grate->transients, list) {
+		if (transient->pixbuf)
+			grate_transient_release(grate, transient);
+
+		if (grate->frame - transient->frame < GRATE_TRANSIENT_MAX_AGE)
+			continue;
+
+		if (host1x_client_wait(gr3d->client, transient->fence, 0))
+			continue;
+
+		grate->transient_bytes -= transient->size;
+		list_del(&transient->list);
+		host1x_bo_free(transient->bo);
+		free(transient);
+	}
+}
+
+void grate_transient_exit(struct grate *grate)
+{
+	struct grate_transient *transient, *tmp;
+
+	list_for_each_entry_safe(transient, tmp, &grate->transients, list) {
+		if (transient->pixbuf)
+			host1x_pixelbuffer_free(transient->pixbuf);
+
+		list_del(&transient->list);
+		host1x_bo_free(transient->bo);
+		free(transient);
+	}
+
+	grate->transient_bytes = 0;
+}
+
+size_t grate_transient_pool_size(struct grate *grate)
+{
+	return grate->transient_bytes;
+}
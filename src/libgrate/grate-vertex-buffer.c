@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libgrate-private.h"
+#include "tgr_3d.xml.h"
+
+/*
+ * Interleaved vertex buffers. Every attribute is given as floats and gets
+ * the first type of the list below that reproduces all of its values
+ * within the tolerance of the attribute. Attributes are 4-byte aligned
+ * within the vertex, so the types only help as long as the padding
+ * doesn't eat the savings.
+ */
+
+struct grate_vertex_format {
+	unsigned int type;
+	unsigned int bytes;
+	float min;
+	float max;
+	bool normalized;
+};
+
+static const struct grate_vertex_format grate_vertex_formats[] = {
+	{ TGR3D_ATTRIB_TYPE_UBYTE,	1, 0.0f,	255.0f,		false },
+	{ TGR3D_ATTRIB_TYPE_SBYTE,	1, -128.0f,	127.0f,		false },
+	{ TGR3D_ATTRIB_TYPE_UBYTE_NORM,	1, 0.0f,	255.0f,		true },
+	{ TGR3D_ATTRIB_TYPE_SBYTE_NORM,	1, -127.0f,	127.0f,		true },
+	{ TGR3D_ATTRIB_TYPE_USHORT,	2, 0.0f,	65535.0f,	false },
+	{ TGR3D_ATTRIB_TYPE_SSHORT,	2, -32768.0f,	32767.0f,	false },
+	{ TGR3D_ATTRIB_TYPE_USHORT_NORM, 2, 0.0f,	65535.0f,	true },
+	{ TGR3D_ATTRIB_TYPE_SSHORT_NORM, 2, -32767.0f,	32767.0f,	true },
+	{ TGR3D_ATTRIB_TYPE_FLOAT16,	2, 0.0f,	0.0f,		false },
+	{ TGR3D_ATTRIB_TYPE_FLOAT32,	4, 0.0f,	0.0f,		false },
+};
+
+/* IEEE half with round to nearest even, out of range values become inf */
+static uint16_t grate_float_to_half(float f)
+{
+	union {
+		uint32_t u;
+		float f;
+	} value = { .f = f };
+	uint32_t sign = (value.u >> 16) & 0x8000;
+	uint32_t mantissa = value.u & 0x7fffff;
+	int exponent = ((value.u >> 23) & 0xff) - 127 + 15;
+	uint32_t half, round, shift;
+
+	if (((value.u >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+	if (exponent >= 31)
+		return sign | 0x7c00;
+
+	if (exponent <= 0) {
+		if (exponent < -10)
+			return sign;
+
+		mantissa |= 0x800000;
+		shift = 14 - exponent;
+		half = mantissa >> shift;
+		round = mantissa & ((1u << shift) - 1);
+
+		if (round > (1u << (shift - 1)) ||
+		    (round == (1u << (shift - 1)) && (half & 1)))
+			half++;
+
+		return sign | half;
+	}
+
+	half = (exponent << 10) | (mantissa >> 13);
+	round = mantissa & 0x1fff;
+
+	/* a carry into the exponent is still the right result */
+	if (round > 0x1000 || (round == 0x1000 && (half & 1)))
+		half++;
+
+	return sign | half;
+}
+
+static float grate_half_to_float(uint16_t half)
+{
+	unsigned int exponent = (half >> 10) & 0x1f;
+	unsigned int mantissa = half & 0x3ff;
+	float f;
+
+	if (exponent == 0)
+		f = ldexpf(mantissa, -24);
+	else if (exponent == 31)
+		f = mantissa ? NAN : INFINITY;
+	else
+		f = ldexpf(mantissa | 0x400, exponent - 25);
+
+	return (half & 0x8000) ? -f : f;
+}
+
+/* stored value of the component and the value the vertex fetch returns */
+static float grate_vertex_quantize(const struct grate_vertex_format *format,
+				   float value, int32_t *stored)
+{
+	float scaled = value;
+
+	if (format->type == TGR3D_ATTRIB_TYPE_FLOAT32)
+		return value;
+
+	if (format->type == TGR3D_ATTRIB_TYPE_FLOAT16) {
+		*stored = grate_float_to_half(value);
+		return grate_half_to_float(*stored);
+	}
+
+	if (format->normalized)
+		scaled = value * format->max;
+
+	scaled = roundf(scaled);
+	scaled = MIN(MAX(scaled, format->min), format->max);
+	*stored = scaled;
+
+	return format->normalized ? scaled / format->max : scaled;
+}
+
+static const struct grate_vertex_format *
+grate_vertex_choose_format(const struct grate_vertex_attrib_data *attrib,
+			   unsigned int num_vertices)
+{
+	const struct grate_vertex_format *format;
+	unsigned int i, k, count = attrib->size * num_vertices;
+	int32_t stored;
+
+	for (i = 0; i < ARRAY_SIZE(grate_vertex_formats) - 1; i++) {
+		format = &grate_vertex_formats[i];
+
+		for (k = 0; k < count; k++) {
+			float value = attrib->data[k];
+			float error;
+
+			error = grate_vertex_quantize(format, value, &stored);
+			error = fabsf(error - value);
+
+			/* NaNs fail the comparison as well */
+			if (!(error <= attrib->tolerance))
+				break;
+		}
+
+		if (k == count)
+			return format;
+	}
+
+	return &grate_vertex_formats[i];
+}
+
+static void grate_vertex_store(const struct grate_vertex_format *format,
+			       uint8_t *dst, float value)
+{
+	int32_t stored;
+	uint16_t u16;
+
+	if (format->type == TGR3D_ATTRIB_TYPE_FLOAT32) {
+		memcpy(dst, &value, sizeof(value));
+		return;
+	}
+
+	grate_vertex_quantize(format, value, &stored);
+
+	if (format->bytes == 1) {
+		*dst = stored;
+	} else {
+		u16 = stored;
+		memcpy(dst, &u16, sizeof(u16));
+	}
+}
+
+int grate_vertex_buffer_init(struct grate *grate,
+			     struct grate_vertex_buffer *vb,
+			     const struct grate_vertex_attrib_data *attribs,
+			     unsigned int num_attribs,
+			     unsigned int num_vertices)
+{
+	const struct grate_vertex_format *formats[16];
+	unsigned int offset = 0, i, v, c;
+	uint8_t *data;
+	size_t size;
+
+	memset(vb, 0, sizeof(*vb));
+
+	if (num_attribs > ARRAY_SIZE(vb->attribs) || !num_vertices)
+		return -EINVAL;
+
+	for (i = 0; i < num_attribs; i++) {
+		if (attribs[i].size < 1 || attribs[i].size > 4)
+			return -EINVAL;
+
+		/* attributes the program doesn't use aren't stored */
+		if (attribs[i].location < 0)
+			continue;
+
+		formats[vb->num_attribs] =
+			grate_vertex_choose_format(&attribs[i], num_vertices);
+
+		vb->attribs[vb->num_attribs].location = attribs[i].location;
+		vb->attribs[vb->num_attribs].size = attribs[i].size;
+		vb->attribs[vb->num_attribs].type =
+					formats[vb->num_attribs]->type;
+		vb->attribs[vb->num_attribs].offset = offset;
+
+		offset += ALIGN(formats[vb->num_attribs]->bytes *
+				attribs[i].size, 4);
+		vb->num_attribs++;
+	}
+
+	if (!vb->num_attribs)
+		return -EINVAL;
+
+	vb->stride = offset;
+	size = (size_t)vb->stride * num_vertices;
+
+	data = calloc(1, size);
+	if (!data)
+		return -ENOMEM;
+
+	for (i = 0, c = 0; i < num_attribs; i++) {
+		const struct grate_vertex_attrib_data *attrib = &attribs[i];
+		unsigned int bytes, k;
+
+		if (attrib->location < 0)
+			continue;
+
+		bytes = formats[c]->bytes;
+
+		for (v = 0; v < num_vertices; v++) {
+			uint8_t *dst = data + v * vb->stride +
+				       vb->attribs[c].offset;
+
+			for (k = 0; k < attrib->size; k++)
+				grate_vertex_store(formats[c], dst + k * bytes,
+						   attrib->data[v * attrib->size + k]);
+		}
+
+		c++;
+	}
+
+	vb->grate = grate;
+	vb->bo = grate_bo_create_from_data(grate, size,
+					   NVHOST_BO_FLAG_ATTRIBUTES |
+					   HOST1X_BO_MAP_WRITE_COMBINE, data);
+	free(data);
+
+	if (!vb->bo)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void grate_vertex_buffer_release(struct grate_vertex_buffer *vb)
+{
+	if (vb->bo)
+		grate_bo_free(vb->grate, vb->bo);
+
+	vb->bo = NULL;
+}
+
+int grate_3d_ctx_bind_vertex_buffer(struct grate_3d_ctx *ctx,
+				    const struct grate_vertex_buffer *vb)
+{
+	struct host1x_bo_view view;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < vb->num_attribs; i++) {
+		host1x_bo_view_init(&view, vb->bo, vb->attribs[i].offset,
+				    vb->bo->size - vb->attribs[i].offset);
+
+		err = grate_3d_ctx_vertex_attrib_pointer_view(ctx,
+						vb->attribs[i].location,
+						vb->attribs[i].size,
+						vb->attribs[i].type,
+						vb->stride, &view);
+		if (err < 0)
+			return err;
+
+		err = grate_3d_ctx_enable_vertex_attrib_array(ctx,
+						vb->attribs[i].location);
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
@@ -74,7 +74,11 @@ struct host1x_bo *grate_bo_create_from_data(struct grate *grate, size_t size,
 	struct host1x_bo *bo;
 	void *map;
 
-	bo = grate_bo_create_and_map(grate, flags, size, &map);
+	if (size <= GRATE_SUBALLOC_MAX_SIZE)
+		bo = grate_bo_suballoc(grate, size, flags, &map);
+	else
+		bo = grate_bo_create_and_map(grate, flags, size, &map);
+
 	if (!bo)
 		return NULL;
 
@@ -85,6 +89,60 @@ struct host1x_bo *grate_bo_create_from_data(struct grate *grate, size_t size,
 	return bo;
 }
 
+static int grate_parse_fb_format(const char *name, enum pixel_format *format)
+{
+	if (!strcmp(name, "rgb565"))
+		*format = PIX_BUF_FMT_RGB565;
+	else if (!strcmp(name, "rgba5551"))
+		*format = PIX_BUF_FMT_RGBA5551;
+	else if (!strcmp(name, "rgba8888"))
+		*format = PIX_BUF_FMT_RGBA8888;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+static int grate_parse_present_mode(const char *name,
+				    struct grate_options *options)
+{
+	if (!strcmp(name, "immediate"))
+		options->present_mode = GRATE_PRESENT_IMMEDIATE;
+	else if (!strcmp(name, "fifo"))
+		options->present_mode = GRATE_PRESENT_FIFO;
+	else if (!strcmp(name, "mailbox"))
+		options->present_mode = GRATE_PRESENT_MAILBOX;
+	else
+		return -EINVAL;
+
+	options->vsync = options->present_mode != GRATE_PRESENT_IMMEDIATE;
+
+	return 0;
+}
+
+/* sync (the default), async or sample:N to check every Nth guard */
+static int grate_parse_guard(const char *mode, struct grate_options *options)
+{
+	options->pixbuf_guard = true;
+	options->pixbuf_guard_interval = 1;
+
+	if (!mode || !strcmp(mode, "sync")) {
+		options->pixbuf_guard_mode = HOST1X_PIXBUF_GUARD_SYNC;
+	} else if (!strcmp(mode, "async")) {
+		options->pixbuf_guard_mode = HOST1X_PIXBUF_GUARD_ASYNC;
+	} else if (!strncmp(mode, "sample:", 7) && atoi(mode + 7) > 0) {
+		options->pixbuf_guard_mode = HOST1X_PIXBUF_GUARD_SAMPLED;
+		options->pixbuf_guard_interval = atoi(mode + 7);
+	} else if (!strcmp(mode, "off")) {
+		options->pixbuf_guard = false;
+		options->pixbuf_guard_mode = HOST1X_PIXBUF_GUARD_OFF;
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 bool grate_parse_command_line(struct grate_options *options, int argc,
 			      char *argv[])
 {
@@ -95,12 +153,29 @@ bool grate_parse_command_line(struct grate_options *options, int argc,
 		{ "vsync", 0, NULL, 'v' },
 		{ "nodisplay", 0, NULL, 'n' },
 		{ "singlebuffered", 0, NULL, 's' },
-		{ "guard", 0, NULL, 'g' },
+		{ "guard", 2, NULL, 'g' },
 		{ "display", 1, NULL, 'd' },
 		{ "rotate-display-degrees", 1, NULL, 'r' },
+		{ "etc1-quality", 1, NULL, 'e' },
+		{ "dxt-quality", 1, NULL, 'x' },
+		{ "texture-budget", 1, NULL, 'B' },
+		{ "texture-cache", 1, NULL, 'c' },
+		{ "shader-cache", 1, NULL, 'S' },
+		{ "profile-json", 1, NULL, 'j' },
+		{ "trace", 1, NULL, 't' },
+		{ "bench", 1, NULL, 'b' },
+		{ "optimize-pushbufs", 0, NULL, 'o' },
+		{ "model", 0, NULL, 'm' },
+		{ "lazy-init", 0, NULL, 'l' },
+		{ "job-timeout", 1, NULL, 'T' },
+		{ "lazy-pixbufs", 0, NULL, 'P' },
+		{ "fb-format", 1, NULL, 'F' },
+		{ "present", 1, NULL, 'p' },
+		{ "emit-stats", 0, NULL, 'E' },
 		{ /* Sentinel */ },
 	};
-	static const char opts[] = "fw:h:vnsgd:r:";
+	static const char opts[] = "fw:h:vnsg::d:r:e:x:B:c:S:j:t:b:omlT:PF:p:E";
+	const char *fb_format, *guard, *timeout, *present;
 	int opt;
 
 	printf("\nINFO: Available cmdline arguments:\n");
@@ -113,15 +188,47 @@ bool grate_parse_command_line(struct grate_options *options, int argc,
 
 	options->singlebuffered = false;
 	options->pixbuf_guard = false;
+	options->pixbuf_guard_mode = HOST1X_PIXBUF_GUARD_OFF;
+	options->pixbuf_guard_interval = 1;
 	options->fullscreen = false;
 	options->nodisplay = false;
 	options->vsync = false;
+	options->present_mode = GRATE_PRESENT_IMMEDIATE;
 	options->x = 0;
 	options->y = 0;
 	options->width = 256;
 	options->height = 256;
 	options->display_id = -1;
 	options->rotate_display = 0;
+	options->etc1_quality = GRATE_ETC1_QUALITY_HIGH;
+	options->dxt_quality = GRATE_DXT_QUALITY_HIGH;
+	options->texture_budget = 0;
+	options->texture_cache = getenv("GRATE_TEXTURE_CACHE");
+	options->shader_cache = getenv("GRATE_SHADER_CACHE");
+	options->profile_json = getenv("GRATE_PROFILE_JSON");
+	options->trace = getenv("GRATE_TRACE");
+	options->bench_frames = 0;
+	options->optimize_pushbufs = false;
+	options->model = !!getenv("GRATE_MODEL");
+	options->lazy_init = !!getenv("GRATE_LAZY_INIT");
+	options->lazy_pixbufs = !!getenv("GRATE_LAZY_PIXBUFS");
+	options->fb_format = 0;
+	options->emit_stats = !!getenv("GRATE_EMIT_STATS");
+
+	timeout = getenv("GRATE_JOB_TIMEOUT");
+	options->job_timeout = timeout ? strtoul(timeout, NULL, 10) : 0;
+
+	fb_format = getenv("GRATE_FB_FORMAT");
+	if (fb_format && grate_parse_fb_format(fb_format, &options->fb_format))
+		return false;
+
+	present = getenv("GRATE_PRESENT_MODE");
+	if (present && grate_parse_present_mode(present, options))
+		return false;
+
+	guard = getenv("GRATE_PIXBUF_GUARD");
+	if (guard && grate_parse_guard(guard, options))
+		return false;
 
 	while ((opt = getopt_long(argc, argv, opts, long_opts, NULL)) != -1) {
 		switch (opt) {
@@ -138,6 +245,7 @@ bool grate_parse_command_line(struct grate_options *options, int argc,
 			break;
 
 		case 'v':
+			options->present_mode = GRATE_PRESENT_FIFO;
 			options->vsync = true;
 			break;
 
@@ -150,7 +258,8 @@ bool grate_parse_command_line(struct grate_options *options, int argc,
 			break;
 
 		case 'g':
-			options->pixbuf_guard = true;
+			if (grate_parse_guard(optarg, options))
+				return false;
 			break;
 
 		case 'd':
@@ -161,6 +270,93 @@ bool grate_parse_command_line(struct grate_options *options, int argc,
 			options->rotate_display = strtoul(optarg, NULL, 10);
 			break;
 
+		case 'e':
+			if (!strcmp(optarg, "fast"))
+				options->etc1_quality = GRATE_ETC1_QUALITY_FAST;
+			else if (!strcmp(optarg, "medium"))
+				options->etc1_quality = GRATE_ETC1_QUALITY_MEDIUM;
+			else if (!strcmp(optarg, "high"))
+				options->etc1_quality = GRATE_ETC1_QUALITY_HIGH;
+			else
+				return false;
+			break;
+
+		case 'x':
+			if (!strcmp(optarg, "fast"))
+				options->dxt_quality = GRATE_DXT_QUALITY_FAST;
+			else if (!strcmp(optarg, "medium"))
+				options->dxt_quality = GRATE_DXT_QUALITY_MEDIUM;
+			else if (!strcmp(optarg, "high"))
+				options->dxt_quality = GRATE_DXT_QUALITY_HIGH;
+			else
+				return false;
+			break;
+
+		case 'B':
+			options->texture_budget = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'c':
+			options->texture_cache = optarg;
+			break;
+
+		case 'S':
+			options->shader_cache = optarg;
+			break;
+
+		case 'j':
+			options->profile_json = optarg;
+			break;
+
+		case 't':
+			options->trace = optarg;
+			break;
+
+		case 'b':
+			options->bench_frames = strtoul(optarg, NULL, 10);
+
+			/* benchmarks run off-screen and without vsync */
+			if (options->bench_frames) {
+				options->present_mode = GRATE_PRESENT_IMMEDIATE;
+				options->nodisplay = true;
+				options->vsync = false;
+			}
+			break;
+
+		case 'o':
+			options->optimize_pushbufs = true;
+			break;
+
+		case 'm':
+			options->model = true;
+			break;
+
+		case 'l':
+			options->lazy_init = true;
+			break;
+
+		case 'T':
+			options->job_timeout = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'P':
+			options->lazy_pixbufs = true;
+			break;
+
+		case 'F':
+			if (grate_parse_fb_format(optarg, &options->fb_format))
+				return false;
+			break;
+
+		case 'p':
+			if (grate_parse_present_mode(optarg, options))
+				return false;
+			break;
+
+		case 'E':
+			options->emit_stats = true;
+			break;
+
 		default:
 			return false;
 		}
@@ -176,7 +372,11 @@ const struct host1x_chip_info *grate_chip_info(void)
 	return &chip_info;
 }
 
-struct grate *grate_init_with_fd(struct grate_options *options, int fd)
+/*
+ * Opens host1x. Asynchronous initialisation defers the display and the
+ * engines, which are brought up by the workers of grate-init.c.
+ */
+struct grate *grate_open(struct grate_options *options, int fd, bool async)
 {
 	struct grate *grate;
 
@@ -184,10 +384,26 @@ struct grate *grate_init_with_fd(struct grate_options *options, int fd)
 	if (!grate)
 		return NULL;
 
+	INIT_LIST_HEAD(&grate->slabs);
+	INIT_LIST_HEAD(&grate->shared_textures);
+	INIT_LIST_HEAD(&grate->resident_textures);
+	INIT_LIST_HEAD(&grate->transients);
+
 	grate->host1x_options.rotate_display = options->rotate_display;
-	grate->host1x_options.open_display = !options->nodisplay;
+	grate->host1x_options.open_display = !options->nodisplay && !async;
 	grate->host1x_options.display_id = options->display_id;
 	grate->host1x_options.fd = fd;
+	grate->host1x_options.model = options->model;
+	grate->host1x_options.lazy_init = options->lazy_init || async;
+	grate->host1x_options.job_timeout = options->job_timeout;
+	grate->lazy_pixbufs = options->lazy_pixbufs;
+
+	/* without guards the pixelbuffers get no guard areas at all */
+	if (options->pixbuf_guard)
+		host1x_pixelbuffer_set_guard_mode(options->pixbuf_guard_mode,
+					options->pixbuf_guard_interval);
+	else
+		host1x_pixelbuffer_disable_bo_guard();
 
 	grate->host1x = host1x_open(&grate->host1x_options);
 	if (!grate->host1x) {
@@ -196,11 +412,39 @@ struct grate *grate_init_with_fd(struct grate_options *options, int fd)
 	}
 
 	grate->options = options;
+	grate->etc1_quality = options->etc1_quality;
+	grate->dxt_quality = options->dxt_quality;
+	grate->texture_budget = (size_t)options->texture_budget << 20;
+	grate->texture_cache = options->texture_cache;
+	grate->shader_cache = options->shader_cache;
+	grate->clear_depth = 1.0f;
 
 	chip_info = grate->host1x_options.chip_info;
+	grate_3d_select_chip(chip_info.soc_id);
+
+	/* the writebacks of a frame are issued once per BO by its submit */
+	host1x_bo_flush_batch_begin(grate->host1x);
+
+	if (options->optimize_pushbufs && !async)
+		host1x_client_optimize_pushbufs(
+				host1x_get_gr3d(grate->host1x)->client, true);
+
+	if (options->trace)
+		grate_trace_open(grate, options->trace);
+
+	if (options->bench_frames)
+		grate->bench = grate_profile_start(grate);
+
+	if (options->emit_stats)
+		grate->emit_stats = grate_emit_stats_create();
+
+	return grate;
+}
 
+void grate_open_display(struct grate *grate)
+{
 	if (grate->options->nodisplay)
-		return grate;
+		return;
 
 	grate->display = grate_display_open(grate);
 	if (grate->display) {
@@ -212,9 +456,15 @@ struct grate *grate_init_with_fd(struct grate_options *options, int fd)
 						     &grate->options->width,
 						     &grate->options->height);
 	}
+}
 
-	if (!grate->options->pixbuf_guard)
-		host1x_pixelbuffer_disable_bo_guard();
+struct grate *grate_init_with_fd(struct grate_options *options, int fd)
+{
+	struct grate *grate;
+
+	grate = grate_open(options, fd, false);
+	if (grate)
+		grate_open_display(grate);
 
 	return grate;
 }
@@ -228,8 +478,38 @@ void grate_exit(struct grate *grate)
 {
 	struct termios term;
 
-	if (grate)
+	if (grate) {
+		/* the workers may still use the grate */
+		if (grate->init) {
+			grate_init_wait(grate);
+			grate_init_free(grate->init);
+		}
+
+		grate_3d_wait_idle(grate);
+
+		if (grate->bench) {
+			grate_profile_finish(grate->bench);
+			grate_profile_free(grate->bench);
+		}
+
+		if (grate->emit_stats) {
+			grate_emit_stats_print(grate->emit_stats, stdout);
+			grate_emit_stats_free(grate->emit_stats);
+		}
+
+		grate_trace_close(grate);
+		grate_texture_share_exit(grate);
+		grate_suballoc_exit(grate);
+		grate_transient_exit(grate);
+		free(grate->batch.failed);
+		host1x_capture_free(grate->capture);
+
+		if (grate->gr3d_init_bo)
+			host1x_bo_free(grate->gr3d_init_bo);
+
+		host1x_bo_flush_batch_end(grate->host1x);
 		host1x_close(grate->host1x);
+	}
 
 	if (termio_adjusted && saved_c_lflag) {
 		/* Restore terminal input */
@@ -257,6 +537,8 @@ static void grate_display_framebuffer(struct grate *grate,
 		grate_overlay_show(grate->overlay, fb, 0, 0,
 				   options->width, options->height,
 				   options->vsync, true);
+	else if (fb->prev && options->vsync && !flip)
+		grate_display_flip(grate->display, fb, true);
 	else
 		grate_display_show(grate->display, fb, options->vsync, true);
 }
@@ -274,6 +556,7 @@ struct host1x_pixelbuffer * grate_get_draw_pixbuf(struct grate_framebuffer *fb)
 
 void grate_flush(struct grate *grate)
 {
+	grate_3d_wait_idle(grate);
 }
 
 struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
@@ -285,6 +568,11 @@ struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 {
 	struct grate_framebuffer *fb;
 
+	/* halves the colour bandwidth of programs asking for 32 bits */
+	if (grate->options->fb_format && (format == PIX_BUF_FMT_RGBA8888 ||
+					  format == PIX_BUF_FMT_BGRA8888))
+		format = grate->options->fb_format;
+
 	fb = calloc(1, sizeof(*fb));
 	if (!fb)
 		return NULL;
@@ -296,18 +584,33 @@ struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 		return NULL;
 	}
 
-	if ((flags & GRATE_DOUBLE_BUFFERED) &&
-	    !grate->options->singlebuffered) {
+	fb->damage.full = true;
+	fb->history[0].full = true;
+	fb->history[1].full = true;
+
+	if (grate->options->singlebuffered)
+		return fb;
+
+	if (flags & (GRATE_DOUBLE_BUFFERED | GRATE_TRIPLE_BUFFERED)) {
 		fb->back = host1x_framebuffer_create(grate->host1x, width,
 						     height, format, layout, 0);
-		if (!fb->back) {
-			host1x_framebuffer_free(fb->front);
-			free(fb);
-			return NULL;
-		}
+		if (!fb->back)
+			goto err_free;
+	}
+
+	if (flags & GRATE_TRIPLE_BUFFERED) {
+		fb->prev = host1x_framebuffer_create(grate->host1x, width,
+						     height, format, layout, 0);
+		if (!fb->prev)
+			goto err_free;
 	}
 
 	return fb;
+
+err_free:
+	grate_framebuffer_free(fb);
+
+	return NULL;
 }
 
 void grate_framebuffer_free(struct grate_framebuffer *fb)
@@ -315,19 +618,174 @@ void grate_framebuffer_free(struct grate_framebuffer *fb)
 	if (fb) {
 		host1x_framebuffer_free(fb->front);
 		host1x_framebuffer_free(fb->back);
+		host1x_framebuffer_free(fb->prev);
 	}
 
 	free(fb);
 }
 
-static void grate_framebuffer_swap(struct grate_framebuffer *fb)
+void grate_framebuffer_swap(struct grate_framebuffer *fb)
 {
 	struct host1x_framebuffer *tmp = fb->front;
 
-	if (fb->back) {
+	/* frames are fully damaged unless told otherwise */
+	fb->history[1] = fb->history[0];
+	fb->history[0] = fb->damage;
+	fb->damage.count = 0;
+	fb->damage.full = true;
+
+	/*
+	 * With triple buffering the previously presented buffer is rendered
+	 * next, while the former front buffer may still be scanned out until
+	 * the flip to the new front buffer completes.
+	 */
+	if (fb->prev) {
+		fb->front = fb->back;
+		fb->back = fb->prev;
+		fb->prev = tmp;
+	} else if (fb->back) {
 		fb->front = fb->back;
 		fb->back = tmp;
 	}
+
+	fb->dropped = false;
+}
+
+/*
+ * The frame of the back buffer isn't presented and the next one is drawn
+ * over it, hence it needs no copy from the front buffer. The buffers that
+ * are rotated in next differ from it in unknown regions.
+ */
+static void grate_framebuffer_drop(struct grate_framebuffer *fb)
+{
+	fb->damage.count = 0;
+	fb->damage.full = true;
+	fb->history[0].full = true;
+	fb->history[1].full = true;
+	fb->dropped = true;
+}
+
+/*
+ * The frame of the back buffer takes the place of the front one, which
+ * was never shown and is drawn over next. The buffer rotated in for the
+ * following frames is kept.
+ */
+void grate_framebuffer_replace(struct grate_framebuffer *fb)
+{
+	struct host1x_framebuffer *tmp = fb->front;
+
+	if (!fb->back)
+		return;
+
+	fb->front = fb->back;
+	fb->back = tmp;
+
+	fb->damage.count = 0;
+	fb->damage.full = true;
+	fb->history[0].full = true;
+	fb->history[1].full = true;
+	fb->dropped = false;
+}
+
+/*
+ * Declare the regions that the next frame redraws, count zero marks the
+ * whole frame as damaged. To be called before drawing. The back buffer is
+ * brought up to date by copying the regions that changed since it was
+ * last drawn from the front buffer, in a single GR2D job that GR3D waits
+ * for in-stream.
+ */
+int grate_framebuffer_set_damage(struct grate *grate,
+				 struct grate_framebuffer *fb,
+				 const struct grate_rect *rects,
+				 unsigned int count)
+{
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
+	struct host1x_pixelbuffer *src, *dst;
+	struct host1x_gr2d_batch batch;
+	struct grate_fence fence;
+	unsigned int age, i, j;
+	int err;
+
+	fb->damage.full = !count || count > GRATE_MAX_DAMAGE_RECTS;
+	fb->damage.count = fb->damage.full ? 0 : count;
+	if (!fb->damage.full)
+		memcpy(fb->damage.rects, rects, count * sizeof(*rects));
+
+	/* number of frames since the back buffer was drawn, minus one */
+	age = fb->prev ? 2 : fb->back ? 1 : 0;
+
+	if (fb->damage.full || !age || fb->dropped)
+		return 0;
+
+	src = fb->front->pixbuf;
+	dst = fb->back->pixbuf;
+
+	err = host1x_gr2d_batch_begin(gr2d, &batch);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < age && !err; i++) {
+		struct grate_damage *damage = &fb->history[i];
+
+		if (damage->full) {
+			err = host1x_gr2d_batch_blit(&batch, src, dst, 0, 0,
+						     0, 0, src->width,
+						     src->height);
+			break;
+		}
+
+		for (j = 0; j < damage->count && !err; j++) {
+			struct grate_rect *rect = &damage->rects[j];
+
+			err = host1x_gr2d_batch_blit(&batch, src, dst,
+						     rect->x, rect->y,
+						     rect->x, rect->y,
+						     rect->width,
+						     rect->height);
+		}
+	}
+
+	if (err < 0) {
+		host1x_gr2d_batch_submit(&batch, NULL);
+		return err;
+	}
+
+	memset(&fence, 0, sizeof(fence));
+	fence.client = gr2d->client;
+
+	err = host1x_gr2d_batch_submit(&batch, &fence.value);
+	if (err < 0)
+		return err;
+
+	fence.pixbufs[0] = dst;
+	fence.num_pixbufs = 1;
+
+	return grate_3d_wait_fence(grate, &fence);
+}
+
+/* limit rendering to the bounding box of the damage */
+void grate_framebuffer_damage_scissor(struct grate_framebuffer *fb,
+				      struct grate_3d_ctx *ctx)
+{
+	struct host1x_pixelbuffer *pixbuf = grate_get_draw_pixbuf(fb);
+	unsigned int x0 = ~0u, y0 = ~0u, x1 = 0, y1 = 0, i;
+
+	if (fb->damage.full) {
+		grate_3d_ctx_set_scissor(ctx, 0, pixbuf->width,
+					 0, pixbuf->height);
+		return;
+	}
+
+	for (i = 0; i < fb->damage.count; i++) {
+		struct grate_rect *rect = &fb->damage.rects[i];
+
+		x0 = MIN(x0, rect->x);
+		y0 = MIN(y0, rect->y);
+		x1 = MAX(x1, rect->x + rect->width);
+		y1 = MAX(y1, rect->y + rect->height);
+	}
+
+	grate_3d_ctx_set_scissor(ctx, x0, x1 - x0, y0, y1 - y0);
 }
 
 void grate_framebuffer_save(struct grate *grate,
@@ -341,15 +799,143 @@ void grate_framebuffer_save(struct grate *grate,
 	host1x_framebuffer_save(grate->host1x, fb->front, path);
 }
 
+/*
+ * Queue a capture of the front buffer, which is written out by a background
+ * thread. 3D rendering waits for the copy in-stream, so the render loop only
+ * stalls if all staging buffers are still being encoded, in which case
+ * -EBUSY is returned and the frame is skipped.
+ */
+int grate_framebuffer_save_async(struct grate *grate,
+				 struct grate_framebuffer *fb,
+				 const char *path)
+{
+	struct host1x_fence copied;
+	struct grate_fence fence;
+	int err;
+
+	if (!grate->capture) {
+		grate->capture = host1x_capture_create(grate->host1x,
+						       GRATE_CAPTURE_BUFFERS);
+		if (!grate->capture)
+			return -ENOMEM;
+	}
+
+	err = host1x_capture_frame(grate->capture, fb->front, path, &copied);
+	if (err < 0)
+		return err;
+
+	memset(&fence, 0, sizeof(fence));
+	fence.client = copied.client;
+	fence.value = copied.value;
+	fence.pixbufs[0] = fb->front->pixbuf;
+	fence.num_pixbufs = 1;
+
+	return grate_3d_wait_fence(grate, &fence);
+}
+
+int grate_framebuffer_save_flush(struct grate *grate)
+{
+	if (!grate->capture)
+		return 0;
+
+	return host1x_capture_flush(grate->capture);
+}
+
+/*
+ * Hash of the visible pixels of the front buffer, a cheap stand-in for
+ * saving it when comparing against golden results.
+ */
+int grate_framebuffer_hash(struct grate *grate,
+			   struct grate_framebuffer *fb,
+			   uint64_t *hash)
+{
+	return host1x_pixelbuffer_hash(fb->front->pixbuf, hash);
+}
+
+/*
+ * Export the front buffer as a dma-buf for consumers like video encoders
+ * or compositors. Pending rendering is submitted, but not waited for:
+ * the returned syncpoint threshold tells when the frame is complete.
+ */
+int grate_framebuffer_export(struct grate *grate,
+			     struct grate_framebuffer *fb,
+			     struct grate_framebuffer_export *export)
+{
+	struct host1x_pixelbuffer *pixbuf = fb->front->pixbuf;
+	bool batching = grate->batch.active;
+	struct grate_fence fence;
+	int err;
+
+	err = grate_3d_end_batch(grate, &fence);
+	if (batching)
+		grate_3d_begin_batch(grate);
+	if (err < 0)
+		return err;
+
+	err = host1x_pixelbuffer_populate(pixbuf);
+	if (err < 0)
+		return err;
+
+	err = HOST1X_BO_EXPORT_DMABUF(pixbuf->bo, &export->fd);
+	if (err < 0)
+		return err;
+
+	export->offset = pixbuf->bo->offset;
+	export->width = pixbuf->width;
+	export->height = pixbuf->height;
+	export->pitch = pixbuf->pitch;
+	export->format = pixbuf->format;
+	export->layout = pixbuf->layout;
+	export->syncpt_id = fence.client->syncpts[0].id;
+	export->syncpt_value = fence.value;
+
+	return 0;
+}
+
 void grate_swap_buffers(struct grate *grate)
 {
-	grate_framebuffer_swap(grate->fb);
+	uint64_t start = grate_trace_now(grate);
+	bool drop = false;
+
+	grate_3d_wait_idle(grate);
+
+	/* the flip of the last frame must complete before "prev" is reused */
+	if (grate->fb->prev && grate->display && !grate->overlay) {
+		if (grate->options->present_mode == GRATE_PRESENT_MAILBOX)
+			drop = grate_display_flip_pending(grate->display);
 
-	if (grate->display || grate->overlay) {
-		grate_display_framebuffer(grate, grate->fb, false);
+		if (!drop)
+			grate_display_wait_flip(grate->display);
+	}
+
+	/* textures unused by the frame are evicted first */
+	grate_texture_residency_trim(grate);
+	grate_transient_frame_end(grate);
+	grate_emit_stats_frame(grate);
+	grate->frame++;
+
+	if (drop) {
+		/* the next frame goes out with the next flip */
+		grate_framebuffer_drop(grate->fb);
 	} else {
-		grate_framebuffer_save(grate, grate->fb, "test.png");
+		grate_framebuffer_swap(grate->fb);
+
+		if (grate->display || grate->overlay)
+			grate_display_framebuffer(grate, grate->fb, false);
+		else if (!grate->bench)
+			grate_framebuffer_save(grate, grate->fb, "test.png");
+	}
+
+	if (grate->bench) {
+		/* the statistics start after the warm-up frames */
+		if (++grate->bench_frames == GRATE_BENCH_WARMUP_FRAMES)
+			grate_profile_reset(grate->bench);
+		else if (grate->bench_frames > GRATE_BENCH_WARMUP_FRAMES)
+			grate_profile_sample(grate->bench);
 	}
+
+	grate_trace_cpu(grate, "swap", start);
+	grate_trace_poll(grate);
 }
 
 void grate_wait_for_key(struct grate *grate)
@@ -364,15 +950,35 @@ void grate_wait_for_key(struct grate *grate)
 	getchar();
 }
 
+/* keys are read as typed, the terminal is restored by grate_exit() */
+void grate_input_raw(void)
+{
+	struct termios term;
+
+	if (termio_adjusted)
+		return;
+
+	termio_adjusted = true;
+	/* Redirect terminal input to us */
+	tcgetattr(STDIN_FILENO, &term);
+	saved_c_lflag = term.c_lflag & (ICANON | ECHO);
+	term.c_lflag &= ~saved_c_lflag;
+	tcsetattr(STDIN_FILENO, TCSANOW, &term);
+}
+
 static uint8_t grate_key_pressed__(struct grate *grate, bool return_keycode)
 {
 	int err, max_fd = STDIN_FILENO;
 	uint8_t key[3];
 	size_t cnt;
 	struct timeval timeout;
-	struct termios term;
 	fd_set fds;
 
+	/* benchmark ends the main loop once all frames are rendered */
+	if (grate && grate->bench)
+		return grate->bench_frames >= GRATE_BENCH_WARMUP_FRAMES +
+					      grate->options->bench_frames;
+
 	/*
 	 * If on-screen display isn't supported, pretend that a key was
 	 * pressed so that the main loop can be exited.
@@ -380,14 +986,8 @@ static uint8_t grate_key_pressed__(struct grate *grate, bool return_keycode)
 	if (grate && !grate->display && !grate->overlay)
 		return true;
 
-	if (return_keycode && !termio_adjusted) {
-		termio_adjusted = true;
-		/* Redirect terminal input to us */
-		tcgetattr(STDIN_FILENO, &term);
-		saved_c_lflag = term.c_lflag & (ICANON | ECHO);
-		term.c_lflag &= ~saved_c_lflag;
-		tcsetattr(STDIN_FILENO, TCSANOW, &term);
-	}
+	if (return_keycode)
+		grate_input_raw();
 
 	memset(&timeout, 0, sizeof(timeout));
 	timeout.tv_sec = 0;
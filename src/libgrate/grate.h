@@ -39,10 +39,13 @@
 struct grate_framebuffer;
 struct grate_display;
 struct grate_overlay;
+struct grate_fence;
 struct grate;
 
 #define GRATE_SINGLE_BUFFERED (0 << 0)
 #define GRATE_DOUBLE_BUFFERED (1 << 0)
+/* double buffering with a third buffer, flips don't stall rendering */
+#define GRATE_TRIPLE_BUFFERED (1 << 1)
 
 struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 						   unsigned int width,
@@ -51,8 +54,77 @@ struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 						   enum layout_format layout,
 						   unsigned long flags);
 void grate_framebuffer_free(struct grate_framebuffer *fb);
+
+/* rectangle in pixelbuffer coordinates */
+struct grate_rect {
+	unsigned int x;
+	unsigned int y;
+	unsigned int width;
+	unsigned int height;
+};
+
+int grate_framebuffer_set_damage(struct grate *grate,
+				 struct grate_framebuffer *fb,
+				 const struct grate_rect *rects,
+				 unsigned int count);
+void grate_framebuffer_damage_scissor(struct grate_framebuffer *fb,
+				      struct grate_3d_ctx *ctx);
 void grate_framebuffer_save(struct grate *grate, struct grate_framebuffer *fb,
 			    const char *path);
+int grate_framebuffer_save_async(struct grate *grate,
+				 struct grate_framebuffer *fb,
+				 const char *path);
+int grate_framebuffer_save_flush(struct grate *grate);
+int grate_framebuffer_hash(struct grate *grate,
+			   struct grate_framebuffer *fb,
+			   uint64_t *hash);
+
+/*
+ * Front buffer of a framebuffer shared as a dma-buf. The consumer has to
+ * wait for the syncpoint to reach the given value before reading it.
+ */
+struct grate_framebuffer_export {
+	int fd;
+	unsigned long offset;
+	unsigned width;
+	unsigned height;
+	unsigned pitch;
+	enum pixel_format format;
+	enum layout_format layout;
+	uint32_t syncpt_id;
+	uint32_t syncpt_value;
+};
+
+int grate_framebuffer_export(struct grate *grate,
+			     struct grate_framebuffer *fb,
+			     struct grate_framebuffer_export *export);
+
+struct grate_compositor;
+
+struct grate_compositor *grate_compositor_create(struct grate *grate);
+void grate_compositor_free(struct grate_compositor *compositor);
+int grate_compositor_add_layer(struct grate_compositor *compositor,
+			       struct grate_framebuffer *fb,
+			       unsigned int x, unsigned int y,
+			       unsigned int width, unsigned int height);
+int grate_compositor_move_layer(struct grate_compositor *compositor,
+				unsigned int index,
+				unsigned int x, unsigned int y,
+				unsigned int width, unsigned int height);
+int grate_compositor_update(struct grate_compositor *compositor, bool vsync);
+int grate_compositor_queue_layer(struct grate_compositor *compositor,
+				 unsigned int index,
+				 struct grate_fence *fence);
+int grate_compositor_dispatch(struct grate_compositor *compositor);
+
+struct grate_pacer;
+
+struct grate_pacer *grate_pacer_create(struct grate *grate, unsigned margin);
+void grate_pacer_free(struct grate_pacer *pacer);
+void grate_pacer_begin_frame(struct grate_pacer *pacer);
+void grate_pacer_end_frame(struct grate_pacer *pacer);
+void grate_pacer_get_stats(struct grate_pacer *pacer, unsigned int *frames,
+			   unsigned int *missed, unsigned int *render_time);
 void *grate_framebuffer_data(struct grate_framebuffer *fb, bool front);
 
 struct host1x_bo *grate_bo_create_and_map(struct grate *grate,
@@ -61,20 +133,95 @@ struct host1x_bo *grate_bo_create_and_map(struct grate *grate,
 struct host1x_bo *grate_bo_create_from_data(struct grate *grate, size_t size,
 					    unsigned long flags,
 					    const void *data);
+/* frees BOs of grate_bo_create_from_data(), which may be sub-allocated */
+void grate_bo_free(struct grate *grate, struct host1x_bo *bo);
+
+struct grate_stream;
+
+struct grate_stream *grate_stream_create(struct grate *grate,
+					 size_t chunk_size,
+					 unsigned int num_chunks);
+void grate_stream_free(struct grate_stream *stream);
+void *grate_stream_alloc(struct grate_stream *stream, size_t size,
+			 struct host1x_bo_view *view);
+int grate_stream_upload(struct grate_stream *stream, const void *data,
+			size_t size, struct host1x_bo_view *view);
+void grate_stream_flush(struct grate_stream *stream);
+int grate_stream_fence(struct grate_stream *stream,
+		       const struct grate_fence *fence);
 
 #define grate_create_attrib_bo_from_data(grate, data)			\
 	grate_bo_create_from_data(grate, sizeof(data),			\
 				  NVHOST_BO_FLAG_ATTRIBUTES, data)
 
+/* quality/speed trade-off of the ETC1 encoder used by texture loading */
+enum grate_etc1_quality {
+	GRATE_ETC1_QUALITY_HIGH,
+	GRATE_ETC1_QUALITY_MEDIUM,
+	GRATE_ETC1_QUALITY_FAST,
+};
+
+/*
+ * DXT encoder used by texture loading, the high quality is squish and the
+ * others a range fit that is encoded in parallel.
+ */
+enum grate_dxt_quality {
+	GRATE_DXT_QUALITY_HIGH,
+	GRATE_DXT_QUALITY_MEDIUM,
+	GRATE_DXT_QUALITY_FAST,
+};
+
+/*
+ * How frames are presented by grate_swap_buffers(). IMMEDIATE flips
+ * without waiting for vblank, FIFO waits for the flip of every frame and
+ * MAILBOX doesn't wait for flips of triple buffered framebuffers: a frame
+ * finished while the last flip is pending isn't shown and the next one is
+ * drawn over it, so that the newest frame goes out with the next flip.
+ */
+enum grate_present_mode {
+	GRATE_PRESENT_IMMEDIATE,
+	GRATE_PRESENT_FIFO,
+	GRATE_PRESENT_MAILBOX,
+};
+
 struct grate_options {
 	unsigned int x, y, width, height;
 	bool singlebuffered;
 	bool pixbuf_guard;
+	/* how the guards are checked if enabled, see --guard */
+	enum host1x_pixbuf_guard_mode pixbuf_guard_mode;
+	unsigned int pixbuf_guard_interval;
 	bool fullscreen;
 	bool nodisplay;
+	/* flips are synchronised to vblank unless presenting IMMEDIATE */
 	bool vsync;
+	enum grate_present_mode present_mode;
 	int display_id;
 	unsigned int rotate_display;
+	enum grate_etc1_quality etc1_quality;
+	enum grate_dxt_quality dxt_quality;
+	/* MiB of textures loaded from files, 0 if unlimited */
+	unsigned int texture_budget;
+	const char *texture_cache;
+	const char *shader_cache;
+	const char *profile_json;
+	const char *trace;
+	/* number of off-screen frames to benchmark, 0 if disabled */
+	unsigned int bench_frames;
+	/* drop redundant register writes from 3D jobs */
+	bool optimize_pushbufs;
+	/* estimate the cost of jobs if there is no GPU */
+	bool model;
+	/* set the engines up on their first use */
+	bool lazy_init;
+	/* milliseconds before a job is considered hung, 0 for the default */
+	unsigned int job_timeout;
+	/* empty textures get their memory on the first use */
+	bool lazy_pixbufs;
+	/* colour format of 32 bit framebuffers, 0 to keep the asked one */
+	enum pixel_format fb_format;
+	/* count the words emitted per group of 3D state, see --emit-stats */
+	bool emit_stats;
 };
 
 bool grate_parse_command_line(struct grate_options *options, int argc,
@@ -83,10 +230,104 @@ struct grate *grate_init(struct grate_options *options);
 struct grate *grate_init_with_fd(struct grate_options *options, int fd);
 void grate_exit(struct grate *grate);
 
+/*
+ * Loads of the application run by grate_init_async() while the display
+ * and the engines are brought up, they are run one after another on a
+ * worker thread. An error is returned by grate_init_wait().
+ */
+typedef int (*grate_init_load_t)(struct grate *grate, void *data);
+
+struct grate_init_load {
+	grate_init_load_t load;
+	void *data;
+};
+
+struct grate *grate_init_async(struct grate_options *options, int fd,
+			       const struct grate_init_load *loads,
+			       unsigned int num_loads);
+int grate_init_get_fd(struct grate *grate);
+int grate_init_wait(struct grate *grate);
+
 void grate_clear_color(struct grate *grate, float red, float green, float blue,
 		       float alpha);
+void grate_clear_depth(struct grate *grate, float depth);
+void grate_clear_stencil(struct grate *grate, uint8_t stencil);
 void grate_clear(struct grate *grate);
 
+#define GRATE_CLEAR_COLOR	(1 << 0)
+#define GRATE_CLEAR_DEPTH	(1 << 1)
+#define GRATE_CLEAR_STENCIL	(1 << 2)
+
+void grate_clear_buffers(struct grate *grate, struct grate_3d_ctx *ctx,
+			 unsigned int mask);
+
+struct host1x_pixelbuffer *
+grate_transient_pixbuf_get(struct grate *grate, unsigned width,
+			   unsigned height, enum pixel_format format,
+			   enum layout_format layout);
+void grate_transient_pixbuf_put(struct grate *grate,
+				struct host1x_pixelbuffer *pixbuf);
+size_t grate_transient_pool_size(struct grate *grate);
+
+enum grate_graph_engine {
+	GRATE_GRAPH_CPU,
+	GRATE_GRAPH_GR2D,
+	GRATE_GRAPH_GR3D,
+};
+
+/*
+ * Runs a pass of the graph. Passes of GR2D return the fence of their
+ * work, the fence of other passes is left signaled.
+ */
+typedef int (*grate_graph_run_t)(struct grate *grate, void *data,
+				 struct grate_fence *fence);
+
+struct grate_graph;
+struct grate_graph_pass;
+
+struct grate_graph *grate_graph_create(struct grate *grate);
+void grate_graph_free(struct grate_graph *graph);
+struct grate_graph_pass *grate_graph_add_pass(struct grate_graph *graph,
+					      enum grate_graph_engine engine,
+					      grate_graph_run_t run,
+					      void *data);
+int grate_graph_read(struct grate_graph_pass *pass,
+		     struct host1x_pixelbuffer *pixbuf);
+int grate_graph_write(struct grate_graph_pass *pass,
+		      struct host1x_pixelbuffer *pixbuf);
+int grate_graph_transient(struct grate_graph *graph,
+			  struct host1x_pixelbuffer *pixbuf);
+int grate_graph_execute(struct grate_graph *graph, struct grate_fence *fence);
+
+enum grate_load_action {
+	GRATE_LOAD_ACTION_LOAD,
+	GRATE_LOAD_ACTION_CLEAR,
+	GRATE_LOAD_ACTION_DONT_CARE,
+};
+
+enum grate_store_action {
+	GRATE_STORE_ACTION_STORE,
+	GRATE_STORE_ACTION_DISCARD,
+};
+
+struct grate_attachment_ops {
+	enum grate_load_action load;
+	enum grate_store_action store;
+};
+
+struct grate_render_pass {
+	struct grate_attachment_ops color;
+	struct grate_attachment_ops depth;
+	struct grate_attachment_ops stencil;
+	float clear_color[4];
+	float clear_depth;
+	uint8_t clear_stencil;
+};
+
+int grate_render_pass_begin(struct grate *grate, struct grate_3d_ctx *ctx,
+			    const struct grate_render_pass *pass);
+int grate_render_pass_end(struct grate *grate, struct grate_fence *fence);
+
 void grate_bind_framebuffer(struct grate *grate, struct grate_framebuffer *fb);
 
 struct host1x_pixelbuffer * grate_get_draw_pixbuf(struct grate_framebuffer *fb);
@@ -111,10 +352,14 @@ struct grate_shader *grate_shader_new(struct grate *grate,
 				      const char *lines[],
 				      unsigned int count);
 void grate_shader_free(struct grate_shader *shader);
+int grate_shader_cache_compile(const char *dir, enum grate_shader_type type,
+			       const char *code);
 struct grate_shader *grate_shader_parse_vertex_asm(const char *);
 const char *grate_shader_disasm_vs(struct grate_shader *shader);
 struct grate_shader *grate_shader_parse_fragment_asm(const char *);
 const char *grate_shader_disasm_fs(struct grate_shader *shader);
+/* mask of the render targets a fragment shader stores to */
+unsigned int grate_shader_render_targets(struct grate_shader *shader);
 struct grate_shader *grate_shader_parse_linker_asm(const char *);
 const char *grate_shader_disasm_linker(struct grate_shader *shader);
 struct grate_shader *grate_shader_parse_vertex_asm_from_file(const char *path);
@@ -129,6 +374,20 @@ struct grate_program *grate_program_new(struct grate *grate,
 					struct grate_shader *linker);
 void grate_program_free(struct grate_program *program);
 
+/*
+ * A fragment program writes several outputs in one pass by storing each of
+ * them from its own EXEC, "store rtN, r0, r1" or "r2, r3". Render targets 0
+ * and 2 are the depth and stencil buffers, so output 0 goes to rt1 and
+ * output n to rt(n + 2), see GRATE_3D_CTX_OUTPUT_RT() and
+ * grate_3d_ctx_bind_outputs().
+ */
+unsigned int grate_program_render_targets(struct grate_program *program);
+
+/*
+ * Locations are resolved by name after grate_program_link() and stay valid
+ * for the lifetime of the program, resolve them once and pass them to the
+ * ctx setters instead of looking them up for every draw.
+ */
 int grate_get_attribute_location(struct grate_program *program,
 				 const char *name);
 int grate_get_vertex_uniform_location(struct grate_program *program,
@@ -136,7 +395,68 @@ int grate_get_vertex_uniform_location(struct grate_program *program,
 int grate_get_fragment_uniform_location(struct grate_program *program,
 					const char *name);
 
+/*
+ * Level 1 removes varyings the fragment program doesn't interpolate and
+ * dead code of the vertex program, based on the outputs read by the linker.
+ * Level 2 additionally packs the varyings into the fewest TRAM rows and
+ * linker instructions, packs independent vector and scalar operations
+ * together and merges exec batches and ALU instructions of the fragment
+ * program where the pipeline allows. Level 0 does nothing. Has to be called
+ * before grate_program_link().
+ */
+int grate_program_optimize(struct grate_program *program, unsigned int level);
+
+/*
+ * Uniforms whose values are fixed for the lifetime of the program, they
+ * are folded into its default constants by grate_program_link() instead of
+ * being set through the context and have no location. A vertex uniform
+ * takes up to 16 floats, a fragment uniform one per component. Has to be
+ * called before grate_program_link().
+ */
+struct grate_specialization {
+	const char *name;
+	float values[16];
+	unsigned int nb;
+};
+
+int grate_program_specialize(struct grate_program *program,
+			     const struct grate_specialization *specs,
+			     unsigned int count);
 void grate_program_link(struct grate_program *program);
+
+/*
+ * Static estimates derived from the encoded programs. Cycle counts assume
+ * one VLIW instruction per clock for vertices and, for fragments, that
+ * every exec batch occupies the pipeline as long as its busiest stage.
+ * Parts of a program that can't be decoded are left zeroed.
+ */
+struct grate_program_stats {
+	unsigned int vs_instructions;
+	unsigned int vs_vector_ops;
+	unsigned int vs_scalar_ops;
+	unsigned int vs_texture_fetches;
+	unsigned int vs_max_live_temporaries;
+	unsigned int vs_critical_path;
+	unsigned int vs_cycles;
+
+	unsigned int fs_instructions;
+	unsigned int fs_mfu_instructions;
+	unsigned int fs_alu_instructions;
+	unsigned int fs_alu_ops;
+	unsigned int fs_texture_fetches;
+	unsigned int fs_registers;
+	unsigned int fs_critical_path;
+	unsigned int fs_cycles;
+
+	unsigned int linker_instructions;
+	unsigned int tram_rows;
+};
+
+void grate_program_get_stats(struct grate_program *program,
+			     struct grate_program_stats *stats);
+int grate_program_save(struct grate_program *program, const char *path);
+struct grate_program *grate_program_load(struct grate *grate,
+					 const char *path);
 void grate_use_program(struct grate *grate, struct grate_program *program);
 
 struct grate_profile;
@@ -145,9 +465,12 @@ struct grate_profile *grate_profile_start(struct grate *grate);
 void grate_profile_free(struct grate_profile *profile);
 void grate_profile_sample(struct grate_profile *profile);
 void grate_profile_finish(struct grate_profile *profile);
+void grate_profile_begin_pass(struct grate_profile *profile, const char *name);
+void grate_profile_dump_json(struct grate_profile *profile, FILE *fp);
 float grate_profile_time_elapsed(struct grate_profile *profile);
 
 struct grate_3d_ctx;
+struct grate_3d_state;
 struct grate_texture;
 
 void grate_3d_draw_elements(struct grate_3d_ctx *ctx,
@@ -156,6 +479,173 @@ void grate_3d_draw_elements(struct grate_3d_ctx *ctx,
 			    unsigned index_mode,
 			    unsigned vtx_count);
 
+struct grate_fence {
+	struct host1x_client *client;
+	struct host1x_pixelbuffer *pixbufs[16];
+	unsigned int num_pixbufs;
+	uint32_t value;
+	bool signaled;
+
+	/* unsubmitted batch of a draw, used while client is NULL */
+	struct grate *batch;
+	uint64_t seq;
+};
+
+int grate_3d_draw_elements_async(struct grate_3d_ctx *ctx,
+				 unsigned primitive_type,
+				 struct host1x_bo *indices_bo,
+				 unsigned index_mode,
+				 unsigned vtx_count,
+				 struct grate_fence *fence);
+int grate_3d_draw_elements_view_async(struct grate_3d_ctx *ctx,
+				      unsigned primitive_type,
+				      const struct host1x_bo_view *indices,
+				      unsigned index_mode,
+				      unsigned vtx_count,
+				      struct grate_fence *fence);
+/*
+ * Triangle list helpers for the post-transform vertex cache, a cache size
+ * of 0 selects the default. ACMR is the average number of vertices
+ * transformed per triangle. The remap table maps the old vertex numbers to
+ * the new ones and is applied to every vertex buffer of the mesh.
+ */
+struct grate_mesh_stats {
+	float acmr_before;
+	float acmr_after;
+};
+
+float grate_mesh_acmr(const uint16_t *indices, unsigned int count,
+		      unsigned int cache_size);
+int grate_mesh_optimize_indices(uint16_t *indices, unsigned int count,
+				unsigned int cache_size,
+				struct grate_mesh_stats *stats);
+int grate_mesh_optimize_vertex_fetch(uint16_t *indices, unsigned int count,
+				     unsigned int num_vertices,
+				     uint16_t *remap);
+int grate_mesh_remap_vertices(void *vertices, unsigned int stride,
+			      unsigned int num_vertices,
+			      const uint16_t *remap);
+
+/*
+ * Converts a triangle list into a single TGR3D_PRIMITIVE_TYPE_TRIANGLE_STRIP,
+ * strips are stitched with degenerate triangles and keep the winding of the
+ * list. The strip has to have room for 2 * count indices.
+ */
+int grate_mesh_stripify(const uint16_t *indices, unsigned int count,
+			uint16_t *strip, unsigned int *strip_count);
+
+/*
+ * Meshes streamed from a file of chunks of at most 64K vertices, each with
+ * its own uint16 triangle list. The first chunk is uploaded by the open,
+ * the others in the background, and a draw covers the chunks uploaded so
+ * far. The attributes of the file are bound to the locations in the order
+ * they were written, -1 skips one.
+ */
+struct grate_mesh_file;
+
+struct grate_mesh_attrib {
+	unsigned int size;
+	unsigned int type;
+	unsigned int offset;
+};
+
+struct grate_mesh_file *grate_mesh_file_open(struct grate *grate,
+					     const char *path);
+void grate_mesh_file_free(struct grate_mesh_file *mesh);
+int grate_mesh_file_ready(struct grate_mesh_file *mesh);
+int grate_mesh_file_wait(struct grate_mesh_file *mesh);
+int grate_mesh_file_draw(struct grate_mesh_file *mesh,
+			 struct grate_3d_ctx *ctx, const int *locations,
+			 struct grate_fence *fence);
+int grate_mesh_file_write(const char *path, unsigned int stride,
+			  const struct grate_mesh_attrib *attribs,
+			  unsigned int num_attribs, const void *vertices,
+			  unsigned int num_vertices, const uint32_t *indices,
+			  unsigned int num_indices);
+
+int grate_3d_draw_instanced(struct grate_3d_ctx *ctx,
+			    unsigned primitive_type,
+			    const struct host1x_bo_view *indices,
+			    unsigned index_mode,
+			    unsigned vtx_count,
+			    unsigned location, unsigned nb,
+			    const float *values,
+			    unsigned instance_count,
+			    struct grate_fence *fence);
+struct grate_3d_state *grate_3d_state_create(struct grate_3d_ctx *ctx);
+void grate_3d_state_free(struct grate_3d_state *state);
+int grate_3d_draw_state_elements_async(struct grate_3d_state *state,
+				       unsigned primitive_type,
+				       const struct host1x_bo_view *indices,
+				       unsigned index_mode,
+				       unsigned vtx_count,
+				       struct grate_fence *fence);
+struct grate_3d_cmdlist;
+
+struct grate_3d_cmdlist *grate_3d_cmdlist_create(struct grate *grate,
+						 size_t words);
+void grate_3d_cmdlist_free(struct grate_3d_cmdlist *list);
+int grate_3d_cmdlist_reset(struct grate_3d_cmdlist *list);
+int grate_3d_cmdlist_draw_elements(struct grate_3d_cmdlist *list,
+				   struct grate_3d_ctx *ctx,
+				   unsigned primitive_type,
+				   const struct host1x_bo_view *indices,
+				   unsigned index_mode,
+				   unsigned vtx_count);
+int grate_3d_cmdlist_add_patch(struct grate_3d_cmdlist *list,
+			       unsigned location, unsigned nb);
+int grate_3d_cmdlist_patch(struct grate_3d_cmdlist *list, int index,
+			   const float *values);
+int grate_3d_cmdlist_execute(struct grate *grate,
+			     struct grate_3d_cmdlist **lists,
+			     unsigned int count,
+			     struct grate_fence *fence);
+struct grate_3d_queue;
+
+struct grate_3d_queue *grate_3d_queue_create(struct grate *grate);
+void grate_3d_queue_free(struct grate_3d_queue *queue);
+int grate_3d_queue_draw_elements(struct grate_3d_queue *queue,
+				 struct grate_3d_ctx *ctx,
+				 unsigned primitive_type,
+				 const struct host1x_bo_view *indices,
+				 unsigned index_mode,
+				 unsigned vtx_count,
+				 float depth, bool translucent);
+int grate_3d_queue_flush(struct grate_3d_queue *queue,
+			 struct grate_fence *fence);
+void grate_3d_begin_batch(struct grate *grate);
+void grate_3d_set_draw_coalescing(struct grate *grate, bool enable);
+int grate_3d_end_batch(struct grate *grate, struct grate_fence *fence);
+int grate_3d_wait_fence(struct grate *grate, struct grate_fence *fence);
+int grate_fence_wait(struct grate_fence *fence, uint32_t timeout);
+int grate_fence_poll(struct grate_fence *fence);
+int grate_fences_wait(struct grate_fence **fences, unsigned int count,
+		      bool all, uint32_t timeout, uint32_t *elapsed);
+
+struct grate_event_loop;
+
+/* times are CLOCK_MONOTONIC in microseconds */
+struct grate_event_loop_callbacks {
+	void (*flip)(void *data, uint64_t time);
+	void (*vblank)(void *data, uint64_t time);
+	void (*input)(void *data, uint8_t key);
+	void *data;
+};
+
+typedef void (*grate_fence_done_t)(void *data, struct grate_fence *fence,
+				   int err);
+
+struct grate_event_loop *
+grate_event_loop_create(struct grate *grate,
+			const struct grate_event_loop_callbacks *callbacks);
+void grate_event_loop_free(struct grate_event_loop *loop);
+int grate_event_loop_get_fd(struct grate_event_loop *loop);
+int grate_event_loop_request_vblank(struct grate_event_loop *loop);
+int grate_event_loop_add_fence(struct grate_event_loop *loop,
+			       struct grate_fence *fence,
+			       grate_fence_done_t done, void *data);
+int grate_event_loop_dispatch(struct grate_event_loop *loop, int timeout);
+
 enum grate_textute_wrap_mode {
 	GRATE_TEXTURE_CLAMP_TO_EDGE,
 	GRATE_TEXTURE_MIRRORED_REPEAT,
@@ -175,14 +665,94 @@ struct grate_texture *grate_create_texture(struct grate *grate,
 					   unsigned width, unsigned height,
 					   enum pixel_format format,
 					   enum layout_format layout);
+struct grate_texture *grate_texture_import_dmabuf(struct grate *grate, int fd,
+						  unsigned width,
+						  unsigned height,
+						  unsigned pitch,
+						  enum pixel_format format,
+						  enum layout_format layout);
 struct grate_texture *grate_create_texture2(struct grate *grate,
 					    const char *path,
 					    enum pixel_format format,
 					    enum layout_format layout);
+struct grate_texture *grate_create_texture_streamed(struct grate *grate,
+						    const char *path,
+						    enum pixel_format format,
+						    enum layout_format layout);
+int grate_texture_stream_wait(struct grate_texture *tex);
+int grate_texture_load_many(struct grate *grate, const char * const *paths,
+			    unsigned count, enum pixel_format format,
+			    enum layout_format layout,
+			    struct grate_texture **textures);
+
+struct grate_atlas;
+
+/* placement of an image in an atlas, in texels and texture coordinates */
+struct grate_atlas_rect {
+	unsigned x, y, width, height;
+	float u0, v0, u1, v1;
+};
+
+struct grate_atlas *grate_atlas_create(struct grate *grate,
+				       unsigned width, unsigned height,
+				       unsigned padding, unsigned align);
+void grate_atlas_free(struct grate_atlas *atlas);
+int grate_atlas_add(struct grate_atlas *atlas, const char *path,
+		    struct grate_atlas_rect *rect);
+int grate_atlas_add_data(struct grate_atlas *atlas, const void *data,
+			 unsigned width, unsigned height, unsigned pitch,
+			 struct grate_atlas_rect *rect);
+struct grate_texture *grate_atlas_create_texture(struct grate_atlas *atlas);
+int grate_atlas_update(struct grate_atlas *atlas, struct grate_texture *tex);
 int grate_texture_load(struct grate *grate, struct grate_texture *tex,
 		       const char *path);
 struct host1x_pixelbuffer *grate_texture_pixbuf(struct grate_texture *tex);
+
+/*
+ * Loads of the same image content with the same parameters share a single
+ * texture, including its sampler state. Every texture returned is released
+ * by grate_texture_free().
+ */
+struct grate_texture_share_stats {
+	unsigned int textures;
+	unsigned int references;
+	unsigned long hits;
+	size_t bytes;
+	/* memory that separate textures of the references would take */
+	size_t bytes_saved;
+};
+
+struct grate_texture *grate_texture_get(struct grate *grate,
+					const char *path,
+					enum pixel_format format,
+					enum layout_format layout);
+void grate_texture_share_stats(struct grate *grate,
+			       struct grate_texture_share_stats *stats);
+
+/*
+ * Textures loaded from files that exceed the budget, or whose memory is
+ * needed, are evicted least recently used first and are reloaded once they
+ * are used again. A budget of 0 is unlimited.
+ */
+struct grate_texture_residency_stats {
+	size_t budget;
+	size_t resident_bytes;
+	size_t evicted_bytes;
+	unsigned int resident;
+	unsigned int evicted;
+	unsigned long evictions;
+	unsigned long reloads;
+};
+
+void grate_set_texture_budget(struct grate *grate, size_t size);
+void grate_texture_residency_stats(struct grate *grate,
+				   struct grate_texture_residency_stats *stats);
 void grate_texture_free(struct grate_texture *tex);
+void grate_set_etc1_quality(struct grate *grate,
+			    enum grate_etc1_quality quality);
+void grate_set_dxt_quality(struct grate *grate,
+			   enum grate_dxt_quality quality);
+float grate_texture_psnr(struct grate_texture *tex);
 void grate_texture_set_max_lod(struct grate_texture *tex, unsigned max_lod);
 void grate_texture_set_wrap_s(struct grate_texture *tex,
 			      enum grate_textute_wrap_mode wrap_mode);
@@ -192,14 +762,34 @@ void grate_texture_set_min_filter(struct grate_texture *tex,
 				  enum grate_textute_filter filter);
 void grate_texture_set_mag_filter(struct grate_texture *tex,
 				  enum grate_textute_filter filter);
+
+/*
+ * Immutable filtering and wrapping, bound per texture unit with
+ * grate_3d_ctx_bind_sampler(). A sampler has to stay bound to no unit when
+ * it's freed.
+ */
+struct grate_sampler *grate_sampler_create(
+				enum grate_textute_wrap_mode wrap_s,
+				enum grate_textute_wrap_mode wrap_t,
+				enum grate_textute_filter min_filter,
+				enum grate_textute_filter mag_filter);
+void grate_sampler_free(struct grate_sampler *sampler);
 void grate_texture_clear(struct grate *grate, struct grate_texture *texture,
 			 uint32_t color);
 void grate_texture_clear_rect(struct grate *grate,
 			      struct grate_texture *texture,
 			      uint32_t color, unsigned x, unsigned y,
 			      unsigned width, unsigned height);
+int grate_texture_clear_rect_async(struct grate *grate,
+				   struct grate_texture *texture,
+				   uint32_t color, unsigned x, unsigned y,
+				   unsigned width, unsigned height,
+				   struct grate_fence *fence);
 int grate_texture_generate_mipmap(struct grate *grate,
 				  struct grate_texture *tex);
+int grate_texture_generate_mipmap_async(struct grate *grate,
+					struct grate_texture *tex,
+					struct grate_fence *fence);
 int grate_texture_load_miplevel(struct grate *grate,
 				struct grate_texture *tex,
 				unsigned level, const char *path);
@@ -208,6 +798,45 @@ int grate_texture_blit(struct grate *grate,
 		       struct grate_texture *dst_tex,
 		       unsigned sx, unsigned sy, unsigned sw, unsigned sh,
 		       unsigned dx, unsigned dy, unsigned dw, signed dh);
+int grate_texture_blit_async(struct grate *grate,
+			     struct grate_texture *src_tex,
+			     struct grate_texture *dst_tex,
+			     unsigned sx, unsigned sy,
+			     unsigned dx, unsigned dy,
+			     unsigned width, signed height,
+			     struct grate_fence *fence);
+int grate_texture_upload_async(struct grate *grate,
+			       struct grate_texture *tex,
+			       const void *data, unsigned pitch,
+			       enum layout_format layout,
+			       struct grate_fence *fence);
+int grate_texture_upload_rgba(struct grate *grate,
+			      struct grate_texture *tex,
+			      const void *data, unsigned pitch,
+			      bool premultiply,
+			      struct grate_fence *fence);
+
+/*
+ * Planar YUV 4:2:0 frame, GR2D scales and converts it to RGB while
+ * blitting it into the bound framebuffer.
+ */
+struct grate_video_frame;
+
+struct grate_video_frame *grate_video_frame_create(struct grate *grate,
+						   unsigned width,
+						   unsigned height);
+void grate_video_frame_free(struct grate_video_frame *frame);
+int grate_video_frame_load(struct grate *grate,
+			   struct grate_video_frame *frame,
+			   void *planes[3], const unsigned pitches[3]);
+int grate_video_blit(struct grate *grate, struct grate_video_frame *frame,
+		     enum host1x_csc csc, unsigned x, unsigned y,
+		     unsigned width, unsigned height);
+
+/* presents a portrait frame on a landscape display and vice versa */
+int grate_framebuffer_rotate(struct grate *grate,
+			     struct grate_framebuffer *src,
+			     enum host1x_gr2d_rotation rotation);
 
 struct grate_font;
 
@@ -215,12 +844,78 @@ struct grate_font *grate_create_font(struct grate *grate,
 				     const char *font_path,
 				     const char *config_path);
 void grate_3d_printf(struct grate *grate,
-		     const struct grate_3d_ctx *ctx,
+		     struct grate_3d_ctx *ctx,
 		     struct grate_font *font,
 		     unsigned render_target,
 		     float x, float y, float scale,
 		     const char *fmt, ...);
 
+struct grate_text;
+
+struct grate_text *grate_text_create(struct grate *grate,
+				     struct grate_font *font);
+void grate_text_free(struct grate_text *text);
+int grate_text_printf(struct grate_text *text, float x, float y,
+		      float scale, const char *fmt, ...);
+int grate_text_draw(struct grate_text *text, const struct grate_3d_ctx *ctx,
+		    unsigned render_target);
+
+/* quad in pixels of the render target and its texture coordinates */
+struct grate_sprite {
+	float x, y, width, height;
+	float u0, v0, u1, v1;
+	float color[4];
+};
+
+struct grate_sprite_batch;
+
+struct grate_sprite_batch *grate_sprite_batch_create(struct grate *grate);
+void grate_sprite_batch_free(struct grate_sprite_batch *batch);
+int grate_sprite_batch_add(struct grate_sprite_batch *batch,
+			   struct grate_program *program,
+			   struct grate_texture *texture,
+			   const struct grate_sprite *sprite);
+int grate_sprite_batch_flush(struct grate_sprite_batch *batch,
+			     const struct grate_3d_ctx *ctx,
+			     unsigned render_target,
+			     struct grate_fence *fence);
+
+/* point sprite in clip space, drawn with the size of its system */
+struct grate_particle {
+	float position[3];
+	uint8_t color[4];
+};
+
+struct grate_particles;
+
+struct grate_particles *grate_particles_create(struct grate *grate);
+void grate_particles_free(struct grate_particles *particles);
+struct grate_particle *grate_particles_alloc(struct grate_particles *particles,
+					     unsigned int count);
+int grate_particles_draw(struct grate_particles *particles,
+			 const struct grate_3d_ctx *ctx,
+			 struct grate_program *program,
+			 struct grate_texture *texture,
+			 float size, struct grate_fence *fence);
+
+struct grate_text_batch;
+
+struct grate_text_batch *grate_text_batch_create(struct grate *grate);
+void grate_text_batch_free(struct grate_text_batch *batch);
+int grate_text_batch_printf(struct grate_text_batch *batch,
+			    struct grate_font *font, float x, float y,
+			    float scale, const char *fmt, ...);
+int grate_text_batch_flush(struct grate_text_batch *batch,
+			   const struct grate_3d_ctx *ctx,
+			   unsigned render_target);
+
+struct grate_hud;
+
+struct grate_hud *grate_hud_create(struct grate *grate);
+void grate_hud_free(struct grate_hud *hud);
+void grate_hud_draw(struct grate_hud *hud, struct grate_3d_ctx *ctx,
+		    unsigned int render_target);
+
 void grate_init_data_path(char *fpath);
 
 const struct host1x_chip_info *grate_chip_info(void);
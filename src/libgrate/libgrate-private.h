@@ -2,7 +2,9 @@
 #define GRATE_LIBGRATE_PRIVATE_H 1
 
 #include "grate.h"
+#include "grate-3d.h"
 #include "libcgc.h"
+#include "list.h"
 
 struct host1x_pushbuf;
 
@@ -17,9 +19,81 @@ struct grate_color {
 	float r, g, b, a;
 };
 
+#define GRATE_MAX_DAMAGE_RECTS	16
+
+struct grate_damage {
+	struct grate_rect rects[GRATE_MAX_DAMAGE_RECTS];
+	unsigned int count;
+	bool full;
+};
+
 struct grate_framebuffer {
 	struct host1x_framebuffer *front;
 	struct host1x_framebuffer *back;
+	/* previously presented buffer of triple buffering */
+	struct host1x_framebuffer *prev;
+
+	/* damage of the frame being drawn and of the last two frames */
+	struct grate_damage damage;
+	struct grate_damage history[2];
+
+	/* the back buffer holds a frame that wasn't presented */
+	bool dropped;
+};
+
+/* slab for sub-allocation of small buffers, see grate-suballoc.c */
+#define GRATE_SLAB_SIZE		(64 * 1024)
+#define GRATE_SUBALLOC_MAX_SIZE	2048
+
+/* max number of pending cross-engine waits of GR3D */
+#define GRATE_3D_MAX_WAITS	8
+
+struct grate_slab {
+	struct list_head list;
+	struct host1x_bo *bo;
+	unsigned long flags;
+	void *map;
+	size_t used;
+	unsigned int refs;
+
+	/* GR3D batch that was recorded when the last allocation was freed */
+	uint64_t batch;
+};
+
+struct grate_3d_wait {
+	struct host1x_client *client;
+	uint32_t value;
+};
+
+/* last draw of a batch, which the following one may be merged into */
+struct grate_3d_batch_draw {
+	struct grate_3d_ctx *ctx;
+	struct host1x_bo *indices;
+	unsigned long offset;
+	unsigned int primitive_type;
+	unsigned int index_mode;
+	unsigned int count;
+	bool provoking_vtx_last;
+	uint32_t *params;
+};
+
+struct grate_3d_batch {
+	struct host1x_job *job;
+	struct host1x_pushbuf *pb;
+	struct grate_fence targets;
+	struct grate_3d_batch_draw last;
+	bool coalesce;
+	bool active;
+
+	/* sequence of the recorded job and of the last submitted one */
+	uint64_t seq;
+	uint64_t submitted;
+	uint32_t value;
+
+	/* sequences of the batches that failed to submit, ascending */
+	uint64_t *failed;
+	unsigned int num_failed;
+	unsigned int max_failed;
 };
 
 struct grate {
@@ -28,10 +102,121 @@ struct grate {
 	struct grate_overlay *overlay;
 	struct grate_framebuffer *fb;
 	struct grate_color clear;
+	float clear_depth;
+	uint8_t clear_stencil;
 	struct host1x_options host1x_options;
 	struct host1x *host1x;
+	struct grate_3d_resident gr3d_resident;
+	uint32_t gr3d_fence;
+	struct host1x_bo *gr3d_init_bo;
+	struct host1x_pushbuf gr3d_init;
+	bool gr3d_initialized;
+	/* resets of GR3D seen, a hang recovery resets it behind our back */
+	unsigned int gr3d_resets;
+	/* see grate_options */
+	bool lazy_pixbufs;
+	struct grate_3d_batch batch;
+	bool pass_active;
+	bool pass_batched;
+	struct grate_3d_wait gr3d_waits[GRATE_3D_MAX_WAITS];
+	unsigned int num_gr3d_waits;
+	struct host1x_capture *capture;
+	enum grate_etc1_quality etc1_quality;
+	enum grate_dxt_quality dxt_quality;
+	const char *texture_cache;
+	const char *shader_cache;
+	struct list_head slabs;
+	struct list_head shared_textures;
+	unsigned long texture_share_hits;
+	/* frames swapped so far, for the residency of textures */
+	uint64_t frame;
+	struct list_head resident_textures;
+	size_t texture_budget;
+	size_t texture_resident_bytes;
+	unsigned long texture_evictions;
+	unsigned long texture_reloads;
+	/* pooled BOs of transient render targets */
+	struct list_head transients;
+	size_t transient_bytes;
+	struct grate_profile *profile;
+	struct grate_trace *trace;
+	struct grate_profile *bench;
+	unsigned int bench_frames;
+	struct grate_emit_stats *emit_stats;
+	/* set up by grate_init_async() */
+	struct grate_init *init;
+};
+
+/* frames rendered by --bench before the statistics are collected */
+#define GRATE_BENCH_WARMUP_FRAMES	30
+
+void grate_profile_reset(struct grate_profile *profile);
+
+int grate_trace_open(struct grate *grate, const char *path);
+void grate_trace_close(struct grate *grate);
+uint64_t grate_trace_now(struct grate *grate);
+void grate_trace_cpu(struct grate *grate, const char *name, uint64_t start);
+void grate_trace_gr3d_job(struct grate *grate, struct host1x_client *client,
+			  uint32_t fence);
+void grate_trace_poll(struct grate *grate);
+void grate_trace_counters(struct grate *grate, const char *name,
+			  const char * const *names, const uint64_t *values,
+			  unsigned int count);
+
+/* state groups emitted by grate_3d_setup_context(), in emission order */
+enum grate_emit_group {
+	GRATE_EMIT_CLASS,
+	GRATE_EMIT_DITHER,
+	GRATE_EMIT_SCISSOR,
+	GRATE_EMIT_GUARDBAND,
+	GRATE_EMIT_LATE_TEST,
+	GRATE_EMIT_POINT,
+	GRATE_EMIT_LINE,
+	GRATE_EMIT_PSEQ_DW_CFG,
+	GRATE_EMIT_DEPTH_RANGE,
+	GRATE_EMIT_DEPTH_BUFFER,
+	GRATE_EMIT_STENCIL,
+	GRATE_EMIT_POLYGON_OFFSET,
+	GRATE_EMIT_PSEQ,
+	GRATE_EMIT_TRAM_ROWS,
+	GRATE_EMIT_VIEWPORT,
+	GRATE_EMIT_CULL_FACE,
+	GRATE_EMIT_VS_UNIFORMS,
+	GRATE_EMIT_FS_UNIFORMS,
+	GRATE_EMIT_ATTRIBUTES,
+	GRATE_EMIT_RENDER_TARGETS,
+	GRATE_EMIT_TEXTURES,
+	GRATE_EMIT_SHADERS,
+	GRATE_EMIT_NUM_GROUPS
 };
 
+struct grate_emit_stats;
+
+/* counts of the pushbuf when the last group of a setup ended */
+struct grate_emit_mark {
+	struct grate_emit_stats *stats;
+	unsigned long words;
+	unsigned long relocs;
+};
+
+struct grate_emit_stats *grate_emit_stats_create(void);
+void grate_emit_stats_free(struct grate_emit_stats *stats);
+void grate_emit_stats_begin(struct grate_emit_mark *mark,
+			    struct grate_emit_stats *stats,
+			    struct host1x_pushbuf *pb);
+void grate_emit_stats_account(struct grate_emit_mark *mark,
+			      struct host1x_pushbuf *pb,
+			      enum grate_emit_group group);
+void grate_emit_stats_frame(struct grate *grate);
+void grate_emit_stats_print(struct grate_emit_stats *stats, FILE *fp);
+
+void grate_profile_job_begin(struct grate_profile *profile);
+void grate_profile_job_submit(struct grate_profile *profile);
+void grate_profile_job_submitted(struct grate_profile *profile,
+				 struct host1x_client *client, uint32_t fence);
+
+#define GRATE_CAPTURE_BUFFERS 3
+
 struct grate_display *grate_display_open(struct grate *grate);
 void grate_display_close(struct grate_display *display);
 void grate_display_get_resolution(struct grate_display *display,
@@ -39,6 +224,16 @@ void grate_display_get_resolution(struct grate_display *display,
 void grate_display_show(struct grate_display *display,
 			struct grate_framebuffer *fb,
 			bool vsync, bool reflect_y);
+void grate_display_flip(struct grate_display *display,
+			struct grate_framebuffer *fb, bool reflect_y);
+void grate_display_wait_flip(struct grate_display *display);
+bool grate_display_flip_pending(struct grate_display *display);
+int grate_display_get_vblank(struct grate_display *display,
+			     uint64_t *time, uint64_t *period);
+int grate_display_get_event_fd(struct grate_display *display);
+int grate_display_request_vblank(struct grate_display *display);
+int grate_display_handle_events(struct grate_display *display,
+				const struct host1x_display_events *events);
 
 struct grate_overlay *grate_overlay_create(struct grate_display *display);
 void grate_overlay_free(struct grate_overlay *overlay);
@@ -46,6 +241,142 @@ void grate_overlay_show(struct grate_overlay *overlay,
 			struct grate_framebuffer *fb, unsigned int x,
 			unsigned int y, unsigned int width,
 			unsigned int height, bool vsync, bool reflect_y);
+bool grate_overlay_supports(struct grate_overlay *overlay,
+			    struct grate_framebuffer *fb);
+int grate_overlay_queue(struct grate_overlay *overlay,
+			struct grate_framebuffer *fb, unsigned int x,
+			unsigned int y, unsigned int width,
+			unsigned int height, bool reflect_y);
+int grate_overlay_wait(struct grate_overlay *overlay, uint32_t timeout);
+
+void grate_framebuffer_swap(struct grate_framebuffer *fb);
+void grate_framebuffer_replace(struct grate_framebuffer *fb);
+
+void grate_input_raw(void);
+
+struct grate_init;
+
+struct grate *grate_open(struct grate_options *options, int fd, bool async);
+void grate_open_display(struct grate *grate);
+void grate_init_free(struct grate_init *init);
+
+int grate_3d_wait_idle(struct grate *grate);
+int grate_3d_flush_batch(struct grate *grate);
+int grate_fence_resolve(struct grate_fence *fence);
+void grate_3d_select_chip(enum tegra_soc_id soc_id);
+
+struct host1x_bo *grate_bo_suballoc(struct grate *grate, size_t size,
+				    unsigned long flags, void **map);
+void grate_suballoc_exit(struct grate *grate);
+
+void grate_transient_wait(struct grate *grate,
+			  struct host1x_pixelbuffer *pixbuf);
+void grate_transient_frame_end(struct grate *grate);
+void grate_transient_exit(struct grate *grate);
+
+bool grate_texture_unshare(struct grate_texture *tex);
+void grate_texture_share_exit(struct grate *grate);
+
+struct host1x_pixelbuffer *grate_texture_create_pixbuf(struct grate *grate,
+						unsigned width, unsigned height,
+						enum pixel_format format,
+						enum layout_format layout);
+void grate_texture_residency_add(struct grate *grate,
+				 struct grate_texture *tex,
+				 const char *path);
+void grate_texture_residency_remove(struct grate_texture *tex);
+void grate_texture_residency_trim(struct grate *grate);
+bool grate_texture_residency_reclaim(struct grate *grate);
+int grate_texture_make_resident(struct grate_texture *tex, bool write);
+void grate_texture_residency_touch(struct grate_texture *tex);
+
+struct grate_texture_cache_entry {
+	void *map;
+	size_t map_size;
+	const void *data;
+	size_t size;
+	enum pixel_format format;
+	unsigned int width;
+	unsigned int height;
+	unsigned int pitch;
+};
+
+#define GRATE_TEXTURE_MAX_LEVELS 16
+
+struct grate_texture_container {
+	void *map;
+	size_t map_size;
+	enum pixel_format format;
+	unsigned int width;
+	unsigned int height;
+	unsigned int num_levels;
+	struct {
+		void *data;
+		size_t size;
+	} levels[GRATE_TEXTURE_MAX_LEVELS];
+};
+
+int grate_texture_container_open(const char *path,
+				 struct grate_texture_container *container);
+void grate_texture_container_close(struct grate_texture_container *container);
+
+int grate_texture_stream_update(struct grate_texture *tex);
+void *grate_texture_decode(const char *path, bool alpha,
+			   unsigned *width, unsigned *height);
+
+#define GRATE_FNV1A_INIT	0xcbf29ce484222325ull
+
+/* 64-bit FNV-1a, used to key the on-disk caches */
+static inline uint64_t grate_fnv1a(uint64_t hash, const void *data,
+				   size_t size)
+{
+	const uint8_t *ptr = data;
+
+	while (size--) {
+		hash ^= *ptr++;
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+int grate_texture_cache_key(struct grate *grate, const char *path,
+			    enum pixel_format format,
+			    enum layout_format layout,
+			    unsigned int width, unsigned int height,
+			    uint64_t *key);
+int grate_texture_cache_lookup(struct grate *grate, uint64_t key,
+			       struct grate_texture_cache_entry *entry);
+void grate_texture_cache_release(struct grate_texture_cache_entry *entry);
+int grate_texture_cache_store(struct grate *grate, uint64_t key,
+			      enum pixel_format format,
+			      unsigned int width, unsigned int height,
+			      unsigned int pitch, const void *data,
+			      size_t size);
+
+bool grate_convert_supported(enum pixel_format format);
+int grate_convert_rgba(enum pixel_format format, bool premultiply,
+		       const void *src, unsigned int src_pitch,
+		       void *dst, unsigned int dst_pitch,
+		       unsigned int width, unsigned int height);
+
+bool grate_asm_cache_put(struct grate_shader *shader);
+struct grate_shader *grate_shader_copy(struct grate_shader *shader,
+				       unsigned int num_words);
+int grate_fragment_schedule(struct grate_program *program);
+int grate_linker_optimize(struct grate_program *program, unsigned int level);
+
+int grate_shader_write(FILE *fp, struct grate_shader *shader);
+struct grate_shader *grate_shader_read(const void *data, size_t size,
+				       size_t *consumed);
+struct grate_shader *grate_shader_from_cgc(struct cgc_shader *cgc);
+
+uint64_t grate_shader_cache_key(enum cgc_shader_type type, const char *code,
+				size_t length);
+struct grate_shader *grate_shader_cache_lookup(struct grate *grate,
+					       uint64_t key);
+int grate_shader_cache_store(struct grate *grate, uint64_t key,
+			     struct grate_shader *shader);
 
 #define grate_error(fmt, args...) \
 	fprintf(stderr, "\033[31mERROR: %s: " fmt "\033[0m", \
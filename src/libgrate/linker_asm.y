@@ -28,26 +28,34 @@
 
 #include "asm.h"
 
-#define PARSE_ERROR(txt)	\
-	{			\
-		yyerror(txt);	\
-		YYABORT;	\
+#define PARSE_ERROR(txt)		\
+	{				\
+		yyerror(scanner, txt);	\
+		YYABORT;		\
 	}
 
-extern int linker_asmlex(void);
-extern int linker_asmlineno;
+extern int linker_asmget_lineno(void *scanner);
 
-void __attribute__((weak)) yyerror(char *err)
+void __attribute__((weak)) yyerror(void *scanner, char *err)
 {
-	fprintf(stderr, "linker: line %d: %s\n", linker_asmlineno, err);
+	fprintf(stderr, "linker: line %d: %s\n",
+		linker_asmget_lineno(scanner), err);
 }
 
-link_instr asm_linker_instructions[32];
-unsigned asm_linker_instructions_nb;
-unsigned asm_linker_used_tram_rows_nb;
+__thread link_instr asm_linker_instructions[32];
+__thread unsigned asm_linker_instructions_nb;
+__thread unsigned asm_linker_used_tram_rows_nb;
 
 %}
 
+%define api.pure full
+%lex-param {void *scanner}
+%parse-param {void *scanner}
+
+%code {
+extern int linker_asmlex(YYSTYPE *lval, void *scanner);
+}
+
 %token <u> T_EXPORT
 %token <u> T_TRAM_ROW
 
@@ -108,8 +116,6 @@ instructions: instructions instruction
 		memset(asm_linker_instructions, 0, sizeof(asm_linker_instructions));
 		asm_linker_instructions_nb = 0;
 		asm_linker_used_tram_rows_nb = 1;
-
-		linker_asmlineno = 1;
 	}
 	;
 
@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm.h"
+#include "grate.h"
+#include "host1x.h"
+#include "libgrate-private.h"
+
+/*
+ * Repacks the varyings of a program into the fewest TRAM rows and linker
+ * instructions. The MFU interpolates every column of a TRAM row into the
+ * row register of the same index, so varyings keep their column and only
+ * move between rows:
+ *
+ * - columns the fragment program never interpolates are dropped from the
+ *   linker, instructions left without columns are removed;
+ * - rows whose columns don't overlap are merged, the interpolation sources
+ *   of the fragment program are remapped accordingly;
+ * - instructions linking the same export into the same row are merged.
+ *
+ * Exports which aren't linked anymore are eliminated by the vertex pass
+ * running afterwards.
+ */
+
+#define TRAM_ROWS		16
+#define LINK_MAX_INSTRUCTIONS	32
+
+struct tram_column {
+	unsigned type;
+	unsigned swizzle;
+	unsigned const_across_width;
+	unsigned const_across_length;
+	unsigned across_point;
+	unsigned interpolation_disable;
+};
+
+static void tram_get_column(const link_instr *instr, unsigned c,
+			    struct tram_column *column)
+{
+	switch (c) {
+	case 0:
+		column->type = instr->tram_dst_type_x;
+		column->swizzle = instr->tram_dst_swizzle_x;
+		column->const_across_width = instr->const_x_across_width;
+		column->const_across_length = instr->const_x_across_length;
+		column->across_point = instr->x_across_point;
+		column->interpolation_disable = instr->interpolation_disable_x;
+		break;
+
+	case 1:
+		column->type = instr->tram_dst_type_y;
+		column->swizzle = instr->tram_dst_swizzle_y;
+		column->const_across_width = instr->const_y_across_width;
+		column->const_across_length = instr->const_y_across_length;
+		column->across_point = instr->y_across_point;
+		column->interpolation_disable = instr->interpolation_disable_y;
+		break;
+
+	case 2:
+		column->type = instr->tram_dst_type_z;
+		column->swizzle = instr->tram_dst_swizzle_z;
+		column->const_across_width = instr->const_z_across_width;
+		column->const_across_length = instr->const_z_across_length;
+		column->across_point = instr->z_across_point;
+		column->interpolation_disable = instr->interpolation_disable_z;
+		break;
+
+	case 3:
+		column->type = instr->tram_dst_type_w;
+		column->swizzle = instr->tram_dst_swizzle_w;
+		column->const_across_width = instr->const_w_across_width;
+		column->const_across_length = instr->const_w_across_length;
+		column->across_point = instr->w_across_point;
+		column->interpolation_disable = instr->interpolation_disable_w;
+		break;
+	}
+}
+
+static void tram_set_column(link_instr *instr, unsigned c,
+			    const struct tram_column *column)
+{
+	switch (c) {
+	case 0:
+		instr->tram_dst_type_x = column->type;
+		instr->tram_dst_swizzle_x = column->swizzle;
+		instr->const_x_across_width = column->const_across_width;
+		instr->const_x_across_length = column->const_across_length;
+		instr->x_across_point = column->across_point;
+		instr->interpolation_disable_x = column->interpolation_disable;
+		break;
+
+	case 1:
+		instr->tram_dst_type_y = column->type;
+		instr->tram_dst_swizzle_y = column->swizzle;
+		instr->const_y_across_width = column->const_across_width;
+		instr->const_y_across_length = column->const_across_length;
+		instr->y_across_point = column->across_point;
+		instr->interpolation_disable_y = column->interpolation_disable;
+		break;
+
+	case 2:
+		instr->tram_dst_type_z = column->type;
+		instr->tram_dst_swizzle_z = column->swizzle;
+		instr->const_z_across_width = column->const_across_width;
+		instr->const_z_across_length = column->const_across_length;
+		instr->z_across_point = column->across_point;
+		instr->interpolation_disable_z = column->interpolation_disable;
+		break;
+
+	case 3:
+		instr->tram_dst_type_w = column->type;
+		instr->tram_dst_swizzle_w = column->swizzle;
+		instr->const_w_across_width = column->const_across_width;
+		instr->const_w_across_length = column->const_across_length;
+		instr->w_across_point = column->across_point;
+		instr->interpolation_disable_w = column->interpolation_disable;
+		break;
+	}
+}
+
+/* mask of the TRAM columns written by the instruction */
+static unsigned tram_columns(const link_instr *instr)
+{
+	struct tram_column column;
+	unsigned c, mask = 0;
+
+	for (c = 0; c < 4; c++) {
+		tram_get_column(instr, c, &column);
+
+		if (column.type != TRAM_DST_NONE)
+			mask |= BIT(c);
+	}
+
+	return mask;
+}
+
+/*
+ * Returns the index of the first word written to the given register by a
+ * NONINCR or INCR opcode, -1 if there is none or the stream can't be
+ * walked.
+ */
+static int tram_find_section(const struct grate_shader *shader,
+			     unsigned offset, unsigned *count)
+{
+	unsigned i, opcode, reg, num;
+
+	for (i = 0; i < shader->num_words; i += 1 + num) {
+		opcode = shader->words[i] >> 28;
+		reg = (shader->words[i] >> 16) & 0xfff;
+		num = shader->words[i] & 0xffff;
+
+		switch (opcode) {
+		case 1: /* INCR */
+		case 2: /* NONINCR */
+			if (i + 1 + num > shader->num_words)
+				return -1;
+
+			if (reg == offset) {
+				*count = num;
+				return i + 1;
+			}
+			break;
+
+		case 4: /* IMM */
+			num = 0;
+			break;
+
+		default:
+			return -1;
+		}
+	}
+
+	return -1;
+}
+
+static void tram_mfu_get_var(const mfu_instr *mfu, unsigned k,
+			     unsigned *opcode, unsigned *source)
+{
+	switch (k) {
+	case 0:
+		*opcode = mfu->var0_opcode;
+		*source = mfu->var0_source;
+		break;
+	case 1:
+		*opcode = mfu->var1_opcode;
+		*source = mfu->var1_source;
+		break;
+	case 2:
+		*opcode = mfu->var2_opcode;
+		*source = mfu->var2_source;
+		break;
+	case 3:
+		*opcode = mfu->var3_opcode;
+		*source = mfu->var3_source;
+		break;
+	}
+}
+
+static void tram_mfu_set_source(mfu_instr *mfu, unsigned k, unsigned source)
+{
+	switch (k) {
+	case 0:
+		mfu->var0_source = source;
+		break;
+	case 1:
+		mfu->var1_source = source;
+		break;
+	case 2:
+		mfu->var2_source = source;
+		break;
+	case 3:
+		mfu->var3_source = source;
+		break;
+	}
+}
+
+/* columns of every TRAM row interpolated by the fragment program */
+static int tram_read_columns(const struct grate_shader *fs,
+			     uint8_t reads[TRAM_ROWS])
+{
+	unsigned i, k, count, opcode, source;
+	mfu_instr mfu;
+	int pos;
+
+	pos = tram_find_section(fs, 0x604, &count);
+	if (pos < 0 || count % 2)
+		return -EINVAL;
+
+	memset(reads, 0, TRAM_ROWS);
+
+	for (i = 0; i < count / 2; i++) {
+		mfu.part1 = fs->words[pos + i * 2 + 0];
+		mfu.part0 = fs->words[pos + i * 2 + 1];
+
+		for (k = 0; k < 4; k++) {
+			tram_mfu_get_var(&mfu, k, &opcode, &source);
+
+			if (opcode != MFU_VAR_NOP)
+				reads[source] |= BIT(k);
+		}
+	}
+
+	return 0;
+}
+
+static struct grate_shader *tram_remap_fs(struct grate_shader *fs,
+					  const unsigned map[TRAM_ROWS])
+{
+	struct grate_shader *shader;
+	unsigned i, k, count, opcode, source;
+	mfu_instr mfu;
+	int pos;
+
+	pos = tram_find_section(fs, 0x604, &count);
+	if (pos < 0)
+		return NULL;
+
+	shader = grate_shader_copy(fs, fs->num_words);
+	if (!shader)
+		return NULL;
+
+	memcpy(shader->words, fs->words, fs->num_words * 4);
+
+	for (i = 0; i < count / 2; i++) {
+		mfu.part1 = shader->words[pos + i * 2 + 0];
+		mfu.part0 = shader->words[pos + i * 2 + 1];
+
+		for (k = 0; k < 4; k++) {
+			tram_mfu_get_var(&mfu, k, &opcode, &source);
+
+			if (opcode != MFU_VAR_NOP)
+				tram_mfu_set_source(&mfu, k, map[source]);
+		}
+
+		shader->words[pos + i * 2 + 0] = mfu.part1;
+		shader->words[pos + i * 2 + 1] = mfu.part0;
+	}
+
+	return shader;
+}
+
+static bool tram_can_merge(const link_instr *a, const link_instr *b)
+{
+	return a->vertex_export_index == b->vertex_export_index &&
+	       a->vec4_select == b->vec4_select &&
+	       a->tram_row_index == b->tram_row_index &&
+	       !(tram_columns(a) & tram_columns(b));
+}
+
+static void tram_merge(link_instr *dst, const link_instr *src)
+{
+	struct tram_column column;
+	unsigned c;
+
+	for (c = 0; c < 4; c++) {
+		tram_get_column(src, c, &column);
+
+		if (column.type != TRAM_DST_NONE)
+			tram_set_column(dst, c, &column);
+	}
+}
+
+int grate_linker_optimize(struct grate_program *program, unsigned int level)
+{
+	struct grate_shader *linker = program->linker, *fs = NULL, *shader;
+	link_instr instrs[LINK_MAX_INSTRUCTIONS];
+	struct tram_column column, none = { 0 };
+	unsigned used[TRAM_ROWS] = { 0 }, rows[TRAM_ROWS] = { 0 };
+	unsigned map[TRAM_ROWS] = { 0 };
+	uint8_t reads[TRAM_ROWS];
+	unsigned i, j, c, count, num, rows_nb = 0;
+	bool changed = false;
+	bool remap = false;
+
+	if (linker->num_words < 1 ||
+	    linker->words[0] >> 28 != 1 ||
+	    ((linker->words[0] >> 16) & 0xfff) != 0x300)
+		return 0;
+
+	count = (linker->words[0] & 0xffff) / 2;
+	if (!count || count > LINK_MAX_INSTRUCTIONS ||
+	    linker->num_words != 1 + count * 2)
+		return 0;
+
+	/* without knowing what's interpolated nothing can be dropped */
+	if (tram_read_columns(program->fs, reads) < 0)
+		return 0;
+
+	for (i = 0, num = 0; i < count; i++) {
+		link_instr *instr = &instrs[num];
+
+		instr->first = linker->words[1 + i * 2];
+		instr->latter = linker->words[2 + i * 2];
+
+		for (c = 0; c < 4; c++) {
+			tram_get_column(instr, c, &column);
+
+			if (column.type != TRAM_DST_NONE &&
+			    !(reads[instr->tram_row_index] & BIT(c))) {
+				tram_set_column(instr, c, &none);
+				changed = true;
+			}
+		}
+
+		if (tram_columns(instr)) {
+			used[instr->tram_row_index] |= tram_columns(instr);
+			num++;
+		}
+	}
+
+	if (!num)
+		return 0;
+
+	/* first fit, row 0 stays in place */
+	for (i = 0; i < TRAM_ROWS; i++) {
+		if (!used[i])
+			continue;
+
+		/* without repacking rows only shrink from the end */
+		if (level < 2) {
+			map[i] = i;
+			rows_nb = i + 1;
+			continue;
+		}
+
+		for (j = 0; j < rows_nb; j++)
+			if (!(rows[j] & used[i]))
+				break;
+
+		if (j == rows_nb)
+			rows_nb++;
+
+		rows[j] |= used[i];
+		map[i] = j;
+
+		if (j != i)
+			remap = true;
+	}
+
+	for (i = 0; i < num; i++)
+		instrs[i].tram_row_index = map[instrs[i].tram_row_index];
+
+	/* merging instructions is part of the packing */
+	for (i = 0; i < num && level > 1; i++) {
+		for (j = i + 1; j < num; ) {
+			if (!tram_can_merge(&instrs[i], &instrs[j])) {
+				j++;
+				continue;
+			}
+
+			tram_merge(&instrs[i], &instrs[j]);
+			memmove(&instrs[j], &instrs[j + 1],
+				(num - j - 1) * sizeof(instrs[0]));
+			num--;
+		}
+	}
+
+	if (!changed && !remap && num == count &&
+	    rows_nb == linker->used_tram_rows_nb)
+		return 0;
+
+	if (remap) {
+		fs = tram_remap_fs(program->fs, map);
+		if (!fs)
+			return -ENOMEM;
+	}
+
+	shader = grate_shader_copy(linker, 1 + num * 2);
+	if (!shader) {
+		grate_shader_free(fs);
+		return -ENOMEM;
+	}
+
+	shader->words[0] = HOST1X_OPCODE_INCR(0x300, num * 2);
+
+	for (i = 0; i < num; i++) {
+		shader->words[1 + i * 2] = instrs[i].first;
+		shader->words[2 + i * 2] = instrs[i].latter;
+	}
+
+	shader->used_tram_rows_nb = rows_nb;
+	shader->linker_inst_nb = num;
+
+	grate_info("linker: %u -> %u instructions, %u -> %u TRAM rows\n",
+		   count, num, linker->used_tram_rows_nb, rows_nb);
+
+	if (program->owns_linker)
+		grate_shader_free(program->linker);
+
+	program->linker = shader;
+	program->owns_linker = true;
+
+	if (fs) {
+		grate_shader_free(program->fs);
+		program->fs = fs;
+	}
+
+	return 0;
+}
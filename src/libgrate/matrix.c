@@ -24,11 +24,64 @@
 
 #include <math.h>
 
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 #include "matrix.h"
 
+#ifdef __ARM_NEON
+/*
+ * Every row of the product is a sum of the rows of b scaled by the
+ * elements of the row of a, which is passed in registers. The rows of b
+ * are loaded before the result is stored, hence the result may alias b.
+ */
+static inline void mat4_multiply_rows(float *result, float32x4_t a0,
+				      float32x4_t a1, float32x4_t a2,
+				      float32x4_t a3, const float *b)
+{
+	float32x4_t b0 = vld1q_f32(b + 0);
+	float32x4_t b1 = vld1q_f32(b + 4);
+	float32x4_t b2 = vld1q_f32(b + 8);
+	float32x4_t b3 = vld1q_f32(b + 12);
+	float32x4_t r0, r1, r2, r3;
+
+	r0 = vmulq_n_f32(b0, vgetq_lane_f32(a0, 0));
+	r1 = vmulq_n_f32(b0, vgetq_lane_f32(a1, 0));
+	r2 = vmulq_n_f32(b0, vgetq_lane_f32(a2, 0));
+	r3 = vmulq_n_f32(b0, vgetq_lane_f32(a3, 0));
+
+	r0 = vmlaq_n_f32(r0, b1, vgetq_lane_f32(a0, 1));
+	r1 = vmlaq_n_f32(r1, b1, vgetq_lane_f32(a1, 1));
+	r2 = vmlaq_n_f32(r2, b1, vgetq_lane_f32(a2, 1));
+	r3 = vmlaq_n_f32(r3, b1, vgetq_lane_f32(a3, 1));
+
+	r0 = vmlaq_n_f32(r0, b2, vgetq_lane_f32(a0, 2));
+	r1 = vmlaq_n_f32(r1, b2, vgetq_lane_f32(a1, 2));
+	r2 = vmlaq_n_f32(r2, b2, vgetq_lane_f32(a2, 2));
+	r3 = vmlaq_n_f32(r3, b2, vgetq_lane_f32(a3, 2));
+
+	r0 = vmlaq_n_f32(r0, b3, vgetq_lane_f32(a0, 3));
+	r1 = vmlaq_n_f32(r1, b3, vgetq_lane_f32(a1, 3));
+	r2 = vmlaq_n_f32(r2, b3, vgetq_lane_f32(a2, 3));
+	r3 = vmlaq_n_f32(r3, b3, vgetq_lane_f32(a3, 3));
+
+	vst1q_f32(result + 0, r0);
+	vst1q_f32(result + 4, r1);
+	vst1q_f32(result + 8, r2);
+	vst1q_f32(result + 12, r3);
+}
+#endif
+
 void mat4_multiply(struct mat4 *result, const struct mat4 *a,
 		   const struct mat4 *b)
 {
+#ifdef __ARM_NEON
+	const float *m = &a->xx;
+
+	mat4_multiply_rows(&result->xx, vld1q_f32(m + 0), vld1q_f32(m + 4),
+			   vld1q_f32(m + 8), vld1q_f32(m + 12), &b->xx);
+#else
 	result->xx = a->xx * b->xx + a->xy * b->yx + a->xz * b->zx + a->xw * b->wx;
 	result->xy = a->xx * b->xy + a->xy * b->yy + a->xz * b->zy + a->xw * b->wy;
 	result->xz = a->xx * b->xz + a->xy * b->yz + a->xz * b->zz + a->xw * b->wz;
@@ -48,6 +101,129 @@ void mat4_multiply(struct mat4 *result, const struct mat4 *a,
 	result->wy = a->wx * b->xy + a->wy * b->yy + a->wz * b->zy + a->ww * b->wy;
 	result->wz = a->wx * b->xz + a->wy * b->yz + a->wz * b->zz + a->ww * b->wz;
 	result->ww = a->wx * b->xw + a->wy * b->yw + a->wz * b->zw + a->ww * b->ww;
+#endif
+}
+
+/* result[i] = a[i] * b[i] */
+void mat4_multiply_array(struct mat4 *result, const struct mat4 *a,
+			 const struct mat4 *b, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		mat4_multiply(&result[i], &a[i], &b[i]);
+}
+
+/* mvp[i] = view_projection * models[i] */
+void mat4_multiply_mvp(struct mat4 *mvp, const struct mat4 *view_projection,
+		       const struct mat4 *models, unsigned int count)
+{
+	unsigned int i;
+
+#ifdef __ARM_NEON
+	const float *vp = &view_projection->xx;
+	float32x4_t a0 = vld1q_f32(vp + 0);
+	float32x4_t a1 = vld1q_f32(vp + 4);
+	float32x4_t a2 = vld1q_f32(vp + 8);
+	float32x4_t a3 = vld1q_f32(vp + 12);
+
+	/* the shared matrix stays in registers for all of the objects */
+	for (i = 0; i < count; i++)
+		mat4_multiply_rows(&mvp[i].xx, a0, a1, a2, a3, &models[i].xx);
+#else
+	for (i = 0; i < count; i++)
+		mat4_multiply(&mvp[i], view_projection, &models[i]);
+#endif
+}
+
+/*
+ * Transform arrays of column vectors. The NEON versions de-interleave four
+ * vectors at a time into one register per component, so that every
+ * component of the result is computed for the four vectors at once.
+ */
+void mat4_transform_vec4(struct vec4 *result, const struct mat4 *m,
+			 const struct vec4 *v, unsigned int count)
+{
+	unsigned int i = 0;
+
+#ifdef __ARM_NEON
+	for (; i + 4 <= count; i += 4) {
+		float32x4x4_t in = vld4q_f32(&v[i].x);
+		float32x4x4_t out;
+
+		out.val[0] = vmulq_n_f32(in.val[0], m->xx);
+		out.val[0] = vmlaq_n_f32(out.val[0], in.val[1], m->xy);
+		out.val[0] = vmlaq_n_f32(out.val[0], in.val[2], m->xz);
+		out.val[0] = vmlaq_n_f32(out.val[0], in.val[3], m->xw);
+
+		out.val[1] = vmulq_n_f32(in.val[0], m->yx);
+		out.val[1] = vmlaq_n_f32(out.val[1], in.val[1], m->yy);
+		out.val[1] = vmlaq_n_f32(out.val[1], in.val[2], m->yz);
+		out.val[1] = vmlaq_n_f32(out.val[1], in.val[3], m->yw);
+
+		out.val[2] = vmulq_n_f32(in.val[0], m->zx);
+		out.val[2] = vmlaq_n_f32(out.val[2], in.val[1], m->zy);
+		out.val[2] = vmlaq_n_f32(out.val[2], in.val[2], m->zz);
+		out.val[2] = vmlaq_n_f32(out.val[2], in.val[3], m->zw);
+
+		out.val[3] = vmulq_n_f32(in.val[0], m->wx);
+		out.val[3] = vmlaq_n_f32(out.val[3], in.val[1], m->wy);
+		out.val[3] = vmlaq_n_f32(out.val[3], in.val[2], m->wz);
+		out.val[3] = vmlaq_n_f32(out.val[3], in.val[3], m->ww);
+
+		vst4q_f32(&result[i].x, out);
+	}
+#endif
+	for (; i < count; i++) {
+		struct vec4 in = v[i];
+
+		result[i].x = m->xx * in.x + m->xy * in.y + m->xz * in.z +
+			      m->xw * in.w;
+		result[i].y = m->yx * in.x + m->yy * in.y + m->yz * in.z +
+			      m->yw * in.w;
+		result[i].z = m->zx * in.x + m->zy * in.y + m->zz * in.z +
+			      m->zw * in.w;
+		result[i].w = m->wx * in.x + m->wy * in.y + m->wz * in.z +
+			      m->ww * in.w;
+	}
+}
+
+/* points with an implicit w of 1, the w row of the matrix is ignored */
+void mat4_transform_vec3(struct vec3 *result, const struct mat4 *m,
+			 const struct vec3 *v, unsigned int count)
+{
+	unsigned int i = 0;
+
+#ifdef __ARM_NEON
+	for (; i + 4 <= count; i += 4) {
+		float32x4x3_t in = vld3q_f32(&v[i].x);
+		float32x4x3_t out;
+
+		out.val[0] = vdupq_n_f32(m->xw);
+		out.val[0] = vmlaq_n_f32(out.val[0], in.val[0], m->xx);
+		out.val[0] = vmlaq_n_f32(out.val[0], in.val[1], m->xy);
+		out.val[0] = vmlaq_n_f32(out.val[0], in.val[2], m->xz);
+
+		out.val[1] = vdupq_n_f32(m->yw);
+		out.val[1] = vmlaq_n_f32(out.val[1], in.val[0], m->yx);
+		out.val[1] = vmlaq_n_f32(out.val[1], in.val[1], m->yy);
+		out.val[1] = vmlaq_n_f32(out.val[1], in.val[2], m->yz);
+
+		out.val[2] = vdupq_n_f32(m->zw);
+		out.val[2] = vmlaq_n_f32(out.val[2], in.val[0], m->zx);
+		out.val[2] = vmlaq_n_f32(out.val[2], in.val[1], m->zy);
+		out.val[2] = vmlaq_n_f32(out.val[2], in.val[2], m->zz);
+
+		vst3q_f32(&result[i].x, out);
+	}
+#endif
+	for (; i < count; i++) {
+		struct vec3 in = v[i];
+
+		result[i].x = m->xx * in.x + m->xy * in.y + m->xz * in.z + m->xw;
+		result[i].y = m->yx * in.x + m->yy * in.y + m->yz * in.z + m->yw;
+		result[i].z = m->zx * in.x + m->zy * in.y + m->zz * in.z + m->zw;
+	}
 }
 
 void mat4_zero(struct mat4 *m)
@@ -32,8 +32,24 @@ struct mat4 {
 	float wx, wy, wz, ww;
 };
 
+struct vec3 {
+	float x, y, z;
+};
+
+struct vec4 {
+	float x, y, z, w;
+};
+
 void mat4_multiply(struct mat4 *result, const struct mat4 *a,
 		   const struct mat4 *b);
+void mat4_multiply_array(struct mat4 *result, const struct mat4 *a,
+			 const struct mat4 *b, unsigned int count);
+void mat4_multiply_mvp(struct mat4 *mvp, const struct mat4 *view_projection,
+		       const struct mat4 *models, unsigned int count);
+void mat4_transform_vec4(struct vec4 *result, const struct mat4 *m,
+			 const struct vec4 *v, unsigned int count);
+void mat4_transform_vec3(struct vec3 *result, const struct mat4 *m,
+			 const struct vec3 *v, unsigned int count);
 void mat4_zero(struct mat4 *m);
 void mat4_identity(struct mat4 *m);
 void mat4_translate(struct mat4 *m, float x, float y, float z);
@@ -21,14 +21,116 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "libgrate-private.h"
 
+#define GRATE_PROFILE_MAX_PASSES	8
+#define GRATE_PROFILE_MAX_JOBS		64
+#define GRATE_PROFILE_BUCKETS		16
+#define GRATE_PROFILE_MAX_FRAMES	1024
+#define GRATE_PROFILE_MAX_CLOCKS	8
+#define GRATE_PROFILE_CLOCK_PERIOD_US	100000
+#define GRATE_PROFILE_MAX_BUSY		4096
+
+/* log2 histogram of durations in microseconds */
+struct grate_profile_histogram {
+	unsigned int buckets[GRATE_PROFILE_BUCKETS];
+	uint64_t total;
+	unsigned int count;
+};
+
+struct grate_profile_pass {
+	const char *name;
+	struct grate_profile_histogram record;
+	struct grate_profile_histogram submit;
+	struct grate_profile_histogram gpu;
+};
+
+/* submitted GR3D job, which completion isn't observed yet */
+struct grate_profile_job {
+	struct grate_profile_pass *pass;
+	uint64_t submitted;
+	uint32_t fence;
+};
+
+/* rate of a clock or of a devfreq device, sampled in Hz */
+struct grate_profile_clock {
+	char name[32];
+	int fd;
+	uint64_t min;
+	uint64_t max;
+	uint64_t total;
+	unsigned int count;
+};
+
+/* time span during which GR3D executed jobs */
+struct grate_profile_busy {
+	uint64_t start;
+	uint64_t end;
+};
+
+/* average per-frame idle times of GR3D and of the CPU, in microseconds */
+struct grate_profile_overlap {
+	unsigned int count;
+	double frame;
+	double gpu_idle;
+	double cpu_wait;
+	uint64_t gpu_idle_max;
+	uint64_t cpu_wait_max;
+};
+
+/* statistics of the frame durations in the sample ring */
+struct grate_profile_frame_stats {
+	unsigned int count;
+	uint64_t p50;
+	uint64_t p95;
+	uint64_t p99;
+	uint64_t max;
+	unsigned int janks;
+	struct grate_profile_histogram hist;
+};
+
 struct grate_profile {
+	struct grate *grate;
 	struct timespec start;
 	struct timespec end;
 	unsigned int frames;
+
+	/* durations of the most recent frames in microseconds */
+	uint32_t frame_times[GRATE_PROFILE_MAX_FRAMES];
+	uint64_t last_frame;
+
+	/* end of every frame and CPU time spent waiting for the engines */
+	uint64_t frame_ends[GRATE_PROFILE_MAX_FRAMES];
+	uint32_t frame_waits[GRATE_PROFILE_MAX_FRAMES];
+	uint64_t wait_time;
+
+	struct grate_profile_busy busy[GRATE_PROFILE_MAX_BUSY];
+	unsigned int num_busy;
+
+	struct grate_profile_pass passes[GRATE_PROFILE_MAX_PASSES];
+	struct grate_profile_pass *pass;
+	unsigned int num_passes;
+
+	struct grate_profile_job jobs[GRATE_PROFILE_MAX_JOBS];
+	unsigned int first_job;
+	unsigned int num_jobs;
+
+	struct grate_profile_clock clocks[GRATE_PROFILE_MAX_CLOCKS];
+	unsigned int num_clocks;
+	uint64_t last_clock_sample;
+
+	struct host1x_client *client;
+	uint64_t record_start;
+	uint64_t submit_start;
+	uint64_t last_done;
 };
 
 static float timespec_diff(const struct timespec *start,
@@ -45,12 +147,481 @@ static float timespec_diff(const struct timespec *start,
 	return seconds + ns / 1000000000.0f;
 }
 
+static uint64_t grate_profile_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void grate_profile_add_clock(struct grate_profile *profile,
+				    const char *name, const char *path)
+{
+	struct grate_profile_clock *clock;
+	int fd;
+
+	if (profile->num_clocks == GRATE_PROFILE_MAX_CLOCKS)
+		return;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	clock = &profile->clocks[profile->num_clocks++];
+	snprintf(clock->name, sizeof(clock->name), "%.*s",
+		 (int)sizeof(clock->name) - 1, name);
+	clock->fd = fd;
+}
+
+/*
+ * Clock rates are read from the common clock framework in debugfs, which
+ * needs to be mounted and readable, and from the devfreq devices, which
+ * scale the memory and GPU clocks. Unavailable sources are skipped.
+ */
+static void grate_profile_open_clocks(struct grate_profile *profile)
+{
+	static const char * const clocks[] = {
+		"host1x", "gr2d", "gr3d", "emc",
+	};
+	struct dirent *entry;
+	char path[PATH_MAX];
+	unsigned int i;
+	DIR *dir;
+	int len;
+
+	for (i = 0; i < ARRAY_SIZE(clocks); i++) {
+		snprintf(path, sizeof(path),
+			 "/sys/kernel/debug/clk/%s/clk_rate", clocks[i]);
+		grate_profile_add_clock(profile, clocks[i], path);
+	}
+
+	dir = opendir("/sys/class/devfreq");
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+
+		len = snprintf(path, sizeof(path),
+			       "/sys/class/devfreq/%s/cur_freq", entry->d_name);
+		if (len < 0 || (size_t)len >= sizeof(path))
+			continue;
+
+		grate_profile_add_clock(profile, entry->d_name, path);
+	}
+
+	closedir(dir);
+}
+
+static void grate_profile_close_clocks(struct grate_profile *profile)
+{
+	unsigned int i;
+
+	for (i = 0; i < profile->num_clocks; i++)
+		close(profile->clocks[i].fd);
+
+	profile->num_clocks = 0;
+}
+
+static void grate_profile_sample_clocks(struct grate_profile *profile,
+					bool force)
+{
+	uint64_t now = grate_profile_now();
+	struct grate_profile_clock *clock;
+	char buf[32];
+	uint64_t rate;
+	unsigned int i;
+	ssize_t len;
+
+	if (!force && now - profile->last_clock_sample <
+			GRATE_PROFILE_CLOCK_PERIOD_US)
+		return;
+
+	profile->last_clock_sample = now;
+
+	for (i = 0; i < profile->num_clocks; i++) {
+		clock = &profile->clocks[i];
+
+		len = pread(clock->fd, buf, sizeof(buf) - 1, 0);
+		if (len <= 0)
+			continue;
+
+		buf[len] = '\0';
+		rate = strtoull(buf, NULL, 10);
+
+		if (!clock->count || rate < clock->min)
+			clock->min = rate;
+
+		if (rate > clock->max)
+			clock->max = rate;
+
+		clock->total += rate;
+		clock->count++;
+	}
+}
+
+static void grate_profile_reset_clocks(struct grate_profile *profile)
+{
+	unsigned int i;
+
+	for (i = 0; i < profile->num_clocks; i++) {
+		profile->clocks[i].min = 0;
+		profile->clocks[i].max = 0;
+		profile->clocks[i].total = 0;
+		profile->clocks[i].count = 0;
+	}
+
+	grate_profile_sample_clocks(profile, true);
+}
+
+static void grate_profile_histogram_add(struct grate_profile_histogram *hist,
+					uint64_t us)
+{
+	unsigned int bucket = 0;
+
+	while (bucket < GRATE_PROFILE_BUCKETS - 1 && (us >> bucket) > 1)
+		bucket++;
+
+	hist->buckets[bucket]++;
+	hist->total += us;
+	hist->count++;
+}
+
+static void grate_profile_histogram_dump(struct grate_profile_histogram *hist,
+					 const char *name, FILE *fp)
+{
+	unsigned int i;
+
+	if (!hist->count)
+		return;
+
+	fprintf(fp, "  %-6s avg %8.1f us:", name,
+		(double)hist->total / hist->count);
+
+	for (i = 0; i < GRATE_PROFILE_BUCKETS; i++)
+		fprintf(fp, " %u", hist->buckets[i]);
+
+	fprintf(fp, "\n");
+}
+
+static int grate_profile_compare(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* jank is a frame that took over 1.5x the median */
+static void grate_profile_frame_stats(struct grate_profile *profile,
+				      struct grate_profile_frame_stats *stats)
+{
+	uint32_t sorted[GRATE_PROFILE_MAX_FRAMES];
+	unsigned int i, count;
+
+	memset(stats, 0, sizeof(*stats));
+
+	count = MIN(profile->frames, GRATE_PROFILE_MAX_FRAMES);
+	if (!count)
+		return;
+
+	memcpy(sorted, profile->frame_times, count * sizeof(*sorted));
+	qsort(sorted, count, sizeof(*sorted), grate_profile_compare);
+
+	stats->count = count;
+	stats->p50 = sorted[(count - 1) * 50 / 100];
+	stats->p95 = sorted[(count - 1) * 95 / 100];
+	stats->p99 = sorted[(count - 1) * 99 / 100];
+	stats->max = sorted[count - 1];
+
+	for (i = 0; i < count; i++) {
+		if ((uint64_t)sorted[i] * 2 > stats->p50 * 3)
+			stats->janks++;
+
+		grate_profile_histogram_add(&stats->hist, sorted[i]);
+	}
+}
+
+/* time spent by the CPU blocked in waits for GR2D and GR3D */
+static uint64_t grate_profile_wait_time(struct grate_profile *profile)
+{
+	struct host1x_stats stats;
+
+	if (!profile->grate)
+		return 0;
+
+	host1x_get_stats(profile->grate->host1x, &stats);
+
+	return stats.gr2d.wait_time_us + stats.gr3d.wait_time_us;
+}
+
+/*
+ * GR3D is idle during the part of a frame not covered by the busy spans of
+ * its jobs, it is then waiting for the CPU to record and submit work. The
+ * CPU waits for GR3D while blocked on a fence.
+ */
+static void grate_profile_overlap(struct grate_profile *profile,
+				  struct grate_profile_overlap *overlap)
+{
+	unsigned int count = MIN(profile->frames, GRATE_PROFILE_MAX_FRAMES);
+	unsigned int num_busy = MIN(profile->num_busy, GRATE_PROFILE_MAX_BUSY);
+	unsigned int first_busy = profile->num_busy - num_busy;
+	unsigned int i, k = 0, index;
+	uint64_t start, end, busy, idle, wait;
+
+	memset(overlap, 0, sizeof(*overlap));
+
+	/* the start of the oldest frame isn't known */
+	if (count < 2)
+		return;
+
+	for (i = profile->frames - count + 1; i < profile->frames; i++) {
+		struct grate_profile_busy *span;
+
+		start = profile->frame_ends[(i - 1) % GRATE_PROFILE_MAX_FRAMES];
+		end = profile->frame_ends[i % GRATE_PROFILE_MAX_FRAMES];
+		busy = 0;
+
+		for (; k < num_busy; k++) {
+			index = (first_busy + k) % GRATE_PROFILE_MAX_BUSY;
+			span = &profile->busy[index];
+
+			if (span->end <= start)
+				continue;
+
+			if (span->start >= end)
+				break;
+
+			busy += MIN(span->end, end) - MAX(span->start, start);
+
+			/* the span continues into the next frame */
+			if (span->end > end)
+				break;
+		}
+
+		idle = end - start - MIN(busy, end - start);
+		wait = profile->frame_waits[i % GRATE_PROFILE_MAX_FRAMES];
+
+		overlap->frame += end - start;
+		overlap->gpu_idle += idle;
+		overlap->cpu_wait += wait;
+		overlap->gpu_idle_max = MAX(overlap->gpu_idle_max, idle);
+		overlap->cpu_wait_max = MAX(overlap->cpu_wait_max, wait);
+		overlap->count++;
+	}
+
+	overlap->frame /= overlap->count;
+	overlap->gpu_idle /= overlap->count;
+	overlap->cpu_wait /= overlap->count;
+}
+
 static void grate_profile_dump(struct grate_profile *profile, FILE *fp)
 {
 	float time = timespec_diff(&profile->start, &profile->end);
+	struct grate_profile_frame_stats stats;
+	struct grate_profile_overlap overlap;
+	unsigned int i;
 
 	fprintf(fp, "%u frames in %.3f seconds: %.2f fps\n", profile->frames,
 		time, profile->frames / time);
+
+	grate_profile_frame_stats(profile, &stats);
+	grate_profile_overlap(profile, &overlap);
+
+	if (stats.count) {
+		fprintf(fp, "frame times of last %u frames: p50 %.2f ms, "
+			"p95 %.2f ms, p99 %.2f ms, max %.2f ms, %u janks\n",
+			stats.count, stats.p50 / 1000.0, stats.p95 / 1000.0,
+			stats.p99 / 1000.0, stats.max / 1000.0, stats.janks);
+		grate_profile_histogram_dump(&stats.hist, "frame", fp);
+	}
+
+	if (overlap.count) {
+		fprintf(fp, "per frame: gpu idle %.2f ms (%.1f%%, max %.2f ms), "
+			"cpu waiting %.2f ms (%.1f%%, max %.2f ms)\n",
+			overlap.gpu_idle / 1000.0,
+			overlap.gpu_idle / overlap.frame * 100.0,
+			overlap.gpu_idle_max / 1000.0,
+			overlap.cpu_wait / 1000.0,
+			overlap.cpu_wait / overlap.frame * 100.0,
+			overlap.cpu_wait_max / 1000.0);
+	}
+
+	for (i = 0; i < profile->num_clocks; i++) {
+		struct grate_profile_clock *clock = &profile->clocks[i];
+
+		if (!clock->count)
+			continue;
+
+		fprintf(fp, "clock %s: avg %.1f MHz, min %.1f MHz, "
+			"max %.1f MHz\n", clock->name,
+			clock->total / clock->count / 1e6, clock->min / 1e6,
+			clock->max / 1e6);
+	}
+
+	for (i = 0; i < profile->num_passes; i++) {
+		struct grate_profile_pass *pass = &profile->passes[i];
+
+		if (!pass->record.count)
+			continue;
+
+		fprintf(fp, "pass %s: %u jobs, histogram buckets are "
+			"<2, <4, <8 ... us\n", pass->name, pass->record.count);
+		grate_profile_histogram_dump(&pass->record, "record", fp);
+		grate_profile_histogram_dump(&pass->submit, "submit", fp);
+		grate_profile_histogram_dump(&pass->gpu, "gpu", fp);
+	}
+}
+
+static void grate_profile_histogram_json(struct grate_profile_histogram *hist,
+					 const char *name, FILE *fp)
+{
+	unsigned int i;
+
+	fprintf(fp, "\"%s\":{\"count\":%u,\"total_us\":%llu,\"buckets\":[",
+		name, hist->count, (unsigned long long)hist->total);
+
+	for (i = 0; i < GRATE_PROFILE_BUCKETS; i++)
+		fprintf(fp, "%s%u", i ? "," : "", hist->buckets[i]);
+
+	fprintf(fp, "]}");
+}
+
+static void grate_profile_model_json(const struct host1x_client_stats *stats,
+				     const char *name, FILE *fp)
+{
+	fprintf(fp, "\"%s\":{\"ops\":%llu,\"vertices\":%llu,"
+		"\"primitives\":%llu,\"vp_instructions\":%llu,"
+		"\"fp_instructions\":%llu,\"tex_fetches\":%llu,"
+		"\"pixels\":%llu,\"cycles\":%llu,\"time_ns\":%llu}", name,
+		(unsigned long long)stats->model.ops,
+		(unsigned long long)stats->model.vertices,
+		(unsigned long long)stats->model.primitives,
+		(unsigned long long)stats->model.vp_instructions,
+		(unsigned long long)stats->model.fp_instructions,
+		(unsigned long long)stats->model.tex_fetches,
+		(unsigned long long)stats->model.pixels,
+		(unsigned long long)stats->model.cycles,
+		(unsigned long long)stats->model.time_ns);
+}
+
+void grate_profile_dump_json(struct grate_profile *profile, FILE *fp)
+{
+	float time = timespec_diff(&profile->start, &profile->end);
+	struct grate_profile_frame_stats stats;
+	struct grate_profile_overlap overlap;
+	unsigned int i;
+
+	grate_profile_frame_stats(profile, &stats);
+	grate_profile_overlap(profile, &overlap);
+
+	fprintf(fp, "{\"frames\":%u,\"seconds\":%.6f,\"fps\":%.3f,",
+		profile->frames, time, profile->frames / time);
+	fprintf(fp, "\"frame_times\":{\"samples\":%u,\"p50_us\":%llu,"
+		"\"p95_us\":%llu,\"p99_us\":%llu,\"max_us\":%llu,"
+		"\"janks\":%u,", stats.count,
+		(unsigned long long)stats.p50, (unsigned long long)stats.p95,
+		(unsigned long long)stats.p99, (unsigned long long)stats.max,
+		stats.janks);
+	grate_profile_histogram_json(&stats.hist, "histogram", fp);
+	fprintf(fp, "},\"overlap\":{\"samples\":%u,\"frame_us\":%.1f,"
+		"\"gpu_idle_us\":%.1f,\"gpu_idle_max_us\":%llu,"
+		"\"cpu_wait_us\":%.1f,\"cpu_wait_max_us\":%llu}",
+		overlap.count, overlap.frame, overlap.gpu_idle,
+		(unsigned long long)overlap.gpu_idle_max, overlap.cpu_wait,
+		(unsigned long long)overlap.cpu_wait_max);
+	fprintf(fp, ",\"clocks\":[");
+
+	for (i = 0; i < profile->num_clocks; i++) {
+		struct grate_profile_clock *clock = &profile->clocks[i];
+
+		fprintf(fp, "%s{\"name\":\"%s\",\"samples\":%u,"
+			"\"avg_hz\":%llu,\"min_hz\":%llu,\"max_hz\":%llu}",
+			i ? "," : "", clock->name, clock->count,
+			(unsigned long long)(clock->count ?
+					     clock->total / clock->count : 0),
+			(unsigned long long)clock->min,
+			(unsigned long long)clock->max);
+	}
+
+	fprintf(fp, "],");
+
+	/* the cost estimated by the dummy backend instead of a GPU */
+	if (profile->grate && profile->grate->options->model) {
+		struct host1x_stats host1x_stats;
+
+		host1x_get_stats(profile->grate->host1x, &host1x_stats);
+
+		fprintf(fp, "\"model\":{");
+		grate_profile_model_json(&host1x_stats.gr2d, "gr2d", fp);
+		fprintf(fp, ",");
+		grate_profile_model_json(&host1x_stats.gr3d, "gr3d", fp);
+		fprintf(fp, "},");
+	}
+
+	fprintf(fp, "\"passes\":[");
+
+	for (i = 0; i < profile->num_passes; i++) {
+		struct grate_profile_pass *pass = &profile->passes[i];
+
+		fprintf(fp, "%s{\"name\":\"%s\",", i ? "," : "", pass->name);
+		grate_profile_histogram_json(&pass->record, "record", fp);
+		fprintf(fp, ",");
+		grate_profile_histogram_json(&pass->submit, "submit", fp);
+		fprintf(fp, ",");
+		grate_profile_histogram_json(&pass->gpu, "gpu", fp);
+		fprintf(fp, "}");
+	}
+
+	fprintf(fp, "]}\n");
+}
+
+/*
+ * Jobs execute in order, hence a job runs from its submission or from the
+ * completion of the previous job, whichever is later, until its syncpoint is
+ * observed as reached. The completion is observed by polling on every
+ * submission and sample, the GPU times are thus upper bounds that are as
+ * precise as the sampling rate.
+ */
+static int grate_profile_retire(struct grate_profile *profile, bool wait)
+{
+	struct grate_profile_busy *span;
+	struct grate_profile_job *job;
+	uint64_t done, start;
+	int err;
+
+	while (profile->num_jobs) {
+		job = &profile->jobs[profile->first_job];
+
+		if (wait) {
+			err = HOST1X_CLIENT_WAIT(profile->client, job->fence,
+						 ~0u);
+			if (err < 0)
+				return err;
+		} else {
+			err = host1x_client_poll(profile->client, job->fence);
+			if (err <= 0)
+				return err;
+		}
+
+		done = grate_profile_now();
+		start = MAX(job->submitted, profile->last_done);
+		grate_profile_histogram_add(&job->pass->gpu, done - start);
+		profile->last_done = done;
+
+		span = &profile->busy[profile->num_busy++ %
+				      GRATE_PROFILE_MAX_BUSY];
+		span->start = start;
+		span->end = done;
+
+		profile->first_job = (profile->first_job + 1) %
+						GRATE_PROFILE_MAX_JOBS;
+		profile->num_jobs--;
+	}
+
+	return 0;
 }
 
 struct grate_profile *grate_profile_start(struct grate *grate)
@@ -63,24 +634,131 @@ struct grate_profile *grate_profile_start(struct grate *grate)
 
 	clock_gettime(CLOCK_MONOTONIC, &profile->start);
 	profile->frames = 0;
+	profile->grate = grate;
+	profile->last_frame = grate_profile_now();
+	profile->wait_time = grate_profile_wait_time(profile);
+
+	grate_profile_begin_pass(profile, "default");
+	grate_profile_open_clocks(profile);
+	grate_profile_sample_clocks(profile, true);
+
+	if (grate)
+		grate->profile = profile;
 
 	return profile;
 }
 
 void grate_profile_free(struct grate_profile *profile)
 {
+	if (profile && profile->grate && profile->grate->profile == profile)
+		profile->grate->profile = NULL;
+
+	if (profile)
+		grate_profile_close_clocks(profile);
+
 	free(profile);
 }
 
+/*
+ * GR3D jobs submitted after this call are accounted to the named pass. The
+ * name has to stay valid for the lifetime of the profile.
+ */
+void grate_profile_begin_pass(struct grate_profile *profile, const char *name)
+{
+	struct grate_profile_pass *pass;
+	unsigned int i;
+
+	for (i = 0; i < profile->num_passes; i++) {
+		if (!strcmp(profile->passes[i].name, name)) {
+			profile->pass = &profile->passes[i];
+			return;
+		}
+	}
+
+	if (profile->num_passes == GRATE_PROFILE_MAX_PASSES) {
+		grate_error("too many profile passes, accounting %s to %s\n",
+			    name, profile->pass->name);
+		return;
+	}
+
+	pass = &profile->passes[profile->num_passes++];
+	memset(pass, 0, sizeof(*pass));
+	pass->name = name;
+
+	profile->pass = pass;
+}
+
+/* drop the statistics collected so far, e.g. during a warm-up */
+void grate_profile_reset(struct grate_profile *profile)
+{
+	unsigned int i;
+
+	if (profile->num_jobs)
+		grate_profile_retire(profile, true);
+
+	clock_gettime(CLOCK_MONOTONIC, &profile->start);
+	profile->last_frame = grate_profile_now();
+	profile->frames = 0;
+
+	for (i = 0; i < profile->num_passes; i++) {
+		const char *name = profile->passes[i].name;
+
+		memset(&profile->passes[i], 0, sizeof(profile->passes[i]));
+		profile->passes[i].name = name;
+	}
+
+	profile->last_done = 0;
+	profile->num_busy = 0;
+	profile->wait_time = grate_profile_wait_time(profile);
+
+	grate_profile_reset_clocks(profile);
+}
+
 void grate_profile_sample(struct grate_profile *profile)
 {
+	unsigned int index = profile->frames % GRATE_PROFILE_MAX_FRAMES;
+	uint64_t now, wait_time;
+
+	/* jobs that completed belong to the frame that ends now */
+	if (profile->num_jobs)
+		grate_profile_retire(profile, false);
+
+	now = grate_profile_now();
+	wait_time = grate_profile_wait_time(profile);
+
+	profile->frame_times[index] = MIN(now - profile->last_frame,
+					  UINT32_MAX);
+	profile->frame_ends[index] = now;
+	profile->frame_waits[index] = MIN(wait_time - profile->wait_time,
+					  UINT32_MAX);
+	profile->last_frame = now;
+	profile->wait_time = wait_time;
 	profile->frames++;
+
+	grate_profile_sample_clocks(profile, false);
 }
 
 void grate_profile_finish(struct grate_profile *profile)
 {
+	if (profile->num_jobs)
+		grate_profile_retire(profile, true);
+
 	clock_gettime(CLOCK_MONOTONIC, &profile->end);
+	grate_profile_sample_clocks(profile, true);
 	grate_profile_dump(profile, stdout);
+
+	if (profile->grate && profile->grate->options->profile_json) {
+		const char *path = profile->grate->options->profile_json;
+		FILE *fp = fopen(path, "w");
+
+		if (!fp) {
+			grate_error("failed to open %s: %m\n", path);
+			return;
+		}
+
+		grate_profile_dump_json(profile, fp);
+		fclose(fp);
+	}
 }
 
 float grate_profile_time_elapsed(struct grate_profile *profile)
@@ -91,3 +769,49 @@ float grate_profile_time_elapsed(struct grate_profile *profile)
 
 	return timespec_diff(&profile->start, &now);
 }
+
+/* a GR3D job started to be recorded */
+void grate_profile_job_begin(struct grate_profile *profile)
+{
+	if (!profile->record_start)
+		profile->record_start = grate_profile_now();
+}
+
+/* the recorded GR3D job is about to be submitted */
+void grate_profile_job_submit(struct grate_profile *profile)
+{
+	profile->submit_start = grate_profile_now();
+}
+
+/* the GR3D job was submitted and will signal the given fence */
+void grate_profile_job_submitted(struct grate_profile *profile,
+				 struct host1x_client *client, uint32_t fence)
+{
+	struct grate_profile_pass *pass = profile->pass;
+	struct grate_profile_job *job;
+	uint64_t now = grate_profile_now();
+	unsigned int index;
+
+	if (profile->record_start)
+		grate_profile_histogram_add(&pass->record,
+					    profile->submit_start -
+					    profile->record_start);
+
+	grate_profile_histogram_add(&pass->submit, now - profile->submit_start);
+	profile->record_start = 0;
+	profile->client = client;
+
+	if (profile->num_jobs)
+		grate_profile_retire(profile, false);
+
+	if (profile->num_jobs == GRATE_PROFILE_MAX_JOBS &&
+	    grate_profile_retire(profile, true) < 0)
+		return;
+
+	index = (profile->first_job + profile->num_jobs++) %
+						GRATE_PROFILE_MAX_JOBS;
+	job = &profile->jobs[index];
+	job->pass = pass;
+	job->submitted = now;
+	job->fence = fence;
+}
@@ -23,7 +23,9 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "libgrate-private.h"
@@ -82,6 +84,55 @@ static unsigned count_pseq_instructions_nb(struct grate_shader *shader)
 	return pseq_instructions_nb;
 }
 
+/* the shader takes over the compiled code, which is freed with it */
+struct grate_shader *grate_shader_from_cgc(struct cgc_shader *cgc)
+{
+	struct cgc_fragment_shader *fs;
+	struct cgc_vertex_shader *vs;
+	struct grate_shader *shader;
+	struct cgc_header *header;
+	size_t size;
+
+	shader = calloc(1, sizeof(*shader));
+	if (!shader) {
+		cgc_shader_free(cgc);
+		return NULL;
+	}
+
+	shader->cgc = cgc;
+
+	switch (cgc->type) {
+	case CGC_SHADER_VERTEX:
+		vs = cgc->stream;
+		fprintf(stdout, "DEBUG: vertex shader: %u words\n", vs->unknownec / 4);
+		shader->words = cgc->stream + vs->unknowne8 * 4;
+		shader->num_words = vs->unknownec / 4;
+		break;
+
+	case CGC_SHADER_FRAGMENT:
+		header = cgc->binary;
+
+		fs = cgc->binary + header->binary_offset;
+		size = header->binary_size - sizeof(*fs);
+
+		fprintf(stdout, "DEBUG: fragment shader: %zu words\n", size / 4);
+		shader->num_words = size / 4;
+		shader->words = fs->words;
+
+		shader->pseq_inst_nb = count_pseq_instructions_nb(shader);
+		shader->pseq_to_dw_nb = 1;
+		shader->alu_buf_size = 1;
+		break;
+
+	default:
+		shader->num_words = 0;
+		shader->words = NULL;
+		break;
+	}
+
+	return shader;
+}
+
 struct grate_shader *grate_shader_new(struct grate *grate,
 				      enum grate_shader_type type,
 				      const char *lines[],
@@ -89,13 +140,10 @@ struct grate_shader *grate_shader_new(struct grate *grate,
 {
 	size_t length = 0, offset = 0, len;
 	enum cgc_shader_type shader_type;
-	struct cgc_fragment_shader *fs;
-	struct cgc_vertex_shader *vs;
 	struct grate_shader *shader;
-	struct cgc_header *header;
 	struct cgc_shader *cgc;
+	uint64_t key = 0;
 	unsigned int i;
-	size_t size;
 	char *code;
 
 	switch (type) {
@@ -126,6 +174,16 @@ struct grate_shader *grate_shader_new(struct grate *grate,
 
 	code[length] = '\0';
 
+	if (grate->shader_cache) {
+		key = grate_shader_cache_key(shader_type, code, length);
+
+		shader = grate_shader_cache_lookup(grate, key);
+		if (shader) {
+			free(code);
+			return shader;
+		}
+	}
+
 	cgc = cgc_compile(shader_type, code, length);
 	if (!cgc) {
 		free(code);
@@ -134,42 +192,14 @@ struct grate_shader *grate_shader_new(struct grate *grate,
 
 	//cgc_shader_dump(cgc, stdout);
 
-	shader = calloc(1, sizeof(*shader));
+	shader = grate_shader_from_cgc(cgc);
 	if (!shader) {
 		free(code);
 		return NULL;
 	}
 
-	shader->cgc = cgc;
-
-	switch (cgc->type) {
-	case CGC_SHADER_VERTEX:
-		vs = cgc->stream;
-		fprintf(stdout, "DEBUG: vertex shader: %u words\n", vs->unknownec / 4);
-		shader->words = cgc->stream + vs->unknowne8 * 4;
-		shader->num_words = vs->unknownec / 4;
-		break;
-
-	case CGC_SHADER_FRAGMENT:
-		header = cgc->binary;
-
-		fs = cgc->binary + header->binary_offset;
-		size = header->binary_size - sizeof(*fs);
-
-		fprintf(stdout, "DEBUG: fragment shader: %zu words\n", size / 4);
-		shader->num_words = size / 4;
-		shader->words = fs->words;
-
-		shader->pseq_inst_nb = count_pseq_instructions_nb(shader);
-		shader->pseq_to_dw_nb = 1;
-		shader->alu_buf_size = 1;
-		break;
-
-	default:
-		shader->num_words = 0;
-		shader->words = NULL;
-		break;
-	}
+	if (grate->shader_cache && shader->words)
+		grate_shader_cache_store(grate, key, shader);
 
 	free(code);
 
@@ -187,6 +217,9 @@ static void grate_free_asm_shader(struct grate_shader *shader)
 
 void grate_shader_free(struct grate_shader *shader)
 {
+	if (shader && shader->refcount && !grate_asm_cache_put(shader))
+		return;
+
 	if (shader) {
 		switch (shader->cgc->type) {
 		case CGC_SHADER_VERTEX:
@@ -203,11 +236,70 @@ void grate_shader_free(struct grate_shader *shader)
 	free(shader);
 }
 
+/*
+ * Creates an unshared asm-style copy of a shader with room for the given
+ * number of words, the words are left for the caller to fill in. Symbols
+ * are duplicated, so the copy outlives the original.
+ */
+struct grate_shader *grate_shader_copy(struct grate_shader *shader,
+				       unsigned int num_words)
+{
+	struct cgc_shader *src = shader->cgc, *cgc;
+	struct grate_shader *copy;
+	unsigned int i;
+
+	copy = calloc(1, sizeof(*copy));
+	cgc = calloc(1, sizeof(*cgc));
+	if (!copy || !cgc)
+		goto err;
+
+	*copy = *shader;
+	copy->cgc = cgc;
+	copy->refcount = 0;
+	copy->num_words = num_words;
+	copy->words = malloc(num_words * 4);
+	if (!copy->words)
+		goto err;
+
+	if (src && src->num_symbols) {
+		cgc->symbols = calloc(src->num_symbols, sizeof(*cgc->symbols));
+		if (!cgc->symbols)
+			goto err;
+
+		for (i = 0; i < src->num_symbols; i++) {
+			cgc->symbols[i] = src->symbols[i];
+			cgc->symbols[i].name = strdup(src->symbols[i].name);
+			if (!cgc->symbols[i].name)
+				goto err;
+
+			cgc->num_symbols++;
+		}
+	}
+
+	return copy;
+
+err:
+	if (cgc) {
+		while (cgc->num_symbols--)
+			free(cgc->symbols[cgc->num_symbols].name);
+		free(cgc->symbols);
+	}
+
+	if (copy)
+		free(copy->words);
+
+	free(cgc);
+	free(copy);
+
+	return NULL;
+}
+
 struct grate_program *grate_program_new(struct grate *grate,
 					struct grate_shader *vs,
 					struct grate_shader *fs,
 					struct grate_shader *linker)
 {
+	static unsigned int ids;
 	struct grate_program *program;
 
 	if (!vs || !fs || !linker)
@@ -220,63 +312,113 @@ struct grate_program *grate_program_new(struct grate *grate,
 	program->vs = vs;
 	program->fs = fs;
 	program->linker = linker;
+	program->id = ++ids;
 
 	return program;
 }
 
 void grate_program_free(struct grate_program *program)
 {
+	unsigned int i;
+
 	if (program) {
 		grate_shader_free(program->fs);
 		grate_shader_free(program->vs);
+
+		if (program->owns_linker)
+			grate_shader_free(program->linker);
+
+		grate_3d_consts_put(program->vs_constants);
+
+		for (i = 0; i < program->num_specs; i++)
+			free((char *)program->specs[i].name);
+
+		free(program->specs);
+		free(program->fs_uniforms);
+		free(program->vs_uniforms);
+		free(program->attributes);
 	}
 
 	free(program);
 }
 
-int grate_get_attribute_location(struct grate_program *program,
-				 const char *name)
+unsigned int grate_program_render_targets(struct grate_program *program)
 {
-	unsigned i;
+	return grate_shader_render_targets(program->fs);
+}
+
+/*
+ * Attributes and uniforms are sorted by name once the program is linked,
+ * lookups are binary searches. Symbols sharing a name are ordered by their
+ * position and the lowest one is returned, like the linear scan used to.
+ * The entry mirrors the layout of struct grate_attribute and grate_uniform.
+ */
+struct grate_symbol_entry {
+	int position;
+	const char *name;
+};
 
-	for (i = 0; i < program->num_attributes; i++) {
-		struct grate_attribute *attribute = &program->attributes[i];
+static int grate_symbol_compare(const void *a, const void *b)
+{
+	const struct grate_symbol_entry *x = a, *y = b;
+	int ret = strcmp(x->name, y->name);
 
-		if (strcmp(name, attribute->name) == 0)
-			return attribute->position;
-	}
+	if (ret)
+		return ret;
 
-	return -1;
+	return x->position - y->position;
 }
 
-int grate_get_vertex_uniform_location(struct grate_program *program,
-				      const char *name)
+static int grate_symbol_find(const void *entries, unsigned count,
+			     size_t size, const char *name)
 {
-	unsigned i;
+	const struct grate_symbol_entry *entry;
+	unsigned low = 0, high = count;
 
-	for (i = 0; i < program->num_vs_uniforms; i++) {
-		struct grate_uniform *uniform = &program->vs_uniforms[i];
+	/* find the first entry not ordered before the name */
+	while (low < high) {
+		unsigned mid = (low + high) / 2;
 
-		if (strcmp(name, uniform->name) == 0)
-			return uniform->position;
+		entry = (const void *)((const char *)entries + mid * size);
+
+		if (strcmp(entry->name, name) < 0)
+			low = mid + 1;
+		else
+			high = mid;
 	}
 
-	return -1;
+	if (low == count)
+		return -1;
+
+	entry = (const void *)((const char *)entries + low * size);
+
+	if (strcmp(entry->name, name))
+		return -1;
+
+	return entry->position;
 }
 
-int grate_get_fragment_uniform_location(struct grate_program *program,
-					const char *name)
+int grate_get_attribute_location(struct grate_program *program,
+				 const char *name)
 {
-	unsigned i;
-
-	for (i = 0; i < program->num_fs_uniforms; i++) {
-		struct grate_uniform *uniform = &program->fs_uniforms[i];
+	return grate_symbol_find(program->attributes, program->num_attributes,
+				 sizeof(*program->attributes), name);
+}
 
-		if (strcmp(name, uniform->name) == 0)
-			return uniform->position;
-	}
+int grate_get_vertex_uniform_location(struct grate_program *program,
+				      const char *name)
+{
+	return grate_symbol_find(program->vs_uniforms,
+				 program->num_vs_uniforms,
+				 sizeof(*program->vs_uniforms), name);
+}
 
-	return -1;
+int grate_get_fragment_uniform_location(struct grate_program *program,
+					const char *name)
+{
+	return grate_symbol_find(program->fs_uniforms,
+				 program->num_fs_uniforms,
+				 sizeof(*program->fs_uniforms), name);
 }
 
 static void grate_program_add_attribute(struct grate_program *program,
@@ -334,6 +476,147 @@ static void grate_program_add_uniform(struct grate_program *program,
 	uniform->name = symbol->name;
 }
 
+int grate_program_specialize(struct grate_program *program,
+			     const struct grate_specialization *specs,
+			     unsigned int count)
+{
+	struct grate_specialization *spec;
+	unsigned int i;
+
+	/* the uniform tables are built by the link */
+	if (program->attributes || program->vs_uniforms ||
+	    program->fs_uniforms)
+		return -EBUSY;
+
+	spec = realloc(program->specs,
+		       (program->num_specs + count) * sizeof(*spec));
+	if (!spec)
+		return -ENOMEM;
+
+	program->specs = spec;
+
+	for (i = 0; i < count; i++) {
+		if (specs[i].nb > 16)
+			return -EINVAL;
+
+		spec = &program->specs[program->num_specs];
+		*spec = specs[i];
+
+		spec->name = strdup(specs[i].name);
+		if (!spec->name)
+			return -ENOMEM;
+
+		program->num_specs++;
+	}
+
+	return 0;
+}
+
+static const struct grate_specialization *
+grate_program_find_spec(struct grate_program *program, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < program->num_specs; i++)
+		if (!strcmp(program->specs[i].name, name))
+			return &program->specs[i];
+
+	return NULL;
+}
+
+/* end of the vec4 constants taken by the symbol */
+static unsigned grate_vs_symbol_end(struct cgc_symbol *symbol)
+{
+	unsigned start = symbol->location;
+	unsigned end;
+
+	switch (symbol->type) {
+	case GLSL_TYPE_MAT2:
+		end = start + 2;
+		break;
+	case GLSL_TYPE_MAT3:
+		end = start + 3;
+		break;
+	case GLSL_TYPE_MAT4:
+		end = start + 4;
+		break;
+	default:
+		end = start + 1;
+		break;
+	}
+
+	return MIN(end, 256);
+}
+
+static void grate_program_use_vs_constant(struct grate_program *program,
+					  struct cgc_symbol *symbol)
+{
+	unsigned start = symbol->location;
+	unsigned end = grate_vs_symbol_end(symbol);
+
+	if (program->vs_constants_start >= program->vs_constants_end) {
+		program->vs_constants_start = start;
+		program->vs_constants_end = end;
+		return;
+	}
+
+	if (start < program->vs_constants_start)
+		program->vs_constants_start = start;
+
+	if (end > program->vs_constants_end)
+		program->vs_constants_end = end;
+}
+
+/* only the range of constants used by the program is stored */
+static void grate_program_store_vs_constants(struct grate_program *program,
+					     struct cgc_shader *shader)
+{
+	struct grate_3d_consts *consts;
+	unsigned int i;
+
+	if (program->vs_constants_start >= program->vs_constants_end)
+		return;
+
+	consts = grate_3d_consts_create(program->vs_constants_start,
+					program->vs_constants_end);
+	if (!consts) {
+		grate_error("failed to allocate vertex constants\n");
+		return;
+	}
+
+	for (i = 0; i < shader->num_symbols; i++) {
+		struct cgc_symbol *symbol = &shader->symbols[i];
+		const struct grate_specialization *spec;
+		unsigned int offset, nb;
+
+		if (symbol->location == -1)
+			continue;
+
+		offset = (symbol->location - consts->start) * 4;
+
+		if (symbol->kind == GLSL_KIND_CONSTANT) {
+			memcpy(&consts->values[offset], symbol->vector, 16);
+			continue;
+		}
+
+		if (symbol->kind != GLSL_KIND_UNIFORM)
+			continue;
+
+		spec = grate_program_find_spec(program, symbol->name);
+		if (!spec)
+			continue;
+
+		nb = (grate_vs_symbol_end(symbol) - symbol->location) * 4;
+		nb = MIN(nb, spec->nb);
+
+		memcpy(&consts->values[offset], spec->values,
+		       nb * sizeof(float));
+	}
+
+	grate_3d_consts_put(program->vs_constants);
+	program->vs_constants = consts;
+}
+
 void grate_program_link(struct grate_program *program)
 {
 	struct cgc_shader *shader;
@@ -383,15 +666,20 @@ void grate_program_link(struct grate_program *program)
 			printf("uniform %s @%u", symbol->name,
 			       symbol->location);
 
-			grate_program_add_uniform(program, symbol, true);
+			if (grate_program_find_spec(program, symbol->name))
+				printf(" (specialized)");
+			else
+				grate_program_add_uniform(program, symbol,
+							  true);
+
+			grate_program_use_vs_constant(program, symbol);
 			break;
 
 		case GLSL_KIND_CONSTANT:
 			printf("constant %s @%u", symbol->name,
 			       symbol->location);
 
-			memcpy(&program->vs_constants[symbol->location * 4],
-			       symbol->vector, 16);
+			grate_program_use_vs_constant(program, symbol);
 
 			break;
 
@@ -410,10 +698,13 @@ void grate_program_link(struct grate_program *program)
 		printf("\n");
 	}
 
+	grate_program_store_vs_constants(program, shader);
+
 	shader = program->fs->cgc;
 
 	for (i = 0; i < shader->num_symbols; i++) {
 		struct cgc_symbol *symbol = &shader->symbols[i];
+		const struct grate_specialization *spec;
 
 		if (symbol->location == -1)
 			continue;
@@ -428,7 +719,18 @@ void grate_program_link(struct grate_program *program)
 			printf("uniform %s @%u", symbol->name,
 			       symbol->location);
 
-			grate_program_add_uniform(program, symbol, false);
+			spec = grate_program_find_spec(program, symbol->name);
+			if (!spec) {
+				grate_program_add_uniform(program, symbol,
+							  false);
+				break;
+			}
+
+			printf(" (specialized)");
+			grate_3d_fragment_uniform_store(program->fs_constants,
+							symbol->location,
+							spec->nb,
+							spec->values);
 			break;
 
 		case GLSL_KIND_CONSTANT:
@@ -453,4 +755,11 @@ void grate_program_link(struct grate_program *program)
 
 		printf("\n");
 	}
+
+	qsort(program->attributes, program->num_attributes,
+	      sizeof(*program->attributes), grate_symbol_compare);
+	qsort(program->vs_uniforms, program->num_vs_uniforms,
+	      sizeof(*program->vs_uniforms), grate_symbol_compare);
+	qsort(program->fs_uniforms, program->num_fs_uniforms,
+	      sizeof(*program->fs_uniforms), grate_symbol_compare);
 }
@@ -28,25 +28,25 @@
 
 #include "asm.h"
 
-extern int vertex_asmlex(void);
-extern int vertex_asmlineno;
+extern int vertex_asmget_lineno(void *scanner);
 
-void __attribute__((weak)) yyerror(char *err)
+void __attribute__((weak)) yyerror(void *scanner, char *err)
 {
-	fprintf(stderr, "vs: line %d: %s\n", vertex_asmlineno, err);
+	fprintf(stderr, "vs: line %d: %s\n",
+		vertex_asmget_lineno(scanner), err);
 }
 
-vpe_instr128 asm_vs_instructions[256];
+__thread vpe_instr128 asm_vs_instructions[256];
 
-asm_const asm_vs_constants[256];
+__thread asm_const asm_vs_constants[256];
 
-asm_in_out asm_vs_attributes[16];
+__thread asm_in_out asm_vs_attributes[16];
 
-asm_in_out asm_vs_exports[16];
+__thread asm_in_out asm_vs_exports[16];
 
-asm_in_out asm_vs_uniforms[256];
+__thread asm_in_out asm_vs_uniforms[256];
 
-int asm_vs_instructions_nb;
+__thread int asm_vs_instructions_nb;
 
 struct parse_state {
 	int rC_used;
@@ -80,13 +80,13 @@ struct parse_state {
 	int export_write_index;
 };
 
-static struct parse_state pst;
-static vpe_instr128 instr;
+static __thread struct parse_state pst;
+static __thread vpe_instr128 instr;
 
-#define PARSE_ERROR(txt)	\
-	{			\
-		yyerror(txt);	\
-		YYABORT;	\
+#define PARSE_ERROR(txt)		\
+	{				\
+		yyerror(scanner, txt);	\
+		YYABORT;		\
 	}
 
 static int swizzle(int component)
@@ -140,11 +140,17 @@ static void reset_asm_parser_state(void)
 	reset_instruction();
 
 	asm_vs_instructions_nb = 0;
-
-	vertex_asmlineno = 1;
 }
 %}
 
+%define api.pure full
+%lex-param {void *scanner}
+%parse-param {void *scanner}
+
+%code {
+extern int vertex_asmlex(YYSTYPE *lval, void *scanner);
+}
+
 %token T_VECTOR_OPCODE_NOP
 %token T_VECTOR_OPCODE_MOV
 %token T_VECTOR_OPCODE_MUL
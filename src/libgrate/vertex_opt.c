@@ -0,0 +1,691 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asm.h"
+#include "grate.h"
+#include "host1x.h"
+#include "libgrate-private.h"
+
+/*
+ * Optional optimiser of vertex programs, run on the instruction words once
+ * the linker of the program is known:
+ *
+ * - instruction slots whose results are neither read later on nor exported
+ *   to an output read by the linker are turned into NOPs, instructions that
+ *   end up empty are dropped;
+ * - a vector-only and a scalar-only instruction are packed into a single
+ *   VLIW instruction if they don't depend on each other and the operands
+ *   they share are the same.
+ *
+ * The position export is always kept. Programs using control flow,
+ * predication, the address register or texture fetches are left alone.
+ * The linker is optimised first, see linker_opt.c, the fragment program
+ * is scheduled afterwards, see fragment_sched.c.
+ */
+
+#define VPE_REG_NONE		63
+#define VPE_EXPORT_NONE		31
+#define VPE_MAX_INSTRUCTIONS	256
+
+/* how far ahead a partner for a half-empty instruction is searched */
+#define VPE_PACK_WINDOW		16
+
+enum vpe_slot {
+	VPE_SLOT_VECTOR,
+	VPE_SLOT_SCALAR,
+};
+
+enum vpe_operand_index {
+	VPE_OPERAND_A,
+	VPE_OPERAND_B,
+	VPE_OPERAND_C,
+};
+
+struct vpe_operand {
+	unsigned type;
+	unsigned index;
+	unsigned swizzle[4];
+	bool negate;
+	bool absolute;
+};
+
+static void vpe_get_operand(const vpe_instr128 *ins,
+			    enum vpe_operand_index op, struct vpe_operand *o)
+{
+	switch (op) {
+	case VPE_OPERAND_A:
+		o->type = ins->rA_type;
+		o->index = ins->rA_index;
+		o->swizzle[0] = ins->rA_swizzle_x;
+		o->swizzle[1] = ins->rA_swizzle_y;
+		o->swizzle[2] = ins->rA_swizzle_z;
+		o->swizzle[3] = ins->rA_swizzle_w;
+		o->negate = ins->rA_negate;
+		o->absolute = ins->rA_absolute_value;
+		break;
+
+	case VPE_OPERAND_B:
+		o->type = ins->rB_type;
+		o->index = ins->rB_index;
+		o->swizzle[0] = ins->rB_swizzle_x;
+		o->swizzle[1] = ins->rB_swizzle_y;
+		o->swizzle[2] = ins->rB_swizzle_z;
+		o->swizzle[3] = ins->rB_swizzle_w;
+		o->negate = ins->rB_negate;
+		o->absolute = ins->rB_absolute_value;
+		break;
+
+	case VPE_OPERAND_C:
+		o->type = ins->rC_type;
+		o->index = ins->rC_index;
+		o->swizzle[0] = ins->rC_swizzle_x;
+		o->swizzle[1] = ins->rC_swizzle_y;
+		o->swizzle[2] = ins->rC_swizzle_z;
+		o->swizzle[3] = ins->rC_swizzle_w;
+		o->negate = ins->rC_negate;
+		o->absolute = ins->rC_absolute_value;
+		break;
+	}
+}
+
+static void vpe_set_operand(vpe_instr128 *ins, enum vpe_operand_index op,
+			    const struct vpe_operand *o)
+{
+	switch (op) {
+	case VPE_OPERAND_A:
+		ins->rA_type = o->type;
+		ins->rA_index = o->index;
+		ins->rA_swizzle_x = o->swizzle[0];
+		ins->rA_swizzle_y = o->swizzle[1];
+		ins->rA_swizzle_z = o->swizzle[2];
+		ins->rA_swizzle_w = o->swizzle[3];
+		ins->rA_negate = o->negate;
+		ins->rA_absolute_value = o->absolute;
+		break;
+
+	case VPE_OPERAND_B:
+		ins->rB_type = o->type;
+		ins->rB_index = o->index;
+		ins->rB_swizzle_x = o->swizzle[0];
+		ins->rB_swizzle_y = o->swizzle[1];
+		ins->rB_swizzle_z = o->swizzle[2];
+		ins->rB_swizzle_w = o->swizzle[3];
+		ins->rB_negate = o->negate;
+		ins->rB_absolute_value = o->absolute;
+		break;
+
+	case VPE_OPERAND_C:
+		ins->rC_type = o->type;
+		ins->rC_index = o->index;
+		ins->rC_swizzle_x = o->swizzle[0];
+		ins->rC_swizzle_y = o->swizzle[1];
+		ins->rC_swizzle_z = o->swizzle[2];
+		ins->rC_swizzle_w = o->swizzle[3];
+		ins->rC_negate = o->negate;
+		ins->rC_absolute_value = o->absolute;
+		break;
+	}
+}
+
+static bool vpe_operand_equal(const struct vpe_operand *a,
+			      const struct vpe_operand *b)
+{
+	return a->type == b->type && a->index == b->index &&
+	       !memcmp(a->swizzle, b->swizzle, sizeof(a->swizzle)) &&
+	       a->negate == b->negate && a->absolute == b->absolute;
+}
+
+static bool vpe_slot_empty(const vpe_instr128 *ins, enum vpe_slot slot)
+{
+	if (slot == VPE_SLOT_VECTOR)
+		return ins->vector_opcode == VECTOR_OPCODE_NOP;
+
+	return ins->scalar_opcode == SCALAR_OPCODE_NOP;
+}
+
+static unsigned vpe_write_reg(const vpe_instr128 *ins, enum vpe_slot slot)
+{
+	if (slot == VPE_SLOT_VECTOR)
+		return ins->vector_rD_index;
+
+	return ins->scalar_rD_index;
+}
+
+/* components written by a slot, bit 0 is x */
+static unsigned vpe_write_mask(const vpe_instr128 *ins, enum vpe_slot slot)
+{
+	if (slot == VPE_SLOT_VECTOR)
+		return ins->vector_op_write_x_enable << 0 |
+		       ins->vector_op_write_y_enable << 1 |
+		       ins->vector_op_write_z_enable << 2 |
+		       ins->vector_op_write_w_enable << 3;
+
+	return ins->scalar_op_write_x_enable << 0 |
+	       ins->scalar_op_write_y_enable << 1 |
+	       ins->scalar_op_write_z_enable << 2 |
+	       ins->scalar_op_write_w_enable << 3;
+}
+
+static void vpe_set_write(vpe_instr128 *ins, enum vpe_slot slot,
+			  unsigned reg, unsigned mask)
+{
+	if (slot == VPE_SLOT_VECTOR) {
+		ins->vector_rD_index = reg;
+		ins->vector_op_write_x_enable = !!(mask & 1);
+		ins->vector_op_write_y_enable = !!(mask & 2);
+		ins->vector_op_write_z_enable = !!(mask & 4);
+		ins->vector_op_write_w_enable = !!(mask & 8);
+	} else {
+		ins->scalar_rD_index = reg;
+		ins->scalar_op_write_x_enable = !!(mask & 1);
+		ins->scalar_op_write_y_enable = !!(mask & 2);
+		ins->scalar_op_write_z_enable = !!(mask & 4);
+		ins->scalar_op_write_w_enable = !!(mask & 8);
+	}
+}
+
+static void vpe_clear_slot(vpe_instr128 *ins, enum vpe_slot slot)
+{
+	if (slot == VPE_SLOT_VECTOR)
+		ins->vector_opcode = VECTOR_OPCODE_NOP;
+	else
+		ins->scalar_opcode = SCALAR_OPCODE_NOP;
+
+	vpe_set_write(ins, slot, VPE_REG_NONE, 0);
+}
+
+/*
+ * Operands are shared by the slots: the scalar unit reads rC only, the
+ * vector unit any of them. Unused operands are left undefined by the
+ * assembler, an operand is thus used by whichever slot is occupied.
+ */
+static unsigned vpe_slot_operands(const vpe_instr128 *ins, enum vpe_slot slot)
+{
+	unsigned mask = 0;
+
+	if (vpe_slot_empty(ins, slot))
+		return 0;
+
+	if (slot == VPE_SLOT_VECTOR) {
+		if (ins->rA_type != REG_TYPE_UNDEFINED)
+			mask |= BIT(VPE_OPERAND_A);
+
+		if (ins->rB_type != REG_TYPE_UNDEFINED)
+			mask |= BIT(VPE_OPERAND_B);
+	}
+
+	if (ins->rC_type != REG_TYPE_UNDEFINED)
+		mask |= BIT(VPE_OPERAND_C);
+
+	return mask;
+}
+
+/* temporary components read by the given operands, indexed by register */
+static void vpe_reads(const vpe_instr128 *ins, unsigned operands,
+		      uint8_t reads[64])
+{
+	struct vpe_operand o;
+	unsigned op, c;
+
+	memset(reads, 0, 64);
+
+	for (op = VPE_OPERAND_A; op <= VPE_OPERAND_C; op++) {
+		if (!(operands & BIT(op)))
+			continue;
+
+		vpe_get_operand(ins, op, &o);
+
+		if (o.type != REG_TYPE_TEMPORARY)
+			continue;
+
+		/* dot products read all of the components */
+		for (c = 0; c < 4; c++)
+			reads[o.index] |= BIT(o.swizzle[c]);
+	}
+}
+
+static bool vpe_instruction_supported(const vpe_instr128 *ins)
+{
+	switch (ins->vector_opcode) {
+	case VECTOR_OPCODE_ARL:
+	case VECTOR_OPCODE_ARR:
+	case VECTOR_OPCODE_ARA:
+	case VECTOR_OPCODE_TXL:
+	case VECTOR_OPCODE_PUSHA:
+	case VECTOR_OPCODE_POPA:
+		return false;
+	}
+
+	switch (ins->scalar_opcode) {
+	case SCALAR_OPCODE_BRA:
+	case SCALAR_OPCODE_CAL:
+	case SCALAR_OPCODE_RET:
+	case SCALAR_OPCODE_PUSHA:
+	case SCALAR_OPCODE_POPA:
+		return false;
+	}
+
+	return !ins->condition_check && !ins->condition_set &&
+	       !ins->condition_flags_write_enable &&
+	       !ins->predicate_lt && !ins->predicate_eq &&
+	       !ins->predicate_gt &&
+	       !ins->export_relative_addressing_enable &&
+	       !ins->attribute_relative_addressing_enable &&
+	       !ins->constant_relative_addressing_enable;
+}
+
+static bool vpe_exports_slot(const vpe_instr128 *ins, enum vpe_slot slot)
+{
+	if (ins->export_write_index == VPE_EXPORT_NONE)
+		return false;
+
+	return ins->export_vector_write_enable == (slot == VPE_SLOT_VECTOR);
+}
+
+static unsigned vpe_eliminate_dead_code(vpe_instr128 *prog, unsigned count,
+					uint32_t exports)
+{
+	uint8_t live[64] = { 0 }, reads[64];
+	unsigned i, j, reg, mask, slot;
+
+	for (i = count; i--; ) {
+		vpe_instr128 *ins = &prog[i];
+		unsigned operands = 0;
+		bool exported = false;
+
+		if (ins->export_write_index != VPE_EXPORT_NONE)
+			exported = !!(exports & BIT(ins->export_write_index));
+
+		for (slot = VPE_SLOT_VECTOR; slot <= VPE_SLOT_SCALAR; slot++) {
+			if (vpe_slot_empty(ins, slot))
+				continue;
+
+			reg = vpe_write_reg(ins, slot);
+			mask = vpe_write_mask(ins, slot);
+
+			if (exported && vpe_exports_slot(ins, slot))
+				continue;
+
+			if (reg != VPE_REG_NONE && (live[reg] & mask)) {
+				/* skip the components nobody reads */
+				vpe_set_write(ins, slot, reg, mask & live[reg]);
+				continue;
+			}
+
+			vpe_clear_slot(ins, slot);
+		}
+
+		if (ins->export_write_index != VPE_EXPORT_NONE &&
+		    (!exported ||
+		     vpe_slot_empty(ins, ins->export_vector_write_enable ?
+					 VPE_SLOT_VECTOR : VPE_SLOT_SCALAR)))
+			ins->export_write_index = VPE_EXPORT_NONE;
+
+		if (vpe_slot_empty(ins, VPE_SLOT_VECTOR)) {
+			ins->rA_type = REG_TYPE_UNDEFINED;
+			ins->rB_type = REG_TYPE_UNDEFINED;
+
+			if (vpe_slot_empty(ins, VPE_SLOT_SCALAR))
+				ins->rC_type = REG_TYPE_UNDEFINED;
+		}
+
+		/* the operands are read before the results are written */
+		for (slot = VPE_SLOT_VECTOR; slot <= VPE_SLOT_SCALAR; slot++) {
+			if (vpe_slot_empty(ins, slot))
+				continue;
+
+			reg = vpe_write_reg(ins, slot);
+			if (reg != VPE_REG_NONE)
+				live[reg] &= ~vpe_write_mask(ins, slot);
+
+			operands |= vpe_slot_operands(ins, slot);
+		}
+
+		vpe_reads(ins, operands, reads);
+
+		for (reg = 0; reg < 64; reg++)
+			live[reg] |= reads[reg];
+	}
+
+	for (i = 0, j = 0; i < count; i++) {
+		if (vpe_slot_empty(&prog[i], VPE_SLOT_VECTOR) &&
+		    vpe_slot_empty(&prog[i], VPE_SLOT_SCALAR))
+			continue;
+
+		prog[j++] = prog[i];
+	}
+
+	return j;
+}
+
+static bool vpe_overlap(const uint8_t a[64], const uint8_t b[64])
+{
+	unsigned reg;
+
+	for (reg = 0; reg < 64; reg++)
+		if (a[reg] & b[reg])
+			return true;
+
+	return false;
+}
+
+static void vpe_writes(const vpe_instr128 *ins, uint8_t writes[64])
+{
+	unsigned slot, reg;
+
+	memset(writes, 0, 64);
+
+	for (slot = VPE_SLOT_VECTOR; slot <= VPE_SLOT_SCALAR; slot++) {
+		if (vpe_slot_empty(ins, slot))
+			continue;
+
+		reg = vpe_write_reg(ins, slot);
+		if (reg != VPE_REG_NONE)
+			writes[reg] |= vpe_write_mask(ins, slot);
+	}
+}
+
+/*
+ * Whether the occupied slot of prog[j] can be moved into the free slot of
+ * prog[i], i.e. executed before everything in between.
+ */
+static bool vpe_can_hoist(const vpe_instr128 *prog, unsigned i, unsigned j)
+{
+	const vpe_instr128 *dst = &prog[i], *src = &prog[j];
+	uint8_t src_reads[64], src_writes[64], reads[64], writes[64];
+	unsigned dst_ops, src_ops, op, k;
+	struct vpe_operand a, b;
+	bool attribute = false;
+	bool uniform = false;
+
+	if (dst->saturate_result != src->saturate_result ||
+	    dst->bit120 != src->bit120)
+		return false;
+
+	if (dst->export_write_index != VPE_EXPORT_NONE &&
+	    src->export_write_index != VPE_EXPORT_NONE)
+		return false;
+
+	dst_ops = vpe_slot_operands(dst, VPE_SLOT_VECTOR) |
+		  vpe_slot_operands(dst, VPE_SLOT_SCALAR);
+	src_ops = vpe_slot_operands(src, VPE_SLOT_VECTOR) |
+		  vpe_slot_operands(src, VPE_SLOT_SCALAR);
+
+	/* shared operands have to be identical */
+	for (op = VPE_OPERAND_A; op <= VPE_OPERAND_C; op++) {
+		if (!(src_ops & BIT(op)))
+			continue;
+
+		vpe_get_operand(src, op, &b);
+
+		if (b.type == REG_TYPE_ATTRIBUTE)
+			attribute = true;
+
+		if (b.type == REG_TYPE_UNIFORM)
+			uniform = true;
+
+		if (!(dst_ops & BIT(op)))
+			continue;
+
+		vpe_get_operand(dst, op, &a);
+
+		if (!vpe_operand_equal(&a, &b))
+			return false;
+	}
+
+	/* so are the fetch indices of attributes and uniforms */
+	for (op = VPE_OPERAND_A; op <= VPE_OPERAND_C; op++) {
+		if (!(dst_ops & BIT(op)))
+			continue;
+
+		vpe_get_operand(dst, op, &a);
+
+		if (a.type == REG_TYPE_ATTRIBUTE && attribute &&
+		    dst->attribute_fetch_index != src->attribute_fetch_index)
+			return false;
+
+		if (a.type == REG_TYPE_UNIFORM && uniform &&
+		    dst->uniform_fetch_index != src->uniform_fetch_index)
+			return false;
+	}
+
+	vpe_reads(src, src_ops, src_reads);
+	vpe_writes(src, src_writes);
+
+	for (k = i; k < j; k++) {
+		const vpe_instr128 *ins = &prog[k];
+
+		vpe_reads(ins, vpe_slot_operands(ins, VPE_SLOT_VECTOR) |
+			       vpe_slot_operands(ins, VPE_SLOT_SCALAR), reads);
+		vpe_writes(ins, writes);
+
+		if (vpe_overlap(writes, src_reads) ||
+		    vpe_overlap(reads, src_writes) ||
+		    vpe_overlap(writes, src_writes))
+			return false;
+
+		if (src->export_write_index != VPE_EXPORT_NONE &&
+		    ins->export_write_index == src->export_write_index)
+			return false;
+	}
+
+	return true;
+}
+
+static void vpe_hoist(vpe_instr128 *dst, const vpe_instr128 *src)
+{
+	unsigned ops = vpe_slot_operands(src, VPE_SLOT_VECTOR) |
+		       vpe_slot_operands(src, VPE_SLOT_SCALAR);
+	struct vpe_operand o;
+	unsigned op;
+
+	for (op = VPE_OPERAND_A; op <= VPE_OPERAND_C; op++) {
+		if (!(ops & BIT(op)))
+			continue;
+
+		vpe_get_operand(src, op, &o);
+		vpe_set_operand(dst, op, &o);
+
+		if (o.type == REG_TYPE_ATTRIBUTE)
+			dst->attribute_fetch_index = src->attribute_fetch_index;
+
+		if (o.type == REG_TYPE_UNIFORM)
+			dst->uniform_fetch_index = src->uniform_fetch_index;
+	}
+
+	if (!vpe_slot_empty(src, VPE_SLOT_VECTOR)) {
+		dst->vector_opcode = src->vector_opcode;
+		vpe_set_write(dst, VPE_SLOT_VECTOR,
+			      vpe_write_reg(src, VPE_SLOT_VECTOR),
+			      vpe_write_mask(src, VPE_SLOT_VECTOR));
+	} else {
+		dst->scalar_opcode = src->scalar_opcode;
+		vpe_set_write(dst, VPE_SLOT_SCALAR,
+			      vpe_write_reg(src, VPE_SLOT_SCALAR),
+			      vpe_write_mask(src, VPE_SLOT_SCALAR));
+	}
+
+	if (src->export_write_index != VPE_EXPORT_NONE) {
+		dst->export_write_index = src->export_write_index;
+		dst->export_vector_write_enable =
+					src->export_vector_write_enable;
+	}
+}
+
+static unsigned vpe_pack(vpe_instr128 *prog, unsigned count)
+{
+	unsigned i, j, k, end;
+
+	for (i = 0; i < count; i++) {
+		enum vpe_slot free_slot;
+
+		if (vpe_slot_empty(&prog[i], VPE_SLOT_VECTOR))
+			free_slot = VPE_SLOT_VECTOR;
+		else if (vpe_slot_empty(&prog[i], VPE_SLOT_SCALAR))
+			free_slot = VPE_SLOT_SCALAR;
+		else
+			continue;
+
+		end = MIN(count, i + 1 + VPE_PACK_WINDOW);
+
+		for (j = i + 1; j < end; j++) {
+			/* the partner has to fill exactly the free slot */
+			if (vpe_slot_empty(&prog[j], free_slot) ||
+			    !vpe_slot_empty(&prog[j], !free_slot))
+				continue;
+
+			if (!vpe_can_hoist(prog, i, j))
+				continue;
+
+			vpe_hoist(&prog[i], &prog[j]);
+
+			for (k = j; k + 1 < count; k++)
+				prog[k] = prog[k + 1];
+
+			count--;
+			break;
+		}
+	}
+
+	return count;
+}
+
+/* mask of the vertex exports read by the linker, all if it can't tell */
+static uint32_t vpe_linker_exports(struct grate_shader *linker)
+{
+	uint32_t exports = BIT(0);
+	link_instr instr;
+	unsigned i, count;
+
+	if (!linker || linker->num_words < 1 ||
+	    linker->words[0] >> 28 != 1 ||
+	    ((linker->words[0] >> 16) & 0xfff) != 0x300)
+		return ~0u;
+
+	count = (linker->words[0] & 0xffff) / 2;
+	if (1 + count * 2 > linker->num_words)
+		return ~0u;
+
+	for (i = 0; i < count; i++) {
+		instr.first = linker->words[1 + i * 2];
+		instr.latter = linker->words[2 + i * 2];
+
+		exports |= BIT(instr.vertex_export_index);
+	}
+
+	return exports;
+}
+
+static int vpe_optimize(struct grate_program *program, unsigned int level)
+{
+	struct grate_shader *vs = program->vs, *shader;
+	vpe_instr128 prog[VPE_MAX_INSTRUCTIONS];
+	unsigned i, count, num;
+
+	if (vs->num_words < 6 || (vs->num_words - 2) % 4 ||
+	    vs->words[0] != HOST1X_OPCODE_IMM(0x205, 0x00) ||
+	    vs->words[1] != HOST1X_OPCODE_NONINCR(0x206, vs->num_words - 2))
+		return -EINVAL;
+
+	count = (vs->num_words - 2) / 4;
+	if (count > VPE_MAX_INSTRUCTIONS)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		prog[i].part3 = vs->words[2 + i * 4];
+		prog[i].part2 = vs->words[3 + i * 4];
+		prog[i].part1 = vs->words[4 + i * 4];
+		prog[i].part0 = vs->words[5 + i * 4];
+
+		if (!vpe_instruction_supported(&prog[i]))
+			return 0;
+	}
+
+	num = vpe_eliminate_dead_code(prog, count,
+				      vpe_linker_exports(program->linker));
+	if (!num)
+		return -EINVAL;
+
+	if (level > 1)
+		num = vpe_pack(prog, num);
+
+	if (num == count)
+		return 0;
+
+	for (i = 0; i < num; i++)
+		prog[i].end_of_program = (i == num - 1);
+
+	shader = grate_shader_copy(vs, 2 + num * 4);
+	if (!shader)
+		return -ENOMEM;
+
+	shader->words[0] = HOST1X_OPCODE_IMM(0x205, 0x00);
+	shader->words[1] = HOST1X_OPCODE_NONINCR(0x206, num * 4);
+
+	for (i = 0; i < num; i++) {
+		shader->words[2 + i * 4] = prog[i].part3;
+		shader->words[3 + i * 4] = prog[i].part2;
+		shader->words[4 + i * 4] = prog[i].part1;
+		shader->words[5 + i * 4] = prog[i].part0;
+	}
+
+	grate_info("vertex program: %u -> %u instructions\n", count, num);
+
+	/* the original may be shared, leave it intact */
+	grate_shader_free(program->vs);
+	program->vs = shader;
+
+	return 0;
+}
+
+int grate_program_optimize(struct grate_program *program, unsigned int level)
+{
+	int err;
+
+	if (!level)
+		return 0;
+
+	/* the symbol tables of a linked program point into the shaders */
+	if (program->attributes || program->vs_uniforms ||
+	    program->fs_uniforms)
+		return -EBUSY;
+
+	err = grate_linker_optimize(program, level);
+	if (err < 0)
+		return err;
+
+	err = vpe_optimize(program, level);
+	if (err < 0)
+		return err;
+
+	if (level < 2)
+		return 0;
+
+	return grate_fragment_schedule(program);
+}
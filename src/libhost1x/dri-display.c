@@ -39,7 +39,7 @@ static int dri2_display_set(struct host1x_display *displayp,
 	xcb_dri2_swap_buffers_cookie_t cookie;
 	xcb_dri2_swap_buffers_reply_t *rep;
 
-	host1x_gr2d_surface_blit(stuff->host1x->gr2d,
+	host1x_gr2d_surface_blit(host1x_get_gr2d(stuff->host1x),
 				 fb->pixbuf, stuff->pixbuf,
 				 0, 0,
 				 fb->pixbuf->width,
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) GRATE-DRIVER project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "x11-display.h"
+
+#ifdef HAVE_XCB_DRI3
+
+#include <errno.h>
+#include <string.h>
+
+#include <xcb/dri3.h>
+#include <xcb/present.h>
+
+/*
+ * DRI3/Present presentation. The window buffers are BOs shared with the
+ * X server as dma-buf pixmaps, frames are blitted into them by GR2D and
+ * presented, without the CPU ever touching the pixels.
+ */
+
+static int dri3_wait_idle(struct xcb_stuff *stuff, unsigned int index)
+{
+	struct dri3_buffer *buffer = &stuff->dri3.buffers[index];
+	xcb_present_generic_event_t *event;
+	xcb_present_idle_notify_event_t *idle;
+	unsigned int i;
+
+	while (buffer->busy) {
+		event = (void *)xcb_wait_for_special_event(stuff->disp,
+							   stuff->dri3.events);
+		if (!event)
+			return -EIO;
+
+		if (event->evtype == XCB_PRESENT_EVENT_IDLE_NOTIFY) {
+			idle = (void *)event;
+
+			for (i = 0; i < DRI3_NUM_BUFFERS; i++)
+				if (stuff->dri3.buffers[i].pixmap ==
+				    idle->pixmap)
+					stuff->dri3.buffers[i].busy = false;
+		}
+
+		free(event);
+	}
+
+	return 0;
+}
+
+static int dri3_display_set(struct host1x_display *displayp,
+			    struct host1x_framebuffer *fb,
+			    bool vsync, bool reflect_y)
+{
+	struct xcb_stuff *stuff = displayp->priv;
+	unsigned int index = stuff->dri3.current;
+	struct dri3_buffer *buffer = &stuff->dri3.buffers[index];
+	uint32_t options = XCB_PRESENT_OPTION_NONE;
+	int err;
+
+	err = dri3_wait_idle(stuff, index);
+	if (err < 0)
+		return err;
+
+	err = host1x_gr2d_surface_blit(host1x_get_gr2d(stuff->host1x),
+				       fb->pixbuf, buffer->pixbuf,
+				       0, 0,
+				       fb->pixbuf->width,
+				       fb->pixbuf->height,
+				       0, 0,
+				       buffer->pixbuf->width,
+				      -buffer->pixbuf->height);
+	if (err < 0)
+		return err;
+
+	if (!vsync)
+		options |= XCB_PRESENT_OPTION_ASYNC;
+
+	xcb_present_pixmap(stuff->disp, stuff->win, buffer->pixmap,
+			   stuff->dri3.serial++, 0, 0, 0, 0, 0, 0, 0,
+			   options, 0, 0, 0, 0, NULL);
+	xcb_flush(stuff->disp);
+
+	buffer->busy = true;
+	stuff->dri3.current = (index + 1) % DRI3_NUM_BUFFERS;
+
+	return 0;
+}
+
+static int dri3_buffer_init(struct xcb_stuff *stuff,
+			    struct dri3_buffer *buffer,
+			    unsigned int width, unsigned int height)
+{
+	unsigned int pitch = ALIGN(width * 4, 64);
+	xcb_void_cookie_t cookie;
+	xcb_generic_error_t *err;
+	struct host1x_bo *bo;
+	int fd;
+
+	/* pixmaps can't have an offset, so the BO has no guard areas */
+	bo = HOST1X_BO_CREATE(stuff->host1x, pitch * height,
+			      NVHOST_BO_FLAG_FRAMEBUFFER);
+	if (!bo)
+		return -ENOMEM;
+
+	buffer->pixbuf = host1x_pixelbuffer_wrap(bo, width, height, pitch,
+						 PIX_BUF_FMT_BGRA8888,
+						 PIX_BUF_LAYOUT_LINEAR);
+	if (!buffer->pixbuf) {
+		host1x_bo_free(bo);
+		return -ENOMEM;
+	}
+
+	if (HOST1X_BO_EXPORT_DMABUF(bo, &fd))
+		return -EINVAL;
+
+	/* the fd is passed to and closed by XCB */
+	buffer->pixmap = xcb_generate_id(stuff->disp);
+	cookie = xcb_dri3_pixmap_from_buffer_checked(stuff->disp,
+						     buffer->pixmap,
+						     stuff->win,
+						     pitch * height,
+						     width, height, pitch,
+						     24, 32, fd);
+	err = xcb_request_check(stuff->disp, cookie);
+	free(err);
+	if (err) {
+		host1x_error("xcb_dri3_pixmap_from_buffer failed\n");
+		buffer->pixmap = 0;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void dri3_display_cleanup(struct xcb_stuff *stuff)
+{
+	unsigned int i;
+
+	for (i = 0; i < DRI3_NUM_BUFFERS; i++) {
+		struct dri3_buffer *buffer = &stuff->dri3.buffers[i];
+
+		if (buffer->pixmap)
+			xcb_free_pixmap(stuff->disp, buffer->pixmap);
+
+		if (buffer->pixbuf)
+			host1x_pixelbuffer_free(buffer->pixbuf);
+	}
+
+	if (stuff->dri3.events)
+		xcb_unregister_for_special_event(stuff->disp,
+						 stuff->dri3.events);
+
+	memset(&stuff->dri3, 0, sizeof(stuff->dri3));
+}
+
+int dri3_display_create(struct xcb_stuff *stuff, struct host1x_display *disp)
+{
+	xcb_present_query_version_reply_t *present_reply;
+	xcb_dri3_query_version_reply_t *dri3_reply;
+	unsigned int i;
+	uint32_t eid;
+	int err;
+
+	dri3_reply = xcb_dri3_query_version_reply(stuff->disp,
+			xcb_dri3_query_version(stuff->disp, 1, 0), NULL);
+	if (!dri3_reply) {
+		host1x_info("DRI3 unsupported\n");
+		return -ENOTSUP;
+	}
+	free(dri3_reply);
+
+	present_reply = xcb_present_query_version_reply(stuff->disp,
+			xcb_present_query_version(stuff->disp, 1, 0), NULL);
+	if (!present_reply) {
+		host1x_info("Present unsupported\n");
+		return -ENOTSUP;
+	}
+	free(present_reply);
+
+	eid = xcb_generate_id(stuff->disp);
+	xcb_present_select_input(stuff->disp, eid, stuff->win,
+				 XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+	stuff->dri3.events = xcb_register_for_special_xge(stuff->disp,
+							  &xcb_present_id,
+							  eid, NULL);
+	if (!stuff->dri3.events) {
+		err = -ENOMEM;
+		goto cleanup;
+	}
+
+	for (i = 0; i < DRI3_NUM_BUFFERS; i++) {
+		err = dri3_buffer_init(stuff, &stuff->dri3.buffers[i],
+				       disp->width, disp->height);
+		if (err < 0)
+			goto cleanup;
+	}
+
+	disp->set = dri3_display_set;
+
+	host1x_info("DRI3 initialized\n");
+
+	return 0;
+
+cleanup:
+	dri3_display_cleanup(stuff);
+
+	return err;
+}
+#endif
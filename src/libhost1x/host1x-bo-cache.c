@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * Cache of released buffer objects. Allocation sizes are rounded up to a
+ * size class, a freed BO is kept together with its mapping and handed out
+ * again to the next allocation of the same class and flags. Note that the
+ * content of a reused BO isn't cleared. Entries that weren't reused within
+ * HOST1X_BO_CACHE_TIMEOUT_MS are released, as well as the whole cache when
+ * the allocation from kernel fails.
+ */
+#define HOST1X_BO_CACHE_TIMEOUT_MS	1000
+#define HOST1X_BO_CACHE_MAX_SIZE	(32 * 1024 * 1024)
+
+/* serialises all BO caches, BO create / free go through the cache */
+static pthread_mutex_t host1x_bo_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t host1x_bo_cache_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+static void host1x_bo_cache_prepare(struct host1x_bo_cache *cache)
+{
+	if (!cache->list.next)
+		INIT_LIST_HEAD(&cache->list);
+}
+
+/* round up to four size classes per power of two, page granular */
+size_t host1x_bo_cache_size_class(size_t size)
+{
+	size_t step = 4096;
+
+	size = (size + 4095) & ~4095ul;
+
+	while (step * 8 <= size)
+		step *= 2;
+
+	return (size + step - 1) & ~(step - 1);
+}
+
+static void host1x_bo_cache_evict(struct host1x_bo_cache *cache,
+				  struct host1x_bo_priv *priv)
+{
+	list_del(&priv->cache_list);
+	cache->num_bos--;
+	cache->size -= priv->cache_size;
+
+	host1x_bo_unaccount(priv);
+
+	priv->free(priv->cache_bo);
+	free(priv->busy);
+	free(priv);
+}
+
+/* release entries older than the timeout, or all of them if "all" is set */
+static void host1x_bo_cache_expire(struct host1x_bo_cache *cache, bool all)
+{
+	struct host1x_bo_priv *priv, *tmp;
+	uint64_t now = host1x_bo_cache_time();
+
+	/* the list is sorted from oldest to newest */
+	list_for_each_entry_safe(priv, tmp, &cache->list, cache_list) {
+		if (!all && now - priv->cache_time < HOST1X_BO_CACHE_TIMEOUT_MS)
+			break;
+
+		host1x_bo_cache_evict(cache, priv);
+	}
+}
+
+struct host1x_bo *host1x_bo_cache_get(struct host1x *host1x, size_t size,
+				      unsigned long flags)
+{
+	struct host1x_bo_cache *cache = &host1x->bo_cache;
+	struct host1x_bo_priv *priv;
+	size_t cache_size;
+
+	pthread_mutex_lock(&host1x_bo_cache_lock);
+
+	host1x_bo_cache_prepare(cache);
+	host1x_bo_cache_expire(cache, false);
+
+	cache_size = host1x_bo_cache_size_class(size);
+
+	/* prefer the most recently released BO, its pages are likely hot */
+	for (priv = list_entry(cache->list.prev, typeof(*priv), cache_list);
+	     &priv->cache_list != &cache->list;
+	     priv = list_entry(priv->cache_list.prev, typeof(*priv), cache_list)) {
+		struct host1x_bo *bo = priv->cache_bo;
+
+		if (priv->cache_size != cache_size || priv->cache_flags != flags)
+			continue;
+
+		/* an existing mapping covers only the size it was made for */
+		if (bo->ptr && bo->size < size)
+			continue;
+
+		list_del(&priv->cache_list);
+		cache->num_bos--;
+		cache->size -= cache_size;
+		cache->hits++;
+
+		bo->size = size;
+
+		pthread_mutex_unlock(&host1x_bo_cache_lock);
+
+		return bo;
+	}
+
+	cache->misses++;
+
+	pthread_mutex_unlock(&host1x_bo_cache_lock);
+
+	return NULL;
+}
+
+bool host1x_bo_cache_put(struct host1x_bo *bo)
+{
+	struct host1x_bo_priv *priv = bo->priv;
+	struct host1x_bo_cache *cache;
+
+	if (!priv->cache_host1x || bo->wrapped)
+		return false;
+
+	cache = &priv->cache_host1x->bo_cache;
+
+	if (priv->cache_size > HOST1X_BO_CACHE_MAX_SIZE)
+		return false;
+
+	pthread_mutex_lock(&host1x_bo_cache_lock);
+
+	if (cache->disabled) {
+		pthread_mutex_unlock(&host1x_bo_cache_lock);
+		return false;
+	}
+
+	host1x_bo_cache_prepare(cache);
+
+	priv->cache_bo = bo;
+	priv->cache_time = host1x_bo_cache_time();
+	list_add_tail(&priv->cache_list, &cache->list);
+	cache->num_bos++;
+	cache->size += priv->cache_size;
+
+	host1x_bo_account(priv, HOST1X_MEM_CACHED, 0);
+
+	/* drop the oldest entries if the cache grew too big */
+	while (cache->size > HOST1X_BO_CACHE_MAX_SIZE) {
+		priv = list_entry(cache->list.next, typeof(*priv), cache_list);
+		host1x_bo_cache_evict(cache, priv);
+	}
+
+	host1x_bo_cache_expire(cache, false);
+
+	pthread_mutex_unlock(&host1x_bo_cache_lock);
+
+	return true;
+}
+
+void host1x_bo_cache_trim(struct host1x *host1x)
+{
+	struct host1x_bo_cache *cache = &host1x->bo_cache;
+
+	pthread_mutex_lock(&host1x_bo_cache_lock);
+	host1x_bo_cache_prepare(cache);
+	host1x_bo_cache_expire(cache, true);
+	pthread_mutex_unlock(&host1x_bo_cache_lock);
+}
+
+void host1x_bo_cache_fini(struct host1x *host1x)
+{
+	host1x_bo_cache_trim(host1x);
+
+	pthread_mutex_lock(&host1x_bo_cache_lock);
+	host1x->bo_cache.disabled = true;
+	pthread_mutex_unlock(&host1x_bo_cache_lock);
+}
+
+void host1x_bo_cache_get_stats(struct host1x *host1x,
+			       struct host1x_bo_cache_stats *stats)
+{
+	struct host1x_bo_cache *cache = &host1x->bo_cache;
+
+	pthread_mutex_lock(&host1x_bo_cache_lock);
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->num_bos = cache->num_bos;
+	stats->size = cache->size;
+	pthread_mutex_unlock(&host1x_bo_cache_lock);
+}
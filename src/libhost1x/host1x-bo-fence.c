@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * Deferred destruction of BOs that GPU may still access. Submission of a
+ * job marks its relocation targets busy with the syncpoint of the job and
+ * the number of flushes of that syncpoint so far. The job is covered by the
+ * next flush, once its fence is reached the BO is idle. A BO freed while
+ * being busy is put on a list and destroyed later, the list is checked
+ * whenever a BO is created or freed.
+ *
+ * The marks are checked against the syncpoint values seen by the last
+ * update, which reads the syncpoints outside of the lock. Hence an ioctl
+ * is issued per busy syncpoint and not per BO, and never with the lock
+ * held.
+ */
+#define HOST1X_BO_FENCE_SYNCPTS	256
+
+struct host1x_bo_fence_syncpt {
+	struct host1x_client *client;
+	uint64_t flushes;
+	uint32_t fence;
+
+	/* syncpoint value seen by the last update */
+	uint32_t reached;
+	bool reached_known;
+};
+
+static struct host1x_bo_fence_syncpt
+			host1x_bo_fence_syncpts[HOST1X_BO_FENCE_SYNCPTS];
+
+/* serialises the busy marks, the flush counters and the deferred list */
+static pthread_mutex_t host1x_bo_fence_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(host1x_bo_deferred);
+
+void host1x_bo_fence_flushed(struct host1x_client *client, uint32_t fence)
+{
+	uint32_t syncpt = client->syncpts[0].id;
+
+	if (syncpt >= HOST1X_BO_FENCE_SYNCPTS)
+		return;
+
+	pthread_mutex_lock(&host1x_bo_fence_lock);
+	host1x_bo_fence_syncpts[syncpt].client = client;
+	host1x_bo_fence_syncpts[syncpt].fence = fence;
+	host1x_bo_fence_syncpts[syncpt].flushes++;
+	pthread_mutex_unlock(&host1x_bo_fence_lock);
+}
+
+/*
+ * Called with the lock held. The fence of the first flush that covers the
+ * mark is unknown, the fence of the latest flush is used instead. It is
+ * fixed once seen, so that a busy engine doesn't keep the BO forever.
+ */
+static bool host1x_bo_busy_mark(struct host1x_bo_busy *busy)
+{
+	struct host1x_bo_fence_syncpt *syncpt;
+
+	if (!busy->valid)
+		return false;
+
+	syncpt = &host1x_bo_fence_syncpts[busy->syncpt];
+
+	/* the job wasn't flushed yet */
+	if (syncpt->flushes == busy->flushes)
+		return true;
+
+	if (!busy->fence_known) {
+		busy->fence = syncpt->fence;
+		busy->fence_known = true;
+	}
+
+	/* syncpoint values wrap around */
+	if (!syncpt->reached_known ||
+	    (int32_t)(syncpt->reached - busy->fence) < 0)
+		return true;
+
+	busy->valid = false;
+
+	return false;
+}
+
+/* called with the lock held */
+static bool host1x_bo_busy(struct host1x_bo_priv *priv)
+{
+	unsigned int i;
+
+	for (i = 0; i < priv->max_busy; i++) {
+		if (host1x_bo_busy_mark(&priv->busy[i]))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Called with the lock held. Marks of other syncpoints are kept until they
+ * are reached, the slots grow if all of them are still busy.
+ */
+static struct host1x_bo_busy *host1x_bo_busy_slot(struct host1x_bo_priv *priv,
+						  uint32_t syncpt)
+{
+	struct host1x_bo_busy *busy;
+	unsigned int i, max;
+
+	for (i = 0; i < priv->max_busy; i++) {
+		if (!priv->busy[i].valid || priv->busy[i].syncpt == syncpt)
+			return &priv->busy[i];
+	}
+
+	for (i = 0; i < priv->max_busy; i++) {
+		if (!host1x_bo_busy_mark(&priv->busy[i]))
+			return &priv->busy[i];
+	}
+
+	max = priv->max_busy ? priv->max_busy * 2 : HOST1X_BO_MAX_BUSY;
+
+	busy = realloc(priv->busy, max * sizeof(*busy));
+	if (!busy)
+		return NULL;
+
+	i = priv->max_busy;
+	memset(&busy[i], 0, (max - i) * sizeof(*busy));
+	priv->busy = busy;
+	priv->max_busy = max;
+
+	return &busy[i];
+}
+
+void host1x_bo_mark_busy(struct host1x_bo *bo, uint32_t syncpt)
+{
+	struct host1x_bo_priv *priv;
+	struct host1x_bo_busy *busy;
+
+	if (!bo || syncpt >= HOST1X_BO_FENCE_SYNCPTS)
+		return;
+
+	priv = (bo->wrapped ?: bo)->priv;
+
+	pthread_mutex_lock(&host1x_bo_fence_lock);
+
+	busy = host1x_bo_busy_slot(priv, syncpt);
+	if (busy) {
+		busy->syncpt = syncpt;
+		busy->flushes = host1x_bo_fence_syncpts[syncpt].flushes;
+		busy->fence_known = false;
+		busy->valid = true;
+	}
+
+	pthread_mutex_unlock(&host1x_bo_fence_lock);
+
+	if (!busy)
+		host1x_error("failed to mark BO %p busy\n", bo);
+}
+
+/* reads the syncpoints that have flushes not seen reached yet */
+static void host1x_bo_fence_update(void)
+{
+	struct {
+		struct host1x_client *client;
+		uint32_t fence;
+		unsigned int index;
+	} pending[HOST1X_BO_FENCE_SYNCPTS];
+	struct host1x_bo_fence_syncpt *syncpt;
+	unsigned int i, num = 0;
+	uint32_t value;
+	int ret;
+
+	pthread_mutex_lock(&host1x_bo_fence_lock);
+
+	for (i = 0; i < HOST1X_BO_FENCE_SYNCPTS; i++) {
+		syncpt = &host1x_bo_fence_syncpts[i];
+
+		if (!syncpt->client || (syncpt->reached_known &&
+		    (int32_t)(syncpt->reached - syncpt->fence) >= 0))
+			continue;
+
+		pending[num].client = syncpt->client;
+		pending[num].fence = syncpt->fence;
+		pending[num++].index = i;
+	}
+
+	pthread_mutex_unlock(&host1x_bo_fence_lock);
+
+	for (i = 0; i < num; i++) {
+		ret = host1x_client_read(pending[i].client, &value);
+		if (ret < 0) {
+			ret = host1x_client_poll(pending[i].client,
+						 pending[i].fence);
+			if (ret == 0)
+				continue;
+
+			/* an error of the engine leaves nothing to wait for */
+			value = pending[i].fence;
+		}
+
+		pthread_mutex_lock(&host1x_bo_fence_lock);
+		syncpt = &host1x_bo_fence_syncpts[pending[i].index];
+
+		if (!syncpt->reached_known ||
+		    (int32_t)(value - syncpt->reached) > 0) {
+			syncpt->reached = value;
+			syncpt->reached_known = true;
+		}
+
+		pthread_mutex_unlock(&host1x_bo_fence_lock);
+	}
+}
+
+static void host1x_bo_reap(bool all)
+{
+	struct host1x_bo_priv *priv, *tmp;
+	LIST_HEAD(idle);
+	bool empty;
+
+	if (!all) {
+		pthread_mutex_lock(&host1x_bo_fence_lock);
+		empty = list_empty(&host1x_bo_deferred);
+		pthread_mutex_unlock(&host1x_bo_fence_lock);
+
+		if (empty)
+			return;
+
+		host1x_bo_fence_update();
+	}
+
+	pthread_mutex_lock(&host1x_bo_fence_lock);
+
+	list_for_each_entry_safe(priv, tmp, &host1x_bo_deferred, busy_list) {
+		if (!all && host1x_bo_busy(priv))
+			continue;
+
+		list_del(&priv->busy_list);
+		list_add_tail(&priv->busy_list, &idle);
+	}
+
+	pthread_mutex_unlock(&host1x_bo_fence_lock);
+
+	/* the BO may go to the cache, which takes its own lock */
+	list_for_each_entry_safe(priv, tmp, &idle, busy_list) {
+		list_del(&priv->busy_list);
+		host1x_bo_release(priv->busy_bo);
+	}
+}
+
+/* returns true if the BO is freed later on */
+bool host1x_bo_defer_free(struct host1x_bo *bo)
+{
+	struct host1x_bo_priv *priv = bo->priv;
+	bool busy = false;
+
+	/* the memory of a wrap belongs to the wrapped BO */
+	if (!bo->wrapped) {
+		pthread_mutex_lock(&host1x_bo_fence_lock);
+
+		busy = host1x_bo_busy(priv);
+		if (busy) {
+			priv->busy_bo = bo;
+			list_add_tail(&priv->busy_list, &host1x_bo_deferred);
+		}
+
+		pthread_mutex_unlock(&host1x_bo_fence_lock);
+	}
+
+	host1x_bo_reap(false);
+
+	return busy;
+}
+
+/* whether submitted jobs referencing the BO or its wraps may still run */
+bool host1x_bo_is_busy(struct host1x_bo *bo)
+{
+	struct host1x_bo_priv *priv = (bo->wrapped ?: bo)->priv;
+	bool busy;
+
+	host1x_bo_fence_update();
+
+	pthread_mutex_lock(&host1x_bo_fence_lock);
+	busy = host1x_bo_busy(priv);
+	pthread_mutex_unlock(&host1x_bo_fence_lock);
+
+	return busy;
+}
+
+void host1x_bo_fence_reap(void)
+{
+	host1x_bo_reap(false);
+}
+
+/* jobs that weren't flushed by now won't run */
+void host1x_bo_fence_fini(void)
+{
+	struct host1x_client *client;
+	uint32_t fence;
+	unsigned int i;
+
+	for (i = 0; i < HOST1X_BO_FENCE_SYNCPTS; i++) {
+		pthread_mutex_lock(&host1x_bo_fence_lock);
+		client = host1x_bo_fence_syncpts[i].client;
+		fence = host1x_bo_fence_syncpts[i].fence;
+		host1x_bo_fence_syncpts[i].client = NULL;
+		pthread_mutex_unlock(&host1x_bo_fence_lock);
+
+		if (client)
+			HOST1X_CLIENT_WAIT(client, fence, ~0u);
+	}
+
+	host1x_bo_reap(true);
+}
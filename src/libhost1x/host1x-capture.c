@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * Asynchronous framebuffer capture. The framebuffer is copied by GR2D into
+ * a linear staging pixelbuffer and the PNG encoding of the copy happens on
+ * a background thread once the blit's fence is reached, so the caller only
+ * pays for queueing the blit. Staging buffers are recycled after encoding.
+ */
+
+struct host1x_capture_frame {
+	struct list_head list;
+	struct host1x_pixelbuffer *pixbuf;
+	uint32_t fence;
+	char *path;
+};
+
+struct host1x_capture {
+	struct host1x *host1x;
+	struct host1x_gr2d *gr2d;
+	struct host1x_capture_frame *frames;
+	unsigned int num_frames;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct list_head idle;
+	struct list_head pending;
+	unsigned int busy;
+	bool stop;
+	int error;
+};
+
+static int host1x_capture_encode(struct host1x_capture *capture,
+				 struct host1x_capture_frame *frame)
+{
+	struct host1x_pixelbuffer *pixbuf = frame->pixbuf;
+	uint8_t *map;
+	int err;
+
+	err = HOST1X_CLIENT_WAIT(capture->gr2d->client, frame->fence, ~0u);
+	if (err < 0)
+		return err;
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, (void **)&map);
+	if (err < 0)
+		return err;
+
+	err = HOST1X_BO_INVALIDATE(pixbuf->bo, pixbuf->bo->offset,
+				   pixbuf->pitch * pixbuf->height);
+	if (err < 0)
+		return err;
+
+	return host1x_png_write(frame->path, pixbuf->width, pixbuf->height,
+				map + pixbuf->bo->offset, pixbuf->pitch);
+}
+
+static void *host1x_capture_thread(void *data)
+{
+	struct host1x_capture *capture = data;
+	struct host1x_capture_frame *frame;
+	int err;
+
+	pthread_mutex_lock(&capture->lock);
+
+	while (true) {
+		while (list_empty(&capture->pending) && !capture->stop)
+			pthread_cond_wait(&capture->cond, &capture->lock);
+
+		if (list_empty(&capture->pending))
+			break;
+
+		frame = list_entry(capture->pending.next,
+				   struct host1x_capture_frame, list);
+		list_del(&frame->list);
+
+		pthread_mutex_unlock(&capture->lock);
+		err = host1x_capture_encode(capture, frame);
+		pthread_mutex_lock(&capture->lock);
+
+		if (err < 0) {
+			host1x_error("Failed to save `%s': %d\n",
+				     frame->path, err);
+			if (!capture->error)
+				capture->error = err;
+		}
+
+		free(frame->path);
+		frame->path = NULL;
+
+		list_add_tail(&frame->list, &capture->idle);
+		capture->busy--;
+
+		pthread_cond_broadcast(&capture->cond);
+	}
+
+	pthread_mutex_unlock(&capture->lock);
+
+	return NULL;
+}
+
+struct host1x_capture *host1x_capture_create(struct host1x *host1x,
+					     unsigned int num_buffers)
+{
+	struct host1x_capture *capture;
+	unsigned int i;
+	int err;
+
+	if (!num_buffers)
+		return NULL;
+
+	capture = calloc(1, sizeof(*capture));
+	if (!capture)
+		return NULL;
+
+	capture->frames = calloc(num_buffers, sizeof(*capture->frames));
+	if (!capture->frames) {
+		free(capture);
+		return NULL;
+	}
+
+	capture->host1x = host1x;
+	capture->gr2d = host1x_get_gr2d(host1x);
+	capture->num_frames = num_buffers;
+
+	INIT_LIST_HEAD(&capture->idle);
+	INIT_LIST_HEAD(&capture->pending);
+
+	for (i = 0; i < num_buffers; i++)
+		list_add_tail(&capture->frames[i].list, &capture->idle);
+
+	pthread_mutex_init(&capture->lock, NULL);
+	pthread_cond_init(&capture->cond, NULL);
+
+	err = pthread_create(&capture->thread, NULL, host1x_capture_thread,
+			     capture);
+	if (err) {
+		host1x_error("Failed to create capture thread: %d\n", err);
+		pthread_cond_destroy(&capture->cond);
+		pthread_mutex_destroy(&capture->lock);
+		free(capture->frames);
+		free(capture);
+		return NULL;
+	}
+
+	return capture;
+}
+
+/*
+ * Queue a capture of the framebuffer to the given PNG file. Rendering to
+ * the framebuffer must be finished and later rendering to it must wait for
+ * the returned fence (which is optional). Returns -EBUSY without blocking
+ * if all staging buffers are in use, letting the caller drop the frame.
+ */
+int host1x_capture_frame(struct host1x_capture *capture,
+			 struct host1x_framebuffer *fb, const char *path,
+			 struct host1x_fence *fence)
+{
+	struct host1x_pixelbuffer *src = fb->pixbuf;
+	struct host1x_capture_frame *frame;
+	struct host1x_pixelbuffer *pixbuf;
+	int err;
+
+	if (PIX_BUF_FORMAT_BITS(src->format) != 32) {
+		host1x_error("%u bits per pixel not supported\n",
+			     PIX_BUF_FORMAT_BITS(src->format));
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&capture->lock);
+
+	if (list_empty(&capture->idle)) {
+		pthread_mutex_unlock(&capture->lock);
+		return -EBUSY;
+	}
+
+	frame = list_entry(capture->idle.next, struct host1x_capture_frame,
+			   list);
+	list_del(&frame->list);
+	capture->busy++;
+
+	pthread_mutex_unlock(&capture->lock);
+
+	pixbuf = frame->pixbuf;
+
+	if (pixbuf && (pixbuf->width != src->width ||
+		       pixbuf->height != src->height ||
+		       pixbuf->format != src->format)) {
+		host1x_pixelbuffer_free(pixbuf);
+		frame->pixbuf = pixbuf = NULL;
+	}
+
+	if (!pixbuf) {
+		pixbuf = host1x_pixelbuffer_create(capture->host1x,
+						   src->width, src->height,
+						   src->width * 4, src->format,
+						   PIX_BUF_LAYOUT_LINEAR);
+		if (!pixbuf) {
+			err = -ENOMEM;
+			goto release;
+		}
+	}
+
+	frame->pixbuf = pixbuf;
+
+	frame->path = strdup(path);
+	if (!frame->path) {
+		err = -ENOMEM;
+		goto release;
+	}
+
+	err = host1x_gr2d_blit_async(capture->gr2d, src, pixbuf, 0, 0, 0, 0,
+				     src->width, src->height, &frame->fence);
+	if (err < 0)
+		goto free_path;
+
+	if (fence) {
+		fence->client = capture->gr2d->client;
+		fence->value = frame->fence;
+	}
+
+	pthread_mutex_lock(&capture->lock);
+	list_add_tail(&frame->list, &capture->pending);
+	pthread_cond_broadcast(&capture->cond);
+	pthread_mutex_unlock(&capture->lock);
+
+	return 0;
+
+free_path:
+	free(frame->path);
+	frame->path = NULL;
+release:
+	pthread_mutex_lock(&capture->lock);
+	list_add(&frame->list, &capture->idle);
+	capture->busy--;
+	pthread_mutex_unlock(&capture->lock);
+
+	return err;
+}
+
+/*
+ * Wait for all queued captures to be written. Returns the first error
+ * that occurred since the previous flush.
+ */
+int host1x_capture_flush(struct host1x_capture *capture)
+{
+	int err;
+
+	pthread_mutex_lock(&capture->lock);
+
+	while (capture->busy)
+		pthread_cond_wait(&capture->cond, &capture->lock);
+
+	err = capture->error;
+	capture->error = 0;
+
+	pthread_mutex_unlock(&capture->lock);
+
+	return err;
+}
+
+void host1x_capture_free(struct host1x_capture *capture)
+{
+	unsigned int i;
+
+	if (!capture)
+		return;
+
+	pthread_mutex_lock(&capture->lock);
+	capture->stop = true;
+	pthread_cond_broadcast(&capture->cond);
+	pthread_mutex_unlock(&capture->lock);
+
+	pthread_join(capture->thread, NULL);
+
+	for (i = 0; i < capture->num_frames; i++)
+		if (capture->frames[i].pixbuf)
+			host1x_pixelbuffer_free(capture->frames[i].pixbuf);
+
+	pthread_cond_destroy(&capture->cond);
+	pthread_mutex_destroy(&capture->lock);
+	free(capture->frames);
+	free(capture);
+}
@@ -23,8 +23,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sys/ioctl.h>
@@ -50,6 +53,9 @@
 #ifndef DRM_CLIENT_CAP_ATOMIC
 #define DRM_CLIENT_CAP_ATOMIC			3
 #endif
+#ifndef DRM_MODE_ATOMIC_NONBLOCK
+#define DRM_MODE_ATOMIC_NONBLOCK		0x0200
+#endif
 
 struct drm;
 
@@ -68,6 +74,12 @@ struct drm_channel {
 	uint64_t context;
 	struct drm *drm;
 	uint32_t fence;
+
+	/* submission scratch arrays, kept across submits */
+	struct drm_tegra_cmdbuf *cmdbufs;
+	unsigned int max_cmdbufs;
+	struct drm_tegra_reloc *relocs;
+	unsigned int max_relocs;
 };
 
 static inline struct drm_channel *to_drm_channel(struct host1x_client *client)
@@ -75,6 +87,17 @@ static inline struct drm_channel *to_drm_channel(struct host1x_client *client)
 	return container_of(client, struct drm_channel, client);
 }
 
+#define DRM_MAX_OVERLAYS 8
+
+struct drm_display;
+struct drm_overlay;
+
+/* user data of the flip events, the overlay is NULL for the primary plane */
+struct drm_flip_event {
+	struct drm_display *display;
+	struct drm_overlay *overlay;
+};
+
 struct drm_display {
 	struct host1x_display base;
 	struct drm *drm;
@@ -85,6 +108,48 @@ struct drm_display {
 	uint32_t crtc;
 	int reflected;
 	bool upside_down;
+	bool flip_pending;
+	struct drm_flip_event flip_event;
+	/* an update queued by one of the overlays wasn't applied yet */
+	bool commit_pending;
+
+	/* events read while waiting, reported by handle_events() */
+	bool flip_done;
+	uint64_t flip_time;
+	bool vblank_done;
+	uint64_t vblank_time;
+
+	/* planes taken by overlays */
+	uint32_t overlay_planes[DRM_MAX_OVERLAYS];
+	unsigned int num_overlays;
+};
+
+/* plane properties of the atomic updates queued by overlays */
+enum drm_plane_prop {
+	DRM_PLANE_FB_ID,
+	DRM_PLANE_CRTC_ID,
+	DRM_PLANE_CRTC_X,
+	DRM_PLANE_CRTC_Y,
+	DRM_PLANE_CRTC_W,
+	DRM_PLANE_CRTC_H,
+	DRM_PLANE_SRC_X,
+	DRM_PLANE_SRC_Y,
+	DRM_PLANE_SRC_W,
+	DRM_PLANE_SRC_H,
+	DRM_PLANE_NUM_PROPS,
+};
+
+static const char * const drm_plane_prop_names[DRM_PLANE_NUM_PROPS] = {
+	[DRM_PLANE_FB_ID] = "FB_ID",
+	[DRM_PLANE_CRTC_ID] = "CRTC_ID",
+	[DRM_PLANE_CRTC_X] = "CRTC_X",
+	[DRM_PLANE_CRTC_Y] = "CRTC_Y",
+	[DRM_PLANE_CRTC_W] = "CRTC_W",
+	[DRM_PLANE_CRTC_H] = "CRTC_H",
+	[DRM_PLANE_SRC_X] = "SRC_X",
+	[DRM_PLANE_SRC_Y] = "SRC_Y",
+	[DRM_PLANE_SRC_W] = "SRC_W",
+	[DRM_PLANE_SRC_H] = "SRC_H",
 };
 
 static inline struct drm_display *to_drm_display(struct host1x_display *display)
@@ -103,6 +168,15 @@ struct drm_overlay {
 	unsigned int height;
 	uint32_t format;
 	int reflected;
+
+	/* DRM formats supported by the plane */
+	uint32_t *formats;
+	unsigned int num_formats;
+
+	/* 0 if the plane can't be updated atomically */
+	uint32_t props[DRM_PLANE_NUM_PROPS];
+	struct drm_flip_event flip_event;
+	bool commit_pending;
 };
 
 static inline struct drm_overlay *to_drm_overlay(struct host1x_overlay *overlay)
@@ -162,6 +236,17 @@ static int drm_plane_type(struct drm *drm, drmModePlane *p)
 	return type;
 }
 
+static bool drm_display_plane_used(struct drm_display *display, uint32_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < display->num_overlays; i++)
+		if (display->overlay_planes[i] == id)
+			return true;
+
+	return false;
+}
+
 static int drm_display_find_plane(struct drm_display *display,
 				  uint32_t *plane, uint32_t type)
 {
@@ -180,7 +265,8 @@ static int drm_display_find_plane(struct drm_display *display,
 		}
 
 		if ((p->possible_crtcs & (1u << display->pipe)) &&
-		    (drm_plane_type(drm, p) == type))
+		    (drm_plane_type(drm, p) == type) &&
+		    !drm_display_plane_used(display, p->plane_id))
 			id = p->plane_id;
 
 		drmModeFreePlane(p);
@@ -197,6 +283,45 @@ static int drm_display_find_plane(struct drm_display *display,
 	return 0;
 }
 
+static int drm_display_wait_pending(struct drm_display *drm, bool *pending,
+				    uint32_t timeout);
+
+static int drm_plane_get_props(struct drm *drm, uint32_t plane,
+			       uint32_t *ids)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	unsigned int i, k;
+
+	props = drmModeObjectGetProperties(drm->fd, plane,
+					   DRM_MODE_OBJECT_PLANE);
+	if (!props)
+		return -ENODEV;
+
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(drm->fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		for (k = 0; k < DRM_PLANE_NUM_PROPS; k++)
+			if (!strcmp(prop->name, drm_plane_prop_names[k]))
+				ids[k] = prop->prop_id;
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	for (k = 0; k < DRM_PLANE_NUM_PROPS; k++) {
+		if (!ids[k]) {
+			memset(ids, 0, DRM_PLANE_NUM_PROPS * sizeof(*ids));
+			return -ENOTSUP;
+		}
+	}
+
+	return 0;
+}
+
 static int drm_overlay_reflect(struct drm_display *display, uint32_t plane_id,
 			       bool reflect_y)
 {
@@ -289,13 +414,58 @@ static int drm_overlay_close(struct host1x_overlay *overlay)
 	struct drm_display *display = plane->display;
 	struct drm *drm = display->drm;
 
+	unsigned int i;
+
+	/* the flip event of a queued update refers to the plane */
+	drm_display_wait_pending(display, &plane->commit_pending, 1000);
+
 	drmModeSetPlane(drm->fd, plane->plane, display->crtc, 0, 0, 0, 0, 0,
 			0, 0, 0, 0, 0);
 
+	for (i = 0; i < display->num_overlays; i++) {
+		if (display->overlay_planes[i] != plane->plane)
+			continue;
+
+		display->overlay_planes[i] =
+			display->overlay_planes[--display->num_overlays];
+		break;
+	}
+
+	free(plane->formats);
 	free(plane);
 	return 0;
 }
 
+static uint32_t drm_pixel_format(enum pixel_format format)
+{
+	switch (format) {
+	case PIX_BUF_FMT_RGB565:
+		return DRM_FORMAT_RGB565;
+	case PIX_BUF_FMT_RGBA5551:
+		return DRM_FORMAT_RGBA5551;
+	case PIX_BUF_FMT_RGBA8888:
+		return DRM_FORMAT_XBGR8888;
+	case PIX_BUF_FMT_BGRA8888:
+		return DRM_FORMAT_XRGB8888;
+	default:
+		return 0;
+	}
+}
+
+static bool drm_overlay_supports(struct host1x_overlay *overlay,
+				 enum pixel_format format)
+{
+	struct drm_overlay *plane = to_drm_overlay(overlay);
+	uint32_t drm_format = drm_pixel_format(format);
+	unsigned int i;
+
+	for (i = 0; i < plane->num_formats; i++)
+		if (drm_format && plane->formats[i] == drm_format)
+			return true;
+
+	return false;
+}
+
 static int drm_overlay_set(struct host1x_overlay *overlay,
 			   struct host1x_framebuffer *fb, unsigned int x,
 			   unsigned int y, unsigned int width,
@@ -344,14 +514,100 @@ static int drm_overlay_set(struct host1x_overlay *overlay,
 	return 0;
 }
 
+/*
+ * Commits the update without blocking, the flip event tells when it got
+ * applied. The CRTC takes one commit at a time, hence a pending flip of
+ * the primary plane or of another overlay makes the kernel return -EBUSY.
+ */
+static int drm_overlay_queue(struct host1x_overlay *overlay,
+			     struct host1x_framebuffer *fb, unsigned int x,
+			     unsigned int y, unsigned int width,
+			     unsigned int height, bool reflect_y)
+{
+	struct drm_overlay *plane = to_drm_overlay(overlay);
+	struct drm_display *display = plane->display;
+	uint64_t values[DRM_PLANE_NUM_PROPS];
+	struct drm *drm = display->drm;
+	drmModeAtomicReqPtr req;
+	unsigned int i;
+	int err = 0;
+
+	if (!plane->props[DRM_PLANE_FB_ID])
+		return -ENOTSUP;
+
+	err = drm_display_wait_pending(display, &plane->commit_pending, 0);
+	if (err == -ETIMEDOUT)
+		return -EBUSY;
+
+	if (err < 0)
+		return err;
+
+	if (plane->reflected != reflect_y) {
+		drm_overlay_reflect(display, plane->plane, reflect_y);
+		plane->reflected = reflect_y;
+	}
+
+	if (display->upside_down) {
+		x = display->mode.hdisplay - width - x;
+		y = display->mode.vdisplay - height - y;
+	}
+
+	values[DRM_PLANE_FB_ID] = fb->handle;
+	values[DRM_PLANE_CRTC_ID] = display->crtc;
+	values[DRM_PLANE_CRTC_X] = x;
+	values[DRM_PLANE_CRTC_Y] = y;
+	values[DRM_PLANE_CRTC_W] = width;
+	values[DRM_PLANE_CRTC_H] = height;
+	values[DRM_PLANE_SRC_X] = 0;
+	values[DRM_PLANE_SRC_Y] = 0;
+	values[DRM_PLANE_SRC_W] = (uint64_t)fb->pixbuf->width << 16;
+	values[DRM_PLANE_SRC_H] = (uint64_t)fb->pixbuf->height << 16;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	for (i = 0; i < DRM_PLANE_NUM_PROPS && err >= 0; i++)
+		err = drmModeAtomicAddProperty(req, plane->plane,
+					       plane->props[i], values[i]);
+
+	if (err >= 0)
+		err = drmModeAtomicCommit(drm->fd, req,
+					  DRM_MODE_ATOMIC_NONBLOCK |
+					  DRM_MODE_PAGE_FLIP_EVENT,
+					  &plane->flip_event);
+
+	drmModeAtomicFree(req);
+
+	if (err < 0)
+		return err;
+
+	plane->commit_pending = true;
+	display->commit_pending = true;
+
+	return 0;
+}
+
+static int drm_overlay_wait(struct host1x_overlay *overlay, uint32_t timeout)
+{
+	struct drm_overlay *plane = to_drm_overlay(overlay);
+
+	return drm_display_wait_pending(plane->display, &plane->commit_pending,
+					timeout);
+}
+
 static int drm_overlay_create(struct host1x_display *display,
 			      struct host1x_overlay **overlayp)
 {
 	struct drm_display *drm = to_drm_display(display);
 	struct drm_overlay *overlay;
+	drmModePlane *p;
 	uint32_t plane = 0;
 	int err;
 
+	if (drm->num_overlays == DRM_MAX_OVERLAYS)
+		return -ENODEV;
+
 	err = drm_display_find_plane(drm, &plane, DRM_PLANE_TYPE_OVERLAY);
 	if (err < 0)
 		return err;
@@ -360,12 +616,35 @@ static int drm_overlay_create(struct host1x_display *display,
 	if (!overlay)
 		return -ENOMEM;
 
+	p = drmModeGetPlane(drm->drm->fd, plane);
+	if (p) {
+		overlay->formats = calloc(p->count_formats,
+					  sizeof(*overlay->formats));
+		if (overlay->formats) {
+			memcpy(overlay->formats, p->formats,
+			       p->count_formats * sizeof(*overlay->formats));
+			overlay->num_formats = p->count_formats;
+		}
+
+		drmModeFreePlane(p);
+	}
+
 	overlay->base.close = drm_overlay_close;
 	overlay->base.set = drm_overlay_set;
+	overlay->base.queue = drm_overlay_queue;
+	overlay->base.wait = drm_overlay_wait;
+	overlay->base.supports = drm_overlay_supports;
 
 	overlay->display = drm;
 	overlay->plane = plane;
 	overlay->reflected = -1;
+	overlay->flip_event.display = drm;
+	overlay->flip_event.overlay = overlay;
+
+	/* without atomic modesetting updates are applied synchronously */
+	drm_plane_get_props(drm->drm, plane, overlay->props);
+
+	drm->overlay_planes[drm->num_overlays++] = plane;
 
 	*overlayp = &overlay->base;
 
@@ -376,71 +655,259 @@ static void drm_display_on_page_flip(int fd, unsigned int frame,
 				     unsigned int sec, unsigned int usec,
 				     void *data)
 {
+	struct drm_flip_event *event = data;
+	struct drm_display *drm = event->display;
+
+	if (event->overlay) {
+		event->overlay->commit_pending = false;
+		drm->commit_pending = false;
+		return;
+	}
+
+	drm->flip_pending = false;
+	drm->flip_done = true;
+	drm->flip_time = sec * 1000000ull + usec;
 }
 
 static void drm_display_on_vblank(int fd, unsigned int frame,
 				  unsigned int sec, unsigned int usec,
 				  void *data)
 {
+	struct drm_display *drm = data;
+
+	drm->vblank_done = true;
+	drm->vblank_time = sec * 1000000ull + usec;
 }
 
-static int drm_display_set(struct host1x_display *display,
-			   struct host1x_framebuffer *fb,
-			   bool vsync, bool reflect_y)
+static void drm_display_read_events(struct drm_display *drm)
 {
-	struct drm_display *drm = to_drm_display(display);
+	drmEventContext context;
+
+	memset(&context, 0, sizeof(context));
+	context.version = DRM_EVENT_CONTEXT_VERSION;
+	context.page_flip_handler = drm_display_on_page_flip;
+	context.vblank_handler = drm_display_on_vblank;
+
+	drmHandleEvent(drm->drm->fd, &context);
+}
+
+/* reads the events until the flag is cleared by one */
+static uint64_t drm_display_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+/*
+ * The timeout bounds the whole wait, reading unrelated events (vblanks,
+ * other planes) doesn't restart it.
+ */
+static int drm_display_wait_pending(struct drm_display *drm, bool *pending,
+				    uint32_t timeout)
+{
+	struct timeval tv, *tvp = NULL;
+	uint64_t deadline = 0, left, now;
+	fd_set fds;
 	int err;
 
-	if (drm->reflected != reflect_y) {
-		drm_overlay_reflect(drm, drm->plane, reflect_y);
-		drm->reflected = reflect_y;
-	}
+	if (timeout != ~0u)
+		deadline = drm_display_time() + timeout;
 
-	if (vsync) {
-		struct timeval timeout;
-		fd_set fds;
+	while (*pending) {
+		if (timeout != ~0u) {
+			/* past the deadline select() merely polls */
+			now = drm_display_time();
+			left = deadline > now ? deadline - now : 0;
 
-		err = drmModePageFlip(drm->drm->fd, drm->crtc, fb->handle,
-				      DRM_MODE_PAGE_FLIP_EVENT, drm);
-		if (err < 0) {
-			err = drmModeSetCrtc(drm->drm->fd, drm->crtc,
-					     fb->handle, 0, 0, &drm->connector,
-					     1, &drm->mode);
+			tv.tv_sec = left / 1000;
+			tv.tv_usec = left % 1000 * 1000;
+			tvp = &tv;
 		}
 
+		FD_ZERO(&fds);
+		FD_SET((unsigned)drm->drm->fd, &fds);
+
+		err = select(drm->drm->fd + 1, &fds, NULL, NULL, tvp);
 		if (err < 0) {
-			host1x_error("drmModePageFlip() failed: %m\n");
+			if (errno == EINTR)
+				continue;
+
 			return -errno;
 		}
 
-		memset(&timeout, 0, sizeof(timeout));
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
+		if (err == 0)
+			return -ETIMEDOUT;
 
-		FD_ZERO(&fds);
-		FD_SET((unsigned)drm->drm->fd, &fds);
+		drm_display_read_events(drm);
+	}
 
-		err = select(drm->drm->fd + 1, &fds, NULL, NULL, &timeout);
-		if (err <= 0) {
-		}
+	return 0;
+}
 
-		if (FD_ISSET((unsigned)drm->drm->fd, &fds)) {
-			drmEventContext context;
+static int drm_display_wait_flip(struct host1x_display *display,
+				 uint32_t timeout)
+{
+	struct drm_display *drm = to_drm_display(display);
 
-			memset(&context, 0, sizeof(context));
-			context.version = DRM_EVENT_CONTEXT_VERSION;
-			context.page_flip_handler = drm_display_on_page_flip;
-			context.vblank_handler = drm_display_on_vblank;
+	return drm_display_wait_pending(drm, &drm->flip_pending, timeout);
+}
 
-			drmHandleEvent(drm->drm->fd, &context);
-		}
-	} else {
-		err = drmModeSetCrtc(drm->drm->fd, drm->crtc, fb->handle, 0,
-				     0, &drm->connector, 1, &drm->mode);
+static int drm_display_get_event_fd(struct host1x_display *display)
+{
+	struct drm_display *drm = to_drm_display(display);
+
+	return drm->drm->fd;
+}
+
+static int drm_display_request_vblank(struct host1x_display *display)
+{
+	struct drm_display *drm = to_drm_display(display);
+	drmVBlank vblank = {
+		.request = {
+			.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT,
+			.sequence = 1,
+			.signal = (unsigned long)drm,
+		},
+	};
+
+	vblank.request.type |= drm->pipe << DRM_VBLANK_HIGH_CRTC_SHIFT;
+
+	if (drmWaitVBlank(drm->drm->fd, &vblank) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int drm_display_handle_events(struct host1x_display *display,
+				     const struct host1x_display_events *ev)
+{
+	struct drm_display *drm = to_drm_display(display);
+	struct pollfd pfd = {
+		.fd = drm->drm->fd,
+		.events = POLLIN,
+	};
+	int count = 0;
+
+	if (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+		drm_display_read_events(drm);
+
+	if (drm->flip_done) {
+		drm->flip_done = false;
+		count++;
+
+		if (ev->flip)
+			ev->flip(ev->data, drm->flip_time);
+	}
+
+	if (drm->vblank_done) {
+		drm->vblank_done = false;
+		count++;
+
+		if (ev->vblank)
+			ev->vblank(ev->data, drm->vblank_time);
+	}
+
+	return count;
+}
+
+static int drm_display_get_vblank(struct host1x_display *display,
+				  uint64_t *time, uint64_t *period)
+{
+	struct drm_display *drm = to_drm_display(display);
+	drmModeModeInfo *mode = &drm->mode;
+	drmVBlank vblank = {
+		.request = {
+			.type = DRM_VBLANK_RELATIVE,
+			.sequence = 0,
+		},
+	};
+	int err;
+
+	if (!mode->clock || !mode->htotal || !mode->vtotal)
+		return -EINVAL;
+
+	vblank.request.type |= drm->pipe << DRM_VBLANK_HIGH_CRTC_SHIFT;
+
+	/* a relative wait for zero vblanks returns the last one at once */
+	err = drmWaitVBlank(drm->drm->fd, &vblank);
+	if (err < 0)
+		return -errno;
+
+	*time = vblank.reply.tval_sec * 1000000ull + vblank.reply.tval_usec;
+	*period = (uint64_t)mode->htotal * mode->vtotal * 1000 / mode->clock;
+
+	return 0;
+}
+
+static int drm_display_flip(struct host1x_display *display,
+			    struct host1x_framebuffer *fb, bool reflect_y)
+{
+	struct drm_display *drm = to_drm_display(display);
+	int err;
+
+	/* only one flip may be queued at a time */
+	err = drm_display_wait_flip(display, 1000);
+	if (err < 0 && err != -ETIMEDOUT)
+		return err;
+
+	/* the CRTC takes one commit at a time, including those of overlays */
+	err = drm_display_wait_pending(drm, &drm->commit_pending, 1000);
+	if (err < 0 && err != -ETIMEDOUT)
+		return err;
+
+	if (drm->reflected != reflect_y) {
+		drm_overlay_reflect(drm, drm->plane, reflect_y);
+		drm->reflected = reflect_y;
+	}
+
+	err = drmModePageFlip(drm->drm->fd, drm->crtc, fb->handle,
+			      DRM_MODE_PAGE_FLIP_EVENT, &drm->flip_event);
+	if (err == 0) {
+		drm->flip_pending = true;
+		return 0;
+	}
+
+	err = drmModeSetCrtc(drm->drm->fd, drm->crtc, fb->handle, 0, 0,
+			     &drm->connector, 1, &drm->mode);
+	if (err < 0) {
+		host1x_error("drmModePageFlip() failed: %m\n");
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int drm_display_set(struct host1x_display *display,
+			   struct host1x_framebuffer *fb,
+			   bool vsync, bool reflect_y)
+{
+	struct drm_display *drm = to_drm_display(display);
+	int err;
+
+	if (vsync) {
+		err = drm_display_flip(display, fb, reflect_y);
 		if (err < 0)
-			return -errno;
+			return err;
+
+		/* a missed flip event isn't fatal */
+		drm_display_wait_flip(display, 1000);
+
+		return 0;
+	}
+
+	if (drm->reflected != reflect_y) {
+		drm_overlay_reflect(drm, drm->plane, reflect_y);
+		drm->reflected = reflect_y;
 	}
 
+	err = drmModeSetCrtc(drm->drm->fd, drm->crtc, fb->handle, 0,
+			     0, &drm->connector, 1, &drm->mode);
+	if (err < 0)
+		return -errno;
+
 	return 0;
 }
 
@@ -545,6 +1012,7 @@ static int drm_display_create(struct drm_display **displayp, struct drm *drm)
 		return -ENOMEM;
 
 	display->drm = drm;
+	display->flip_event.display = display;
 
 	err = drmSetMaster(drm->fd);
 	if (err < 0)
@@ -567,6 +1035,12 @@ static int drm_display_create(struct drm_display **displayp, struct drm *drm)
 	display->base.height = display->mode.vdisplay;
 	display->base.create_overlay = drm_overlay_create;
 	display->base.set = drm_display_set;
+	display->base.flip = drm_display_flip;
+	display->base.wait_flip = drm_display_wait_flip;
+	display->base.get_vblank = drm_display_get_vblank;
+	display->base.get_event_fd = drm_display_get_event_fd;
+	display->base.request_vblank = drm_display_request_vblank;
+	display->base.handle_events = drm_display_handle_events;
 
 	*displayp = display;
 
@@ -693,6 +1167,18 @@ static int drm_bo_export(struct host1x_bo *bo, uint32_t *handle)
 	return 0;
 }
 
+static int drm_bo_export_dmabuf(struct host1x_bo *bo, int *fd)
+{
+	struct drm_bo *dbo = to_drm_bo(bo);
+	int err;
+
+	err = drmPrimeHandleToFD(dbo->drm->fd, bo->handle, DRM_CLOEXEC, fd);
+	if (err < 0)
+		return -errno;
+
+	return 0;
+}
+
 static struct host1x_bo *drm_bo_create(struct host1x *host1x,
 				       struct host1x_bo_priv *priv,
 				       size_t size, unsigned long flags)
@@ -732,6 +1218,7 @@ static struct host1x_bo *drm_bo_create(struct host1x *host1x,
 	bo->base.priv->free = drm_bo_free;
 	bo->base.priv->clone = drm_bo_clone;
 	bo->base.priv->export = drm_bo_export;
+	bo->base.priv->export_dmabuf = drm_bo_export_dmabuf;
 
 	return &bo->base;
 }
@@ -769,6 +1256,48 @@ static struct host1x_bo *drm_bo_import(struct host1x *host1x,
 	bo->base.priv->free = drm_bo_free;
 	bo->base.priv->clone = drm_bo_clone;
 	bo->base.priv->export = drm_bo_export;
+	bo->base.priv->export_dmabuf = drm_bo_export_dmabuf;
+
+	return &bo->base;
+}
+
+static struct host1x_bo *drm_bo_import_dmabuf(struct host1x *host1x,
+					      struct host1x_bo_priv *priv,
+					      int fd)
+{
+	struct drm *drm = to_drm(host1x);
+	struct drm_bo *bo;
+	uint32_t handle;
+	off_t size;
+	int err;
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size < 0)
+		return NULL;
+
+	bo = calloc(1, sizeof(*bo));
+	if (!bo)
+		return NULL;
+
+	bo->drm = drm;
+	bo->base.priv = priv;
+
+	err = drmPrimeFDToHandle(drm->fd, fd, &handle);
+	if (err < 0) {
+		free(bo);
+		return NULL;
+	}
+
+	bo->base.handle = handle;
+	bo->base.size = size;
+
+	bo->base.priv->mmap = drm_bo_mmap;
+	bo->base.priv->invalidate = drm_bo_invalidate;
+	bo->base.priv->flush = drm_bo_flush;
+	bo->base.priv->free = drm_bo_free;
+	bo->base.priv->clone = drm_bo_clone;
+	bo->base.priv->export = drm_bo_export;
+	bo->base.priv->export_dmabuf = drm_bo_export_dmabuf;
 
 	return &bo->base;
 }
@@ -785,18 +1314,8 @@ static int drm_framebuffer_init(struct host1x *host1x,
 	int err = -1;
 
 	/* XXX: support other formats */
-	switch (pixbuf->format)
-	{
-	case PIX_BUF_FMT_RGB565:
-		format = DRM_FORMAT_RGB565;
-		break;
-	case PIX_BUF_FMT_RGBA8888:
-		format = DRM_FORMAT_XBGR8888;
-		break;
-	case PIX_BUF_FMT_BGRA8888:
-		format = DRM_FORMAT_XRGB8888;
-		break;
-	default:
+	format = drm_pixel_format(pixbuf->format);
+	if (!format) {
 		host1x_error("Unsupported framebuffer format\n");
 		return -EINVAL;
 	}
@@ -849,50 +1368,72 @@ static int drm_channel_open(struct drm *drm, uint32_t class, uint64_t *channel)
 	return 0;
 }
 
+static int drm_channel_reserve(void **array, unsigned int *max,
+			       unsigned int count, size_t size)
+{
+	unsigned int num = *max;
+	void *ptr;
+
+	if (count <= num)
+		return 0;
+
+	while (num < count)
+		num = num ? num * 2 : 16;
+
+	ptr = realloc(*array, num * size);
+	if (!ptr)
+		return -ENOMEM;
+
+	*array = ptr;
+	*max = num;
+
+	return 0;
+}
+
 static int drm_channel_submit(struct host1x_client *client,
 			      struct host1x_job *job)
 {
 	struct drm_channel *channel = to_drm_channel(client);
-	struct drm_tegra_reloc *relocs, *reloc;
 	unsigned int i, j, num_relocs = 0;
-	struct drm_tegra_cmdbuf *cmdbufs;
 	struct drm_tegra_syncpt syncpt;
 	struct drm_tegra_submit args;
+	struct drm_tegra_reloc *reloc;
 	int err;
 
 	memset(&syncpt, 0, sizeof(syncpt));
 	syncpt.id = job->syncpt;
 	syncpt.incrs = job->syncpt_incrs;
 
-	cmdbufs = calloc(job->num_pushbufs, sizeof(*cmdbufs));
-	if (!cmdbufs)
-		return -ENOMEM;
+	for (i = 0; i < job->num_pushbufs; i++)
+		num_relocs += job->pushbufs[i].num_relocs;
+
+	err = drm_channel_reserve((void **)&channel->cmdbufs,
+				  &channel->max_cmdbufs, job->num_pushbufs,
+				  sizeof(*channel->cmdbufs));
+	if (err < 0)
+		return err;
+
+	err = drm_channel_reserve((void **)&channel->relocs,
+				  &channel->max_relocs, num_relocs,
+				  sizeof(*channel->relocs));
+	if (err < 0)
+		return err;
+
+	reloc = channel->relocs;
 
 	for (i = 0; i < job->num_pushbufs; i++) {
 		struct host1x_pushbuf *pushbuf = &job->pushbufs[i];
-		struct drm_tegra_cmdbuf *cmdbuf = &cmdbufs[i];
+		struct drm_tegra_cmdbuf *cmdbuf = &channel->cmdbufs[i];
 
+		memset(cmdbuf, 0, sizeof(*cmdbuf));
 		cmdbuf->handle = pushbuf->bo->handle;
 		cmdbuf->offset = pushbuf->offset;
 		cmdbuf->words = pushbuf->length;
 
-		num_relocs += pushbuf->num_relocs;
-	}
-
-	relocs = calloc(num_relocs, sizeof(*relocs));
-	if (!relocs) {
-		free(cmdbufs);
-		return -ENOMEM;
-	}
-
-	reloc = relocs;
-
-	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pushbuf = &job->pushbufs[i];
-
 		for (j = 0; j < pushbuf->num_relocs; j++) {
 			struct host1x_pushbuf_reloc *r = &pushbuf->relocs[j];
 
+			memset(reloc, 0, sizeof(*reloc));
 			reloc->cmdbuf.handle = pushbuf->bo->handle;
 			reloc->cmdbuf.offset = r->source_offset;
 			reloc->target.handle = r->target_handle;
@@ -910,11 +1451,11 @@ static int drm_channel_submit(struct host1x_client *client,
 	args.num_relocs = num_relocs;
 	args.num_waitchks = 0;
 	args.waitchk_mask = 0;
-	args.timeout = 1000;
+	args.timeout = job->timeout ?: client->timeout ?: HOST1X_JOB_TIMEOUT_MS;
 
 	args.syncpts = (unsigned long)&syncpt;
-	args.cmdbufs = (unsigned long)cmdbufs;
-	args.relocs = (unsigned long)relocs;
+	args.cmdbufs = (unsigned long)channel->cmdbufs;
+	args.relocs = (unsigned long)channel->relocs;
 	args.waitchks = 0;
 
 	err = ioctl(channel->drm->fd, DRM_IOCTL_TEGRA_SUBMIT, &args);
@@ -927,9 +1468,6 @@ static int drm_channel_submit(struct host1x_client *client,
 		err = 0;
 	}
 
-	free(relocs);
-	free(cmdbufs);
-
 	return err;
 }
 
@@ -959,6 +1497,10 @@ static int drm_channel_wait(struct host1x_client *client, uint32_t fence,
 
 	err = ioctl(channel->drm->fd, DRM_IOCTL_TEGRA_SYNCPT_WAIT, &args);
 	if (err < 0) {
+		/* timeouts are expected while polling, don't spam the log */
+		if (errno == EAGAIN)
+			return -EAGAIN;
+
 		host1x_error("ioctl(DRM_IOCTL_TEGRA_SYNCPT_WAIT) failed: %d\n",
 			     errno);
 		return -errno;
@@ -967,6 +1509,27 @@ static int drm_channel_wait(struct host1x_client *client, uint32_t fence,
 	return 0;
 }
 
+static int drm_channel_read(struct host1x_client *client, uint32_t *value)
+{
+	struct drm_channel *channel = to_drm_channel(client);
+	struct drm_tegra_syncpt_read args;
+	int err;
+
+	memset(&args, 0, sizeof(args));
+	args.id = channel->client.syncpts[0].id;
+
+	err = ioctl(channel->drm->fd, DRM_IOCTL_TEGRA_SYNCPT_READ, &args);
+	if (err < 0) {
+		host1x_error("ioctl(DRM_IOCTL_TEGRA_SYNCPT_READ) failed: %d\n",
+			     errno);
+		return -errno;
+	}
+
+	*value = args.value;
+
+	return 0;
+}
+
 static int drm_channel_init(struct drm *drm, struct drm_channel *channel,
 			    uint32_t class, unsigned int num_syncpts)
 {
@@ -1004,9 +1567,11 @@ static int drm_channel_init(struct drm *drm, struct drm_channel *channel,
 		syncpts[i].value = 0;
 	}
 
+	pthread_mutex_init(&channel->client.submit_lock, NULL);
 	channel->client.submit = drm_channel_submit;
 	channel->client.flush = drm_channel_flush;
 	channel->client.wait = drm_channel_wait;
+	channel->client.read = drm_channel_read;
 
 	return 0;
 }
@@ -1024,7 +1589,10 @@ static void drm_channel_exit(struct drm_channel *channel)
 		host1x_error("ioctl(DRM_IOCTL_TEGRA_CLOSE_CHANNEL) failed: %d\n",
 			     -errno);
 
+	pthread_mutex_destroy(&channel->client.submit_lock);
 	free(channel->client.syncpts);
+	free(channel->relocs);
+	free(channel->cmdbufs);
 }
 
 static int drm_gr2d_create(struct drm_gr2d **gr2dp, struct drm *drm)
@@ -1058,8 +1626,8 @@ static int drm_gr2d_create(struct drm_gr2d **gr2dp, struct drm *drm)
 static void drm_gr2d_close(struct drm_gr2d *gr2d)
 {
 	if (gr2d) {
-		drm_channel_exit(&gr2d->channel);
 		host1x_gr2d_exit(&gr2d->base);
+		drm_channel_exit(&gr2d->channel);
 	}
 
 	free(gr2d);
@@ -1096,8 +1664,8 @@ static int drm_gr3d_create(struct drm_gr3d **gr3dp, struct drm *drm)
 static void drm_gr3d_close(struct drm_gr3d *gr3d)
 {
 	if (gr3d) {
-		drm_channel_exit(&gr3d->channel);
 		host1x_gr3d_exit(&gr3d->base);
+		drm_channel_exit(&gr3d->channel);
 	}
 
 	free(gr3d);
@@ -1167,6 +1735,7 @@ struct host1x *host1x_drm_open(struct host1x_options *options)
 	drm->base.framebuffer_init = drm_framebuffer_init;
 	drm->base.close = drm_close;
 	drm->base.bo_import = drm_bo_import;
+	drm->base.bo_import_dmabuf = drm_bo_import_dmabuf;
 	drm->base.options = options;
 
 	err = drm_gr2d_create(&drm->gr2d, drm);
@@ -21,12 +21,58 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <pthread.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <sys/mman.h>
+
+#include "cdma.h"
 #include "host1x-private.h"
+#include "tgr_3d.xml.h"
+
+/*
+ * BOs are carved page aligned out of large anonymous mappings, which keeps
+ * the memory layout and the cost of allocations close to the one of a real
+ * driver. Free extents of an arena are kept sorted by offset and merged, an
+ * arena is unmapped once the last BO in it is freed.
+ */
+#define DUMMY_ARENA_SIZE	(64 << 20)
+
+struct dummy_arena {
+	struct list_head node;
+	uint8_t *base;
+	size_t size;
+	size_t used;
+	struct list_head free;
+};
+
+struct dummy_extent {
+	struct list_head node;
+	size_t offset;
+	size_t size;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct list_head arenas;
+	size_t page_size;
+
+	unsigned int num_arenas;
+	uint64_t mapped;
+	uint64_t used;
+	uint64_t peak_used;
+	uint64_t peak_resident;
+} dummy_mem = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.arenas = LIST_HEAD_INIT(dummy_mem.arenas),
+};
 
 struct dummy_data {
-	void *ptr;
+	struct dummy_arena *arena;
+	size_t offset;
+	size_t size;
 	int refcnt;
 };
 
@@ -35,11 +81,223 @@ struct dummy_bo {
 	struct dummy_data *data;
 };
 
+static struct dummy_arena *dummy_arena_create(size_t size)
+{
+	struct dummy_extent *extent;
+	struct dummy_arena *arena;
+
+	arena = calloc(1, sizeof(*arena));
+	extent = calloc(1, sizeof(*extent));
+	if (!arena || !extent)
+		goto err_free;
+
+	arena->size = MAX(size, DUMMY_ARENA_SIZE);
+	arena->base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (arena->base == MAP_FAILED)
+		goto err_free;
+
+	extent->size = arena->size;
+	INIT_LIST_HEAD(&arena->free);
+	list_add(&extent->node, &arena->free);
+	list_add_tail(&arena->node, &dummy_mem.arenas);
+
+	dummy_mem.num_arenas++;
+	dummy_mem.mapped += arena->size;
+
+	return arena;
+
+err_free:
+	free(extent);
+	free(arena);
+
+	return NULL;
+}
+
+static void dummy_arena_destroy(struct dummy_arena *arena)
+{
+	struct dummy_extent *extent, *tmp;
+
+	list_for_each_entry_safe(extent, tmp, &arena->free, node) {
+		list_del(&extent->node);
+		free(extent);
+	}
+
+	list_del(&arena->node);
+	munmap(arena->base, arena->size);
+
+	dummy_mem.num_arenas--;
+	dummy_mem.mapped -= arena->size;
+
+	free(arena);
+}
+
+static bool dummy_arena_alloc(struct dummy_arena *arena, size_t size,
+			      size_t *offset)
+{
+	struct dummy_extent *extent;
+
+	list_for_each_entry(extent, &arena->free, node) {
+		if (extent->size < size)
+			continue;
+
+		*offset = extent->offset;
+		extent->offset += size;
+		extent->size -= size;
+
+		if (!extent->size) {
+			list_del(&extent->node);
+			free(extent);
+		}
+
+		arena->used += size;
+
+		return true;
+	}
+
+	return false;
+}
+
+static void dummy_arena_free(struct dummy_arena *arena, size_t offset,
+			     size_t size)
+{
+	struct dummy_extent *extent, *prev = NULL, *next = NULL;
+
+	arena->used -= size;
+
+	if (!arena->used) {
+		dummy_arena_destroy(arena);
+		return;
+	}
+
+	list_for_each_entry(extent, &arena->free, node) {
+		if (extent->offset > offset) {
+			next = extent;
+			break;
+		}
+
+		prev = extent;
+	}
+
+	if (prev && prev->offset + prev->size == offset) {
+		prev->size += size;
+
+		if (next && offset + size == next->offset) {
+			prev->size += next->size;
+			list_del(&next->node);
+			free(next);
+		}
+		return;
+	}
+
+	if (next && offset + size == next->offset) {
+		next->offset = offset;
+		next->size += size;
+		return;
+	}
+
+	extent = calloc(1, sizeof(*extent));
+	if (!extent) {
+		/* the range is lost until the arena is destroyed */
+		return;
+	}
+
+	extent->offset = offset;
+	extent->size = size;
+
+	if (next)
+		list_add_tail(&extent->node, &next->node);
+	else
+		list_add_tail(&extent->node, &arena->free);
+}
+
+static struct dummy_data *dummy_mem_alloc(size_t size)
+{
+	struct dummy_arena *arena;
+	struct dummy_data *data;
+
+	data = calloc(1, sizeof(*data));
+	if (!data)
+		return NULL;
+
+	pthread_mutex_lock(&dummy_mem.lock);
+
+	if (!dummy_mem.page_size)
+		dummy_mem.page_size = sysconf(_SC_PAGESIZE);
+
+	size = ALIGN(MAX(size, 1), dummy_mem.page_size);
+
+	list_for_each_entry(arena, &dummy_mem.arenas, node)
+		if (dummy_arena_alloc(arena, size, &data->offset))
+			goto found;
+
+	arena = dummy_arena_create(size);
+	if (!arena || !dummy_arena_alloc(arena, size, &data->offset)) {
+		pthread_mutex_unlock(&dummy_mem.lock);
+		free(data);
+		return NULL;
+	}
+
+found:
+	data->arena = arena;
+	data->size = size;
+
+	dummy_mem.used += size;
+	dummy_mem.peak_used = MAX(dummy_mem.peak_used, dummy_mem.used);
+
+	pthread_mutex_unlock(&dummy_mem.lock);
+
+	return data;
+}
+
+static void dummy_mem_free(struct dummy_data *data)
+{
+	pthread_mutex_lock(&dummy_mem.lock);
+	dummy_arena_free(data->arena, data->offset, data->size);
+	dummy_mem.used -= data->size;
+	pthread_mutex_unlock(&dummy_mem.lock);
+
+	free(data);
+}
+
+/* bytes of the arenas backed by memory, the BOs are touched by the CPU only */
+static uint64_t dummy_mem_resident(void)
+{
+	struct dummy_arena *arena;
+	uint64_t resident = 0;
+	unsigned char *vec;
+	size_t i, pages;
+
+	pthread_mutex_lock(&dummy_mem.lock);
+
+	list_for_each_entry(arena, &dummy_mem.arenas, node) {
+		pages = arena->size / dummy_mem.page_size;
+
+		vec = malloc(pages);
+		if (!vec)
+			break;
+
+		if (mincore(arena->base, arena->size, vec) == 0) {
+			for (i = 0; i < pages; i++)
+				if (vec[i] & 1)
+					resident += dummy_mem.page_size;
+		}
+
+		free(vec);
+	}
+
+	dummy_mem.peak_resident = MAX(dummy_mem.peak_resident, resident);
+
+	pthread_mutex_unlock(&dummy_mem.lock);
+
+	return resident;
+}
+
 static int host1x_dummy_bo_mmap(struct host1x_bo *bo)
 {
 	struct dummy_bo *dbo = container_of(bo, struct dummy_bo, bo);
 
-	bo->ptr = dbo->data->ptr;
+	bo->ptr = dbo->data->arena->base + dbo->data->offset;
 
 	return 0;
 }
@@ -48,10 +306,9 @@ static void host1x_dummy_bo_free(struct host1x_bo *bo)
 {
 	struct dummy_bo *dbo = container_of(bo, struct dummy_bo, bo);
 
-	if (dbo->data->refcnt-- == 0) {
-		free(dbo->data->ptr);
-		free(dbo->data);
-	}
+	if (dbo->data->refcnt-- == 0)
+		dummy_mem_free(dbo->data);
+
 	free(dbo);
 }
 
@@ -82,19 +339,12 @@ static struct host1x_bo *host1x_dummy_bo_create(struct host1x *host1x,
 	if (!dbo)
 		return NULL;
 
-	dbo->data = calloc(1, sizeof(*dbo->data));
+	dbo->data = dummy_mem_alloc(size);
 	if (!dbo->data) {
 		free(dbo);
 		return NULL;
 	}
 
-	dbo->data->ptr = malloc(size);
-	if (!dbo->data->ptr) {
-		free(dbo->data);
-		free(dbo);
-		return NULL;
-	}
-
 	bo = &dbo->bo;
 
 	bo->priv = priv;
@@ -105,14 +355,294 @@ static struct host1x_bo *host1x_dummy_bo_create(struct host1x *host1x,
 	return bo;
 }
 
+/*
+ * A rough model of the cost of jobs, which allows to compare the work done
+ * by rendering code without the hardware. Register writes are decoded as
+ * the engines would see them, with the state carried over jobs. Gathers
+ * aren't followed. The costs are guesses for a Tegra20 running at
+ * DUMMY_MODEL_MHZ, the vertex engine runs one instruction per clock, the
+ * fragment engine four pixels per clock in parallel to it.
+ */
+#define DUMMY_MODEL_MHZ			300
+#define DUMMY_MODEL_JOB_CYCLES		200
+#define DUMMY_MODEL_DRAW_CYCLES		100
+#define DUMMY_MODEL_SETUP_CYCLES	2
+#define DUMMY_MODEL_FP_PIPES		4
+#define DUMMY_MODEL_GR2D_BYTES		8
+
+/* registers of GR2D */
+#define GR2D_TRIGGER			0x09
+#define GR2D_CONTROLMAIN		0x1f
+#define GR2D_DSTSIZE			0x38
+
+struct dummy_client {
+	struct host1x_client base;
+	struct host1x_syncpt syncpt;
+	bool model;
+
+	uint32_t classid;
+	uint32_t regs[4096];
+
+	/* words of the programs, counted since the upload was reset */
+	unsigned int vp_words;
+	unsigned int alu_words;
+	unsigned int tex_words;
+};
+
+static float dummy_model_float(uint32_t value)
+{
+	union {
+		uint32_t u;
+		float f;
+	} v = { .u = value };
+
+	return v.f < 0.0f ? -v.f : v.f;
+}
+
+static uint64_t dummy_model_pixels(struct dummy_client *dc)
+{
+	float x_scale = dummy_model_float(dc->regs[TGR3D_VIEWPORT_X_SCALE]);
+	float y_scale = dummy_model_float(dc->regs[TGR3D_VIEWPORT_Y_SCALE]);
+	float x_bias = dummy_model_float(dc->regs[TGR3D_VIEWPORT_X_BIAS]);
+	float y_bias = dummy_model_float(dc->regs[TGR3D_VIEWPORT_Y_BIAS]);
+	uint32_t horiz = dc->regs[TGR3D_SCISSOR_HORIZ];
+	uint32_t vert = dc->regs[TGR3D_SCISSOR_VERT];
+	int x0, x1, y0, y1;
+
+	/* the viewport is in 1/16 of a pixel, the bias is at its center */
+	x0 = (x_bias - x_scale) / 16.0f;
+	x1 = (x_bias + x_scale) / 16.0f;
+	y0 = (y_bias - y_scale) / 16.0f;
+	y1 = (y_bias + y_scale) / 16.0f;
+
+	if (horiz) {
+		x0 = MAX(x0, (int)(horiz >> 16));
+		x1 = MIN(x1, (int)(horiz & 0xffff));
+	}
+
+	if (vert) {
+		y0 = MAX(y0, (int)(vert >> 16));
+		y1 = MIN(y1, (int)(vert & 0xffff));
+	}
+
+	if (x1 <= x0 || y1 <= y0)
+		return 0;
+
+	return (uint64_t)(x1 - x0) * (y1 - y0);
+}
+
+static void dummy_model_draw(struct dummy_client *dc, uint32_t value)
+{
+	struct host1x_client_stats *stats = &dc->base.stats;
+	uint32_t type = dc->regs[TGR3D_DRAW_PARAMS];
+	uint64_t vertex, setup, fragment;
+	unsigned int vp, fp, tex;
+	uint64_t count, prims, pixels;
+
+	count = (value & TGR3D_DRAW_PRIMITIVES_INDEX_COUNT__MASK) >>
+		TGR3D_DRAW_PRIMITIVES_INDEX_COUNT__SHIFT;
+	count += 1;
+	type = (type & TGR3D_DRAW_PARAMS_PRIMITIVE_TYPE__MASK) >>
+		TGR3D_DRAW_PARAMS_PRIMITIVE_TYPE__SHIFT;
+
+	switch (type) {
+	case TGR3D_PRIMITIVE_TYPE_POINTS:
+	case TGR3D_PRIMITIVE_TYPE_LINE_LOOP:
+		prims = count;
+		break;
+	case TGR3D_PRIMITIVE_TYPE_LINES:
+		prims = count / 2;
+		break;
+	case TGR3D_PRIMITIVE_TYPE_LINE_STRIP:
+		prims = count - 1;
+		break;
+	case TGR3D_PRIMITIVE_TYPE_TRIANGLES:
+		prims = count / 3;
+		break;
+	default:
+		prims = count > 2 ? count - 2 : 0;
+		break;
+	}
+
+	vp = MAX(dc->vp_words / 4, 1);
+	fp = MAX(dc->alu_words / 8, 1);
+	tex = dc->tex_words;
+	pixels = prims ? dummy_model_pixels(dc) : 0;
+
+	vertex = count * vp;
+	setup = prims * DUMMY_MODEL_SETUP_CYCLES;
+	fragment = pixels * (fp + tex) / DUMMY_MODEL_FP_PIPES;
+
+	stats->model.ops++;
+	stats->model.vertices += count;
+	stats->model.primitives += prims;
+	stats->model.vp_instructions += vertex;
+	stats->model.fp_instructions += pixels * fp;
+	stats->model.tex_fetches += pixels * tex;
+	stats->model.pixels += pixels;
+	stats->model.cycles += MAX(MAX(vertex, setup), fragment) +
+			       DUMMY_MODEL_DRAW_CYCLES;
+}
+
+static void dummy_model_gr2d_op(struct dummy_client *dc)
+{
+	struct host1x_client_stats *stats = &dc->base.stats;
+	uint32_t control = dc->regs[GR2D_CONTROLMAIN];
+	uint32_t size = dc->regs[GR2D_DSTSIZE];
+	uint64_t pixels, bytes;
+
+	pixels = (uint64_t)(size & 0xffff) * (size >> 16);
+	bytes = pixels << ((control >> 16) & 0x3);
+
+	/* anything but a solid fill reads the source too */
+	if (!(control & (1 << 6)))
+		bytes *= 2;
+
+	stats->model.ops++;
+	stats->model.pixels += pixels;
+	stats->model.cycles += bytes / DUMMY_MODEL_GR2D_BYTES;
+}
+
+static void dummy_model_write_gr3d(struct dummy_client *dc, uint32_t offset,
+				   uint32_t value)
+{
+	switch (offset) {
+	case TGR3D_DRAW_PRIMITIVES:
+		dummy_model_draw(dc, value);
+		return;
+
+	case TGR3D_VP_UPLOAD_INST_ID:
+		dc->vp_words = 0;
+		return;
+
+	case TGR3D_VP_UPLOAD_INST:
+		dc->vp_words++;
+		return;
+
+	case TGR3D_FP_UPLOAD_INST_ID_COMMON:
+		dc->alu_words = 0;
+		dc->tex_words = 0;
+		return;
+
+	case TGR3D_FP_UPLOAD_ALU_INST_ID:
+		dc->alu_words = 0;
+		return;
+
+	case TGR3D_FP_UPLOAD_ALU_INST:
+		dc->alu_words++;
+		return;
+
+	case TGR3D_FP_UPLOAD_TEX_INST_ID:
+		dc->tex_words = 0;
+		return;
+
+	case TGR3D_FP_UPLOAD_TEX_INST:
+		dc->tex_words++;
+		return;
+	}
+
+	dc->regs[offset] = value;
+}
+
+static void dummy_model_write(void *user, uint32_t classid, uint32_t offset,
+			      uint32_t value)
+{
+	struct dummy_client *dc = user;
+
+	offset &= 0xfff;
+
+	switch (classid) {
+	case HOST1X_CLASS_GR3D:
+		dummy_model_write_gr3d(dc, offset, value);
+		break;
+
+	case HOST1X_CLASS_GR2D:
+	case HOST1X_CLASS_GR2D_SB:
+		dc->regs[offset] = value;
+
+		if (dc->regs[GR2D_TRIGGER] && offset != GR2D_TRIGGER &&
+		    offset == (dc->regs[GR2D_TRIGGER] & 0xfff))
+			dummy_model_gr2d_op(dc);
+		break;
+	}
+}
+
+static const struct cdma_visitor dummy_model_visitor = {
+	.write = dummy_model_write,
+};
+
+static void dummy_model_job(struct dummy_client *dc, struct host1x_job *job)
+{
+	struct host1x_client_stats *stats = &dc->base.stats;
+	struct host1x_pushbuf *pb;
+	struct cdma_decoder dec;
+	unsigned int i;
+
+	stats->model.cycles += DUMMY_MODEL_JOB_CYCLES;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		pb = &job->pushbufs[i];
+
+		/* fetching a word takes about a clock */
+		stats->model.cycles += pb->length;
+
+		cdma_decoder_init(&dec, &dummy_model_visitor, dc, dc->classid);
+		cdma_decode(&dec, (uint32_t *)((uint8_t *)pb->bo->ptr +
+					       pb->offset), pb->length);
+		dc->classid = dec.classid;
+	}
+
+	stats->model.time_ns = stats->model.cycles * 1000 / DUMMY_MODEL_MHZ;
+}
+
+static void host1x_dummy_model_print(const char *name,
+				     struct host1x_client *client)
+{
+	const struct host1x_client_stats *stats = &client->stats;
+
+	printf("model %s: %llu ops, %llu vertices, %llu primitives, "
+	       "%llu pixels, %llu vp and %llu fp instructions, "
+	       "%llu tex fetches, %.3f ms\n", name,
+	       (unsigned long long)stats->model.ops,
+	       (unsigned long long)stats->model.vertices,
+	       (unsigned long long)stats->model.primitives,
+	       (unsigned long long)stats->model.pixels,
+	       (unsigned long long)stats->model.vp_instructions,
+	       (unsigned long long)stats->model.fp_instructions,
+	       (unsigned long long)stats->model.tex_fetches,
+	       stats->model.time_ns / 1e6);
+}
+
 static void host1x_dummy_close(struct host1x *host1x)
 {
+	if (host1x->options->model) {
+		host1x_dummy_model_print("gr2d", host1x->gr2d->client);
+		host1x_dummy_model_print("gr3d", host1x->gr3d->client);
+
+		printf("model memory: %u arenas, %.1f MiB mapped, "
+		       "%.1f MiB resident, peak %.1f MiB used and %.1f MiB "
+		       "resident\n", dummy_mem.num_arenas,
+		       dummy_mem.mapped / 1048576.0,
+		       dummy_mem_resident() / 1048576.0,
+		       dummy_mem.peak_used / 1048576.0,
+		       dummy_mem.peak_resident / 1048576.0);
+	}
+
 	free(host1x);
 }
 
 static int host1x_dummy_submit(struct host1x_client *client,
 			       struct host1x_job *job)
 {
+	struct dummy_client *dc = container_of(client, struct dummy_client,
+					       base);
+
+	/* the footprint peaks are sampled as the jobs are executed */
+	if (dc->model) {
+		dummy_model_job(dc, job);
+		dummy_mem_resident();
+	}
+
 	return 0;
 }
 
@@ -127,22 +657,28 @@ static int host1x_dummy_wait(struct host1x_client *client, uint32_t fence,
 	return 0;
 }
 
-static struct host1x_syncpt syncpt;
+#define DUMMY_CLIENT(name, class)					\
+	static struct dummy_client name = {				\
+		.base = {						\
+			.submit = host1x_dummy_submit,			\
+			.flush = host1x_dummy_flush,			\
+			.wait = host1x_dummy_wait,			\
+			.syncpts = &name.syncpt,			\
+			.num_syncpts = 1,				\
+			.submit_lock = PTHREAD_MUTEX_INITIALIZER,	\
+		},							\
+		.classid = class,					\
+	}
 
-static struct host1x_client dummy_client = {
-	.submit = host1x_dummy_submit,
-	.flush = host1x_dummy_flush,
-	.wait = host1x_dummy_wait,
-	.syncpts = &syncpt,
-	.num_syncpts = 1,
-};
+DUMMY_CLIENT(dummy_gr2d_client, HOST1X_CLASS_GR2D);
+DUMMY_CLIENT(dummy_gr3d_client, HOST1X_CLASS_GR3D);
 
 static struct host1x_gr2d dummy_gr2d = {
-	.client = &dummy_client,
+	.client = &dummy_gr2d_client.base,
 };
 
 static struct host1x_gr3d dummy_gr3d = {
-	.client = &dummy_client,
+	.client = &dummy_gr3d_client.base,
 };
 
 struct host1x *host1x_dummy_open(struct host1x_options *options)
@@ -161,6 +697,9 @@ struct host1x *host1x_dummy_open(struct host1x_options *options)
 	host1x->gr2d = &dummy_gr2d;
 	host1x->gr3d = &dummy_gr3d;
 
+	dummy_gr2d_client.model = options->model;
+	dummy_gr3d_client.model = options->model;
+
 	err = host1x_gr2d_init(host1x, host1x->gr2d);
 	if (err)
 		return NULL;
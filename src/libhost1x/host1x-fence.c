@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <time.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * Upper bound of a single blocking wait while waiting for any of multiple
+ * fences. The kernel can't wait for multiple syncpoints at once, hence the
+ * fences are slept on in turns.
+ */
+#define HOST1X_FENCE_WAIT_SLICE_MS	1
+
+static uint64_t host1x_fence_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+int host1x_client_read(struct host1x_client *client, uint32_t *value)
+{
+	if (!client->read)
+		return -ENOSYS;
+
+	return client->read(client, value);
+}
+
+/*
+ * Returns 1 if the fence is reached, 0 if it is pending or a negative error
+ * code. Never blocks.
+ */
+int host1x_client_poll(struct host1x_client *client, uint32_t fence)
+{
+	uint32_t value;
+	int err;
+
+	if (!client->read) {
+		err = client->wait(client, fence, 0);
+		if (err == -EAGAIN || err == -ETIMEDOUT)
+			return 0;
+
+		if (err < 0)
+			return err;
+
+		return 1;
+	}
+
+	err = client->read(client, &value);
+	if (err < 0)
+		return err;
+
+	/* syncpoint values wrap around */
+	return (int32_t)(value - fence) >= 0;
+}
+
+static uint32_t host1x_fence_remaining(uint32_t timeout, uint64_t start)
+{
+	uint64_t spent = host1x_fence_time() - start;
+
+	if (timeout == ~0u)
+		return ~0u;
+
+	if (spent >= timeout)
+		return 0;
+
+	return timeout - spent;
+}
+
+static int host1x_fences_wait_all(const struct host1x_fence *fences,
+				  unsigned int count, uint32_t timeout,
+				  uint64_t start)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < count; i++) {
+		err = host1x_client_wait(fences[i].client, fences[i].value,
+					 host1x_fence_remaining(timeout, start));
+		if (err < 0)
+			return err;
+	}
+
+	return 0;
+}
+
+static int host1x_fences_wait_any(const struct host1x_fence *fences,
+				  unsigned int count, uint32_t timeout,
+				  uint64_t start)
+{
+	unsigned int next = 0;
+	uint32_t remaining;
+	unsigned int i;
+	int err;
+
+	while (true) {
+		for (i = 0; i < count; i++) {
+			err = host1x_client_poll(fences[i].client,
+						 fences[i].value);
+			if (err)
+				return err < 0 ? err : (int)i;
+		}
+
+		remaining = host1x_fence_remaining(timeout, start);
+		if (!remaining)
+			return -ETIMEDOUT;
+
+		err = host1x_client_wait(fences[next].client,
+					 fences[next].value,
+					 MIN(remaining,
+					     HOST1X_FENCE_WAIT_SLICE_MS));
+		if (!err)
+			return next;
+
+		if (err != -EAGAIN && err != -ETIMEDOUT)
+			return err;
+
+		next = (next + 1) % count;
+	}
+}
+
+/*
+ * Waits for all or for any of the fences, which may belong to different
+ * clients. The timeout is in milliseconds, ~0u waits forever. Returns the
+ * index of a reached fence when waiting for any of them, 0 when waiting
+ * for all of them, or a negative error code. Time spent blocking is stored
+ * in "elapsed" if it isn't NULL.
+ */
+int host1x_fences_wait(const struct host1x_fence *fences, unsigned int count,
+		       bool all, uint32_t timeout, uint32_t *elapsed)
+{
+	uint64_t start = host1x_fence_time();
+	int err;
+
+	if (!count)
+		err = 0;
+	else if (all)
+		err = host1x_fences_wait_all(fences, count, timeout, start);
+	else
+		err = host1x_fences_wait_any(fences, count, timeout, start);
+
+	if (elapsed)
+		*elapsed = host1x_fence_time() - start;
+
+	return err;
+}
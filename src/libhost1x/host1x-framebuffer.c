@@ -29,30 +29,6 @@
 
 #include "host1x-private.h"
 
-#if 0
-static void detile(void *target, struct host1x_pixelbuffer *pb,
-		   unsigned int tx, unsigned int ty)
-{
-	const unsigned int nx = pb->pitch / tx, ny = pb->height / ty;
-	const unsigned int size = tx * ty, pitch = tx * nx;
-	const void *source = pb->bo->ptr;
-	unsigned int i, j, k;
-
-	for (j = 0; j < ny; j++) {
-		for (i = 0; i < nx; i++) {
-			unsigned int to = (j * nx * size) + (i * tx);
-			unsigned int so = (j * nx + i) * size;
-
-			for (k = 0; k < ty; k++) {
-				memcpy(target + to + k * pitch,
-				       source + so + k * tx,
-				       tx);
-			}
-		}
-	}
-}
-#endif
-
 struct host1x_framebuffer *host1x_framebuffer_create(struct host1x *host1x,
 						     unsigned int width,
 						     unsigned int height,
@@ -65,6 +41,10 @@ struct host1x_framebuffer *host1x_framebuffer_create(struct host1x *host1x,
 	int err;
 
 	switch (layout) {
+	case PIX_BUF_LAYOUT_AUTO:
+		/* scanned out and CPU mapped by some displays */
+		layout = PIX_BUF_LAYOUT_LINEAR;
+		break;
 	case PIX_BUF_LAYOUT_LINEAR:
 	case PIX_BUF_LAYOUT_TILED_16x16:
 		break;
@@ -75,6 +55,7 @@ struct host1x_framebuffer *host1x_framebuffer_create(struct host1x *host1x,
 
 	switch (format) {
 	case PIX_BUF_FMT_RGB565:
+	case PIX_BUF_FMT_RGBA5551:
 		pitch = width * 2;
 		break;
 	case PIX_BUF_FMT_RGBA8888:
@@ -113,29 +94,22 @@ struct host1x_framebuffer *host1x_framebuffer_create(struct host1x *host1x,
 
 void host1x_framebuffer_free(struct host1x_framebuffer *fb)
 {
+	if (!fb)
+		return;
+
 	host1x_pixelbuffer_free(fb->pixbuf);
 	free(fb);
 }
 
-int host1x_framebuffer_save(struct host1x *host1x,
-			    struct host1x_framebuffer *fb,
-			    const char *path)
+int host1x_png_write(const char *path, unsigned int width,
+		     unsigned int height, const void *data, unsigned int pitch)
 {
-	struct host1x_pixelbuffer *tiled_pixbuf = fb->pixbuf;
-	struct host1x_pixelbuffer *detiled_pixbuf;
 	png_structp png;
 	png_bytep *rows;
 	png_infop info;
 	unsigned int i;
-	void *buffer;
 	FILE *fp;
-	int err;
-
-	if (PIX_BUF_FORMAT_BITS(tiled_pixbuf->format) != 32) {
-		host1x_error("%u bits per pixel not supported\n",
-			     PIX_BUF_FORMAT_BITS(tiled_pixbuf->format));
-		return -EINVAL;
-	}
+	int err = 0;
 
 	fp = fopen(path, "wb");
 	if (!fp) {
@@ -143,86 +117,86 @@ int host1x_framebuffer_save(struct host1x *host1x,
 		return -errno;
 	}
 
-	png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	if (!png)
+	rows = malloc(height * sizeof(png_bytep));
+	if (!rows) {
+		host1x_error("Out-of-memory\n");
+		fclose(fp);
 		return -ENOMEM;
+	}
 
-	info = png_create_info_struct(png);
-	if (!info)
-		return -ENOMEM;
+	for (i = 0; i < height; i++)
+		rows[height - i - 1] = (png_bytep)data + i * pitch;
 
-	if (setjmp(png_jmpbuf(png)))
-		return -EIO;
+	png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (!png) {
+		err = -ENOMEM;
+		goto free_rows;
+	}
 
-	png_init_io(png, fp);
+	info = png_create_info_struct(png);
+	if (!info) {
+		png_destroy_write_struct(&png, NULL);
+		err = -ENOMEM;
+		goto free_rows;
+	}
 
-	if (setjmp(png_jmpbuf(png)))
-		return -EIO;
+	if (setjmp(png_jmpbuf(png))) {
+		host1x_error("Failed to encode `%s'\n", path);
+		err = -EIO;
+		goto destroy_png;
+	}
 
-	png_set_IHDR(png, info, tiled_pixbuf->width, tiled_pixbuf->height,
+	png_init_io(png, fp);
+	png_set_IHDR(png, info, width, height,
 		     8, PNG_COLOR_TYPE_RGBA,
 		     PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE,
 		     PNG_FILTER_TYPE_BASE);
 	png_write_info(png, info);
+	png_write_image(png, rows);
+	png_write_end(png, NULL);
 
-	if (setjmp(png_jmpbuf(png))) {
-		host1x_error("Failed to write IHDR\n");
-		return -EIO;
-	}
+destroy_png:
+	png_destroy_write_struct(&png, &info);
+free_rows:
+	free(rows);
+	fclose(fp);
 
-	if (tiled_pixbuf->layout == PIX_BUF_LAYOUT_TILED_16x16) {
-		detiled_pixbuf = host1x_pixelbuffer_create(host1x,
-							tiled_pixbuf->width,
-							tiled_pixbuf->height,
-							tiled_pixbuf->width * 4,
-							tiled_pixbuf->format,
-							PIX_BUF_LAYOUT_LINEAR);
-		if (!detiled_pixbuf)
-			return -ENOMEM;
-
-		err = host1x_gr2d_blit(host1x->gr2d,
-				       tiled_pixbuf,
-				       detiled_pixbuf,
-				       0, 0, 0, 0,
-				       tiled_pixbuf->width,
-				       tiled_pixbuf->height);
-		if (err < 0)
-			return -EFAULT;
-	} else {
-		detiled_pixbuf = tiled_pixbuf;
-	}
+	return err;
+}
 
-	err = HOST1X_BO_MMAP(detiled_pixbuf->bo, &buffer);
-	if (err < 0)
-		return -EFAULT;
+int host1x_framebuffer_save(struct host1x *host1x,
+			    struct host1x_framebuffer *fb,
+			    const char *path)
+{
+	struct host1x_pixelbuffer *tiled_pixbuf = fb->pixbuf;
+	unsigned int pitch;
+	void *buffer;
+	int err;
 
-	err = HOST1X_BO_INVALIDATE(detiled_pixbuf->bo,
-				   detiled_pixbuf->bo->offset,
-				   detiled_pixbuf->bo->size);
-	if (err < 0)
-		return -EFAULT;
+	if (PIX_BUF_FORMAT_BITS(tiled_pixbuf->format) != 32) {
+		host1x_error("%u bits per pixel not supported\n",
+			     PIX_BUF_FORMAT_BITS(tiled_pixbuf->format));
+		return -EINVAL;
+	}
 
-	rows = malloc(detiled_pixbuf->height * sizeof(png_bytep));
-	if (!rows) {
+	pitch = tiled_pixbuf->width * 4;
+
+	buffer = malloc(pitch * tiled_pixbuf->height);
+	if (!buffer) {
 		host1x_error("Out-of-memory\n");
 		return -ENOMEM;
 	}
 
-	for (i = 0; i < detiled_pixbuf->height; i++)
-		rows[detiled_pixbuf->height - i - 1] =
-					buffer + i * detiled_pixbuf->pitch;
-
-	png_write_image(png, rows);
-
-	if (setjmp(png_jmpbuf(png)))
-		return -EIO;
-
-	png_write_end(png, NULL);
+	err = host1x_pixelbuffer_read_data(tiled_pixbuf, buffer, pitch);
+	if (err < 0) {
+		free(buffer);
+		return -EFAULT;
+	}
 
-	if (detiled_pixbuf != tiled_pixbuf)
-		host1x_pixelbuffer_free(detiled_pixbuf);
+	err = host1x_png_write(path, tiled_pixbuf->width, tiled_pixbuf->height,
+			       buffer, pitch);
 
-	fclose(fp);
+	free(buffer);
 
-	return 0;
+	return err;
 }
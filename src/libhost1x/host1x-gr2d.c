@@ -23,12 +23,19 @@
 
 #include <errno.h>
 #include <math.h>
+#include <string.h>
 
 #include "host1x.h"
 #include "host1x-private.h"
 
 #define HOST1X_GR2D_TEST 0
 
+/* upper bound of words pushed by a single GR2D operation */
+#define HOST1X_GR2D_WORDS 64
+
+/* size of the ring reservation for a batch of operations */
+#define HOST1X_GR2D_BATCH_WORDS 4096
+
 #define FLOAT_TO_FIXED_6_12(fp) \
 	(((int32_t) (fp * 4096.0f + 0.5f)) & ((1 << 18) - 1))
 
@@ -84,12 +91,18 @@ static int host1x_gr2d_test(struct host1x_gr2d *gr2d)
 	return 0;
 }
 
-int host1x_gr2d_init(struct host1x *host1x, struct host1x_gr2d *gr2d)
+/* called with the engine setup lock held, see host1x_get_gr2d() */
+int host1x_gr2d_setup(struct host1x_gr2d *gr2d)
 {
+	struct host1x *host1x = gr2d->host1x;
 	int err;
 
+	if (gr2d->ready)
+		return 0;
+
 	gr2d->commands = HOST1X_BO_CREATE(host1x, 8 * 4096,
-					  NVHOST_BO_FLAG_COMMAND_BUFFER);
+					  NVHOST_BO_FLAG_COMMAND_BUFFER |
+					  HOST1X_BO_MAP_WRITE_COMBINE);
 	if (!gr2d->commands)
 		return -ENOMEM;
 
@@ -97,6 +110,8 @@ int host1x_gr2d_init(struct host1x *host1x, struct host1x_gr2d *gr2d)
 	if (err < 0)
 		return err;
 
+	host1x_ring_init(&gr2d->ring, gr2d->client, gr2d->commands);
+
 	gr2d->scratch = HOST1X_BO_CREATE(host1x, 64, NVHOST_BO_FLAG_SCRATCH);
 	if (!gr2d->scratch) {
 		host1x_bo_free(gr2d->commands);
@@ -111,52 +126,169 @@ int host1x_gr2d_init(struct host1x *host1x, struct host1x_gr2d *gr2d)
 		}
 	}
 
+	__atomic_store_n(&gr2d->ready, true, __ATOMIC_RELEASE);
+
 	return 0;
 }
 
+int host1x_gr2d_init(struct host1x *host1x, struct host1x_gr2d *gr2d)
+{
+	gr2d->host1x = host1x;
+	gr2d->client->timeout = host1x->options->job_timeout ?:
+				HOST1X_JOB_TIMEOUT_MS;
+
+	if (host1x->options->lazy_init)
+		return 0;
+
+	return host1x_gr2d_setup(gr2d);
+}
+
 void host1x_gr2d_exit(struct host1x_gr2d *gr2d)
 {
+	unsigned int i;
+
+	if (!gr2d->ready)
+		return;
+
+	host1x_ring_wait_idle(&gr2d->ring);
 	host1x_bo_free(gr2d->commands);
 	host1x_bo_free(gr2d->scratch);
-}
 
-int host1x_gr2d_clear(struct host1x_gr2d *gr2d,
-		      struct host1x_pixelbuffer *pixbuf,
-		      uint32_t color)
-{
-	return host1x_gr2d_clear_rect(gr2d, pixbuf, color, 0, 0,
-				      pixbuf->width, pixbuf->height);
+	for (i = 0; i < HOST1X_GR2D_STAGING_SLOTS; i++) {
+		if (gr2d->staging[i].bo)
+			host1x_bo_free(gr2d->staging[i].bo);
+	}
 }
 
-int host1x_gr2d_clear_rect(struct host1x_gr2d *gr2d,
-			   struct host1x_pixelbuffer *pixbuf,
-			   uint32_t color,
-			   unsigned x, unsigned y,
-			   unsigned width, unsigned height)
+/*
+ * GR2D operations are recorded into the command ring and aren't waited for,
+ * the returned fence may be waited for by the CPU or by other engine within
+ * its command stream, see host1x_pushbuf_wait().
+ */
+static int host1x_gr2d_begin(struct host1x_gr2d *gr2d,
+			     struct host1x_job **jobp, size_t words,
+			     struct host1x_pushbuf **pbp)
 {
-	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
+	struct host1x_syncpt *syncpt;
 	struct host1x_pushbuf *pb;
 	struct host1x_job *job;
-	unsigned tiled = 0;
-	uint32_t fence;
-	int err;
+
+	/* the deferred setup of the engine has failed */
+	if (!gr2d)
+		return -ENODEV;
+
+	syncpt = &gr2d->client->syncpts[0];
+
+	/* the ring has a single pending reservation */
+	if (gr2d->batch) {
+		host1x_error("GR2D batch is being recorded\n");
+		return -EBUSY;
+	}
 
 	job = HOST1X_JOB_CREATE(syncpt->id, 1);
 	if (!job)
 		return -ENOMEM;
 
-	pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
+	pb = host1x_ring_append(&gr2d->ring, job, words);
 	if (!pb) {
 		host1x_job_free(job);
 		return -ENOMEM;
 	}
 
+	*jobp = job;
+	*pbp = pb;
+
+	return 0;
+}
+
+static int host1x_gr2d_submit(struct host1x_gr2d *gr2d,
+			      struct host1x_job *job,
+			      struct host1x_pushbuf *pb,
+			      uint32_t *fence)
+{
+	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
+	int err;
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 1));
+	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+
+	err = HOST1X_CLIENT_SUBMIT(gr2d->client, job);
+	if (err < 0) {
+		host1x_job_free(job);
+		return err;
+	}
+
+	err = HOST1X_CLIENT_FLUSH(gr2d->client, fence);
+	if (err < 0) {
+		host1x_job_free(job);
+		return err;
+	}
+
+	err = host1x_ring_commit(&gr2d->ring, pb, *fence);
+	host1x_job_free(job);
+	if (err < 0)
+		return err;
+
+	gr2d->fence = *fence;
+
+	return 0;
+}
+
+static int host1x_gr2d_wait(struct host1x_gr2d *gr2d,
+			    struct host1x_pixelbuffer *pixbuf,
+			    uint32_t fence)
+{
+	int err;
+
+	err = HOST1X_CLIENT_WAIT(gr2d->client, fence, ~0u);
+	if (err < 0)
+		return err;
+
+	host1x_pixelbuffer_check_guard(pixbuf);
+
+	return 0;
+}
+
+int host1x_gr2d_clear(struct host1x_gr2d *gr2d,
+		      struct host1x_pixelbuffer *pixbuf,
+		      uint32_t color)
+{
+	return host1x_gr2d_clear_rect(gr2d, pixbuf, color, 0, 0,
+				      pixbuf->width, pixbuf->height);
+}
+
+/* lazy pixelbuffers get their BOs once they are blitted */
+static int host1x_gr2d_populate(struct host1x_pixelbuffer *src,
+				struct host1x_pixelbuffer *dst)
+{
+	int err;
+
+	err = host1x_pixelbuffer_populate(src);
+	if (err < 0)
+		return err;
+
+	return host1x_pixelbuffer_populate(dst);
+}
+
+static int host1x_gr2d_push_clear_rect(struct host1x_pushbuf *pb,
+				       struct host1x_pixelbuffer *pixbuf,
+				       uint32_t color,
+				       unsigned x, unsigned y,
+				       unsigned width, unsigned height)
+{
+	unsigned tiled = 0;
+	int err;
+
 	if (x + width > pixbuf->width)
 		return -EINVAL;
 
 	if (y + height > pixbuf->height)
 		return -EINVAL;
 
+	err = host1x_pixelbuffer_populate(pixbuf);
+	if (err < 0)
+		return err;
+
 	switch (pixbuf->layout) {
 	case PIX_BUF_LAYOUT_TILED_16x16:
 		tiled = 1;
@@ -189,49 +321,23 @@ int host1x_gr2d_clear_rect(struct host1x_gr2d *gr2d,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x38, 5));
 	host1x_pushbuf_push(pb, height << 16 | width);
 	host1x_pushbuf_push(pb, y << 16 | x);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 1));
-	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
-
-	err = HOST1X_CLIENT_SUBMIT(gr2d->client, job);
-	if (err < 0) {
-		host1x_job_free(job);
-		return err;
-	}
-
-	host1x_job_free(job);
-
-	err = HOST1X_CLIENT_FLUSH(gr2d->client, &fence);
-	if (err < 0)
-		return err;
-
-	err = HOST1X_CLIENT_WAIT(gr2d->client, fence, ~0u);
-	if (err < 0)
-		return err;
-
-	host1x_pixelbuffer_check_guard(pixbuf);
-
 	return 0;
 }
 
-int host1x_gr2d_blit(struct host1x_gr2d *gr2d,
-		     struct host1x_pixelbuffer *src,
-		     struct host1x_pixelbuffer *dst,
-		     unsigned int sx, unsigned int sy,
-		     unsigned int dx, unsigned int dy,
-		     unsigned int width, int height)
+static int host1x_gr2d_push_blit(struct host1x_pushbuf *pb,
+				 struct host1x_pixelbuffer *src,
+				 struct host1x_pixelbuffer *dst,
+				 unsigned int sx, unsigned int sy,
+				 unsigned int dx, unsigned int dy,
+				 unsigned int width, int height)
 {
-	struct host1x_bo *src_orig = src->bo->wrapped ?: src->bo;
-	struct host1x_bo *dst_orig = dst->bo->wrapped ?: dst->bo;
-	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
-	struct host1x_pushbuf *pb;
-	struct host1x_job *job;
+	struct host1x_bo *src_orig, *dst_orig;
 	unsigned src_tiled = 0;
 	unsigned dst_tiled = 0;
 	unsigned yflip = 0;
 	unsigned xdir = 0;
 	unsigned ydir = 0;
 	unsigned bytes;
-	uint32_t fence;
 	int err;
 
 	if (PIX_BUF_FORMAT_BYTES(src->format) !=
@@ -241,6 +347,13 @@ int host1x_gr2d_blit(struct host1x_gr2d *gr2d,
 		return -EINVAL;
 	}
 
+	err = host1x_gr2d_populate(src, dst);
+	if (err < 0)
+		return err;
+
+	src_orig = src->bo->wrapped ?: src->bo;
+	dst_orig = dst->bo->wrapped ?: dst->bo;
+
 	switch (src->layout) {
 	case PIX_BUF_LAYOUT_TILED_16x16:
 		src_tiled = 1;
@@ -344,16 +457,6 @@ yflip_setup:
 		bytes = PIX_BUF_FORMAT_BYTES(dst->format);
 	}
 
-	job = HOST1X_JOB_CREATE(syncpt->id, 1);
-	if (!job)
-		return -ENOMEM;
-
-	pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
-	if (!pb) {
-		host1x_job_free(job);
-		return -ENOMEM;
-	}
-
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0, 0x51, 0));
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x009, 0x9));
@@ -390,26 +493,115 @@ yflip_setup:
 	host1x_pushbuf_push(pb, sy << 16 | sx); /* srcps */
 	host1x_pushbuf_push(pb, dy << 16 | dx); /* dstps */
 
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 1));
-	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+	return 0;
+}
 
-	err = HOST1X_CLIENT_SUBMIT(gr2d->client, job);
-	if (err < 0) {
-		host1x_job_free(job);
-		return err;
+static bool host1x_gr2d_rotation_swaps_xy(enum host1x_gr2d_rotation rotation)
+{
+	switch (rotation) {
+	case HOST1X_GR2D_TRANSPOSE:
+	case HOST1X_GR2D_ANTI_TRANSPOSE:
+	case HOST1X_GR2D_ROTATE_90:
+	case HOST1X_GR2D_ROTATE_270:
+		return true;
+	default:
+		return false;
 	}
+}
 
-	host1x_job_free(job);
+/*
+ * The fast rotate unit reads the source rectangle and writes it rotated
+ * into the destination, (dx, dy) is the top-left corner of the rotated
+ * rectangle. It can't work in-place on a sub-rectangle, hence source and
+ * destination must be different surfaces.
+ */
+static int host1x_gr2d_push_rotate_blit(struct host1x_pushbuf *pb,
+					struct host1x_pixelbuffer *src,
+					struct host1x_pixelbuffer *dst,
+					enum host1x_gr2d_rotation rotation,
+					unsigned int sx, unsigned int sy,
+					unsigned int dx, unsigned int dy,
+					unsigned int width, unsigned int height)
+{
+	struct host1x_bo *src_orig, *dst_orig;
+	unsigned int dst_width = width, dst_height = height;
+	unsigned bytes;
+	int err;
 
-	err = HOST1X_CLIENT_FLUSH(gr2d->client, &fence);
-	if (err < 0)
-		return err;
+	if (rotation > HOST1X_GR2D_ROTATE_0) {
+		host1x_error("Invalid rotation %u\n", rotation);
+		return -EINVAL;
+	}
 
-	err = HOST1X_CLIENT_WAIT(gr2d->client, fence, ~0u);
+	if (src->format != dst->format ||
+	    PIX_BUF_FORMAT_COMPRESSED(src->format)) {
+		host1x_error("Invalid formats\n");
+		return -EINVAL;
+	}
+
+	err = host1x_gr2d_populate(src, dst);
 	if (err < 0)
 		return err;
 
-	host1x_pixelbuffer_check_guard(dst);
+	src_orig = src->bo->wrapped ?: src->bo;
+	dst_orig = dst->bo->wrapped ?: dst->bo;
+
+	if (src->layout != PIX_BUF_LAYOUT_LINEAR ||
+	    dst->layout != PIX_BUF_LAYOUT_LINEAR) {
+		host1x_error("Fast rotate requires linear layouts\n");
+		return -EINVAL;
+	}
+
+	if (src_orig == dst_orig) {
+		host1x_error("In-place rotation isn't supported\n");
+		return -EINVAL;
+	}
+
+	if (host1x_gr2d_rotation_swaps_xy(rotation)) {
+		dst_width = height;
+		dst_height = width;
+	}
+
+	if (sx + width > src->width ||
+	    sy + height > src->height ||
+	    dx + dst_width > dst->width ||
+	    dy + dst_height > dst->height) {
+		host1x_error("Coords out of range\n");
+		return -EINVAL;
+	}
+
+	bytes = PIX_BUF_FORMAT_BYTES(dst->format);
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0, 0x51, 0));
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x009, 0x9));
+	host1x_pushbuf_push(pb, 0x0000003a); /* trigger */
+	host1x_pushbuf_push(pb, 0x00000000); /* cmdsel */
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x01e, 0x7));
+	/*
+	 * [31:29] fast rotate type
+	 * [27:26] fast rotate mode (0: disabled, 1: source to destination)
+	 */
+	host1x_pushbuf_push(pb, rotation << 29 | 1 << 26); /* controlsecond */
+	host1x_pushbuf_push(pb, /* controlmain */
+			1 << 20 |
+			(bytes >> 1) << 16);
+	host1x_pushbuf_push(pb, 0x000000cc); /* ropfade */
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x046, 1));
+	host1x_pushbuf_push(pb, 0x00000000); /* tilemode */
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x02b, 0xe149));
+	HOST1X_PUSHBUF_RELOCATE(pb, dst->bo, dst->bo->offset, 0);
+	host1x_pushbuf_push(pb, 0xdeadbeef); /* dstba */
+	host1x_pushbuf_push(pb, dst->pitch); /* dstst */
+	HOST1X_PUSHBUF_RELOCATE(pb, src->bo, src->bo->offset, 0);
+	host1x_pushbuf_push(pb, 0xdeadbeef); /* srcba */
+	host1x_pushbuf_push(pb, src->pitch); /* srcst */
+	host1x_pushbuf_push(pb, height << 16 | width); /* dstsize */
+	host1x_pushbuf_push(pb, sy << 16 | sx); /* srcps */
+	host1x_pushbuf_push(pb, dy << 16 | dx); /* dstps */
 
 	return 0;
 }
@@ -436,17 +628,87 @@ static uint32_t sb_offset(struct host1x_pixelbuffer *pixbuf,
 	return offset;
 }
 
-int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
-			     struct host1x_pixelbuffer *src,
-			     struct host1x_pixelbuffer *dst,
-			     unsigned int sx, unsigned int sy,
-			     unsigned int src_width, int src_height,
-			     unsigned int dx, unsigned int dy,
-			     unsigned int dst_width, int dst_height)
+/*
+ * Coefficients of the conversion to RGB, yos is the offset of the luma.
+ * The chroma offset of 128 is applied by the engine.
+ */
+struct host1x_gr2d_csc {
+	int yos;
+	float cyx, cur, cug, cub, cvr, cvg, cvb;
+};
+
+static const struct host1x_gr2d_csc host1x_gr2d_csc_identity = {
+	.cyx = 1.0f, .cub = 1.0f, .cvr = 1.0f,
+};
+
+/* limited range, as produced by video decoders */
+static const struct host1x_gr2d_csc host1x_gr2d_csc_yuv[] = {
+	[HOST1X_CSC_BT601] = {
+		.yos = -16,
+		.cyx = 1.164f, .cur = 0.0f, .cvr = 1.596f,
+		.cug = -0.392f, .cvg = -0.813f,
+		.cub = 2.017f, .cvb = 0.0f,
+	},
+	[HOST1X_CSC_BT709] = {
+		.yos = -16,
+		.cyx = 1.164f, .cur = 0.0f, .cvr = 1.793f,
+		.cug = -0.213f, .cvg = -0.533f,
+		.cub = 2.112f, .cvb = 0.0f,
+	},
+};
+
+static int host1x_gr2d_check_yuv(const struct host1x_yuv_frame *yuv)
 {
-	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
-	struct host1x_pushbuf *pb;
-	struct host1x_job *job;
+	struct host1x_pixelbuffer *y = yuv->y, *u = yuv->u, *v = yuv->v;
+
+	/* GR2D reads 4:2:0 chroma only from separate planes */
+	if (!y || !u || !v) {
+		host1x_error("Semi-planar YUV isn't supported\n");
+		return -ENOTSUP;
+	}
+
+	if (y->format != PIX_BUF_FMT_L8 || u->format != PIX_BUF_FMT_L8 ||
+	    v->format != PIX_BUF_FMT_L8 || u->pitch != v->pitch) {
+		host1x_error("Invalid YUV planes\n");
+		return -EINVAL;
+	}
+
+	if (y->layout != PIX_BUF_LAYOUT_LINEAR ||
+	    u->layout != PIX_BUF_LAYOUT_LINEAR ||
+	    v->layout != PIX_BUF_LAYOUT_LINEAR) {
+		host1x_error("YUV planes have to be linear\n");
+		return -EINVAL;
+	}
+
+	if (u->width < (y->width + 1) / 2 || u->height < (y->height + 1) / 2 ||
+	    v->width < u->width || v->height < u->height) {
+		host1x_error("YUV chroma planes are too small\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Stretch blit with filtering, the source is either an RGB pixelbuffer
+ * or, if yuv is given, the luma plane of a planar YUV 4:2:0 frame that
+ * is converted to RGB on the way.
+ */
+static int host1x_gr2d_push_surface_blit(struct host1x_pushbuf *pb,
+					 struct host1x_pixelbuffer *src,
+					 const struct host1x_yuv_frame *yuv,
+					 enum host1x_csc csc_type,
+					 struct host1x_pixelbuffer *dst,
+					 unsigned int sx, unsigned int sy,
+					 unsigned int src_width,
+					 int src_height,
+					 unsigned int dx, unsigned int dy,
+					 unsigned int dst_width,
+					 int dst_height)
+{
+	const struct host1x_gr2d_csc *csc = &host1x_gr2d_csc_identity;
+	unsigned long uv_offset = 0;
+	unsigned imode = 0;
 	float inv_scale_x;
 	float inv_scale_y;
 	unsigned src_tiled = 0;
@@ -458,9 +720,23 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 	unsigned vftype;
 	unsigned hfen = 1;
 	unsigned vfen = 1;
-	uint32_t fence;
 	int err;
 
+	if (yuv) {
+		err = host1x_gr2d_check_yuv(yuv);
+		if (err < 0)
+			return err;
+
+		if (csc_type > HOST1X_CSC_BT709) {
+			host1x_error("Invalid colour space %u\n", csc_type);
+			return -EINVAL;
+		}
+	}
+
+	err = host1x_gr2d_populate(src, dst);
+	if (err < 0)
+		return err;
+
 	switch (src->layout) {
 	case PIX_BUF_LAYOUT_TILED_16x16:
 		src_tiled = 1;
@@ -488,11 +764,23 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 	case PIX_BUF_FMT_RGBA8888:
 		src_fmt = 15;
 		break;
+	case PIX_BUF_FMT_L8:
+		if (yuv)
+			break;
+		/* fall through */
 	default:
 		host1x_error("Invalid src format %u\n", src->format);
 		return -EINVAL;
 	}
 
+	if (yuv) {
+		/* planar input, the chroma planes are given separately */
+		csc = &host1x_gr2d_csc_yuv[csc_type];
+		uv_offset = sb_offset(yuv->u, sx / 2, sy / 2);
+		src_fmt = 0;
+		imode = 1;
+	}
+
 	switch (dst->format) {
 	case PIX_BUF_FMT_BGRA8888:
 		dst_fmt = 14;
@@ -577,16 +865,6 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 	src_height = MAX(src_height, 0);
 	dst_height = MAX(dst_height, 0);
 
-	job = HOST1X_JOB_CREATE(syncpt->id, 1);
-	if (!job)
-		return -ENOMEM;
-
-	pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
-	if (!pb) {
-		host1x_job_free(job);
-		return -ENOMEM;
-	}
-
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0, 0x52, 0));
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x009, 0xF09));
@@ -597,22 +875,37 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 	host1x_pushbuf_push(pb, FLOAT_TO_FIXED_6_12(inv_scale_x)); /* hdda */
 	host1x_pushbuf_push(pb, FLOAT_TO_FIXED_0_8(sx)); /* hddainils */
 
+	if (yuv) {
+		/* uvstride, U and V plane bases */
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x018, 0xd));
+		host1x_pushbuf_push(pb, yuv->u->pitch);
+		HOST1X_PUSHBUF_RELOCATE(pb, yuv->u->bo,
+					yuv->u->bo->offset + uv_offset, 0);
+		host1x_pushbuf_push(pb, 0xdeadbeef); /* uba */
+		HOST1X_PUSHBUF_RELOCATE(pb, yuv->v->bo,
+					yuv->v->bo->offset + uv_offset, 0);
+		host1x_pushbuf_push(pb, 0xdeadbeef); /* vba */
+	}
+
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x15, 0x787));
-	/* CSC RGB -> RGB coefficients */
+	/* CSC coefficients, identity for RGB sources */
 	host1x_pushbuf_push(pb,
-			/* cvr */ FLOAT_TO_FIXED_2_7(1.0f) << 12 |
-			/* cub */ FLOAT_TO_FIXED_2_7(1.0f)); /* cscfirst */
+			/* yos */ (csc->yos & 0xff) << 24 |
+			/* cvr */ FLOAT_TO_FIXED_2_7(csc->cvr) << 12 |
+			/* cub */ FLOAT_TO_FIXED_2_7(csc->cub)); /* cscfirst */
 	host1x_pushbuf_push(pb,
-			/* cyx */ FLOAT_TO_FIXED_1_7(1.0f) << 24 |
-			/* cur */ FLOAT_TO_FIXED_2_7(0.0f) << 12 |
-			/* cug */ FLOAT_TO_FIXED_1_7(0.0f)); /* cscsecond */
+			/* cyx */ FLOAT_TO_FIXED_1_7(csc->cyx) << 24 |
+			/* cur */ FLOAT_TO_FIXED_2_7(csc->cur) << 12 |
+			/* cug */ FLOAT_TO_FIXED_1_7(csc->cug)); /* cscsecond */
 	host1x_pushbuf_push(pb,
-			/* cvb */ FLOAT_TO_FIXED_2_7(0.0f) << 16 |
-			/* cvg */ FLOAT_TO_FIXED_1_7(0.0f)); /* cscthird */
+			/* cvb */ FLOAT_TO_FIXED_2_7(csc->cvb) << 16 |
+			/* cvg */ FLOAT_TO_FIXED_1_7(csc->cvg)); /* cscthird */
 
 	host1x_pushbuf_push(pb, dst_fmt << 8 | src_fmt); /* sbformat */
+	/* [6:5] input mode (0: multiplexed, 1: planar) */
 	host1x_pushbuf_push(pb, /* controlsb */
-			    hftype << 20 | vfen << 18 | vftype << 16);
+			    hftype << 20 | vfen << 18 | vftype << 16 |
+			    imode << 5);
 	host1x_pushbuf_push(pb, 0x00000000); /* controlsecond */
 	/*
 	 * [20:20] source color depth (0: mono, 1: same)
@@ -650,26 +943,544 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 	host1x_pushbuf_push(pb, src_height << 16 | src_width); /* srcsize */
 	host1x_pushbuf_push(pb, dst_height << 16 | dst_width); /* dstsize */
 
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 1));
-	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+	return 0;
+}
 
-	err = HOST1X_CLIENT_SUBMIT(gr2d->client, job);
+int host1x_gr2d_clear_rect_async(struct host1x_gr2d *gr2d,
+				 struct host1x_pixelbuffer *pixbuf,
+				 uint32_t color,
+				 unsigned x, unsigned y,
+				 unsigned width, unsigned height,
+				 uint32_t *fence)
+{
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	int err;
+
+	err = host1x_gr2d_begin(gr2d, &job, HOST1X_GR2D_WORDS, &pb);
+	if (err < 0)
+		return err;
+
+	err = host1x_gr2d_push_clear_rect(pb, pixbuf, color, x, y,
+					  width, height);
 	if (err < 0) {
 		host1x_job_free(job);
 		return err;
 	}
 
-	host1x_job_free(job);
+	return host1x_gr2d_submit(gr2d, job, pb, fence);
+}
 
-	err = HOST1X_CLIENT_FLUSH(gr2d->client, &fence);
+int host1x_gr2d_blit_async(struct host1x_gr2d *gr2d,
+			   struct host1x_pixelbuffer *src,
+			   struct host1x_pixelbuffer *dst,
+			   unsigned int sx, unsigned int sy,
+			   unsigned int dx, unsigned int dy,
+			   unsigned int width, int height,
+			   uint32_t *fence)
+{
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	int err;
+
+	err = host1x_gr2d_begin(gr2d, &job, HOST1X_GR2D_WORDS, &pb);
 	if (err < 0)
 		return err;
 
-	err = HOST1X_CLIENT_WAIT(gr2d->client, fence, ~0u);
+	err = host1x_gr2d_push_blit(pb, src, dst, sx, sy, dx, dy,
+				    width, height);
+	if (err < 0) {
+		host1x_job_free(job);
+		return err;
+	}
+
+	return host1x_gr2d_submit(gr2d, job, pb, fence);
+}
+
+int host1x_gr2d_surface_blit_async(struct host1x_gr2d *gr2d,
+				   struct host1x_pixelbuffer *src,
+				   struct host1x_pixelbuffer *dst,
+				   unsigned int sx, unsigned int sy,
+				   unsigned int src_width, int src_height,
+				   unsigned int dx, unsigned int dy,
+				   unsigned int dst_width, int dst_height,
+				   uint32_t *fence)
+{
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	int err;
+
+	err = host1x_gr2d_begin(gr2d, &job, HOST1X_GR2D_WORDS, &pb);
+	if (err < 0)
+		return err;
+
+	err = host1x_gr2d_push_surface_blit(pb, src, NULL, 0, dst, sx, sy,
+					    src_width, src_height, dx, dy,
+					    dst_width, dst_height);
+	if (err < 0) {
+		host1x_job_free(job);
+		return err;
+	}
+
+	return host1x_gr2d_submit(gr2d, job, pb, fence);
+}
+
+int host1x_gr2d_yuv_blit_async(struct host1x_gr2d *gr2d,
+			       const struct host1x_yuv_frame *src,
+			       enum host1x_csc csc,
+			       struct host1x_pixelbuffer *dst,
+			       unsigned int sx, unsigned int sy,
+			       unsigned int src_width, int src_height,
+			       unsigned int dx, unsigned int dy,
+			       unsigned int dst_width, int dst_height,
+			       uint32_t *fence)
+{
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	int err;
+
+	err = host1x_gr2d_begin(gr2d, &job, HOST1X_GR2D_WORDS, &pb);
+	if (err < 0)
+		return err;
+
+	err = host1x_gr2d_push_surface_blit(pb, src->y, src, csc, dst, sx, sy,
+					    src_width, src_height, dx, dy,
+					    dst_width, dst_height);
+	if (err < 0) {
+		host1x_job_free(job);
+		return err;
+	}
+
+	return host1x_gr2d_submit(gr2d, job, pb, fence);
+}
+
+int host1x_gr2d_rotate_blit_async(struct host1x_gr2d *gr2d,
+				  struct host1x_pixelbuffer *src,
+				  struct host1x_pixelbuffer *dst,
+				  enum host1x_gr2d_rotation rotation,
+				  unsigned int sx, unsigned int sy,
+				  unsigned int dx, unsigned int dy,
+				  unsigned int width, unsigned int height,
+				  uint32_t *fence)
+{
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	int err;
+
+	err = host1x_gr2d_begin(gr2d, &job, HOST1X_GR2D_WORDS, &pb);
+	if (err < 0)
+		return err;
+
+	err = host1x_gr2d_push_rotate_blit(pb, src, dst, rotation, sx, sy,
+					   dx, dy, width, height);
+	if (err < 0) {
+		host1x_job_free(job);
+		return err;
+	}
+
+	return host1x_gr2d_submit(gr2d, job, pb, fence);
+}
+
+/*
+ * The slots are used round-robin and GR2D completes the blits in-order,
+ * hence the next slot is the one that was busy for the longest time. Only
+ * uploads that outrun GR2D wait for it.
+ */
+static struct host1x_gr2d_staging *
+host1x_gr2d_staging_get(struct host1x_gr2d *gr2d, size_t size)
+{
+	struct host1x_gr2d_staging *slot;
+	int err;
+
+	slot = &gr2d->staging[gr2d->staging_next];
+
+	if (slot->busy) {
+		err = HOST1X_CLIENT_WAIT(gr2d->client, slot->fence, ~0u);
+		if (err < 0)
+			return NULL;
+
+		slot->busy = false;
+	}
+
+	if (slot->bo && slot->bo->size < size) {
+		host1x_bo_free(slot->bo);
+		slot->bo = NULL;
+	}
+
+	if (!slot->bo) {
+		slot->bo = HOST1X_BO_CREATE(gr2d->host1x, size,
+					NVHOST_BO_FLAG_FRAMEBUFFER |
+					HOST1X_BO_MAP_WRITE_COMBINE |
+					HOST1X_BO_CATEGORY(HOST1X_MEM_TEXTURE));
+		if (!slot->bo)
+			return NULL;
+	}
+
+	gr2d->staging_next = (gr2d->staging_next + 1) %
+						HOST1X_GR2D_STAGING_SLOTS;
+
+	return slot;
+}
+
+/*
+ * Copies the data of the whole pixelbuffer into a staging BO and blits it
+ * from there, the data is given in the format of the pixelbuffer. The data
+ * may be overwritten by the caller once this returns.
+ */
+int host1x_gr2d_upload_async(struct host1x_gr2d *gr2d,
+			     struct host1x_pixelbuffer *pixbuf,
+			     const void *data, unsigned data_pitch,
+			     unsigned long data_size,
+			     enum layout_format data_layout,
+			     uint32_t *fence)
+{
+	struct host1x_pixelbuffer src = {
+		.format = pixbuf->format,
+		.layout = data_layout,
+		.width = pixbuf->width,
+		.height = pixbuf->height,
+		.pitch = data_pitch,
+	};
+	struct host1x_gr2d_staging *slot;
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	unsigned rows, th;
+	void *map;
+	int err;
+
+	if (PIX_BUF_FORMAT_COMPRESSED(pixbuf->format)) {
+		th = PIX_BUF_FORMAT_TEXEL_HEIGHT(pixbuf->format);
+		rows = ALIGN(pixbuf->height, th) / th;
+	} else if (data_layout == PIX_BUF_LAYOUT_TILED_16x16) {
+		rows = ALIGN(pixbuf->height, 16);
+	} else {
+		rows = pixbuf->height;
+	}
+
+	if ((unsigned long)data_pitch * rows > data_size) {
+		host1x_error("invalid: data of %lu bytes is too small\n",
+			     data_size);
+		return -EINVAL;
+	}
+
+	if (!gr2d)
+		return -ENODEV;
+
+	slot = host1x_gr2d_staging_get(gr2d, data_size);
+	if (!slot)
+		return -ENOMEM;
+
+	err = HOST1X_BO_MMAP(slot->bo, &map);
+	if (err < 0)
+		return err;
+
+	memcpy(map + slot->bo->offset, data, data_size);
+	HOST1X_BO_FLUSH(slot->bo, slot->bo->offset, data_size);
+
+	src.bo = slot->bo;
+
+	err = host1x_gr2d_begin(gr2d, &job, HOST1X_GR2D_WORDS, &pb);
+	if (err < 0)
+		return err;
+
+	err = host1x_gr2d_push_blit(pb, &src, pixbuf, 0, 0, 0, 0,
+				    pixbuf->width, pixbuf->height);
+	if (err < 0) {
+		host1x_job_free(job);
+		return err;
+	}
+
+	err = host1x_gr2d_submit(gr2d, job, pb, fence);
+	if (err < 0)
+		return err;
+
+	slot->fence = *fence;
+	slot->busy = true;
+
+	return 0;
+}
+
+int host1x_gr2d_clear_rect(struct host1x_gr2d *gr2d,
+			   struct host1x_pixelbuffer *pixbuf,
+			   uint32_t color,
+			   unsigned x, unsigned y,
+			   unsigned width, unsigned height)
+{
+	uint32_t fence;
+	int err;
+
+	err = host1x_gr2d_clear_rect_async(gr2d, pixbuf, color, x, y,
+					   width, height, &fence);
+	if (err < 0)
+		return err;
+
+	return host1x_gr2d_wait(gr2d, pixbuf, fence);
+}
+
+int host1x_gr2d_blit(struct host1x_gr2d *gr2d,
+		     struct host1x_pixelbuffer *src,
+		     struct host1x_pixelbuffer *dst,
+		     unsigned int sx, unsigned int sy,
+		     unsigned int dx, unsigned int dy,
+		     unsigned int width, int height)
+{
+	uint32_t fence;
+	int err;
+
+	err = host1x_gr2d_blit_async(gr2d, src, dst, sx, sy, dx, dy,
+				     width, height, &fence);
+	if (err < 0)
+		return err;
+
+	return host1x_gr2d_wait(gr2d, dst, fence);
+}
+
+int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
+			     struct host1x_pixelbuffer *src,
+			     struct host1x_pixelbuffer *dst,
+			     unsigned int sx, unsigned int sy,
+			     unsigned int src_width, int src_height,
+			     unsigned int dx, unsigned int dy,
+			     unsigned int dst_width, int dst_height)
+{
+	uint32_t fence;
+	int err;
+
+	err = host1x_gr2d_surface_blit_async(gr2d, src, dst, sx, sy,
+					     src_width, src_height, dx, dy,
+					     dst_width, dst_height, &fence);
+	if (err < 0)
+		return err;
+
+	return host1x_gr2d_wait(gr2d, dst, fence);
+}
+
+int host1x_gr2d_yuv_blit(struct host1x_gr2d *gr2d,
+			 const struct host1x_yuv_frame *src,
+			 enum host1x_csc csc,
+			 struct host1x_pixelbuffer *dst,
+			 unsigned int sx, unsigned int sy,
+			 unsigned int src_width, int src_height,
+			 unsigned int dx, unsigned int dy,
+			 unsigned int dst_width, int dst_height)
+{
+	uint32_t fence;
+	int err;
+
+	err = host1x_gr2d_yuv_blit_async(gr2d, src, csc, dst, sx, sy,
+					 src_width, src_height, dx, dy,
+					 dst_width, dst_height, &fence);
+	if (err < 0)
+		return err;
+
+	return host1x_gr2d_wait(gr2d, dst, fence);
+}
+
+int host1x_gr2d_rotate_blit(struct host1x_gr2d *gr2d,
+			    struct host1x_pixelbuffer *src,
+			    struct host1x_pixelbuffer *dst,
+			    enum host1x_gr2d_rotation rotation,
+			    unsigned int sx, unsigned int sy,
+			    unsigned int dx, unsigned int dy,
+			    unsigned int width, unsigned int height)
+{
+	uint32_t fence;
+	int err;
+
+	err = host1x_gr2d_rotate_blit_async(gr2d, src, dst, rotation, sx, sy,
+					    dx, dy, width, height, &fence);
+	if (err < 0)
+		return err;
+
+	return host1x_gr2d_wait(gr2d, dst, fence);
+}
+
+int host1x_gr2d_upload(struct host1x_gr2d *gr2d,
+		       struct host1x_pixelbuffer *pixbuf,
+		       const void *data, unsigned data_pitch,
+		       unsigned long data_size,
+		       enum layout_format data_layout)
+{
+	uint32_t fence;
+	int err;
+
+	err = host1x_gr2d_upload_async(gr2d, pixbuf, data, data_pitch,
+				       data_size, data_layout, &fence);
+	if (err < 0)
+		return err;
+
+	return host1x_gr2d_wait(gr2d, pixbuf, fence);
+}
+
+/*
+ * Batch records any number of GR2D operations into a single job that is
+ * submitted with a single syncpoint increment. The job is submitted earlier
+ * if it runs out of space, GR2D executes jobs in-order, hence the fence
+ * returned by host1x_gr2d_batch_submit() covers all recorded operations.
+ * Only one batch can be recorded at a time and other GR2D operations are
+ * rejected meanwhile.
+ */
+int host1x_gr2d_batch_begin(struct host1x_gr2d *gr2d,
+			    struct host1x_gr2d_batch *batch)
+{
+	if (!gr2d)
+		return -ENODEV;
+
+	if (gr2d->batch) {
+		host1x_error("GR2D batch is being recorded\n");
+		return -EBUSY;
+	}
+
+	memset(batch, 0, sizeof(*batch));
+	batch->gr2d = gr2d;
+	gr2d->batch = batch;
+
+	return 0;
+}
+
+static int host1x_gr2d_batch_flush(struct host1x_gr2d_batch *batch)
+{
+	uint32_t fence;
+	int err;
+
+	err = host1x_gr2d_submit(batch->gr2d, batch->job, batch->pb, &fence);
+	batch->job = NULL;
+	batch->pb = NULL;
+
+	return err;
+}
+
+static struct host1x_pushbuf *
+host1x_gr2d_batch_reserve(struct host1x_gr2d_batch *batch)
+{
+	struct host1x_gr2d *gr2d = batch->gr2d;
+
+	if (batch->job &&
+	    batch->pb->length + HOST1X_GR2D_WORDS > gr2d->ring.reserved) {
+		if (host1x_gr2d_batch_flush(batch) < 0)
+			return NULL;
+	}
+
+	if (!batch->job) {
+		gr2d->batch = NULL;
+		if (host1x_gr2d_begin(gr2d, &batch->job,
+				      HOST1X_GR2D_BATCH_WORDS, &batch->pb) < 0)
+			batch->pb = NULL;
+		gr2d->batch = batch;
+	}
+
+	return batch->pb;
+}
+
+int host1x_gr2d_batch_clear_rect(struct host1x_gr2d_batch *batch,
+				 struct host1x_pixelbuffer *pixbuf,
+				 uint32_t color,
+				 unsigned x, unsigned y,
+				 unsigned width, unsigned height)
+{
+	struct host1x_pushbuf *pb;
+
+	pb = host1x_gr2d_batch_reserve(batch);
+	if (!pb)
+		return -ENOMEM;
+
+	return host1x_gr2d_push_clear_rect(pb, pixbuf, color, x, y,
+					   width, height);
+}
+
+int host1x_gr2d_batch_blit(struct host1x_gr2d_batch *batch,
+			   struct host1x_pixelbuffer *src,
+			   struct host1x_pixelbuffer *dst,
+			   unsigned int sx, unsigned int sy,
+			   unsigned int dx, unsigned int dy,
+			   unsigned int width, int height)
+{
+	struct host1x_pushbuf *pb;
+
+	pb = host1x_gr2d_batch_reserve(batch);
+	if (!pb)
+		return -ENOMEM;
+
+	return host1x_gr2d_push_blit(pb, src, dst, sx, sy, dx, dy,
+				     width, height);
+}
+
+int host1x_gr2d_batch_surface_blit(struct host1x_gr2d_batch *batch,
+				   struct host1x_pixelbuffer *src,
+				   struct host1x_pixelbuffer *dst,
+				   unsigned int sx, unsigned int sy,
+				   unsigned int src_width, int src_height,
+				   unsigned int dx, unsigned int dy,
+				   unsigned int dst_width, int dst_height)
+{
+	struct host1x_pushbuf *pb;
+
+	pb = host1x_gr2d_batch_reserve(batch);
+	if (!pb)
+		return -ENOMEM;
+
+	return host1x_gr2d_push_surface_blit(pb, src, NULL, 0, dst, sx, sy,
+					     src_width, src_height, dx, dy,
+					     dst_width, dst_height);
+}
+
+int host1x_gr2d_batch_yuv_blit(struct host1x_gr2d_batch *batch,
+			       const struct host1x_yuv_frame *src,
+			       enum host1x_csc csc,
+			       struct host1x_pixelbuffer *dst,
+			       unsigned int sx, unsigned int sy,
+			       unsigned int src_width, int src_height,
+			       unsigned int dx, unsigned int dy,
+			       unsigned int dst_width, int dst_height)
+{
+	struct host1x_pushbuf *pb;
+
+	pb = host1x_gr2d_batch_reserve(batch);
+	if (!pb)
+		return -ENOMEM;
+
+	return host1x_gr2d_push_surface_blit(pb, src->y, src, csc, dst,
+					     sx, sy, src_width, src_height,
+					     dx, dy, dst_width, dst_height);
+}
+
+int host1x_gr2d_batch_rotate_blit(struct host1x_gr2d_batch *batch,
+				  struct host1x_pixelbuffer *src,
+				  struct host1x_pixelbuffer *dst,
+				  enum host1x_gr2d_rotation rotation,
+				  unsigned int sx, unsigned int sy,
+				  unsigned int dx, unsigned int dy,
+				  unsigned int width, unsigned int height)
+{
+	struct host1x_pushbuf *pb;
+
+	pb = host1x_gr2d_batch_reserve(batch);
+	if (!pb)
+		return -ENOMEM;
+
+	return host1x_gr2d_push_rotate_blit(pb, src, dst, rotation, sx, sy,
+					    dx, dy, width, height);
+}
+
+/*
+ * Submits the recorded operations and ends the batch. If nothing was
+ * recorded, the fence of the last GR2D job is returned.
+ */
+int host1x_gr2d_batch_submit(struct host1x_gr2d_batch *batch,
+			     uint32_t *fence)
+{
+	int err = 0;
+
+	if (batch->job)
+		err = host1x_gr2d_batch_flush(batch);
+
+	batch->gr2d->batch = NULL;
+
 	if (err < 0)
 		return err;
 
-	host1x_pixelbuffer_check_guard(dst);
+	if (fence)
+		*fence = batch->gr2d->fence;
 
 	return 0;
 }
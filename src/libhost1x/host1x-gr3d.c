@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
@@ -48,7 +49,7 @@ static int host1x_gr3d_test(struct host1x_gr3d *gr3d)
 	if (!job)
 		return -ENOMEM;
 
-	pb = HOST1X_JOB_APPEND(job, gr3d->commands, 0);
+	pb = host1x_ring_append(&gr3d->ring, job, 3);
 	if (!pb) {
 		host1x_job_free(job);
 		return -ENOMEM;
@@ -64,9 +65,14 @@ static int host1x_gr3d_test(struct host1x_gr3d *gr3d)
 		return err;
 	}
 
-	host1x_job_free(job);
-
 	err = HOST1X_CLIENT_FLUSH(gr3d->client, &fence);
+	if (err < 0) {
+		host1x_job_free(job);
+		return err;
+	}
+
+	err = host1x_ring_commit(&gr3d->ring, pb, fence);
+	host1x_job_free(job);
 	if (err < 0)
 		return err;
 
@@ -299,10 +305,52 @@ int host1x_push_gr3d_reset(struct host1x_pushbuf *pb)
 	return 0;
 }
 
-static int host1x_gr3d_reset(struct host1x_gr3d *gr3d)
+static int host1x_gr3d_build_reset(struct host1x *host1x,
+				   struct host1x_gr3d *gr3d)
+{
+	struct host1x_syncpt *syncpt = &gr3d->client->syncpts[0];
+	struct host1x_pushbuf *pb = &gr3d->reset;
+	int err;
+
+	gr3d->reset_bo = host1x_bo_create(host1x,
+					  (HOST1X_GR3D_RESET_WORDS + 3) * 4,
+					  NVHOST_BO_FLAG_COMMAND_BUFFER |
+					  HOST1X_BO_MAP_WRITE_COMBINE);
+	if (!gr3d->reset_bo)
+		return -ENOMEM;
+
+	err = HOST1X_BO_MMAP(gr3d->reset_bo, NULL);
+	if (err < 0) {
+		host1x_bo_free(gr3d->reset_bo);
+		return err;
+	}
+
+	memset(pb, 0, sizeof(*pb));
+	pb->bo = gr3d->reset_bo;
+	pb->ptr = gr3d->reset_bo->ptr;
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0x000, 0x060, 0x00));
+	host1x_push_gr3d_reset(pb);
+
+	/* the ring isn't used, recovery may run while it's reserved */
+	pb = &gr3d->reset_incr;
+	memset(pb, 0, sizeof(*pb));
+	pb->bo = gr3d->reset_bo;
+	pb->offset = gr3d->reset.length * 4;
+	pb->ptr = gr3d->reset_bo->ptr + pb->offset;
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 0x01));
+	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+
+	HOST1X_BO_FLUSH(gr3d->reset_bo, gr3d->reset_bo->offset,
+			(gr3d->reset.length + pb->length) * 4);
+
+	return 0;
+}
+
+static int host1x_gr3d_reset(struct host1x_gr3d *gr3d, bool wait)
 {
 	struct host1x_syncpt *syncpt = &gr3d->client->syncpts[0];
-	struct host1x_pushbuf *pb;
 	struct host1x_job *job;
 	uint32_t fence;
 	int err;
@@ -311,22 +359,27 @@ static int host1x_gr3d_reset(struct host1x_gr3d *gr3d)
 	if (!job)
 		return -ENOMEM;
 
-	pb = HOST1X_JOB_APPEND(job, gr3d->commands, 0);
-	if (!pb)
+	if (!host1x_job_append_pushbuf(job, &gr3d->reset) ||
+	    !host1x_job_append_pushbuf(job, &gr3d->reset_incr)) {
+		host1x_job_free(job);
 		return -ENOMEM;
-
-	host1x_push_gr3d_reset(pb);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 0x01));
-	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+	}
 
 	err = HOST1X_CLIENT_SUBMIT(gr3d->client, job);
-	if (err < 0)
+	if (err < 0) {
+		host1x_job_free(job);
 		return err;
+	}
 
 	err = HOST1X_CLIENT_FLUSH(gr3d->client, &fence);
+	host1x_job_free(job);
 	if (err < 0)
 		return err;
 
+	/* jobs of the channel run in order, later ones follow the reset */
+	if (!wait)
+		return 0;
+
 	err = HOST1X_CLIENT_WAIT(gr3d->client, fence, ~0u);
 	if (err < 0)
 		return err;
@@ -334,12 +387,18 @@ static int host1x_gr3d_reset(struct host1x_gr3d *gr3d)
 	return 0;
 }
 
-int host1x_gr3d_init(struct host1x *host1x, struct host1x_gr3d *gr3d)
+/* called with the engine setup lock held, see host1x_get_gr3d() */
+int host1x_gr3d_setup(struct host1x_gr3d *gr3d)
 {
+	struct host1x *host1x = gr3d->host1x;
 	int err;
 
+	if (gr3d->ready)
+		return 0;
+
 	gr3d->commands = host1x_bo_create(host1x, 32 * 4096,
-					  NVHOST_BO_FLAG_COMMAND_BUFFER);
+					  NVHOST_BO_FLAG_COMMAND_BUFFER |
+					  HOST1X_BO_MAP_WRITE_COMBINE);
 	if (!gr3d->commands)
 		return -ENOMEM;
 
@@ -349,8 +408,11 @@ int host1x_gr3d_init(struct host1x *host1x, struct host1x_gr3d *gr3d)
 		return err;
 	}
 
+	host1x_ring_init(&gr3d->ring, gr3d->client, gr3d->commands);
+
 	gr3d->attributes = host1x_bo_create(host1x, 12 * 4096,
-					    NVHOST_BO_FLAG_ATTRIBUTES);
+					    NVHOST_BO_FLAG_ATTRIBUTES |
+					    HOST1X_BO_MAP_WRITE_COMBINE);
 	if (!gr3d->attributes) {
 		host1x_bo_free(gr3d->commands);
 		return -ENOMEM;
@@ -373,18 +435,61 @@ int host1x_gr3d_init(struct host1x *host1x, struct host1x_gr3d *gr3d)
 		}
 	}
 
-	err = host1x_gr3d_reset(gr3d);
+	err = host1x_gr3d_build_reset(host1x, gr3d);
 	if (err < 0) {
 		host1x_bo_free(gr3d->attributes);
 		host1x_bo_free(gr3d->commands);
 		return err;
 	}
 
+	err = host1x_gr3d_reset(gr3d, true);
+	if (err < 0) {
+		host1x_bo_free(gr3d->reset_bo);
+		host1x_bo_free(gr3d->attributes);
+		host1x_bo_free(gr3d->commands);
+		return err;
+	}
+
+	__atomic_store_n(&gr3d->ready, true, __ATOMIC_RELEASE);
+
 	return 0;
 }
 
+/*
+ * The state of the engine is unknown after a hang, start over from reset.
+ * Called by the submission following the hang, ahead of its job.
+ */
+static int host1x_gr3d_recover(struct host1x_client *client, void *data)
+{
+	struct host1x_gr3d *gr3d = data;
+
+	if (!__atomic_load_n(&gr3d->ready, __ATOMIC_ACQUIRE))
+		return 0;
+
+	return host1x_gr3d_reset(gr3d, false);
+}
+
+int host1x_gr3d_init(struct host1x *host1x, struct host1x_gr3d *gr3d)
+{
+	gr3d->host1x = host1x;
+	gr3d->client->timeout = host1x->options->job_timeout ?:
+				HOST1X_JOB_TIMEOUT_MS;
+	gr3d->client->recover = host1x_gr3d_recover;
+	gr3d->client->recover_data = gr3d;
+
+	if (host1x->options->lazy_init)
+		return 0;
+
+	return host1x_gr3d_setup(gr3d);
+}
+
 void host1x_gr3d_exit(struct host1x_gr3d *gr3d)
 {
+	if (!gr3d->ready)
+		return;
+
+	host1x_ring_wait_idle(&gr3d->ring);
+	host1x_bo_free(gr3d->reset_bo);
 	host1x_bo_free(gr3d->attributes);
 	host1x_bo_free(gr3d->commands);
 }
@@ -462,7 +567,7 @@ int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
 	    commands: 103
 	*/
 
-	pb = HOST1X_JOB_APPEND(job, gr3d->commands, 0);
+	pb = host1x_ring_append(&gr3d->ring, job, 256);
 	if (!pb) {
 		host1x_job_free(job);
 		return -ENOMEM;
@@ -715,9 +820,14 @@ int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
 		return err;
 	}
 
-	host1x_job_free(job);
-
 	err = HOST1X_CLIENT_FLUSH(gr3d->client, &fence);
+	if (err < 0) {
+		host1x_job_free(job);
+		return err;
+	}
+
+	err = host1x_ring_commit(&gr3d->ring, pb, fence);
+	host1x_job_free(job);
 	if (err < 0)
 		return err;
 
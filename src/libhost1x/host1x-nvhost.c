@@ -54,8 +54,8 @@ static int nvhost_bo_flush(struct host1x_bo *bo, unsigned long offset,
 {
 	struct nvhost_bo *nbo = to_nvhost_bo(bo);
 
-	return nvmap_handle_writeback_invalidate(nbo->nvmap, nbo->handle,
-						 offset, length);
+	return nvmap_handle_writeback_deferred(nbo->nvmap, nbo->handle,
+					       offset, length);
 }
 
 static void nvhost_bo_free(struct host1x_bo *bo)
@@ -65,7 +65,7 @@ static void nvhost_bo_free(struct host1x_bo *bo)
 	if (bo->wrapped)
 		return free(nbo);
 
-	nvmap_handle_free(nbo->nvmap, nbo->handle);
+	nvmap_handle_pool_put(nbo->nvmap, nbo->handle);
 
 	free(nbo);
 }
@@ -88,7 +88,7 @@ static struct host1x_bo *nvhost_bo_create(struct host1x *host1x,
 					  size_t size, unsigned long flags)
 {
 	struct nvhost *nvhost = to_nvhost(host1x);
-	unsigned long heap_mask, align;
+	unsigned long heap_mask, align, map;
 	struct nvhost_bo *bo;
 	int err;
 
@@ -99,13 +99,10 @@ static struct host1x_bo *nvhost_bo_create(struct host1x *host1x,
 	bo->nvmap = nvhost->nvmap;
 	bo->base.priv = priv;
 
-	bo->handle = nvmap_handle_create(nvhost->nvmap, size);
-	if (!bo->handle) {
-		free(bo);
-		return NULL;
-	}
+	map = flags & HOST1X_BO_MAP_MASK;
 
-	switch (flags & ~HOST1X_BO_CREATE_DRM_FLAGS_MASK) {
+	switch (flags & ~(HOST1X_BO_CREATE_DRM_FLAGS_MASK |
+			  HOST1X_BO_MAP_MASK)) {
 	case NVHOST_BO_FLAG_FRAMEBUFFER:
 		heap_mask = NVMAP_HEAP_CARVEOUT_GENERIC;
 		flags = NVMAP_HANDLE_WRITE_COMBINE;
@@ -137,13 +134,38 @@ static struct host1x_bo *nvhost_bo_create(struct host1x *host1x,
 		break;
 	}
 
-	/* XXX what to use for flags and heap_mask? */
-	err = nvmap_handle_alloc(nvhost->nvmap, bo->handle, heap_mask, flags,
-				 align);
-	if (err < 0) {
-		nvmap_handle_free(nvhost->nvmap, bo->handle);
-		free(bo);
-		return NULL;
+	switch (map) {
+	case HOST1X_BO_MAP_WRITE_COMBINE:
+		flags = NVMAP_HANDLE_WRITE_COMBINE;
+		break;
+
+	case HOST1X_BO_MAP_CACHED:
+		flags = NVMAP_HANDLE_CACHEABLE;
+		break;
+
+	case HOST1X_BO_MAP_UNCACHED:
+		flags = NVMAP_HANDLE_UNCACHEABLE;
+		break;
+	}
+
+	/* handles too large for the pool are allocated on their own */
+	bo->handle = nvmap_handle_pool_get(nvhost->nvmap, size, heap_mask,
+					   flags, align);
+	if (!bo->handle) {
+		bo->handle = nvmap_handle_create(nvhost->nvmap, size);
+		if (!bo->handle) {
+			free(bo);
+			return NULL;
+		}
+
+		/* XXX what to use for flags and heap_mask? */
+		err = nvmap_handle_alloc(nvhost->nvmap, bo->handle, heap_mask,
+					 flags, align);
+		if (err < 0) {
+			nvmap_handle_free(nvhost->nvmap, bo->handle);
+			free(bo);
+			return NULL;
+		}
 	}
 
 	bo->base.handle = bo->handle->id;
@@ -168,6 +190,16 @@ static void host1x_nvhost_close(struct host1x *host1x)
 	nvmap_close(nvhost->nvmap);
 }
 
+static void host1x_nvhost_flush_batch_begin(struct host1x *host1x)
+{
+	nvmap_batch_begin(to_nvhost(host1x)->nvmap);
+}
+
+static int host1x_nvhost_flush_batch_end(struct host1x *host1x)
+{
+	return nvmap_batch_end(to_nvhost(host1x)->nvmap);
+}
+
 static int nvhost_framebuffer_init(struct host1x *host1x,
 				   struct host1x_framebuffer *fb)
 {
@@ -229,6 +261,8 @@ struct host1x *host1x_nvhost_open(struct host1x_options *options)
 
 	nvhost->base.bo_create = nvhost_bo_create;
 	nvhost->base.close = host1x_nvhost_close;
+	nvhost->base.flush_batch_begin = host1x_nvhost_flush_batch_begin;
+	nvhost->base.flush_batch_end = host1x_nvhost_flush_batch_end;
 	nvhost->base.options = options;
 
 	nvhost->gr2d = nvhost_gr2d_open(nvhost);
@@ -0,0 +1,450 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+#include "tgr_3d.xml.h"
+
+/*
+ * Peephole optimizer of pushbufs. The last value written to each state
+ * register of the 3D class is tracked from the start of the pushbuf and
+ * writes of the same value are dropped. The surviving writes are encoded
+ * into as few opcodes as their order allows, relocations move along with
+ * their words. Upload ports, triggers and registers the optimizer doesn't
+ * know are never dropped.
+ */
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+#define OPT_NUM_REGS	4096
+
+#define OPCODE(word)	((word) >> 28)
+
+enum {
+	OPCODE_SETCL,
+	OPCODE_INCR,
+	OPCODE_NONINCR,
+	OPCODE_MASK,
+	OPCODE_IMM,
+	OPCODE_RESTART,
+	OPCODE_GATHER,
+	OPCODE_EXTEND = 14,
+	OPCODE_CHDONE = 15,
+};
+
+/* registers of the 3D class that only hold state */
+static const struct {
+	uint16_t first;
+	uint16_t last;
+} opt_state_regs[] = {
+	{ TGR3D_ATTRIB_PTR(0), TGR3D_ATTRIB_MODE(15) },
+	{ TGR3D_VP_ATTRIB_IN_OUT_SELECT, TGR3D_DRAW_PARAMS },
+	{ TGR3D_LINKER_INSTRUCTION(0), TGR3D_LINKER_INSTRUCTION(31) + 1 },
+	{ TGR3D_CULL_FACE_LINKER_SETUP, TGR3D_GUARDBAND_DEPTH },
+	{ TGR3D_STENCIL_FRONT1, TGR3D_DEPTH_RANGE_FAR },
+	{ TGR3D_FP_PSEQ_ENGINE_INST, TGR3D_FP_PSEQ_ENGINE_INST },
+	{ TGR3D_FP_PSEQ_QUAD_ID, TGR3D_FP_PSEQ_DW_CFG },
+	{ TGR3D_TEXTURE_POINTER(0), TGR3D_TEXTURE_DESC2(15) },
+	{ TGR3D_FP_CONST(0), TGR3D_FP_CONST(31) },
+	{ TGR3D_RT_ENABLE, TGR3D_RT_ENABLE },
+	{ TGR3D_RT_PTR(0), TGR3D_RT_PARAMS(15) },
+	{ TGR3D_ALU_BUFFER_SIZE, TGR3D_TRAM_SETUP },
+	{ TGR3D_DITHER, TGR3D_DITHER },
+	{ TGR3D_STENCIL_FRONT2, TGR3D_STENCIL_BACK2 },
+};
+
+struct opt_write {
+	uint16_t offset;
+	int reloc;
+	uint32_t value;
+};
+
+struct host1x_optimizer {
+	const uint32_t *in;
+	unsigned long length;
+	uint32_t classid;
+
+	uint32_t *out;
+	unsigned long num_out;
+
+	/* relocation of every input word, or -1 */
+	int *reloc_at;
+	unsigned long *reloc_offsets;
+
+	/* pending writes of the 3D class, in stream order */
+	struct opt_write *writes;
+	unsigned int num_writes;
+
+	uint32_t values[OPT_NUM_REGS];
+	uint8_t known[OPT_NUM_REGS];
+};
+
+/* pushbufs of different channels may be optimized concurrently */
+static pthread_once_t opt_state_once = PTHREAD_ONCE_INIT;
+static uint8_t opt_state[OPT_NUM_REGS / 8];
+
+static void opt_state_init(void)
+{
+	unsigned int i, k;
+
+	for (i = 0; i < ARRAY_SIZE(opt_state_regs); i++)
+		for (k = opt_state_regs[i].first;
+		     k <= opt_state_regs[i].last; k++)
+			opt_state[k / 8] |= 1 << (k % 8);
+}
+
+static bool opt_state_reg(unsigned int offset)
+{
+	return opt_state[offset / 8] & (1 << (offset % 8));
+}
+
+static void opt_emit(struct host1x_optimizer *opt, uint32_t word, int reloc)
+{
+	if (reloc >= 0)
+		opt->reloc_offsets[reloc] = opt->num_out * 4;
+
+	opt->out[opt->num_out++] = word;
+}
+
+static void opt_copy(struct host1x_optimizer *opt, unsigned long pos,
+		     unsigned long count)
+{
+	while (count--) {
+		opt_emit(opt, opt->in[pos], opt->reloc_at[pos]);
+		pos++;
+	}
+}
+
+static void opt_write(struct host1x_optimizer *opt, unsigned int offset,
+		      unsigned long pos)
+{
+	uint32_t value = opt->in[pos];
+	struct opt_write *write;
+	int reloc = opt->reloc_at[pos];
+
+	offset %= OPT_NUM_REGS;
+
+	if (opt_state_reg(offset)) {
+		/* the address a relocation patches in isn't known */
+		if (reloc < 0 && opt->known[offset] &&
+		    opt->values[offset] == value)
+			return;
+
+		opt->known[offset] = reloc < 0;
+		opt->values[offset] = value;
+	}
+
+	write = &opt->writes[opt->num_writes++];
+	write->offset = offset;
+	write->value = value;
+	write->reloc = reloc;
+}
+
+/* length of the run of writes starting at the given one for each opcode */
+static unsigned int opt_run(const struct host1x_optimizer *opt,
+			    unsigned int first, unsigned int opcode)
+{
+	const struct opt_write *w = &opt->writes[first];
+	unsigned int i, max = MIN(opt->num_writes - first, 0xffff);
+
+	for (i = 1; i < max; i++) {
+		if (opcode == OPCODE_INCR && w[i].offset != w[i - 1].offset + 1)
+			break;
+
+		if (opcode == OPCODE_NONINCR && w[i].offset != w[0].offset)
+			break;
+
+		if (opcode == OPCODE_MASK && (w[i].offset <= w[i - 1].offset ||
+					      w[i].offset - w[0].offset > 15))
+			break;
+	}
+
+	return i;
+}
+
+/*
+ * An immediate takes a single word, which no run beats. Otherwise the
+ * longest run has the least opcode overhead.
+ */
+static void opt_flush(struct host1x_optimizer *opt)
+{
+	unsigned int i = 0, k, incr, nonincr, mask, pending;
+	const struct opt_write *w;
+
+	while (i < opt->num_writes) {
+		w = &opt->writes[i];
+
+		if (w->reloc < 0 && w->value <= 0xffff) {
+			opt_emit(opt, HOST1X_OPCODE_IMM(w->offset, w->value),
+				 -1);
+			i++;
+			continue;
+		}
+
+		incr = opt_run(opt, i, OPCODE_INCR);
+		nonincr = opt_run(opt, i, OPCODE_NONINCR);
+		mask = opt_run(opt, i, OPCODE_MASK);
+
+		if (incr >= nonincr && incr >= mask) {
+			opt_emit(opt, HOST1X_OPCODE_INCR(w->offset, incr), -1);
+			pending = incr;
+		} else if (nonincr >= mask) {
+			opt_emit(opt, HOST1X_OPCODE_NONINCR(w->offset, nonincr),
+				 -1);
+			pending = nonincr;
+		} else {
+			uint32_t bits = 0;
+
+			for (k = 0; k < mask; k++)
+				bits |= 1 << (w[k].offset - w->offset);
+
+			opt_emit(opt, HOST1X_OPCODE_MASK(w->offset, bits), -1);
+			pending = mask;
+		}
+
+		for (k = 0; k < pending; k++)
+			opt_emit(opt, w[k].value, w[k].reloc);
+
+		i += pending;
+	}
+
+	opt->num_writes = 0;
+}
+
+static int opt_run_stream(struct host1x_optimizer *opt)
+{
+	unsigned long pos = 0, count, i;
+	unsigned int offset, mask;
+	uint32_t word;
+
+	while (pos < opt->length) {
+		word = opt->in[pos];
+		offset = (word >> 16) & 0xfff;
+
+		/* relocations patch data words only */
+		if (opt->reloc_at[pos] >= 0)
+			return -EINVAL;
+
+		switch (OPCODE(word)) {
+		case OPCODE_SETCL:
+			mask = word & 0x3f;
+			count = __builtin_popcount(mask);
+
+			if (pos + 1 + count > opt->length)
+				return -EINVAL;
+
+			opt_flush(opt);
+
+			if (((word >> 6) & 0x3ff) != HOST1X_CLASS_GR3D) {
+				opt->classid = (word >> 6) & 0x3ff;
+				opt_copy(opt, pos, 1 + count);
+				pos += 1 + count;
+				break;
+			}
+
+			/* the class is set already */
+			if (opt->classid != HOST1X_CLASS_GR3D)
+				opt_emit(opt, HOST1X_OPCODE_SETCL(0,
+						HOST1X_CLASS_GR3D, 0), -1);
+
+			opt->classid = HOST1X_CLASS_GR3D;
+			pos++;
+
+			for (i = 0; i < 6; i++)
+				if (mask & (1 << i))
+					opt_write(opt, offset + i, pos++);
+			break;
+
+		case OPCODE_INCR:
+		case OPCODE_NONINCR:
+		case OPCODE_MASK:
+			if (OPCODE(word) == OPCODE_MASK)
+				count = __builtin_popcount(word & 0xffff);
+			else
+				count = word & 0xffff;
+
+			if (pos + 1 + count > opt->length)
+				return -EINVAL;
+
+			if (opt->classid != HOST1X_CLASS_GR3D) {
+				opt_copy(opt, pos, 1 + count);
+				pos += 1 + count;
+				break;
+			}
+
+			pos++;
+
+			for (i = 0; i < 16 && OPCODE(word) == OPCODE_MASK; i++)
+				if (word & (1 << i))
+					opt_write(opt, offset + i, pos++);
+
+			for (i = 0; i < count && OPCODE(word) != OPCODE_MASK;
+			     i++)
+				opt_write(opt, OPCODE(word) == OPCODE_INCR ?
+					  offset + i : offset, pos++);
+			break;
+
+		case OPCODE_IMM:
+			if (opt->classid != HOST1X_CLASS_GR3D) {
+				opt_copy(opt, pos++, 1);
+				break;
+			}
+
+			/* a write of the opcode word itself */
+			if (opt_state_reg(offset) && opt->known[offset] &&
+			    opt->values[offset] == (word & 0xffff)) {
+				pos++;
+				break;
+			}
+
+			opt_flush(opt);
+			opt_copy(opt, pos++, 1);
+
+			if (opt_state_reg(offset)) {
+				opt->known[offset] = true;
+				opt->values[offset] = word & 0xffff;
+			}
+			break;
+
+		case OPCODE_GATHER:
+			if (pos + 2 > opt->length)
+				return -EINVAL;
+
+			/* the gathered words may write any register */
+			opt_flush(opt);
+			opt_copy(opt, pos, 2);
+			memset(opt->known, 0, sizeof(opt->known));
+			pos += 2;
+			break;
+
+		case OPCODE_EXTEND:
+		case OPCODE_CHDONE:
+			opt_flush(opt);
+			opt_copy(opt, pos++, 1);
+			break;
+
+		case OPCODE_RESTART:
+			/* the words up to the restart may be executed later */
+			opt_flush(opt);
+			opt_copy(opt, pos, opt->length - pos);
+			pos = opt->length;
+			break;
+
+		default:
+			return -EINVAL;
+		}
+	}
+
+	opt_flush(opt);
+
+	return 0;
+}
+
+/*
+ * Rewrites the pushbuf in place and returns the number of words saved.
+ * Pushbufs that run as a part of other jobs as well are left alone, as is
+ * a pushbuf that the optimizer doesn't understand.
+ */
+int host1x_pushbuf_optimize(struct host1x_pushbuf *pb)
+{
+	struct host1x_optimizer *opt;
+	unsigned long i, index;
+	uint32_t *words;
+	int err;
+
+	if (pb->shared || !pb->length)
+		return 0;
+
+	pthread_once(&opt_state_once, opt_state_init);
+
+	words = (uint32_t *)((uint8_t *)pb->bo->ptr + pb->offset);
+
+	opt = calloc(1, sizeof(*opt));
+	if (!opt)
+		return -ENOMEM;
+
+	opt->in = words;
+	opt->length = pb->length;
+	/* a write takes two words at most, if it becomes an opcode of its own */
+	opt->out = malloc(pb->length * 2 * sizeof(*opt->out));
+	opt->writes = malloc(pb->length * sizeof(*opt->writes));
+	opt->reloc_at = malloc(pb->length * sizeof(*opt->reloc_at));
+	opt->reloc_offsets = malloc((pb->num_relocs + 1) *
+				    sizeof(*opt->reloc_offsets));
+
+	err = -ENOMEM;
+
+	if (!opt->out || !opt->writes || !opt->reloc_at ||
+	    !opt->reloc_offsets)
+		goto out;
+
+	for (i = 0; i < pb->length; i++)
+		opt->reloc_at[i] = -1;
+
+	err = -EINVAL;
+
+	for (i = 0; i < pb->num_relocs; i++) {
+		index = (pb->relocs[i].source_offset - pb->offset) / 4;
+
+		if (pb->relocs[i].source_offset < pb->offset ||
+		    pb->relocs[i].source_offset % 4 || index >= pb->length ||
+		    opt->reloc_at[index] >= 0)
+			goto out;
+
+		opt->reloc_at[index] = i;
+	}
+
+	err = opt_run_stream(opt);
+	if (err < 0)
+		goto out;
+
+	err = 0;
+
+	if (opt->num_out >= pb->length)
+		goto out;
+
+	memcpy(words, opt->out, opt->num_out * sizeof(*words));
+
+	for (i = 0; i < pb->num_relocs; i++)
+		pb->relocs[i].source_offset = pb->offset +
+					      opt->reloc_offsets[i];
+
+	err = pb->length - opt->num_out;
+
+	pb->length = opt->num_out;
+	pb->ptr = words + opt->num_out;
+
+out:
+	free(opt->reloc_offsets);
+	free(opt->reloc_at);
+	free(opt->writes);
+	free(opt->out);
+	free(opt);
+
+	return err;
+}
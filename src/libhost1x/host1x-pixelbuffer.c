@@ -25,12 +25,61 @@
 
 #define PIXBUF_GUARD_PATTERN	0xF5132803
 
+#include <errno.h>
+#include <pthread.h>
 #include <string.h>
+
 #include "host1x-private.h"
 
-static bool pixbuf_guard_disabled;
+#define PIXBUF_GUARD_QUEUE_SIZE	64
+
+static enum host1x_pixbuf_guard_mode pixbuf_guard_mode =
+						HOST1X_PIXBUF_GUARD_SYNC;
+static unsigned int pixbuf_guard_interval = 1;
+static unsigned int pixbuf_guard_checks;
+
+/* pixelbuffers waiting for the background check, NULL once freed */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool started;
+	struct host1x_pixelbuffer *queue[PIXBUF_GUARD_QUEUE_SIZE];
+	unsigned int head;
+	unsigned int tail;
+	struct host1x_pixelbuffer *checking;
+} guard_worker = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
 
-struct host1x_pixelbuffer *host1x_pixelbuffer_create(
+/*
+ * The 16x16 tiles keep the pixels of a GPU access close to each other,
+ * which pays off once the buffer spans a few tiles in both directions.
+ * Smaller buffers would mostly waste the alignment of the tiled layout,
+ * compressed formats aren't tiled.
+ */
+#define PIXBUF_AUTO_TILED_MIN	64
+
+enum layout_format host1x_pixelbuffer_auto_layout(unsigned width,
+						 unsigned height,
+						 enum pixel_format format)
+{
+	if (PIX_BUF_FORMAT_COMPRESSED(format))
+		return PIX_BUF_LAYOUT_LINEAR;
+
+	if (width < PIXBUF_AUTO_TILED_MIN || height < PIXBUF_AUTO_TILED_MIN)
+		return PIX_BUF_LAYOUT_LINEAR;
+
+	return PIX_BUF_LAYOUT_TILED_16x16;
+}
+
+/*
+ * Describes the pixelbuffer without allocating its BO, which is done by
+ * host1x_pixelbuffer_populate() on the first bind, upload or clear.
+ * Pixelbuffers that are never used take no memory.
+ */
+struct host1x_pixelbuffer *host1x_pixelbuffer_create_lazy(
 				struct host1x *host1x,
 				unsigned width, unsigned height,
 				unsigned pitch,
@@ -45,6 +94,9 @@ struct host1x_pixelbuffer *host1x_pixelbuffer_create(
 	if (!pixbuf)
 		return NULL;
 
+	if (layout == PIX_BUF_LAYOUT_AUTO)
+		layout = host1x_pixelbuffer_auto_layout(width, height, format);
+
 	if (layout == PIX_BUF_LAYOUT_TILED_16x16)
 		pitch = ALIGN(pitch, 256);
 
@@ -59,7 +111,7 @@ struct host1x_pixelbuffer *host1x_pixelbuffer_create(
 
 	bo_size = pixbuf->pitch * height;
 
-	if (!pixbuf_guard_disabled)
+	if (pixbuf_guard_mode != HOST1X_PIXBUF_GUARD_OFF)
 		bo_size += PIXBUF_GUARD_AREA_SIZE * 2;
 
 	if (layout == PIX_BUF_LAYOUT_TILED_16x16)
@@ -67,35 +119,197 @@ struct host1x_pixelbuffer *host1x_pixelbuffer_create(
 
 	flags |= HOST1X_BO_CREATE_FLAG_BOTTOM_UP;
 
-	pixbuf->bo = HOST1X_BO_CREATE(host1x, bo_size, flags);
-	if (!pixbuf->bo) {
+	pixbuf->lazy.host1x = host1x;
+	pixbuf->lazy.size = bo_size;
+	pixbuf->lazy.flags = flags;
+	pixbuf->lazy.guard = pixbuf_guard_mode != HOST1X_PIXBUF_GUARD_OFF;
+
+	return pixbuf;
+}
+
+int host1x_pixelbuffer_alloc_bo(struct host1x_pixelbuffer *pixbuf)
+{
+	if (pixbuf->bo)
+		return 0;
+
+	if (!pixbuf->lazy.host1x) {
+		host1x_error("invalid: pixelbuffer has no BO\n");
+		return -EINVAL;
+	}
+
+	pixbuf->bo = HOST1X_BO_CREATE(pixbuf->lazy.host1x, pixbuf->lazy.size,
+				      pixbuf->lazy.flags);
+	if (!pixbuf->bo)
+		return -ENOMEM;
+
+	/* the guards were accounted for at creation time */
+	if (pixbuf->lazy.guard) {
+		pixbuf->bo->offset += PIXBUF_GUARD_AREA_SIZE;
+		host1x_pixelbuffer_setup_guard(pixbuf);
+	}
+
+	return 0;
+}
+
+struct host1x_pixelbuffer *host1x_pixelbuffer_create(
+				struct host1x *host1x,
+				unsigned width, unsigned height,
+				unsigned pitch,
+				enum pixel_format format,
+				enum layout_format layout)
+{
+	struct host1x_pixelbuffer *pixbuf;
+
+	pixbuf = host1x_pixelbuffer_create_lazy(host1x, width, height, pitch,
+						format, layout);
+	if (!pixbuf)
+		return NULL;
+
+	if (host1x_pixelbuffer_alloc_bo(pixbuf) < 0) {
 		free(pixbuf);
 		return NULL;
 	}
 
-	if (!pixbuf_guard_disabled)
-		pixbuf->bo->offset += PIXBUF_GUARD_AREA_SIZE;
+	return pixbuf;
+}
+
+/*
+ * Describe an existing BO, like an imported dma-buf, as a pixelbuffer.
+ * The pixelbuffer takes over the BO, which has no guard areas.
+ */
+struct host1x_pixelbuffer *host1x_pixelbuffer_wrap(
+				struct host1x_bo *bo,
+				unsigned width, unsigned height,
+				unsigned pitch,
+				enum pixel_format format,
+				enum layout_format layout)
+{
+	struct host1x_pixelbuffer *pixbuf;
+	unsigned rows = height;
+
+	if (layout == PIX_BUF_LAYOUT_AUTO) {
+		host1x_error("invalid: layout of existing data must be given\n");
+		return NULL;
+	}
+
+	if (layout == PIX_BUF_LAYOUT_TILED_16x16)
+		rows = ALIGN(height, 16);
+
+	if (bo->size && (size_t)pitch * rows > bo->size) {
+		host1x_error("invalid: %ux%u pitch %u doesn't fit BO of %zu bytes\n",
+			     width, height, pitch, bo->size);
+		return NULL;
+	}
+
+	pixbuf = calloc(1, sizeof(*pixbuf));
+	if (!pixbuf)
+		return NULL;
 
-	host1x_pixelbuffer_setup_guard(pixbuf);
+	pixbuf->bo = bo;
+	pixbuf->pitch = pitch;
+	pixbuf->width = width;
+	pixbuf->height = height;
+	pixbuf->format = format;
+	pixbuf->layout = layout;
 
 	return pixbuf;
 }
 
+/* makes sure that the background check doesn't touch the pixelbuffer */
+static void host1x_pixelbuffer_guard_forget(struct host1x_pixelbuffer *pixbuf)
+{
+	unsigned int i;
+
+	if (!__atomic_load_n(&guard_worker.started, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_mutex_lock(&guard_worker.lock);
+
+	for (i = guard_worker.head; i != guard_worker.tail; i++)
+		if (guard_worker.queue[i % PIXBUF_GUARD_QUEUE_SIZE] == pixbuf)
+			guard_worker.queue[i % PIXBUF_GUARD_QUEUE_SIZE] = NULL;
+
+	while (guard_worker.checking == pixbuf)
+		pthread_cond_wait(&guard_worker.cond, &guard_worker.lock);
+
+	pthread_mutex_unlock(&guard_worker.lock);
+}
+
 void host1x_pixelbuffer_free(struct host1x_pixelbuffer *pixbuf)
 {
-	host1x_bo_free(pixbuf->bo);
+	if (pixbuf->guarded)
+		host1x_pixelbuffer_guard_forget(pixbuf);
+
+	if (pixbuf->bo)
+		host1x_bo_free(pixbuf->bo);
+
 	free(pixbuf);
 }
 
-int host1x_pixelbuffer_load_data(struct host1x *host1x,
-				 struct host1x_pixelbuffer *pixbuf,
-				 void *data,
-				 unsigned data_pitch,
-				 unsigned long data_size,
-				 enum pixel_format data_format,
-				 enum layout_format data_layout)
+/*
+ * Writes linear data straight into the destination, swizzling it into
+ * the 16x16 tiled layout if needed.
+ */
+static int host1x_pixelbuffer_load_direct(struct host1x_pixelbuffer *pixbuf,
+					  const uint8_t *data,
+					  unsigned data_pitch,
+					  unsigned long data_size)
 {
-	struct host1x_pixelbuffer *tmp;
+	unsigned bpp = PIX_BUF_FORMAT_BYTES(pixbuf->format);
+	unsigned row_bytes = pixbuf->width * bpp;
+	unsigned height = pixbuf->height;
+	size_t size;
+	unsigned y;
+	uint8_t *map;
+	int err;
+
+	if (data_pitch < row_bytes ||
+	    (unsigned long)data_pitch * (height - 1) + row_bytes > data_size) {
+		host1x_error("invalid: data of %lu bytes is too small\n",
+			     data_size);
+		return -EINVAL;
+	}
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, (void **)&map);
+	if (err)
+		return err;
+
+	map += pixbuf->bo->offset;
+
+	if (pixbuf->layout == PIX_BUF_LAYOUT_LINEAR) {
+		for (y = 0; y < height; y++)
+			memcpy(map + y * pixbuf->pitch, data + y * data_pitch,
+			       row_bytes);
+
+		size = pixbuf->pitch * height;
+		goto flush;
+	}
+
+	host1x_tile_16x16(map, pixbuf->pitch, data, data_pitch,
+			  pixbuf->width, height, pixbuf->format);
+
+	size = pixbuf->pitch * ALIGN(height, 16);
+flush:
+	HOST1X_BO_FLUSH(pixbuf->bo, pixbuf->bo->offset, size);
+
+	return 0;
+}
+
+/*
+ * Data that needs a GR2D blit goes through a staging BO of GR2D, if the
+ * fence is given the blit isn't waited for and 1 is returned. Otherwise
+ * the data is loaded by CPU.
+ */
+static int host1x_pixelbuffer_load(struct host1x *host1x,
+				   struct host1x_pixelbuffer *pixbuf,
+				   void *data,
+				   unsigned data_pitch,
+				   unsigned long data_size,
+				   enum pixel_format data_format,
+				   enum layout_format data_layout,
+				   uint32_t *fence)
+{
+	struct host1x_gr2d *gr2d;
 	bool blit = false;
 	void *map;
 	int err;
@@ -104,12 +318,20 @@ int host1x_pixelbuffer_load_data(struct host1x *host1x,
 		    pixbuf->width, pixbuf->height,
 		    data_format, data_pitch, data_layout, data_size);
 
+	/* data in memory of the caller is linear unless told otherwise */
+	if (data_layout == PIX_BUF_LAYOUT_AUTO)
+		data_layout = PIX_BUF_LAYOUT_LINEAR;
+
 	if (pixbuf->format != data_format) {
 		host1x_error("invalid: pixbuf->format (0x%08x) != data_format (0x%08x)\n",
 			     pixbuf->format, data_format);
 		return -1;
 	}
 
+	err = host1x_pixelbuffer_populate(pixbuf);
+	if (err < 0)
+		return err;
+
 	if (pixbuf->layout != data_layout) {
 		host1x_info("blit cause: pixbuf->layout (%u) != data_layout (%u)\n",
 			    pixbuf->layout, data_layout);
@@ -122,40 +344,156 @@ int host1x_pixelbuffer_load_data(struct host1x *host1x,
 		blit = true;
 	}
 
+	/* linear uncompressed data is re-laid out by CPU in a single pass */
+	if (blit && data_layout == PIX_BUF_LAYOUT_LINEAR &&
+	    !PIX_BUF_FORMAT_COMPRESSED(data_format)) {
+		host1x_info("using direct tiled load\n");
+		return host1x_pixelbuffer_load_direct(pixbuf, data, data_pitch,
+						      data_size);
+	}
+
 	if (blit) {
-		host1x_info("using 2-pass blit-load\n");
+		host1x_info("using staged blit-load\n");
+
+		gr2d = host1x_get_gr2d(host1x);
+
+		if (!fence)
+			return host1x_gr2d_upload(gr2d, pixbuf, data,
+						  data_pitch, data_size,
+						  data_layout);
+
+		err = host1x_gr2d_upload_async(gr2d, pixbuf, data,
+					       data_pitch, data_size,
+					       data_layout, fence);
+		if (err < 0)
+			return err;
 
-		tmp = host1x_pixelbuffer_create(host1x,
-						pixbuf->width, pixbuf->height,
-						data_pitch, data_format,
-						data_layout);
-		if (!tmp)
-			return -1;
-	} else {
-		host1x_info("using direct load\n");
-		tmp = pixbuf;
+		return 1;
 	}
 
-	err = HOST1X_BO_MMAP(tmp->bo, &map);
+	host1x_info("using direct load\n");
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, &map);
 	if (err)
 		return err;
 
 	host1x_info("loading data\n");
-	memcpy(map + tmp->bo->offset, data, data_size);
+	memcpy(map + pixbuf->bo->offset, data, data_size);
 
-	HOST1X_BO_FLUSH(tmp->bo, tmp->bo->offset, data_size);
+	HOST1X_BO_FLUSH(pixbuf->bo, pixbuf->bo->offset, data_size);
 
-	if (blit) {
-		host1x_info("blitting\n");
-		err = host1x_gr2d_blit(host1x->gr2d, tmp, pixbuf,
-				       0, 0, 0, 0,
-				       pixbuf->width, pixbuf->height);
-		host1x_pixelbuffer_free(tmp);
+	host1x_info("success\n");
+
+	return 0;
+}
+
+int host1x_pixelbuffer_load_data(struct host1x *host1x,
+				 struct host1x_pixelbuffer *pixbuf,
+				 void *data,
+				 unsigned data_pitch,
+				 unsigned long data_size,
+				 enum pixel_format data_format,
+				 enum layout_format data_layout)
+{
+	return host1x_pixelbuffer_load(host1x, pixbuf, data, data_pitch,
+				       data_size, data_format, data_layout,
+				       NULL);
+}
+
+/*
+ * Returns 1 if the data is blitted by GR2D, which is done once the fence
+ * is reached, or 0 if the data was loaded by CPU already. The data may be
+ * reused by the caller right away in both cases.
+ */
+int host1x_pixelbuffer_load_data_async(struct host1x *host1x,
+				       struct host1x_pixelbuffer *pixbuf,
+				       void *data,
+				       unsigned data_pitch,
+				       unsigned long data_size,
+				       enum pixel_format data_format,
+				       enum layout_format data_layout,
+				       uint32_t *fence)
+{
+	return host1x_pixelbuffer_load(host1x, pixbuf, data, data_pitch,
+				       data_size, data_format, data_layout,
+				       fence);
+}
+
+/*
+ * Reads the pixel data into linear memory of the given pitch, detiling it
+ * by CPU if needed. GPU writes must be completed.
+ */
+int host1x_pixelbuffer_read_data(struct host1x_pixelbuffer *pixbuf,
+				 void *data, unsigned data_pitch)
+{
+	unsigned bpp = PIX_BUF_FORMAT_BYTES(pixbuf->format);
+	unsigned row_bytes = pixbuf->width * bpp;
+	unsigned height = pixbuf->height;
+	uint8_t *map;
+	unsigned y;
+	int err;
+
+	if (PIX_BUF_FORMAT_COMPRESSED(pixbuf->format)) {
+		host1x_error("compressed formats aren't supported\n");
+		return -EINVAL;
 	}
 
-	host1x_info("success\n");
+	err = host1x_pixelbuffer_populate(pixbuf);
+	if (err < 0)
+		return err;
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, (void **)&map);
+	if (err)
+		return err;
+
+	err = HOST1X_BO_INVALIDATE(pixbuf->bo, pixbuf->bo->offset,
+				   pixbuf->pitch * ALIGN(height, 16));
+	if (err)
+		return err;
+
+	map += pixbuf->bo->offset;
+
+	if (pixbuf->layout == PIX_BUF_LAYOUT_TILED_16x16) {
+		host1x_detile_16x16(data, data_pitch, map, pixbuf->pitch,
+				    pixbuf->width, height, pixbuf->format);
+		return 0;
+	}
+
+	for (y = 0; y < height; y++)
+		memcpy((uint8_t *)data + y * data_pitch,
+		       map + y * pixbuf->pitch, row_bytes);
 
-	return err;
+	return 0;
+}
+
+/*
+ * Hash of the visible pixels for comparing against golden hashes, which is
+ * the same for both layouts and is computed on the tiled data in place.
+ */
+int host1x_pixelbuffer_hash(struct host1x_pixelbuffer *pixbuf,
+			    uint64_t *hash)
+{
+	uint8_t *map;
+	int err;
+
+	err = host1x_pixelbuffer_populate(pixbuf);
+	if (err < 0)
+		return err;
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, (void **)&map);
+	if (err)
+		return err;
+
+	err = HOST1X_BO_INVALIDATE(pixbuf->bo, pixbuf->bo->offset,
+				   pixbuf->pitch * ALIGN(pixbuf->height, 16));
+	if (err)
+		return err;
+
+	*hash = host1x_hash_pixels(map + pixbuf->bo->offset, pixbuf->pitch,
+				   pixbuf->width, pixbuf->height,
+				   pixbuf->format, pixbuf->layout);
+
+	return 0;
 }
 
 void host1x_pixelbuffer_setup_guard(struct host1x_pixelbuffer *pixbuf)
@@ -163,7 +501,7 @@ void host1x_pixelbuffer_setup_guard(struct host1x_pixelbuffer *pixbuf)
 	volatile uint32_t *guard;
 	unsigned i;
 
-	if (pixbuf_guard_disabled)
+	if (pixbuf_guard_mode == HOST1X_PIXBUF_GUARD_OFF)
 		return;
 
 	HOST1X_BO_MMAP(pixbuf->bo, (void**)&guard);
@@ -182,9 +520,12 @@ void host1x_pixelbuffer_setup_guard(struct host1x_pixelbuffer *pixbuf)
 			PIXBUF_GUARD_AREA_SIZE);
 
 	pixbuf->guarded = true;
+
+	host1x_bo_account(pixbuf->bo->priv, pixbuf->bo->priv->mem_category,
+			  PIXBUF_GUARD_AREA_SIZE * 2);
 }
 
-void host1x_pixelbuffer_check_guard(struct host1x_pixelbuffer *pixbuf)
+static void host1x_pixelbuffer_guard_scan(struct host1x_pixelbuffer *pixbuf)
 {
 	struct host1x_bo *orig_bo;
 	volatile uint32_t *guard;
@@ -192,9 +533,6 @@ void host1x_pixelbuffer_check_guard(struct host1x_pixelbuffer *pixbuf)
 	uint32_t value;
 	unsigned i;
 
-	if (!pixbuf->guarded)
-		return;
-
 	orig_bo = pixbuf->bo->wrapped ?: pixbuf->bo;
 
 	HOST1X_BO_INVALIDATE(orig_bo, orig_bo->size - PIXBUF_GUARD_AREA_SIZE,
@@ -240,12 +578,127 @@ smashed_abort:
 	}
 }
 
+static void *host1x_pixelbuffer_guard_worker(void *arg)
+{
+	struct host1x_pixelbuffer *pixbuf;
+
+	pthread_mutex_lock(&guard_worker.lock);
+
+	while (true) {
+		while (guard_worker.head == guard_worker.tail)
+			pthread_cond_wait(&guard_worker.cond,
+					  &guard_worker.lock);
+
+		pixbuf = guard_worker.queue[guard_worker.head++ %
+					    PIXBUF_GUARD_QUEUE_SIZE];
+		if (!pixbuf)
+			continue;
+
+		guard_worker.checking = pixbuf;
+		pthread_mutex_unlock(&guard_worker.lock);
+
+		host1x_pixelbuffer_guard_scan(pixbuf);
+
+		pthread_mutex_lock(&guard_worker.lock);
+		guard_worker.checking = NULL;
+		pthread_cond_broadcast(&guard_worker.cond);
+	}
+
+	return NULL;
+}
+
+/* returns false if the check has to be done in place */
+static bool host1x_pixelbuffer_guard_queue(struct host1x_pixelbuffer *pixbuf)
+{
+	unsigned int i;
+	bool queued = false;
+
+	pthread_mutex_lock(&guard_worker.lock);
+
+	if (!guard_worker.started) {
+		if (pthread_create(&guard_worker.thread, NULL,
+				   host1x_pixelbuffer_guard_worker, NULL)) {
+			host1x_error("failed to start guard checker\n");
+			goto unlock;
+		}
+
+		pthread_detach(guard_worker.thread);
+		__atomic_store_n(&guard_worker.started, true,
+				 __ATOMIC_RELEASE);
+	}
+
+	/* a pending check covers the pixelbuffer already */
+	for (i = guard_worker.head; i != guard_worker.tail; i++) {
+		if (guard_worker.queue[i % PIXBUF_GUARD_QUEUE_SIZE] == pixbuf) {
+			queued = true;
+			goto unlock;
+		}
+	}
+
+	if (guard_worker.tail - guard_worker.head == PIXBUF_GUARD_QUEUE_SIZE)
+		goto unlock;
+
+	i = guard_worker.tail++ % PIXBUF_GUARD_QUEUE_SIZE;
+	guard_worker.queue[i] = pixbuf;
+	pthread_cond_broadcast(&guard_worker.cond);
+	queued = true;
+
+unlock:
+	pthread_mutex_unlock(&guard_worker.lock);
+
+	return queued;
+}
+
+void host1x_pixelbuffer_check_guard(struct host1x_pixelbuffer *pixbuf)
+{
+	unsigned int n;
+
+	if (!pixbuf->guarded)
+		return;
+
+	switch (pixbuf_guard_mode) {
+	case HOST1X_PIXBUF_GUARD_SAMPLED:
+		n = __atomic_add_fetch(&pixbuf_guard_checks, 1,
+				       __ATOMIC_RELAXED);
+		if (n % pixbuf_guard_interval)
+			return;
+		break;
+
+	case HOST1X_PIXBUF_GUARD_ASYNC:
+		if (host1x_pixelbuffer_guard_queue(pixbuf))
+			return;
+		break;
+
+	default:
+		break;
+	}
+
+	host1x_pixelbuffer_guard_scan(pixbuf);
+}
+
+/* the guards of the pixelbuffer aren't checked anymore */
+void host1x_pixelbuffer_unguard(struct host1x_pixelbuffer *pixbuf)
+{
+	if (!pixbuf->guarded)
+		return;
+
+	host1x_pixelbuffer_guard_forget(pixbuf);
+	pixbuf->guarded = false;
+}
+
+void host1x_pixelbuffer_set_guard_mode(enum host1x_pixbuf_guard_mode mode,
+				       unsigned int interval)
+{
+	pixbuf_guard_interval = MAX(interval, 1);
+	pixbuf_guard_mode = mode;
+}
+
 void host1x_pixelbuffer_disable_bo_guard(void)
 {
-	pixbuf_guard_disabled = true;
+	host1x_pixelbuffer_set_guard_mode(HOST1X_PIXBUF_GUARD_OFF, 0);
 }
 
 bool host1x_pixelbuffer_bo_guard_disabled(void)
 {
-	return pixbuf_guard_disabled;
+	return pixbuf_guard_mode == HOST1X_PIXBUF_GUARD_OFF;
 }
@@ -24,10 +24,12 @@
 #ifndef GRATE_HOST1X_PRIVATE_H
 #define GRATE_HOST1X_PRIVATE_H 1
 
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include "host1x.h"
+#include "list.h"
 
 #define container_of(ptr, type, member) ({ \
 		const typeof(((type *)0)->member) *__mptr = (ptr); \
@@ -43,16 +45,82 @@ struct host1x_syncpt {
 	uint32_t value;
 };
 
+/* the BO is referenced by jobs of the syncpoint, see host1x-bo-fence.c */
+struct host1x_bo_busy {
+	uint64_t flushes;
+	uint32_t syncpt;
+	uint32_t fence;
+	bool fence_known;
+	bool valid;
+};
+
+#define HOST1X_BO_MAX_BUSY	2
+
 struct host1x_bo_priv {
 	int (*mmap)(struct host1x_bo *bo);
 	int (*invalidate)(struct host1x_bo *bo, unsigned long offset,
 			  size_t length);
 	int (*flush)(struct host1x_bo *bo, unsigned long offset, size_t length);
 	int (*export)(struct host1x_bo *bo, uint32_t *handle);
+	int (*export_dmabuf)(struct host1x_bo *bo, int *fd);
 	void (*free)(struct host1x_bo *bo);
 	struct host1x_bo* (*clone)(struct host1x_bo *bo);
+
+	/* BO cache bookkeeping, cache_host1x is NULL if BO isn't cacheable */
+	struct host1x *cache_host1x;
+	struct list_head cache_list;
+	struct host1x_bo *cache_bo;
+	unsigned long cache_flags;
+	uint64_t cache_time;
+	size_t cache_size;
+
+	/* memory accounting, mem_host1x is NULL if BO isn't accounted */
+	struct host1x *mem_host1x;
+	enum host1x_mem_category mem_category;
+	size_t mem_guard;
+	bool mem_accounted;
+
+	/* last references by GPU, a busy BO is freed once they are done */
+	struct host1x_bo_busy *busy;
+	unsigned int max_busy;
+	struct list_head busy_list;
+	struct host1x_bo *busy_bo;
+
+	/* user memory wrapped by host1x_bo_create_from_userptr() */
+	void (*userptr_free)(struct host1x_bo *bo);
+	int userptr_fd;
 };
 
+struct host1x_bo_cache {
+	struct list_head list;
+	unsigned int num_bos;
+	size_t size;
+	unsigned long hits;
+	unsigned long misses;
+	bool disabled;
+};
+
+size_t host1x_bo_cache_size_class(size_t size);
+struct host1x_bo *host1x_bo_cache_get(struct host1x *host1x, size_t size,
+				      unsigned long flags);
+bool host1x_bo_cache_put(struct host1x_bo *bo);
+void host1x_bo_cache_fini(struct host1x *host1x);
+
+void host1x_bo_release(struct host1x_bo *bo);
+void host1x_bo_mark_busy(struct host1x_bo *bo, uint32_t syncpt);
+void host1x_bo_fence_flushed(struct host1x_client *client, uint32_t fence);
+bool host1x_bo_defer_free(struct host1x_bo *bo);
+bool host1x_bo_is_busy(struct host1x_bo *bo);
+void host1x_bo_fence_reap(void);
+void host1x_bo_fence_fini(void);
+
+void host1x_bo_account(struct host1x_bo_priv *priv,
+		       enum host1x_mem_category category, size_t guard);
+void host1x_bo_unaccount(struct host1x_bo_priv *priv);
+
+int host1x_png_write(const char *path, unsigned int width,
+		     unsigned int height, const void *data, unsigned int pitch);
+
 static inline unsigned long host1x_bo_get_offset(struct host1x_bo *bo,
 						 void *ptr)
 {
@@ -69,6 +137,18 @@ struct host1x_display {
 			      struct host1x_overlay **overlayp);
 	int (*set)(struct host1x_display *display,
 		   struct host1x_framebuffer *fb, bool vsync, bool reflect_y);
+	/* optional, non-blocking page flip */
+	int (*flip)(struct host1x_display *display,
+		    struct host1x_framebuffer *fb, bool reflect_y);
+	int (*wait_flip)(struct host1x_display *display, uint32_t timeout);
+	/* optional, time of the last vblank and the refresh period in us */
+	int (*get_vblank)(struct host1x_display *display, uint64_t *time,
+			  uint64_t *period);
+	/* optional, events are read from the fd without blocking */
+	int (*get_event_fd)(struct host1x_display *display);
+	int (*request_vblank)(struct host1x_display *display);
+	int (*handle_events)(struct host1x_display *display,
+			     const struct host1x_display_events *events);
 };
 
 struct host1x_overlay {
@@ -77,34 +157,148 @@ struct host1x_overlay {
 		   struct host1x_framebuffer *fb, unsigned int x,
 		   unsigned int y, unsigned int width, unsigned int height,
 		   bool vsync, bool reflect_y);
+	/* optional, non-blocking update applied at the next vblank */
+	int (*queue)(struct host1x_overlay *overlay,
+		     struct host1x_framebuffer *fb, unsigned int x,
+		     unsigned int y, unsigned int width, unsigned int height,
+		     bool reflect_y);
+	int (*wait)(struct host1x_overlay *overlay, uint32_t timeout);
+	/* optional, whether the plane can scan out the format */
+	bool (*supports)(struct host1x_overlay *overlay,
+			 enum pixel_format format);
+};
+
+struct host1x_queue;
+
+#define HOST1X_JOB_TIMEOUT_MS	1000
+#define HOST1X_CLIENT_HISTORY	16
+
+/* a recently submitted job, kept to report the one that hung */
+struct host1x_job_record {
+	uint32_t fence;
+	/* in milliseconds, the timeout of the job or of the client */
+	uint32_t timeout;
+	bool flushed;
+	unsigned int num_pushbufs;
+	unsigned long words;
+	uint32_t handle;
+	unsigned long offset;
 };
 
 struct host1x_client {
 	struct host1x_syncpt *syncpts;
 	unsigned int num_syncpts;
+	struct host1x_queue *queue;
 
 	int (*submit)(struct host1x_client *client, struct host1x_job *job);
 	int (*flush)(struct host1x_client *client, uint32_t *fence);
 	int (*wait)(struct host1x_client *client, uint32_t fence,
 		    uint32_t timeout);
+	/* optional, reads the current syncpoint value without blocking */
+	int (*read)(struct host1x_client *client, uint32_t *value);
+
+	/* pushbufs of jobs are passed through the optimizer on submission */
+	bool optimize;
+
+	/* jobs that run longer than this many milliseconds are hung */
+	uint32_t timeout;
+	/*
+	 * optional, resets the engine after a hang. Hangs are detected by
+	 * waits, which may run on any thread and within ring operations,
+	 * hence they only set reset_pending and the reset is submitted by
+	 * the next host1x_client_submit().
+	 */
+	int (*recover)(struct host1x_client *client, void *data);
+	void *recover_data;
+	bool reset_pending;
+	/* times the engine was reset, state cached by users is lost */
+	unsigned int resets;
+
+	struct host1x_job_record history[HOST1X_CLIENT_HISTORY];
+	unsigned int history_next;
+
+	/*
+	 * Serialises submissions and flushes, which may come from the queue
+	 * thread and from synchronous submits. Covers the scratch state of
+	 * the backend, its fence and the history.
+	 */
+	pthread_mutex_t submit_lock;
+
+	struct host1x_client_stats stats;
+};
+
+#define HOST1X_RING_MAX_SEGMENTS	64
+
+struct host1x_ring_segment {
+	unsigned long start;
+	unsigned long end;
+	uint32_t fence;
+};
+
+struct host1x_ring {
+	struct host1x_client *client;
+	struct host1x_bo *bo;
+	unsigned long head;
+	size_t reserved;
+
+	struct host1x_ring_segment segments[HOST1X_RING_MAX_SEGMENTS];
+	unsigned int first;
+	unsigned int count;
 };
 
+void host1x_ring_init(struct host1x_ring *ring, struct host1x_client *client,
+		      struct host1x_bo *bo);
+struct host1x_pushbuf *host1x_ring_append(struct host1x_ring *ring,
+					  struct host1x_job *job,
+					  size_t words);
+int host1x_ring_commit(struct host1x_ring *ring, struct host1x_pushbuf *pb,
+		       uint32_t fence);
+int host1x_ring_wait_idle(struct host1x_ring *ring);
+
+/* linear upload buffer, reused once the blit out of it is completed */
+struct host1x_gr2d_staging {
+	struct host1x_bo *bo;
+	uint32_t fence;
+	bool busy;
+};
+
+#define HOST1X_GR2D_STAGING_SLOTS	4
+
 struct host1x_gr2d {
+	struct host1x *host1x;
 	struct host1x_client *client;
+	bool ready;
 	struct host1x_bo *commands;
 	struct host1x_bo *scratch;
+	struct host1x_ring ring;
+	struct host1x_gr2d_batch *batch;
+	uint32_t fence;
+
+	struct host1x_gr2d_staging staging[HOST1X_GR2D_STAGING_SLOTS];
+	unsigned int staging_next;
 };
 
 int host1x_gr2d_init(struct host1x *host1x, struct host1x_gr2d *gr2d);
+int host1x_gr2d_setup(struct host1x_gr2d *gr2d);
 void host1x_gr2d_exit(struct host1x_gr2d *gr2d);
 
 struct host1x_gr3d {
+	struct host1x *host1x;
 	struct host1x_client *client;
+	bool ready;
 	struct host1x_bo *commands;
 	struct host1x_bo *attributes;
+	struct host1x_ring ring;
+
+	/* pre-built reset sequence, executed as a separate pushbuf */
+	struct host1x_bo *reset_bo;
+	struct host1x_pushbuf reset;
+	/* syncpoint increment that completes a reset job of its own */
+	struct host1x_pushbuf reset_incr;
 };
 
 int host1x_gr3d_init(struct host1x *host1x, struct host1x_gr3d *gr3d);
+int host1x_gr3d_setup(struct host1x_gr3d *gr3d);
 void host1x_gr3d_exit(struct host1x_gr3d *gr3d);
 
 struct host1x {
@@ -117,11 +311,29 @@ struct host1x {
 	struct host1x_bo *(*bo_import)(struct host1x *host1x,
 				       struct host1x_bo_priv *priv,
 				       uint32_t handle);
+	struct host1x_bo *(*bo_import_dmabuf)(struct host1x *host1x,
+					      struct host1x_bo_priv *priv,
+					      int fd);
+	void (*flush_batch_begin)(struct host1x *host1x);
+	int (*flush_batch_end)(struct host1x *host1x);
+	/* NULL if the backend has no display */
+	void (*display_init)(struct host1x *host1x);
 
 	struct host1x_display *display;
 	struct host1x_gr2d *gr2d;
 	struct host1x_gr3d *gr3d;
 	struct host1x_options *options;
+
+	struct host1x_bo_cache bo_cache;
+
+	uint64_t bo_creates;
+	uint64_t bo_frees;
+	uint64_t bo_allocs;
+	uint64_t bo_bytes_allocated;
+
+	const char *backend;
+	struct host1x_mem_category_stats mem[HOST1X_MEM_NUM_CATEGORIES];
+	struct host1x_mem_category_stats mem_total;
 };
 
 struct host1x *host1x_nvhost_open(struct host1x_options *options);
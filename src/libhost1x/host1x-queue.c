@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * Submission queue. Jobs recorded by any thread are handed over to a worker
+ * thread, which submits them to the kernel in the order of queueing. A job
+ * is owned by the queue once queued and is freed after its submission.
+ */
+#define HOST1X_QUEUE_SIZE	32
+
+struct host1x_queue {
+	struct host1x_client *client;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+
+	struct host1x_job *jobs[HOST1X_QUEUE_SIZE];
+	unsigned int first;
+	unsigned int count;
+	bool busy;
+	bool stop;
+
+	uint32_t fence;
+	int error;
+};
+
+static void *host1x_queue_worker(void *data)
+{
+	struct host1x_queue *queue = data;
+	struct host1x_client *client = queue->client;
+	struct host1x_job *job;
+	uint32_t fence;
+	int err;
+
+	pthread_mutex_lock(&queue->lock);
+
+	while (true) {
+		while (!queue->count && !queue->stop)
+			pthread_cond_wait(&queue->work, &queue->lock);
+
+		if (!queue->count)
+			break;
+
+		job = queue->jobs[queue->first];
+		queue->first = (queue->first + 1) % HOST1X_QUEUE_SIZE;
+		queue->count--;
+		queue->busy = true;
+
+		pthread_cond_broadcast(&queue->done);
+		pthread_mutex_unlock(&queue->lock);
+
+		err = HOST1X_CLIENT_SUBMIT(client, job);
+		if (!err)
+			err = HOST1X_CLIENT_FLUSH(client, &fence);
+
+		host1x_job_free(job);
+
+		pthread_mutex_lock(&queue->lock);
+
+		if (err < 0 && !queue->error)
+			queue->error = err;
+		else if (!err)
+			queue->fence = fence;
+
+		queue->busy = false;
+		pthread_cond_broadcast(&queue->done);
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return NULL;
+}
+
+int host1x_client_queue_start(struct host1x_client *client)
+{
+	struct host1x_queue *queue;
+	int err;
+
+	if (client->queue)
+		return 0;
+
+	queue = calloc(1, sizeof(*queue));
+	if (!queue)
+		return -ENOMEM;
+
+	queue->client = client;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->work, NULL);
+	pthread_cond_init(&queue->done, NULL);
+
+	err = pthread_create(&queue->thread, NULL, host1x_queue_worker, queue);
+	if (err) {
+		host1x_error("pthread_create() failed: %d\n", err);
+		pthread_cond_destroy(&queue->done);
+		pthread_cond_destroy(&queue->work);
+		pthread_mutex_destroy(&queue->lock);
+		free(queue);
+		return -err;
+	}
+
+	client->queue = queue;
+
+	return 0;
+}
+
+void host1x_client_queue_stop(struct host1x_client *client)
+{
+	struct host1x_queue *queue = client->queue;
+
+	if (!queue)
+		return;
+
+	/* the worker drains the pending jobs before exiting */
+	pthread_mutex_lock(&queue->lock);
+	queue->stop = true;
+	pthread_cond_signal(&queue->work);
+	pthread_mutex_unlock(&queue->lock);
+
+	pthread_join(queue->thread, NULL);
+
+	pthread_cond_destroy(&queue->done);
+	pthread_cond_destroy(&queue->work);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue);
+
+	client->queue = NULL;
+}
+
+int host1x_client_queue_submit(struct host1x_client *client,
+			       struct host1x_job *job)
+{
+	struct host1x_queue *queue = client->queue;
+	unsigned int index;
+
+	if (!queue) {
+		host1x_job_free(job);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&queue->lock);
+
+	while (queue->count == HOST1X_QUEUE_SIZE)
+		pthread_cond_wait(&queue->done, &queue->lock);
+
+	index = (queue->first + queue->count) % HOST1X_QUEUE_SIZE;
+	queue->jobs[index] = job;
+	queue->count++;
+
+	pthread_cond_signal(&queue->work);
+	pthread_mutex_unlock(&queue->lock);
+
+	return 0;
+}
+
+int host1x_client_queue_drain(struct host1x_client *client, uint32_t *fence)
+{
+	struct host1x_queue *queue = client->queue;
+	int err;
+
+	if (!queue)
+		return -EINVAL;
+
+	pthread_mutex_lock(&queue->lock);
+
+	while (queue->count || queue->busy)
+		pthread_cond_wait(&queue->done, &queue->lock);
+
+	/* report the first error only once */
+	err = queue->error;
+	queue->error = 0;
+
+	if (fence)
+		*fence = queue->fence;
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return err;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * Command buffer ring. Jobs are recorded one after another into the ring
+ * BO, every recorded job is tracked by the syncpoint fence of its submission
+ * and the space is reused only after the fence is reached. This allows to
+ * have multiple jobs in-flight without waiting for each of them. A ring
+ * belongs to the thread that records into it, the submission itself is
+ * serialised with the other submitters of the client.
+ */
+
+void host1x_ring_init(struct host1x_ring *ring, struct host1x_client *client,
+		      struct host1x_bo *bo)
+{
+	memset(ring, 0, sizeof(*ring));
+
+	ring->client = client;
+	ring->bo = bo;
+}
+
+static struct host1x_ring_segment *
+host1x_ring_segment(struct host1x_ring *ring, unsigned int index)
+{
+	index = (ring->first + index) % HOST1X_RING_MAX_SEGMENTS;
+
+	return &ring->segments[index];
+}
+
+/* retire segments up to and including the given one */
+static int host1x_ring_retire(struct host1x_ring *ring, unsigned int index)
+{
+	struct host1x_ring_segment *segment = host1x_ring_segment(ring, index);
+	int err;
+
+	err = HOST1X_CLIENT_WAIT(ring->client, segment->fence, ~0u);
+	if (err < 0)
+		return err;
+
+	ring->first = (ring->first + index + 1) % HOST1X_RING_MAX_SEGMENTS;
+	ring->count -= index + 1;
+
+	return 0;
+}
+
+struct host1x_pushbuf *host1x_ring_append(struct host1x_ring *ring,
+					  struct host1x_job *job,
+					  size_t words)
+{
+	struct host1x_pushbuf *pb;
+	unsigned long start, end;
+	unsigned int i;
+	int busy = -1;
+	int err;
+
+	end = ring->head + words * 4;
+
+	if (words * 4 > ring->bo->size) {
+		host1x_error("Job of %zu words doesn't fit ring of %zu bytes\n",
+			     words, ring->bo->size);
+		return NULL;
+	}
+
+	if (end > ring->bo->size) {
+		ring->head = 0;
+		end = words * 4;
+	}
+
+	start = ring->head;
+
+	if (ring->count == HOST1X_RING_MAX_SEGMENTS)
+		busy = 0;
+
+	for (i = 0; i < ring->count; i++) {
+		struct host1x_ring_segment *segment;
+
+		segment = host1x_ring_segment(ring, i);
+
+		if (segment->start < end && start < segment->end)
+			busy = i;
+	}
+
+	if (busy >= 0) {
+		err = host1x_ring_retire(ring, busy);
+		if (err < 0)
+			return NULL;
+	}
+
+	ring->reserved = words;
+
+	/* the words past the reservation belong to other jobs */
+	pb = HOST1X_JOB_APPEND(job, ring->bo, start);
+	if (pb) {
+		pb->end = pb->ptr + words;
+		pb->chainable = false;
+	}
+
+	return pb;
+}
+
+int host1x_ring_commit(struct host1x_ring *ring, struct host1x_pushbuf *pb,
+		       uint32_t fence)
+{
+	struct host1x_ring_segment *segment;
+
+	segment = host1x_ring_segment(ring, ring->count++);
+	segment->start = pb->offset;
+	segment->end = pb->offset + pb->length * 4;
+	segment->fence = fence;
+
+	ring->head = segment->end;
+	ring->reserved = 0;
+
+	return 0;
+}
+
+int host1x_ring_wait_idle(struct host1x_ring *ring)
+{
+	if (!ring->count)
+		return 0;
+
+	return host1x_ring_retire(ring, ring->count - 1);
+}
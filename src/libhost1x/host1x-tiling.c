@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2012, 2013 Erik Faye-Lund
+ * Copyright (c) 2013 Thierry Reding
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * CPU conversion between linear and 16x16 tiled layouts. Tile is 16 bytes
+ * wide and 16 lines high, tiles are stored row by row and a row of tiles
+ * spans the pitch of the surface. Tile width in bytes is independent of
+ * the format, pixels and compressed blocks of every format fit the tile
+ * width evenly, hence the same kernels serve all the formats.
+ */
+
+/* copies 16 lines of 16 bytes into a contiguous 256 bytes tile */
+static void host1x_tile_block(uint8_t *dst, const uint8_t *src,
+			      unsigned src_pitch)
+{
+	unsigned i;
+
+#ifdef __ARM_NEON
+	for (i = 0; i < 16; i += 4) {
+		uint8x16_t l0 = vld1q_u8(src + src_pitch * 0);
+		uint8x16_t l1 = vld1q_u8(src + src_pitch * 1);
+		uint8x16_t l2 = vld1q_u8(src + src_pitch * 2);
+		uint8x16_t l3 = vld1q_u8(src + src_pitch * 3);
+
+		vst1q_u8(dst + 0,  l0);
+		vst1q_u8(dst + 16, l1);
+		vst1q_u8(dst + 32, l2);
+		vst1q_u8(dst + 48, l3);
+
+		src += src_pitch * 4;
+		dst += 64;
+	}
+#else
+	for (i = 0; i < 16; i++) {
+		memcpy(dst, src, 16);
+		src += src_pitch;
+		dst += 16;
+	}
+#endif
+}
+
+/* copies a contiguous 256 bytes tile into 16 lines of 16 bytes */
+static void host1x_detile_block(uint8_t *dst, unsigned dst_pitch,
+				const uint8_t *src)
+{
+	unsigned i;
+
+#ifdef __ARM_NEON
+	for (i = 0; i < 16; i += 4) {
+		uint8x16_t l0 = vld1q_u8(src + 0);
+		uint8x16_t l1 = vld1q_u8(src + 16);
+		uint8x16_t l2 = vld1q_u8(src + 32);
+		uint8x16_t l3 = vld1q_u8(src + 48);
+
+		vst1q_u8(dst + dst_pitch * 0, l0);
+		vst1q_u8(dst + dst_pitch * 1, l1);
+		vst1q_u8(dst + dst_pitch * 2, l2);
+		vst1q_u8(dst + dst_pitch * 3, l3);
+
+		dst += dst_pitch * 4;
+		src += 64;
+	}
+#else
+	for (i = 0; i < 16; i++) {
+		memcpy(dst, src, 16);
+		dst += dst_pitch;
+		src += 16;
+	}
+#endif
+}
+
+/* size of a line in bytes and number of lines, compressed blocks count */
+static void host1x_tiling_dims(enum pixel_format format,
+			       unsigned width, unsigned height,
+			       unsigned *row_bytes, unsigned *lines)
+{
+	unsigned tw = PIX_BUF_FORMAT_TEXEL_WIDTH(format);
+	unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(format);
+
+	*row_bytes = ALIGN(width, tw) / tw * PIX_BUF_FORMAT_BYTES(format);
+	*lines = ALIGN(height, th) / th;
+}
+
+void host1x_tile_16x16(void *dst, unsigned dst_pitch,
+		       const void *src, unsigned src_pitch,
+		       unsigned width, unsigned height,
+		       enum pixel_format format)
+{
+	unsigned row_bytes, lines, x, y, i, bytes, n;
+
+	host1x_tiling_dims(format, width, height, &row_bytes, &lines);
+
+	for (y = 0; y < lines; y += 16) {
+		n = MIN(16u, lines - y);
+
+		for (x = 0; x < row_bytes; x += 16) {
+			const uint8_t *s = (const uint8_t *)src +
+					   y * src_pitch + x;
+			uint8_t *d = (uint8_t *)dst + y * dst_pitch + x * 16;
+
+			bytes = MIN(16u, row_bytes - x);
+
+			if (n == 16 && bytes == 16) {
+				host1x_tile_block(d, s, src_pitch);
+				continue;
+			}
+
+			for (i = 0; i < n; i++)
+				memcpy(d + i * 16, s + i * src_pitch, bytes);
+		}
+	}
+}
+
+void host1x_detile_16x16(void *dst, unsigned dst_pitch,
+			 const void *src, unsigned src_pitch,
+			 unsigned width, unsigned height,
+			 enum pixel_format format)
+{
+	unsigned row_bytes, lines, x, y, i, bytes, n;
+
+	host1x_tiling_dims(format, width, height, &row_bytes, &lines);
+
+	for (y = 0; y < lines; y += 16) {
+		n = MIN(16u, lines - y);
+
+		for (x = 0; x < row_bytes; x += 16) {
+			const uint8_t *s = (const uint8_t *)src +
+					   y * src_pitch + x * 16;
+			uint8_t *d = (uint8_t *)dst + y * dst_pitch + x;
+
+			bytes = MIN(16u, row_bytes - x);
+
+			if (n == 16 && bytes == 16) {
+				host1x_detile_block(d, dst_pitch, s);
+				continue;
+			}
+
+			for (i = 0; i < n; i++)
+				memcpy(d + i * dst_pitch, s + i * 16, bytes);
+		}
+	}
+}
+
+#define HASH_PRIME32_1	0x9e3779b1u
+#define HASH_PRIME32_2	0x85ebca77u
+#define HASH_PRIME64_1	0x9e3779b185ebca87ull
+#define HASH_PRIME64_2	0xc2b2ae3d27d4eb4full
+#define HASH_PRIME64_3	0x165667b19e3779f9ull
+
+/*
+ * Lines are hashed in 16 bytes chunks by four XXH32 lanes, the chunk
+ * ending a line is padded with zeros. Both layouts feed the chunks in the
+ * linear order, hence a tiled pixelbuffer hashes like its linear copy.
+ */
+struct host1x_hash_state {
+#ifdef __ARM_NEON
+	uint32x4_t acc;
+#else
+	uint32_t acc[4];
+#endif
+};
+
+static void host1x_hash_chunk(struct host1x_hash_state *st,
+			      const uint8_t *chunk)
+{
+#ifdef __ARM_NEON
+	uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(chunk));
+	uint32x4_t a = vmlaq_n_u32(st->acc, v, HASH_PRIME32_2);
+
+	a = vorrq_u32(vshlq_n_u32(a, 13), vshrq_n_u32(a, 19));
+	st->acc = vmulq_n_u32(a, HASH_PRIME32_1);
+#else
+	uint32_t v[4];
+	unsigned i;
+
+	memcpy(v, chunk, sizeof(v));
+
+	for (i = 0; i < 4; i++) {
+		uint32_t a = st->acc[i] + v[i] * HASH_PRIME32_2;
+
+		a = (a << 13) | (a >> 19);
+		st->acc[i] = a * HASH_PRIME32_1;
+	}
+#endif
+}
+
+static void host1x_hash_tail(struct host1x_hash_state *st,
+			     const uint8_t *data, unsigned bytes)
+{
+	uint8_t chunk[16] = { 0 };
+
+	memcpy(chunk, data, bytes);
+	host1x_hash_chunk(st, chunk);
+}
+
+static uint64_t host1x_hash_final(struct host1x_hash_state *st,
+				  uint64_t size)
+{
+	uint32_t acc[4];
+	uint64_t h = size;
+	unsigned i;
+
+#ifdef __ARM_NEON
+	vst1q_u32(acc, st->acc);
+#else
+	memcpy(acc, st->acc, sizeof(acc));
+#endif
+
+	for (i = 0; i < 4; i++) {
+		h ^= acc[i] * HASH_PRIME64_2;
+		h = ((h << 31) | (h >> 33)) * HASH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= HASH_PRIME64_2;
+	h ^= h >> 29;
+	h *= HASH_PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+/* hash of the pixels, pitch padding and the rest of tiles don't count */
+uint64_t host1x_hash_pixels(const void *data, unsigned pitch,
+			    unsigned width, unsigned height,
+			    enum pixel_format format,
+			    enum layout_format layout)
+{
+	struct host1x_hash_state st;
+	unsigned row_bytes, lines, x, y, bytes;
+	const uint8_t *line;
+
+#ifdef __ARM_NEON
+	st.acc = vdupq_n_u32(HASH_PRIME32_1);
+#else
+	st.acc[0] = st.acc[1] = st.acc[2] = st.acc[3] = HASH_PRIME32_1;
+#endif
+
+	host1x_tiling_dims(format, width, height, &row_bytes, &lines);
+
+	for (y = 0; y < lines; y++) {
+		if (layout == PIX_BUF_LAYOUT_TILED_16x16)
+			line = (const uint8_t *)data + (y & ~15u) * pitch +
+			       (y & 15) * 16;
+		else
+			line = (const uint8_t *)data + y * pitch;
+
+		for (x = 0; x < row_bytes; x += 16) {
+			/* a line of a tile spans 16 bytes of the 256 */
+			const uint8_t *chunk = line +
+				(layout == PIX_BUF_LAYOUT_TILED_16x16 ?
+				 x * 16 : x);
+
+			bytes = MIN(16u, row_bytes - x);
+
+			if (bytes == 16)
+				host1x_hash_chunk(&st, chunk);
+			else
+				host1x_hash_tail(&st, chunk, bytes);
+		}
+	}
+
+	return host1x_hash_final(&st, (uint64_t)row_bytes * lines);
+}
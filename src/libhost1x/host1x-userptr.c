@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/udmabuf.h>) && __has_include(<linux/dma-buf.h>)
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
+#define HAVE_UDMABUF 1
+#endif
+#endif
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+/*
+ * The Tegra DRM has no userptr BOs, but it imports dma-bufs, and udmabuf
+ * turns pages of a memfd into a dma-buf. Memory of host1x_userptr_alloc()
+ * is hence memfd-backed, the udmabuf pins its pages for the lifetime of
+ * the BO. The user mapping is CPU cached, flushes and invalidations of the
+ * BO are dma-buf syncs.
+ */
+
+struct host1x_userptr {
+	struct list_head list;
+	void *ptr;
+	size_t size;
+	int memfd;
+};
+
+static LIST_HEAD(host1x_userptrs);
+static pthread_mutex_t host1x_userptr_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void *host1x_userptr_alloc(size_t size)
+{
+	struct host1x_userptr *userptr;
+	long page = sysconf(_SC_PAGESIZE);
+
+	userptr = calloc(1, sizeof(*userptr));
+	if (!userptr)
+		return NULL;
+
+	userptr->size = ALIGN(size, page);
+
+	userptr->memfd = memfd_create("host1x-userptr",
+				      MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (userptr->memfd < 0)
+		goto free;
+
+	/* udmabuf refuses memfds that may shrink */
+	if (ftruncate(userptr->memfd, userptr->size) < 0 ||
+	    fcntl(userptr->memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0)
+		goto close;
+
+	userptr->ptr = mmap(NULL, userptr->size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, userptr->memfd, 0);
+	if (userptr->ptr == MAP_FAILED)
+		goto close;
+
+	pthread_mutex_lock(&host1x_userptr_lock);
+	list_add_tail(&userptr->list, &host1x_userptrs);
+	pthread_mutex_unlock(&host1x_userptr_lock);
+
+	return userptr->ptr;
+
+close:
+	close(userptr->memfd);
+free:
+	free(userptr);
+
+	return NULL;
+}
+
+void host1x_userptr_free(void *ptr)
+{
+	struct host1x_userptr *userptr;
+
+	if (!ptr)
+		return;
+
+	pthread_mutex_lock(&host1x_userptr_lock);
+
+	list_for_each_entry(userptr, &host1x_userptrs, list) {
+		if (userptr->ptr != ptr)
+			continue;
+
+		list_del(&userptr->list);
+		pthread_mutex_unlock(&host1x_userptr_lock);
+
+		munmap(userptr->ptr, userptr->size);
+		close(userptr->memfd);
+		free(userptr);
+		return;
+	}
+
+	pthread_mutex_unlock(&host1x_userptr_lock);
+
+	host1x_error("invalid: %p isn't userptr memory\n", ptr);
+}
+
+#ifdef HAVE_UDMABUF
+static int host1x_userptr_sync(struct host1x_bo *bo, uint64_t flags)
+{
+	struct dma_buf_sync sync;
+
+	memset(&sync, 0, sizeof(sync));
+	sync.flags = DMA_BUF_SYNC_START | flags;
+
+	if (ioctl(bo->priv->userptr_fd, DMA_BUF_IOCTL_SYNC, &sync) < 0)
+		return -errno;
+
+	sync.flags = DMA_BUF_SYNC_END | flags;
+
+	if (ioctl(bo->priv->userptr_fd, DMA_BUF_IOCTL_SYNC, &sync) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* the syncs cover the whole dma-buf, it can't be synced by range */
+static int host1x_userptr_invalidate(struct host1x_bo *bo,
+				     unsigned long offset, size_t length)
+{
+	return host1x_userptr_sync(bo, DMA_BUF_SYNC_READ);
+}
+
+static int host1x_userptr_flush(struct host1x_bo *bo, unsigned long offset,
+				size_t length)
+{
+	return host1x_userptr_sync(bo, DMA_BUF_SYNC_WRITE);
+}
+
+static void host1x_userptr_bo_free(struct host1x_bo *bo)
+{
+	struct host1x_bo_priv *priv = bo->priv;
+
+	/* wraps share the dma-buf of the wrapped BO */
+	if (!bo->wrapped)
+		close(priv->userptr_fd);
+
+	priv->userptr_free(bo);
+}
+
+static struct host1x_bo *host1x_userptr_import(struct host1x *host1x,
+					       void *ptr, size_t size)
+{
+	static int udmabuf = -1;
+	struct host1x_userptr *userptr, *found = NULL;
+	struct udmabuf_create create;
+	struct host1x_bo_priv *priv;
+	struct host1x_bo *bo;
+	int fd;
+
+	if (!host1x->bo_import_dmabuf)
+		return NULL;
+
+	pthread_mutex_lock(&host1x_userptr_lock);
+
+	list_for_each_entry(userptr, &host1x_userptrs, list) {
+		if ((uint8_t *)ptr >= (uint8_t *)userptr->ptr &&
+		    (uint8_t *)ptr + size <=
+				(uint8_t *)userptr->ptr + userptr->size) {
+			found = userptr;
+			break;
+		}
+	}
+
+	if (found && udmabuf < 0)
+		udmabuf = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+
+	pthread_mutex_unlock(&host1x_userptr_lock);
+
+	if (!found || udmabuf < 0)
+		return NULL;
+
+	memset(&create, 0, sizeof(create));
+	create.memfd = found->memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = (uint8_t *)ptr - (uint8_t *)found->ptr;
+	create.size = ALIGN(size, sysconf(_SC_PAGESIZE));
+
+	/* the udmabuf works in whole pages */
+	if (create.offset % sysconf(_SC_PAGESIZE) ||
+	    create.offset + create.size > found->size)
+		return NULL;
+
+	fd = ioctl(udmabuf, UDMABUF_CREATE, &create);
+	if (fd < 0)
+		return NULL;
+
+	bo = host1x_bo_import_dmabuf(host1x, fd);
+	if (!bo) {
+		close(fd);
+		return NULL;
+	}
+
+	priv = bo->priv;
+	priv->userptr_free = priv->free;
+	priv->userptr_fd = fd;
+	priv->free = host1x_userptr_bo_free;
+	priv->invalidate = host1x_userptr_invalidate;
+	priv->flush = host1x_userptr_flush;
+
+	/* the user mapping is the mapping of the BO */
+	bo->ptr = ptr;
+
+	return bo;
+}
+#else
+static struct host1x_bo *host1x_userptr_import(struct host1x *host1x,
+					       void *ptr, size_t size)
+{
+	return NULL;
+}
+#endif
+
+struct host1x_bo *host1x_bo_create_from_userptr(struct host1x *host1x,
+						void *ptr, size_t size,
+						unsigned long flags)
+{
+	struct host1x_bo *bo;
+	int err;
+
+	bo = host1x_userptr_import(host1x, ptr, size);
+	if (bo) {
+		err = HOST1X_BO_FLUSH(bo, 0, size);
+		if (err < 0) {
+			host1x_bo_free(bo);
+			return NULL;
+		}
+
+		return bo;
+	}
+
+	host1x_info("userptr %p can't be wrapped, it's copied\n", ptr);
+
+	bo = HOST1X_BO_CREATE(host1x, size, flags);
+	if (!bo)
+		return NULL;
+
+	err = HOST1X_BO_MMAP(bo, NULL);
+	if (err < 0) {
+		host1x_bo_free(bo);
+		return NULL;
+	}
+
+	memcpy(bo->ptr + bo->offset, ptr, size);
+
+	err = HOST1X_BO_FLUSH(bo, bo->offset, size);
+	if (err < 0) {
+		host1x_bo_free(bo);
+		return NULL;
+	}
+
+	return bo;
+}
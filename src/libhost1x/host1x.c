@@ -22,9 +22,11 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "host1x.h"
 #include "host1x-private.h"
@@ -36,6 +38,19 @@ static const char * const soc_names[] = {
 	[TEGRA114_SOC] = "Tegra114",
 };
 
+static const char * const mem_category_names[] = {
+	[HOST1X_MEM_OTHER] = "other",
+	[HOST1X_MEM_TEXTURE] = "textures",
+	[HOST1X_MEM_FRAMEBUFFER] = "framebuffers",
+	[HOST1X_MEM_VERTEX] = "vertices",
+	[HOST1X_MEM_COMMANDS] = "commands",
+	[HOST1X_MEM_GUARD] = "guards",
+	[HOST1X_MEM_CACHED] = "cached",
+};
+
+/* serialises the memory accounting of all host1x instances */
+static pthread_mutex_t host1x_mem_lock = PTHREAD_MUTEX_INITIALIZER;
+
 struct host1x *host1x_open(struct host1x_options *options)
 {
 	struct host1x *host1x;
@@ -46,6 +61,8 @@ struct host1x *host1x_open(struct host1x_options *options)
 	host1x = host1x_drm_open(options);
 	if (host1x) {
 		printf("found\n");
+		host1x->backend = "drm";
+		host1x->display_init = host1x_drm_display_init;
 		if (options->open_display)
 			host1x_drm_display_init(host1x);
 		goto out;
@@ -58,6 +75,8 @@ struct host1x *host1x_open(struct host1x_options *options)
 	host1x = host1x_nvhost_open(options);
 	if (host1x) {
 		printf("found\n");
+		host1x->backend = "nvhost";
+		host1x->display_init = host1x_nvhost_display_init;
 		if (options->open_display)
 			host1x_nvhost_display_init(host1x);
 		goto out;
@@ -67,6 +86,8 @@ struct host1x *host1x_open(struct host1x_options *options)
 
 	printf("Kernel driver interface undetected, continuing using a dummy interface!\n\n");
 	host1x = host1x_dummy_open(options);
+	if (host1x)
+		host1x->backend = "dummy";
 out:
 	printf("SoC ID: %s\n", soc_names[options->chip_info.soc_id]);
 
@@ -75,6 +96,14 @@ out:
 
 void host1x_close(struct host1x *host1x)
 {
+	if (host1x->gr2d)
+		host1x_client_queue_stop(host1x->gr2d->client);
+
+	if (host1x->gr3d)
+		host1x_client_queue_stop(host1x->gr3d->client);
+
+	host1x_bo_fence_fini();
+	host1x_bo_cache_fini(host1x);
 	host1x->close(host1x);
 }
 
@@ -83,14 +112,64 @@ struct host1x_display *host1x_get_display(struct host1x *host1x)
 	return host1x->display;
 }
 
+/*
+ * Opens the display of a host1x opened without open_display, which may be
+ * done by another thread while the engines are set up. The display must
+ * not be used before this returns.
+ */
+struct host1x_display *host1x_open_display(struct host1x *host1x)
+{
+	if (!host1x->display && host1x->display_init)
+		host1x->display_init(host1x);
+
+	return host1x->display;
+}
+
+/*
+ * Engines of a host1x opened with lazy_init are set up on the first get,
+ * each engine has its own lock so that both may be set up concurrently.
+ */
+static pthread_mutex_t host1x_gr2d_setup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t host1x_gr3d_setup_lock = PTHREAD_MUTEX_INITIALIZER;
+
 struct host1x_gr2d *host1x_get_gr2d(struct host1x *host1x)
 {
-	return host1x->gr2d;
+	struct host1x_gr2d *gr2d = host1x->gr2d;
+	int err;
+
+	if (!gr2d || __atomic_load_n(&gr2d->ready, __ATOMIC_ACQUIRE))
+		return gr2d;
+
+	pthread_mutex_lock(&host1x_gr2d_setup_lock);
+	err = host1x_gr2d_setup(gr2d);
+	pthread_mutex_unlock(&host1x_gr2d_setup_lock);
+
+	if (err < 0) {
+		host1x_error("GR2D setup failed: %d\n", err);
+		return NULL;
+	}
+
+	return gr2d;
 }
 
 struct host1x_gr3d *host1x_get_gr3d(struct host1x *host1x)
 {
-	return host1x->gr3d;
+	struct host1x_gr3d *gr3d = host1x->gr3d;
+	int err;
+
+	if (!gr3d || __atomic_load_n(&gr3d->ready, __ATOMIC_ACQUIRE))
+		return gr3d;
+
+	pthread_mutex_lock(&host1x_gr3d_setup_lock);
+	err = host1x_gr3d_setup(gr3d);
+	pthread_mutex_unlock(&host1x_gr3d_setup_lock);
+
+	if (err < 0) {
+		host1x_error("GR3D setup failed: %d\n", err);
+		return NULL;
+	}
+
+	return gr3d;
 }
 
 int host1x_display_get_resolution(struct host1x_display *display,
@@ -109,6 +188,78 @@ int host1x_display_set(struct host1x_display *display,
 	return display->set(display, fb, vsync, reflect_y);
 }
 
+/*
+ * Queues a flip to the framebuffer on the next vblank without waiting for
+ * it. Displays that don't support non-blocking flips perform the flip
+ * synchronously.
+ */
+int host1x_display_flip(struct host1x_display *display,
+			struct host1x_framebuffer *fb, bool reflect_y)
+{
+	if (!display->flip)
+		return display->set(display, fb, true, reflect_y);
+
+	return display->flip(display, fb, reflect_y);
+}
+
+/*
+ * Waits for completion of the queued flip, zero timeout polls. Returns
+ * -ETIMEDOUT if the flip is still pending.
+ */
+int host1x_display_wait_flip(struct host1x_display *display,
+			     uint32_t timeout)
+{
+	if (!display->wait_flip)
+		return 0;
+
+	return display->wait_flip(display, timeout);
+}
+
+/*
+ * Returns the CLOCK_MONOTONIC time of the last vblank and the refresh
+ * period, both in microseconds.
+ */
+int host1x_display_get_vblank(struct host1x_display *display,
+			      uint64_t *time, uint64_t *period)
+{
+	if (!display->get_vblank)
+		return -ENOTSUP;
+
+	return display->get_vblank(display, time, period);
+}
+
+/*
+ * The display's events can be waited for by polling the returned fd for
+ * input, host1x_display_handle_events() then reports them. Flips queued by
+ * host1x_display_flip() report their completion, a vblank is reported
+ * once per host1x_display_request_vblank().
+ */
+int host1x_display_get_event_fd(struct host1x_display *display)
+{
+	if (!display->get_event_fd)
+		return -ENOTSUP;
+
+	return display->get_event_fd(display);
+}
+
+int host1x_display_request_vblank(struct host1x_display *display)
+{
+	if (!display->request_vblank)
+		return -ENOTSUP;
+
+	return display->request_vblank(display);
+}
+
+/* doesn't block, returns the number of reported events */
+int host1x_display_handle_events(struct host1x_display *display,
+				 const struct host1x_display_events *events)
+{
+	if (!display->handle_events)
+		return 0;
+
+	return display->handle_events(display, events);
+}
+
 int host1x_overlay_create(struct host1x_overlay **overlayp,
 			  struct host1x_display *display)
 {
@@ -128,24 +279,179 @@ int host1x_overlay_set(struct host1x_overlay *overlay,
 	return overlay->set(overlay, fb, x, y, width, height, vsync, reflect_y);
 }
 
+/*
+ * Queues an update that is applied at the next vblank without waiting for
+ * it. Returns -EBUSY while the display can't take it yet, which includes
+ * a previous update of the overlay that wasn't applied, and -ENOTSUP if
+ * only host1x_overlay_set() is supported.
+ */
+int host1x_overlay_queue(struct host1x_overlay *overlay,
+			 struct host1x_framebuffer *fb, unsigned int x,
+			 unsigned int y, unsigned int width,
+			 unsigned int height, bool reflect_y)
+{
+	if (!overlay->queue)
+		return -ENOTSUP;
+
+	return overlay->queue(overlay, fb, x, y, width, height, reflect_y);
+}
+
+/* waits for the queued update to be applied, a timeout of 0 polls */
+int host1x_overlay_wait(struct host1x_overlay *overlay, uint32_t timeout)
+{
+	if (!overlay->wait)
+		return 0;
+
+	return overlay->wait(overlay, timeout);
+}
+
+bool host1x_overlay_supports(struct host1x_overlay *overlay,
+			     enum pixel_format format)
+{
+	if (!overlay->supports)
+		return true;
+
+	return overlay->supports(overlay, format);
+}
+
+static void host1x_mem_update(struct host1x_mem_category_stats *stats,
+			      int64_t bytes, int count)
+{
+	stats->bytes += bytes;
+	stats->count += count;
+	stats->peak_bytes = MAX(stats->peak_bytes, stats->bytes);
+	stats->peak_count = MAX(stats->peak_count, stats->count);
+}
+
+/* adds or removes the BO, a negative sign removes, under host1x_mem_lock */
+static void host1x_mem_add(struct host1x_bo_priv *priv, int sign)
+{
+	struct host1x *host1x = priv->mem_host1x;
+	int64_t guard = priv->mem_guard;
+	int64_t size = priv->cache_size;
+
+	host1x_mem_update(&host1x->mem[priv->mem_category],
+			  sign * (size - guard), sign);
+
+	if (guard)
+		host1x_mem_update(&host1x->mem[HOST1X_MEM_GUARD],
+				  sign * guard, sign);
+
+	host1x_mem_update(&host1x->mem_total, sign * size, sign);
+}
+
+/* (re)accounts the BO to the category, guard bytes excluded */
+void host1x_bo_account(struct host1x_bo_priv *priv,
+		       enum host1x_mem_category category, size_t guard)
+{
+	if (!priv->mem_host1x)
+		return;
+
+	pthread_mutex_lock(&host1x_mem_lock);
+
+	if (priv->mem_accounted)
+		host1x_mem_add(priv, -1);
+
+	priv->mem_category = category;
+	priv->mem_guard = MIN(guard, priv->cache_size);
+	priv->mem_accounted = true;
+
+	host1x_mem_add(priv, 1);
+
+	pthread_mutex_unlock(&host1x_mem_lock);
+}
+
+void host1x_bo_unaccount(struct host1x_bo_priv *priv)
+{
+	if (!priv->mem_host1x)
+		return;
+
+	pthread_mutex_lock(&host1x_mem_lock);
+
+	if (priv->mem_accounted)
+		host1x_mem_add(priv, -1);
+
+	priv->mem_accounted = false;
+
+	pthread_mutex_unlock(&host1x_mem_lock);
+}
+
+static enum host1x_mem_category host1x_bo_flags_category(unsigned long flags)
+{
+	if (flags & HOST1X_BO_CATEGORY_MASK)
+		return (flags & HOST1X_BO_CATEGORY_MASK) >> 16;
+
+	switch (flags & 0xff) {
+	case NVHOST_BO_FLAG_FRAMEBUFFER:
+		return HOST1X_MEM_FRAMEBUFFER;
+	case NVHOST_BO_FLAG_COMMAND_BUFFER:
+		return HOST1X_MEM_COMMANDS;
+	case NVHOST_BO_FLAG_ATTRIBUTES:
+		return HOST1X_MEM_VERTEX;
+	}
+
+	return HOST1X_MEM_OTHER;
+}
+
 struct host1x_bo *host1x_bo_create(struct host1x *host1x, size_t size,
 				   unsigned long flags)
 {
+	enum host1x_mem_category category = host1x_bo_flags_category(flags);
 	struct host1x_bo_priv *priv;
 	struct host1x_bo *bo;
+	size_t cache_size;
+
+	if (category >= HOST1X_MEM_NUM_CATEGORIES ||
+	    category == HOST1X_MEM_GUARD || category == HOST1X_MEM_CACHED)
+		category = HOST1X_MEM_OTHER;
+
+	/* the category isn't a property of the memory */
+	flags &= ~HOST1X_BO_CATEGORY_MASK;
+
+	host1x_bo_fence_reap();
+
+	bo = host1x_bo_cache_get(host1x, size, flags);
+	if (bo) {
+		host1x_bo_account(bo->priv, category, 0);
+		host1x->bo_creates++;
+		return bo;
+	}
 
 	priv = calloc(1, sizeof(*priv));
 	if (!priv)
 		return NULL;
 
-	bo = host1x->bo_create(host1x, priv, size, flags);
+	cache_size = host1x_bo_cache_size_class(size);
+
+	bo = host1x->bo_create(host1x, priv, cache_size, flags);
 	if (!bo) {
-		free(priv);
-		return NULL;
+		/* give the cached memory back and retry */
+		host1x_bo_cache_trim(host1x);
+
+		bo = host1x->bo_create(host1x, priv, cache_size, flags);
+		if (!bo) {
+			host1x_error("failed to allocate %zu bytes of %s\n",
+				     cache_size,
+				     host1x_mem_category_name(category));
+			host1x_memory_stats_print(host1x, stderr);
+			free(priv);
+			return NULL;
+		}
 	}
 
+	priv->cache_host1x = host1x;
+	priv->cache_flags = flags;
+	priv->cache_size = cache_size;
+	priv->mem_host1x = host1x;
+
+	host1x_bo_account(priv, category, 0);
+
 	bo->size = size;
 
+	host1x->bo_creates++;
+	host1x->bo_allocs++;
+	host1x->bo_bytes_allocated += cache_size;
+
 	return bo;
 }
 
@@ -164,14 +470,70 @@ struct host1x_bo *host1x_bo_import(struct host1x *host1x, uint32_t handle)
 	return NULL;
 }
 
-void host1x_bo_free(struct host1x_bo *bo)
+/* import a PRIME buffer, the fd stays owned by the caller */
+struct host1x_bo *host1x_bo_import_dmabuf(struct host1x *host1x, int fd)
+{
+	struct host1x_bo_priv *priv;
+	struct host1x_bo *bo;
+
+	if (!host1x->bo_import_dmabuf)
+		return NULL;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return NULL;
+
+	bo = host1x->bo_import_dmabuf(host1x, priv, fd);
+	if (!bo)
+		free(priv);
+
+	return bo;
+}
+
+/* the BO is idle, it goes to the cache or is destroyed */
+void host1x_bo_release(struct host1x_bo *bo)
 {
 	struct host1x_bo_priv *priv = bo->priv;
 
+	if (host1x_bo_cache_put(bo))
+		return;
+
+	host1x_bo_unaccount(priv);
+
 	bo->priv->free(bo);
+	free(priv->busy);
 	free(priv);
 }
 
+/*
+ * The BO may be freed while jobs referencing it are still recorded or
+ * executed, it is released once they are done.
+ */
+void host1x_bo_free(struct host1x_bo *bo)
+{
+	struct host1x_bo_priv *priv = bo->priv;
+
+	if (priv->cache_host1x)
+		priv->cache_host1x->bo_frees++;
+
+	if (host1x_bo_defer_free(bo))
+		return;
+
+	host1x_bo_release(bo);
+}
+
+/* retags the BO for the memory accounting, wraps retag the wrapped BO */
+void host1x_bo_set_category(struct host1x_bo *bo,
+			    enum host1x_mem_category category)
+{
+	struct host1x_bo_priv *priv = (bo->wrapped ?: bo)->priv;
+
+	if (category >= HOST1X_MEM_NUM_CATEGORIES)
+		return;
+
+	host1x_bo_account(priv, category, priv->mem_guard);
+}
+
 int host1x_bo_mmap(struct host1x_bo *bo, void **ptr)
 {
 	int err;
@@ -186,9 +548,24 @@ int host1x_bo_mmap(struct host1x_bo *bo, void **ptr)
 	return 0;
 }
 
+/* true if the CPU mapping of the BO bypasses the CPU caches */
+static bool host1x_bo_uncached(struct host1x_bo *bo)
+{
+	switch (bo->priv->cache_flags & HOST1X_BO_MAP_MASK) {
+	case HOST1X_BO_MAP_WRITE_COMBINE:
+	case HOST1X_BO_MAP_UNCACHED:
+		return true;
+	}
+
+	return false;
+}
+
 int host1x_bo_invalidate(struct host1x_bo *bo, unsigned long offset,
 			 size_t length)
 {
+	if (host1x_bo_uncached(bo))
+		return 0;
+
 	if (bo->priv->invalidate)
 		return bo->priv->invalidate(bo, offset, length);
 
@@ -198,20 +575,59 @@ int host1x_bo_invalidate(struct host1x_bo *bo, unsigned long offset,
 int host1x_bo_flush(struct host1x_bo *bo, unsigned long offset,
 		    size_t length)
 {
+	/* only the write buffers need to be drained, no cache maintenance */
+	if (host1x_bo_uncached(bo)) {
+		__sync_synchronize();
+		return 0;
+	}
+
 	if (bo->priv->flush)
 		return bo->priv->flush(bo, offset, length);
 
 	return 0;
 }
 
+void host1x_bo_flush_batch_begin(struct host1x *host1x)
+{
+	if (host1x->flush_batch_begin)
+		host1x->flush_batch_begin(host1x);
+}
+
+int host1x_bo_flush_batch_end(struct host1x *host1x)
+{
+	if (host1x->flush_batch_end)
+		return host1x->flush_batch_end(host1x);
+
+	return 0;
+}
+
 int host1x_bo_export(struct host1x_bo *bo, uint32_t *handle)
 {
+	struct host1x_bo *orig = bo->wrapped ?: bo;
+
+	/* an exported BO may be in use by others after it was freed */
+	orig->priv->cache_host1x = NULL;
+
 	if (bo->priv->export)
 		return bo->priv->export(bo, handle);
 
 	return -1;
 }
 
+/* the returned fd is owned by the caller and refers to the whole BO */
+int host1x_bo_export_dmabuf(struct host1x_bo *bo, int *fd)
+{
+	struct host1x_bo *orig = bo->wrapped ?: bo;
+
+	/* an exported BO may be in use by others after it was freed */
+	orig->priv->cache_host1x = NULL;
+
+	if (bo->priv->export_dmabuf)
+		return bo->priv->export_dmabuf(bo, fd);
+
+	return -ENOTSUP;
+}
+
 /*
  * Offset is given relatively to the wrapped BO and not the original,
  * to make nested wrapping work seamlessly. However the actual offset of
@@ -241,6 +657,8 @@ struct host1x_bo *host1x_bo_wrap(struct host1x_bo *bo,
 	wrap = bo->priv->clone(bo);
 	if (wrap) {
 		memcpy(priv, bo->priv, sizeof(*priv));
+		/* the memory is accounted to the wrapped BO */
+		priv->mem_host1x = NULL;
 		wrap->offset += (bo->wrapped ? bo->size : 0) + offset;
 		wrap->wrapped = orig;
 		wrap->size = size;
@@ -260,105 +678,832 @@ chk_err:
 	return NULL;
 }
 
+/*
+ * Freed jobs are kept around together with their pushbuf and relocation
+ * arrays, so that the common create / append / relocate / free cycle of a
+ * draw doesn't hit the allocator once the arrays have grown large enough.
+ */
+#define HOST1X_JOB_POOL_SIZE	8
+
+static pthread_mutex_t job_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct host1x_job *job_pool[HOST1X_JOB_POOL_SIZE];
+static unsigned int job_pool_count;
+
+static void host1x_job_destroy(struct host1x_job *job)
+{
+	unsigned int i;
+
+	for (i = 0; i < job->max_pushbufs; i++) {
+		struct host1x_pushbuf *pb = &job->pushbufs[i];
+		free(pb->relocs);
+	}
+
+	free(job->pushbufs);
+	free(job);
+}
+
 struct host1x_job *host1x_job_create(uint32_t syncpt, uint32_t increments)
 {
-	struct host1x_job *job;
+	struct host1x_job *job = NULL;
 
-	job = calloc(1, sizeof(*job));
-	if (!job)
-		return NULL;
+	pthread_mutex_lock(&job_pool_lock);
+	if (job_pool_count)
+		job = job_pool[--job_pool_count];
+	pthread_mutex_unlock(&job_pool_lock);
+
+	if (!job) {
+		job = calloc(1, sizeof(*job));
+		if (!job)
+			return NULL;
+	}
 
 	job->syncpt = syncpt;
 	job->syncpt_incrs = increments;
+	job->timeout = 0;
 
 	return job;
 }
 
-void host1x_job_free(struct host1x_job *job)
+/* chained BOs are released once the job is done, see host1x_bo_free() */
+static void host1x_pushbuf_unchain(struct host1x_pushbuf *pb)
+{
+	unsigned int i;
+
+	for (i = 0; i < pb->num_chain; i++) {
+		host1x_bo_free(pb->chain[i].bo);
+		free(pb->chain[i].relocs);
+	}
+
+	free(pb->chain);
+	pb->chain = NULL;
+	pb->num_chain = 0;
+	pb->max_chain = 0;
+}
+
+void host1x_job_reset(struct host1x_job *job)
 {
 	unsigned int i;
 
 	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pb = &job->pushbufs[i];
-		free(pb->relocs);
+		job->pushbufs[i].num_relocs = 0;
+		host1x_pushbuf_unchain(&job->pushbufs[i]);
 	}
 
-	free(job->pushbufs);
-	free(job);
+	job->num_pushbufs = 0;
+	job->timeout = 0;
+}
+
+void host1x_job_free(struct host1x_job *job)
+{
+	host1x_job_reset(job);
+
+	pthread_mutex_lock(&job_pool_lock);
+
+	if (job_pool_count < HOST1X_JOB_POOL_SIZE) {
+		job_pool[job_pool_count++] = job;
+		job = NULL;
+	}
+
+	pthread_mutex_unlock(&job_pool_lock);
+
+	if (job)
+		host1x_job_destroy(job);
 }
 
 struct host1x_pushbuf *host1x_job_append(struct host1x_job *job,
 					 struct host1x_bo *bo,
 					 unsigned long offset)
 {
+	struct host1x_pushbuf_reloc *relocs;
 	struct host1x_pushbuf *pb;
-	size_t size;
+	unsigned long max_relocs;
+	unsigned int max;
 
 	if (!bo->ptr)
 		return NULL;
 
-	size = (job->num_pushbufs + 1) * sizeof(*pb);
+	if (job->num_pushbufs == job->max_pushbufs) {
+		max = job->max_pushbufs ? job->max_pushbufs * 2 : 4;
 
-	pb = realloc(job->pushbufs, size);
-	if (!pb)
-		return NULL;
+		pb = realloc(job->pushbufs, max * sizeof(*pb));
+		if (!pb)
+			return NULL;
 
-	job->pushbufs = pb;
+		memset(pb + job->max_pushbufs, 0,
+		       (max - job->max_pushbufs) * sizeof(*pb));
+
+		job->pushbufs = pb;
+		job->max_pushbufs = max;
+	}
 
 	pb = &job->pushbufs[job->num_pushbufs++];
+
+	/* keep the relocation storage of a recycled pushbuf */
+	relocs = pb->relocs;
+	max_relocs = pb->max_relocs;
+
 	memset(pb, 0, sizeof(*pb));
 
+	pb->relocs = relocs;
+	pb->max_relocs = max_relocs;
 	pb->ptr = bo->ptr + offset;
 	pb->offset = offset;
 	pb->bo = bo;
+	pb->chainable = true;
+
+	if (bo->size > offset)
+		pb->end = bo->ptr + bo->size;
+
+	return pb;
+}
+
+/*
+ * Append a copy of an already recorded pushbuf, this allows to execute
+ * the same commands as a part of multiple jobs without re-recording them.
+ */
+struct host1x_pushbuf *host1x_job_append_pushbuf(struct host1x_job *job,
+						 const struct host1x_pushbuf *src)
+{
+	struct host1x_pushbuf_reloc *relocs;
+	struct host1x_pushbuf *pb;
+
+	/* the chained BOs belong to the job of the source */
+	if (src->num_chain) {
+		host1x_error("Chained pushbufs can't be appended\n");
+		return NULL;
+	}
+
+	pb = host1x_job_append(job, src->bo, src->offset);
+	if (!pb)
+		return NULL;
+
+	if (pb->max_relocs < src->num_relocs) {
+		relocs = realloc(pb->relocs, src->num_relocs * sizeof(*relocs));
+		if (!relocs) {
+			job->num_pushbufs--;
+			return NULL;
+		}
+
+		pb->relocs = relocs;
+		pb->max_relocs = src->num_relocs;
+	}
+
+	memcpy(pb->relocs, src->relocs, src->num_relocs * sizeof(*relocs));
+	pb->num_relocs = src->num_relocs;
+	pb->length = src->length;
+	pb->ptr = src->ptr;
+	pb->shared = true;
 
 	return pb;
 }
 
+static struct host1x_pushbuf_reloc *
+host1x_pushbuf_add_reloc(struct host1x_pushbuf *pb)
+{
+	struct host1x_pushbuf_reloc *reloc;
+	unsigned long max;
+
+	if (pb->num_relocs == pb->max_relocs) {
+		max = pb->max_relocs ? pb->max_relocs * 2 : 32;
+
+		reloc = realloc(pb->relocs, max * sizeof(*reloc));
+		if (!reloc)
+			return NULL;
+
+		pb->relocs = reloc;
+		pb->max_relocs = max;
+	}
+
+	return &pb->relocs[pb->num_relocs++];
+}
+
+/* upper bound of words of a chained command BO, unless a command is bigger */
+#define HOST1X_PUSHBUF_CHAIN_WORDS	16384
+
+static int host1x_pushbuf_chain_fail(struct host1x_pushbuf *pb, int err)
+{
+	host1x_error("Pushbuf chaining failed: %d\n", err);
+	pb->error = err;
+
+	return err;
+}
+
+/*
+ * Continues the pushbuf in a new command BO. The command that isn't
+ * complete yet is moved over together with its relocations, and the BO
+ * starts with the current class, so that every BO is valid on its own.
+ */
+static int host1x_pushbuf_chain(struct host1x_pushbuf *pb)
+{
+	struct host1x_bo *orig = pb->bo->wrapped ?: pb->bo;
+	struct host1x *host1x = orig->priv->mem_host1x;
+	struct host1x_pushbuf *tail, *seg, *chain;
+	size_t words = HOST1X_PUSHBUF_CHAIN_WORDS;
+	struct host1x_pushbuf_reloc *reloc;
+	unsigned long moved = 0, start, i, j;
+	struct host1x_bo *bo;
+	unsigned int max;
+	int err;
+
+	if (pb->error)
+		return pb->error;
+
+	if (!pb->chainable || !host1x)
+		return host1x_pushbuf_chain_fail(pb, -EOVERFLOW);
+
+	if (pb->num_chain == pb->max_chain) {
+		max = pb->max_chain ? pb->max_chain * 2 : 4;
+
+		chain = realloc(pb->chain, max * sizeof(*chain));
+		if (!chain)
+			return host1x_pushbuf_chain_fail(pb, -ENOMEM);
+
+		pb->chain = chain;
+		pb->max_chain = max;
+	}
+
+	tail = pb->num_chain ? &pb->chain[pb->num_chain - 1] : pb;
+
+	/* a command of the size of the whole BO can't be moved */
+	if (pb->pending && pb->cmd != tail->ptr - tail->length)
+		moved = tail->ptr - pb->cmd;
+
+	words = MAX(words, moved + pb->pending + 2);
+
+	bo = HOST1X_BO_CREATE(host1x, words * 4,
+			      NVHOST_BO_FLAG_COMMAND_BUFFER |
+			      HOST1X_BO_MAP_WRITE_COMBINE);
+	if (!bo)
+		return host1x_pushbuf_chain_fail(pb, -ENOMEM);
+
+	err = HOST1X_BO_MMAP(bo, NULL);
+	if (err < 0) {
+		host1x_bo_free(bo);
+		return host1x_pushbuf_chain_fail(pb, err);
+	}
+
+	seg = &pb->chain[pb->num_chain++];
+	memset(seg, 0, sizeof(*seg));
+	seg->bo = bo;
+	seg->ptr = bo->ptr;
+	seg->end = seg->ptr + words;
+	seg->chainable = true;
+
+	if (pb->classid) {
+		*seg->ptr++ = HOST1X_OPCODE_SETCL(0x000, pb->classid, 0x00);
+		seg->length++;
+	}
+
+	if (!moved)
+		return 0;
+
+	start = host1x_bo_get_offset(tail->bo, pb->cmd);
+
+	for (i = 0; i < tail->num_relocs; i++)
+		if (tail->relocs[i].source_offset >= start)
+			break;
+
+	for (j = i; j < tail->num_relocs; j++) {
+		reloc = host1x_pushbuf_add_reloc(seg);
+		if (!reloc)
+			return host1x_pushbuf_chain_fail(pb, -ENOMEM);
+
+		*reloc = tail->relocs[j];
+		reloc->source_offset = host1x_bo_get_offset(seg->bo, seg->ptr) +
+				       tail->relocs[j].source_offset - start;
+	}
+
+	memcpy(seg->ptr, pb->cmd, moved * 4);
+
+	tail->num_relocs = i;
+	tail->ptr -= moved;
+	tail->length -= moved;
+
+	pb->cmd = seg->ptr;
+	seg->ptr += moved;
+	seg->length += moved;
+
+	return 0;
+}
+
+/* the pushbuf the words go to, chains a new one if the last one is full */
+static struct host1x_pushbuf *host1x_pushbuf_tail(struct host1x_pushbuf *pb)
+{
+	struct host1x_pushbuf *tail = pb;
+
+	if (pb->num_chain)
+		tail = &pb->chain[pb->num_chain - 1];
+
+	if (!tail->end || tail->ptr < tail->end)
+		return tail;
+
+	if (host1x_pushbuf_chain(pb) < 0)
+		return NULL;
+
+	return &pb->chain[pb->num_chain - 1];
+}
+
+/* keeps track of where the commands start and of the current class */
+static void host1x_pushbuf_decode(struct host1x_pushbuf *pb,
+				  struct host1x_pushbuf *tail, uint32_t word)
+{
+	if (pb->pending) {
+		pb->pending--;
+		return;
+	}
+
+	pb->cmd = tail->ptr;
+
+	switch (word >> 28) {
+	case 0x0: /* SETCL */
+		pb->classid = (word >> 6) & 0x3ff;
+		pb->pending = __builtin_popcount(word & 0x3f);
+		break;
+	case 0x1: /* INCR */
+	case 0x2: /* NONINCR */
+		pb->pending = word & 0xffff;
+		break;
+	case 0x3: /* MASK */
+		pb->pending = __builtin_popcount(word & 0xffff);
+		break;
+	case 0x6: /* GATHER */
+		pb->pending = 1;
+		break;
+	default:
+		pb->pending = 0;
+		break;
+	}
+}
+
 int host1x_pushbuf_push(struct host1x_pushbuf *pb, uint32_t word)
 {
-	*pb->ptr++ = word;
-	pb->length++;
+	struct host1x_pushbuf *tail = host1x_pushbuf_tail(pb);
+
+	if (!tail)
+		return pb->error;
+
+	host1x_pushbuf_decode(pb, tail, word);
+
+	*tail->ptr++ = word;
+	tail->length++;
 
 	return 0;
 }
 
+/* the address the next word is written to */
+uint32_t *host1x_pushbuf_cursor(struct host1x_pushbuf *pb)
+{
+	if (pb->num_chain)
+		return pb->chain[pb->num_chain - 1].ptr;
+
+	return pb->ptr;
+}
+
+/* words and relocations pushed so far, including the chained BOs */
+void host1x_pushbuf_count(struct host1x_pushbuf *pb, unsigned long *words,
+			  unsigned long *relocs)
+{
+	unsigned int i;
+
+	*words = pb->length;
+	*relocs = pb->num_relocs;
+
+	for (i = 0; i < pb->num_chain; i++) {
+		*words += pb->chain[i].length;
+		*relocs += pb->chain[i].num_relocs;
+	}
+}
+
 int host1x_pushbuf_relocate(struct host1x_pushbuf *pb, struct host1x_bo *target,
 			    unsigned long offset, unsigned long shift)
 {
 	struct host1x_pushbuf_reloc *reloc;
-	size_t size;
 
-	size = (pb->num_relocs + 1) * sizeof(*reloc);
+	/* the relocated word is pushed next, it goes to the tail */
+	pb = host1x_pushbuf_tail(pb);
+	if (!pb)
+		return -ENOMEM;
 
-	reloc = realloc(pb->relocs, size);
+	reloc = host1x_pushbuf_add_reloc(pb);
 	if (!reloc)
 		return -ENOMEM;
 
-	pb->relocs = reloc;
-
-	reloc = &pb->relocs[pb->num_relocs++];
-
 	reloc->source_offset = host1x_bo_get_offset(pb->bo, pb->ptr);
 	reloc->target_handle = target->handle;
 	reloc->target_offset = offset;
 	reloc->shift = shift;
+	reloc->target = target->wrapped ?: target;
 
 	return 0;
 }
 
+/*
+ * Opts the client into optimizing the pushbufs of submitted jobs, which
+ * drops redundant writes of registers. The pushbufs are rewritten in place
+ * and mustn't be submitted with the original length or relocations again.
+ */
+void host1x_client_optimize_pushbufs(struct host1x_client *client,
+				     bool enable)
+{
+	client->optimize = enable;
+}
+
+static void host1x_client_prepare_pushbuf(struct host1x_client *client,
+					   struct host1x_job *job,
+					   struct host1x_pushbuf *pb)
+{
+	unsigned long i;
+	int saved;
+
+	/* a pushbuf the optimizer fails on is submitted as it is */
+	if (client->optimize) {
+		saved = host1x_pushbuf_optimize(pb);
+		if (saved > 0)
+			client->stats.words_saved += saved;
+	}
+
+	client->stats.words += pb->length;
+	client->stats.relocs += pb->num_relocs;
+
+	/* the job is covered by the flush that follows */
+	for (i = 0; i < pb->num_relocs; i++)
+		host1x_bo_mark_busy(pb->relocs[i].target, job->syncpt);
+}
+
+/*
+ * The backends see the chained BOs as pushbufs of their own, which follow
+ * the pushbuf they continue.
+ */
+static int host1x_client_submit_chained(struct host1x_client *client,
+					struct host1x_job *job,
+					unsigned int count)
+{
+	struct host1x_job flat = *job;
+	struct host1x_pushbuf *pb;
+	unsigned int i, j, n = 0;
+	int err;
+
+	flat.pushbufs = malloc(count * sizeof(*flat.pushbufs));
+	if (!flat.pushbufs)
+		return -ENOMEM;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		pb = &job->pushbufs[i];
+		flat.pushbufs[n++] = *pb;
+
+		for (j = 0; j < pb->num_chain; j++) {
+			HOST1X_BO_FLUSH(pb->chain[j].bo, 0,
+					pb->chain[j].length * 4);
+			host1x_bo_mark_busy(pb->chain[j].bo, job->syncpt);
+			flat.pushbufs[n++] = pb->chain[j];
+		}
+	}
+
+	flat.num_pushbufs = count;
+	flat.max_pushbufs = count;
+
+	err = client->submit(client, &flat);
+	free(flat.pushbufs);
+
+	return err;
+}
+
+static void host1x_client_record_job(struct host1x_client *client,
+				     const struct host1x_job *job)
+{
+	struct host1x_job_record *record;
+	unsigned int i;
+
+	record = &client->history[client->history_next];
+	client->history_next = (client->history_next + 1) %
+			       HOST1X_CLIENT_HISTORY;
+
+	memset(record, 0, sizeof(*record));
+	record->num_pushbufs = job->num_pushbufs;
+	record->timeout = job->timeout ?: client->timeout;
+
+	for (i = 0; i < job->num_pushbufs; i++)
+		record->words += job->pushbufs[i].length;
+
+	if (job->num_pushbufs) {
+		record->handle = job->pushbufs[0].bo->handle;
+		record->offset = job->pushbufs[0].offset;
+	}
+}
+
 int host1x_client_submit(struct host1x_client *client, struct host1x_job *job)
 {
-	return client->submit(client, job);
+	unsigned int count = 0;
+	struct host1x_pushbuf *pb;
+	unsigned int i, j;
+	int err;
+
+	/* only one submitter gets to run the reset of a hang */
+	if (client->recover &&
+	    __atomic_exchange_n(&client->reset_pending, false,
+				__ATOMIC_ACQ_REL)) {
+		err = client->recover(client, client->recover_data);
+		if (err < 0)
+			host1x_error("engine recovery failed: %d\n", err);
+	}
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		pb = &job->pushbufs[i];
+
+		if (pb->error)
+			return pb->error;
+	}
+
+	pthread_mutex_lock(&client->submit_lock);
+
+	client->stats.submits++;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		pb = &job->pushbufs[i];
+
+		host1x_client_prepare_pushbuf(client, job, pb);
+
+		for (j = 0; j < pb->num_chain; j++)
+			host1x_client_prepare_pushbuf(client, job,
+						      &pb->chain[j]);
+
+		count += 1 + pb->num_chain;
+	}
+
+	/* the history has the lengths of the words the engine executes */
+	host1x_client_record_job(client, job);
+
+	if (count != job->num_pushbufs)
+		err = host1x_client_submit_chained(client, job, count);
+	else
+		err = client->submit(client, job);
+
+	pthread_mutex_unlock(&client->submit_lock);
+
+	return err;
 }
 
 int host1x_client_flush(struct host1x_client *client, uint32_t *fence)
 {
-	return client->flush(client, fence);
+	unsigned int i;
+	int err;
+
+	pthread_mutex_lock(&client->submit_lock);
+
+	err = client->flush(client, fence);
+	if (err < 0)
+		goto unlock;
+
+	/* the fence is reached once all jobs submitted so far are done */
+	for (i = 0; i < HOST1X_CLIENT_HISTORY; i++) {
+		if (!client->history[i].flushed) {
+			client->history[i].fence = *fence;
+			client->history[i].flushed = true;
+		}
+	}
+
+	host1x_bo_fence_flushed(client, *fence);
+
+unlock:
+	pthread_mutex_unlock(&client->submit_lock);
+
+	return err;
+}
+
+/* reports the job the syncpoint is stuck at and resets the engine */
+static void host1x_client_hang(struct host1x_client *client, uint32_t fence,
+			       uint32_t value)
+{
+	const struct host1x_job_record *record;
+	struct host1x_job_record hung;
+	bool found = false;
+	unsigned int i;
+
+	__atomic_add_fetch(&client->stats.hangs, 1, __ATOMIC_RELAXED);
+
+	host1x_error("syncpoint %u stuck at %u for %u ms, waiting for %u\n",
+		     client->syncpts[0].id, value, client->timeout, fence);
+
+	/* the oldest job whose fence isn't reached yet */
+	pthread_mutex_lock(&client->submit_lock);
+
+	for (i = 0; i < HOST1X_CLIENT_HISTORY; i++) {
+		record = &client->history[(client->history_next + i) %
+					  HOST1X_CLIENT_HISTORY];
+
+		if (record->flushed && record->num_pushbufs &&
+		    (int32_t)(record->fence - value) > 0) {
+			hung = *record;
+			found = true;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&client->submit_lock);
+
+	if (found)
+		host1x_error("hung job: fence %u, %u pushbufs of %lu words, "
+			     "first at BO %u offset %#lx\n", hung.fence,
+			     hung.num_pushbufs, hung.words, hung.handle,
+			     hung.offset);
+
+	/* the reset goes out with the next submission, see recover */
+	if (client->recover)
+		__atomic_store_n(&client->reset_pending, true,
+				 __ATOMIC_RELEASE);
+
+	__atomic_add_fetch(&client->resets, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Timeout of the oldest job whose fence isn't reached at the value yet. The
+ * history is written by submitters, waiters read it under the submit lock.
+ */
+static uint32_t host1x_client_job_timeout(struct host1x_client *client,
+					  uint32_t value)
+{
+	const struct host1x_job_record *record;
+	uint32_t timeout = client->timeout;
+	unsigned int i;
+
+	pthread_mutex_lock(&client->submit_lock);
+
+	for (i = 0; i < HOST1X_CLIENT_HISTORY; i++) {
+		record = &client->history[(client->history_next + i) %
+					  HOST1X_CLIENT_HISTORY];
+
+		if (record->flushed && record->num_pushbufs &&
+		    (int32_t)(record->fence - value) > 0) {
+			timeout = record->timeout ?: client->timeout;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&client->submit_lock);
+
+	return timeout;
+}
+
+/*
+ * Waits longer than the job timeout are done in slices of it. A syncpoint
+ * that doesn't move for a whole slice is stuck: the hung job is reported
+ * and the engine is recovered. If the syncpoint is still stuck after that,
+ * the wait fails instead of blocking forever.
+ */
+static int host1x_client_wait_checked(struct host1x_client *client,
+				      uint32_t fence, uint32_t timeout)
+{
+	uint32_t slice = client->timeout, last, value, wait;
+	bool stuck = false;
+	int err;
+
+	if (!slice || timeout <= slice || !client->read)
+		return client->wait(client, fence, timeout);
+
+	err = client->read(client, &last);
+	if (err < 0)
+		return client->wait(client, fence, timeout);
+
+	/* the slice follows the timeout of the job that is running */
+	slice = host1x_client_job_timeout(client, last);
+
+	while (true) {
+		wait = MIN(slice, timeout);
+
+		err = client->wait(client, fence, wait);
+		if (err != -EAGAIN && err != -ETIMEDOUT)
+			return err;
+
+		if (timeout != ~0u) {
+			timeout -= wait;
+			if (!timeout)
+				return err;
+		}
+
+		err = client->read(client, &value);
+		if (err < 0)
+			return err;
+
+		if (value != last) {
+			last = value;
+			slice = host1x_client_job_timeout(client, value);
+			continue;
+		}
+
+		if (stuck)
+			return -ETIMEDOUT;
+
+		host1x_client_hang(client, fence, value);
+		stuck = true;
+	}
 }
 
 int host1x_client_wait(struct host1x_client *client, uint32_t fence,
 		       uint32_t timeout)
 {
-	return client->wait(client, fence, timeout);
+	struct timespec start, end;
+	int err;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = host1x_client_wait_checked(client, fence, timeout);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* clients may be waited for by several threads */
+	__atomic_add_fetch(&client->stats.waits, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&client->stats.wait_time_us,
+			   (end.tv_sec - start.tv_sec) * 1000000ll +
+			   (end.tv_nsec - start.tv_nsec) / 1000,
+			   __ATOMIC_RELAXED);
+
+	return err;
+}
+
+/*
+ * Snapshot of the counters accumulated since host1x_open(). Counters never
+ * reset, the difference of two snapshots gives the activity in between.
+ */
+void host1x_get_stats(struct host1x *host1x, struct host1x_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (host1x->gr2d)
+		stats->gr2d = host1x->gr2d->client->stats;
+
+	if (host1x->gr3d)
+		stats->gr3d = host1x->gr3d->client->stats;
+
+	stats->bo_creates = host1x->bo_creates;
+	stats->bo_frees = host1x->bo_frees;
+	stats->bo_allocs = host1x->bo_allocs;
+	stats->bo_bytes_allocated = host1x->bo_bytes_allocated;
+}
+
+void host1x_memory_stats(struct host1x *host1x,
+			 struct host1x_memory_stats *stats)
+{
+	pthread_mutex_lock(&host1x_mem_lock);
+
+	stats->backend = host1x->backend ?: "unknown";
+	memcpy(stats->categories, host1x->mem, sizeof(stats->categories));
+	stats->total = host1x->mem_total;
+
+	pthread_mutex_unlock(&host1x_mem_lock);
+}
+
+const char *host1x_mem_category_name(enum host1x_mem_category category)
+{
+	if (category >= HOST1X_MEM_NUM_CATEGORIES)
+		return "invalid";
+
+	return mem_category_names[category];
+}
+
+static void host1x_mem_print(FILE *fp, const char *name,
+			     const struct host1x_mem_category_stats *s)
+{
+	fprintf(fp, "  %-12s %10llu %8llu %10llu %8llu\n", name,
+		(unsigned long long)s->bytes / 1024,
+		(unsigned long long)s->count,
+		(unsigned long long)s->peak_bytes / 1024,
+		(unsigned long long)s->peak_count);
+}
+
+void host1x_memory_stats_print(struct host1x *host1x, FILE *fp)
+{
+	struct host1x_memory_stats stats;
+	unsigned int i;
+
+	host1x_memory_stats(host1x, &stats);
+
+	fprintf(fp, "%s memory:\n  %-12s %10s %8s %10s %8s\n",
+		stats.backend, "", "KiB", "BOs", "peak KiB", "peak BOs");
+
+	for (i = 0; i < HOST1X_MEM_NUM_CATEGORIES; i++)
+		host1x_mem_print(fp, host1x_mem_category_name(i),
+				 &stats.categories[i]);
+
+	host1x_mem_print(fp, "total", &stats.total);
+}
+
+/*
+ * Makes the channel, which executes the pushbuf, to stall until the given
+ * fence of other client is reached. This allows to express a dependency
+ * between engines without involving the CPU. The pushbuf is switched back
+ * to the given class afterwards.
+ */
+int host1x_pushbuf_wait(struct host1x_pushbuf *pb,
+			struct host1x_client *client, uint32_t fence,
+			uint32_t classid)
+{
+	struct host1x_syncpt *syncpt = &client->syncpts[0];
+
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0x000, HOST1X_CLASS_HOST1X,
+						    0x00));
+
+	/* host class WAIT_SYNCPT register: [31:24] syncpt id, [23:0] value */
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x008, 1));
+	host1x_pushbuf_push(pb, syncpt->id << 24 | (fence & 0xffffff));
+	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0x000, classid, 0x00));
+
+	return 0;
 }
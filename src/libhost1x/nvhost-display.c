@@ -60,6 +60,9 @@ static int overlay_set(struct host1x_overlay *overlayp,
 	case PIX_BUF_FMT_RGB565:
 		pixformat = TEGRA_DC_EXT_FMT_B5G6R5;
 		break;
+	case PIX_BUF_FMT_RGBA5551:
+		pixformat = TEGRA_DC_EXT_FMT_AB5G5R5;
+		break;
 	case PIX_BUF_FMT_RGBA8888:
 		pixformat = TEGRA_DC_EXT_FMT_R8G8B8A8;
 		break;
@@ -67,6 +70,11 @@ static int overlay_set(struct host1x_overlay *overlayp,
 		return -1;
 	}
 
+	/* the display reads memory outside of the submits */
+	err = nvmap_writeback_pending(nvhost->nvmap);
+	if (err < 0)
+		return err;
+
 	memset(&flip, 0, sizeof(flip));
 
 	flip.win[0].index = -1;
@@ -66,8 +66,8 @@ struct nvhost_gr2d *nvhost_gr2d_open(struct nvhost *nvhost)
 void nvhost_gr2d_close(struct nvhost_gr2d *gr2d)
 {
 	if (gr2d) {
-		nvhost_client_exit(&gr2d->client);
 		host1x_gr2d_exit(&gr2d->base);
+		nvhost_client_exit(&gr2d->client);
 	}
 
 	free(gr2d);
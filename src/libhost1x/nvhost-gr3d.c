@@ -66,8 +66,8 @@ struct nvhost_gr3d *nvhost_gr3d_open(struct nvhost *nvhost)
 void nvhost_gr3d_close(struct nvhost_gr3d *gr3d)
 {
 	if (gr3d) {
-		nvhost_client_exit(&gr3d->client);
 		host1x_gr3d_exit(&gr3d->base);
+		nvhost_client_exit(&gr3d->client);
 	}
 
 	free(gr3d);
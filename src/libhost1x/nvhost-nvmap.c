@@ -23,6 +23,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -119,12 +120,21 @@ struct nvmap *nvmap_open(void)
 		return NULL;
 	}
 
+	pthread_mutex_init(&nvmap->lock, NULL);
+	INIT_LIST_HEAD(&nvmap->dirty);
+	INIT_LIST_HEAD(&nvmap->pool);
+
 	return nvmap;
 }
 
 void nvmap_close(struct nvmap *nvmap)
 {
+	struct nvmap_handle *handle, *tmp;
+
 	if (nvmap) {
+		list_for_each_entry_safe(handle, tmp, &nvmap->pool, pool_node)
+			nvmap_handle_free(nvmap, handle);
+
 		if (nvmap->fd >= 0)
 			close(nvmap->fd);
 	}
@@ -162,6 +172,24 @@ void nvmap_handle_free(struct nvmap *nvmap, struct nvmap_handle *handle)
 {
 	int err;
 
+	/* contents of a freed handle don't need to reach the memory */
+	pthread_mutex_lock(&nvmap->lock);
+	if (handle->dirty_end)
+		list_del(&handle->dirty_node);
+	pthread_mutex_unlock(&nvmap->lock);
+
+	if (handle->pinned) {
+		struct nvmap_pin_handle args;
+
+		memset(&args, 0, sizeof(args));
+		args.handles = handle->id;
+		args.count = 1;
+
+		err = ioctl(nvmap->fd, NVMAP_IOCTL_UNPIN, &args);
+		if (err < 0)
+			host1x_error("Failed to unpin nvmap handle\n");
+	}
+
 	err = ioctl(nvmap->fd, NVMAP_IOCTL_FREE, handle->id);
 	if (err < 0) {
 		host1x_error("Failed to free nvmap handle\n");
@@ -188,6 +216,10 @@ int nvmap_handle_alloc(struct nvmap *nvmap, struct nvmap_handle *handle,
 		return -errno;
 	}
 
+	handle->heap_mask = heap_mask;
+	handle->flags = flags;
+	handle->align = align;
+
 	return 0;
 }
 
@@ -204,6 +236,10 @@ int nvmap_handle_mmap(struct nvmap *nvmap, struct nvmap_handle *handle)
 
 	handle->ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
 			   nvmap->fd, 0);
+	if (handle->ptr == MAP_FAILED) {
+		handle->ptr = NULL;
+		return -errno;
+	}
 
 	memset(&args, 0, sizeof(args));
 	args.handle = handle->id;
@@ -214,18 +250,42 @@ int nvmap_handle_mmap(struct nvmap *nvmap, struct nvmap_handle *handle)
 
 	err = ioctl(nvmap->fd, NVMAP_IOCTL_MMAP, &args);
 	if (err < 0) {
+		err = -errno;
 		munmap(handle->ptr, size);
-		return -errno;
+		handle->ptr = NULL;
+		return err;
 	}
 
 	return 0;
 }
 
+static int nvmap_handle_writeback_dirty(struct nvmap *nvmap,
+					struct nvmap_handle *handle)
+{
+	unsigned long start = handle->dirty_start;
+	unsigned long end = handle->dirty_end;
+
+	list_del(&handle->dirty_node);
+	handle->dirty_end = 0;
+
+	return nvmap_handle_writeback_invalidate(nvmap, handle, start,
+						 end - start);
+}
+
 int nvmap_handle_invalidate(struct nvmap *nvmap, struct nvmap_handle *handle,
 			    unsigned long offset, unsigned long length)
 {
 	struct nvmap_cache_op args;
-	int err;
+	int err = 0;
+
+	/* invalidation would discard the CPU writes of a pending writeback */
+	pthread_mutex_lock(&nvmap->lock);
+	if (handle->dirty_end)
+		err = nvmap_handle_writeback_dirty(nvmap, handle);
+	pthread_mutex_unlock(&nvmap->lock);
+
+	if (err < 0)
+		return err;
 
 	memset(&args, 0, sizeof(args));
 	args.addr = (uintptr_t)handle->ptr + offset;
@@ -260,3 +320,221 @@ int nvmap_handle_writeback_invalidate(struct nvmap *nvmap,
 
 	return 0;
 }
+
+/*
+ * Outside of a batch the writeback is issued right away, within a batch
+ * it's merged with the pending writeback of the handle. A handle is
+ * written back once per batch, however many times its ranges are flushed.
+ */
+int nvmap_handle_writeback_deferred(struct nvmap *nvmap,
+				    struct nvmap_handle *handle,
+				    unsigned long offset,
+				    unsigned long length)
+{
+	if (!length)
+		return 0;
+
+	pthread_mutex_lock(&nvmap->lock);
+
+	if (!nvmap->batch) {
+		pthread_mutex_unlock(&nvmap->lock);
+
+		return nvmap_handle_writeback_invalidate(nvmap, handle,
+							 offset, length);
+	}
+
+	if (handle->dirty_end) {
+		handle->dirty_start = MIN(handle->dirty_start, offset);
+		handle->dirty_end = MAX(handle->dirty_end, offset + length);
+	} else {
+		handle->dirty_start = offset;
+		handle->dirty_end = offset + length;
+		list_add_tail(&handle->dirty_node, &nvmap->dirty);
+	}
+
+	pthread_mutex_unlock(&nvmap->lock);
+
+	return 0;
+}
+
+void nvmap_batch_begin(struct nvmap *nvmap)
+{
+	pthread_mutex_lock(&nvmap->lock);
+	nvmap->batch++;
+	pthread_mutex_unlock(&nvmap->lock);
+}
+
+int nvmap_batch_end(struct nvmap *nvmap)
+{
+	bool last;
+
+	pthread_mutex_lock(&nvmap->lock);
+	if (nvmap->batch)
+		nvmap->batch--;
+	last = !nvmap->batch;
+	pthread_mutex_unlock(&nvmap->lock);
+
+	return last ? nvmap_writeback_pending(nvmap) : 0;
+}
+
+/* returns the first error, the remaining writebacks are issued anyway */
+int nvmap_writeback_pending(struct nvmap *nvmap)
+{
+	struct nvmap_handle *handle, *tmp;
+	int ret = 0, err;
+
+	pthread_mutex_lock(&nvmap->lock);
+
+	list_for_each_entry_safe(handle, tmp, &nvmap->dirty, dirty_node) {
+		err = nvmap_handle_writeback_dirty(nvmap, handle);
+		if (err < 0 && !ret)
+			ret = err;
+	}
+
+	pthread_mutex_unlock(&nvmap->lock);
+
+	return ret;
+}
+
+/*
+ * Small handles are allocated in bulk and pinned by a single ioctl, the
+ * freed ones are kept allocated, mapped and pinned for reuse. The kernel
+ * pins the buffers of every submit, which is merely a refcount increment
+ * for a handle that is pinned already.
+ */
+#define NVMAP_POOL_MAX_SIZE	(64 * 1024)
+#define NVMAP_POOL_MAX_HANDLES	64
+#define NVMAP_POOL_BULK		4
+
+static bool nvmap_handle_matches(struct nvmap_handle *handle, size_t size,
+				 unsigned long heap_mask, unsigned long flags,
+				 unsigned long align)
+{
+	return handle->size == size && handle->heap_mask == heap_mask &&
+	       handle->flags == flags && handle->align == align;
+}
+
+static int nvmap_handles_pin(struct nvmap *nvmap,
+			     struct nvmap_handle **handles,
+			     unsigned int count)
+{
+	uint32_t ids[NVMAP_POOL_BULK], addrs[NVMAP_POOL_BULK];
+	struct nvmap_pin_handle args;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < count; i++)
+		ids[i] = handles[i]->id;
+
+	/* a single handle is passed by value, multiple ones by pointer */
+	memset(&args, 0, sizeof(args));
+	args.handles = count > 1 ? (uintptr_t)ids : ids[0];
+	args.addr = count > 1 ? (uintptr_t)addrs : 0;
+	args.count = count;
+
+	err = ioctl(nvmap->fd, NVMAP_IOCTL_PIN, &args);
+	if (err < 0)
+		return -errno;
+
+	for (i = 0; i < count; i++)
+		handles[i]->pinned = true;
+
+	return 0;
+}
+
+static struct nvmap_handle *nvmap_pool_alloc(struct nvmap *nvmap,
+					     size_t size,
+					     unsigned long heap_mask,
+					     unsigned long flags,
+					     unsigned long align)
+{
+	struct nvmap_handle *handles[NVMAP_POOL_BULK];
+	unsigned int i, count;
+
+	for (count = 0; count < NVMAP_POOL_BULK; count++) {
+		handles[count] = nvmap_handle_create(nvmap, size);
+		if (!handles[count])
+			break;
+
+		if (nvmap_handle_alloc(nvmap, handles[count], heap_mask, flags,
+				       align) < 0) {
+			nvmap_handle_free(nvmap, handles[count]);
+			break;
+		}
+	}
+
+	if (!count)
+		return NULL;
+
+	/* unpinned handles are fine, the submit pins them on its own */
+	if (nvmap_handles_pin(nvmap, handles, count) < 0)
+		host1x_error("Failed to pin nvmap handles\n");
+
+	pthread_mutex_lock(&nvmap->lock);
+
+	for (i = 1; i < count; i++) {
+		list_add_tail(&handles[i]->pool_node, &nvmap->pool);
+		nvmap->pool_count++;
+	}
+
+	pthread_mutex_unlock(&nvmap->lock);
+
+	return handles[0];
+}
+
+/*
+ * Returns an allocated handle of the pool, NULL if the size is too large
+ * for pooling or the allocation failed.
+ */
+struct nvmap_handle *nvmap_handle_pool_get(struct nvmap *nvmap, size_t size,
+					   unsigned long heap_mask,
+					   unsigned long flags,
+					   unsigned long align)
+{
+	struct nvmap_handle *handle;
+
+	size = ROUNDUP(size, 4096);
+	if (size > NVMAP_POOL_MAX_SIZE)
+		return NULL;
+
+	pthread_mutex_lock(&nvmap->lock);
+
+	list_for_each_entry(handle, &nvmap->pool, pool_node) {
+		if (nvmap_handle_matches(handle, size, heap_mask, flags,
+					 align)) {
+			list_del(&handle->pool_node);
+			nvmap->pool_count--;
+			pthread_mutex_unlock(&nvmap->lock);
+
+			return handle;
+		}
+	}
+
+	pthread_mutex_unlock(&nvmap->lock);
+
+	return nvmap_pool_alloc(nvmap, size, heap_mask, flags, align);
+}
+
+/* returns the handle to the pool, frees it if the pool is full */
+void nvmap_handle_pool_put(struct nvmap *nvmap, struct nvmap_handle *handle)
+{
+	pthread_mutex_lock(&nvmap->lock);
+
+	if (handle->size > NVMAP_POOL_MAX_SIZE ||
+	    nvmap->pool_count >= NVMAP_POOL_MAX_HANDLES) {
+		pthread_mutex_unlock(&nvmap->lock);
+		nvmap_handle_free(nvmap, handle);
+		return;
+	}
+
+	/* contents of a freed handle don't need to reach the memory */
+	if (handle->dirty_end) {
+		list_del(&handle->dirty_node);
+		handle->dirty_end = 0;
+	}
+
+	list_add(&handle->pool_node, &nvmap->pool);
+	nvmap->pool_count++;
+
+	pthread_mutex_unlock(&nvmap->lock);
+}
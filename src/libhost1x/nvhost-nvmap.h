@@ -24,11 +24,27 @@
 #ifndef GRATE_HOST1X_NVHOST_NVMAP_H
 #define GRATE_HOST1X_NVHOST_NVMAP_H 1
 
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "list.h"
+
 struct nvmap {
 	int fd;
+
+	/*
+	 * Writebacks of a batch are merged per handle and issued by
+	 * nvmap_writeback_pending() before the GPU or display reads memory.
+	 */
+	pthread_mutex_t lock;
+	unsigned int batch;
+	struct list_head dirty;
+
+	/* freed and bulk allocated handles of up to 64 KiB, protected by lock */
+	struct list_head pool;
+	unsigned int pool_count;
 };
 
 struct nvmap *nvmap_open(void);
@@ -38,6 +54,18 @@ struct nvmap_handle {
 	size_t size;
 	uint32_t id;
 	void *ptr;
+
+	/* parameters of the allocation, a pooled handle matches all of them */
+	unsigned long heap_mask;
+	unsigned long flags;
+	unsigned long align;
+	bool pinned;
+	struct list_head pool_node;
+
+	/* range of a pending writeback, linked if end isn't zero */
+	struct list_head dirty_node;
+	unsigned long dirty_start;
+	unsigned long dirty_end;
 };
 
 static inline unsigned long
@@ -52,6 +80,7 @@ nvmap_handle_get_offset(struct nvmap_handle *handle, void *ptr)
 #define NVMAP_HEAP_CARVEOUT_GENERIC (1ul << 0)
 
 #define NVMAP_HANDLE_UNREACHABLE     (0x0ul << 0)
+#define NVMAP_HANDLE_UNCACHEABLE     (0x0ul << 0)
 #define NVMAP_HANDLE_WRITE_COMBINE   (0x1ul << 0)
 #define NVMAP_HANDLE_INNER_CACHEABLE (0x2ul << 0)
 #define NVMAP_HANDLE_CACHEABLE       (0x3ul << 0)
@@ -67,6 +96,11 @@ void nvmap_handle_free(struct nvmap *nvmap, struct nvmap_handle *handle);
 int nvmap_handle_alloc(struct nvmap *nvmap, struct nvmap_handle *handle,
 		       unsigned long heap_mask, unsigned long flags,
 		       unsigned long align);
+struct nvmap_handle *nvmap_handle_pool_get(struct nvmap *nvmap, size_t size,
+					   unsigned long heap_mask,
+					   unsigned long flags,
+					   unsigned long align);
+void nvmap_handle_pool_put(struct nvmap *nvmap, struct nvmap_handle *handle);
 int nvmap_handle_mmap(struct nvmap *nvmap, struct nvmap_handle *handle);
 int nvmap_handle_invalidate(struct nvmap *nvmap, struct nvmap_handle *handle,
 			    unsigned long offset, unsigned long length);
@@ -74,6 +108,13 @@ int nvmap_handle_writeback_invalidate(struct nvmap *nvmap,
 				      struct nvmap_handle *handle,
 				      unsigned long offset,
 				      unsigned long length);
+int nvmap_handle_writeback_deferred(struct nvmap *nvmap,
+				    struct nvmap_handle *handle,
+				    unsigned long offset,
+				    unsigned long length);
+void nvmap_batch_begin(struct nvmap *nvmap);
+int nvmap_batch_end(struct nvmap *nvmap);
+int nvmap_writeback_pending(struct nvmap *nvmap);
 
 struct nvmap_framebuffer {
 	unsigned short width;
@@ -23,7 +23,9 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -229,8 +231,13 @@ static int nvhost_client_submit(struct host1x_client *client,
 {
 	struct nvhost_client *nvhost = to_nvhost_client(client);
 	struct nvhost_submit_hdr_ext args;
+	struct nvhost_reloc_shift *shift;
 	unsigned long num_relocs = 0;
+	struct nvhost_cmdbuf *cmdbuf;
+	struct nvhost_reloc *reloc;
 	unsigned int i, j;
+	ssize_t written;
+	size_t size;
 	int err;
 
 	for (i = 0; i < job->num_pushbufs; i++) {
@@ -239,14 +246,18 @@ static int nvhost_client_submit(struct host1x_client *client,
 		struct nvmap_handle *handle = bo->handle;
 		unsigned long length = pb->length * 4;
 
-		err = nvmap_handle_writeback_invalidate(nvhost->nvmap, handle,
-							pb->offset, length);
+		err = nvmap_handle_writeback_deferred(nvhost->nvmap, handle,
+						      pb->offset, length);
 		if (err < 0) {
 		}
 
 		num_relocs += pb->num_relocs;
 	}
 
+	err = nvmap_writeback_pending(nvhost->nvmap);
+	if (err < 0)
+		host1x_error("nvmap_writeback_pending() failed %d\n", err);
+
 	memset(&args, 0, sizeof(args));
 	args.syncpt_id = job->syncpt;
 	args.syncpt_incrs = job->syncpt_incrs;
@@ -257,61 +268,67 @@ static int nvhost_client_submit(struct host1x_client *client,
 	args.num_waitchks = 0;
 	args.waitchk_mask = 0;
 
-	err = ioctl(nvhost->fd, NVHOST_IOCTL_CHANNEL_SUBMIT_EXT, &args);
-	if (err < 0) {
-		host1x_error("NVHOST_IOCTL_CHANNEL_SUBMIT_EXT: %d\n", errno);
-		return -errno;
+	/*
+	 * The channel consumes the cmdbufs, relocs and shifts announced by
+	 * the header in this order from whatever it is written, hence the
+	 * job is staged to be written at once.
+	 */
+	size = job->num_pushbufs * sizeof(struct nvhost_cmdbuf) +
+	       num_relocs * (sizeof(struct nvhost_reloc) +
+			     sizeof(struct nvhost_reloc_shift));
+
+	if (size > nvhost->stage_size) {
+		void *stage = realloc(nvhost->stage, size);
+		if (!stage)
+			return -ENOMEM;
+
+		nvhost->stage = stage;
+		nvhost->stage_size = size;
 	}
 
+	cmdbuf = nvhost->stage;
+	reloc = (struct nvhost_reloc *)(cmdbuf + job->num_pushbufs);
+	shift = (struct nvhost_reloc_shift *)(reloc + num_relocs);
+
 	for (i = 0; i < job->num_pushbufs; i++) {
 		struct host1x_pushbuf *pb = &job->pushbufs[i];
 		struct nvhost_bo *bo = to_nvhost_bo(pb->bo);
-		struct nvhost_cmdbuf cmdbuf;
-
-		memset(&cmdbuf, 0, sizeof(cmdbuf));
-		cmdbuf.mem = bo->handle->id;
-		cmdbuf.offset = pb->offset;
-		cmdbuf.words = pb->length;
-
-		err = write(nvhost->fd, &cmdbuf, sizeof(cmdbuf));
-		if (err < 0) {
-		}
-	}
 
-	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pb = &job->pushbufs[i];
+		cmdbuf->mem = bo->handle->id;
+		cmdbuf->offset = pb->offset;
+		cmdbuf->words = pb->length;
+		cmdbuf++;
 
 		for (j = 0; j < pb->num_relocs; j++) {
 			struct host1x_pushbuf_reloc *r = &pb->relocs[j];
-			struct nvhost_bo *bo = to_nvhost_bo(pb->bo);
-			struct nvhost_reloc reloc;
 
-			memset(&reloc, 0, sizeof(reloc));
-			reloc.cmdbuf_mem = bo->handle->id;
-			reloc.cmdbuf_offset = r->source_offset;
-			reloc.target_mem = r->target_handle;
-			reloc.target_offset = r->target_offset;
+			reloc->cmdbuf_mem = bo->handle->id;
+			reloc->cmdbuf_offset = r->source_offset;
+			reloc->target_mem = r->target_handle;
+			reloc->target_offset = r->target_offset;
+			reloc++;
 
-			err = write(nvhost->fd, &reloc, sizeof(reloc));
-			if (err < 0) {
-			}
+			shift->shift = r->shift;
+			shift++;
 		}
 	}
 
-	for (i = 0; i < job->num_pushbufs; i++) {
-		struct host1x_pushbuf *pb = &job->pushbufs[i];
-
-		for (j = 0; j < pb->num_relocs; j++) {
-			struct host1x_pushbuf_reloc *reloc = &pb->relocs[j];
-			struct nvhost_reloc_shift shift;
+	err = ioctl(nvhost->fd, NVHOST_IOCTL_CHANNEL_SUBMIT_EXT, &args);
+	if (err < 0) {
+		host1x_error("NVHOST_IOCTL_CHANNEL_SUBMIT_EXT: %d\n", errno);
+		return -errno;
+	}
 
-			memset(&shift, 0, sizeof(shift));
-			shift.shift = reloc->shift;
+	written = write(nvhost->fd, nvhost->stage, size);
+	if (written < 0) {
+		host1x_error("write() of the job failed: %d\n", errno);
+		return -errno;
+	}
 
-			err = write(nvhost->fd, &shift, sizeof(shift));
-			if (err < 0) {
-			}
-		}
+	if ((size_t)written != size) {
+		host1x_error("job written partially: %zd of %zu bytes\n",
+			     written, size);
+		return -EIO;
 	}
 
 	return 0;
@@ -356,6 +373,14 @@ static int nvhost_client_wait(struct host1x_client *client, uint32_t fence,
 	return 0;
 }
 
+static int nvhost_client_read(struct host1x_client *client, uint32_t *value)
+{
+	struct nvhost_client *nvhost = to_nvhost_client(client);
+	struct host1x_syncpt *syncpt = &client->syncpts[0];
+
+	return nvhost_ctrl_read_syncpt(nvhost->ctrl, syncpt->id, value);
+}
+
 int nvhost_client_init(struct nvhost_client *client, struct nvmap *nvmap,
 		       struct nvhost_ctrl *ctrl, int fd)
 {
@@ -386,14 +411,18 @@ int nvhost_client_init(struct nvhost_client *client, struct nvmap *nvmap,
 	if (err < 0)
 		return err;
 
+	pthread_mutex_init(&client->base.submit_lock, NULL);
 	client->base.submit = nvhost_client_submit;
 	client->base.flush = nvhost_client_flush;
 	client->base.wait = nvhost_client_wait;
+	client->base.read = nvhost_client_read;
 
 	return 0;
 }
 
 void nvhost_client_exit(struct nvhost_client *client)
 {
+	pthread_mutex_destroy(&client->base.submit_lock);
+	free(client->stage);
 	close(client->fd);
 }
@@ -54,6 +54,10 @@ struct nvhost_client {
 	struct nvhost_ctrl *ctrl;
 	struct nvmap *nvmap;
 	int fd;
+
+	/* cmdbufs, relocs and shifts of a job, written by a single write() */
+	void *stage;
+	size_t stage_size;
 };
 
 static inline struct nvhost_client *to_nvhost_client(struct host1x_client *client)
@@ -29,6 +29,12 @@
 #ifdef HAVE_XCB
 
 #include <errno.h>
+#include <string.h>
+
+#ifdef HAVE_XCB_SHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
 
 #define WIN_WIDTH	720
 #define WIN_HEIGHT	576
@@ -73,7 +79,7 @@ static void *fbdata(struct xcb_stuff *stuff, struct host1x_framebuffer *fb)
 	if (!stuff->pixbuf)
 		return NULL;
 
-	err = host1x_gr2d_surface_blit(stuff->host1x->gr2d,
+	err = host1x_gr2d_surface_blit(host1x_get_gr2d(stuff->host1x),
 				       pixbuf, stuff->pixbuf,
 				       0, 0,
 				       pixbuf->width,
@@ -103,6 +109,87 @@ static int x11_display_set(struct host1x_display *displayp,
 	return 0;
 }
 
+#ifdef HAVE_XCB_SHM
+/*
+ * MIT-SHM presentation: the frame is copied once into a segment shared
+ * with the X server, instead of being streamed through the socket.
+ */
+static int x11_shm_display_set(struct host1x_display *displayp,
+			       struct host1x_framebuffer *fb,
+			       bool vsync, bool reflect_y)
+{
+	struct xcb_stuff *stuff = displayp->priv;
+	void *data;
+
+	data = fbdata(stuff, fb);
+	if (!data)
+		return -1;
+
+	/* the server may still read the previous frame */
+	if (stuff->shm.pending) {
+		free(xcb_get_input_focus_reply(stuff->disp, stuff->shm.sync,
+					       NULL));
+		stuff->shm.pending = false;
+	}
+
+	memcpy(stuff->shm.data, data, WIN_WIDTH * WIN_HEIGHT * 4);
+
+	xcb_shm_put_image(stuff->disp, stuff->win, stuff->gc,
+			  WIN_WIDTH, WIN_HEIGHT, 0, 0,
+			  WIN_WIDTH, WIN_HEIGHT, 0, 0,
+			  24, XCB_IMAGE_FORMAT_Z_PIXMAP, 0,
+			  stuff->shm.seg, 0);
+
+	stuff->shm.sync = xcb_get_input_focus(stuff->disp);
+	stuff->shm.pending = true;
+	xcb_flush(stuff->disp);
+
+	return 0;
+}
+
+static int x11_shm_init(struct xcb_stuff *stuff)
+{
+	xcb_shm_query_version_reply_t *reply;
+	xcb_void_cookie_t cookie;
+	xcb_generic_error_t *err;
+	int id;
+
+	reply = xcb_shm_query_version_reply(stuff->disp,
+				xcb_shm_query_version(stuff->disp), NULL);
+	if (!reply)
+		return -ENOTSUP;
+	free(reply);
+
+	id = shmget(IPC_PRIVATE, WIN_WIDTH * WIN_HEIGHT * 4,
+		    IPC_CREAT | 0600);
+	if (id < 0)
+		return -errno;
+
+	stuff->shm.data = shmat(id, NULL, 0);
+	if (stuff->shm.data == (void *)-1) {
+		shmctl(id, IPC_RMID, NULL);
+		stuff->shm.data = NULL;
+		return -ENOMEM;
+	}
+
+	stuff->shm.seg = xcb_generate_id(stuff->disp);
+	cookie = xcb_shm_attach_checked(stuff->disp, stuff->shm.seg, id, 0);
+	err = xcb_request_check(stuff->disp, cookie);
+
+	/* the segment goes away once both sides detached */
+	shmctl(id, IPC_RMID, NULL);
+
+	if (err) {
+		free(err);
+		shmdt(stuff->shm.data);
+		stuff->shm.data = NULL;
+		return -ENODEV;
+	}
+
+	return 0;
+}
+#endif
+
 int x11_display_create(struct host1x *host1x, struct host1x_display *base,
 		       int drm_fd)
 {
@@ -176,7 +263,20 @@ int x11_display_create(struct host1x *host1x, struct host1x_display *base,
 	base->needs_explicit_vsync = true;
 	host1x->framebuffer_init = NULL;
 
+	/* prefer sharing the buffers with the X server over copying */
+	if (dri3_display_create(stuff, base) == 0)
+		return 0;
+
 	dri2_display_create(stuff, base);
+	if (base->set != x11_display_set)
+		return 0;
+
+#ifdef HAVE_XCB_SHM
+	if (x11_shm_init(stuff) == 0) {
+		base->set = x11_shm_display_set;
+		host1x_info("MIT-SHM initialized\n");
+	}
+#endif
 
 	return 0;
 }
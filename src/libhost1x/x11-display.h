@@ -27,10 +27,24 @@
 
 #ifdef HAVE_XCB
 
+#include <errno.h>
+
 #include <xcb/xcb.h>
 #include <xcb/xcb_icccm.h>
 #include <xcb/xcb_image.h>
 
+#ifdef HAVE_XCB_SHM
+#include <xcb/shm.h>
+#endif
+
+#define DRI3_NUM_BUFFERS	2
+
+struct dri3_buffer {
+	struct host1x_pixelbuffer *pixbuf;
+	xcb_pixmap_t pixmap;
+	bool busy;
+};
+
 struct xcb_stuff {
 	struct host1x_pixelbuffer *pixbuf;
 	struct host1x *host1x;
@@ -39,9 +53,36 @@ struct xcb_stuff {
 	xcb_window_t win;
 	xcb_image_t *img;
 	int drm_fd;
+
+#ifdef HAVE_XCB_SHM
+	struct {
+		xcb_shm_seg_t seg;
+		void *data;
+		/* round-trip after the last put, the segment is free then */
+		xcb_get_input_focus_cookie_t sync;
+		bool pending;
+	} shm;
+#endif
+
+	struct {
+		struct dri3_buffer buffers[DRI3_NUM_BUFFERS];
+		xcb_special_event_t *events;
+		unsigned int current;
+		uint32_t serial;
+	} dri3;
 };
 
 void dri2_display_create(struct xcb_stuff *stuff, struct host1x_display *disp);
+
+#ifdef HAVE_XCB_DRI3
+int dri3_display_create(struct xcb_stuff *stuff, struct host1x_display *disp);
+#else
+static inline int dri3_display_create(struct xcb_stuff *stuff,
+				      struct host1x_display *disp)
+{
+	return -ENOTSUP;
+}
+#endif
 #endif
 
 int x11_display_create(struct host1x *host1x, struct host1x_display *base,
@@ -29,58 +29,15 @@
 #include <envytools/rnndec.h>
 #endif
 
+#include "cdma.h"
 #include "cdma_parser.h"
 
-enum cdma_opcode {
-	HOST1X_OPCODE_SETCL,
-	HOST1X_OPCODE_INCR,
-	HOST1X_OPCODE_NONINCR,
-	HOST1X_OPCODE_MASK,
-	HOST1X_OPCODE_IMM,
-	HOST1X_OPCODE_RESTART,
-	HOST1X_OPCODE_GATHER,
-	HOST1X_OPCODE_EXTEND = 14,
-	HOST1X_OPCODE_CHDONE = 15,
-};
-
-#if 0
-static const char *cdma_opcode_names[] = {
-	"HOST1X_OPCODE_SETCL",
-	"HOST1X_OPCODE_INCR",
-	"HOST1X_OPCODE_NONINCR",
-	"HOST1X_OPCODE_MASK",
-	"HOST1X_OPCODE_IMM",
-	"HOST1X_OPCODE_RESTART",
-	"HOST1X_OPCODE_GATHER",
-	"HOST1X_OPCODE_UNKNOWN_7",
-	"HOST1X_OPCODE_UNKNOWN_8",
-	"HOST1X_OPCODE_UNKNOWN_9",
-	"HOST1X_OPCODE_UNKNOWN_10",
-	"HOST1X_OPCODE_UNKNOWN_11",
-	"HOST1X_OPCODE_UNKNOWN_12",
-	"HOST1X_OPCODE_UNKNOWN_13",
-	"HOST1X_OPCODE_EXTEND",
-	"HOST1X_OPCODE_CHDONE",
-};
-#endif
-
-#define BIT(x) (1 << (x))
-
 struct cdma_stream {
-	uint32_t num_words;
-	uint32_t position;
-	uint32_t *words;
-	uint32_t classid;
 	cdma_write write;
 	void *write_arg;
 	bool print;
 };
 
-static enum cdma_opcode cdma_stream_get_opcode(struct cdma_stream *stream)
-{
-	return (stream->words[stream->position] >> 28) & 0xf;
-}
-
 #ifdef ENABLE_RNN
 
 static void cdma_dump_register_write(uint32_t offset, uint32_t value)
@@ -129,227 +86,114 @@ static void cdma_dump_register_write(uint32_t offset, uint32_t value)
 
 #endif
 
-static void cdma_register_write(struct cdma_stream *stream,
+static void cdma_register_write(void *user, uint32_t classid,
 				uint32_t offset, uint32_t value)
 {
+	struct cdma_stream *stream = user;
+
 	if (stream->print)
 		cdma_dump_register_write(offset, value);
 
 	if (stream->write)
-		stream->write(stream->write_arg, stream->classid, offset, value);
+		stream->write(stream->write_arg, classid, offset, value);
 }
 
-static void cdma_opcode_setcl_dump(struct cdma_stream *stream)
+static void cdma_opcode_dump(void *user, const struct cdma_op *op)
 {
-	uint32_t offset, classid, mask, i;
-
-	offset = (stream->words[stream->position] >> 16) & 0xfff;
-	classid = (stream->words[stream->position] >> 6) & 0x3ff;
-	mask =stream->words[stream->position] & 0x3f;
-
-	if (stream->print)
-		printf("      HOST1X_OPCODE_SETCL: offset:%x classid:%x mask:%x\n",
-		       offset, classid, mask);
-
-	stream->classid = classid;
-
-	for (i = 0; i < 6; i++) {
-		if (mask & BIT(i)) {
-			uint32_t value = stream->words[++stream->position];
-			cdma_register_write(stream, offset + i, value);
-		}
+	const char *name = cdma_opcode_names[op->opcode];
+	const char *insert = "";
+
+	switch (op->opcode) {
+	case CDMA_OPCODE_SETCL:
+		printf("      %s: offset:%x classid:%x mask:%x\n",
+		       name, op->offset, op->classid, op->mask);
+		break;
+
+	case CDMA_OPCODE_INCR:
+	case CDMA_OPCODE_NONINCR:
+		printf("      %s: offset:%x count:%x\n",
+		       name, op->offset, op->count);
+		break;
+
+	case CDMA_OPCODE_MASK:
+		printf("      %s: offset:%x mask:%x\n",
+		       name, op->offset, op->mask);
+		break;
+
+	case CDMA_OPCODE_IMM:
+		printf("      %s: offset:%x value:%x\n",
+		       name, op->offset, op->value);
+		break;
+
+	case CDMA_OPCODE_RESTART:
+		printf("      %s: offset:%x\n", name, op->offset);
+		break;
+
+	case CDMA_OPCODE_GATHER:
+		if (op->insert)
+			insert = op->incr ? "INCR " : "NONINCR ";
+
+		printf("      %s: offset:%x %scount:%x base:%x\n",
+		       name, op->offset, insert, op->count, op->base);
+		break;
+
+	case CDMA_OPCODE_EXTEND:
+		printf("      %s: subop:%x value:%x\n",
+		       name, op->subop, op->value);
+		break;
+
+	case CDMA_OPCODE_CHDONE:
+		printf("      %s\n", name);
+		break;
 	}
-
-	stream->position++;
 }
 
-static void cdma_opcode_incr_dump(struct cdma_stream *stream)
+static void cdma_opcode_error(void *user, uint32_t word)
 {
-	uint32_t offset, count, i;
-
-	offset = (stream->words[stream->position] >> 16) & 0xfff;
-	count = stream->words[stream->position] & 0xffff;
-	stream->position++;
+	struct cdma_stream *stream = user;
 
 	if (stream->print)
-		printf("      HOST1X_OPCODE_INCR: offset:%x count:%x\n",
-		       offset, count);
-
-	for (i = 0; i < count; i++)
-		cdma_register_write(stream, offset + i,
-				    stream->words[stream->position++]);
+		printf("      HOST1X_OPCODE_UNKNOWN: 0x%08x\n", word);
 }
 
-static void cdma_opcode_nonincr_dump(struct cdma_stream *stream)
-{
-	uint32_t offset, count, i;
-
-	offset = (stream->words[stream->position] >> 16) & 0xfff;
-	count = stream->words[stream->position] & 0xffff;
-	stream->position++;
-
-	if (stream->print)
-		printf("      HOST1X_OPCODE_NONINCR: offset:%x count:%x\n",
-		       offset, count);
-
-	for (i = 0; i < count; i++)
-		cdma_register_write(stream, offset,
-				    stream->words[stream->position++]);
-}
-
-static void cdma_opcode_mask_dump(struct cdma_stream *stream)
-{
-	uint32_t offset, mask, i;
-
-	offset = (stream->words[stream->position] >> 16) & 0xfff;
-	mask = stream->words[stream->position] & 0xffff;
-	stream->position++;
-
-	if (stream->print)
-		printf("      HOST1X_OPCODE_MASK: offset:%x mask:%x\n",
-		       offset, mask);
-
-	for (i = 0; i < 16; i++)
-		if (mask & BIT(i))
-			cdma_register_write(stream, offset + i,
-			       stream->words[stream->position++]);
-}
-
-static void cdma_opcode_imm_dump(struct cdma_stream *stream)
-{
-	uint32_t offset, value;
-
-	offset = (stream->words[stream->position] >> 16) & 0xfff;
-	value = stream->words[stream->position] & 0xffff;
-	stream->position++;
-
-	if (stream->print)
-		printf("      HOST1X_OPCODE_IMM: offset:%x value:%x\n",
-		       offset, value);
-
-	cdma_register_write(stream, offset, value);
-}
-
-static void cdma_opcode_restart_dump(struct cdma_stream *stream)
-{
-	uint32_t offset;
-
-	offset = (stream->words[stream->position] & 0x0fffffff) << 4;
-	stream->position++;
-
-	if (stream->print)
-		printf("      HOST1X_OPCODE_RESTART: offset:%x\n", offset);
-}
-
-static void cdma_opcode_gather_dump(struct cdma_stream *stream)
-{
-	uint32_t offset, count;
-	const char *insert;
-
-	offset = (stream->words[stream->position] >> 16) & 0xfff;
-	count = stream->words[stream->position] & 0x3fff;
-
-	if (stream->words[stream->position] & BIT(15)) {
-		if (stream->words[stream->position] & BIT(14))
-			insert = "INCR ";
-		else
-			insert = "NONINCR ";
-	} else {
-		insert = "";
-	}
-	stream->position++;
-
-	if (stream->print)
-		printf("      HOST1X_OPCODE_GATHER: offset:%x %scount:%x base:%x\n",
-		       offset, insert, count, stream->words[++stream->position]);
-}
-
-static void cdma_opcode_extend_dump(struct cdma_stream *stream)
-{
-	uint16_t subop;
-	uint32_t value;
-
-	subop = (stream->words[stream->position] >> 24) & 0xf;
-	value = stream->words[stream->position] & 0xffffff;
-
-	if (stream->print)
-		printf("      HOST1X_OPCODE_EXTEND: subop:%x value:%x\n",
-		       subop, value);
-
-	stream->position++;
-}
+static const struct cdma_visitor cdma_print_visitor = {
+	.op = cdma_opcode_dump,
+	.write = cdma_register_write,
+	.error = cdma_opcode_error,
+};
 
-static void cdma_opcode_chdone_dump(struct cdma_stream *stream)
-{
-	if (stream->print)
-		printf("      HOST1X_OPCODE_CHDONE\n");
-	stream->position++;
-}
+static const struct cdma_visitor cdma_write_visitor = {
+	.write = cdma_register_write,
+	.error = cdma_opcode_error,
+};
 
 void cdma_parse_commands(uint32_t *commands, unsigned int count,
 			 bool print, uint32_t *classid, void *write_arg,
 			 cdma_write write_cb)
 {
 	struct cdma_stream stream = {
-		.classid = classid ? (*classid) : 0,
-		.words = commands,
-		.num_words = count,
-		.position = 0,
 		.write_arg = write_arg,
 		.write = write_cb,
 		.print = print,
 	};
+	struct cdma_decoder dec;
 
 	if (print)
 		printf("    commands: %u\n", count);
 
-	while (stream.position < stream.num_words) {
-		enum cdma_opcode opcode = cdma_stream_get_opcode(&stream);
-
-		switch (opcode) {
-		case HOST1X_OPCODE_SETCL:
-			cdma_opcode_setcl_dump(&stream);
-			break;
-
-		case HOST1X_OPCODE_INCR:
-			cdma_opcode_incr_dump(&stream);
-			break;
-
-		case HOST1X_OPCODE_NONINCR:
-			cdma_opcode_nonincr_dump(&stream);
-			break;
-
-		case HOST1X_OPCODE_MASK:
-			cdma_opcode_mask_dump(&stream);
-			break;
+	/* nothing to do if neither the writes nor the class are wanted */
+	if (!print && !write_cb && !classid)
+		return;
 
-		case HOST1X_OPCODE_IMM:
-			cdma_opcode_imm_dump(&stream);
-			break;
+	cdma_decoder_init(&dec, print ? &cdma_print_visitor :
+					&cdma_write_visitor,
+			  &stream, classid ? *classid : 0);
 
-		case HOST1X_OPCODE_RESTART:
-			cdma_opcode_restart_dump(&stream);
-			break;
+	cdma_decode(&dec, commands, count);
 
-		case HOST1X_OPCODE_GATHER:
-			cdma_opcode_gather_dump(&stream);
-			break;
-
-		case HOST1X_OPCODE_EXTEND:
-			cdma_opcode_extend_dump(&stream);
-			break;
-
-		case HOST1X_OPCODE_CHDONE:
-			cdma_opcode_chdone_dump(&stream);
-			break;
-
-		default:
-			if (print)
-				printf("\n");
-			break;
-		}
-	}
+	if (print && cdma_decode_end(&dec) == -ENODATA)
+		printf("      truncated\n");
 
 	if (classid)
-		*classid = stream.classid;
+		*classid = dec.classid;
 }
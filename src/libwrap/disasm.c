@@ -21,6 +21,7 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -28,6 +29,82 @@
 #include "disasm.h"
 #include "utils.h"
 
+/*
+ * The blob uploads the programs for every draw, mostly the same ones. Each
+ * distinct program is disassembled once, repeated uploads only refer to
+ * it by its number. Programs are told apart by a hash of their words.
+ */
+
+#define DISASM_CACHE_SIZE	1024
+
+enum disasm_program {
+	DISASM_VP,
+	DISASM_LINKER,
+	DISASM_FP,
+	DISASM_NUM_PROGRAMS,
+};
+
+static struct {
+	pthread_mutex_t lock;
+	uint64_t hashes[DISASM_NUM_PROGRAMS][DISASM_CACHE_SIZE];
+	unsigned int ids[DISASM_NUM_PROGRAMS][DISASM_CACHE_SIZE];
+	unsigned int count[DISASM_NUM_PROGRAMS];
+} disasm_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t disasm_hash(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+/*
+ * Returns the number of an already disassembled program or, with first
+ * set, the number the new program is given. Programs that don't fit are
+ * disassembled every time.
+ */
+static unsigned int disasm_cache_lookup(enum disasm_program type,
+					uint64_t hash, bool *first)
+{
+	unsigned int i, index, id = 0;
+
+	/* 0 marks free slots */
+	hash = hash ?: 1;
+	index = hash % DISASM_CACHE_SIZE;
+	*first = true;
+
+	pthread_mutex_lock(&disasm_cache.lock);
+
+	for (i = 0; i < DISASM_CACHE_SIZE; i++) {
+		unsigned int slot = (index + i) % DISASM_CACHE_SIZE;
+
+		if (disasm_cache.hashes[type][slot] == hash) {
+			id = disasm_cache.ids[type][slot];
+			*first = false;
+			break;
+		}
+
+		if (!disasm_cache.hashes[type][slot]) {
+			id = ++disasm_cache.count[type];
+			disasm_cache.hashes[type][slot] = hash;
+			disasm_cache.ids[type][slot] = id;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&disasm_cache.lock);
+
+	return id;
+}
+
 static void disasm_reset_vp(struct disasm_state *d)
 {
 	d->vpe_words_nb = 0;
@@ -190,13 +267,29 @@ void disasm_write_reg(void *opaque, uint32_t host1x_class,
 	}
 }
 
-void disasm_dump(struct disasm_state *d)
+static void disasm_dump_vp(struct disasm_state *d)
 {
-	unsigned int i, k;
-	unsigned int addr;
+	unsigned int i, id;
+	bool first;
+
+	id = disasm_cache_lookup(DISASM_VP,
+				 disasm_hash(0xcbf29ce484222325ull,
+					     d->vpe_words,
+					     d->vpe_words_nb * 4),
+				 &first);
 
 	printf("=======================\n");
 	printf("Vertex instructions: %u\n", d->vpe_words_nb / 4);
+
+	if (id)
+		printf("Vertex program #%u%s\n", id,
+		       first ? "" : ", disassembled above");
+
+	if (!first) {
+		printf("\n");
+		return;
+	}
+
 	printf("\n");
 
 	if (d->vpe_words_nb & 3)
@@ -214,14 +307,68 @@ void disasm_dump(struct disasm_state *d)
 		printf("%s\n", vpe_vliw_disassemble(&instr));
 	}
 	printf("\n");
+}
+
+static void disasm_dump_linker(struct disasm_state *d)
+{
+	unsigned int i, id;
+	bool first;
+
+	id = disasm_cache_lookup(DISASM_LINKER,
+				 disasm_hash(0xcbf29ce484222325ull,
+					     d->lnk_instr,
+					     d->linker_inst_nb *
+					     sizeof(d->lnk_instr[0])),
+				 &first);
 
 	printf("=======================\n");
 	printf("Linker instructions: %u\n", d->linker_inst_nb);
+
+	if (id)
+		printf("Linker program #%u%s\n", id,
+		       first ? "" : ", disassembled above");
+
+	if (!first) {
+		printf("\n");
+		return;
+	}
+
 	printf("\n");
 
 	for (i = 0; i < d->linker_inst_nb; i++)
 		printf("%s\n", linker_instruction_disassemble(&d->lnk_instr[i]));
 	printf("\n");
+}
+
+static uint64_t disasm_hash_fp(struct disasm_state *d)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	hash = disasm_hash(hash, d->pseq_instructions,
+			   d->pseq_words_nb * sizeof(d->pseq_instructions[0]));
+	hash = disasm_hash(hash, d->mfu_sched,
+			   d->mfu_sched_words_nb * sizeof(d->mfu_sched[0]));
+	hash = disasm_hash(hash, d->mfu_words, d->mfu_words_nb * 4);
+	hash = disasm_hash(hash, d->tex_instructions,
+			   d->tex_words_nb * sizeof(d->tex_instructions[0]));
+	hash = disasm_hash(hash, d->alu_sched,
+			   d->alu_sched_words_nb * sizeof(d->alu_sched[0]));
+	hash = disasm_hash(hash, d->alu_words, d->alu_words_nb * 4);
+	hash = disasm_hash(hash, d->alu_complements,
+			   d->alu_complements_nb * 4);
+	hash = disasm_hash(hash, d->dw_instructions,
+			   d->dw_words_nb * sizeof(d->dw_instructions[0]));
+
+	return hash;
+}
+
+static void disasm_dump_fp(struct disasm_state *d)
+{
+	unsigned int i, k, id;
+	unsigned int addr;
+	bool first;
+
+	id = disasm_cache_lookup(DISASM_FP, disasm_hash_fp(d), &first);
 
 	printf("=======================\n");
 	printf("PSEQ instructions: %u\n", d->pseq_words_nb);
@@ -230,6 +377,15 @@ void disasm_dump(struct disasm_state *d)
 	printf("ALU instructions: %u\n", d->alu_sched_words_nb);
 	printf("DW instructions: %u\n", d->dw_words_nb);
 
+	if (id)
+		printf("Fragment program #%u%s\n", id,
+		       first ? "" : ", disassembled above");
+
+	if (!first) {
+		printf("\n");
+		return;
+	}
+
 	if (d->pseq_words_nb != d->mfu_sched_words_nb ||
 	    d->pseq_words_nb != d->tex_words_nb ||
 	    d->pseq_words_nb != d->alu_sched_words_nb ||
@@ -282,3 +438,10 @@ void disasm_dump(struct disasm_state *d)
 	}
 	printf("\n");
 }
+
+void disasm_dump(struct disasm_state *d)
+{
+	disasm_dump_vp(d);
+	disasm_dump_linker(d);
+	disasm_dump_fp(d);
+}
@@ -36,6 +36,7 @@
 #include "host1x.h"
 #include "syscall.h"
 #include "recorder.h"
+#include "trace.h"
 #include "drm_fourcc.h"
 
 enum host1x_class {
@@ -53,8 +54,9 @@ struct drm_context {
 };
 
 struct host1x_file {
-	struct list_head bos;
-	struct list_head contexts;
+	struct list_head bos[FILE_HASH_SIZE];
+	struct list_head contexts[FILE_HASH_SIZE];
+	struct list_head fbs[FILE_HASH_SIZE];
 	struct file file;
 
 	struct rec_ctx *rec_ctx;
@@ -66,10 +68,14 @@ struct host1x_bo {
 	char *mapped;
 
 	struct list_head list;
+	struct list_head fb_node;
 
 	struct bo_rec *rec_bo;
 };
 
+/* the recorder state is shared by all DRM files */
+static pthread_mutex_t host1x_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static inline struct host1x_file *to_host1x_file(struct file *file)
 {
 	return container_of(file, struct host1x_file, file);
@@ -114,6 +120,7 @@ static struct host1x_bo *host1x_bo_new(struct host1x_file *host1x,
 		return NULL;
 
 	INIT_LIST_HEAD(&bo->list);
+	INIT_LIST_HEAD(&bo->fb_node);
 	bo->size = size;
 	bo->id = id;
 	bo->rec_bo = record_create_bo(host1x->rec_ctx, size, flags);
@@ -127,6 +134,7 @@ static void host1x_bo_free(struct host1x_bo *bo)
 		munmap_orig(bo->mapped, bo->size);
 
 	record_destroy_bo(bo->rec_bo);
+	list_del(&bo->fb_node);
 	list_del(&bo->list);
 	free(bo);
 }
@@ -136,7 +144,7 @@ static struct host1x_bo *host1x_file_lookup_bo(struct host1x_file *host1x,
 {
 	struct host1x_bo *bo;
 
-	list_for_each_entry(bo, &host1x->bos, list)
+	list_for_each_entry(bo, file_hash(host1x->bos, id), list)
 		if (bo->id == id)
 			return bo;
 
@@ -171,7 +179,7 @@ static struct drm_context *host1x_file_lookup_context(struct host1x_file *host1x
 {
 	struct drm_context *ctx;
 
-	list_for_each_entry(ctx, &host1x->contexts, list)
+	list_for_each_entry(ctx, file_hash(host1x->contexts, id), list)
 		if (ctx->id == id)
 			return ctx;
 
@@ -265,6 +273,10 @@ static void host1x_file_enter_ioctl_submit(struct host1x_file *host1x,
 		}
 
 		commands = (uint32_t *)(bo->mapped + cmdbuf->offset);
+
+		if (trace_enabled())
+			trace_commands(classid, commands, cmdbuf->words);
+
 		cdma_parse_commands(commands, cmdbuf->words, libwrap_verbose,
 				    &classid, &d, disasm_write_reg);
 
@@ -367,6 +379,14 @@ static void host1x_file_enter_ioctl_gem_set_flags(struct host1x_file *host1x,
 	record_set_bo_flags(bo->rec_bo, args->flags);
 }
 
+/* a BO is found by the ID of the framebuffer added last for it */
+static void host1x_file_add_fb(struct host1x_file *host1x,
+			       struct host1x_bo *bo)
+{
+	list_del(&bo->fb_node);
+	list_add_tail(&bo->fb_node, file_hash(host1x->fbs, bo->rec_bo->fb_id));
+}
+
 static struct host1x_bo *host1x_file_lookup_fb(struct host1x_file *host1x,
 					       unsigned long fb_id)
 {
@@ -375,9 +395,8 @@ static struct host1x_bo *host1x_file_lookup_fb(struct host1x_file *host1x,
 	if (!fb_id)
 		return NULL;
 
-	list_for_each_entry(bo, &host1x->bos, list)
-		if (bo->rec_bo->fb_id == fb_id &&
-		    bo->rec_bo->ctx->id == host1x->rec_ctx->id)
+	list_for_each_entry(bo, file_hash(host1x->fbs, fb_id), fb_node)
+		if (bo->rec_bo->fb_id == fb_id)
 			return bo;
 
 	return NULL;
@@ -443,8 +462,13 @@ static void host1x_file_enter_ioctl_rmfb(struct host1x_file *host1x,
 		return;
 
 	bo = host1x_file_lookup_fb(host1x, *fb_id);
-	if (bo)
-		return record_del_framebuffer(bo->rec_bo);
+	if (!bo)
+		return;
+
+	list_del(&bo->fb_node);
+	INIT_LIST_HEAD(&bo->fb_node);
+
+	record_del_framebuffer(bo->rec_bo);
 }
 
 static int host1x_file_enter_ioctl(struct file *file, unsigned long request,
@@ -515,7 +539,7 @@ static void host1x_file_leave_ioctl_gem_create(struct host1x_file *host1x,
 		abort();
 	}
 
-	list_add_tail(&bo->list, &host1x->bos);
+	list_add_tail(&bo->list, file_hash(host1x->bos, bo->id));
 }
 
 static void host1x_file_leave_ioctl_gem_mmap(struct host1x_file *host1x,
@@ -559,6 +583,10 @@ static void host1x_file_leave_ioctl_syncpt_wait(struct host1x_file *host1x,
 	PRINTF("    thresh: %u\n", args->thresh);
 	PRINTF("    timeout: %u\n", args->timeout);
 	PRINTF("    value: %u\n", args->value);
+
+	/* the value is returned on a timeout too */
+	if (args->timeout && (int32_t)(args->value - args->thresh) < 0)
+		record_gpu_hang();
 }
 
 static void host1x_file_leave_ioctl_submit(struct host1x_file *host1x,
@@ -594,7 +622,7 @@ static void host1x_file_leave_ioctl_open_channel(struct host1x_file *host1x,
 		abort();
 	}
 
-	list_add_tail(&ctx->list, &host1x->contexts);
+	list_add_tail(&ctx->list, file_hash(host1x->contexts, ctx->id));
 }
 
 static void host1x_file_leave_ioctl_close_channel(struct host1x_file *host1x,
@@ -688,7 +716,7 @@ static void host1x_file_leave_ioctl_create_dumb(struct host1x_file *host1x,
 		abort();
 	}
 
-	list_add_tail(&bo->list, &host1x->bos);
+	list_add_tail(&bo->list, file_hash(host1x->bos, bo->id));
 }
 
 static void host1x_file_leave_ioctl_mmap_dumb(struct host1x_file *host1x,
@@ -786,6 +814,8 @@ static void host1x_file_leave_ioctl_addfb(struct host1x_file *host1x,
 	bo->rec_bo->format = pixel_format;
 	bo->rec_bo->fb_id = args->fb_id;
 
+	host1x_file_add_fb(host1x, bo);
+
 	record_add_framebuffer(bo->rec_bo, 0);
 }
 
@@ -829,6 +859,8 @@ static void host1x_file_leave_ioctl_addfb2(struct host1x_file *host1x,
 	bo->rec_bo->format = args->pixel_format;
 	bo->rec_bo->fb_id = args->fb_id;
 
+	host1x_file_add_fb(host1x, bo);
+
 	record_add_framebuffer(bo->rec_bo, args->flags);
 }
 
@@ -848,7 +880,7 @@ static void host1x_file_leave_ioctl_gem_open(struct host1x_file *host1x,
 		abort();
 	}
 
-	list_add_tail(&bo->list, &host1x->bos);
+	list_add_tail(&bo->list, file_hash(host1x->bos, bo->id));
 }
 
 static int host1x_file_leave_ioctl(struct file *file, unsigned long request,
@@ -941,12 +973,16 @@ static void host1x_file_release(struct file *file)
 	struct host1x_file *host1x = to_host1x_file(file);
 	struct host1x_bo *bo, *bo_tmp;
 	struct drm_context *ctx, *ctx_tmp;
+	unsigned int i;
 
-	list_for_each_entry_safe(bo, bo_tmp, &host1x->bos, list)
-		host1x_bo_free(bo);
+	for (i = 0; i < FILE_HASH_SIZE; i++) {
+		list_for_each_entry_safe(bo, bo_tmp, &host1x->bos[i], list)
+			host1x_bo_free(bo);
 
-	list_for_each_entry_safe(ctx, ctx_tmp, &host1x->contexts, list)
-		host1x_context_free(ctx);
+		list_for_each_entry_safe(ctx, ctx_tmp, &host1x->contexts[i],
+					 list)
+			host1x_context_free(ctx);
+	}
 
 	record_destroy_ctx(host1x->rec_ctx);
 
@@ -975,11 +1011,13 @@ static struct file *host1x_file_new(const char *path, int fd)
 	host1x->file.num_ioctls = ARRAY_SIZE(host1x_ioctls);
 	host1x->file.ioctls = host1x_ioctls;
 	host1x->file.ops = &host1x_file_ops;
+	host1x->file.lock = &host1x_lock;
 
 	host1x->rec_ctx = record_create_ctx();
 
-	INIT_LIST_HEAD(&host1x->bos);
-	INIT_LIST_HEAD(&host1x->contexts);
+	file_hash_init(host1x->bos);
+	file_hash_init(host1x->contexts);
+	file_hash_init(host1x->fbs);
 
 	return &host1x->file;
 }
@@ -28,12 +28,16 @@
 #include "cdma_parser.h"
 #include "disasm.h"
 #include "nvhost.h"
+#include "trace.h"
 
 struct nvmap_file {
-	struct list_head handles;
+	struct list_head handles[FILE_HASH_SIZE];
 	struct file file;
 };
 
+/* channels look handles up in the nvmap file */
+static pthread_mutex_t nvmap_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static inline struct nvmap_file *to_nvmap_file(struct file *file)
 {
 	return container_of(file, struct nvmap_file, file);
@@ -98,7 +102,7 @@ static struct nvmap_handle *nvmap_file_lookup_handle(struct nvmap_file *nvmap,
 {
 	struct nvmap_handle *handle;
 
-	list_for_each_entry(handle, &nvmap->handles, list)
+	list_for_each_entry(handle, file_hash(nvmap->handles, id), list)
 		if (handle->id == id)
 			return handle;
 
@@ -272,7 +276,7 @@ static void nvmap_file_leave_ioctl_create(struct nvmap_file *nvmap,
 		abort();
 	}
 
-	list_add_tail(&handle->list, &nvmap->handles);
+	list_add_tail(&handle->list, file_hash(nvmap->handles, handle->id));
 }
 
 static void nvmap_file_leave_ioctl_alloc(struct nvmap_file *nvmap,
@@ -390,8 +394,9 @@ struct file *nvmap_file_new(const char *path, int fd)
 	nvmap->file.num_ioctls = ARRAY_SIZE(nvmap_ioctls);
 	nvmap->file.ioctls = nvmap_ioctls;
 	nvmap->file.ops = &nvmap_file_ops;
+	nvmap->file.lock = &nvmap_lock;
 
-	INIT_LIST_HEAD(&nvmap->handles);
+	file_hash_init(nvmap->handles);
 
 	return &nvmap->file;
 }
@@ -680,7 +685,13 @@ static void nvhost_job_add_pushbuf(struct nvhost_file *nvhost,
 				commands = handle->buffer + cmdbuf->offset;
 
 			nvhost_pushbuf_push(pushbuf, commands, cmdbuf->words);
-			cdma_parse_commands(commands, cmdbuf->words, true,
+
+			if (trace_enabled())
+				trace_commands(nvhost->classid, commands,
+					       cmdbuf->words);
+
+			cdma_parse_commands(commands, cmdbuf->words,
+					    !trace_enabled(),
 					    &nvhost->classid, &nvhost->d,
 					    disasm_write_reg);
 		}
@@ -957,6 +968,7 @@ struct file *nvhost_file_new(const char *path, int fd)
 	nvhost->file.num_ioctls = ARRAY_SIZE(nvhost_ioctls);
 	nvhost->file.ioctls = nvhost_ioctls;
 	nvhost->file.ops = &nvhost_file_ops;
+	nvhost->file.lock = &nvmap_lock;
 
 	disasm_reset(&nvhost->d);
 
@@ -31,20 +31,103 @@
 #include <lz4.h>
 #endif
 
+#ifdef ENABLE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
 #include "recorder.h"
 
 static struct recorder rec;
 static enum record_compression compression = REC_UNCOMPRESSED;
 
-static unsigned long calc_page_checksum(void *page_data, size_t size)
-{
-#ifdef ENABLE_ZLIB
-	return adler32(0, page_data, size);
+#ifdef ENABLE_ZSTD
+static ZSTD_CDict *zstd_cdict;
+
+/* raw pages collected for training of a dictionary */
+static struct {
+	const char *path;
+	uint8_t *samples;
+	unsigned int num_samples;
+} zstd_train;
 #endif
-	return 0;
+
+#define XXH_PRIME64_1	0x9e3779b185ebca87ull
+#define XXH_PRIME64_2	0xc2b2ae3d27d4eb4full
+#define XXH_PRIME64_3	0x165667b19e3779f9ull
+#define XXH_PRIME64_4	0x85ebca77c2b2ae63ull
+
+static inline uint64_t xxh64_rotl(uint64_t x, unsigned int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = xxh64_rotl(acc, 31);
+
+	return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t value)
+{
+	acc ^= xxh64_round(0, value);
+
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
 }
 
-static void record_write_data(void *data, size_t size)
+/*
+ * XXH64 of the page, size has to be a multiple of 32 bytes. The four
+ * independent lanes keep the multipliers busy, which makes it several
+ * times faster than adler32 and it works without zlib. The page is read
+ * in place, it is copied only if it has changed.
+ */
+static uint64_t calc_page_checksum(const void *page_data, size_t size)
+{
+	const uint8_t *p = page_data, *end = p + size;
+	uint64_t v1 = XXH_PRIME64_1 + XXH_PRIME64_2;
+	uint64_t v2 = XXH_PRIME64_2;
+	uint64_t v3 = 0;
+	uint64_t v4 = -XXH_PRIME64_1;
+	uint64_t lane[4], h;
+
+	for (; p < end; p += 32) {
+		memcpy(lane, p, sizeof(lane));
+
+		v1 = xxh64_round(v1, lane[0]);
+		v2 = xxh64_round(v2, lane[1]);
+		v3 = xxh64_round(v3, lane[2]);
+		v4 = xxh64_round(v4, lane[3]);
+	}
+
+	h = xxh64_rotl(v1, 1) + xxh64_rotl(v2, 7) + xxh64_rotl(v3, 12) +
+	    xxh64_rotl(v4, 18);
+	h = xxh64_merge(h, v1);
+	h = xxh64_merge(h, v2);
+	h = xxh64_merge(h, v3);
+	h = xxh64_merge(h, v4);
+	h += size;
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static uint64_t record_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void record_output(const void *data, size_t size)
 {
 	int ret = fwrite(data, size, 1, rec.fout);
 	if (ret != 1) {
@@ -52,12 +135,35 @@ static void record_write_data(void *data, size_t size)
 			__func__, size, ret, strerror(errno));
 		abort();
 	}
+
+	rec.offset += size;
+}
+
+/* called by the writer right before the indexed record is written out */
+static void record_index(uint8_t type, uint32_t frame)
+{
+	struct record_index_entry *entry;
+
+	/* offsets of the flight recorder's segments aren't known */
+	if (rec.ring_frames)
+		return;
+
+	if (rec.num_index == rec.max_index) {
+		rec.max_index = rec.max_index * 2 ?: 1024;
+		rec.index = realloc(rec.index,
+				    rec.max_index * sizeof(*rec.index));
+		assert(rec.index != NULL);
+	}
+
+	entry = &rec.index[rec.num_index++];
+	entry->offset = rec.offset;
+	entry->frame = frame;
+	entry->type = type;
 }
 
-static void record_write_action(struct record_act *r)
+static size_t record_action_size(const struct record_act *r)
 {
 	size_t size = sizeof(r->act);
-	void *data = r;
 
 	switch (r->act) {
 	case REC_START:
@@ -88,6 +194,30 @@ static void record_write_action(struct record_act *r)
 		size += sizeof(r->data.bo_load);
 		break;
 
+	case REC_BO_LOAD_EXTENT:
+		size += sizeof(r->data.bo_load_extent);
+		break;
+
+	case REC_BO_LOAD_STORED:
+		size += sizeof(r->data.bo_load_stored);
+		break;
+
+	case REC_ZSTD_DICT:
+		size += sizeof(r->data.zstd_dict);
+		break;
+
+	case REC_KEYFRAME:
+		size += sizeof(r->data.keyframe);
+		break;
+
+	case REC_INDEX:
+		size += sizeof(r->data.index);
+		break;
+
+	case REC_INDEX_END:
+		size += sizeof(r->data.index_end);
+		break;
+
 	case REC_BO_SET_FLAGS:
 		size += sizeof(r->data.bo_set_flags);
 		break;
@@ -122,28 +252,714 @@ static void record_write_action(struct record_act *r)
 		abort();
 	}
 
-	record_write_data(data, size);
+	return size;
+}
+
+#ifdef ENABLE_ZLIB
+static size_t compress_data_zlib(void *in, void *out,
+				 size_t in_size, size_t out_size)
+{
+	z_stream strm;
+	int ret;
+
+	strm.zalloc = Z_NULL;
+	strm.zfree = Z_NULL;
+	strm.opaque = Z_NULL;
+	strm.avail_in = in_size;
+	strm.next_in = in;
+	strm.avail_out = out_size;
+	strm.next_out = out;
+
+	ret = deflateInit(&strm, Z_BEST_SPEED);
+	assert(ret == Z_OK);
+
+	ret = deflate(&strm, Z_FINISH);
+	if (ret != Z_STREAM_END && ret != Z_OK && ret != Z_BUF_ERROR) {
+		fprintf(stderr, "%s: ERROR: deflate failed: %d\n",
+			__func__, ret);
+		abort();
+	}
+
+	/* data that doesn't fit into the output is stored uncompressed */
+	deflateEnd(&strm);
+
+	if (ret != Z_STREAM_END || strm.total_out >= in_size)
+		return 0;
+
+	return strm.total_out;
+}
+#endif
+
+#ifdef ENABLE_LZ4
+static size_t compress_data_lz4(void *in, void *out,
+				size_t in_size, size_t out_size)
+{
+	return LZ4_compress_default(in, out, in_size, out_size);
+}
+#endif
+
+#ifdef ENABLE_ZSTD
+static size_t compress_data_zstd(void *in, void *out,
+				 size_t in_size, size_t out_size)
+{
+	/* every worker thread compresses with a context of its own */
+	static __thread ZSTD_CCtx *cctx;
+	size_t ret;
+
+	if (!cctx) {
+		cctx = ZSTD_createCCtx();
+		assert(cctx != NULL);
+	}
+
+	if (zstd_cdict)
+		ret = ZSTD_compress_usingCDict(cctx, out, out_size,
+					       in, in_size, zstd_cdict);
+	else
+		ret = ZSTD_compressCCtx(cctx, out, out_size, in, in_size,
+					REC_ZSTD_LEVEL);
+
+	/* data that doesn't fit into the output is stored uncompressed */
+	if (ZSTD_isError(ret))
+		return 0;
+
+	return ret;
+}
+#endif
+
+static size_t compress_data(void *in, void *out,
+			    size_t in_size, size_t out_size)
+{
+#ifdef ENABLE_ZSTD
+	if (compression == REC_ZSTD)
+		return compress_data_zstd(in, out, in_size, out_size);
+#endif
+
+#ifdef ENABLE_LZ4
+	if (compression == REC_LZ4)
+		return compress_data_lz4(in, out, in_size, out_size);
+#endif
+
+#ifdef ENABLE_ZLIB
+	if (compression == REC_ZLIB)
+		return compress_data_zlib(in, out, in_size, out_size);
+#endif
+
+	return 0;
 }
 
+static void *record_queue_worker(void *arg)
+{
+	struct rec_queue *q = &rec.queue;
+	struct rec_queue_entry *e;
+	size_t size;
+
+	pthread_mutex_lock(&q->lock);
+
+	while (true) {
+		/* raw records may have been written out already */
+		if ((int)(q->compress - q->head) < 0)
+			q->compress = q->head;
+
+		if (q->compress == q->tail) {
+			pthread_cond_wait(&q->cond, &q->lock);
+			continue;
+		}
+
+		e = &q->entries[q->compress++ % REC_QUEUE_SIZE];
+		if (!e->page)
+			continue;
+
+		pthread_mutex_unlock(&q->lock);
+
+		size = REC_COMPRESSED_SIZE(e->size);
+
+		e->compressed = malloc(size);
+		assert(e->compressed != NULL);
+
+		/* size 0 means go uncompressed */
+		e->act.data.bo_load_extent.data_size =
+			compress_data(e->buf, e->compressed, e->size, size);
+
+		pthread_mutex_lock(&q->lock);
+		e->state = REC_ENTRY_READY;
+		pthread_cond_broadcast(&q->cond);
+	}
+
+	return NULL;
+}
+
+static void *record_queue_writer(void *arg)
+{
+	struct rec_queue *q = &rec.queue;
+	struct rec_queue_entry *e;
+
+	pthread_mutex_lock(&q->lock);
+
+	while (true) {
+		e = &q->entries[q->head % REC_QUEUE_SIZE];
+
+		while (q->head == q->tail || e->state != REC_ENTRY_READY)
+			pthread_cond_wait(&q->cond, &q->lock);
+
+		pthread_mutex_unlock(&q->lock);
+
+		if (e->call) {
+			e->call();
+		} else if (e->page) {
+			uint32_t data_size =
+				e->act.data.bo_load_extent.data_size;
+
+			record_output(&e->act, record_action_size(&e->act));
+			record_output(data_size ? e->compressed : e->buf,
+				      data_size ?: e->size);
+			free(e->compressed);
+			free(e->buf);
+		} else {
+			if (e->index)
+				record_index(e->index, e->frame);
+
+			record_output(e->data, e->size);
+			free(e->data);
+		}
+
+		pthread_mutex_lock(&q->lock);
+		e->state = REC_ENTRY_FREE;
+		q->head++;
+		pthread_cond_broadcast(&q->cond);
+	}
+
+	return NULL;
+}
+
+/* returns the next free entry with the queue locked, blocks if it's full */
+static struct rec_queue_entry *record_queue_get(void)
+{
+	struct rec_queue *q = &rec.queue;
+
+	pthread_mutex_lock(&q->lock);
+
+	while (q->tail - q->head == REC_QUEUE_SIZE)
+		pthread_cond_wait(&q->cond, &q->lock);
+
+	return &q->entries[q->tail % REC_QUEUE_SIZE];
+}
+
+static void record_queue_put(void)
+{
+	struct rec_queue *q = &rec.queue;
+
+	q->tail++;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* the queue takes over the copy of the extent */
+static void record_queue_extent(const struct record_act *r,
+				uint8_t *buf, size_t size)
+{
+	struct rec_queue_entry *e;
+	uint8_t *compressed = NULL;
+	uint32_t data_size = 0;
+
+	/* without workers the extent is compressed right away */
+	if (!rec.queue.num_workers) {
+		compressed = malloc(REC_COMPRESSED_SIZE(size));
+		assert(compressed != NULL);
+
+		data_size = compress_data(buf, compressed, size,
+					  REC_COMPRESSED_SIZE(size));
+	}
+
+	e = record_queue_get();
+	e->call = NULL;
+	e->page = true;
+	e->act = *r;
+	e->act.data.bo_load_extent.data_size = data_size;
+	e->buf = buf;
+	e->compressed = compressed;
+	e->size = size;
+	e->state = rec.queue.num_workers ? REC_ENTRY_PENDING :
+					   REC_ENTRY_READY;
+	record_queue_put();
+}
+
+static void record_queue_data(const void *data, size_t size,
+			      uint8_t index)
+{
+	struct rec_queue_entry *e;
+	void *copy;
+
+	copy = malloc(size);
+	if (!copy) {
+		fprintf(stderr, "%s: size %zu: Out of memory\n",
+			__func__, size);
+		abort();
+	}
+
+	memcpy(copy, data, size);
+
+	e = record_queue_get();
+	e->call = NULL;
+	e->page = false;
+	e->index = index;
+	e->frame = rec.num_frames;
+	e->data = copy;
+	e->size = size;
+	e->state = REC_ENTRY_READY;
+	record_queue_put();
+}
+
+/* runs the function once everything queued before has been written out */
+static void record_queue_call(void (*call)(void))
+{
+	struct rec_queue_entry *e;
+
+	if (!rec.queue.enabled) {
+		call();
+		return;
+	}
+
+	e = record_queue_get();
+	e->call = call;
+	e->page = false;
+	e->index = 0;
+	e->state = REC_ENTRY_READY;
+	record_queue_put();
+}
+
+/* write out everything queued before the process exits */
+static void record_queue_drain(void)
+{
+	struct rec_queue *q = &rec.queue;
+
+	pthread_mutex_lock(&q->lock);
+
+	while (q->head != q->tail)
+		pthread_cond_wait(&q->cond, &q->lock);
+
+	pthread_mutex_unlock(&q->lock);
+
+	fflush(rec.fout);
+}
+
+static void record_queue_init(void)
+{
+	struct rec_queue *q = &rec.queue;
+	unsigned int num_threads = 2;
+	const char *env;
+
+	env = getenv("LIBWRAP_RECORD_THREADS");
+	if (env)
+		num_threads = strtoul(env, NULL, 0);
+
+	/* 0 keeps compressing and writing synchronously */
+	if (!num_threads)
+		return;
+
+	if (num_threads > REC_MAX_THREADS)
+		num_threads = REC_MAX_THREADS;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+
+	if (pthread_create(&q->writer, NULL, record_queue_writer, NULL)) {
+		fprintf(stderr, "%s: Failed to create writer thread\n",
+			__func__);
+		return;
+	}
+
+	/* without workers pages are compressed when queued */
+	while (q->num_workers < num_threads) {
+		if (pthread_create(&q->workers[q->num_workers], NULL,
+				   record_queue_worker, NULL))
+			break;
+
+		q->num_workers++;
+	}
+
+	q->enabled = true;
+	atexit(record_queue_drain);
+}
+
+static void record_write_data(const void *data, size_t size)
+{
+	if (rec.queue.enabled)
+		record_queue_data(data, size, 0);
+	else
+		record_output(data, size);
+}
+
+static void record_write_action(struct record_act *r)
+{
+	record_write_data(r, record_action_size(r));
+}
+
+static void record_write_indexed_action(struct record_act *r,
+					enum record_index_type type)
+{
+	size_t size = record_action_size(r);
+
+	if (rec.queue.enabled) {
+		record_queue_data(r, size, type);
+	} else {
+		record_index(type, rec.num_frames);
+		record_output(r, size);
+	}
+}
+
+/*
+ * Runs once everything queued has been written out, replay locates the
+ * index through the REC_INDEX_END that terminates the record.
+ */
+static void record_write_index(void)
+{
+	uint64_t offset = rec.offset;
+	struct record_act r;
+
+	r.act = REC_INDEX;
+	r.data.index.num_entries = rec.num_index;
+
+	record_output(&r, record_action_size(&r));
+	record_output(rec.index, rec.num_index * sizeof(*rec.index));
+
+	r.act = REC_INDEX_END;
+	r.data.index_end.offset = offset;
+
+	record_output(&r, record_action_size(&r));
+
+	fflush(rec.fout);
+}
+
+static void ring_stream_open(struct rec_ring_stream *s)
+{
+	s->fp = open_memstream(&s->buf, &s->size);
+	assert(s->fp != NULL);
+}
+
+static void ring_stream_close(struct rec_ring_stream *s)
+{
+	if (s->fp)
+		fclose(s->fp);
+
+	free(s->buf);
+	s->fp = NULL;
+	s->buf = NULL;
+	s->size = 0;
+}
+
+static bool ring_stream_write(struct rec_ring_stream *s, FILE *fp)
+{
+	if (!s->fp)
+		return true;
+
+	fflush(s->fp);
+
+	return !s->size || fwrite(s->buf, s->size, 1, fp) == 1;
+}
+
+/* run by the writer, the oldest segment is dropped */
+static void ring_open_segment(void)
+{
+	struct rec_ring_segment *seg;
+
+	rec.ring_current ^= 1;
+	seg = &rec.ring[rec.ring_current];
+
+	ring_stream_close(&seg->prologue);
+	ring_stream_close(&seg->data);
+	ring_stream_open(&seg->prologue);
+	ring_stream_open(&seg->data);
+
+	rec.fout = seg->prologue.fp;
+}
+
+static void ring_begin_data(void)
+{
+	rec.fout = rec.ring[rec.ring_current].data.fp;
+}
+
+/* run by the writer, the record starts at the oldest segment kept */
+static void ring_flush(void)
+{
+	struct rec_ring_segment *cur = &rec.ring[rec.ring_current];
+	struct rec_ring_segment *prev = &rec.ring[rec.ring_current ^ 1];
+	char path[PATH_MAX];
+	bool ok;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s.%u", rec.path, rec.ring_flushes++);
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "%s: Failed to open %s: %s\n",
+			__func__, path, strerror(errno));
+		return;
+	}
+
+	ok = ring_stream_write(&rec.ring_header, fp);
+
+	if (prev->data.fp)
+		ok = ok && ring_stream_write(&prev->prologue, fp) &&
+		     ring_stream_write(&prev->data, fp);
+	else
+		ok = ok && ring_stream_write(&cur->prologue, fp);
+
+	ok = ok && ring_stream_write(&cur->data, fp);
+
+	if (fclose(fp) || !ok)
+		fprintf(stderr, "%s: Failed to write %s\n", __func__, path);
+	else
+		fprintf(stderr, "libwrap flight record written to %s\n", path);
+}
+
+/* creates the live objects for replay starting at the next keyframe */
+static void ring_write_prologue(void)
+{
+	struct job_ctx_rec *job_ctx;
+	struct record_act r;
+	struct rec_ctx *ctx;
+	struct bo_rec *bo;
+
+	list_for_each_entry(ctx, &rec.ctxs, node) {
+		r.act = REC_CTX_CREATE;
+		r.data.ctx_create.id = ctx->id;
+
+		record_write_action(&r);
+	}
+
+	list_for_each_entry(bo, &rec.bos, node) {
+		r.act = REC_BO_CREATE;
+		r.data.bo_create.id = bo->id;
+		r.data.bo_create.ctx_id = bo->ctx->id;
+		r.data.bo_create.num_pages = bo->num_pages;
+		r.data.bo_create.flags = bo->flags;
+
+		record_write_action(&r);
+
+		if (!bo->is_framebuffer)
+			continue;
+
+		r.act = REC_ADD_FRAMEBUFFER;
+		r.data.add_framebuffer.bo_id = bo->id;
+		r.data.add_framebuffer.ctx_id = bo->ctx->id;
+		r.data.add_framebuffer.width = bo->width;
+		r.data.add_framebuffer.height = bo->height;
+		r.data.add_framebuffer.pitch = bo->pitch;
+		r.data.add_framebuffer.format = bo->format;
+		r.data.add_framebuffer.flags = bo->fb_flags;
+
+		record_write_action(&r);
+	}
+
+	list_for_each_entry(job_ctx, &rec.job_ctxs, node) {
+		r.act = REC_JOB_CTX_CREATE;
+		r.data.job_ctx_create.id = job_ctx->id;
+		r.data.job_ctx_create.gr2d = job_ctx->gr2d;
+
+		record_write_action(&r);
+	}
+}
+
+static void ring_request_flush(const char *reason)
+{
+	/* nothing new to write out since the last flush */
+	if (rec.ring_flush_frame == rec.num_frames + 1)
+		return;
+
+	fprintf(stderr, "libwrap flushing flight record: %s\n", reason);
+
+	rec.ring_flush_frame = rec.num_frames + 1;
+	record_queue_call(ring_flush);
+}
+
+static void ring_signal(int sig)
+{
+	rec.ring_flush_requested = 1;
+}
+
+/* a flush requested by the signal is made by the recording thread */
+static void ring_poll(void)
+{
+	if (!rec.ring_flush_requested)
+		return;
+
+	rec.ring_flush_requested = 0;
+	ring_request_flush("SIGUSR2");
+}
+
+static void ring_init(unsigned int frames)
+{
+	rec.ring_frames = frames;
+	rec.keyframe_interval = frames;
+
+	/* start, info and dictionary go to the header of every flush */
+	ring_stream_open(&rec.ring_header);
+	rec.fout = rec.ring_header.fp;
+
+	signal(SIGUSR2, ring_signal);
+}
+
+#ifdef ENABLE_ZSTD
+static void record_zstd_load_dict(const char *path)
+{
+	struct record_act r;
+	void *dict;
+	long size;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp || fseek(fp, 0, SEEK_END) || (size = ftell(fp)) <= 0) {
+		fprintf(stderr, "%s: Failed to open %s: %s\n",
+			__func__, path, strerror(errno));
+		abort();
+	}
+
+	dict = malloc(size);
+	assert(dict != NULL);
+
+	rewind(fp);
+
+	if (fread(dict, size, 1, fp) != 1) {
+		fprintf(stderr, "%s: Failed to read %s\n", __func__, path);
+		abort();
+	}
+
+	fclose(fp);
+
+	zstd_cdict = ZSTD_createCDict(dict, size, REC_ZSTD_LEVEL);
+	if (!zstd_cdict) {
+		fprintf(stderr, "%s: Invalid dictionary %s\n", __func__, path);
+		abort();
+	}
+
+	/* replay needs the very same dictionary for decompression */
+	r.act = REC_ZSTD_DICT;
+	r.data.zstd_dict.size = size;
+
+	record_write_action(&r);
+	record_write_data(dict, size);
+
+	free(dict);
+}
+
+static void record_zstd_sample(const void *data, unsigned int num_pages)
+{
+	unsigned int free_pages;
+
+	if (!zstd_train.path)
+		return;
+
+	free_pages = REC_ZSTD_TRAIN_PAGES - zstd_train.num_samples;
+	if (num_pages > free_pages)
+		num_pages = free_pages;
+
+	memcpy(zstd_train.samples + zstd_train.num_samples * 4096,
+	       data, num_pages * 4096);
+
+	zstd_train.num_samples += num_pages;
+}
+
+/* train a dictionary on the pages recorded by the time the process exits */
+static void record_zstd_train(void)
+{
+	size_t *sizes, size;
+	unsigned int i;
+	void *dict;
+	FILE *fp;
+
+	sizes = malloc(zstd_train.num_samples * sizeof(*sizes));
+	dict = malloc(REC_ZSTD_DICT_SIZE);
+	assert(sizes != NULL && dict != NULL);
+
+	for (i = 0; i < zstd_train.num_samples; i++)
+		sizes[i] = 4096;
+
+	size = ZDICT_trainFromBuffer(dict, REC_ZSTD_DICT_SIZE,
+				     zstd_train.samples, sizes,
+				     zstd_train.num_samples);
+	if (ZDICT_isError(size)) {
+		fprintf(stderr, "%s: Training on %u pages failed: %s\n",
+			__func__, zstd_train.num_samples,
+			ZDICT_getErrorName(size));
+		goto out;
+	}
+
+	fp = fopen(zstd_train.path, "w");
+	if (!fp || fwrite(dict, size, 1, fp) != 1)
+		fprintf(stderr, "%s: Failed to write %s\n",
+			__func__, zstd_train.path);
+	else
+		fprintf(stderr, "libwrap zstd dictionary of %zu bytes "
+			"written to %s\n", size, zstd_train.path);
+
+	if (fp)
+		fclose(fp);
+out:
+	free(dict);
+	free(sizes);
+	free(zstd_train.samples);
+}
+
+static void record_zstd_init(void)
+{
+	const char *path;
+
+	path = getenv("LIBWRAP_RECORD_ZSTD_DICT");
+	if (path)
+		record_zstd_load_dict(path);
+
+	path = getenv("LIBWRAP_RECORD_ZSTD_TRAIN");
+	if (!path)
+		return;
+
+	zstd_train.samples = malloc(REC_ZSTD_TRAIN_PAGES * 4096);
+	assert(zstd_train.samples != NULL);
+	zstd_train.path = path;
+
+	atexit(record_zstd_train);
+}
+#endif
+
 static bool record_start(void)
 {
 	struct record_act r;
 	uint8_t buf[4096];
+	const char *env;
 	char *path;
 
 	path = getenv("LIBWRAP_RECORD_PATH");
 	if (!path)
 		return false;
 
-	rec.fout = fopen(path, "w");
-	if (!rec.fout) {
-		fprintf(stderr, "%s: Failed to open %s: %s\n",
-			__func__, path, strerror(errno));
-		abort();
-	}
+	rec.path = path;
 
 	memset(buf, 0, 4096);
 	rec.zeroed_page_chksum = calc_page_checksum(buf, 4096);
+	memset(rec.store.table, 0xff, sizeof(rec.store.table));
+
+	INIT_LIST_HEAD(&rec.bos);
+	INIT_LIST_HEAD(&rec.ctxs);
+	INIT_LIST_HEAD(&rec.job_ctxs);
+
+	/* 0 disables keyframes */
+	env = getenv("LIBWRAP_RECORD_KEYFRAME_INTERVAL");
+	rec.keyframe_interval = env ? strtoul(env, NULL, 0) :
+				      REC_KEYFRAME_INTERVAL;
+
+	/* records only the last frames in memory, up to twice as many */
+	env = getenv("LIBWRAP_RECORD_RING_FRAMES");
+	if (env && strtoul(env, NULL, 0)) {
+		ring_init(strtoul(env, NULL, 0));
+	} else {
+		rec.fout = fopen(path, "w");
+		if (!rec.fout) {
+			fprintf(stderr, "%s: Failed to open %s: %s\n",
+				__func__, path, strerror(errno));
+			abort();
+		}
+	}
+
+	rec.start_time = record_time();
 
 	r.act = REC_START;
 	r.data.header.version = REC_VER;
@@ -159,12 +975,32 @@ static bool record_start(void)
 #endif
 #ifdef ENABLE_LZ4
 	compression = REC_LZ4;
+#endif
+#ifdef ENABLE_ZSTD
+	compression = REC_ZSTD;
 #endif
 	r.data.record_info.compression = compression;
 
 	record_write_action(&r);
 
-	fprintf(stderr, "libwrap recording started on %s to %s\n",
+#ifdef ENABLE_ZSTD
+	record_zstd_init();
+#endif
+
+	/* registered first to run after the queue is drained */
+	if (!rec.ring_frames)
+		atexit(record_write_index);
+
+	record_queue_init();
+
+	/* the first segment creates the objects itself */
+	if (rec.ring_frames) {
+		record_queue_call(ring_open_segment);
+		record_queue_call(ring_begin_data);
+	}
+
+	fprintf(stderr, "libwrap %s started on %s to %s\n",
+		rec.ring_frames ? "flight recording" : "recording",
 		r.data.record_info.drm ? "DRM" : "NVHOST", path);
 
 	return true;
@@ -193,6 +1029,7 @@ struct rec_ctx *record_create_ctx(void)
 	assert(ctx != NULL);
 
 	ctx->id = rec.ctx_cnt++;
+	list_add_tail(&ctx->node, &rec.ctxs);
 
 	r.act = REC_CTX_CREATE;
 	r.data.ctx_create.id = ctx->id;
@@ -212,6 +1049,7 @@ void record_destroy_ctx(struct rec_ctx *ctx)
 	r.act = REC_CTX_DESTROY;
 	r.data.ctx_destroy.id = ctx->id;
 
+	list_del(&ctx->node);
 	free(ctx);
 
 	record_write_action(&r);
@@ -238,6 +1076,8 @@ struct bo_rec *record_create_bo(struct rec_ctx *ctx, size_t size,
 
 	assert(bo->page_meta != NULL);
 
+	list_add_tail(&bo->node, &rec.bos);
+
 	for (i = 0; i < bo->num_pages; i++)
 		bo->page_meta[i].chksum = rec.zeroed_page_chksum;
 
@@ -271,110 +1111,176 @@ void record_destroy_bo(struct bo_rec *bo)
 	r.data.bo_destroy.id = bo->id;
 	r.data.bo_destroy.ctx_id = bo->ctx->id;
 
+	list_del(&bo->node);
 	free(bo);
 
 	record_write_action(&r);
 }
 
-#ifdef ENABLE_ZLIB
-static size_t compress_data_zlib(void *in, void *out,
-				 size_t in_size, size_t out_size)
+static bool check_page(struct bo_rec *bo, unsigned int page)
 {
-	z_stream strm;
-	int ret;
+	uint64_t chksum;
 
-	strm.zalloc = Z_NULL;
-	strm.zfree = Z_NULL;
-	strm.opaque = Z_NULL;
-	strm.avail_in = in_size;
-	strm.next_in = in;
-	strm.avail_out = out_size;
-	strm.next_out = out;
-
-	ret = deflateInit(&strm, Z_BEST_SPEED);
-	assert(ret == Z_OK);
-
-	ret = deflate(&strm, Z_FINISH);
-	if (ret != Z_STREAM_END) {
-		fprintf(stderr, "%s: ERROR: deflate failed: %d\n",
-			__func__, ret);
-		abort();
-	}
+	chksum = calc_page_checksum(bo->page_data[page].data, 4096);
 
-	ret = deflateEnd(&strm);
-	assert(ret == Z_OK);
+	if (chksum == bo->page_meta[page].chksum)
+		return false;
 
-	if (strm.total_out >= in_size)
-		return 0;
+	bo->page_meta[page].chksum = chksum;
 
-	return strm.total_out;
+	return true;
 }
-#endif
 
-#ifdef ENABLE_LZ4
-static size_t compress_data_lz4(void *in, void *out,
-				size_t in_size, size_t out_size)
+static int store_lookup(uint64_t hash)
 {
-	return LZ4_compress_default(in, out, in_size, out_size);
+	int slot = rec.store.table[hash % REC_STORE_HASH_SIZE];
+
+	if (slot < 0 || rec.store.hashes[slot] != hash)
+		return -1;
+
+	return slot;
 }
-#endif
 
-static size_t compress_data(void *in, void *out,
-			    size_t in_size, size_t out_size)
+static void store_insert(uint64_t hash)
 {
-#ifdef ENABLE_LZ4
-	if (compression == REC_LZ4)
-		return compress_data_lz4(in, out, in_size, out_size);
-#endif
+	unsigned int slot = rec.store.next++ % REC_PAGE_STORE_SIZE;
 
-#ifdef ENABLE_ZLIB
-	if (compression == REC_ZLIB)
-		return compress_data_zlib(in, out, in_size, out_size);
-#endif
+	rec.store.hashes[slot] = hash;
+	rec.store.table[hash % REC_STORE_HASH_SIZE] = slot;
+}
 
-	return 0;
+/* replay starts with an empty ring at a keyframe */
+static void store_reset(void)
+{
+	memset(rec.store.table, 0xff, sizeof(rec.store.table));
+	rec.store.next = 0;
 }
 
-static bool check_and_load_page(struct bo_rec *bo, unsigned int page)
+/*
+ * A write racing with the copy of the extent only makes the next capture
+ * record the page again. The ring is filled with the hashes of the copy,
+ * which is what replay loads.
+ */
+static void record_extent(struct bo_rec *bo, unsigned int page,
+			  unsigned int num_pages)
 {
+	size_t size = num_pages * 4096;
+	uint8_t *buf, *compressed;
 	struct record_act r;
-	unsigned long chksum;
-	uint16_t data_size;
-	uint8_t compressed[3328];
-	uint8_t buf[4096];
-	void *data;
+	uint32_t data_size;
+	unsigned int i;
 
-	memcpy(buf, bo->page_data[page].data, 4096);
+	r.act = REC_BO_LOAD_EXTENT;
+	r.data.bo_load_extent.id = bo->id;
+	r.data.bo_load_extent.ctx_id = bo->ctx->id;
+	r.data.bo_load_extent.page_id = page;
+	r.data.bo_load_extent.num_pages = num_pages;
 
-	chksum = calc_page_checksum(buf, 4096);
+	buf = malloc(size);
+	assert(buf != NULL);
 
-#ifdef ENABLE_ZLIB
-	if (chksum == bo->page_meta[page].chksum)
-		return false;
+	memcpy(buf, bo->page_data[page].data, size);
+
+	for (i = 0; i < num_pages; i++)
+		store_insert(calc_page_checksum(buf + i * 4096, 4096));
+
+#ifdef ENABLE_ZSTD
+	record_zstd_sample(buf, num_pages);
 #endif
 
+	/* compression is left to the queue, off the ioctl path */
+	if (rec.queue.enabled) {
+		record_queue_extent(&r, buf, size);
+		return;
+	}
+
+	compressed = malloc(REC_COMPRESSED_SIZE(size));
+	assert(compressed != NULL);
+
 	/* size 0 means go uncompressed */
-	data_size = compress_data(buf, compressed, 4096, 3328);
-	data = data_size ? compressed : buf;
+	data_size = compress_data(buf, compressed, size,
+				  REC_COMPRESSED_SIZE(size));
 
-	r.act = REC_BO_LOAD_DATA;
-	r.data.bo_load.id = bo->id;
-	r.data.bo_load.page_id = page;
-	r.data.bo_load.ctx_id = bo->ctx->id;
-	r.data.bo_load.data_size = data_size;
+	r.data.bo_load_extent.data_size = data_size;
 
 	record_write_action(&r);
-	record_write_data(data, data_size ?: 4096);
+	record_write_data(data_size ? compressed : buf, data_size ?: size);
 
-	bo->page_meta[page].chksum = chksum;
+	free(compressed);
+	free(buf);
+}
 
-	return true;
+static void load_stored(struct bo_rec *bo, unsigned int page,
+			unsigned int slot)
+{
+	struct record_act r;
+
+	r.act = REC_BO_LOAD_STORED;
+	r.data.bo_load_stored.id = bo->id;
+	r.data.bo_load_stored.ctx_id = bo->ctx->id;
+	r.data.bo_load_stored.page_id = page;
+	r.data.bo_load_stored.slot = slot;
+
+	record_write_action(&r);
+}
+
+/*
+ * Pages that were recorded lately, by this or any other BO, are loaded
+ * from the ring, the rest is recorded as extents.
+ */
+static void load_extent(struct bo_rec *bo, unsigned int page,
+			unsigned int num_pages)
+{
+	unsigned int i, first = page, end = page + num_pages;
+	uint64_t hash;
+	int slot;
+
+	for (i = page; i < end; i++) {
+		hash = bo->page_meta[i].chksum;
+
+		if (store_lookup(hash) < 0)
+			continue;
+
+		if (i > first)
+			record_extent(bo, first, i - first);
+
+		/* the extent may have taken the slot of the page */
+		first = i;
+		slot = store_lookup(hash);
+		if (slot < 0)
+			continue;
+
+		load_stored(bo, i, slot);
+		first = i + 1;
+	}
+
+	if (end > first)
+		record_extent(bo, first, end - first);
+}
+
+/* runs of changed pages are recorded as a single extent */
+static void load_page(struct bo_rec *bo, unsigned int page,
+		      unsigned int *first, unsigned int *count)
+{
+	if (*count && *first + *count == page &&
+	    *count < REC_MAX_EXTENT_PAGES) {
+		(*count)++;
+		return;
+	}
+
+	if (*count)
+		load_extent(bo, *first, *count);
+
+	*first = page;
+	*count = 1;
 }
 
 void record_capture_bo_data(struct bo_rec *bo, bool force)
 {
+	unsigned int first = 0, count = 0;
 	unsigned int hpage[3];
-	unsigned int i;
+	bool changed[3];
+	unsigned int i, k;
 	bool dirty = false;
 
 	if (!recorder_enabled())
@@ -397,21 +1303,77 @@ void record_capture_bo_data(struct bo_rec *bo, bool force)
 	hpage[2] = bo->num_pages - 1;
 
 	if (!force && bo->num_pages > 4) {
-		dirty |= check_and_load_page(bo, hpage[0]);
-		dirty |= check_and_load_page(bo, hpage[1]);
-		dirty |= check_and_load_page(bo, hpage[2]);
+		for (k = 0; k < 3; k++) {
+			changed[k] = check_page(bo, hpage[k]);
+			dirty |= changed[k];
+		}
 	} else {
 		force = true;
 	}
 
-	if (force || dirty)
-		for (i = 0; i < bo->num_pages; i++)
-			if (force || (i != hpage[0] && i != hpage[1] && i != hpage[2]))
-				check_and_load_page(bo, i);
+	if (!force && !dirty)
+		goto out;
+
+	for (i = 0; i < bo->num_pages; i++) {
+		bool load;
+
+		for (k = 0; k < 3; k++)
+			if (!force && i == hpage[k])
+				break;
+
+		load = k < 3 ? changed[k] : check_page(bo, i);
+		if (load)
+			load_page(bo, i, &first, &count);
+	}
 
+	if (count)
+		load_extent(bo, first, count);
+
+out:
 	bo->captured = true;
 }
 
+/*
+ * The current data of every live BO, replay can start at a keyframe after
+ * creating the BOs without loading any of the data recorded before it.
+ */
+static void record_keyframe(void)
+{
+	unsigned int first = 0, count, i;
+	struct record_act r;
+	struct bo_rec *bo;
+
+	/* the new segment replaces the oldest one of the flight recorder */
+	if (rec.ring_frames) {
+		record_queue_call(ring_open_segment);
+		ring_write_prologue();
+		record_queue_call(ring_begin_data);
+	}
+
+	r.act = REC_KEYFRAME;
+	r.data.keyframe.frame = rec.num_frames;
+
+	record_write_indexed_action(&r, REC_INDEX_KEYFRAME);
+	store_reset();
+
+	list_for_each_entry(bo, &rec.bos, node) {
+		if (!bo->page_data)
+			continue;
+
+		for (i = 0, count = 0; i < bo->num_pages; i++) {
+			check_page(bo, i);
+
+			if (bo->page_meta[i].chksum != rec.zeroed_page_chksum)
+				load_page(bo, i, &first, &count);
+		}
+
+		if (count)
+			load_extent(bo, first, count);
+
+		bo->captured = true;
+	}
+}
+
 void record_set_bo_flags(struct bo_rec *bo, uint32_t flags)
 {
 	struct record_act r;
@@ -437,6 +1399,7 @@ void record_add_framebuffer(struct bo_rec *bo, uint32_t flags)
 		return;
 
 	bo->is_framebuffer = true;
+	bo->fb_flags = flags;
 
 	r.act = REC_ADD_FRAMEBUFFER;
 	r.data.add_framebuffer.bo_id = bo->id;
@@ -474,11 +1437,20 @@ void record_display_framebuffer(struct bo_rec *bo)
 	if (!recorder_enabled())
 		return;
 
+	ring_poll();
+
 	r.act = REC_DISP_FRAMEBUFFER;
 	r.data.disp_framebuffer.bo_id = bo->id;
 	r.data.disp_framebuffer.ctx_id = bo->ctx->id;
+	r.data.disp_framebuffer.time = record_time() - rec.start_time;
 
-	record_write_action(&r);
+	record_write_indexed_action(&r, REC_INDEX_FRAME);
+
+	rec.num_frames++;
+
+	if (rec.keyframe_interval &&
+	    !(rec.num_frames % rec.keyframe_interval))
+		record_keyframe();
 }
 
 struct job_ctx_rec *record_job_ctx_create(bool gr2d)
@@ -494,6 +1466,7 @@ struct job_ctx_rec *record_job_ctx_create(bool gr2d)
 
 	ctx->id = rec.job_ctx_cnt++;
 	ctx->gr2d = gr2d;
+	list_add_tail(&ctx->node, &rec.job_ctxs);
 
 	r.act = REC_JOB_CTX_CREATE;
 	r.data.job_ctx_create.id = ctx->id;
@@ -514,6 +1487,7 @@ void record_job_ctx_destroy(struct job_ctx_rec *ctx)
 	r.act = REC_JOB_CTX_DESTROY;
 	r.data.job_ctx_destroy.id = ctx->id;
 
+	list_del(&ctx->node);
 	free(ctx);
 
 	record_write_action(&r);
@@ -526,13 +1500,16 @@ void record_job_submit(struct job_rec *job)
 	if (!recorder_enabled())
 		return;
 
+	ring_poll();
+
 	r.act = REC_JOB_SUBMIT;
 	r.data.job_submit.job_ctx_id = job->ctx->id;
 	r.data.job_submit.num_gathers = job->num_gathers;
 	r.data.job_submit.num_relocs = job->num_relocs;
 	r.data.job_submit.num_syncpt_incrs = job->num_syncpt_incrs;
+	r.data.job_submit.time = record_time() - rec.start_time;
 
-	record_write_action(&r);
+	record_write_indexed_action(&r, REC_INDEX_JOB);
 
 	if (job->num_gathers)
 		record_write_data(job->gathers,
@@ -542,3 +1519,12 @@ void record_job_submit(struct job_rec *job)
 		record_write_data(job->relocs,
 				sizeof(*job->relocs) * job->num_relocs);
 }
+
+/* a syncpoint wait timed out, the flight record shows what led to it */
+void record_gpu_hang(void)
+{
+	if (!recorder_enabled() || !rec.ring_frames)
+		return;
+
+	ring_request_flush("GPU hang");
+}
@@ -26,16 +26,22 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "list.h"
 #include "record_replay.h"
 
 struct rec_ctx {
+	struct list_head node;
 	unsigned int id;
 };
 
@@ -44,10 +50,11 @@ struct bo_page {
 };
 
 struct rec_page_meta {
-	unsigned long chksum;
+	uint64_t chksum;
 };
 
 struct bo_rec {
+	struct list_head node;
 	struct rec_page_meta *page_meta;
 	struct bo_page *page_data;
 	struct rec_ctx *ctx;
@@ -60,10 +67,12 @@ struct bo_rec {
 	uint32_t format;
 	uint32_t flags;
 	bool is_framebuffer;
+	uint32_t fb_flags;
 	unsigned int fb_id;
 };
 
 struct job_ctx_rec {
+	struct list_head node;
 	unsigned int id;
 	bool gr2d;
 };
@@ -80,17 +89,147 @@ struct job_rec {
 	struct job_ctx_rec *ctx;
 };
 
-#define REC_VER		0x0004
+#define REC_VER		0x0007
+
+/* extents of consecutive changed pages are compressed as a whole */
+#define REC_MAX_EXTENT_PAGES	32
+
+/* compressed data has to save at least 3/16 to be worth it */
+#define REC_COMPRESSED_SIZE(size)	((size) / 16 * 13)
+
+#define REC_ZSTD_LEVEL		3
+#define REC_ZSTD_DICT_SIZE	(110 * 1024)
+
+/* pages sampled for LIBWRAP_RECORD_ZSTD_TRAIN, 16 MB */
+#define REC_ZSTD_TRAIN_PAGES	4096
+
+/* frames between BO state keyframes, for seeking in replay */
+#define REC_KEYFRAME_INTERVAL	300
+
+/* slots of the page hashes of the ring of recorded pages, a power of two */
+#define REC_STORE_HASH_SIZE	(REC_PAGE_STORE_SIZE * 2)
+
+/* number of records in flight between the traced process and the file */
+#define REC_QUEUE_SIZE		256
+#define REC_MAX_THREADS		8
+
+enum rec_entry_state {
+	REC_ENTRY_FREE,
+	REC_ENTRY_PENDING,
+	REC_ENTRY_READY,
+};
+
+struct rec_queue_entry {
+	enum rec_entry_state state;
+	bool page;
+
+	/* raw records may be indexed once their offset is known */
+	uint8_t index;
+	uint32_t frame;
+
+	/* raw record data, size is also the one of the extent */
+	void *data;
+	size_t size;
+
+	/* extent load, compressed by a worker */
+	struct record_act act;
+	uint8_t *buf;
+	uint8_t *compressed;
+
+	/* run by the writer in place of writing a record */
+	void (*call)(void);
+};
+
+/*
+ * Records are queued in order, pages are compressed by a pool of worker
+ * threads and a writer thread writes the records out in queue order. The
+ * traced process blocks once the queue is full.
+ */
+struct rec_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t writer;
+	pthread_t workers[REC_MAX_THREADS];
+	unsigned int num_workers;
+	bool enabled;
+
+	/* free running counters, head <= compress <= tail */
+	unsigned int head;
+	unsigned int compress;
+	unsigned int tail;
+
+	struct rec_queue_entry entries[REC_QUEUE_SIZE];
+};
+
+/*
+ * Mirrors the ring of pages replay fills with the loaded extents. A page
+ * is found by its hash, an entry of the table is valid if the slot it
+ * points to still holds a page of that hash.
+ */
+struct rec_page_store {
+	uint64_t hashes[REC_PAGE_STORE_SIZE];
+	int table[REC_STORE_HASH_SIZE];
+	unsigned int next;
+};
+
+/* records kept in memory by the flight recorder */
+struct rec_ring_stream {
+	FILE *fp;
+	char *buf;
+	size_t size;
+};
+
+/*
+ * A segment starts with a keyframe, the prologue creates the objects that
+ * are live at it and is written out only for the oldest segment.
+ */
+struct rec_ring_segment {
+	struct rec_ring_stream prologue;
+	struct rec_ring_stream data;
+};
 
 struct recorder {
 	bool inited;
 	bool enabled;
 
+	struct rec_queue queue;
 	FILE *fout;
 	unsigned int ctx_cnt;
 	unsigned int bos_cnt;
 	unsigned int job_ctx_cnt;
-	unsigned long zeroed_page_chksum;
+	uint64_t zeroed_page_chksum;
+	struct rec_page_store store;
+
+	/* live BOs, all of them are loaded by a keyframe */
+	struct list_head bos;
+	unsigned int num_frames;
+	unsigned int keyframe_interval;
+
+	/* CLOCK_MONOTONIC time of the start, in microseconds */
+	uint64_t start_time;
+
+	/*
+	 * Flight recorder, keeps the last two segments of ring_frames frames
+	 * each and writes them out on a GPU hang or on SIGUSR2. The current
+	 * segment is the one written to by the writer.
+	 */
+	unsigned int ring_frames;
+	const char *path;
+	struct list_head ctxs;
+	struct list_head job_ctxs;
+	struct rec_ring_stream ring_header;
+	struct rec_ring_segment ring[2];
+	unsigned int ring_current;
+	unsigned int ring_flushes;
+	/* frame of the last flush plus one, 0 before the first one */
+	unsigned int ring_flush_frame;
+	volatile sig_atomic_t ring_flush_requested;
+
+	/* updated by the writer of the records */
+	uint64_t offset;
+	struct record_index_entry *index;
+	unsigned int num_index;
+	unsigned int max_index;
 };
 
 bool recorder_enabled(void);
@@ -108,5 +247,6 @@ void record_display_framebuffer(struct bo_rec *bo);
 struct job_ctx_rec *record_job_ctx_create(bool gr2d);
 void record_job_ctx_destroy(struct job_ctx_rec *ctx);
 void record_job_submit(struct job_rec *job);
+void record_gpu_hang(void);
 
 #endif
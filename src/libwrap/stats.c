@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "utils.h"
+
+#define STATS_MAX_REQUESTS	128
+
+/*
+ * Durations are binned by their most significant bit and the two bits
+ * below it, which keeps the percentiles within 25% in any range.
+ */
+#define STATS_SUB_BITS		2
+#define STATS_NUM_BINS		(64 << STATS_SUB_BITS)
+
+struct ioctl_stats {
+	unsigned long request;
+	const char *name;
+
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	uint64_t bins[STATS_NUM_BINS];
+};
+
+static struct {
+	bool enabled;
+	struct ioctl_stats requests[STATS_MAX_REQUESTS];
+} stats;
+
+static unsigned int stats_bin(uint64_t value)
+{
+	unsigned int msb;
+
+	if (value < (1 << STATS_SUB_BITS))
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+
+	return (msb - STATS_SUB_BITS + 1) << STATS_SUB_BITS |
+	       ((value >> (msb - STATS_SUB_BITS)) &
+		((1 << STATS_SUB_BITS) - 1));
+}
+
+/* the largest value of the bin */
+static uint64_t stats_bin_limit(unsigned int bin)
+{
+	unsigned int shift = bin >> STATS_SUB_BITS;
+	uint64_t mantissa = bin & ((1 << STATS_SUB_BITS) - 1);
+
+	if (!shift)
+		return mantissa;
+
+	mantissa |= 1 << STATS_SUB_BITS;
+	shift -= 1;
+
+	return ((mantissa + 1) << shift) - 1;
+}
+
+/* the slots are claimed once per request code, lock-free */
+static struct ioctl_stats *stats_lookup(unsigned long request,
+					const char *name)
+{
+	unsigned int i, index = (request * 0x9e3779b1u) % STATS_MAX_REQUESTS;
+	struct ioctl_stats *s;
+	unsigned long expected;
+
+	for (i = 0; i < STATS_MAX_REQUESTS; i++) {
+		s = &stats.requests[(index + i) % STATS_MAX_REQUESTS];
+		expected = 0;
+
+		if (__atomic_compare_exchange_n(&s->request, &expected,
+						request, false,
+						__ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&s->name, name, __ATOMIC_RELEASE);
+			return s;
+		}
+
+		if (expected == request)
+			return s;
+	}
+
+	return NULL;
+}
+
+bool stats_enabled(void)
+{
+	return stats.enabled;
+}
+
+void stats_ioctl(unsigned long request, const char *name, uint64_t duration)
+{
+	struct ioctl_stats *s = stats_lookup(request, name);
+	uint64_t old;
+
+	if (!s)
+		return;
+
+	__atomic_add_fetch(&s->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&s->total, duration, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&s->bins[stats_bin(duration)], 1,
+			   __ATOMIC_RELAXED);
+
+	old = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+	while (duration > old &&
+	       !__atomic_compare_exchange_n(&s->max, &old, duration, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	old = __atomic_load_n(&s->min, __ATOMIC_RELAXED);
+	while ((!old || duration < old) &&
+	       !__atomic_compare_exchange_n(&s->min, &old, duration, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static double stats_percentile(const struct ioctl_stats *s, double p)
+{
+	uint64_t rank = s->count * p, sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < STATS_NUM_BINS; i++) {
+		sum += s->bins[i];
+
+		if (sum > rank)
+			return MIN(stats_bin_limit(i), s->max) / 1000.0;
+	}
+
+	return s->max / 1000.0;
+}
+
+static int stats_compare(const void *a, const void *b)
+{
+	const struct ioctl_stats *sa = a, *sb = b;
+
+	if (sa->total != sb->total)
+		return sa->total < sb->total ? 1 : -1;
+
+	return 0;
+}
+
+static void stats_exit(void)
+{
+	struct ioctl_stats *s;
+	char name[32];
+	unsigned int i;
+
+	/* the summary is a snapshot, threads may still be running */
+	qsort(stats.requests, STATS_MAX_REQUESTS, sizeof(*s), stats_compare);
+
+	fprintf(stderr, "\nioctl latencies in us, by total time:\n");
+	fprintf(stderr, "%-40s %10s %12s %10s %10s %10s %10s %10s %10s\n",
+		"request", "count", "total", "mean", "min", "p50", "p90",
+		"p99", "max");
+
+	for (i = 0; i < STATS_MAX_REQUESTS; i++) {
+		s = &stats.requests[i];
+
+		if (!s->count)
+			continue;
+
+		if (!s->name)
+			snprintf(name, sizeof(name), "%#lx", s->request);
+
+		fprintf(stderr,
+			"%-40s %10ju %12.1f %10.1f %10.1f %10.1f %10.1f "
+			"%10.1f %10.1f\n", s->name ?: name,
+			(uintmax_t)s->count, s->total / 1000.0,
+			s->total / 1000.0 / s->count, s->min / 1000.0,
+			stats_percentile(s, 0.5), stats_percentile(s, 0.9),
+			stats_percentile(s, 0.99), s->max / 1000.0);
+	}
+}
+
+void stats_init(void)
+{
+	const char *str = getenv("LIBWRAP_IOCTL_STATS");
+
+	if (!str || strcmp(str, "1"))
+		return;
+
+	atexit(stats_exit);
+	stats.enabled = true;
+}
@@ -40,11 +40,12 @@
 
 #include "host1x.h"
 #include "nvhost.h"
+#include "stats.h"
 #include "syscall.h"
+#include "trace.h"
 #include "utils.h"
 #include "list.h"
 
-static pthread_mutex_t ioctl_lock = PTHREAD_MUTEX_INITIALIZER;
 static bool initialized = false;
 bool libwrap_verbose = true;
 
@@ -84,6 +85,8 @@ int open(const char *pathname, int flags, ...)
 
 	if (!initialized) {
 		init_verbosity();
+		trace_init();
+		stats_init();
 		nvhost_register();
 		host1x_register();
 		initialized = true;
@@ -121,6 +124,8 @@ int open64(const char *pathname, int flags, ...)
 
 	if (!initialized) {
 		init_verbosity();
+		trace_init();
+		stats_init();
 		nvhost_register();
 		host1x_register();
 		initialized = true;
@@ -303,24 +308,34 @@ int ioctl(int fd, unsigned long request, ...)
 
 	PRINTF("%s(fd=%d, request=%#lx, arg=%p)\n", __func__, fd, request, arg);
 
+	if (trace_enabled())
+		trace_ioctl_enter(fd, request, arg, ioc ? ioc->name : NULL);
+
 	if (file && file->ops && file->ops->enter_ioctl) {
-		pthread_mutex_lock(&ioctl_lock);
+		pthread_mutex_lock(file->lock);
 		file->ops->enter_ioctl(file, request, arg);
-		pthread_mutex_unlock(&ioctl_lock);
-
-		clock_gettime(CLOCK_MONOTONIC, &t1);
+		pthread_mutex_unlock(file->lock);
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &t1);
 	ret = orig(fd, request, arg);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
 
-	if (file && file->ops && file->ops->leave_ioctl) {
-		clock_gettime(CLOCK_MONOTONIC, &t2);
+	if (stats_enabled())
+		stats_ioctl(request, ioc ? ioc->name : NULL,
+			    (t2.tv_sec - t1.tv_sec) * 1000000000ull +
+			    t2.tv_nsec - t1.tv_nsec);
 
-		pthread_mutex_lock(&ioctl_lock);
+	if (file && file->ops && file->ops->leave_ioctl) {
+		pthread_mutex_lock(file->lock);
 		file->ops->leave_ioctl(file, request, arg);
-		pthread_mutex_unlock(&ioctl_lock);
+		pthread_mutex_unlock(file->lock);
 	}
 
+	if (trace_enabled())
+		trace_ioctl_leave(fd, request, ret,
+				  ioc ? timespec_diff_in_us(&t1, &t2) : 0);
+
 	if (!ioc) {
 		PRINTF("  dir:%lx type:'%c' nr:%lx size:%lu\n",
 		       _IOC_DIR(request), (char)_IOC_TYPE(request),
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "utils.h"
+
+/* records of a thread that aren't drained yet, a power of two */
+#define TRACE_RING_SIZE		16384
+
+/* requests whose names were traced already */
+#define TRACE_MAX_NAMES		256
+
+/*
+ * The ring is written only by its thread and read only by the writer,
+ * the free running counters are the only shared state.
+ */
+struct trace_ring {
+	struct list_head node;
+	uint32_t tid;
+
+	unsigned int head;
+	unsigned int tail;
+	unsigned int dropped;
+	unsigned int reported;
+
+	struct trace_record records[TRACE_RING_SIZE];
+};
+
+static struct {
+	bool enabled;
+	bool stop;
+	FILE *fout;
+	pthread_t writer;
+
+	/* protects the list of rings, taken once per thread by tracers */
+	pthread_mutex_t lock;
+	struct list_head rings;
+
+	unsigned long names[TRACE_MAX_NAMES];
+} trace = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread struct trace_ring *trace_ring;
+
+static uint64_t trace_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct trace_ring *trace_get_ring(void)
+{
+	struct trace_ring *ring = trace_ring;
+
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->tid = syscall(SYS_gettid);
+
+	pthread_mutex_lock(&trace.lock);
+	list_add_tail(&ring->node, &trace.rings);
+	pthread_mutex_unlock(&trace.lock);
+
+	trace_ring = ring;
+
+	return ring;
+}
+
+/*
+ * Reserves count consecutive records, which are written by filling
+ * trace_slot() and published by trace_commit(). Records that don't fit
+ * are dropped instead of stalling the traced thread.
+ */
+static struct trace_ring *trace_reserve(unsigned int count)
+{
+	struct trace_ring *ring = trace_get_ring();
+	unsigned int head;
+
+	if (!ring)
+		return NULL;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (TRACE_RING_SIZE - (ring->tail - head) < count) {
+		__atomic_add_fetch(&ring->dropped, count, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	return ring;
+}
+
+static struct trace_record *trace_slot(struct trace_ring *ring,
+				       unsigned int index, uint64_t time,
+				       enum trace_type type)
+{
+	struct trace_record *r;
+
+	r = &ring->records[(ring->tail + index) % TRACE_RING_SIZE];
+	memset(r, 0, sizeof(*r));
+	r->time = time;
+	r->tid = ring->tid;
+	r->type = type;
+
+	return r;
+}
+
+static void trace_commit(struct trace_ring *ring, unsigned int count)
+{
+	__atomic_store_n(&ring->tail, ring->tail + count, __ATOMIC_RELEASE);
+}
+
+/* returns true if the request wasn't named in the trace before */
+static bool trace_claim_name(unsigned long request)
+{
+	unsigned int i, index = (request * 0x9e3779b1u) % TRACE_MAX_NAMES;
+	unsigned long expected;
+
+	for (i = 0; i < TRACE_MAX_NAMES; i++) {
+		unsigned long *slot = &trace.names[(index + i) %
+						   TRACE_MAX_NAMES];
+
+		expected = 0;
+
+		if (__atomic_compare_exchange_n(slot, &expected, request,
+						false, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+			return true;
+
+		if (expected == request)
+			return false;
+	}
+
+	return false;
+}
+
+static void trace_name(unsigned long request, const char *name,
+		       uint64_t time)
+{
+	unsigned int len = strlen(name) + 1, count, i;
+	struct trace_ring *ring;
+	struct trace_record *r;
+
+	count = (len + 11) / 12;
+
+	ring = trace_reserve(count);
+	if (!ring)
+		return;
+
+	for (i = 0; i < count; i++) {
+		r = trace_slot(ring, i, time, TRACE_IOCTL_NAME);
+		r->count = i;
+		r->data[0] = request;
+		memcpy(&r->data[1], name + i * 12, MIN(len - i * 12, 12));
+	}
+
+	trace_commit(ring, count);
+}
+
+bool trace_enabled(void)
+{
+	return trace.enabled;
+}
+
+void trace_ioctl_enter(int fd, unsigned long request, void *arg,
+		       const char *name)
+{
+	uint64_t time = trace_time();
+	struct trace_ring *ring;
+	struct trace_record *r;
+
+	if (name && trace_claim_name(request))
+		trace_name(request, name, time);
+
+	ring = trace_reserve(1);
+	if (!ring)
+		return;
+
+	r = trace_slot(ring, 0, time, TRACE_IOCTL_ENTER);
+	r->data[0] = fd;
+	r->data[1] = request;
+	r->data[2] = (uintptr_t)arg;
+	r->data[3] = (uint64_t)(uintptr_t)arg >> 32;
+
+	trace_commit(ring, 1);
+}
+
+void trace_ioctl_leave(int fd, unsigned long request, int ret, long duration)
+{
+	struct trace_ring *ring;
+	struct trace_record *r;
+
+	ring = trace_reserve(1);
+	if (!ring)
+		return;
+
+	r = trace_slot(ring, 0, trace_time(), TRACE_IOCTL_LEAVE);
+	r->data[0] = fd;
+	r->data[1] = request;
+	r->data[2] = ret;
+	r->data[3] = duration;
+
+	trace_commit(ring, 1);
+}
+
+void trace_commands(uint32_t classid, const uint32_t *words,
+		    unsigned int count)
+{
+	unsigned int num = 1 + (count + 3) / 4, i, n;
+	uint64_t time = trace_time();
+	struct trace_ring *ring;
+	struct trace_record *r;
+
+	ring = trace_reserve(num);
+	if (!ring)
+		return;
+
+	r = trace_slot(ring, 0, time, TRACE_COMMANDS);
+	r->data[0] = classid;
+	r->data[1] = count;
+
+	for (i = 1; i < num; i++, words += n, count -= n) {
+		n = MIN(count, 4);
+
+		r = trace_slot(ring, i, time, TRACE_WORDS);
+		r->count = n;
+		memcpy(r->data, words, n * sizeof(*words));
+	}
+
+	trace_commit(ring, num);
+}
+
+static bool trace_drain_ring(struct trace_ring *ring)
+{
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	unsigned int head = ring->head, dropped, first, n;
+	struct trace_record r;
+
+	if (head == tail)
+		return false;
+
+	while (head != tail) {
+		first = head % TRACE_RING_SIZE;
+		n = MIN(tail - head, TRACE_RING_SIZE - first);
+
+		fwrite(&ring->records[first], sizeof(r), n, trace.fout);
+		head += n;
+	}
+
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+	dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+
+	if (dropped != ring->reported) {
+		memset(&r, 0, sizeof(r));
+		r.time = trace_time();
+		r.tid = ring->tid;
+		r.type = TRACE_DROPPED;
+		r.data[0] = dropped - ring->reported;
+
+		fwrite(&r, sizeof(r), 1, trace.fout);
+		ring->reported = dropped;
+	}
+
+	return true;
+}
+
+static bool trace_drain(void)
+{
+	struct trace_ring *ring;
+	bool drained = false;
+
+	pthread_mutex_lock(&trace.lock);
+
+	list_for_each_entry(ring, &trace.rings, node)
+		drained |= trace_drain_ring(ring);
+
+	pthread_mutex_unlock(&trace.lock);
+
+	return drained;
+}
+
+static void *trace_writer(void *arg)
+{
+	while (!__atomic_load_n(&trace.stop, __ATOMIC_ACQUIRE)) {
+		if (!trace_drain())
+			usleep(1000);
+	}
+
+	return NULL;
+}
+
+static void trace_exit(void)
+{
+	__atomic_store_n(&trace.stop, true, __ATOMIC_RELEASE);
+	pthread_join(trace.writer, NULL);
+
+	/* records of threads that are still running are best effort */
+	trace_drain();
+	fclose(trace.fout);
+}
+
+void trace_init(void)
+{
+	struct trace_header header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VER,
+		.record_size = sizeof(struct trace_record),
+	};
+	const char *path = getenv("LIBWRAP_TRACE_PATH");
+
+	if (!path)
+		return;
+
+	trace.fout = fopen(path, "w");
+	if (!trace.fout) {
+		fprintf(stderr, "%s: failed to open %s\n", __func__, path);
+		return;
+	}
+
+	fwrite(&header, sizeof(header), 1, trace.fout);
+
+	INIT_LIST_HEAD(&trace.rings);
+
+	if (pthread_create(&trace.writer, NULL, trace_writer, NULL)) {
+		fprintf(stderr, "%s: failed to create writer\n", __func__);
+		fclose(trace.fout);
+		return;
+	}
+
+	atexit(trace_exit);
+
+	/* the text output is produced offline from the trace */
+	libwrap_verbose = false;
+	trace.enabled = true;
+
+	fprintf(stderr, "libwrap tracing to %s\n", path);
+}
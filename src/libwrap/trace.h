@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef GRATE_TRACE_H
+#define GRATE_TRACE_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Binary trace, enabled by LIBWRAP_TRACE_PATH. Every thread appends fixed
+ * size records to a ring of its own, a writer thread drains the rings into
+ * the trace file. Records of a thread are in order, the records of all
+ * threads are ordered by time. tools/wrap-trace decodes the trace to text.
+ */
+#define TRACE_MAGIC	"grateTRC"
+#define TRACE_VER	1
+
+enum trace_type {
+	/* fd, request, arg (low and high word) */
+	TRACE_IOCTL_ENTER = 1,
+	/* fd, request, ret, duration in microseconds */
+	TRACE_IOCTL_LEAVE,
+	/* request, 12 characters of the name at chunk * 12 */
+	TRACE_IOCTL_NAME,
+	/* classid, number of words, followed by TRACE_WORDS */
+	TRACE_COMMANDS,
+	/* 4 words of commands, count gives the valid ones */
+	TRACE_WORDS,
+	/* number of records the ring of the thread had no space for */
+	TRACE_DROPPED,
+};
+
+struct __attribute__((packed)) trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+};
+
+struct __attribute__((packed)) trace_record {
+	/* CLOCK_MONOTONIC in nanoseconds */
+	uint64_t time;
+	uint32_t tid;
+	uint16_t type;
+	/* chunk of TRACE_IOCTL_NAME, count of TRACE_WORDS */
+	uint16_t count;
+	uint32_t data[4];
+};
+
+bool trace_enabled(void);
+void trace_init(void);
+void trace_ioctl_enter(int fd, unsigned long request, void *arg,
+		       const char *name);
+void trace_ioctl_leave(int fd, unsigned long request, int ret, long duration);
+void trace_commands(uint32_t classid, const uint32_t *words,
+		    unsigned int count);
+
+#endif
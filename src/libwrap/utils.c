@@ -39,6 +39,9 @@ struct file_table_entry {
 static LIST_HEAD(file_table);
 static LIST_HEAD(files);
 
+/* ioctls of all threads look their file up, opening and closing is rare */
+static pthread_rwlock_t files_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 void print_hexdump(FILE *fp, int prefix_type, const char *prefix,
 		   const void *buffer, size_t size, size_t columns,
 		   bool ascii)
@@ -115,7 +118,15 @@ struct file *file_open(const char *path, int fd)
 			for (i = 0; i < ARRAY_SIZE(file->dup_fds); i++)
 				file->dup_fds[i] = -1;
 
+			pthread_mutex_init(&file->own_lock, NULL);
+
+			if (!file->lock)
+				file->lock = &file->own_lock;
+
+			pthread_rwlock_wrlock(&files_lock);
 			list_add_tail(&file->list, &files);
+			pthread_rwlock_unlock(&files_lock);
+
 			return file;
 		}
 	}
@@ -125,7 +136,7 @@ struct file *file_open(const char *path, int fd)
 	return NULL;
 }
 
-struct file *file_lookup(int fd)
+static struct file *file_lookup_locked(int fd)
 {
 	struct file *file;
 	unsigned int i;
@@ -142,18 +153,36 @@ struct file *file_lookup(int fd)
 	return NULL;
 }
 
-struct file *file_find(const char *path)
+struct file *file_lookup(int fd)
 {
 	struct file *file;
 
-	list_for_each_entry(file, &files, list)
-		if (strcmp(file->path, path) == 0)
-			return file;
+	pthread_rwlock_rdlock(&files_lock);
+	file = file_lookup_locked(fd);
+	pthread_rwlock_unlock(&files_lock);
 
-	return NULL;
+	return file;
 }
 
-void file_close(int fd)
+struct file *file_find(const char *path)
+{
+	struct file *file, *found = NULL;
+
+	pthread_rwlock_rdlock(&files_lock);
+
+	list_for_each_entry(file, &files, list) {
+		if (strcmp(file->path, path) == 0) {
+			found = file;
+			break;
+		}
+	}
+
+	pthread_rwlock_unlock(&files_lock);
+
+	return found;
+}
+
+static void file_close_locked(int fd)
 {
 	struct file *file;
 	unsigned int i;
@@ -193,6 +222,13 @@ void file_close(int fd)
 	}
 }
 
+void file_close(int fd)
+{
+	pthread_rwlock_wrlock(&files_lock);
+	file_close_locked(fd);
+	pthread_rwlock_unlock(&files_lock);
+}
+
 void file_table_register(const struct file_table *table, unsigned int count)
 {
 	unsigned int i;
@@ -218,14 +254,19 @@ void file_dup(struct file *file, int fd)
 {
 	unsigned int i;
 
+	pthread_rwlock_wrlock(&files_lock);
+
 	for (i = 0; i < ARRAY_SIZE(file->dup_fds); i++) {
 		if (file->dup_fds[i] < 0) {
 			PRINTF("duplicating %s\n", file->path);
 			file->dup_fds[i] = fd;
+			pthread_rwlock_unlock(&files_lock);
 			return;
 		}
 	}
 
+	pthread_rwlock_unlock(&files_lock);
+
 	fprintf(stderr, "out of FD slots\n");
 }
 
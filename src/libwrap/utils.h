@@ -25,12 +25,15 @@
 #ifndef GRATE_UTILS_H
 #define GRATE_UTILS_H 1
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "list.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
 #define PRINTF(...)				\
 	do {					\
@@ -71,6 +74,13 @@ struct file {
 	unsigned int num_ioctls;
 
 	const struct file_ops *ops;
+
+	/*
+	 * Serialises the bookkeeping of ioctls, defaults to a lock of the
+	 * file. Files sharing state set it to a common lock on creation.
+	 */
+	pthread_mutex_t *lock;
+	pthread_mutex_t own_lock;
 };
 
 struct file_ops {
@@ -94,6 +104,26 @@ struct file_table {
 
 void file_table_register(const struct file_table *table, unsigned int count);
 
+/* objects of files are looked up per reloc, hence hashed by handle or id */
+#define FILE_HASH_BITS	8
+#define FILE_HASH_SIZE	(1 << FILE_HASH_BITS)
+
+static inline void file_hash_init(struct list_head *table)
+{
+	unsigned int i;
+
+	for (i = 0; i < FILE_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&table[i]);
+}
+
+static inline struct list_head *file_hash(struct list_head *table,
+					  unsigned long id)
+{
+	uint32_t hash = (uint32_t)id * 0x9e3779b1u;
+
+	return &table[hash >> (32 - FILE_HASH_BITS)];
+}
+
 enum chip_id {
 	TEGRA_INVALID,
 	TEGRA_UNKNOWN,
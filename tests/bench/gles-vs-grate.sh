@@ -0,0 +1,133 @@
+#!/bin/sh
+#
+# Runs the GLES tests on the blob and the grate demos that render the same
+# scene, and reports their throughput and the command stream words they
+# spend per draw side by side:
+#	tests/bench/gles-vs-grate.sh [-b builddir] [-n frames] [-o dir] \
+#		[-w libwrap.so]
+#
+# Both sides run off-screen without vsync. The timed runs go without
+# libwrap, a second run of each side is traced by it for tools/stream-stats,
+# which also keeps the ioctl latencies of the blob in <dir>/<pair>-gles.log.
+#
+# gles-stencil and stencil render a single fixed frame, that pair only
+# compares the words per draw.
+
+DIR=$(dirname $0)
+BUILD=$DIR/../..
+FRAMES=300
+OUT=gles-vs-grate
+WRAP=
+
+while getopts "b:n:o:w:" opt; do
+	case $opt in
+	b) BUILD=$OPTARG ;;
+	n) FRAMES=$OPTARG ;;
+	o) OUT=$OPTARG ;;
+	w) WRAP=$OPTARG ;;
+	*) echo "usage: $0 [-b builddir] [-n frames] [-o dir] [-w libwrap.so]"
+	   exit 2 ;;
+	esac
+done
+
+# libtool keeps the library in .libs, meson next to its sources
+if [ -z "$WRAP" ]; then
+	for lib in $BUILD/src/libwrap/.libs/libgrate-wrap.so \
+		   $BUILD/src/libwrap/libwrap.so; do
+		if [ -e "$lib" ]; then
+			WRAP=$lib
+			break
+		fi
+	done
+fi
+
+if [ -z "$WRAP" ]; then
+	echo "libwrap not found, build it or pass -w"
+	exit 1
+fi
+
+# the programs run from their directories to find their data
+WRAP=$(cd $(dirname $WRAP) && pwd)/$(basename $WRAP)
+
+mkdir -p $OUT || exit 1
+
+# gles test, grate demo and whether they render a frame loop
+PAIRS="
+cube:gles-cube:cube:1
+cube-textured:gles-cube-textured:cube-textured:1
+stencil:gles-stencil:stencil:0
+"
+
+fps() {
+	sed -n 's/.* seconds: \([0-9.]*\) fps$/\1/p' $1 | tail -n 1
+}
+
+p50() {
+	sed -n 's/^frame times of .*: p50 \([0-9.]*\) ms.*/\1/p' $1 | tail -n 1
+}
+
+words_per_draw() {
+	$BUILD/tools/stream-stats $1 2>/dev/null |
+		awk '$1 == "total" { print $3 }'
+}
+
+# run <program> <frames> <log> [trace]
+run() {
+	if [ -n "$4" ]; then
+		(cd $(dirname $1) &&
+		 LD_PRELOAD=$WRAP LIBWRAP_SILENT=1 LIBWRAP_IOCTL_STATS=1 \
+		 LIBWRAP_TRACE_PATH=$4 ./$(basename $1) --bench $2) \
+			> $3 2>&1
+	else
+		(cd $(dirname $1) && ./$(basename $1) --bench $2) > $3 2>&1
+	fi
+}
+
+OUT=$(cd $OUT && pwd)
+
+printf "%-16s %10s %10s %7s %10s %10s %10s %10s\n" "pair" "gles fps" \
+	"grate fps" "ratio" "gles p50" "grate p50" "gles w/d" "grate w/d"
+
+echo "$PAIRS" | while IFS=: read name gles grate loop; do
+	[ -z "$name" ] && continue
+
+	gles=$BUILD/tests/gles2/$gles
+	grate=$BUILD/tests/grate/$grate
+
+	if [ ! -x $gles ] || [ ! -x $grate ]; then
+		echo "$name: not built, skipped"
+		continue
+	fi
+
+	gles_fps=- grate_fps=- ratio=- gles_p50=- grate_p50=-
+
+	if [ $loop = 1 ]; then
+		run $gles $FRAMES $OUT/$name-gles.bench
+		run $grate $FRAMES $OUT/$name-grate.bench
+
+		gles_fps=$(fps $OUT/$name-gles.bench)
+		grate_fps=$(fps $OUT/$name-grate.bench)
+		gles_p50=$(p50 $OUT/$name-gles.bench)
+		grate_p50=$(p50 $OUT/$name-grate.bench)
+
+		if [ -n "$gles_fps" ] && [ -n "$grate_fps" ]; then
+			ratio=$(echo "$grate_fps $gles_fps" |
+				awk '{ printf "%.2f", $2 ? $1 / $2 : 0 }')
+		fi
+	fi
+
+	# the traced runs are short, only the streams matter
+	run $gles 30 $OUT/$name-gles.log $OUT/$name-gles.trace
+	run $grate 30 $OUT/$name-grate.log $OUT/$name-grate.trace
+
+	gles_words=$(words_per_draw $OUT/$name-gles.trace)
+	grate_words=$(words_per_draw $OUT/$name-grate.trace)
+
+	printf "%-16s %10s %10s %7s %10s %10s %10s %10s\n" $name \
+		${gles_fps:--} ${grate_fps:--} $ratio ${gles_p50:--} \
+		${grate_p50:--} ${gles_words:--} ${grate_words:--}
+done
+
+echo
+echo "ratio is grate fps over gles fps, w/d the words per draw"
+echo "ioctl latencies of the blob are in $OUT/<pair>-gles.log"
@@ -0,0 +1,728 @@
+/*
+ * Copyright (c) GRATE-DRIVER project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Micro-benchmarks of libgrate and libhost1x. Results are written as a
+ * single JSON object, which layout is kept stable so that results of
+ * different kernel and library versions can be compared. The object goes
+ * to the file given as the first non-option argument, since the libraries
+ * print informational messages to stdout, or to stdout otherwise.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "grate.h"
+#include "host1x.h"
+#include "matrix.h"
+#include "tgr_3d.xml.h"
+
+#define BENCH_VERSION		1
+
+#define BENCH_WIDTH		1024
+#define BENCH_HEIGHT		1024
+
+#define BENCH_DRAWS		4000
+#define BENCH_TRIANGLES		3000
+#define BENCH_TRIANGLE_LOOPS	20
+#define BENCH_FILL_LOOPS	50
+#define BENCH_GR2D_LOOPS	50
+#define BENCH_BO_LOOPS		2000
+#define BENCH_LATENCY_LOOPS	500
+#define BENCH_MATRICES		1024
+#define BENCH_MATRIX_LOOPS	200
+
+static const char *color_vs[] = {
+	"attribute vec4 position;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_Position = position;\n",
+	"}"
+};
+
+static const char *color_fs[] = {
+	"precision mediump float;\n",
+	"uniform vec4 color;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = color;\n",
+	"}"
+};
+
+static const char *color_linker =
+	"LINK fp20, fp20, NOP, NOP, tram0.xyzw, export1"
+;
+
+static const char *texture_vs[] = {
+	"attribute vec4 position;\n",
+	"attribute vec2 texcoord;\n",
+	"varying vec2 vtexcoord;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_Position = position;\n",
+	"    vtexcoord = texcoord;\n",
+	"}"
+};
+
+static const char *texture_fs[] = {
+	"precision mediump float;\n",
+	"varying vec2 vtexcoord;\n",
+	"uniform sampler2D tex;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = texture2D(tex, vtexcoord);\n",
+	"}"
+};
+
+static const char *texture_linker =
+	"LINK fp20, fp20, NOP, NOP, tram0.zwxx, export1"
+;
+
+static const float quad_vertices[] = {
+	-1.0f, -1.0f, 0.0f, 1.0f,
+	 1.0f, -1.0f, 0.0f, 1.0f,
+	 1.0f,  1.0f, 0.0f, 1.0f,
+	-1.0f,  1.0f, 0.0f, 1.0f,
+};
+
+static const float quad_texcoords[] = {
+	0.0f, 0.0f,
+	1.0f, 0.0f,
+	1.0f, 1.0f,
+	0.0f, 1.0f,
+};
+
+static const unsigned short quad_indices[] = {
+	0, 1, 2,
+	0, 2, 3,
+};
+
+static const float tiny_vertices[] = {
+	-1.0f, -1.0f, 0.0f, 1.0f,
+	-0.99f, -1.0f, 0.0f, 1.0f,
+	-1.0f, -0.99f, 0.0f, 1.0f,
+};
+
+static const unsigned short tiny_indices[] = {
+	0, 1, 2,
+};
+
+static const struct {
+	const char *name;
+	enum pixel_format format;
+} render_formats[] = {
+	{ "RGBA8888", PIX_BUF_FMT_RGBA8888 },
+	{ "RGB565",   PIX_BUF_FMT_RGB565 },
+	{ "RGBA4444", PIX_BUF_FMT_RGBA4444 },
+	{ "A8",       PIX_BUF_FMT_A8 },
+};
+
+static const struct {
+	const char *name;
+	enum pixel_format format;
+} texture_formats[] = {
+	{ "RGBA8888", PIX_BUF_FMT_RGBA8888 },
+	{ "RGB565",   PIX_BUF_FMT_RGB565 },
+	{ "RGBA4444", PIX_BUF_FMT_RGBA4444 },
+	{ "L8",       PIX_BUF_FMT_L8 },
+};
+
+static const struct {
+	const char *name;
+	enum grate_textute_filter filter;
+} texture_filters[] = {
+	{ "NEAREST", GRATE_TEXTURE_NEAREST },
+	{ "LINEAR",  GRATE_TEXTURE_LINEAR },
+};
+
+struct bench {
+	struct grate *grate;
+	struct host1x *host1x;
+	struct grate_3d_ctx *ctx;
+	struct grate_program *color;
+	struct grate_program *texture;
+	struct host1x_pixelbuffer *target;
+	unsigned int num_results;
+	FILE *fp;
+};
+
+static double time_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_result(struct bench *bench, const char *name,
+			 const char *param, double value, const char *unit)
+{
+	fprintf(bench->fp, "%s\n    { \"name\": \"%s\", "
+		"\"param\": \"%s\", \"value\": %.3f, \"unit\": \"%s\" }",
+		bench->num_results++ ? "," : "", name, param, value, unit);
+	fflush(bench->fp);
+}
+
+static struct grate_program *bench_program(struct bench *bench,
+					   const char **vs_source,
+					   unsigned int vs_lines,
+					   const char **fs_source,
+					   unsigned int fs_lines,
+					   const char *linker_source)
+{
+	struct grate_shader *vs, *fs, *linker;
+	struct grate_program *program;
+
+	vs = grate_shader_new(bench->grate, GRATE_SHADER_VERTEX, vs_source,
+			      vs_lines);
+	fs = grate_shader_new(bench->grate, GRATE_SHADER_FRAGMENT, fs_source,
+			      fs_lines);
+	linker = grate_shader_parse_linker_asm(linker_source);
+	if (!vs || !fs || !linker)
+		return NULL;
+
+	program = grate_program_new(bench->grate, vs, fs, linker);
+	if (!program)
+		return NULL;
+
+	grate_program_link(program);
+
+	return program;
+}
+
+static void bench_setup_ctx(struct bench *bench,
+			    struct grate_program *program,
+			    struct host1x_pixelbuffer *target)
+{
+	struct grate_3d_ctx *ctx = bench->ctx;
+
+	grate_3d_ctx_bind_program(ctx, program);
+	grate_3d_ctx_set_depth_range(ctx, 0.0f, 1.0f);
+	grate_3d_ctx_set_dither(ctx, 0x779);
+	grate_3d_ctx_set_point_params(ctx, 0x1401);
+	grate_3d_ctx_set_point_size(ctx, 1.0f);
+	grate_3d_ctx_set_line_params(ctx, 0x2);
+	grate_3d_ctx_set_line_width(ctx, 1.0f);
+	grate_3d_ctx_set_viewport_bias(ctx, 0.0f, 0.0f, 0.5f);
+	grate_3d_ctx_set_viewport_scale(ctx, target->width, target->height,
+					0.5f);
+	grate_3d_ctx_use_guardband(ctx, true);
+	grate_3d_ctx_set_front_direction_is_cw(ctx, false);
+	grate_3d_ctx_set_cull_face(ctx, GRATE_3D_CTX_CULL_FACE_NONE);
+	grate_3d_ctx_set_scissor(ctx, 0, target->width, 0, target->height);
+	grate_3d_ctx_set_point_coord_range(ctx, 0.0f, 1.0f, 0.0f, 1.0f);
+	grate_3d_ctx_set_polygon_offset(ctx, 0.0f, 0.0f);
+	grate_3d_ctx_set_provoking_vtx_last(ctx, true);
+
+	grate_3d_ctx_bind_render_target(ctx, 1, target);
+	grate_3d_ctx_enable_render_target(ctx, 1);
+}
+
+static void bench_set_position(struct bench *bench,
+			       struct grate_program *program,
+			       struct host1x_bo *bo)
+{
+	int location = grate_get_attribute_location(program, "position");
+
+	grate_3d_ctx_vertex_attrib_float_pointer(bench->ctx, location, 4, bo);
+	grate_3d_ctx_enable_vertex_attrib_array(bench->ctx, location);
+}
+
+static void bench_set_color(struct bench *bench)
+{
+	float color[4] = { 1.0f, 0.5f, 0.25f, 1.0f };
+	int location;
+
+	location = grate_get_fragment_uniform_location(bench->color, "color");
+	grate_3d_ctx_set_fragment_uniform(bench->ctx, location, 4, color);
+}
+
+/* draw calls per second, with a state change every "rate" draws */
+static void bench_draw_calls(struct bench *bench, unsigned int rate)
+{
+	struct host1x_pixelbuffer *target = bench->target;
+	struct host1x_bo *vertices, *indices;
+	char param[32];
+	double start;
+	unsigned int i;
+
+	vertices = grate_create_attrib_bo_from_data(bench->grate,
+						    tiny_vertices);
+	indices = grate_create_attrib_bo_from_data(bench->grate, tiny_indices);
+	if (!vertices || !indices)
+		goto out;
+
+	bench_setup_ctx(bench, bench->color, target);
+	bench_set_position(bench, bench->color, vertices);
+	bench_set_color(bench);
+
+	start = time_sec();
+	grate_3d_begin_batch(bench->grate);
+
+	for (i = 0; i < BENCH_DRAWS; i++) {
+		if (rate && i % rate == 0)
+			grate_3d_ctx_set_scissor(bench->ctx, 0,
+						 target->width - (i / rate & 1),
+						 0, target->height);
+
+		grate_3d_draw_elements_async(bench->ctx,
+					     TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+					     indices, TGR3D_INDEX_MODE_UINT16,
+					     ARRAY_SIZE(tiny_indices), NULL);
+	}
+
+	grate_3d_end_batch(bench->grate, NULL);
+	grate_flush(bench->grate);
+
+	if (rate)
+		snprintf(param, sizeof(param), "state change every %u", rate);
+	else
+		snprintf(param, sizeof(param), "no state changes");
+
+	bench_result(bench, "draw_calls", param,
+		     BENCH_DRAWS / (time_sec() - start), "draws/s");
+
+out:
+	grate_bo_free(bench->grate, indices);
+	grate_bo_free(bench->grate, vertices);
+}
+
+/* small triangles in a single draw */
+static void bench_triangles(struct bench *bench)
+{
+	unsigned int count = BENCH_TRIANGLES * 3;
+	struct host1x_bo *vertices, *indices;
+	unsigned short *index_data;
+	float *vertex_data;
+	double start;
+	unsigned int i;
+
+	vertex_data = malloc(count * 4 * sizeof(*vertex_data));
+	index_data = malloc(count * sizeof(*index_data));
+	if (!vertex_data || !index_data)
+		return;
+
+	/* a grid of triangles, a few pixels in size each */
+	for (i = 0; i < count; i++) {
+		float *v = &vertex_data[i * 4];
+
+		v[0] = tiny_vertices[i % 3 * 4 + 0] + (i / 3 % 64) / 32.0f;
+		v[1] = tiny_vertices[i % 3 * 4 + 1] + (i / 3 / 64 % 64) / 32.0f;
+		v[2] = 0.0f;
+		v[3] = 1.0f;
+
+		index_data[i] = i;
+	}
+
+	vertices = grate_bo_create_from_data(bench->grate,
+					     count * 4 * sizeof(*vertex_data),
+					     NVHOST_BO_FLAG_ATTRIBUTES,
+					     vertex_data);
+	indices = grate_bo_create_from_data(bench->grate,
+					    count * sizeof(*index_data),
+					    NVHOST_BO_FLAG_ATTRIBUTES,
+					    index_data);
+	free(index_data);
+	free(vertex_data);
+
+	if (!vertices || !indices)
+		goto out;
+
+	bench_setup_ctx(bench, bench->color, bench->target);
+	bench_set_position(bench, bench->color, vertices);
+	bench_set_color(bench);
+
+	start = time_sec();
+
+	for (i = 0; i < BENCH_TRIANGLE_LOOPS; i++)
+		grate_3d_draw_elements_async(bench->ctx,
+					     TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+					     indices, TGR3D_INDEX_MODE_UINT16,
+					     count, NULL);
+
+	grate_flush(bench->grate);
+
+	bench_result(bench, "triangles", "small triangles",
+		     BENCH_TRIANGLES * BENCH_TRIANGLE_LOOPS /
+		     (time_sec() - start), "triangles/s");
+
+out:
+	grate_bo_free(bench->grate, indices);
+	grate_bo_free(bench->grate, vertices);
+}
+
+static double bench_quads(struct bench *bench, struct host1x_bo *indices,
+			  unsigned int loops)
+{
+	double start = time_sec();
+	unsigned int i;
+
+	for (i = 0; i < loops; i++)
+		grate_3d_draw_elements_async(bench->ctx,
+					     TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+					     indices, TGR3D_INDEX_MODE_UINT16,
+					     ARRAY_SIZE(quad_indices), NULL);
+
+	grate_flush(bench->grate);
+
+	return time_sec() - start;
+}
+
+/* full-screen quads of a constant colour per render target format */
+static void bench_fill_rate(struct bench *bench)
+{
+	struct host1x_bo *vertices, *indices;
+	struct host1x_pixelbuffer *target;
+	double time;
+	unsigned int i;
+
+	vertices = grate_create_attrib_bo_from_data(bench->grate,
+						    quad_vertices);
+	indices = grate_create_attrib_bo_from_data(bench->grate, quad_indices);
+	if (!vertices || !indices)
+		goto out;
+
+	for (i = 0; i < ARRAY_SIZE(render_formats); i++) {
+		target = host1x_pixelbuffer_create(bench->host1x,
+						   BENCH_WIDTH, BENCH_HEIGHT,
+						   BENCH_WIDTH *
+						   PIX_BUF_FORMAT_BYTES(
+						   render_formats[i].format),
+						   render_formats[i].format,
+						   PIX_BUF_LAYOUT_TILED_16x16);
+		if (!target)
+			continue;
+
+		bench_setup_ctx(bench, bench->color, target);
+		bench_set_position(bench, bench->color, vertices);
+		bench_set_color(bench);
+
+		time = bench_quads(bench, indices, BENCH_FILL_LOOPS);
+
+		bench_result(bench, "fill_rate", render_formats[i].name,
+			     (double)BENCH_WIDTH * BENCH_HEIGHT *
+			     BENCH_FILL_LOOPS / time / 1e6, "Mpixels/s");
+
+		host1x_pixelbuffer_free(target);
+	}
+
+out:
+	grate_bo_free(bench->grate, indices);
+	grate_bo_free(bench->grate, vertices);
+}
+
+/* full-screen textured quads per texture format and filter */
+static void bench_texture_rate(struct bench *bench)
+{
+	struct host1x_bo *vertices, *texcoords, *indices;
+	struct grate_texture *texture;
+	char param[64];
+	double time;
+	unsigned int i, k;
+	int location;
+
+	vertices = grate_create_attrib_bo_from_data(bench->grate,
+						    quad_vertices);
+	texcoords = grate_create_attrib_bo_from_data(bench->grate,
+						     quad_texcoords);
+	indices = grate_create_attrib_bo_from_data(bench->grate, quad_indices);
+	if (!vertices || !texcoords || !indices)
+		goto out;
+
+	for (i = 0; i < ARRAY_SIZE(texture_formats); i++) {
+		texture = grate_create_texture(bench->grate,
+					       BENCH_WIDTH, BENCH_HEIGHT,
+					       texture_formats[i].format,
+					       PIX_BUF_LAYOUT_TILED_16x16);
+		if (!texture)
+			continue;
+
+		grate_texture_clear(bench->grate, texture, 0x80808080);
+
+		bench_setup_ctx(bench, bench->texture, bench->target);
+		bench_set_position(bench, bench->texture, vertices);
+
+		location = grate_get_attribute_location(bench->texture,
+							"texcoord");
+		grate_3d_ctx_vertex_attrib_float_pointer(bench->ctx, location,
+							 2, texcoords);
+		grate_3d_ctx_enable_vertex_attrib_array(bench->ctx, location);
+
+		for (k = 0; k < ARRAY_SIZE(texture_filters); k++) {
+			grate_texture_set_min_filter(texture,
+						     texture_filters[k].filter);
+			grate_texture_set_mag_filter(texture,
+						     texture_filters[k].filter);
+			grate_3d_ctx_bind_texture(bench->ctx, 0, texture);
+
+			time = bench_quads(bench, indices, BENCH_FILL_LOOPS);
+
+			snprintf(param, sizeof(param), "%s %s",
+				 texture_formats[i].name,
+				 texture_filters[k].name);
+
+			bench_result(bench, "texture_rate", param,
+				     (double)BENCH_WIDTH * BENCH_HEIGHT *
+				     BENCH_FILL_LOOPS / time / 1e6,
+				     "Mtexels/s");
+		}
+
+		grate_texture_free(texture);
+	}
+
+out:
+	grate_bo_free(bench->grate, indices);
+	grate_bo_free(bench->grate, texcoords);
+	grate_bo_free(bench->grate, vertices);
+}
+
+/* bandwidth of GR2D solid fills and of copies between surfaces */
+static void bench_gr2d(struct bench *bench)
+{
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(bench->host1x);
+	struct host1x_pixelbuffer *src = bench->target, *dst;
+	size_t size = (size_t)src->pitch * src->height;
+	double start;
+	unsigned int i;
+
+	dst = host1x_pixelbuffer_create(bench->host1x, src->width,
+					src->height, src->pitch, src->format,
+					src->layout);
+	if (!dst)
+		return;
+
+	start = time_sec();
+	for (i = 0; i < BENCH_GR2D_LOOPS; i++)
+		host1x_gr2d_clear(gr2d, dst, 0xff00ff00);
+
+	bench_result(bench, "gr2d_fill", "RGBA8888",
+		     size * BENCH_GR2D_LOOPS / (time_sec() - start) / 1e9,
+		     "GB/s");
+
+	start = time_sec();
+	for (i = 0; i < BENCH_GR2D_LOOPS; i++)
+		host1x_gr2d_blit(gr2d, src, dst, 0, 0, 0, 0, src->width,
+				 src->height);
+
+	/* a copy reads and writes every byte */
+	bench_result(bench, "gr2d_blit", "RGBA8888",
+		     2.0 * size * BENCH_GR2D_LOOPS / (time_sec() - start) / 1e9,
+		     "GB/s");
+
+	host1x_pixelbuffer_free(dst);
+}
+
+/* BO create and free pairs per second, mostly served by the BO cache */
+static void bench_bo_alloc(struct bench *bench)
+{
+	static const size_t sizes[] = { 4096, 65536, 1048576 };
+	struct host1x_bo *bo;
+	char param[32];
+	double start;
+	unsigned int i, k;
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		start = time_sec();
+
+		for (k = 0; k < BENCH_BO_LOOPS; k++) {
+			bo = HOST1X_BO_CREATE(bench->host1x, sizes[i], 0);
+			if (!bo)
+				return;
+
+			host1x_bo_free(bo);
+		}
+
+		snprintf(param, sizeof(param), "%zu bytes", sizes[i]);
+
+		bench_result(bench, "bo_alloc_free", param,
+			     BENCH_BO_LOOPS / (time_sec() - start), "pairs/s");
+	}
+}
+
+/* CPU side of a many-object scene: model matrices and vertex transforms */
+static void bench_matrix(struct bench *bench)
+{
+	static struct mat4 models[BENCH_MATRICES], mvp[BENCH_MATRICES];
+	static struct vec4 vertices[BENCH_MATRICES], result[BENCH_MATRICES];
+	struct mat4 projection;
+	unsigned int i, k;
+	double start;
+
+	mat4_perspective(&projection, 60.0f, 1.0f, 1.0f, 1024.0f);
+
+	for (i = 0; i < BENCH_MATRICES; i++) {
+		mat4_rotate_y(&models[i], i);
+		vertices[i].x = i;
+		vertices[i].y = -(float)i;
+		vertices[i].z = 1.0f;
+		vertices[i].w = 1.0f;
+	}
+
+	start = time_sec();
+	for (k = 0; k < BENCH_MATRIX_LOOPS; k++)
+		for (i = 0; i < BENCH_MATRICES; i++)
+			mat4_multiply(&mvp[i], &projection, &models[i]);
+
+	bench_result(bench, "mat4", "multiply",
+		     BENCH_MATRICES * BENCH_MATRIX_LOOPS /
+		     (time_sec() - start), "matrices/s");
+
+	start = time_sec();
+	for (k = 0; k < BENCH_MATRIX_LOOPS; k++)
+		mat4_multiply_mvp(mvp, &projection, models, BENCH_MATRICES);
+
+	bench_result(bench, "mat4", "multiply_mvp",
+		     BENCH_MATRICES * BENCH_MATRIX_LOOPS /
+		     (time_sec() - start), "matrices/s");
+
+	start = time_sec();
+	for (k = 0; k < BENCH_MATRIX_LOOPS; k++)
+		mat4_transform_vec4(result, &mvp[k], vertices,
+				    BENCH_MATRICES);
+
+	bench_result(bench, "mat4", "transform_vec4",
+		     BENCH_MATRICES * BENCH_MATRIX_LOOPS /
+		     (time_sec() - start), "vectors/s");
+}
+
+/* round trip of a minimal job from submission to the syncpoint wait */
+static void bench_submit_latency(struct bench *bench)
+{
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(bench->host1x);
+	struct host1x_bo *vertices, *indices;
+	double start;
+	unsigned int i;
+
+	start = time_sec();
+	for (i = 0; i < BENCH_LATENCY_LOOPS; i++)
+		host1x_gr2d_clear_rect(gr2d, bench->target, 0, 0, 0, 1, 1);
+
+	bench_result(bench, "submit_latency", "gr2d",
+		     (time_sec() - start) / BENCH_LATENCY_LOOPS * 1e6, "us");
+
+	vertices = grate_create_attrib_bo_from_data(bench->grate,
+						    tiny_vertices);
+	indices = grate_create_attrib_bo_from_data(bench->grate, tiny_indices);
+	if (!vertices || !indices)
+		goto out;
+
+	bench_setup_ctx(bench, bench->color, bench->target);
+	bench_set_position(bench, bench->color, vertices);
+	bench_set_color(bench);
+
+	start = time_sec();
+	for (i = 0; i < BENCH_LATENCY_LOOPS; i++)
+		grate_3d_draw_elements(bench->ctx,
+				       TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+				       indices, TGR3D_INDEX_MODE_UINT16,
+				       ARRAY_SIZE(tiny_indices));
+
+	bench_result(bench, "submit_latency", "gr3d",
+		     (time_sec() - start) / BENCH_LATENCY_LOOPS * 1e6, "us");
+
+out:
+	grate_bo_free(bench->grate, indices);
+	grate_bo_free(bench->grate, vertices);
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int rates[] = { 0, 16, 4, 1 };
+	struct grate_options options;
+	struct bench bench;
+	unsigned int i;
+
+	if (!grate_parse_command_line(&options, argc, argv))
+		return 1;
+
+	/* benchmarks render off-screen */
+	options.nodisplay = true;
+
+	memset(&bench, 0, sizeof(bench));
+
+	bench.grate = grate_init(&options);
+	if (!bench.grate)
+		return 1;
+
+	bench.host1x = grate_get_host1x(bench.grate);
+	bench.ctx = grate_3d_alloc_ctx(bench.grate);
+	bench.color = bench_program(&bench, color_vs, ARRAY_SIZE(color_vs),
+				    color_fs, ARRAY_SIZE(color_fs),
+				    color_linker);
+	bench.texture = bench_program(&bench, texture_vs,
+				      ARRAY_SIZE(texture_vs), texture_fs,
+				      ARRAY_SIZE(texture_fs), texture_linker);
+	bench.target = host1x_pixelbuffer_create(bench.host1x, BENCH_WIDTH,
+						 BENCH_HEIGHT, BENCH_WIDTH * 4,
+						 PIX_BUF_FMT_RGBA8888,
+						 PIX_BUF_LAYOUT_TILED_16x16);
+	if (!bench.ctx || !bench.color || !bench.texture || !bench.target) {
+		fprintf(stderr, "failed to set up benchmarks\n");
+		return 1;
+	}
+
+	bench.fp = stdout;
+
+	if (optind < argc) {
+		bench.fp = fopen(argv[optind], "w");
+		if (!bench.fp) {
+			fprintf(stderr, "failed to open %s\n", argv[optind]);
+			return 1;
+		}
+	}
+
+	fprintf(bench.fp, "{\n  \"version\": %u,\n  \"soc\": %u,\n"
+		"  \"width\": %u,\n  \"height\": %u,\n  \"results\": [",
+		BENCH_VERSION, grate_chip_info()->soc_id, BENCH_WIDTH,
+		BENCH_HEIGHT);
+
+	for (i = 0; i < ARRAY_SIZE(rates); i++)
+		bench_draw_calls(&bench, rates[i]);
+
+	bench_triangles(&bench);
+	bench_fill_rate(&bench);
+	bench_texture_rate(&bench);
+	bench_gr2d(&bench);
+	bench_bo_alloc(&bench);
+	bench_submit_latency(&bench);
+	bench_matrix(&bench);
+
+	fprintf(bench.fp, "\n  ]\n}\n");
+
+	if (bench.fp != stdout)
+		fclose(bench.fp);
+
+	host1x_pixelbuffer_free(bench.target);
+	grate_exit(bench.grate);
+
+	return 0;
+}
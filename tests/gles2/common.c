@@ -24,9 +24,11 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <GLES2/gl2.h>
 #include <IL/il.h>
@@ -37,6 +39,92 @@
 
 #define PNG_COLOR_TYPE_INVALID 0xff
 
+/* frames rendered before the frame times are collected */
+#define GLES_BENCH_WARMUP_FRAMES 30
+
+static struct {
+	unsigned int frames;
+	unsigned int count;
+	uint64_t start;
+	uint64_t last;
+	uint64_t *times;
+} bench;
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+	uint64_t ta = *(const uint64_t *)a, tb = *(const uint64_t *)b;
+
+	return ta < tb ? -1 : ta > tb;
+}
+
+/*
+ * Benchmarks render off-screen and without vsync, the frames are timed
+ * between calls of window_event_loop() past the warm-up. The report has
+ * the layout of the --bench report of the grate demos.
+ */
+void gles_bench_init(unsigned int frames)
+{
+	bench.frames = frames;
+
+	bench.times = calloc(frames + 1, sizeof(*bench.times));
+	if (!bench.times)
+		bench.frames = 0;
+}
+
+static bool bench_frame(void)
+{
+	uint64_t now;
+
+	glFlush();
+	now = bench_now();
+
+	if (bench.count == GLES_BENCH_WARMUP_FRAMES)
+		bench.start = now;
+	else if (bench.count > GLES_BENCH_WARMUP_FRAMES)
+		bench.times[bench.count - GLES_BENCH_WARMUP_FRAMES - 1] =
+			now - bench.last;
+
+	bench.last = now;
+
+	return bench.count++ < GLES_BENCH_WARMUP_FRAMES + bench.frames;
+}
+
+static void bench_report(void)
+{
+	unsigned int frames;
+	double time;
+
+	if (bench.count <= GLES_BENCH_WARMUP_FRAMES + 1)
+		return;
+
+	/* the last frame is complete once the GPU is idle */
+	glFinish();
+
+	frames = bench.count - GLES_BENCH_WARMUP_FRAMES - 1;
+	time = (bench_now() - bench.start) / 1000000.0;
+
+	printf("%u frames in %.3f seconds: %.2f fps\n", frames, time,
+	       frames / time);
+
+	qsort(bench.times, frames, sizeof(*bench.times), bench_compare);
+
+	printf("frame times of last %u frames: p50 %.2f ms, p95 %.2f ms, "
+	       "p99 %.2f ms, max %.2f ms\n", frames,
+	       bench.times[frames / 2] / 1000.0,
+	       bench.times[frames * 95 / 100] / 1000.0,
+	       bench.times[frames * 99 / 100] / 1000.0,
+	       bench.times[frames - 1] / 1000.0);
+}
+
 png_byte png_format(GLenum format)
 {
 	switch (format) {
@@ -69,12 +157,17 @@ int gles_parse_command_line(struct gles_options *opts, int argc, char *argv[])
 {
 	static const struct option options[] = {
 		{ "size", 1, NULL, 's' },
+		{ "bench", 1, NULL, 'b' },
 		{ NULL, 0, NULL, 0 }
 	};
 	int opt, num;
 
-	while ((opt = getopt_long(argc, argv, "s:", options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "s:b:", options, NULL)) != -1) {
 		switch (opt) {
+		case 'b':
+			gles_bench_init(strtoul(optarg, NULL, 10));
+			break;
+
 		case 's':
 			num = sscanf(optarg, "%ux%u", &opts->width,
 				     &opts->height);
@@ -90,6 +183,76 @@ int gles_parse_command_line(struct gles_options *opts, int argc, char *argv[])
 	return optind;
 }
 
+/* benchmarks draw into a pbuffer that stands in for the window */
+static struct window *window_create_offscreen(unsigned int width,
+					      unsigned int height)
+{
+	static const EGLint attribs[] = {
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 8,
+		EGL_STENCIL_SIZE, 8,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_NONE
+	};
+	static const EGLint attrs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	const EGLint surface_attribs[] = {
+		EGL_WIDTH, width,
+		EGL_HEIGHT, height,
+		EGL_NONE
+	};
+	struct window *window;
+	EGLint num_configs;
+	EGLConfig config;
+
+	window = calloc(1, sizeof(*window));
+	if (!window)
+		return NULL;
+
+	window->width = width;
+	window->height = height;
+
+	window->egl.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (window->egl.display == EGL_NO_DISPLAY)
+		goto err;
+
+	if (!eglInitialize(window->egl.display, NULL, NULL))
+		goto err;
+
+	if (!eglChooseConfig(window->egl.display, attribs, &config, 1,
+			     &num_configs) || !num_configs)
+		goto err;
+
+	eglBindAPI(EGL_OPENGL_ES_API);
+
+	window->egl.surface = eglCreatePbufferSurface(window->egl.display,
+						      config, surface_attribs);
+	if (window->egl.surface == EGL_NO_SURFACE)
+		goto err;
+
+	window->egl.context = eglCreateContext(window->egl.display, config,
+					       EGL_NO_CONTEXT, attrs);
+	if (window->egl.context == EGL_NO_CONTEXT)
+		goto err;
+
+	if (!eglMakeCurrent(window->egl.display, window->egl.surface,
+			    window->egl.surface, window->egl.context))
+		goto err;
+
+	eglSwapInterval(window->egl.display, 0);
+
+	return window;
+
+err:
+	free(window);
+	return NULL;
+}
+
 struct window *window_create(unsigned int x, unsigned int y,
 			     unsigned int width, unsigned int height)
 {
@@ -115,6 +278,9 @@ struct window *window_create(unsigned int x, unsigned int y,
 	EGLint version;
 	Window root;
 
+	if (bench.frames)
+		return window_create_offscreen(width, height);
+
 	window = calloc(1, sizeof(*window));
 	if (!window)
 		return NULL;
@@ -202,6 +368,17 @@ struct window *window_create(unsigned int x, unsigned int y,
 
 void window_close(struct window *window)
 {
+	if (!window->x.display) {
+		bench_report();
+		eglMakeCurrent(window->egl.display, EGL_NO_SURFACE,
+			       EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroySurface(window->egl.display, window->egl.surface);
+		eglDestroyContext(window->egl.display, window->egl.context);
+		eglTerminate(window->egl.display);
+		free(window);
+		return;
+	}
+
 	eglDestroySurface(window->egl.display, window->egl.surface);
 	eglDestroyContext(window->egl.display, window->egl.context);
 	XDestroyWindow(window->x.display, window->x.window);
@@ -213,7 +390,7 @@ void window_close(struct window *window)
 
 void window_show(struct window *window)
 {
-	int done = False;
+	int done = window->x.display == NULL;
 
 	while (!done) {
 		XEvent event;
@@ -240,6 +417,9 @@ void window_show(struct window *window)
 
 bool window_event_loop(struct window *window)
 {
+	if (!window->x.display)
+		return bench_frame();
+
 	if (XPending(window->x.display)) {
 		XEvent event;
 
@@ -43,6 +43,8 @@ struct gles_options {
 int gles_parse_command_line(struct gles_options *options, int argc,
 			    char *argv[]);
 
+void gles_bench_init(unsigned int frames);
+
 struct window {
 	struct {
 		Display *display;
@@ -159,11 +159,19 @@ static void window_draw(struct window *window)
 
 int main(int argc, char *argv[])
 {
+	struct gles_options options;
 	struct window *window;
 
 	grate_init_data_path(argv[0]);
 
-	window = window_create(0, 0, 640, 480);
+	memset(&options, 0, sizeof(options));
+	options.width = 640;
+	options.height = 480;
+
+	if (gles_parse_command_line(&options, argc, argv) < 0)
+		return 1;
+
+	window = window_create(0, 0, options.width, options.height);
 	if (!window) {
 		fprintf(stderr, "window_create() failed\n");
 		return 1;
@@ -185,8 +185,10 @@ int main(int argc, char *argv[])
 		{ "StencilEnabled", 0, NULL, 's' },
 		{ "StencilFuncFace", 1, NULL, 'n' },
 		{ "StencilOpFace", 1, NULL, 'o' },
+		{ "bench", 1, NULL, 'b' },
+		{ NULL, 0, NULL, 0 }
 	};
-	static const char opts[] = "u:r:m:f:z:p:sn:o:";
+	static const char opts[] = "u:r:m:f:z:p:sn:o:b:";
 	int opt;
 
 	grate_init_data_path(argv[0]);
@@ -261,6 +263,10 @@ int main(int argc, char *argv[])
 			if (strcmp(optarg, "GL_BACK") == 0)	{ opface = GL_BACK; break; }
 			break;
 
+		case 'b':
+			gles_bench_init(strtoul(optarg, NULL, 10));
+			break;
+
 		default:
 			fprintf(stderr, "Invalid cmdline argument\n");
 			return 1;
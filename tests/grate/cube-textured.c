@@ -160,8 +160,10 @@ int main(int argc, char *argv[])
 	struct grate_3d_ctx *ctx;
 	struct grate_texture *texture;
 	struct host1x_pixelbuffer *pixbuf;
+	struct grate_vertex_attrib_data attribs[2] = { 0 };
+	struct grate_vertex_buffer vb;
 	struct host1x_bo *bo;
-	int location, mvp_loc;
+	int mvp_loc, err;
 	float aspect, elapsed;
 
 	grate_init_data_path(argv[0]);
@@ -226,19 +228,26 @@ int main(int argc, char *argv[])
 	grate_3d_ctx_set_polygon_offset(ctx, 0.0f, 0.0f);
 	grate_3d_ctx_set_provoking_vtx_last(ctx, true);
 
-	/* Setup vertices attribute */
+	/* Setup vertices and texcoords attributes */
 
-	location = grate_get_attribute_location(program, "position");
-	bo = grate_create_attrib_bo_from_data(grate, vertices);
-	grate_3d_ctx_vertex_attrib_float_pointer(ctx, location, 4, bo);
-	grate_3d_ctx_enable_vertex_attrib_array(ctx, location);
+	attribs[0].location = grate_get_attribute_location(program,
+							  "position");
+	attribs[0].size = 4;
+	attribs[0].data = vertices;
 
-	/* Setup texcoords attribute */
+	attribs[1].location = grate_get_attribute_location(program,
+							  "texcoord");
+	attribs[1].size = 2;
+	attribs[1].data = uv;
 
-	location = grate_get_attribute_location(program, "texcoord");
-	bo = grate_create_attrib_bo_from_data(grate, uv);
-	grate_3d_ctx_vertex_attrib_float_pointer(ctx, location, 2, bo);
-	grate_3d_ctx_enable_vertex_attrib_array(ctx, location);
+	err = grate_vertex_buffer_init(grate, &vb, attribs, ARRAY_SIZE(attribs),
+				       ARRAY_SIZE(vertices) / 4);
+	if (err < 0) {
+		fprintf(stderr, "grate_vertex_buffer_init() failed\n");
+		return 1;
+	}
+
+	grate_3d_ctx_bind_vertex_buffer(ctx, &vb);
 
 	/* Setup render target */
 
@@ -309,6 +318,7 @@ int main(int argc, char *argv[])
 	grate_profile_finish(profile);
 	grate_profile_free(profile);
 
+	grate_vertex_buffer_release(&vb);
 	grate_exit(grate);
 	return 0;
 }
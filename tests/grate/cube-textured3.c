@@ -160,6 +160,7 @@ static struct grate *grate;
 static struct grate_3d_ctx *ctx;
 static struct grate_texture *depth_buffer;
 static struct grate_font *font;
+static struct grate_text *text;
 
 static struct grate_program *cube_program;
 static struct grate_shader *cube_vs, *cube_fs, *cube_linker;
@@ -429,6 +430,12 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	text = grate_text_create(grate, font);
+	if (!text) {
+		fprintf(stderr, "grate_text_create() failed\n");
+		return 1;
+	}
+
 	font_scale = options.width / 500.0f / aspect;
 
 	/* Set up textures */
@@ -552,24 +559,25 @@ int main(int argc, char *argv[])
 
 		draw_cube(cube_texture, 0.0f, 0.0f, 0.0f, x, y, z);
 
-		grate_3d_printf(grate, ctx, font, 1, -0.85f, 0.85f, font_scale,
-				"Texture compression: %s\n"
-				"SKY texture size: %ux%u\n"
-				"Galaxy texture size: %ux%u\n"
-				"Cube texture size: %ux%u\n"
-				"Framebuffer size: %ux%u\n"
-				"FPS: %.2f (%s)\n",
-				compression_modes[mode].name,
-				sky_texture->pixbuf->width,
-				sky_texture->pixbuf->height,
-				galaxy_texture->pixbuf->width,
-				galaxy_texture->pixbuf->height,
-				cube_texture->pixbuf->width,
-				cube_texture->pixbuf->height,
-				fb_pixbuf->width, fb_pixbuf->height,
-				frames / (elapsed - basetime),
-				(options.vsync || !options.singlebuffered) ?
-				"VSYNC limited" : "Unlimited");
+		grate_text_printf(text, -0.85f, 0.85f, font_scale,
+				  "Texture compression: %s\n"
+				  "SKY texture size: %ux%u\n"
+				  "Galaxy texture size: %ux%u\n"
+				  "Cube texture size: %ux%u\n"
+				  "Framebuffer size: %ux%u\n"
+				  "FPS: %.2f (%s)\n",
+				  compression_modes[mode].name,
+				  sky_texture->pixbuf->width,
+				  sky_texture->pixbuf->height,
+				  galaxy_texture->pixbuf->width,
+				  galaxy_texture->pixbuf->height,
+				  cube_texture->pixbuf->width,
+				  cube_texture->pixbuf->height,
+				  fb_pixbuf->width, fb_pixbuf->height,
+				  frames / (elapsed - basetime),
+				  (options.vsync || !options.singlebuffered) ?
+				  "VSYNC limited" : "Unlimited");
+		grate_text_draw(text, ctx, 1);
 
 		grate_swap_buffers(grate);
 
@@ -589,6 +597,7 @@ int main(int argc, char *argv[])
 	grate_profile_finish(profile);
 	grate_profile_free(profile);
 
+	grate_text_free(text);
 	grate_exit(grate);
 	return 0;
 }
@@ -133,6 +133,7 @@ int main(int argc, char *argv[])
 	float scale = 1.0f;
 	float k_factor = 1.0f;
 	struct grate_profile *profile;
+	struct grate_hud *hud;
 	struct grate_framebuffer *fb;
 	struct grate_options options;
 	struct grate *grate;
@@ -156,6 +157,7 @@ int main(int argc, char *argv[])
 	unsigned cull_mode = 0;
 	unsigned depth_func = 0;
 	bool front_direction_cw = false;
+	bool show_hud = true;
 
 	grate_init_data_path(argv[0]);
 
@@ -304,9 +306,14 @@ int main(int argc, char *argv[])
 	printf("Key 1     - toggle face cull mode\n");
 	printf("Key 2     - toggle triangle front face direction mode\n");
 	printf("Key 3     - toggle depth test function\n");
+	printf("Key H     - toggle HUD\n");
 	printf("Press escape to exit\n");
 	printf("\n");
 
+	hud = grate_hud_create(grate);
+	if (!hud)
+		fprintf(stderr, "grate_hud_create() failed\n");
+
 	profile = grate_profile_start(grate);
 
 	while (true) {
@@ -344,6 +351,10 @@ int main(int argc, char *argv[])
 		grate_3d_draw_elements(ctx, TGR3D_PRIMITIVE_TYPE_TRIANGLES,
 				       cube_bo, TGR3D_INDEX_MODE_UINT16,
 				       ARRAY_SIZE(cube_indices));
+
+		if (hud && show_hud)
+			grate_hud_draw(hud, ctx, 1);
+
 		grate_flush(grate);
 
 		grate_swap_buffers(grate);
@@ -470,6 +481,9 @@ int main(int argc, char *argv[])
 				continue;
 			}
 			continue;
+		case 104: /* KEY_H */
+			show_hud = !show_hud;
+			continue;
 		case 27: /* KEY_ESC */
 			break;
 		case 0:
@@ -488,6 +502,9 @@ int main(int argc, char *argv[])
 	grate_profile_finish(profile);
 	grate_profile_free(profile);
 
+	if (hud)
+		grate_hud_free(hud);
+
 	grate_exit(grate);
 	return 0;
 }
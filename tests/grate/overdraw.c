@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Draws full screen quads back to front, the worst case for overdraw, with
+ * an expensive fragment program. GRATE_DEPTH_PREPASS=1 lays the depth down
+ * first, so the fragment program runs once per pixel:
+ *	overdraw --bench
+ *	GRATE_DEPTH_PREPASS=1 overdraw --bench
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "grate.h"
+#include "tgr_3d.xml.h"
+
+#define LAYERS	8
+
+static const char *vertex_shader[] = {
+	"attribute vec4 position;\n",
+	"attribute vec4 color;\n",
+	"varying vec4 vcolor;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_Position = position;\n",
+	"    vcolor = color;\n",
+	"}"
+};
+
+static const char *fragment_shader[] = {
+	"precision mediump float;\n",
+	"varying vec4 vcolor;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    vec4 c = vcolor;\n",
+	"\n",
+	"    c = c * c * 0.5 + vcolor * 0.5;\n",
+	"    c = c * c * 0.5 + vcolor * 0.5;\n",
+	"    c = c * c * 0.5 + vcolor * 0.5;\n",
+	"    c = c * c * 0.5 + vcolor * 0.5;\n",
+	"    c = c * c * 0.5 + vcolor * 0.5;\n",
+	"    c = c * c * 0.5 + vcolor * 0.5;\n",
+	"    c = c * c * 0.5 + vcolor * 0.5;\n",
+	"    c = c * c * 0.5 + vcolor * 0.5;\n",
+	"    gl_FragColor = c;\n",
+	"}"
+};
+
+static const char *depth_fragment_shader[] = {
+	"precision mediump float;\n",
+	"\n",
+	"void main()\n",
+	"{\n",
+	"    gl_FragColor = vec4(0.0);\n",
+	"}"
+};
+
+static const char *shader_linker =
+	"LINK fp20, fp20, fp20, fp20, tram0.yxzw, export1"
+;
+
+static float vertices[LAYERS * 4 * 4];
+static float colors[LAYERS * 4 * 4];
+static unsigned short indices[LAYERS * 6];
+
+static void setup_layers(void)
+{
+	static const float corners[4][2] = {
+		{ -1.0f, -1.0f }, { 1.0f, -1.0f },
+		{  1.0f,  1.0f }, { -1.0f, 1.0f },
+	};
+	unsigned int i, k;
+
+	for (i = 0; i < LAYERS; i++) {
+		/* back to front */
+		float z = 0.9f - 1.8f * i / (LAYERS - 1);
+
+		for (k = 0; k < 4; k++) {
+			float *v = &vertices[(i * 4 + k) * 4];
+			float *c = &colors[(i * 4 + k) * 4];
+
+			v[0] = corners[k][0];
+			v[1] = corners[k][1];
+			v[2] = z;
+			v[3] = 1.0f;
+
+			c[0] = (float)(i & 1);
+			c[1] = (float)((i >> 1) & 1);
+			c[2] = (float)((i >> 2) & 1);
+			c[3] = 1.0f;
+		}
+
+		indices[i * 6 + 0] = i * 4 + 0;
+		indices[i * 6 + 1] = i * 4 + 1;
+		indices[i * 6 + 2] = i * 4 + 2;
+		indices[i * 6 + 3] = i * 4 + 0;
+		indices[i * 6 + 4] = i * 4 + 2;
+		indices[i * 6 + 5] = i * 4 + 3;
+	}
+}
+
+static struct grate_program *create_program(struct grate *grate,
+					    const char **fs_source,
+					    unsigned int fs_lines)
+{
+	struct grate_shader *vs, *fs, *linker;
+	struct grate_program *program;
+
+	vs = grate_shader_new(grate, GRATE_SHADER_VERTEX, vertex_shader,
+			      ARRAY_SIZE(vertex_shader));
+	fs = grate_shader_new(grate, GRATE_SHADER_FRAGMENT, fs_source,
+			      fs_lines);
+	linker = grate_shader_parse_linker_asm(shader_linker);
+
+	program = grate_program_new(grate, vs, fs, linker);
+	if (!program) {
+		fprintf(stderr, "grate_program_new() failed\n");
+		return NULL;
+	}
+
+	grate_program_link(program);
+
+	return program;
+}
+
+int main(int argc, char *argv[])
+{
+	struct grate_program *program, *depth_program;
+	struct grate_framebuffer *fb;
+	struct grate_options options;
+	struct grate_profile *profile;
+	struct grate_texture *depth_buffer;
+	struct grate *grate;
+	struct grate_3d_ctx *ctx;
+	struct host1x_pixelbuffer *pixbuf;
+	struct host1x_bo *bo, *indices_bo;
+	const char *env;
+	bool prepass;
+	int location;
+
+	if (!grate_parse_command_line(&options, argc, argv))
+		return 1;
+
+	env = getenv("GRATE_DEPTH_PREPASS");
+	prepass = env && atoi(env);
+
+	grate = grate_init(&options);
+	if (!grate)
+		return 1;
+
+	fb = grate_framebuffer_create(grate, options.width, options.height,
+				      PIX_BUF_FMT_RGBA8888,
+				      PIX_BUF_LAYOUT_TILED_16x16,
+				      GRATE_DOUBLE_BUFFERED);
+	if (!fb)
+		return 1;
+
+	grate_clear_color(grate, 0.0f, 0.0f, 0.0f, 1.0f);
+	grate_bind_framebuffer(grate, fb);
+
+	/* Prepare shaders, both programs share the vertex program */
+
+	program = create_program(grate, fragment_shader,
+				 ARRAY_SIZE(fragment_shader));
+	if (!program)
+		return 1;
+
+	depth_program = create_program(grate, depth_fragment_shader,
+				       ARRAY_SIZE(depth_fragment_shader));
+	if (!depth_program)
+		return 1;
+
+	/* Setup context */
+
+	ctx = grate_3d_alloc_ctx(grate);
+
+	grate_3d_ctx_bind_program(ctx, program);
+	grate_3d_ctx_set_depth_range(ctx, 0.0f, 1.0f);
+	grate_3d_ctx_set_dither(ctx, 0x779);
+	grate_3d_ctx_set_point_params(ctx, 0x1401);
+	grate_3d_ctx_set_point_size(ctx, 1.0f);
+	grate_3d_ctx_set_line_params(ctx, 0x2);
+	grate_3d_ctx_set_line_width(ctx, 1.0f);
+	grate_3d_ctx_set_viewport_bias(ctx, 0.0f, 0.0f, 0.5f);
+	grate_3d_ctx_set_viewport_scale(ctx, options.width, options.height, 0.5f);
+	grate_3d_ctx_use_guardband(ctx, true);
+	grate_3d_ctx_set_front_direction_is_cw(ctx, false);
+	grate_3d_ctx_set_cull_face(ctx, GRATE_3D_CTX_CULL_FACE_NONE);
+	grate_3d_ctx_set_scissor(ctx, 0, options.width, 0, options.height);
+	grate_3d_ctx_set_point_coord_range(ctx, 0.0f, 1.0f, 0.0f, 1.0f);
+	grate_3d_ctx_set_polygon_offset(ctx, 0.0f, 0.0f);
+	grate_3d_ctx_set_provoking_vtx_last(ctx, true);
+	grate_3d_ctx_set_depth_test_mode(ctx, GRATE_3D_CTX_DEPTH_TEST_EARLY);
+
+	/* Setup depth buffer */
+
+	depth_buffer = grate_create_texture(grate,
+					    options.width, options.height,
+					    PIX_BUF_FMT_D16_LINEAR,
+					    PIX_BUF_LAYOUT_TILED_16x16);
+
+	pixbuf = grate_texture_pixbuf(depth_buffer);
+
+	grate_3d_ctx_bind_depth_buffer(ctx, pixbuf);
+	grate_3d_ctx_perform_depth_test(ctx, true);
+	grate_3d_ctx_perform_depth_write(ctx, true);
+	grate_3d_ctx_set_depth_func(ctx, GRATE_3D_CTX_DEPTH_FUNC_LESS);
+
+	setup_layers();
+
+	/* Setup vertices attribute */
+
+	location = grate_get_attribute_location(program, "position");
+	bo = grate_create_attrib_bo_from_data(grate, vertices);
+	grate_3d_ctx_vertex_attrib_float_pointer(ctx, location, 4, bo);
+	grate_3d_ctx_enable_vertex_attrib_array(ctx, location);
+
+	/* Setup colors attribute */
+
+	location = grate_get_attribute_location(program, "color");
+	bo = grate_create_attrib_bo_from_data(grate, colors);
+	grate_3d_ctx_vertex_attrib_float_pointer(ctx, location, 4, bo);
+	grate_3d_ctx_enable_vertex_attrib_array(ctx, location);
+
+	grate_3d_ctx_enable_render_target(ctx, 1);
+
+	/* Create indices BO */
+
+	indices_bo = grate_create_attrib_bo_from_data(grate, indices);
+
+	profile = grate_profile_start(grate);
+
+	while (true) {
+		grate_clear(grate);
+		grate_texture_clear(grate, depth_buffer, 0xFFFFFFFF);
+
+		/* Setup render target */
+		pixbuf = grate_get_draw_pixbuf(fb);
+		grate_3d_ctx_bind_render_target(ctx, 1, pixbuf);
+
+		if (prepass) {
+			grate_3d_ctx_begin_depth_prepass(ctx, depth_program);
+			grate_3d_draw_elements(ctx,
+					       TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+					       indices_bo,
+					       TGR3D_INDEX_MODE_UINT16,
+					       ARRAY_SIZE(indices));
+			grate_3d_ctx_begin_shading_pass(ctx);
+		}
+
+		grate_3d_draw_elements(ctx, TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+				       indices_bo, TGR3D_INDEX_MODE_UINT16,
+				       ARRAY_SIZE(indices));
+
+		if (prepass)
+			grate_3d_ctx_end_depth_prepass(ctx);
+
+		grate_flush(grate);
+		grate_swap_buffers(grate);
+
+		if (grate_key_pressed(grate))
+			break;
+
+		grate_profile_sample(profile);
+	}
+
+	grate_profile_finish(profile);
+	grate_profile_free(profile);
+
+	grate_exit(grate);
+	return 0;
+}
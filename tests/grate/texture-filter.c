@@ -68,6 +68,7 @@ static struct grate_options options;
 static struct grate *grate;
 static struct grate_3d_ctx *ctx;
 static struct grate_font *font;
+static struct grate_text_batch *labels;
 static struct grate_program *quad_program;
 static struct grate_texture *tex[3];
 static struct host1x_bo *idx_bo;
@@ -76,6 +77,8 @@ static float font_scale;
 static float elapsed;
 static int active_tex;
 static int location;
+static int lod_bias_loc;
+static int mvp_loc;
 static int max_lod;
 
 static void test1_lod_bias(enum grate_textute_filter min_filter,
@@ -87,30 +90,29 @@ static void test1_lod_bias(enum grate_textute_filter min_filter,
 	mat4_translate(&transform, 0.0f, 0.0f, -1.0f);
 	mat4_multiply(&mvp, &projection, &transform);
 
-	location = grate_get_vertex_uniform_location(quad_program, "mvp");
-	grate_3d_ctx_set_vertex_mat4_uniform(ctx, location, &mvp);
+	grate_3d_ctx_set_vertex_mat4_uniform(ctx, mvp_loc, &mvp);
 
 	grate_texture_set_min_filter(tex[active_tex], min_filter);
 	grate_texture_set_mag_filter(tex[active_tex], mag_filter);
 	grate_texture_set_max_lod(tex[active_tex], max_lod);
 	grate_3d_ctx_bind_texture(ctx, 0, tex[active_tex]);
 
-	location = grate_get_fragment_uniform_location(quad_program, "lod_bias");
-	grate_3d_ctx_set_fragment_float_uniform(ctx, location, bias);
+	grate_3d_ctx_set_fragment_float_uniform(ctx, lod_bias_loc, bias);
 
 	grate_3d_draw_elements(ctx, TGR3D_PRIMITIVE_TYPE_TRIANGLES,
 			       idx_bo, TGR3D_INDEX_MODE_UINT16,
 			       ARRAY_SIZE(indices));
 	grate_flush(grate);
 
-	grate_3d_printf(grate, ctx, font, 1, -0.85f, 0.85f, font_scale,
-			"LOD BIAS: %f\nMAX LOD: %d\nMIN: %s\nMAG: %s\nMIPMAP: %s\n"
-			"Texture id: %d",
-			bias, max_lod,
-			texfilter[min_filter], texfilter[mag_filter],
-			mipdesc[active_tex], active_tex);
+	grate_text_batch_printf(labels, font, -0.85f, 0.85f, font_scale,
+				"LOD BIAS: %f\nMAX LOD: %d\nMIN: %s\nMAG: %s\n"
+				"MIPMAP: %s\nTexture id: %d",
+				bias, max_lod,
+				texfilter[min_filter], texfilter[mag_filter],
+				mipdesc[active_tex], active_tex);
 
-	grate_3d_printf(grate, ctx, font, 1, 0.55f, 0.85f, font_scale, "Test #1");
+	grate_text_batch_printf(labels, font, 0.55f, 0.85f, font_scale,
+				"Test #1");
 }
 
 static void test2_scale(enum grate_textute_filter min_filter,
@@ -124,30 +126,29 @@ static void test2_scale(enum grate_textute_filter min_filter,
 	mat4_multiply(&modelview, &transform, &scale);
 	mat4_multiply(&mvp, &projection, &modelview);
 
-	location = grate_get_vertex_uniform_location(quad_program, "mvp");
-	grate_3d_ctx_set_vertex_mat4_uniform(ctx, location, &mvp);
+	grate_3d_ctx_set_vertex_mat4_uniform(ctx, mvp_loc, &mvp);
 
 	grate_texture_set_min_filter(tex[active_tex], min_filter);
 	grate_texture_set_mag_filter(tex[active_tex], mag_filter);
 	grate_texture_set_max_lod(tex[active_tex], max_lod);
 	grate_3d_ctx_bind_texture(ctx, 0, tex[active_tex]);
 
-	location = grate_get_fragment_uniform_location(quad_program, "lod_bias");
-	grate_3d_ctx_set_fragment_float_uniform(ctx, location, 0.0f);
+	grate_3d_ctx_set_fragment_float_uniform(ctx, lod_bias_loc, 0.0f);
 
 	grate_3d_draw_elements(ctx, TGR3D_PRIMITIVE_TYPE_TRIANGLES,
 			       idx_bo, TGR3D_INDEX_MODE_UINT16,
 			       ARRAY_SIZE(indices));
 	grate_flush(grate);
 
-	grate_3d_printf(grate, ctx, font, 1, -0.85f, 0.85f, font_scale,
-			"LOD BIAS: 0\nMAX LOD: %d\nMIN: %s\nMAG: %s\nMIPMAP: %s\n"
-			"Texture id: %d",
-			max_lod, texfilter[min_filter], texfilter[mag_filter],
-			mipdesc[active_tex], active_tex);
+	grate_text_batch_printf(labels, font, -0.85f, 0.85f, font_scale,
+				"LOD BIAS: 0\nMAX LOD: %d\nMIN: %s\nMAG: %s\n"
+				"MIPMAP: %s\nTexture id: %d",
+				max_lod, texfilter[min_filter],
+				texfilter[mag_filter],
+				mipdesc[active_tex], active_tex);
 
-	grate_3d_printf(grate, ctx, font, 1, 0.55f, 0.85f, font_scale,
-			"Test #2");
+	grate_text_batch_printf(labels, font, 0.55f, 0.85f, font_scale,
+				"Test #2");
 }
 
 static void test3_mag(enum grate_textute_filter min_filter,
@@ -161,30 +162,29 @@ static void test3_mag(enum grate_textute_filter min_filter,
 	mat4_multiply(&modelview, &transform, &scale);
 	mat4_multiply(&mvp, &projection, &modelview);
 
-	location = grate_get_vertex_uniform_location(quad_program, "mvp");
-	grate_3d_ctx_set_vertex_mat4_uniform(ctx, location, &mvp);
+	grate_3d_ctx_set_vertex_mat4_uniform(ctx, mvp_loc, &mvp);
 
 	grate_texture_set_min_filter(tex[active_tex], min_filter);
 	grate_texture_set_mag_filter(tex[active_tex], mag_filter);
 	grate_texture_set_max_lod(tex[active_tex], max_lod);
 	grate_3d_ctx_bind_texture(ctx, 0, tex[active_tex]);
 
-	location = grate_get_fragment_uniform_location(quad_program, "lod_bias");
-	grate_3d_ctx_set_fragment_float_uniform(ctx, location, 0.0f);
+	grate_3d_ctx_set_fragment_float_uniform(ctx, lod_bias_loc, 0.0f);
 
 	grate_3d_draw_elements(ctx, TGR3D_PRIMITIVE_TYPE_TRIANGLES,
 			       idx_bo, TGR3D_INDEX_MODE_UINT16,
 			       ARRAY_SIZE(indices));
 	grate_flush(grate);
 
-	grate_3d_printf(grate, ctx, font, 1, -0.85f, 0.85f, font_scale,
-			"LOD BIAS: 0\nMAX LOD: %d\nMIN: %s\nMAG: %s\nMIPMAP: %s\n"
-			"Texture id: %d",
-			max_lod, texfilter[min_filter], texfilter[mag_filter],
-			mipdesc[active_tex], active_tex);
+	grate_text_batch_printf(labels, font, -0.85f, 0.85f, font_scale,
+				"LOD BIAS: 0\nMAX LOD: %d\nMIN: %s\nMAG: %s\n"
+				"MIPMAP: %s\nTexture id: %d",
+				max_lod, texfilter[min_filter],
+				texfilter[mag_filter],
+				mipdesc[active_tex], active_tex);
 
-	grate_3d_printf(grate, ctx, font, 1, 0.55f, 0.85f, font_scale,
-			"Test #3");
+	grate_text_batch_printf(labels, font, 0.55f, 0.85f, font_scale,
+				"Test #3");
 }
 
 static void test4_max_lod(enum grate_textute_filter min_filter,
@@ -196,31 +196,29 @@ static void test4_max_lod(enum grate_textute_filter min_filter,
 	mat4_translate(&transform, 0.0f, 0.0f, -1.0f);
 	mat4_multiply(&mvp, &projection, &transform);
 
-	location = grate_get_vertex_uniform_location(quad_program, "mvp");
-	grate_3d_ctx_set_vertex_mat4_uniform(ctx, location, &mvp);
+	grate_3d_ctx_set_vertex_mat4_uniform(ctx, mvp_loc, &mvp);
 
 	grate_texture_set_min_filter(tex[active_tex], min_filter);
 	grate_texture_set_mag_filter(tex[active_tex], mag_filter);
 	grate_texture_set_max_lod(tex[active_tex], max_lod);
 	grate_3d_ctx_bind_texture(ctx, 0, tex[active_tex]);
 
-	location = grate_get_fragment_uniform_location(quad_program, "lod_bias");
-	grate_3d_ctx_set_fragment_float_uniform(ctx, location, bias);
+	grate_3d_ctx_set_fragment_float_uniform(ctx, lod_bias_loc, bias);
 
 	grate_3d_draw_elements(ctx, TGR3D_PRIMITIVE_TYPE_TRIANGLES,
 			       idx_bo, TGR3D_INDEX_MODE_UINT16,
 			       ARRAY_SIZE(indices));
 	grate_flush(grate);
 
-	grate_3d_printf(grate, ctx, font, 1, -0.85f, 0.85f, font_scale,
-			"LOD BIAS: %f\nMAX LOD: %d\nMIN: %s\nMAG: %s\nMIPMAP: %s\n"
-			"Texture id: %d",
-			bias, max_lod,
-			texfilter[min_filter], texfilter[mag_filter],
-			mipdesc[active_tex], active_tex);
+	grate_text_batch_printf(labels, font, -0.85f, 0.85f, font_scale,
+				"LOD BIAS: %f\nMAX LOD: %d\nMIN: %s\nMAG: %s\n"
+				"MIPMAP: %s\nTexture id: %d",
+				bias, max_lod,
+				texfilter[min_filter], texfilter[mag_filter],
+				mipdesc[active_tex], active_tex);
 
-	grate_3d_printf(grate, ctx, font, 1, 0.55f, 0.85f, font_scale,
-			"Test #4");
+	grate_text_batch_printf(labels, font, 0.55f, 0.85f, font_scale,
+				"Test #4");
 }
 
 int main(int argc, char *argv[])
@@ -285,6 +283,10 @@ int main(int argc, char *argv[])
 
 	grate_program_link(quad_program);
 
+	mvp_loc = grate_get_vertex_uniform_location(quad_program, "mvp");
+	lod_bias_loc = grate_get_fragment_uniform_location(quad_program,
+							   "lod_bias");
+
 	/* Load font */
 
 	font = grate_create_font(grate, "data/font.png", "data/font.fnt");
@@ -293,6 +295,12 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	labels = grate_text_batch_create(grate);
+	if (!labels) {
+		fprintf(stderr, "grate_text_batch_create() failed\n");
+		return 1;
+	}
+
 	font_scale = options.width / 700.0f;
 
 	/* Setup context */
@@ -452,6 +460,7 @@ int main(int argc, char *argv[])
 			break;
 		}
 
+		grate_text_batch_flush(labels, ctx, 1);
 		grate_swap_buffers(grate);
 
 		if (grate_key_pressed(grate))
@@ -465,6 +474,7 @@ int main(int argc, char *argv[])
 	grate_profile_finish(profile);
 	grate_profile_free(profile);
 
+	grate_text_batch_free(labels);
 	grate_exit(grate);
 	return 0;
 }
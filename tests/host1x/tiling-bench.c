@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) GRATE-DRIVER project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host1x.h"
+
+#define BENCH_WIDTH	1920
+#define BENCH_HEIGHT	1088
+#define BENCH_LOOPS	50
+
+static const struct {
+	const char *name;
+	enum pixel_format format;
+} formats[] = {
+	{ "A8",       PIX_BUF_FMT_A8 },
+	{ "RGB565",   PIX_BUF_FMT_RGB565 },
+	{ "RGBA8888", PIX_BUF_FMT_RGBA8888 },
+	{ "DXT1",     PIX_BUF_FMT_DXT1 },
+	{ "DXT5",     PIX_BUF_FMT_DXT5 },
+};
+
+static double time_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, k;
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		enum pixel_format format = formats[i].format;
+		unsigned tw = PIX_BUF_FORMAT_TEXEL_WIDTH(format);
+		unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(format);
+		unsigned pitch = BENCH_WIDTH / tw * PIX_BUF_FORMAT_BYTES(format);
+		unsigned lines = BENCH_HEIGHT / th;
+		size_t size = (size_t)pitch * lines;
+		double start, tile, detile;
+		uint8_t *linear, *tiled;
+
+		linear = malloc(size);
+		tiled = malloc(size);
+		if (!linear || !tiled) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+
+		for (k = 0; k < size; k++)
+			linear[k] = k * 7;
+
+		start = time_sec();
+		for (k = 0; k < BENCH_LOOPS; k++)
+			host1x_tile_16x16(tiled, pitch, linear, pitch,
+					  BENCH_WIDTH, BENCH_HEIGHT, format);
+		tile = time_sec() - start;
+
+		memset(linear, 0, size);
+
+		start = time_sec();
+		for (k = 0; k < BENCH_LOOPS; k++)
+			host1x_detile_16x16(linear, pitch, tiled, pitch,
+					    BENCH_WIDTH, BENCH_HEIGHT, format);
+		detile = time_sec() - start;
+
+		for (k = 0; k < size; k++) {
+			if (linear[k] != (uint8_t)(k * 7)) {
+				fprintf(stderr, "%s: mismatch at %u\n",
+					formats[i].name, k);
+				return 1;
+			}
+		}
+
+		printf("%-10s tile: %6.2f GB/s  detile: %6.2f GB/s\n",
+		       formats[i].name,
+		       size * BENCH_LOOPS / tile / 1e9,
+		       size * BENCH_LOOPS / detile / 1e9);
+
+		free(tiled);
+		free(linear);
+	}
+
+	return 0;
+}
@@ -43,9 +43,12 @@ struct vs_asm_test {
 	char *vs_path;
 	char *fs_path;
 	char *linker_path;
+	char *save_path;
 	uint32_t expected_result;
 	bool has_expected;
 	bool test_only;
+	unsigned optimize;
+	bool stats;
 
 	struct vs_uniform vs_uniforms[256];
 	unsigned vs_uniforms_nb;
@@ -89,11 +92,14 @@ static int parse_command_line(struct vs_asm_test *test, int argc, char *argv[])
 			{"testonly",	no_argument, NULL, 0},
 			{"vs_uniform",	required_argument, NULL, 0},
 			{"fs_uniform",	required_argument, NULL, 0},
+			{"save",	required_argument, NULL, 0},
+			{"optimize",	no_argument, NULL, 0},
+			{"stats",	no_argument, NULL, 0},
 			{ /* Sentinel */ }
 		};
 		int option_index = 0;
 
-		c = getopt_long(argc, argv, "h", long_options, &option_index);
+		c = getopt_long(argc, argv, "hO:", long_options, &option_index);
 
 		switch (c) {
 		case 0:
@@ -143,10 +149,26 @@ static int parse_command_line(struct vs_asm_test *test, int argc, char *argv[])
 				}
 				test->fs_uniforms_nb++;
 				break;
+			case 7:
+				test->save_path = optarg;
+				break;
+			case 8:
+				test->optimize = 2;
+				break;
+			case 9:
+				test->stats = true;
+				break;
 			default:
 				return 0;
 			}
 			break;
+		case 'O':
+			if (sscanf(optarg, "%u", &test->optimize) != 1 ||
+			    test->optimize > 2) {
+				fprintf(stderr, "invalid optimization level\n");
+				return 0;
+			}
+			break;
 		case -1:
 			break;
 		default:
@@ -158,6 +180,10 @@ static int parse_command_line(struct vs_asm_test *test, int argc, char *argv[])
 			fprintf(stderr, "\t--lnk path : linker asm path\n");
 			fprintf(stderr, "\t--expected 0x00000000 : perform the test\n");
 			fprintf(stderr, "\t--testonly : don't show the rendered result\n");
+			fprintf(stderr, "\t--save path : write the program binary\n");
+			fprintf(stderr, "\t-O0, -O1, -O2 : optimization level\n");
+			fprintf(stderr, "\t--optimize : same as -O2\n");
+			fprintf(stderr, "\t--stats : print static estimates and exit\n");
 			fprintf(stderr, "\t-h : this help\n");
 			return 0;
 		}
@@ -166,18 +192,20 @@ static int parse_command_line(struct vs_asm_test *test, int argc, char *argv[])
 	return 1;
 }
 
-static void dump_raw(struct grate_shader *vs,
-		     struct grate_shader *fs,
-		     struct grate_shader *linker,
-		     struct grate_program *program)
+static void dump_raw(struct grate_program *program)
 {
+	struct grate_3d_consts *consts = program->vs_constants;
+	struct grate_shader *linker = program->linker;
+	struct grate_shader *vs = program->vs;
+	struct grate_shader *fs = program->fs;
 	unsigned i;
 
 	fprintf(stderr, "\nVertex constants raw:\n");
 
-	for (i = 0; i < 256 * 4; i++)
+	/* only the range used by the program is stored */
+	for (i = 0; consts && i < (consts->end - consts->start) * 4; i++)
 		fprintf(stderr, "\t[%d] = 0x%08X,\n",
-			i, program->vs_constants[i]);
+			consts->start * 4 + i, consts->values[i]);
 
 	fprintf(stderr, "\nFragment constants raw:\n");
 
@@ -201,18 +229,122 @@ static void dump_raw(struct grate_shader *vs,
 		fprintf(stderr, "\t[%d] = 0x%08X,\n", i, linker->words[i]);
 }
 
-static void dump_asm(struct grate_shader *vs,
-		     struct grate_shader *fs,
-		     struct grate_shader *linker)
+static void dump_asm(struct grate_program *program)
 {
 	fprintf(stderr, "\nVertex disassembly:\n%s\n",
-		grate_shader_disasm_vs(vs) ?: "");
+		grate_shader_disasm_vs(program->vs) ?: "");
 
 	fprintf(stderr, "\nFragment disassembly:\n%s\n",
-		grate_shader_disasm_fs(fs) ?: "");
+		grate_shader_disasm_fs(program->fs) ?: "");
 
 	fprintf(stderr, "\nLinker disassembly:\n%s\n",
-		grate_shader_disasm_linker(linker) ?: "");
+		grate_shader_disasm_linker(program->linker) ?: "");
+}
+
+static unsigned percent(unsigned value, unsigned total)
+{
+	return total ? value * 100 / total : 0;
+}
+
+static void dump_stats(struct grate_program *program)
+{
+	struct grate_program_stats stats;
+
+	grate_program_get_stats(program, &stats);
+
+	printf("Vertex program:\n");
+	printf("\tinstructions: %u\n", stats.vs_instructions);
+	printf("\testimated cycles per vertex: %u\n", stats.vs_cycles);
+	printf("\tissue slots used: %u vector, %u scalar (%u%%)\n",
+	       stats.vs_vector_ops, stats.vs_scalar_ops,
+	       percent(stats.vs_vector_ops + stats.vs_scalar_ops,
+		       stats.vs_instructions * 2));
+	printf("\tmax live temporaries: %u\n",
+	       stats.vs_max_live_temporaries);
+	printf("\ttexture fetches: %u\n", stats.vs_texture_fetches);
+	printf("\tcritical path: %u instructions\n", stats.vs_critical_path);
+
+	printf("Fragment program:\n");
+	printf("\tinstructions: %u (%u MFU, %u ALU)\n",
+	       stats.fs_instructions, stats.fs_mfu_instructions,
+	       stats.fs_alu_instructions);
+	printf("\testimated cycles per fragment: %u\n", stats.fs_cycles);
+	printf("\tALU slots used: %u (%u%%)\n", stats.fs_alu_ops,
+	       percent(stats.fs_alu_ops, stats.fs_alu_instructions * 4));
+	printf("\tregisters: %u\n", stats.fs_registers);
+	printf("\ttexture fetches: %u\n", stats.fs_texture_fetches);
+	printf("\tcritical path: %u instructions\n", stats.fs_critical_path);
+
+	printf("Linker:\n");
+	printf("\tinstructions: %u\n", stats.linker_instructions);
+	printf("\tTRAM rows: %u\n", stats.tram_rows);
+}
+
+static void dump_savings(unsigned level,
+			 const struct grate_program_stats *before,
+			 const struct grate_program_stats *after)
+{
+	fprintf(stderr, "\nOptimization -O%u:\n", level);
+	fprintf(stderr, "\tvertex: %u -> %u instructions, %d saved\n",
+		before->vs_instructions, after->vs_instructions,
+		before->vs_instructions - after->vs_instructions);
+	fprintf(stderr, "\tfragment: %u -> %u instructions, %d saved\n",
+		before->fs_instructions, after->fs_instructions,
+		before->fs_instructions - after->fs_instructions);
+	fprintf(stderr, "\tfragment ALU: %u -> %u instructions, %d saved\n",
+		before->fs_alu_instructions, after->fs_alu_instructions,
+		before->fs_alu_instructions - after->fs_alu_instructions);
+	fprintf(stderr, "\tlinker: %u -> %u instructions, %d saved\n",
+		before->linker_instructions, after->linker_instructions,
+		before->linker_instructions - after->linker_instructions);
+	fprintf(stderr, "\tTRAM rows: %u -> %u\n",
+		before->tram_rows, after->tram_rows);
+}
+
+static struct grate_program *create_program(struct grate *grate,
+					    struct vs_asm_test *test)
+{
+	struct grate_shader *vs, *fs, *linker;
+	struct grate_program *program;
+
+	vs = grate_shader_parse_vertex_asm_from_file(test->vs_path);
+	if (!vs) {
+		fprintf(stderr, "%s assembler parse failed\n",
+			test->vs_path);
+		return NULL;
+	}
+
+	fs = grate_shader_parse_fragment_asm_from_file(test->fs_path);
+	if (!fs) {
+		fprintf(stderr, "%s assembler parse failed\n",
+			test->fs_path);
+		return NULL;
+	}
+
+	linker = grate_shader_parse_linker_asm_from_file(test->linker_path);
+	if (!linker) {
+		fprintf(stderr, "%s assembler parse failed\n",
+			test->linker_path);
+		return NULL;
+	}
+
+	program = grate_program_new(grate, vs, fs, linker);
+	if (!program)
+		return NULL;
+
+	if (test->optimize) {
+		struct grate_program_stats before, after;
+
+		grate_program_get_stats(program, &before);
+
+		if (grate_program_optimize(program, test->optimize) < 0)
+			fprintf(stderr, "program optimization failed\n");
+
+		grate_program_get_stats(program, &after);
+		dump_savings(test->optimize, &before, &after);
+	}
+
+	return program;
 }
 
 int main(int argc, char *argv[])
@@ -220,7 +352,6 @@ int main(int argc, char *argv[])
 	struct vs_asm_test test;
 	struct grate_program *program;
 	struct grate_framebuffer *fb;
-	struct grate_shader *vs, *fs, *linker;
 	struct grate_options options;
 	struct grate *grate;
 	struct grate_3d_ctx *ctx;
@@ -241,6 +372,20 @@ int main(int argc, char *argv[])
 	if (!grate_parse_command_line(&options, argc, argv))
 		return 1;
 
+	/* the estimates don't need the hardware */
+	if (test.stats) {
+		program = create_program(NULL, &test);
+		if (!program)
+			return 1;
+
+		if (test.optimize)
+			dump_asm(program);
+
+		dump_stats(program);
+
+		return 0;
+	}
+
 	grate = grate_init(&options);
 	if (!grate)
 		return 1;
@@ -261,29 +406,14 @@ int main(int argc, char *argv[])
 
 	/* Prepare shaders */
 
-	vs = grate_shader_parse_vertex_asm_from_file(test.vs_path);
-	if (!vs) {
-		fprintf(stderr, "%s assembler parse failed\n",
-			test.vs_path);
+	program = create_program(grate, &test);
+	if (!program)
 		return 1;
-	}
 
-	fs = grate_shader_parse_fragment_asm_from_file(test.fs_path);
-	if (!fs) {
-		fprintf(stderr, "%s assembler parse failed\n",
-			test.fs_path);
-		return 1;
-	}
+	grate_program_link(program);
 
-	linker = grate_shader_parse_linker_asm_from_file(test.linker_path);
-	if (!linker) {
-		fprintf(stderr, "%s assembler parse failed\n",
-			test.linker_path);
+	if (test.save_path && grate_program_save(program, test.save_path) < 0)
 		return 1;
-	}
-
-	program = grate_program_new(grate, vs, fs, linker);
-	grate_program_link(program);
 
 	/* Setup context */
 
@@ -331,8 +461,8 @@ int main(int argc, char *argv[])
 	bo = grate_create_attrib_bo_from_data(grate, indices);
 
 	if (!test.test_only) {
-		dump_raw(vs, fs, linker, program);
-		dump_asm(vs, fs, linker);
+		dump_raw(program);
+		dump_asm(program);
 	}
 
 	/* Setup uniforms */
@@ -370,7 +500,7 @@ int main(int argc, char *argv[])
 				fb_data[i], fb_data[i + 1],
 				fb_data[i + 2], fb_data[i + 3]);
 
-		dump_asm(vs, fs, linker);
+		dump_asm(program);
 
 		fprintf(stderr, "\ntest %s; %s; %s; failed: expected 0x%08X, got 0x%08X\n",
 			test.vs_path,
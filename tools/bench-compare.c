@@ -0,0 +1,255 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compares results of tests/bench/grate-bench against a baseline. Every
+ * side is given as one or more result files of repeated runs:
+ *
+ *   bench-compare [-t percent] baseline.json... -- current.json...
+ *
+ * For each metric the means of both sides are compared with Welch's
+ * t-test, a change is reported as significant if the 95% confidence
+ * interval of the difference excludes zero and as a regression if,
+ * additionally, the change is worse than the threshold. Sides with a
+ * single run have no variance estimate, for them only the threshold is
+ * applied. Exits with 1 if any metric regressed.
+ */
+
+#define MAX_METRICS	256
+#define MAX_RUNS	64
+#define MAX_NAME	64
+
+struct metric {
+	char name[MAX_NAME];
+	char param[MAX_NAME];
+	char unit[16];
+	double values[2][MAX_RUNS];
+	unsigned int count[2];
+};
+
+static struct metric metrics[MAX_METRICS];
+static unsigned int num_metrics;
+
+/* two-sided 95% quantiles of Student's t distribution */
+static const double t_quantiles[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+	2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101,
+	2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052,
+	2.048, 2.045, 2.042,
+};
+
+static double t_quantile(double df)
+{
+	unsigned int index = df < 1.0 ? 0 : (unsigned int)df - 1;
+
+	if (index >= sizeof(t_quantiles) / sizeof(t_quantiles[0]))
+		return 1.960;
+
+	return t_quantiles[index];
+}
+
+/* latencies get worse when they grow, everything else when it drops */
+static bool lower_is_better(const struct metric *metric)
+{
+	return !strcmp(metric->unit, "us") || !strcmp(metric->unit, "ms");
+}
+
+static struct metric *find_metric(const char *name, const char *param,
+				  const char *unit)
+{
+	struct metric *metric;
+	unsigned int i;
+
+	for (i = 0; i < num_metrics; i++) {
+		metric = &metrics[i];
+
+		if (!strcmp(metric->name, name) &&
+		    !strcmp(metric->param, param))
+			return metric;
+	}
+
+	if (num_metrics == MAX_METRICS)
+		return NULL;
+
+	metric = &metrics[num_metrics++];
+	snprintf(metric->name, sizeof(metric->name), "%s", name);
+	snprintf(metric->param, sizeof(metric->param), "%s", param);
+	snprintf(metric->unit, sizeof(metric->unit), "%s", unit);
+
+	return metric;
+}
+
+/* grate-bench writes one result object per line */
+static int load_results(const char *path, unsigned int side)
+{
+	char line[512], name[MAX_NAME], param[MAX_NAME], unit[16];
+	struct metric *metric;
+	double value;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s\n", path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, " { \"name\": \"%63[^\"]\", "
+			   "\"param\": \"%63[^\"]\", \"value\": %lf, "
+			   "\"unit\": \"%15[^\"]\" }",
+			   name, param, &value, unit) != 4)
+			continue;
+
+		metric = find_metric(name, param, unit);
+		if (!metric) {
+			fprintf(stderr, "too many metrics in %s\n", path);
+			break;
+		}
+
+		if (metric->count[side] < MAX_RUNS)
+			metric->values[side][metric->count[side]++] = value;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static void statistics(const double *values, unsigned int count,
+		       double *mean, double *variance)
+{
+	unsigned int i;
+
+	*mean = 0.0;
+	*variance = 0.0;
+
+	for (i = 0; i < count; i++)
+		*mean += values[i];
+
+	*mean /= count;
+
+	if (count < 2)
+		return;
+
+	for (i = 0; i < count; i++)
+		*variance += (values[i] - *mean) * (values[i] - *mean);
+
+	*variance /= count - 1;
+}
+
+static bool compare(const struct metric *metric, double threshold)
+{
+	unsigned int n0 = metric->count[0], n1 = metric->count[1];
+	double mean0, mean1, var0, var1, diff, change, ci = 0.0;
+	const char *verdict = "ok";
+	bool significant, worse;
+
+	statistics(metric->values[0], n0, &mean0, &var0);
+	statistics(metric->values[1], n1, &mean1, &var1);
+
+	diff = mean1 - mean0;
+	change = mean0 ? diff / mean0 * 100.0 : 0.0;
+
+	if (n0 > 1 && n1 > 1) {
+		double se0 = var0 / n0, se1 = var1 / n1;
+		double se = sqrt(se0 + se1), df;
+
+		/* Welch-Satterthwaite degrees of freedom */
+		if (se0 + se1 > 0.0)
+			df = (se0 + se1) * (se0 + se1) /
+			     (se0 * se0 / (n0 - 1) + se1 * se1 / (n1 - 1));
+		else
+			df = n0 + n1 - 2;
+
+		ci = t_quantile(df) * se;
+		significant = fabs(diff) > ci;
+	} else {
+		significant = true;
+	}
+
+	worse = lower_is_better(metric) ? change > threshold :
+					  change < -threshold;
+
+	if (significant && worse)
+		verdict = "REGRESSION";
+	else if (significant && fabs(change) > threshold)
+		verdict = "improvement";
+
+	printf("%-16s %-28s %12.3f %12.3f %-10s %+7.2f%% ", metric->name,
+	       metric->param, mean0, mean1, metric->unit, change);
+
+	if (n0 > 1 && n1 > 1)
+		printf("+-%6.2f%% ", mean0 ? ci / mean0 * 100.0 : 0.0);
+	else
+		printf("%9s ", "n/a");
+
+	printf("%s\n", verdict);
+
+	return significant && worse;
+}
+
+static void usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-t percent] baseline.json... -- "
+		"current.json...\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int side = 0, regressions = 0, i;
+	double threshold = 5.0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "+t:h")) != -1) {
+		switch (opt) {
+		case 't':
+			threshold = strtod(optarg, NULL);
+			break;
+
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	for (i = optind; i < (unsigned int)argc; i++) {
+		if (!strcmp(argv[i], "--")) {
+			side = 1;
+			continue;
+		}
+
+		if (load_results(argv[i], side) < 0)
+			return 2;
+	}
+
+	if (!side) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	printf("%-16s %-28s %12s %12s %-10s %8s %9s\n", "metric", "param",
+	       "baseline", "current", "unit", "change", "95% CI");
+
+	for (i = 0; i < num_metrics; i++) {
+		struct metric *metric = &metrics[i];
+
+		if (!metric->count[0] || !metric->count[1]) {
+			printf("%-16s %-28s missing in %s\n", metric->name,
+			       metric->param,
+			       metric->count[0] ? "current" : "baseline");
+			continue;
+		}
+
+		if (compare(metric, threshold))
+			regressions++;
+	}
+
+	if (regressions)
+		printf("%u metrics regressed\n", regressions);
+
+	return regressions ? 1 : 0;
+}
@@ -8,38 +8,237 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <sys/wait.h>
+
+#include "grate.h"
 #include "libcgc.h"
 
+#define MAX_JOBS	64
+
 struct opts {
 	enum cgc_shader_type type;
+	const char *manifest;
+	const char *cache;
+	unsigned int jobs;
 	bool help;
 };
 
 static void usage(FILE *fp, const char *program)
 {
 	fprintf(fp, "usage: %s [options] FILE\n", program);
+	fprintf(fp, "       %s --batch MANIFEST --cache DIR [--jobs N]\n",
+		program);
+	fprintf(fp, "\n");
+	fprintf(fp, "Each line of the manifest is \"vertex FILE\" or "
+		"\"fragment FILE\", the\n");
+	fprintf(fp, "shaders are compiled into the shader cache directory "
+		"(GRATE_SHADER_CACHE).\n");
+}
+
+struct batch_entry {
+	enum grate_shader_type type;
+	char path[4096];
+};
+
+static struct batch_entry *entries;
+static unsigned int num_entries;
+
+static int batch_parse(const char *manifest)
+{
+	unsigned int max_entries = 0, line = 0;
+	struct batch_entry *entry;
+	char buf[4200], type[16];
+	FILE *fp;
+
+	fp = fopen(manifest, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open `%s': %m\n", manifest);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		line++;
+
+		if (buf[0] == '#' || buf[strspn(buf, " \t\n")] == '\0')
+			continue;
+
+		if (num_entries == max_entries) {
+			max_entries = max_entries * 2 ?: 64;
+			entries = realloc(entries,
+					  max_entries * sizeof(*entries));
+			if (!entries) {
+				fprintf(stderr, "out of memory\n");
+				fclose(fp);
+				return -1;
+			}
+		}
+
+		entry = &entries[num_entries];
+
+		if (sscanf(buf, "%15s %4095s", type, entry->path) != 2) {
+			fprintf(stderr, "%s:%u: invalid entry\n", manifest,
+				line);
+			fclose(fp);
+			return -1;
+		}
+
+		if (!strcmp(type, "vertex")) {
+			entry->type = GRATE_SHADER_VERTEX;
+		} else if (!strcmp(type, "fragment")) {
+			entry->type = GRATE_SHADER_FRAGMENT;
+		} else {
+			fprintf(stderr, "%s:%u: unknown shader type `%s'\n",
+				manifest, line, type);
+			fclose(fp);
+			return -1;
+		}
+
+		num_entries++;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static int batch_compile(const struct opts *opts, const char *path,
+			 enum grate_shader_type type)
+{
+	static char code[65536];
+	size_t length;
+	FILE *fp;
+	int err;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open `%s': %m\n", path);
+		return -1;
+	}
+
+	length = fread(code, 1, sizeof(code) - 1, fp);
+	code[length] = '\0';
+	fclose(fp);
+
+	err = grate_shader_cache_compile(opts->cache, type, code);
+	if (err < 0) {
+		fprintf(stderr, "failed to compile `%s': %d\n", path, err);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the worker compiles every jobs-th entry, returns the number of failures */
+static unsigned int batch_worker(const struct opts *opts, unsigned int index)
+{
+	unsigned int i, failed = 0;
+
+	for (i = index; i < num_entries; i += opts->jobs)
+		if (batch_compile(opts, entries[i].path, entries[i].type) < 0)
+			failed++;
+
+	return failed;
+}
+
+/*
+ * The compiler isn't known to be thread-safe, hence the shaders are
+ * compiled by forked workers, each compiling its share of the manifest in
+ * a single process.
+ */
+static int batch_main(struct opts *opts)
+{
+	pid_t pids[MAX_JOBS];
+	unsigned int i, failed = 0;
+	int status;
+
+	if (!opts->cache) {
+		fprintf(stderr, "no shader cache directory given\n");
+		return 1;
+	}
+
+	if (batch_parse(opts->manifest) < 0)
+		return 1;
+
+	if (opts->jobs > num_entries)
+		opts->jobs = num_entries ?: 1;
+
+	if (opts->jobs == 1)
+		return batch_worker(opts, 0) ? 1 : 0;
+
+	for (i = 0; i < opts->jobs; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			/* the output of the compiler would only interleave */
+			if (!freopen("/dev/null", "w", stdout))
+				_exit(1);
+
+			_exit(batch_worker(opts, i) ? 1 : 0);
+		}
+
+		if (pids[i] < 0) {
+			fprintf(stderr, "failed to fork worker: %m\n");
+			failed += batch_worker(opts, i);
+		}
+	}
+
+	for (i = 0; i < opts->jobs; i++) {
+		if (pids[i] < 0)
+			continue;
+
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			failed++;
+	}
+
+	if (failed)
+		fprintf(stderr, "%u of %u shaders failed\n", failed,
+			num_entries);
+
+	return failed ? 1 : 0;
 }
 
 static int parse_command_line(struct opts *opts, int argc, char *argv[])
 {
 	static const struct option options[] = {
+		{ "batch", 1, NULL, 'b' },
+		{ "cache", 1, NULL, 'c' },
 		{ "fragment", 0, NULL, 'F' },
 		{ "help", 0, NULL, 'h' },
+		{ "jobs", 1, NULL, 'j' },
 		{ "vertex", 0, NULL, 'v' },
 		{ NULL, 0, NULL, 0 }
 	};
+	long cpus;
 	int opt;
 
 	memset(opts, 0, sizeof(*opts));
 	opts->type = CGC_SHADER_FRAGMENT;
+	opts->cache = getenv("GRATE_SHADER_CACHE");
 
-	while ((opt = getopt_long(argc, argv, "FhvV", options, NULL)) != -1) {
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	opts->jobs = cpus > 0 ? cpus : 1;
+
+	while ((opt = getopt_long(argc, argv, "b:c:Fhj:vV", options,
+				  NULL)) != -1) {
 		switch (opt) {
+		case 'b':
+			opts->manifest = optarg;
+			break;
+
+		case 'c':
+			opts->cache = optarg;
+			break;
+
 		case 'F':
 			opts->type = CGC_SHADER_FRAGMENT;
 			break;
 
+		case 'j':
+			opts->jobs = strtoul(optarg, NULL, 0);
+			break;
+
 		case 'h':
 			opts->help = true;
 			break;
@@ -54,6 +253,12 @@ static int parse_command_line(struct opts *opts, int argc, char *argv[])
 		}
 	}
 
+	if (!opts->jobs)
+		opts->jobs = 1;
+
+	if (opts->jobs > MAX_JOBS)
+		opts->jobs = MAX_JOBS;
+
 	return optind;
 }
 
@@ -80,6 +285,9 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
+	if (opts.manifest)
+		return batch_main(&opts);
+
 	if (err < argc) {
 		fp = fopen(argv[err], "r");
 		if (!fp) {
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Runtime of the programs generated by tools/rec2c. A program replays the
+ * BO loads and jobs of a record headless and straight from its code, with
+ * the BO data mapped from the file written along with it:
+ *	cc -Iinclude -Isrc/libhost1x -Itools workload.c -o workload \
+ *		src/libhost1x/.libs/libhost1x.a -ldrm -lpthread
+ *	./workload [runs [workload.bin]]
+ */
+
+#ifndef GRATE_REC2C_RUNTIME_H
+#define GRATE_REC2C_RUNTIME_H 1
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "host1x.h"
+#include "host1x-private.h"
+
+struct wl_gather {
+	uint32_t bo;
+	uint32_t offset;
+	uint32_t num_words;
+};
+
+/* patches the address of the target into the gathers of the given BO */
+struct wl_reloc {
+	uint32_t gather_bo;
+	uint32_t bo;
+	uint32_t offset;
+	uint32_t patch_offset;
+};
+
+struct wl_bo {
+	struct host1x_bo *bo;
+	uint8_t *map;
+	struct host1x_client *client;
+	uint32_t fence;
+};
+
+static struct {
+	struct host1x *host1x;
+	struct host1x_gr2d *gr2d;
+	struct host1x_gr3d *gr3d;
+	const uint8_t *data;
+	struct wl_bo bos[WL_NUM_BOS + 1];
+
+	/* jobs of one engine are in flight at a time */
+	struct host1x_client *busy_client;
+	uint32_t busy_fence;
+
+	unsigned int frames;
+	unsigned int jobs;
+} wl;
+
+static void wl_run(void);
+
+static void wl_wait(struct host1x_client *client, uint32_t fence)
+{
+	if (HOST1X_CLIENT_WAIT(client, fence, ~0u) < 0)
+		abort();
+}
+
+/* BO data mustn't be overwritten while a job still uses it */
+static void wl_bo_wait(struct wl_bo *bo)
+{
+	if (!bo->client)
+		return;
+
+	wl_wait(bo->client, bo->fence);
+	bo->client = NULL;
+}
+
+static void wl_bo_create(unsigned int index, size_t size,
+			 unsigned long flags)
+{
+	struct wl_bo *bo = &wl.bos[index];
+
+	bo->bo = HOST1X_BO_CREATE(wl.host1x, size, flags);
+	assert(bo->bo != NULL);
+
+	if (HOST1X_BO_MMAP(bo->bo, (void **)&bo->map) < 0)
+		abort();
+}
+
+static void wl_bo_free(unsigned int index)
+{
+	struct wl_bo *bo = &wl.bos[index];
+
+	wl_bo_wait(bo);
+	host1x_bo_free(bo->bo);
+	memset(bo, 0, sizeof(*bo));
+}
+
+static void wl_bo_load(unsigned int index, unsigned int page,
+		       unsigned int num_pages, uint64_t offset)
+{
+	struct wl_bo *bo = &wl.bos[index];
+
+	wl_bo_wait(bo);
+	memcpy(bo->map + page * 4096, wl.data + offset, num_pages * 4096);
+}
+
+static void wl_submit(bool gr2d, unsigned int syncpt_incrs,
+		      const struct wl_gather *gathers,
+		      unsigned int num_gathers,
+		      const struct wl_reloc *relocs,
+		      unsigned int num_relocs)
+{
+	struct host1x_client *client;
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	unsigned int i, k;
+	uint32_t fence;
+	bool *handled;
+
+	client = gr2d ? wl.gr2d->client : wl.gr3d->client;
+
+	job = HOST1X_JOB_CREATE(client->syncpts[0].id, 1);
+	if (!job)
+		abort();
+
+	/* a relocation is patched into the first gather of its BO */
+	handled = calloc(num_relocs + 1, sizeof(*handled));
+	assert(handled != NULL);
+
+	for (i = 0; i < num_gathers; i++) {
+		struct wl_bo *bo = &wl.bos[gathers[i].bo];
+
+		/* relocations are patched into the gather */
+		wl_bo_wait(bo);
+
+		pb = HOST1X_JOB_APPEND(job, bo->bo, 0);
+		if (!pb)
+			abort();
+
+		for (k = 0; k < num_relocs; k++) {
+			if (handled[k] || relocs[k].gather_bo != gathers[i].bo)
+				continue;
+
+			pb->ptr = pb->bo->ptr + relocs[k].patch_offset;
+
+			if (HOST1X_PUSHBUF_RELOCATE(pb, wl.bos[relocs[k].bo].bo,
+						    relocs[k].offset, 0))
+				abort();
+
+			handled[k] = true;
+		}
+
+		pb->offset = gathers[i].offset;
+		pb->length = gathers[i].num_words;
+	}
+
+	free(handled);
+
+	job->syncpt_incrs = syncpt_incrs;
+
+	/* jobs of the other engine aren't ordered with this one */
+	if (wl.busy_client && wl.busy_client != client)
+		wl_wait(wl.busy_client, wl.busy_fence);
+
+	if (HOST1X_CLIENT_SUBMIT(client, job) < 0)
+		abort();
+
+	host1x_job_free(job);
+
+	if (HOST1X_CLIENT_FLUSH(client, &fence) < 0)
+		abort();
+
+	wl.busy_client = client;
+	wl.busy_fence = fence;
+	wl.jobs++;
+
+	for (i = 0; i < num_gathers; i++) {
+		wl.bos[gathers[i].bo].client = client;
+		wl.bos[gathers[i].bo].fence = fence;
+	}
+
+	for (i = 0; i < num_relocs; i++) {
+		wl.bos[relocs[i].bo].client = client;
+		wl.bos[relocs[i].bo].fence = fence;
+	}
+}
+
+static void wl_frame(void)
+{
+	wl.frames++;
+}
+
+static uint64_t wl_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char *argv[])
+{
+	struct host1x_options options = {
+		.display_id = -1,
+		.fd = -1,
+	};
+	const char *path = argc > 2 ? argv[2] : WL_DATA_PATH;
+	unsigned int runs = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+	unsigned int run, i;
+	uint64_t start, time, total = 0;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	if (st.st_size) {
+		wl.data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (wl.data == MAP_FAILED) {
+			fprintf(stderr, "Failed to map %s: %s\n", path,
+				strerror(errno));
+			return 1;
+		}
+	}
+
+	wl.host1x = host1x_open(&options);
+	if (!wl.host1x) {
+		fprintf(stderr, "host1x_open() failed\n");
+		return 1;
+	}
+
+	wl.gr2d = host1x_get_gr2d(wl.host1x);
+	wl.gr3d = host1x_get_gr3d(wl.host1x);
+	if (!wl.gr2d || !wl.gr3d) {
+		fprintf(stderr, "host1x has no GR2D or GR3D\n");
+		return 1;
+	}
+
+	for (run = 0; run < runs; run++) {
+		wl.frames = 0;
+		wl.jobs = 0;
+
+		start = wl_now_us();
+		wl_run();
+
+		if (wl.busy_client)
+			wl_wait(wl.busy_client, wl.busy_fence);
+
+		time = wl_now_us() - start;
+		total += time;
+
+		/* BOs that are live at the end of the record */
+		for (i = 1; i <= WL_NUM_BOS; i++)
+			if (wl.bos[i].bo)
+				wl_bo_free(i);
+
+		wl.busy_client = NULL;
+
+		fprintf(stderr, "run %u: %u frames and %u jobs in %.3f ms, "
+			"%.2f fps\n", run, wl.frames, wl.jobs, time / 1e3,
+			time ? wl.frames * 1e6 / time : 0.0);
+	}
+
+	if (runs)
+		fprintf(stderr, "%u runs in %.3f ms, %.3f ms per run\n",
+			runs, total / 1e3, total / 1e3 / runs);
+
+	host1x_close(wl.host1x);
+
+	return 0;
+}
+
+#endif
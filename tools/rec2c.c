@@ -0,0 +1,709 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Converts a record of libwrap into a standalone C program, which issues
+ * the jobs of the record through libhost1x without parsing it. The BO data
+ * loaded by the record is decompressed into a file the program maps, see
+ * tools/rec2c-runtime.h for building and running it:
+ *	tools/rec2c [-n frames] record.bin workload.c [workload.bin]
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef ENABLE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "list.h"
+#include "record_replay.h"
+
+/* as of tegra_drm.h */
+#define DRM_TEGRA_GEM_CREATE_TILED	(1 << 0)
+#define DRM_TEGRA_GEM_CREATE_BOTTOM_UP	(1 << 1)
+
+#define REC_HASH_BITS	10
+#define REC_HASH_SIZE	(1 << REC_HASH_BITS)
+
+struct rec_bo {
+	struct list_head node;
+	unsigned int id;
+	unsigned int ctx_id;
+	unsigned int index;
+	unsigned int num_pages;
+};
+
+struct rec_job_ctx {
+	struct list_head node;
+	unsigned int id;
+	bool gr2d;
+};
+
+static struct {
+	FILE *fp;
+	unsigned int version;
+	enum record_compression compression;
+	void *payload;
+	size_t payload_size;
+	void *pages;
+	size_t pages_size;
+
+	struct list_head bos[REC_HASH_SIZE];
+	struct list_head job_ctxs[REC_HASH_SIZE];
+
+	/* data file offsets of the ring of loaded pages */
+	uint64_t store[REC_PAGE_STORE_SIZE];
+	unsigned int store_next;
+
+#ifdef ENABLE_ZSTD
+	ZSTD_DCtx *zstd_dctx;
+	ZSTD_DDict *zstd_ddict;
+#endif
+} rec;
+
+static struct {
+	FILE *code;
+	FILE *data;
+	uint64_t data_size;
+	unsigned int num_bos;
+	unsigned int num_frames;
+	unsigned int max_frames;
+	unsigned int num_funcs;
+	bool in_frame;
+} out;
+
+static struct list_head *rec_hash(struct list_head *table, unsigned int id,
+				  unsigned int ctx_id)
+{
+	uint32_t hash = id * 0x9e3779b1u ^ ctx_id * 0x85ebca6bu;
+
+	return &table[hash >> (32 - REC_HASH_BITS)];
+}
+
+static struct rec_bo *lookup_bo(unsigned int id, unsigned int ctx_id)
+{
+	struct rec_bo *bo;
+
+	list_for_each_entry(bo, rec_hash(rec.bos, id, ctx_id), node)
+		if (bo->id == id && bo->ctx_id == ctx_id)
+			return bo;
+
+	return NULL;
+}
+
+static struct rec_job_ctx *lookup_job_ctx(unsigned int id)
+{
+	struct rec_job_ctx *job_ctx;
+
+	list_for_each_entry(job_ctx, rec_hash(rec.job_ctxs, id, 0), node)
+		if (job_ctx->id == id)
+			return job_ctx;
+
+	return NULL;
+}
+
+/* size of the action data, 0 for unknown actions */
+static size_t action_data_size(uint32_t act)
+{
+	struct record_act r;
+
+	/* timestamps were added by version 6 */
+	if (rec.version < 6) {
+		if (act == REC_DISP_FRAMEBUFFER)
+			return offsetof(struct disp_framebuffer, time);
+
+		if (act == REC_JOB_SUBMIT)
+			return offsetof(struct job_submit, time);
+	}
+
+	switch (act) {
+	case REC_START:			return sizeof(r.data.header);
+	case REC_INFO:			return sizeof(r.data.record_info);
+	case REC_CTX_CREATE:		return sizeof(r.data.ctx_create);
+	case REC_CTX_DESTROY:		return sizeof(r.data.ctx_destroy);
+	case REC_BO_CREATE:		return sizeof(r.data.bo_create);
+	case REC_BO_DESTROY:		return sizeof(r.data.bo_destroy);
+	case REC_BO_LOAD_DATA:		return sizeof(r.data.bo_load);
+	case REC_BO_SET_FLAGS:		return sizeof(r.data.bo_set_flags);
+	case REC_ADD_FRAMEBUFFER:	return sizeof(r.data.add_framebuffer);
+	case REC_DEL_FRAMEBUFFER:	return sizeof(r.data.del_framebuffer);
+	case REC_DISP_FRAMEBUFFER:	return sizeof(r.data.disp_framebuffer);
+	case REC_JOB_CTX_CREATE:	return sizeof(r.data.job_ctx_create);
+	case REC_JOB_CTX_DESTROY:	return sizeof(r.data.job_ctx_destroy);
+	case REC_JOB_SUBMIT:		return sizeof(r.data.job_submit);
+	case REC_BO_LOAD_EXTENT:	return sizeof(r.data.bo_load_extent);
+	case REC_ZSTD_DICT:		return sizeof(r.data.zstd_dict);
+	case REC_KEYFRAME:		return sizeof(r.data.keyframe);
+	case REC_INDEX:			return sizeof(r.data.index);
+	case REC_INDEX_END:		return sizeof(r.data.index_end);
+	case REC_BO_LOAD_STORED:	return sizeof(r.data.bo_load_stored);
+	}
+
+	return 0;
+}
+
+/* size of the data following the action */
+static size_t action_payload_size(const struct record_act *r)
+{
+	switch (r->act) {
+	case REC_BO_LOAD_DATA:
+		return r->data.bo_load.data_size ?: 4096;
+
+	case REC_BO_LOAD_EXTENT:
+		return r->data.bo_load_extent.data_size ?:
+		       r->data.bo_load_extent.num_pages * 4096;
+
+	case REC_JOB_SUBMIT:
+		return sizeof(struct record_gather) *
+				r->data.job_submit.num_gathers +
+		       sizeof(struct record_reloc) *
+				r->data.job_submit.num_relocs;
+
+	case REC_ZSTD_DICT:
+		return r->data.zstd_dict.size;
+
+	case REC_INDEX:
+		return sizeof(struct record_index_entry) *
+				r->data.index.num_entries;
+	}
+
+	return 0;
+}
+
+static int decompress(void *dest, size_t dest_size, size_t size)
+{
+#ifdef ENABLE_ZLIB
+	uLongf out_size = dest_size;
+
+	if (rec.compression == REC_ZLIB)
+		return uncompress(dest, &out_size, rec.payload, size) == Z_OK &&
+		       out_size == dest_size ? 0 : -EINVAL;
+#endif
+
+#ifdef ENABLE_LZ4
+	if (rec.compression == REC_LZ4)
+		return LZ4_decompress_safe(rec.payload, dest, size,
+					   dest_size) >= 0 ? 0 : -EINVAL;
+#endif
+
+#ifdef ENABLE_ZSTD
+	if (rec.compression == REC_ZSTD) {
+		size_t ret;
+
+		if (!rec.zstd_dctx)
+			rec.zstd_dctx = ZSTD_createDCtx();
+
+		if (!rec.zstd_dctx)
+			return -ENOMEM;
+
+		if (rec.zstd_ddict)
+			ret = ZSTD_decompress_usingDDict(rec.zstd_dctx, dest,
+							 dest_size, rec.payload,
+							 size, rec.zstd_ddict);
+		else
+			ret = ZSTD_decompressDCtx(rec.zstd_dctx, dest,
+						  dest_size, rec.payload,
+						  size);
+
+		return ZSTD_isError(ret) ? -EINVAL : 0;
+	}
+#endif
+
+	return -ENOTSUP;
+}
+
+/* the code of every frame goes to a function of its own */
+static void begin_frame(void)
+{
+	if (out.in_frame)
+		return;
+
+	fprintf(out.code, "static void wl_frame_%u(void)\n{\n",
+		out.num_funcs++);
+	out.in_frame = true;
+}
+
+static void end_frame(void)
+{
+	if (!out.in_frame)
+		return;
+
+	fprintf(out.code, "}\n\n");
+	out.in_frame = false;
+}
+
+static int create_bo(const struct record_act *r)
+{
+	struct bo_create c = r->data.bo_create;
+	struct rec_bo *bo;
+
+	bo = calloc(1, sizeof(*bo));
+	if (!bo)
+		return -ENOMEM;
+
+	/* indices aren't reused, 0 is none */
+	bo->id = c.id;
+	bo->ctx_id = c.ctx_id;
+	bo->index = ++out.num_bos;
+	bo->num_pages = c.num_pages;
+
+	list_add_tail(&bo->node, rec_hash(rec.bos, bo->id, bo->ctx_id));
+
+	begin_frame();
+	fprintf(out.code, "\twl_bo_create(%u, %u * 4096, 0", bo->index,
+		bo->num_pages);
+
+	if (c.flags & DRM_TEGRA_GEM_CREATE_TILED)
+		fprintf(out.code, " | HOST1X_BO_CREATE_FLAG_TILED");
+
+	if (c.flags & DRM_TEGRA_GEM_CREATE_BOTTOM_UP)
+		fprintf(out.code, " | HOST1X_BO_CREATE_FLAG_BOTTOM_UP");
+
+	fprintf(out.code, ");\n");
+
+	return 0;
+}
+
+static int destroy_bo(unsigned int id, unsigned int ctx_id)
+{
+	struct rec_bo *bo = lookup_bo(id, ctx_id);
+
+	if (!bo)
+		return -EINVAL;
+
+	begin_frame();
+	fprintf(out.code, "\twl_bo_free(%u);\n", bo->index);
+
+	list_del(&bo->node);
+	free(bo);
+
+	return 0;
+}
+
+/* the pages are appended to the data file and fill the ring */
+static int load_bo(unsigned int id, unsigned int ctx_id, unsigned int page,
+		   unsigned int num_pages, size_t size)
+{
+	struct rec_bo *bo = lookup_bo(id, ctx_id);
+	size_t dest_size = num_pages * 4096;
+	unsigned int i, slot;
+	const void *data;
+	int err;
+
+	if (!bo || page + num_pages > bo->num_pages)
+		return -EINVAL;
+
+	data = rec.payload;
+
+	if (size) {
+		if (dest_size > rec.pages_size) {
+			free(rec.pages);
+
+			rec.pages = malloc(dest_size);
+			if (!rec.pages)
+				return -ENOMEM;
+
+			rec.pages_size = dest_size;
+		}
+
+		err = decompress(rec.pages, dest_size, size);
+		if (err < 0)
+			return err;
+
+		data = rec.pages;
+	}
+
+	if (fwrite(data, dest_size, 1, out.data) != 1)
+		return -EIO;
+
+	begin_frame();
+	fprintf(out.code, "\twl_bo_load(%u, %u, %u, 0x%jxull);\n",
+		bo->index, page, num_pages, (uintmax_t)out.data_size);
+
+	if (rec.version >= 7) {
+		for (i = 0; i < num_pages; i++) {
+			slot = rec.store_next++ % REC_PAGE_STORE_SIZE;
+			rec.store[slot] = out.data_size + i * 4096;
+		}
+	}
+
+	out.data_size += dest_size;
+
+	return 0;
+}
+
+static int load_bo_stored(const struct record_act *r)
+{
+	struct bo_load_stored l = r->data.bo_load_stored;
+	struct rec_bo *bo = lookup_bo(l.id, l.ctx_id);
+
+	if (!bo || l.page_id >= bo->num_pages ||
+	    l.slot >= REC_PAGE_STORE_SIZE)
+		return -EINVAL;
+
+	begin_frame();
+	fprintf(out.code, "\twl_bo_load(%u, %u, 1, 0x%jxull);\n",
+		bo->index, l.page_id, (uintmax_t)rec.store[l.slot]);
+
+	return 0;
+}
+
+static int submit_job(unsigned int job_ctx_id, unsigned int num_gathers,
+		      unsigned int num_relocs, unsigned int num_syncpt_incrs)
+{
+	const struct record_gather *gathers = rec.payload;
+	const struct record_reloc *relocs;
+	struct rec_job_ctx *job_ctx;
+	struct rec_bo *bo, *target;
+	unsigned int i;
+
+	relocs = (const void *)(gathers + num_gathers);
+
+	job_ctx = lookup_job_ctx(job_ctx_id);
+	if (!job_ctx)
+		return -EINVAL;
+
+	begin_frame();
+	fprintf(out.code, "\t{\n\t\tstatic const struct wl_gather "
+		"gathers[] = {\n");
+
+	for (i = 0; i < num_gathers; i++) {
+		bo = lookup_bo(gathers[i].id, gathers[i].ctx_id);
+		if (!bo)
+			return -EINVAL;
+
+		fprintf(out.code, "\t\t\t{ %u, 0x%x, %u },\n", bo->index,
+			gathers[i].offset, gathers[i].num_words);
+	}
+
+	fprintf(out.code, "\t\t};\n");
+
+	if (num_relocs) {
+		fprintf(out.code, "\t\tstatic const struct wl_reloc "
+			"relocs[] = {\n");
+
+		for (i = 0; i < num_relocs; i++) {
+			bo = lookup_bo(relocs[i].gather_id, relocs[i].ctx_id);
+			target = lookup_bo(relocs[i].id, relocs[i].ctx_id);
+			if (!bo || !target)
+				return -EINVAL;
+
+			fprintf(out.code, "\t\t\t{ %u, %u, 0x%x, 0x%x },\n",
+				bo->index, target->index, relocs[i].offset,
+				relocs[i].patch_offset);
+		}
+
+		fprintf(out.code, "\t\t};\n");
+	}
+
+	fprintf(out.code, "\n\t\twl_submit(%s, %u, gathers, %u, %s, %u);\n"
+		"\t}\n", job_ctx->gr2d ? "true" : "false", num_syncpt_incrs,
+		num_gathers, num_relocs ? "relocs" : "NULL", num_relocs);
+
+	return 0;
+}
+
+static int handle_action(struct record_act *r, size_t size)
+{
+	struct rec_job_ctx *job_ctx;
+
+	switch (r->act) {
+	case REC_START:
+		if (memcmp(r->data.header.magic, REC_MAGIC,
+			   strlen(REC_MAGIC)))
+			return -EINVAL;
+
+		/* the size of actions depends on the version */
+		if (r->data.header.version < 4 || r->data.header.version > 7)
+			return -ENOTSUP;
+
+		rec.version = r->data.header.version;
+		break;
+
+	case REC_INFO:
+		rec.compression = r->data.record_info.compression;
+		break;
+
+	case REC_BO_CREATE:
+		return create_bo(r);
+
+	case REC_BO_DESTROY:
+		return destroy_bo(r->data.bo_destroy.id,
+				  r->data.bo_destroy.ctx_id);
+
+	case REC_BO_LOAD_DATA:
+		return load_bo(r->data.bo_load.id, r->data.bo_load.ctx_id,
+			       r->data.bo_load.page_id, 1,
+			       r->data.bo_load.data_size);
+
+	case REC_BO_LOAD_EXTENT:
+		return load_bo(r->data.bo_load_extent.id,
+			       r->data.bo_load_extent.ctx_id,
+			       r->data.bo_load_extent.page_id,
+			       r->data.bo_load_extent.num_pages,
+			       r->data.bo_load_extent.data_size);
+
+	case REC_BO_LOAD_STORED:
+		return load_bo_stored(r);
+
+	case REC_KEYFRAME:
+		rec.store_next = 0;
+		break;
+
+	case REC_ZSTD_DICT:
+#ifdef ENABLE_ZSTD
+		rec.zstd_ddict = ZSTD_createDDict(rec.payload, size);
+		if (!rec.zstd_ddict)
+			return -EINVAL;
+#endif
+		break;
+
+	case REC_DISP_FRAMEBUFFER:
+		begin_frame();
+		fprintf(out.code, "\twl_frame();\n");
+		end_frame();
+		out.num_frames++;
+		break;
+
+	case REC_JOB_CTX_CREATE:
+		job_ctx = calloc(1, sizeof(*job_ctx));
+		if (!job_ctx)
+			return -ENOMEM;
+
+		job_ctx->id = r->data.job_ctx_create.id;
+		job_ctx->gr2d = r->data.job_ctx_create.gr2d;
+
+		list_add_tail(&job_ctx->node,
+			      rec_hash(rec.job_ctxs, job_ctx->id, 0));
+		break;
+
+	case REC_JOB_CTX_DESTROY:
+		job_ctx = lookup_job_ctx(r->data.job_ctx_destroy.id);
+		if (job_ctx) {
+			list_del(&job_ctx->node);
+			free(job_ctx);
+		}
+		break;
+
+	case REC_JOB_SUBMIT:
+		return submit_job(r->data.job_submit.job_ctx_id,
+				  r->data.job_submit.num_gathers,
+				  r->data.job_submit.num_relocs,
+				  r->data.job_submit.num_syncpt_incrs);
+
+	/* the program runs headless, framebuffers are plain BOs */
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int convert_record(FILE *fp)
+{
+	struct record_act r;
+	size_t size;
+	int err;
+
+	rec.fp = fp;
+	rec.version = 6;
+
+	for (size = 0; size < REC_HASH_SIZE; size++) {
+		INIT_LIST_HEAD(&rec.bos[size]);
+		INIT_LIST_HEAD(&rec.job_ctxs[size]);
+	}
+
+	while (fread(&r.act, sizeof(r.act), 1, fp) == 1) {
+		if (out.max_frames && out.num_frames == out.max_frames)
+			break;
+
+		size = action_data_size(r.act);
+		if (!size) {
+			fprintf(stderr, "invalid action %u\n", r.act);
+			return -EINVAL;
+		}
+
+		if (fread(&r.data, size, 1, fp) != 1)
+			return -ENODATA;
+
+		size = action_payload_size(&r);
+
+		if (size > rec.payload_size) {
+			free(rec.payload);
+
+			rec.payload = malloc(size);
+			if (!rec.payload)
+				return -ENOMEM;
+
+			rec.payload_size = size;
+		}
+
+		if (size && fread(rec.payload, size, 1, fp) != 1)
+			return -ENODATA;
+
+		err = handle_action(&r, size);
+		if (err < 0) {
+			fprintf(stderr, "failed to handle action %u: %s\n",
+				r.act, strerror(-err));
+			return err;
+		}
+	}
+
+	end_frame();
+
+	return 0;
+}
+
+/* the frame functions are written to a temporary file first */
+static int write_program(FILE *fp, const char *record, const char *data)
+{
+	char buf[4096];
+	unsigned int i;
+	size_t n;
+
+	fprintf(fp, "/* generated by tools/rec2c from %s */\n\n", record);
+	fprintf(fp, "#define WL_NUM_BOS\t%u\n", out.num_bos);
+	fprintf(fp, "#define WL_DATA_PATH\t\"%s\"\n\n", data);
+	fprintf(fp, "#include \"rec2c-runtime.h\"\n\n");
+
+	rewind(out.code);
+
+	while ((n = fread(buf, 1, sizeof(buf), out.code)) > 0)
+		if (fwrite(buf, n, 1, fp) != 1)
+			return -EIO;
+
+	fprintf(fp, "static void wl_run(void)\n{\n");
+
+	/* actions after the last frame are in a function of theirs */
+	for (i = 0; i < out.num_funcs; i++)
+		fprintf(fp, "\twl_frame_%u();\n", i);
+
+	fprintf(fp, "}\n");
+
+	return ferror(fp) ? -EIO : 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n frames] record.bin workload.c "
+		"[workload.bin]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *record, *program;
+	char *data;
+	FILE *fp, *code;
+	int opt, err;
+	size_t n;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			out.max_frames = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (argc - optind < 2 || argc - optind > 3) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	record = argv[optind];
+	program = argv[optind + 1];
+
+	if (argc - optind == 3) {
+		data = strdup(argv[optind + 2]);
+	} else {
+		/* workload.c goes with workload.bin */
+		data = malloc(strlen(program) + 5);
+		if (data) {
+			strcpy(data, program);
+			n = strlen(data);
+			if (n > 2 && !strcmp(data + n - 2, ".c"))
+				data[n - 2] = '\0';
+			strcat(data, ".bin");
+		}
+	}
+
+	if (!data)
+		return 1;
+
+	fp = fopen(record, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s: %s\n", record,
+			strerror(errno));
+		return 1;
+	}
+
+	out.data = fopen(data, "w");
+	out.code = tmpfile();
+	if (!out.data || !out.code) {
+		fprintf(stderr, "failed to create %s: %s\n", data,
+			strerror(errno));
+		return 1;
+	}
+
+	err = convert_record(fp);
+	fclose(fp);
+
+	if (err < 0)
+		return 1;
+
+	if (fclose(out.data)) {
+		fprintf(stderr, "failed to write %s\n", data);
+		return 1;
+	}
+
+	code = fopen(program, "w");
+	if (!code || write_program(code, record, data) < 0 || fclose(code)) {
+		fprintf(stderr, "failed to write %s\n", program);
+		return 1;
+	}
+
+	fprintf(stderr, "%u frames, %u BOs and %ju bytes of BO data "
+		"written to %s and %s\n", out.num_frames, out.num_bos,
+		(uintmax_t)out.data_size, program, data);
+
+	return 0;
+}
@@ -27,16 +27,54 @@
  * Make a record:
  *	LIBWRAP_RECORD_PATH=/path/record.bin LD_PRELOAD=libgrate-wrap.so /path/app
  *
+ * Train a zstd dictionary on the BO data of a record and make further
+ * records with it, the dictionary is embedded into the record:
+ *	LIBWRAP_RECORD_ZSTD_TRAIN=/path/dict LIBWRAP_RECORD_PATH=...
+ *	LIBWRAP_RECORD_ZSTD_DICT=/path/dict LIBWRAP_RECORD_PATH=...
+ *
+ * Keep only the last 300 to 600 frames in memory and write them out as a
+ * record to /path/record.bin.N on a GPU hang or on SIGUSR2:
+ *	LIBWRAP_RECORD_RING_FRAMES=300 LIBWRAP_RECORD_PATH=/path/record.bin ...
+ *
  * Replay a record:
  *	tools/replay --recfile /path/record.bin
+ *
+ * Start replaying at frame N, BO data is loaded from the last keyframe:
+ *	tools/replay --recfile /path/record.bin --frame N
+ *
+ * Replay a record N times headless and report GPU times, optionally as
+ * results for tools/bench-compare:
+ *	tools/replay --recfile /path/record.bin --bench N [--bench-json path]
+ *
+ * Replay N copies of a record, or several records, concurrently by processes
+ * of their own and report the throughput of all of them and the latencies
+ * of each:
+ *	tools/replay --recfile a.bin [--recfile b.bin] --streams N --bench N
+ *
+ * Write hashes of the displayed frames, and compare a replay against them:
+ *	tools/replay --recfile /path/record.bin --hashes /path/golden.txt
+ *	tools/replay --recfile /path/record.bin --verify /path/golden.txt
+ *
+ * Replay jobs and frames at the pace they were recorded with:
+ *	tools/replay --recfile /path/record.bin --pace
  */
 
 #define _LARGEFILE64_SOURCE
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #ifdef ENABLE_ZLIB
 #include <zlib.h>
@@ -46,6 +84,10 @@
 #include <lz4.h>
 #endif
 
+#ifdef ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
 #include <libdrm/drm_fourcc.h>
 
 #include "grate.h"
@@ -62,6 +104,8 @@ struct rep_ctx {
 struct rep_bo {
 	struct list_head node;
 	struct host1x_bo *bo;
+	struct host1x_client *client;
+	uint32_t fence;
 	unsigned int refcnt;
 	unsigned int ctx_id;
 	unsigned int id;
@@ -87,12 +131,151 @@ struct rep_job_ctx {
 	bool gr2d;
 };
 
-static LIST_HEAD(ctx_list);
-static LIST_HEAD(bo_list);
-static LIST_HEAD(fb_list);
-static LIST_HEAD(job_ctx_list);
+/* objects are looked up per reloc, hence hashed by (id, ctx_id) */
+#define REP_HASH_BITS	10
+#define REP_HASH_SIZE	(1 << REP_HASH_BITS)
+
+static struct list_head ctx_table[REP_HASH_SIZE];
+static struct list_head bo_table[REP_HASH_SIZE];
+static struct list_head fb_table[REP_HASH_SIZE];
+static struct list_head job_ctx_table[REP_HASH_SIZE];
+
+static struct list_head *rep_hash(struct list_head *table, unsigned int id,
+				  unsigned int ctx_id)
+{
+	uint32_t hash = id * 0x9e3779b1u ^ ctx_id * 0x85ebca6bu;
+
+	return &table[hash >> (32 - REP_HASH_BITS)];
+}
+
+static void init_tables(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < REP_HASH_SIZE; i++) {
+		INIT_LIST_HEAD(&ctx_table[i]);
+		INIT_LIST_HEAD(&bo_table[i]);
+		INIT_LIST_HEAD(&fb_table[i]);
+		INIT_LIST_HEAD(&job_ctx_table[i]);
+	}
+}
+
+/*
+ * The record is mapped in windows, which keeps long records replayable on
+ * 32-bit systems. Data returned by rec_data() stays valid until the next
+ * call that needs a window of its own.
+ */
+#define REC_MAP_WINDOW	(64 << 20)
+
+static struct rec_map {
+	int fd;
+	off64_t size;
+	off64_t pos;
+	off64_t base;
+	uint8_t *map;
+	size_t map_size;
+} recfile = { .fd = -1 };
+
+/*
+ * Compressed BO data is decompressed ahead of the replay by a thread with
+ * a mapping of its own, loads take the staging buffers of their action in
+ * record order.
+ */
+#define REP_READAHEAD_DEPTH	32
+
+struct rep_readahead_entry {
+	off64_t offset;
+	void *data;
+};
+
+static struct rep_readahead {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct rec_map map;
+	bool started;
+	bool done;
+	bool stop;
+
+	/* free running counters */
+	unsigned int head;
+	unsigned int tail;
+
+	struct rep_readahead_entry entries[REP_READAHEAD_DEPTH];
+} readahead = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* jobs of one engine are in flight at a time */
+static struct host1x_client *busy_client;
+static uint32_t busy_fence;
+
+/*
+ * Benchmarking: the GPU time of a job spans from its submission or from the
+ * completion of the previous job, whichever is later, until its fence is
+ * observed as reached. Completions are polled on every submission, hence
+ * the times are upper bounds.
+ */
+#define REP_BENCH_MAX_JOBS	64
+
+struct rep_stat {
+	double sum;
+	double sum2;
+	double min;
+	double max;
+	unsigned int count;
+};
+
+struct rep_bench_job {
+	struct host1x_client *client;
+	uint64_t submitted;
+	unsigned int frame;
+	uint32_t fence;
+};
+
+static struct rep_bench {
+	unsigned int runs;
+	const char *json;
+
+	struct rep_bench_job pending[REP_BENCH_MAX_JOBS];
+	unsigned int first_pending;
+	unsigned int num_pending;
+	uint64_t last_done;
+
+	/* GPU time of the jobs of a frame, summed up as they complete */
+	unsigned int gpu_frame;
+	uint64_t gpu_frame_time;
+	uint64_t frame_start;
 
-static FILE *recfile;
+	struct rep_stat job_gpu;
+	struct rep_stat frame_gpu;
+	struct rep_stat frame_time;
+	struct rep_stat run_time;
+	unsigned int jobs;
+	unsigned int frames;
+} bench;
+
+/*
+ * Pacing: recorded times are mapped to the replay clock relative to the
+ * first paced action. Actions replayed late shift the schedule instead of
+ * being followed by a burst of catching up.
+ */
+static struct rep_pace {
+	bool enabled;
+	bool started;
+	uint64_t record_base;
+	uint64_t replay_base;
+} pace;
+
+/* replay starts at the last keyframe before the frame to seek to */
+static off64_t seek_offset;
+static unsigned int seek_frame;
+static unsigned int frame_cnt;
+
+/* ring of the loaded pages of a record since version 7 */
+static uint8_t *page_store;
+static unsigned int page_store_next;
 
 static struct host1x *host1x;
 static struct host1x_display *display;
@@ -101,8 +284,14 @@ static struct host1x_gr2d *gr2d;
 static struct host1x_gr3d *gr3d;
 
 static enum record_compression compression;
+static unsigned int record_version;
 static struct rep_framebuffer *displayed_fb;
 
+#ifdef ENABLE_ZSTD
+static __thread ZSTD_DCtx *zstd_dctx;
+static ZSTD_DDict *zstd_ddict;
+#endif
+
 static const char *str_actions[] = {
 	[REC_START] = "REC_START",
 	[REC_INFO] = "REC_INFO",
@@ -118,6 +307,12 @@ static const char *str_actions[] = {
 	[REC_JOB_CTX_CREATE] = "REC_JOB_CTX_CREATE",
 	[REC_JOB_CTX_DESTROY] = "REC_JOB_CTX_DESTROY",
 	[REC_JOB_SUBMIT] = "REC_JOB_SUBMIT",
+	[REC_BO_LOAD_EXTENT] = "REC_BO_LOAD_EXTENT",
+	[REC_ZSTD_DICT] = "REC_ZSTD_DICT",
+	[REC_KEYFRAME] = "REC_KEYFRAME",
+	[REC_INDEX] = "REC_INDEX",
+	[REC_INDEX_END] = "REC_INDEX_END",
+	[REC_BO_LOAD_STORED] = "REC_BO_LOAD_STORED",
 };
 
 static void create_context(unsigned int id)
@@ -128,14 +323,14 @@ static void create_context(unsigned int id)
 	ctx->id = id;
 
 	INIT_LIST_HEAD(&ctx->node);
-	list_add_tail(&ctx->node, &ctx_list);
+	list_add_tail(&ctx->node, rep_hash(ctx_table, id, 0));
 }
 
 static struct rep_ctx *lookup_context(unsigned int id)
 {
 	struct rep_ctx *ctx;
 
-	list_for_each_entry(ctx, &ctx_list, node)
+	list_for_each_entry(ctx, rep_hash(ctx_table, id, 0), node)
 		if (ctx->id == id)
 			return ctx;
 
@@ -170,6 +365,7 @@ static void create_bo(unsigned int id, unsigned int ctx_id,
 		rbo->flags |= HOST1X_BO_CREATE_FLAG_BOTTOM_UP;
 
 	rbo->id = id;
+	rbo->ctx_id = ctx_id;
 	rbo->bo = HOST1X_BO_CREATE(host1x, size, rbo->flags);
 	assert(rbo->bo != NULL);
 
@@ -177,15 +373,15 @@ static void create_bo(unsigned int id, unsigned int ctx_id,
 	assert(rbo->map != NULL);
 
 	INIT_LIST_HEAD(&rbo->node);
-	list_add_tail(&rbo->node, &bo_list);
+	list_add_tail(&rbo->node, rep_hash(bo_table, id, ctx_id));
 }
 
 static struct rep_bo *lookup_bo(unsigned int id, unsigned int ctx_id)
 {
 	struct rep_bo *rbo;
 
-	list_for_each_entry(rbo, &bo_list, node)
-		if (rbo->id == id)
+	list_for_each_entry(rbo, rep_hash(bo_table, id, ctx_id), node)
+		if (rbo->id == id && rbo->ctx_id == ctx_id)
 			return rbo;
 
 	return NULL;
@@ -200,8 +396,219 @@ static void destroy_bo(unsigned int id, unsigned int ctx_id)
 	free(rbo);
 }
 
+static const void *rec_map_data(struct rec_map *rm, size_t size)
+{
+	const void *data;
+	off64_t end;
+
+	if (rm->pos + (off64_t)size > rm->size) {
+		errno = ENODATA;
+		return NULL;
+	}
+
+	end = rm->base + rm->map_size;
+
+	if (!rm->map || rm->pos < rm->base || rm->pos + (off64_t)size > end) {
+		if (rm->map)
+			munmap(rm->map, rm->map_size);
+
+		rm->base = rm->pos & ~(off64_t)(sysconf(_SC_PAGESIZE) - 1);
+		rm->map_size = MAX(REC_MAP_WINDOW, rm->pos - rm->base + size);
+		rm->map_size = MIN(rm->map_size, rm->size - rm->base);
+
+		rm->map = mmap64(NULL, rm->map_size, PROT_READ, MAP_PRIVATE,
+				 rm->fd, rm->base);
+		if (rm->map == MAP_FAILED) {
+			rm->map = NULL;
+			return NULL;
+		}
+
+		madvise(rm->map, rm->map_size, MADV_SEQUENTIAL);
+	}
+
+	data = rm->map + (rm->pos - rm->base);
+	rm->pos += size;
+
+	return data;
+}
+
+static int rec_map_read(struct rec_map *rm, void *dest, size_t size)
+{
+	const void *data = rec_map_data(rm, size);
+
+	if (!data)
+		return 0;
+
+	memcpy(dest, data, size);
+
+	return 1;
+}
+
+static const void *rec_data(size_t size)
+{
+	return rec_map_data(&recfile, size);
+}
+
+static int rec_read(void *dest, size_t size)
+{
+	return rec_map_read(&recfile, dest, size);
+}
+
+static int rec_open(const char *path)
+{
+	struct rec_map *rm = &recfile;
+	struct stat64 st;
+
+	rm->fd = open64(path, O_RDONLY);
+	if (rm->fd < 0)
+		return -errno;
+
+	if (fstat64(rm->fd, &st) < 0)
+		return -errno;
+
+	rm->size = st.st_size;
+
+	return 0;
+}
+
+/* looks up the keyframe to start at in the index ending the record */
+static int rec_seek_frame(unsigned int frame)
+{
+	const struct record_index_entry *entries;
+	struct record_act r;
+	unsigned int i;
+	size_t size;
+	int err = -ENOENT;
+
+	seek_frame = frame;
+
+	size = sizeof(r.act) + sizeof(r.data.index_end);
+	if (recfile.size < (off64_t)size)
+		return err;
+
+	recfile.pos = recfile.size - size;
+
+	if (!rec_read(&r, size) || r.act != REC_INDEX_END)
+		goto out;
+
+	recfile.pos = r.data.index_end.offset;
+
+	size = sizeof(r.act) + sizeof(r.data.index);
+	if (!rec_read(&r, size) || r.act != REC_INDEX)
+		goto out;
+
+	size = sizeof(*entries) * r.data.index.num_entries;
+	entries = rec_data(size);
+	if (!entries)
+		goto out;
+
+	for (i = 0; i < r.data.index.num_entries; i++) {
+		if (entries[i].type == REC_INDEX_KEYFRAME &&
+		    entries[i].frame <= frame)
+			seek_offset = entries[i].offset;
+	}
+
+	err = 0;
+out:
+	recfile.pos = 0;
+
+	return err;
+}
+
+/* size of the action data, 0 for unknown actions */
+static size_t action_data_size(uint32_t act)
+{
+	struct record_act r;
+
+	/* timestamps were added by version 6 */
+	if (record_version < 6) {
+		if (act == REC_DISP_FRAMEBUFFER)
+			return offsetof(struct disp_framebuffer, time);
+
+		if (act == REC_JOB_SUBMIT)
+			return offsetof(struct job_submit, time);
+	}
+
+	switch (act) {
+	case REC_START:			return sizeof(r.data.header);
+	case REC_INFO:			return sizeof(r.data.record_info);
+	case REC_CTX_CREATE:		return sizeof(r.data.ctx_create);
+	case REC_CTX_DESTROY:		return sizeof(r.data.ctx_destroy);
+	case REC_BO_CREATE:		return sizeof(r.data.bo_create);
+	case REC_BO_DESTROY:		return sizeof(r.data.bo_destroy);
+	case REC_BO_LOAD_DATA:		return sizeof(r.data.bo_load);
+	case REC_BO_SET_FLAGS:		return sizeof(r.data.bo_set_flags);
+	case REC_ADD_FRAMEBUFFER:	return sizeof(r.data.add_framebuffer);
+	case REC_DEL_FRAMEBUFFER:	return sizeof(r.data.del_framebuffer);
+	case REC_DISP_FRAMEBUFFER:	return sizeof(r.data.disp_framebuffer);
+	case REC_JOB_CTX_CREATE:	return sizeof(r.data.job_ctx_create);
+	case REC_JOB_CTX_DESTROY:	return sizeof(r.data.job_ctx_destroy);
+	case REC_JOB_SUBMIT:		return sizeof(r.data.job_submit);
+	case REC_BO_LOAD_EXTENT:	return sizeof(r.data.bo_load_extent);
+	case REC_ZSTD_DICT:		return sizeof(r.data.zstd_dict);
+	case REC_KEYFRAME:		return sizeof(r.data.keyframe);
+	case REC_INDEX:			return sizeof(r.data.index);
+	case REC_INDEX_END:		return sizeof(r.data.index_end);
+	case REC_BO_LOAD_STORED:	return sizeof(r.data.bo_load_stored);
+	}
+
+	return 0;
+}
+
+/* size of the data following the action */
+static size_t action_payload_size(const struct record_act *r)
+{
+	switch (r->act) {
+	case REC_BO_LOAD_DATA:
+		return r->data.bo_load.data_size ?: 4096;
+
+	case REC_BO_LOAD_EXTENT:
+		return r->data.bo_load_extent.data_size ?:
+		       r->data.bo_load_extent.num_pages * 4096;
+
+	case REC_JOB_SUBMIT:
+		return sizeof(struct record_gather) *
+				r->data.job_submit.num_gathers +
+		       sizeof(struct record_reloc) *
+				r->data.job_submit.num_relocs;
+
+	case REC_ZSTD_DICT:
+		return r->data.zstd_dict.size;
+
+	case REC_INDEX:
+		return sizeof(struct record_index_entry) *
+				r->data.index.num_entries;
+	}
+
+	return 0;
+}
+
+/* skips the data of actions that don't matter before the keyframe */
+static int skip_action(struct record_act *r)
+{
+	switch (r->act) {
+	case REC_BO_LOAD_DATA:
+	case REC_BO_LOAD_EXTENT:
+	case REC_BO_LOAD_STORED:
+	case REC_JOB_SUBMIT:
+	case REC_DISP_FRAMEBUFFER:
+		break;
+
+	default:
+		return 0;
+	}
+
+	if (!rec_read(&r->data, action_data_size(r->act)))
+		return -1;
+
+	if (r->act == REC_DISP_FRAMEBUFFER)
+		frame_cnt++;
+
+	return rec_data(action_payload_size(r)) ? 1 : -1;
+}
+
 #ifdef ENABLE_ZLIB
-static void decompress_data_zlib(void *in, void *out,
+static void decompress_data_zlib(const void *in, void *out,
 				 size_t in_size, size_t out_size)
 {
 	z_stream strm;
@@ -215,7 +622,7 @@ static void decompress_data_zlib(void *in, void *out,
 	strm.zfree = Z_NULL;
 	strm.opaque = Z_NULL;
 	strm.avail_in = in_size;
-	strm.next_in = in;
+	strm.next_in = (Bytef *)in;
 	strm.avail_out = out_size;
 	strm.next_out = buf;
 
@@ -233,7 +640,7 @@ static void decompress_data_zlib(void *in, void *out,
 #endif
 
 #ifdef ENABLE_LZ4
-static void decompress_data_lz4(void *in, void *out,
+static void decompress_data_lz4(const void *in, void *out,
 				size_t in_size, size_t out_size)
 {
 	void *buf;
@@ -249,7 +656,34 @@ static void decompress_data_lz4(void *in, void *out,
 }
 #endif
 
-static int decompress_data(void *in, void *out,
+#ifdef ENABLE_ZSTD
+static void decompress_data_zstd(const void *in, void *out,
+				 size_t in_size, size_t out_size)
+{
+	void *buf;
+	size_t ret;
+
+	/* utilizing CPU cache is way much faster than uncached DRAM */
+	buf = alloca(out_size);
+
+	if (!zstd_dctx) {
+		zstd_dctx = ZSTD_createDCtx();
+		assert(zstd_dctx != NULL);
+	}
+
+	if (zstd_ddict)
+		ret = ZSTD_decompress_usingDDict(zstd_dctx, buf, out_size,
+						 in, in_size, zstd_ddict);
+	else
+		ret = ZSTD_decompressDCtx(zstd_dctx, buf, out_size,
+					  in, in_size);
+	assert(!ZSTD_isError(ret));
+
+	memcpy(out, buf, out_size);
+}
+#endif
+
+static int decompress_data(const void *in, void *out,
 			    size_t in_size, size_t out_size)
 {
 #ifdef ENABLE_ZLIB
@@ -266,32 +700,281 @@ static int decompress_data(void *in, void *out,
 	}
 #endif
 
+#ifdef ENABLE_ZSTD
+	if (compression == REC_ZSTD) {
+		decompress_data_zstd(in, out, in_size, out_size);
+		return 1;
+	}
+#endif
+
 	return 0;
 }
 
-static int load_bo(unsigned int id, unsigned int ctx_id,
-		   unsigned int page, unsigned int size)
+static void *readahead_thread(void *arg)
+{
+	struct rep_readahead *ra = &readahead;
+	struct rep_readahead_entry *entry;
+	struct record_act r;
+	size_t size, out_size;
+	const void *data;
+	off64_t offset;
+	void *buf;
+
+	while (true) {
+		offset = ra->map.pos;
+
+		if (!rec_map_read(&ra->map, &r.act, sizeof(r.act)))
+			break;
+
+		size = action_data_size(r.act);
+		if (!size || !rec_map_read(&ra->map, &r.data, size))
+			break;
+
+		size = action_payload_size(&r);
+		data = rec_map_data(&ra->map, size);
+		if (!data)
+			break;
+
+		/* uncompressed data is copied straight from the mapping */
+		if (r.act == REC_BO_LOAD_DATA && r.data.bo_load.data_size)
+			out_size = 4096;
+		else if (r.act == REC_BO_LOAD_EXTENT &&
+			 r.data.bo_load_extent.data_size)
+			out_size = r.data.bo_load_extent.num_pages * 4096;
+		else
+			continue;
+
+		buf = malloc(out_size);
+		assert(buf != NULL);
+
+		if (!decompress_data(data, buf, size, out_size)) {
+			free(buf);
+			continue;
+		}
+
+		pthread_mutex_lock(&ra->lock);
+
+		while (ra->tail - ra->head == REP_READAHEAD_DEPTH && !ra->stop)
+			pthread_cond_wait(&ra->cond, &ra->lock);
+
+		if (ra->stop) {
+			pthread_mutex_unlock(&ra->lock);
+			free(buf);
+			break;
+		}
+
+		entry = &ra->entries[ra->tail++ % REP_READAHEAD_DEPTH];
+		entry->offset = offset;
+		entry->data = buf;
+
+		pthread_cond_broadcast(&ra->cond);
+		pthread_mutex_unlock(&ra->lock);
+	}
+
+	pthread_mutex_lock(&ra->lock);
+	ra->done = true;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+
+	return NULL;
+}
+
+static void readahead_start(off64_t offset)
+{
+	struct rep_readahead *ra = &readahead;
+
+	ra->map.fd = recfile.fd;
+	ra->map.size = recfile.size;
+	ra->map.pos = offset;
+
+	if (pthread_create(&ra->thread, NULL, readahead_thread, NULL)) {
+		fprintf(stderr, "Failed to create read-ahead thread\n");
+		return;
+	}
+
+	ra->started = true;
+}
+
+static void readahead_stop(void)
+{
+	struct rep_readahead *ra = &readahead;
+
+	if (!ra->started)
+		return;
+
+	pthread_mutex_lock(&ra->lock);
+	ra->stop = true;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+
+	pthread_join(ra->thread, NULL);
+
+	for (; ra->head != ra->tail; ra->head++)
+		free(ra->entries[ra->head % REP_READAHEAD_DEPTH].data);
+
+	if (ra->map.map)
+		munmap(ra->map.map, ra->map.map_size);
+
+	ra->map.map = NULL;
+	ra->map.base = 0;
+	ra->head = 0;
+	ra->tail = 0;
+	ra->started = false;
+	ra->done = false;
+	ra->stop = false;
+}
+
+/* returns the decompressed data of the action at the offset, if any */
+static void *readahead_take(off64_t offset)
+{
+	struct rep_readahead *ra = &readahead;
+	struct rep_readahead_entry *entry;
+	void *data = NULL;
+
+	if (!ra->started)
+		return NULL;
+
+	pthread_mutex_lock(&ra->lock);
+
+	while (true) {
+		entry = &ra->entries[ra->head % REP_READAHEAD_DEPTH];
+
+		if (ra->head != ra->tail && entry->offset < offset) {
+			free(entry->data);
+			ra->head++;
+			pthread_cond_broadcast(&ra->cond);
+			continue;
+		}
+
+		if (ra->head != ra->tail || ra->done)
+			break;
+
+		pthread_cond_wait(&ra->cond, &ra->lock);
+	}
+
+	if (ra->head != ra->tail && entry->offset == offset) {
+		data = entry->data;
+		ra->head++;
+		pthread_cond_broadcast(&ra->cond);
+	}
+
+	pthread_mutex_unlock(&ra->lock);
+
+	return data;
+}
+
+/* BO data mustn't be overwritten while a job still uses it */
+static void wait_bo(struct rep_bo *rbo)
+{
+	int ret;
+
+	if (!rbo->client)
+		return;
+
+	ret = HOST1X_CLIENT_WAIT(rbo->client, rbo->fence, ~0u);
+	if (ret < 0)
+		abort();
+
+	rbo->client = NULL;
+}
+
+/* the fallback of decompressing in place reads the pages back from the BO */
+static void store_pages(const uint8_t *data, unsigned int num_pages)
+{
+	unsigned int slot;
+
+	if (record_version < 7)
+		return;
+
+	if (!page_store) {
+		page_store = malloc(REC_PAGE_STORE_SIZE * 4096);
+		assert(page_store != NULL);
+	}
+
+	for (; num_pages; num_pages--, data += 4096) {
+		slot = page_store_next++ % REC_PAGE_STORE_SIZE;
+		memcpy(page_store + slot * 4096, data, 4096);
+	}
+}
+
+static int load_bo_stored(unsigned int id, unsigned int ctx_id,
+			  unsigned int page, unsigned int slot)
+{
+	struct rep_bo *rbo = lookup_bo(id, ctx_id);
+
+	assert(rbo != NULL);
+
+	if (!page_store || slot >= REC_PAGE_STORE_SIZE)
+		return 0;
+
+	wait_bo(rbo);
+
+	memcpy(rbo->map + page * 4096, page_store + slot * 4096, 4096);
+
+	return 1;
+}
+
+static int load_bo_extent(off64_t offset, unsigned int id,
+			  unsigned int ctx_id, unsigned int page,
+			  unsigned int num_pages, unsigned int size)
 {
 	struct rep_bo *rbo = lookup_bo(id, ctx_id);
-	uint8_t compressed[size];
+	size_t out_size = num_pages * 4096;
+	const void *data;
+	void *staging;
 	void *dest;
-	int ret;
+	int ret = 1;
 
 	assert(rbo != NULL);
 
 	dest = rbo->map + page * 4096;
 
-	if (size) {
-		ret = fread(compressed, size, 1, recfile);
-		if (ret == 1)
-			ret = decompress_data(compressed, dest, size, 4096);
+	data = rec_data(size ?: out_size);
+	if (!data)
+		return 0;
+
+	staging = size ? readahead_take(offset) : NULL;
+
+	wait_bo(rbo);
+
+	if (staging) {
+		memcpy(dest, staging, out_size);
+		store_pages(staging, num_pages);
+		free(staging);
+	} else if (size) {
+		ret = decompress_data(data, dest, size, out_size);
+		store_pages(dest, num_pages);
 	} else {
-		ret = fread(dest, 4096, 1, recfile);
+		memcpy(dest, data, out_size);
+		store_pages(data, num_pages);
 	}
 
 	return ret;
 }
 
+static int load_bo(off64_t offset, unsigned int id, unsigned int ctx_id,
+		   unsigned int page, unsigned int size)
+{
+	return load_bo_extent(offset, id, ctx_id, page, 1, size);
+}
+
+static int load_zstd_dict(unsigned int size)
+{
+	const void *dict = rec_data(size);
+
+	if (!dict)
+		return 0;
+
+#ifdef ENABLE_ZSTD
+	zstd_ddict = ZSTD_createDDict(dict, size);
+	if (zstd_ddict)
+		return 1;
+#endif
+
+	/* extents can't be decompressed without zstd */
+	return 0;
+}
+
 static void set_bo_flags(unsigned int id, unsigned int ctx_id, uint32_t flags)
 {
 	struct rep_bo *rbo = lookup_bo(id, ctx_id);
@@ -354,7 +1037,7 @@ static void create_framebuffer(unsigned int bo_id, unsigned int ctx_id,
 	if (rbo->flags & HOST1X_BO_CREATE_FLAG_TILED)
 		pb->layout = PIX_BUF_LAYOUT_TILED_16x16;
 
-	if (host1x->framebuffer_init) {
+	if (host1x->framebuffer_init && !bench.runs) {
 		err = host1x->framebuffer_init(host1x, hfb);
 		if (err != 0) {
 			fprintf(stderr, "FB init failed %d (%s), can't continue\n",
@@ -372,85 +1055,672 @@ static void create_framebuffer(unsigned int bo_id, unsigned int ctx_id,
 	rfb->pitch = pitch;
 	rfb->reflect_y = !!(rbo->flags & HOST1X_BO_CREATE_FLAG_BOTTOM_UP);
 
-	INIT_LIST_HEAD(&rfb->node);
-	list_add_tail(&rfb->node, &fb_list);
+	INIT_LIST_HEAD(&rfb->node);
+	list_add_tail(&rfb->node, rep_hash(fb_table, bo_id, ctx_id));
+}
+
+static struct rep_framebuffer *lookup_framebuffer(unsigned int bo_id,
+						  unsigned int ctx_id)
+{
+	struct rep_framebuffer *rfb;
+
+	list_for_each_entry(rfb, rep_hash(fb_table, bo_id, ctx_id), node)
+		if (rfb->bo_id == bo_id && rfb->ctx_id == ctx_id)
+			return rfb;
+
+	return NULL;
+}
+
+static void destroy_framebuffer(unsigned int bo_id, unsigned int ctx_id)
+{
+	struct rep_framebuffer *rfb = lookup_framebuffer(bo_id, ctx_id);
+	assert(rfb != NULL);
+
+	list_del(&rfb->node);
+	free(rfb->hfb->pixbuf);
+	free(rfb->hfb);
+	free(rfb);
+
+	if (displayed_fb == rfb)
+		displayed_fb = NULL;
+}
+
+/*
+ * Verification: hashes of the displayed frames, one "frame hash" line per
+ * frame, are written out or compared with the golden ones.
+ */
+struct rep_golden_hash {
+	unsigned int frame;
+	uint64_t hash;
+};
+
+static struct rep_verify {
+	FILE *out;
+	struct rep_golden_hash *golden;
+	unsigned int num_golden;
+	unsigned int next_golden;
+	unsigned int checked;
+	unsigned int mismatches;
+} verify;
+
+static int verify_load(const char *path)
+{
+	unsigned long long hash;
+	unsigned int frame, max = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+
+	while (fscanf(fp, "%u %llx", &frame, &hash) == 2) {
+		if (verify.num_golden == max) {
+			max = max * 2 ?: 256;
+			verify.golden = realloc(verify.golden,
+						max * sizeof(*verify.golden));
+			assert(verify.golden != NULL);
+		}
+
+		verify.golden[verify.num_golden].frame = frame;
+		verify.golden[verify.num_golden].hash = hash;
+		verify.num_golden++;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static void verify_frame(struct rep_framebuffer *rfb)
+{
+	const struct rep_golden_hash *golden;
+	uint64_t hash;
+
+	if (!verify.out && !verify.golden)
+		return;
+
+	if (host1x_pixelbuffer_hash(rfb->hfb->pixbuf, &hash) < 0) {
+		fprintf(stderr, "Failed to hash frame %u\n", frame_cnt);
+		verify.mismatches++;
+		return;
+	}
+
+	if (verify.out)
+		fprintf(verify.out, "%u %016jx\n", frame_cnt, (uintmax_t)hash);
+
+	/* frames are displayed in the order of the golden hashes */
+	while (verify.next_golden < verify.num_golden &&
+	       verify.golden[verify.next_golden].frame < frame_cnt)
+		verify.next_golden++;
+
+	if (verify.next_golden == verify.num_golden)
+		return;
+
+	golden = &verify.golden[verify.next_golden];
+	if (golden->frame != frame_cnt)
+		return;
+
+	verify.checked++;
+
+	if (golden->hash != hash) {
+		fprintf(stderr, "frame %u: hash %016jx, expected %016jx\n",
+			frame_cnt, (uintmax_t)hash, (uintmax_t)golden->hash);
+		verify.mismatches++;
+	}
+}
+
+static void display_framebuffer(unsigned int bo_id, unsigned int ctx_id)
+{
+	struct rep_framebuffer *rfb = lookup_framebuffer(bo_id, ctx_id);
+	assert(rfb != NULL);
+	int err;
+
+	printf("    displaying fb bo_id: %u\n", rfb->bo_id);
+
+	wait_bo(lookup_bo(rfb->bo_id, rfb->ctx_id));
+	verify_frame(rfb);
+
+	if (displayed_fb == rfb)
+		return;
+
+	err = host1x_overlay_set(overlay, rfb->hfb, 0, 0,
+				 rfb->width, rfb->height, false,
+				 rfb->reflect_y);
+	assert(err == 0);
+
+	displayed_fb = rfb;
+}
+
+static void create_job_context(unsigned int id, bool gr2d)
+{
+	struct rep_job_ctx *job_ctx = calloc(1, sizeof(*job_ctx));
+	assert(job_ctx != NULL);
+
+	job_ctx->id = id;
+	job_ctx->gr2d = gr2d;
+
+	INIT_LIST_HEAD(&job_ctx->node);
+	list_add_tail(&job_ctx->node, rep_hash(job_ctx_table, id, 0));
+}
+
+static struct rep_job_ctx *lookup_job_context(unsigned int id)
+{
+	struct rep_job_ctx *job_ctx;
+
+	list_for_each_entry(job_ctx, rep_hash(job_ctx_table, id, 0), node)
+		if (job_ctx->id == id)
+			return job_ctx;
+
+	return NULL;
+}
+
+static void destroy_job_context(unsigned int id)
+{
+	struct rep_job_ctx *job_ctx = lookup_job_context(id);
+	assert(job_ctx != NULL);
+
+	list_del(&job_ctx->node);
+	free(job_ctx);
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void stat_add(struct rep_stat *stat, double value)
+{
+	if (!stat->count || value < stat->min)
+		stat->min = value;
+
+	if (!stat->count || value > stat->max)
+		stat->max = value;
+
+	stat->sum += value;
+	stat->sum2 += value * value;
+	stat->count++;
+}
+
+static double stat_mean(const struct rep_stat *stat)
+{
+	return stat->count ? stat->sum / stat->count : 0.0;
+}
+
+static double stat_stddev(const struct rep_stat *stat)
+{
+	double mean = stat_mean(stat), var;
+
+	if (stat->count < 2)
+		return 0.0;
+
+	var = (stat->sum2 - stat->sum * mean) / (stat->count - 1);
+
+	return var > 0.0 ? sqrt(var) : 0.0;
+}
+
+static void bench_flush_frame(void)
+{
+	if (bench.gpu_frame_time)
+		stat_add(&bench.frame_gpu, bench.gpu_frame_time);
+
+	bench.gpu_frame_time = 0;
+}
+
+static void bench_retire(bool wait)
+{
+	struct rep_bench_job *job;
+	uint64_t done, start;
+	int ret;
+
+	while (bench.num_pending) {
+		job = &bench.pending[bench.first_pending];
+
+		if (wait)
+			ret = HOST1X_CLIENT_WAIT(job->client, job->fence, ~0u);
+		else
+			ret = host1x_client_poll(job->client, job->fence);
+
+		if (ret < 0)
+			abort();
+
+		if (!wait && !ret)
+			break;
+
+		done = now_us();
+		start = MAX(job->submitted, bench.last_done);
+		bench.last_done = done;
+
+		stat_add(&bench.job_gpu, done - start);
+
+		if (job->frame != bench.gpu_frame) {
+			bench_flush_frame();
+			bench.gpu_frame = job->frame;
+		}
+
+		bench.gpu_frame_time += done - start;
+
+		bench.first_pending = (bench.first_pending + 1) % REP_BENCH_MAX_JOBS;
+		bench.num_pending--;
+	}
+}
+
+static void bench_job_submitted(struct host1x_client *client,
+				uint32_t fence)
+{
+	struct rep_bench_job *job;
+	unsigned int index;
+
+	bench_retire(false);
+
+	if (bench.num_pending == REP_BENCH_MAX_JOBS)
+		bench_retire(true);
+
+	index = (bench.first_pending + bench.num_pending++) % REP_BENCH_MAX_JOBS;
+	job = &bench.pending[index];
+	job->client = client;
+	job->submitted = now_us();
+	job->frame = frame_cnt;
+	job->fence = fence;
+
+	bench.jobs++;
+}
+
+static void pace_action(uint64_t time)
+{
+	uint64_t now = now_us(), target;
+
+	if (!pace.enabled || !time)
+		return;
+
+	target = pace.replay_base + time - pace.record_base;
+
+	if (!pace.started || time < pace.record_base || target <= now) {
+		pace.record_base = time;
+		pace.replay_base = now;
+		pace.started = true;
+		return;
+	}
+
+	usleep(target - now);
+}
+
+static void bench_frame(void)
+{
+	uint64_t now = now_us();
+
+	if (bench.frame_start)
+		stat_add(&bench.frame_time, now - bench.frame_start);
+
+	bench.frame_start = now;
+	bench.frames++;
+}
+
+static void bench_run_finished(uint64_t start)
+{
+	bench_retire(true);
+	bench_flush_frame();
+
+	stat_add(&bench.run_time, now_us() - start);
+
+	bench.frame_start = 0;
+	bench.last_done = 0;
+}
+
+static void bench_result(FILE *fp, unsigned int *num, const char *name,
+			 double value, const char *unit)
+{
+	fprintf(fp, "%s\n    { \"name\": \"replay\", \"param\": \"%s\", "
+		"\"value\": %.3f, \"unit\": \"%s\" }",
+		(*num)++ ? "," : "", name, value, unit);
+}
+
+static void bench_report(void)
+{
+	double time = bench.run_time.sum / 1e6;
+	unsigned int num = 0;
+	FILE *fp;
+
+	fprintf(stderr, "%u runs, %u frames and %u jobs in %.3f seconds: "
+		"%.2f fps, %.1f jobs/s\n", bench.runs, bench.frames,
+		bench.jobs, time, bench.frames / time, bench.jobs / time);
+	fprintf(stderr, "run:       mean %10.1f us, stddev %10.1f us, "
+		"min %10.1f us, max %10.1f us\n", stat_mean(&bench.run_time),
+		stat_stddev(&bench.run_time), bench.run_time.min,
+		bench.run_time.max);
+	fprintf(stderr, "frame:     mean %10.1f us, stddev %10.1f us, "
+		"min %10.1f us, max %10.1f us\n",
+		stat_mean(&bench.frame_time), stat_stddev(&bench.frame_time),
+		bench.frame_time.min, bench.frame_time.max);
+	fprintf(stderr, "frame gpu: mean %10.1f us, stddev %10.1f us, "
+		"min %10.1f us, max %10.1f us\n",
+		stat_mean(&bench.frame_gpu), stat_stddev(&bench.frame_gpu),
+		bench.frame_gpu.min, bench.frame_gpu.max);
+	fprintf(stderr, "job gpu:   mean %10.1f us, stddev %10.1f us, "
+		"min %10.1f us, max %10.1f us\n",
+		stat_mean(&bench.job_gpu), stat_stddev(&bench.job_gpu),
+		bench.job_gpu.min, bench.job_gpu.max);
+
+	if (!bench.json)
+		return;
+
+	fp = fopen(bench.json, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", bench.json,
+			strerror(errno));
+		return;
+	}
+
+	/* in the format of tests/bench/grate-bench */
+	fprintf(fp, "{\n  \"results\": [");
+	bench_result(fp, &num, "fps", bench.frames / time, "fps");
+	bench_result(fp, &num, "jobs", bench.jobs / time, "jobs/s");
+	bench_result(fp, &num, "run", stat_mean(&bench.run_time), "us");
+	bench_result(fp, &num, "run stddev", stat_stddev(&bench.run_time),
+		     "us");
+	bench_result(fp, &num, "frame", stat_mean(&bench.frame_time), "us");
+	bench_result(fp, &num, "frame gpu", stat_mean(&bench.frame_gpu),
+		     "us");
+	bench_result(fp, &num, "job gpu", stat_mean(&bench.job_gpu), "us");
+	fprintf(fp, "\n  ]\n}\n");
+
+	fclose(fp);
+}
+
+/*
+ * Stress replay: every stream is replayed by a process of its own, which
+ * has host1x channels of its own. The processes start replaying at once
+ * and send their benchmark results to the parent.
+ */
+#define REP_MAX_STREAMS	16
+
+struct rep_stream_result {
+	unsigned int frames;
+	unsigned int jobs;
+	struct rep_stat frame_time;
+	struct rep_stat frame_gpu;
+	struct rep_stat job_gpu;
+};
+
+static struct rep_streams {
+	unsigned int count;
+	const char *paths[REP_MAX_STREAMS];
+	unsigned int num_paths;
+
+	/* pipes of the process of a stream to the parent */
+	int result_fd;
+	int start_fd;
+} streams = {
+	.result_fd = -1,
+	.start_fd = -1,
+};
+
+static void stat_merge(struct rep_stat *stat, const struct rep_stat *other)
+{
+	if (!other->count)
+		return;
+
+	if (!stat->count || other->min < stat->min)
+		stat->min = other->min;
+
+	if (!stat->count || other->max > stat->max)
+		stat->max = other->max;
+
+	stat->sum += other->sum;
+	stat->sum2 += other->sum2;
+	stat->count += other->count;
+}
+
+static bool read_full(int fd, void *buf, size_t size)
+{
+	ssize_t ret;
+
+	while (size) {
+		ret = read(fd, buf, size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return false;
+
+		buf = (char *)buf + ret;
+		size -= ret;
+	}
+
+	return true;
+}
+
+/* the process of a stream is ready to replay once the record is open */
+static void stream_wait_start(void)
+{
+	char c = 0;
+
+	if (streams.result_fd < 0)
+		return;
+
+	if (write(streams.result_fd, &c, 1) != 1 ||
+	    !read_full(streams.start_fd, &c, 1))
+		exit(1);
+}
+
+static void stream_send_result(void)
+{
+	struct rep_stream_result result = {
+		.frames = bench.frames,
+		.jobs = bench.jobs,
+		.frame_time = bench.frame_time,
+		.frame_gpu = bench.frame_gpu,
+		.job_gpu = bench.job_gpu,
+	};
+
+	if (write(streams.result_fd, &result, sizeof(result)) !=
+	    sizeof(result))
+		fprintf(stderr, "Failed to send results: %s\n",
+			strerror(errno));
+}
+
+static void streams_report(const struct rep_stream_result *results,
+			   const bool *ok, double time)
+{
+	struct rep_stream_result all = {};
+	const struct rep_stream_result *res;
+	unsigned int i, num = 0;
+	char name[32];
+	FILE *fp;
+
+	for (i = 0; i < streams.count; i++) {
+		res = &results[i];
+
+		if (!ok[i]) {
+			fprintf(stderr, "stream %2u: failed\n", i);
+			continue;
+		}
+
+		fprintf(stderr, "stream %2u: %8.2f fps, frame mean %10.1f us, "
+			"max %10.1f us, job gpu mean %10.1f us, "
+			"max %10.1f us, %s\n", i, res->frames / time,
+			stat_mean(&res->frame_time), res->frame_time.max,
+			stat_mean(&res->job_gpu), res->job_gpu.max,
+			streams.paths[i % streams.num_paths]);
+
+		all.frames += res->frames;
+		all.jobs += res->jobs;
+		stat_merge(&all.frame_time, &res->frame_time);
+		stat_merge(&all.frame_gpu, &res->frame_gpu);
+		stat_merge(&all.job_gpu, &res->job_gpu);
+	}
+
+	fprintf(stderr, "%u streams, %u frames and %u jobs in %.3f seconds: "
+		"%.2f fps, %.1f jobs/s\n", streams.count, all.frames,
+		all.jobs, time, all.frames / time, all.jobs / time);
+	fprintf(stderr, "frame:     mean %10.1f us, stddev %10.1f us, "
+		"min %10.1f us, max %10.1f us\n",
+		stat_mean(&all.frame_time), stat_stddev(&all.frame_time),
+		all.frame_time.min, all.frame_time.max);
+	fprintf(stderr, "frame gpu: mean %10.1f us, stddev %10.1f us, "
+		"min %10.1f us, max %10.1f us\n",
+		stat_mean(&all.frame_gpu), stat_stddev(&all.frame_gpu),
+		all.frame_gpu.min, all.frame_gpu.max);
+	fprintf(stderr, "job gpu:   mean %10.1f us, stddev %10.1f us, "
+		"min %10.1f us, max %10.1f us\n",
+		stat_mean(&all.job_gpu), stat_stddev(&all.job_gpu),
+		all.job_gpu.min, all.job_gpu.max);
+
+	if (!bench.json)
+		return;
+
+	fp = fopen(bench.json, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", bench.json,
+			strerror(errno));
+		return;
+	}
+
+	fprintf(fp, "{\n  \"results\": [");
+	bench_result(fp, &num, "fps", all.frames / time, "fps");
+	bench_result(fp, &num, "jobs", all.jobs / time, "jobs/s");
+	bench_result(fp, &num, "frame", stat_mean(&all.frame_time), "us");
+	bench_result(fp, &num, "frame max", all.frame_time.max, "us");
+	bench_result(fp, &num, "frame gpu", stat_mean(&all.frame_gpu),
+		     "us");
+	bench_result(fp, &num, "job gpu", stat_mean(&all.job_gpu), "us");
+
+	for (i = 0; i < streams.count; i++) {
+		snprintf(name, sizeof(name), "stream %u frame", i);
+		bench_result(fp, &num, name,
+			     stat_mean(&results[i].frame_time), "us");
+	}
+
+	fprintf(fp, "\n  ]\n}\n");
+
+	fclose(fp);
 }
 
-static struct rep_framebuffer *lookup_framebuffer(unsigned int bo_id,
-						  unsigned int ctx_id)
+/*
+ * Returns in the process of a stream with the path of its record, the
+ * parent waits for the streams to finish and exits.
+ */
+static void streams_start(char **path)
 {
-	struct rep_framebuffer *rfb;
+	struct rep_stream_result results[REP_MAX_STREAMS] = {};
+	int result_fds[REP_MAX_STREAMS], start_fds[2], fds[2];
+	pid_t pids[REP_MAX_STREAMS];
+	bool ok[REP_MAX_STREAMS];
+	int status, err = 0;
+	unsigned int i, k;
+	uint64_t start;
+	char c = 0;
 
-	list_for_each_entry(rfb, &fb_list, node)
-		if (rfb->bo_id == bo_id && rfb->ctx_id == ctx_id)
-			return rfb;
+	if (pipe(start_fds) < 0)
+		abort();
 
-	return NULL;
-}
+	for (i = 0; i < streams.count; i++) {
+		if (pipe(fds) < 0)
+			abort();
 
-static void destroy_framebuffer(unsigned int bo_id, unsigned int ctx_id)
-{
-	struct rep_framebuffer *rfb = lookup_framebuffer(bo_id, ctx_id);
-	assert(rfb != NULL);
+		pids[i] = fork();
+		if (pids[i] < 0)
+			abort();
 
-	list_del(&rfb->node);
-	free(rfb->hfb->pixbuf);
-	free(rfb->hfb);
-	free(rfb);
+		if (!pids[i]) {
+			for (k = 0; k < i; k++)
+				close(result_fds[k]);
 
-	if (displayed_fb == rfb)
-		displayed_fb = NULL;
-}
+			close(fds[0]);
+			close(start_fds[1]);
 
-static void display_framebuffer(unsigned int bo_id, unsigned int ctx_id)
-{
-	struct rep_framebuffer *rfb = lookup_framebuffer(bo_id, ctx_id);
-	assert(rfb != NULL);
-	int err;
+			streams.result_fd = fds[1];
+			streams.start_fd = start_fds[0];
+			*path = (char *)streams.paths[i % streams.num_paths];
+			return;
+		}
 
-	printf("    displaying fb bo_id: %u\n", rfb->bo_id);
+		close(fds[1]);
+		result_fds[i] = fds[0];
+	}
 
-	if (displayed_fb == rfb)
-		return;
+	close(start_fds[0]);
 
-	err = host1x_overlay_set(overlay, rfb->hfb, 0, 0,
-				 rfb->width, rfb->height, false,
-				 rfb->reflect_y);
-	assert(err == 0);
+	for (i = 0; i < streams.count; i++)
+		ok[i] = read_full(result_fds[i], &c, 1);
 
-	displayed_fb = rfb;
-}
+	start = now_us();
 
-static void create_job_context(unsigned int id, bool gr2d)
-{
-	struct rep_job_ctx *job_ctx = calloc(1, sizeof(*job_ctx));
-	assert(job_ctx != NULL);
+	for (i = 0; i < streams.count; i++)
+		if (write(start_fds[1], &c, 1) != 1)
+			abort();
 
-	job_ctx->id = id;
-	job_ctx->gr2d = gr2d;
+	for (i = 0; i < streams.count; i++)
+		ok[i] = ok[i] && read_full(result_fds[i], &results[i],
+					   sizeof(results[i]));
 
-	INIT_LIST_HEAD(&job_ctx->node);
-	list_add_tail(&job_ctx->node, &job_ctx_list);
-}
+	/* all streams ran from the start till the last one finished */
+	start = now_us() - start;
 
-static struct rep_job_ctx *lookup_job_context(unsigned int id)
-{
-	struct rep_job_ctx *job_ctx;
+	for (i = 0; i < streams.count; i++) {
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			ok[i] = false;
 
-	list_for_each_entry(job_ctx, &job_ctx_list, node)
-		if (job_ctx->id == id)
-			return job_ctx;
+		err |= !ok[i];
+	}
 
-	return NULL;
+	streams_report(results, ok, start / 1e6);
+
+	exit(err);
 }
 
-static void destroy_job_context(unsigned int id)
+/* drops the objects left over by the record for the next run */
+static void reset_replay(void)
 {
-	struct rep_job_ctx *job_ctx = lookup_job_context(id);
-	assert(job_ctx != NULL);
+	struct rep_job_ctx *job_ctx, *tmp_job_ctx;
+	struct rep_framebuffer *rfb, *tmp_rfb;
+	struct rep_ctx *ctx, *tmp_ctx;
+	struct rep_bo *rbo, *tmp_rbo;
+	unsigned int i;
+
+	readahead_stop();
+
+	for (i = 0; i < REP_HASH_SIZE; i++) {
+		list_for_each_entry_safe(rfb, tmp_rfb, &fb_table[i], node) {
+			list_del(&rfb->node);
+			free(rfb->hfb->pixbuf);
+			free(rfb->hfb);
+			free(rfb);
+		}
 
-	list_del(&job_ctx->node);
-	free(job_ctx);
+		list_for_each_entry_safe(rbo, tmp_rbo, &bo_table[i], node) {
+			list_del(&rbo->node);
+			host1x_bo_free(rbo->bo);
+			free(rbo);
+		}
+
+		list_for_each_entry_safe(ctx, tmp_ctx, &ctx_table[i], node) {
+			list_del(&ctx->node);
+			free(ctx);
+		}
+
+		list_for_each_entry_safe(job_ctx, tmp_job_ctx,
+					 &job_ctx_table[i], node) {
+			list_del(&job_ctx->node);
+			free(job_ctx);
+		}
+	}
+
+#ifdef ENABLE_ZSTD
+	ZSTD_freeDDict(zstd_ddict);
+	zstd_ddict = NULL;
+#endif
+
+	displayed_fb = NULL;
+	busy_client = NULL;
+	recfile.pos = 0;
+	frame_cnt = 0;
+	page_store_next = 0;
+	pace.started = false;
 }
 
 static int submit_job(unsigned int ctx_id,
@@ -460,10 +1730,10 @@ static int submit_job(unsigned int ctx_id,
 {
 	struct rep_job_ctx *job_ctx;
 	struct host1x_client *client;
-	struct record_gather *gathers;
+	const struct record_gather *gathers;
 	struct host1x_syncpt *syncpt;
 	struct rep_framebuffer *rfb;
-	struct record_reloc *relocs;
+	const struct record_reloc *relocs;
 	struct host1x_pushbuf *pb;
 	struct host1x_job *job;
 	struct rep_ctx *ctx;
@@ -492,25 +1762,13 @@ static int submit_job(unsigned int ctx_id,
 	if (!job)
 		abort();
 
-	if (num_gathers) {
-		size = sizeof(*gathers) * num_gathers;
-		gathers = alloca(size);
-		ret = fread(gathers, size, 1, recfile);
-		if (ret != 1)
-			return ret;
-	} else {
-		gathers = NULL;
-	}
+	/* relocations follow the gathers, both are used from the mapping */
+	size = sizeof(*gathers) * num_gathers;
+	gathers = rec_data(size + sizeof(*relocs) * num_relocs);
+	if (!gathers)
+		return -ENODATA;
 
-	if (num_relocs) {
-		size = sizeof(*relocs) * num_relocs;
-		relocs = alloca(size);
-		ret = fread(relocs, size, 1, recfile);
-		if (ret != 1)
-			return ret;
-	} else {
-		relocs = NULL;
-	}
+	relocs = (const void *)((const uint8_t *)gathers + size);
 
 	handled_relocs = alloca(sizeof(bool) * num_relocs);
 	rfb = NULL;
@@ -536,6 +1794,9 @@ static int submit_job(unsigned int ctx_id,
 		rbo = lookup_bo(gathers[i].id, gathers[i].ctx_id);
 		assert(rbo != NULL);
 
+		/* relocations are patched into the gather */
+		wait_bo(rbo);
+
 		pb = HOST1X_JOB_APPEND(job, rbo->bo, 0);
 		if (!pb)
 			abort();
@@ -582,6 +1843,13 @@ static int submit_job(unsigned int ctx_id,
 
 	job->syncpt_incrs = num_syncpt_incrs;
 
+	/* jobs of the other engine aren't ordered with this one */
+	if (busy_client && busy_client != client) {
+		ret = HOST1X_CLIENT_WAIT(busy_client, busy_fence, ~0u);
+		if (ret < 0)
+			abort();
+	}
+
 	ret = HOST1X_CLIENT_SUBMIT(client, job);
 	if (ret < 0)
 		abort();
@@ -592,9 +1860,24 @@ static int submit_job(unsigned int ctx_id,
 	if (ret < 0)
 		abort();
 
-	ret = HOST1X_CLIENT_WAIT(client, fence, ~0u);
-	if (ret < 0)
-		abort();
+	/* the job runs while the following actions are replayed */
+	busy_client = client;
+	busy_fence = fence;
+
+	if (bench.runs)
+		bench_job_submitted(client, fence);
+
+	for (i = 0; i < num_gathers; i++) {
+		rbo = lookup_bo(gathers[i].id, gathers[i].ctx_id);
+		rbo->client = client;
+		rbo->fence = fence;
+	}
+
+	for (i = 0; i < num_relocs; i++) {
+		rbo = lookup_bo(relocs[i].id, relocs[i].ctx_id);
+		rbo->client = client;
+		rbo->fence = fence;
+	}
 
 	return 0;
 }
@@ -629,7 +1912,11 @@ int main(int argc, char *argv[])
 	struct host1x_options options = {};
 	struct record_act r;
 	unsigned int act_cnt = 0;
+	char *frame = NULL;
 	char *path = NULL;
+	unsigned int run = 0;
+	uint64_t run_start;
+	off64_t start;
 	int err = 1;
 	int ret;
 	int c;
@@ -638,38 +1925,19 @@ int main(int argc, char *argv[])
 	options.display_id = -1;
 	options.fd = -1;
 
-	host1x = host1x_open(&options);
-	if (!host1x) {
-		fprintf(stderr, "host1x_open() failed\n");
-		abort();
-	}
-
-	display = host1x_get_display(host1x);
-	if (display) {
-		ret = host1x_overlay_create(&overlay, display);
-		if (ret < 0) {
-			fprintf(stderr, "host1x_overlay_create() failed %d\n",
-				ret);
-			abort();
-		}
-	}
-
-	gr2d = host1x_get_gr2d(host1x);
-	if (!gr2d) {
-		fprintf(stderr, "host1x_get_gr2d() failed\n");
-		abort();
-	}
-
-	gr3d = host1x_get_gr3d(host1x);
-	if (!gr3d) {
-		fprintf(stderr, "host1x_get_gr3d() failed\n");
-		abort();
-	}
+	init_tables();
 
 	do {
 		struct option long_options[] =
 		{
 			{"recfile",	required_argument, NULL, 0},
+			{"frame",	required_argument, NULL, 0},
+			{"bench",	required_argument, NULL, 0},
+			{"bench-json",	required_argument, NULL, 0},
+			{"pace",	no_argument,       NULL, 0},
+			{"streams",	required_argument, NULL, 0},
+			{"hashes",	required_argument, NULL, 0},
+			{"verify",	required_argument, NULL, 0},
 			{ /* Sentinel */ }
 		};
 		int option_index = 0;
@@ -681,6 +1949,50 @@ int main(int argc, char *argv[])
 			switch (option_index) {
 			case 0:
 				path = optarg;
+
+				if (streams.num_paths < REP_MAX_STREAMS)
+					streams.paths[streams.num_paths++] =
+						optarg;
+				break;
+
+			case 1:
+				frame = optarg;
+				break;
+
+			case 2:
+				bench.runs = strtoul(optarg, NULL, 0);
+				break;
+
+			case 3:
+				bench.json = optarg;
+				break;
+
+			case 4:
+				pace.enabled = true;
+				break;
+
+			case 5:
+				streams.count = strtoul(optarg, NULL, 0);
+				break;
+
+			case 6:
+				verify.out = fopen(optarg, "w");
+				if (!verify.out) {
+					fprintf(stderr, "Failed to open %s: "
+						"%s\n", optarg,
+						strerror(errno));
+					return 1;
+				}
+				break;
+
+			case 7:
+				ret = verify_load(optarg);
+				if (ret < 0) {
+					fprintf(stderr, "Failed to load %s: "
+						"%s\n", optarg,
+						strerror(-ret));
+					return 1;
+				}
 				break;
 
 			default:
@@ -696,26 +2008,91 @@ int main(int argc, char *argv[])
 		}
 	} while (c != -1);
 
+	/* benchmarking runs headless and quiet, the results go to stderr */
+	if (bench.runs) {
+		options.open_display = false;
+
+		if (!freopen("/dev/null", "w", stdout))
+			abort();
+	}
+
+	streams.count = MAX(streams.count, streams.num_paths);
+
+	if (streams.count > 1) {
+		if (!bench.runs) {
+			fprintf(stderr, "Streams are replayed with --bench\n");
+			abort();
+		}
+
+		streams.count = MIN(streams.count, REP_MAX_STREAMS);
+		streams_start(&path);
+	}
+
+	host1x = host1x_open(&options);
+	if (!host1x) {
+		fprintf(stderr, "host1x_open() failed\n");
+		abort();
+	}
+
+	display = host1x_get_display(host1x);
+	if (display) {
+		ret = host1x_overlay_create(&overlay, display);
+		if (ret < 0) {
+			fprintf(stderr, "host1x_overlay_create() failed %d\n",
+				ret);
+			abort();
+		}
+	}
+
+	gr2d = host1x_get_gr2d(host1x);
+	if (!gr2d) {
+		fprintf(stderr, "host1x_get_gr2d() failed\n");
+		abort();
+	}
+
+	gr3d = host1x_get_gr3d(host1x);
+	if (!gr3d) {
+		fprintf(stderr, "host1x_get_gr3d() failed\n");
+		abort();
+	}
+
 	if (!path) {
 		fprintf(stderr, "'--recfile path' is missing\n\n");
 		abort();
 	}
 
-	recfile = fopen(path, "r");
-	if (!recfile) {
+	ret = rec_open(path);
+	if (ret < 0) {
 		fprintf(stderr, "%s: Failed to open %s: %s\n",
-			__func__, path, strerror(errno));
+			__func__, path, strerror(-ret));
 		abort();
 	}
 
+	if (frame) {
+		ret = rec_seek_frame(strtoul(frame, NULL, 0));
+		if (ret < 0)
+			fprintf(stderr, "Record has no index, replaying "
+				"everything before frame %s\n", frame);
+		else
+			fprintf(stderr, "Seeking to keyframe at offset %jd\n",
+				(intmax_t)seek_offset);
+	}
+
+	stream_wait_start();
+
+replay:
+	run_start = now_us();
+	act_cnt = 0;
+
 	do {
-		ret = fread(&r.act, sizeof(r.act), 1, recfile);
-		if (ret != 1) {
-			if (feof(recfile))
-				break;
+		if (recfile.pos == recfile.size)
+			break;
 
+		start = recfile.pos;
+
+		ret = rec_read(&r.act, sizeof(r.act));
+		if (ret != 1)
 			goto err_act;
-		}
 
 		if (act_cnt == 0)
 			assert(r.act == REC_START);
@@ -723,13 +2100,31 @@ int main(int argc, char *argv[])
 		if (act_cnt == 1)
 			assert(r.act == REC_INFO);
 
-		if (r.act <= REC_JOB_SUBMIT)
+		/* the header and dictionary are needed for decompression */
+		if (!readahead.started && start >= seek_offset &&
+		    r.act != REC_START && r.act != REC_INFO &&
+		    r.act != REC_ZSTD_DICT)
+			readahead_start(start);
+
+		/* actions before the keyframe only set up the replay state */
+		if (start < seek_offset) {
+			ret = skip_action(&r);
+			if (ret < 0)
+				goto err_act_data;
+
+			if (ret) {
+				act_cnt++;
+				continue;
+			}
+		}
+
+		if (r.act < ARRAY_SIZE(str_actions))
 			printf("replaying action %u: %s\n",
 			       act_cnt, str_actions[r.act]);
 
 		switch (r.act) {
 		case REC_INFO:
-			ret = fread(&r.data.record_info, sizeof(r.data.record_info), 1, recfile);
+			ret = rec_read(&r.data.record_info, sizeof(r.data.record_info));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -742,13 +2137,13 @@ int main(int argc, char *argv[])
 
 			printf("    compression: %u\n", compression);
 
-			if (compression > REC_LZ4)
+			if (compression > REC_ZSTD)
 				goto err_bad_info;
 
 			break;
 
 		case REC_CTX_CREATE:
-			ret = fread(&r.data, sizeof(r.data.ctx_create), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.ctx_create));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -759,7 +2154,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case REC_CTX_DESTROY:
-			ret = fread(&r.data, sizeof(r.data.ctx_destroy), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.ctx_destroy));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -770,7 +2165,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case REC_BO_CREATE:
-			ret = fread(&r.data, sizeof(r.data.bo_create), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.bo_create));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -786,7 +2181,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case REC_BO_DESTROY:
-			ret = fread(&r.data, sizeof(r.data.bo_destroy), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.bo_destroy));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -798,7 +2193,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case REC_BO_LOAD_DATA:
-			ret = fread(&r.data, sizeof(r.data.bo_load), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.bo_load));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -806,7 +2201,8 @@ int main(int argc, char *argv[])
 			printf("    ctx_id: %u\n", r.data.bo_load.ctx_id);
 			printf("    page: %u\n", r.data.bo_load.page_id);
 
-			ret = load_bo(r.data.bo_load.id, r.data.bo_load.ctx_id,
+			ret = load_bo(start, r.data.bo_load.id,
+				      r.data.bo_load.ctx_id,
 				      r.data.bo_load.page_id,
 				      r.data.bo_load.data_size);
 			if (ret != 1)
@@ -815,7 +2211,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case REC_BO_SET_FLAGS:
-			ret = fread(&r.data, sizeof(r.data.bo_set_flags), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.bo_set_flags));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -830,7 +2226,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case REC_ADD_FRAMEBUFFER:
-			ret = fread(&r.data, sizeof(r.data.add_framebuffer), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.add_framebuffer));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -853,7 +2249,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case REC_DEL_FRAMEBUFFER:
-			ret = fread(&r.data, sizeof(r.data.del_framebuffer), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.del_framebuffer));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -866,20 +2262,34 @@ int main(int argc, char *argv[])
 			break;
 
 		case REC_DISP_FRAMEBUFFER:
-			ret = fread(&r.data, sizeof(r.data.disp_framebuffer), 1, recfile);
+			r.data.disp_framebuffer.time = 0;
+
+			ret = rec_read(&r.data, action_data_size(r.act));
 			if (ret != 1)
 				goto err_act_data;
 
 			printf("    bo_id: %u\n", r.data.disp_framebuffer.bo_id);
 			printf("    ctx_id: %u\n", r.data.disp_framebuffer.ctx_id);
+			printf("    time: %ju us\n",
+			       (uintmax_t)r.data.disp_framebuffer.time);
+
+			/* frames between the keyframe and the seeked one */
+			if (frame_cnt >= seek_frame)
+				pace_action(r.data.disp_framebuffer.time);
 
-			display_framebuffer(r.data.disp_framebuffer.bo_id,
-					    r.data.disp_framebuffer.ctx_id);
+			if (bench.runs)
+				bench_frame();
+			else if (frame_cnt >= seek_frame)
+				display_framebuffer(
+					r.data.disp_framebuffer.bo_id,
+					r.data.disp_framebuffer.ctx_id);
+
+			frame_cnt++;
 
 			break;
 
 		case REC_JOB_CTX_CREATE:
-			ret = fread(&r.data, sizeof(r.data.job_ctx_create), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.job_ctx_create));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -892,7 +2302,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case REC_JOB_CTX_DESTROY:
-			ret = fread(&r.data, sizeof(r.data.job_ctx_destroy), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.job_ctx_destroy));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -903,7 +2313,9 @@ int main(int argc, char *argv[])
 			break;
 
 		case REC_JOB_SUBMIT:
-			ret = fread(&r.data, sizeof(r.data.job_submit), 1, recfile);
+			r.data.job_submit.time = 0;
+
+			ret = rec_read(&r.data, action_data_size(r.act));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -911,6 +2323,11 @@ int main(int argc, char *argv[])
 			printf("    num_gathers: %u\n", r.data.job_submit.num_gathers);
 			printf("    num_relocs: %u\n", r.data.job_submit.num_relocs);
 			printf("    num_syncpt_incrs: %u\n", r.data.job_submit.num_syncpt_incrs);
+			printf("    time: %ju us\n",
+			       (uintmax_t)r.data.job_submit.time);
+
+			if (frame_cnt >= seek_frame)
+				pace_action(r.data.job_submit.time);
 
 			ret = submit_job(r.data.job_submit.job_ctx_id,
 					 r.data.job_submit.num_gathers,
@@ -919,12 +2336,99 @@ int main(int argc, char *argv[])
 			if (ret != 0)
 				goto err_act_data;
 
-			handle_single_step();
+			if (!bench.runs)
+				handle_single_step();
+
+			break;
+
+		case REC_BO_LOAD_EXTENT:
+			ret = rec_read(&r.data, sizeof(r.data.bo_load_extent));
+			if (ret != 1)
+				goto err_act_data;
+
+			printf("    bo_id: %u\n", r.data.bo_load_extent.id);
+			printf("    ctx_id: %u\n", r.data.bo_load_extent.ctx_id);
+			printf("    page: %u\n", r.data.bo_load_extent.page_id);
+			printf("    num_pages: %u\n",
+			       r.data.bo_load_extent.num_pages);
+
+			ret = load_bo_extent(start,
+					     r.data.bo_load_extent.id,
+					     r.data.bo_load_extent.ctx_id,
+					     r.data.bo_load_extent.page_id,
+					     r.data.bo_load_extent.num_pages,
+					     r.data.bo_load_extent.data_size);
+			if (ret != 1)
+				goto err_act_data;
+
+			break;
+
+		case REC_ZSTD_DICT:
+			ret = rec_read(&r.data, sizeof(r.data.zstd_dict));
+			if (ret != 1)
+				goto err_act_data;
+
+			printf("    size: %u\n", r.data.zstd_dict.size);
+
+			ret = load_zstd_dict(r.data.zstd_dict.size);
+			if (ret != 1)
+				goto err_act_data;
+
+			break;
+
+		case REC_KEYFRAME:
+			ret = rec_read(&r.data, sizeof(r.data.keyframe));
+			if (ret != 1)
+				goto err_act_data;
+
+			printf("    frame: %u\n", r.data.keyframe.frame);
+
+			page_store_next = 0;
+
+			break;
+
+		case REC_BO_LOAD_STORED:
+			ret = rec_read(&r.data, sizeof(r.data.bo_load_stored));
+			if (ret != 1)
+				goto err_act_data;
+
+			printf("    bo_id: %u\n", r.data.bo_load_stored.id);
+			printf("    ctx_id: %u\n", r.data.bo_load_stored.ctx_id);
+			printf("    page: %u\n", r.data.bo_load_stored.page_id);
+			printf("    slot: %u\n", r.data.bo_load_stored.slot);
+
+			ret = load_bo_stored(r.data.bo_load_stored.id,
+					     r.data.bo_load_stored.ctx_id,
+					     r.data.bo_load_stored.page_id,
+					     r.data.bo_load_stored.slot);
+			if (ret != 1)
+				goto err_act_data;
+
+			break;
+
+		case REC_INDEX:
+			ret = rec_read(&r.data, sizeof(r.data.index));
+			if (ret != 1)
+				goto err_act_data;
+
+			printf("    num_entries: %u\n",
+			       r.data.index.num_entries);
+
+			if (!rec_data(sizeof(struct record_index_entry) *
+				      r.data.index.num_entries))
+				goto err_act_data;
+
+			break;
+
+		case REC_INDEX_END:
+			ret = rec_read(&r.data, sizeof(r.data.index_end));
+			if (ret != 1)
+				goto err_act_data;
 
 			break;
 
 		case REC_START:
-			ret = fread(&r.data, sizeof(r.data.header), 1, recfile);
+			ret = rec_read(&r.data, sizeof(r.data.header));
 			if (ret != 1)
 				goto err_act_data;
 
@@ -932,9 +2436,12 @@ int main(int argc, char *argv[])
 				    strlen(REC_MAGIC) != 0))
 				goto err_invalid_header;
 
-			if (r.data.header.version != 4)
+			if (r.data.header.version < 4 ||
+			    r.data.header.version > 7)
 				goto err_invalid_version;
 
+			record_version = r.data.header.version;
+
 			break;
 
 		default:
@@ -944,9 +2451,47 @@ int main(int argc, char *argv[])
 		act_cnt++;
 	} while (1);
 
+	if (busy_client)
+		HOST1X_CLIENT_WAIT(busy_client, busy_fence, ~0u);
+
+	if (bench.runs) {
+		bench_run_finished(run_start);
+
+		if (++run < bench.runs) {
+			reset_replay();
+			goto replay;
+		}
+
+		if (streams.result_fd >= 0)
+			stream_send_result();
+		else
+			bench_report();
+
+		err = 0;
+		goto exit;
+	}
+
 	fprintf(stderr, "\n\nEnd of record file reached\n");
 
+	/* verification runs unattended */
+	if (verify.out || verify.golden) {
+		if (verify.out)
+			fclose(verify.out);
+
+		if (verify.golden)
+			fprintf(stderr, "%u of %u frames verified, "
+				"%u mismatches\n", verify.checked,
+				verify.num_golden, verify.mismatches);
+
+		err = verify.checked != verify.num_golden ||
+		      verify.mismatches;
+		goto exit;
+	}
+
 stop:
+	if (bench.runs)
+		goto exit;
+
 	fprintf(stderr, "Press Enter to exit\n");
 	grate_wait_for_key(NULL);
 
@@ -0,0 +1,1241 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Reports how efficiently command streams program the 3D engine: registers
+ * written with the value they hold already, shader uploads that repeat the
+ * loaded program and the words spent per draw in each group of registers.
+ *	tools/stream-stats [-j] [-n count] <record | trace | log>
+ *
+ * The input is a record of libwrap, a binary trace of libwrap taken with
+ * LIBWRAP_TRACE_PATH set or the text libwrap prints. The text is parsed
+ * from the register writes libwrap prints without the RNN decoding.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef ENABLE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "cdma.h"
+#include "list.h"
+#include "record_replay.h"
+#include "tgr_3d.xml.h"
+#include "trace.h"
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+
+#define CLASS_GR2D	0x51
+#define CLASS_GR3D	0x60
+
+#define NUM_CLASSES	1024
+#define NUM_REGS	4096
+
+enum reg_group {
+	GROUP_OPCODES,
+	GROUP_SYNC,
+	GROUP_ATTRIBS,
+	GROUP_DRAW,
+	GROUP_VP,
+	GROUP_LINKER,
+	GROUP_RASTER,
+	GROUP_DEPTH_STENCIL,
+	GROUP_FP,
+	GROUP_TEXTURES,
+	GROUP_FP_CONSTS,
+	GROUP_RT,
+	GROUP_MISC,
+	GROUP_OTHER_CLASSES,
+	NUM_GROUPS,
+};
+
+static const char * const group_names[NUM_GROUPS] = {
+	[GROUP_OPCODES]		= "opcodes",
+	[GROUP_SYNC]		= "sync",
+	[GROUP_ATTRIBS]		= "attributes",
+	[GROUP_DRAW]		= "draw",
+	[GROUP_VP]		= "vertex program",
+	[GROUP_LINKER]		= "linker",
+	[GROUP_RASTER]		= "rasterizer",
+	[GROUP_DEPTH_STENCIL]	= "depth/stencil",
+	[GROUP_FP]		= "fragment program",
+	[GROUP_TEXTURES]	= "textures",
+	[GROUP_FP_CONSTS]	= "fragment consts",
+	[GROUP_RT]		= "render targets",
+	[GROUP_MISC]		= "misc",
+	[GROUP_OTHER_CLASSES]	= "other classes",
+};
+
+/* registers whose writes aren't state, but push data or trigger work */
+enum reg_kind {
+	KIND_STATE,
+	KIND_PORT,
+	KIND_VP_INST,
+	KIND_VP_CONST,
+	KIND_FP,
+	NUM_KINDS,
+};
+
+#define NUM_UPLOADS	(NUM_KINDS - KIND_VP_INST)
+
+/* later entries override earlier ones */
+static const struct reg_range {
+	uint16_t first;
+	uint16_t last;
+	uint8_t group;
+	uint8_t kind;
+} tgr3d_ranges[] = {
+	{ 0x000, 0x0ff, GROUP_SYNC, KIND_STATE },
+	{ 0x000, 0x00c, GROUP_SYNC, KIND_PORT },
+	{ TGR3D_INDOFF2, TGR3D_INDOFF, GROUP_SYNC, KIND_PORT },
+	{ 0x100, 0x11f, GROUP_ATTRIBS, KIND_STATE },
+	{ 0x120, 0x12f, GROUP_DRAW, KIND_STATE },
+	{ TGR3D_DRAW_PRIMITIVES, TGR3D_DRAW_PRIMITIVES, GROUP_DRAW, KIND_PORT },
+	{ 0x200, 0x2ff, GROUP_VP, KIND_STATE },
+	{ TGR3D_VP_UPLOAD_INST_ID, TGR3D_VP_UPLOAD_INST, GROUP_VP,
+	  KIND_VP_INST },
+	{ TGR3D_VP_UPLOAD_CONST_ID, TGR3D_VP_UPLOAD_CONST, GROUP_VP,
+	  KIND_VP_CONST },
+	{ 0x300, 0x33f, GROUP_LINKER, KIND_STATE },
+	{ 0x340, 0x3ff, GROUP_RASTER, KIND_STATE },
+	{ 0x400, 0x4ff, GROUP_DEPTH_STENCIL, KIND_STATE },
+	{ 0x500, 0x70f, GROUP_FP, KIND_STATE },
+	{ TGR3D_FP_PSEQ_UPLOAD_INST_BUFFER_FLUSH,
+	  TGR3D_FP_PSEQ_UPLOAD_INST_BUFFER_FLUSH, GROUP_FP, KIND_PORT },
+	{ TGR3D_FP_PSEQ_UPLOAD_INST_ID, TGR3D_FP_PSEQ_UPLOAD_INST, GROUP_FP,
+	  KIND_FP },
+	{ TGR3D_FP_UPLOAD_MFU_SCHED_ID, TGR3D_FP_UPLOAD_MFU_INST, GROUP_FP,
+	  KIND_FP },
+	{ TGR3D_FP_UPLOAD_TEX_INST_ID, TGR3D_FP_UPLOAD_TEX_INST, GROUP_FP,
+	  KIND_FP },
+	{ 0x710, 0x7ff, GROUP_TEXTURES, KIND_STATE },
+	{ 0x800, 0x81f, GROUP_FP, KIND_STATE },
+	{ TGR3D_FP_UPLOAD_ALU_SCHED_ID, TGR3D_FP_UPLOAD_ALU_INST_COMPLEMENT,
+	  GROUP_FP, KIND_FP },
+	{ 0x820, 0x83f, GROUP_FP_CONSTS, KIND_STATE },
+	{ TGR3D_FP_UPLOAD_DW_INST_ID, TGR3D_FP_UPLOAD_DW_INST, GROUP_FP,
+	  KIND_FP },
+	{ 0x900, 0xfff, GROUP_MISC, KIND_STATE },
+	{ TGR3D_RT_ENABLE, TGR3D_RT_ENABLE, GROUP_RT, KIND_STATE },
+	{ TGR3D_FDC_CONTROL, TGR3D_FDC_CONTROL, GROUP_MISC, KIND_PORT },
+	{ 0xe00, 0xe1f, GROUP_RT, KIND_STATE },
+	{ TGR3D_FP_UPLOAD_INST_ID_COMMON, TGR3D_FP_UPLOAD_INST_ID_COMMON,
+	  GROUP_FP, KIND_FP },
+	{ TGR3D_STENCIL_FRONT2, TGR3D_STENCIL_BACK2, GROUP_DEPTH_STENCIL,
+	  KIND_STATE },
+};
+
+static const struct reg_name {
+	uint16_t offset;
+	uint8_t stride;
+	uint8_t count;
+	const char *name;
+} tgr3d_names[] = {
+	{ TGR3D_INDOFF2, 1, 1, "INDOFF2" },
+	{ TGR3D_INDOFF, 1, 1, "INDOFF" },
+	{ TGR3D_ATTRIB_PTR(0), 2, 16, "ATTRIB_PTR" },
+	{ TGR3D_ATTRIB_MODE(0), 2, 16, "ATTRIB_MODE" },
+	{ TGR3D_VP_ATTRIB_IN_OUT_SELECT, 1, 1, "VP_ATTRIB_IN_OUT_SELECT" },
+	{ TGR3D_INDEX_PTR, 1, 1, "INDEX_PTR" },
+	{ TGR3D_DRAW_PARAMS, 1, 1, "DRAW_PARAMS" },
+	{ TGR3D_DRAW_PRIMITIVES, 1, 1, "DRAW_PRIMITIVES" },
+	{ TGR3D_VP_UPLOAD_INST_ID, 1, 1, "VP_UPLOAD_INST_ID" },
+	{ TGR3D_VP_UPLOAD_INST, 1, 1, "VP_UPLOAD_INST" },
+	{ TGR3D_VP_UPLOAD_CONST_ID, 1, 1, "VP_UPLOAD_CONST_ID" },
+	{ TGR3D_VP_UPLOAD_CONST, 1, 1, "VP_UPLOAD_CONST" },
+	{ TGR3D_LINKER_INSTRUCTION(0), 2, 32, "LINKER_INSTRUCTION" },
+	{ TGR3D_LINKER_INSTRUCTION(0) + 1, 2, 32, "LINKER_INSTRUCTION_H" },
+	{ TGR3D_CULL_FACE_LINKER_SETUP, 1, 1, "CULL_FACE_LINKER_SETUP" },
+	{ TGR3D_POLYGON_OFFSET_UNITS, 1, 1, "POLYGON_OFFSET_UNITS" },
+	{ TGR3D_POLYFON_OFFSET_FACTOR, 1, 1, "POLYGON_OFFSET_FACTOR" },
+	{ TGR3D_POINT_PARAMS, 1, 1, "POINT_PARAMS" },
+	{ TGR3D_POINT_SIZE, 1, 1, "POINT_SIZE" },
+	{ TGR3D_POINT_COORD_RANGE_MAX_S, 1, 1, "POINT_COORD_RANGE_MAX_S" },
+	{ TGR3D_POINT_COORD_RANGE_MAX_T, 1, 1, "POINT_COORD_RANGE_MAX_T" },
+	{ TGR3D_POINT_COORD_RANGE_MIN_S, 1, 1, "POINT_COORD_RANGE_MIN_S" },
+	{ TGR3D_POINT_COORD_RANGE_MIN_T, 1, 1, "POINT_COORD_RANGE_MIN_T" },
+	{ TGR3D_LINE_PARAMS, 1, 1, "LINE_PARAMS" },
+	{ TGR3D_HALF_LINE_WIDTH, 1, 1, "HALF_LINE_WIDTH" },
+	{ TGR3D_SCISSOR_HORIZ, 1, 1, "SCISSOR_HORIZ" },
+	{ TGR3D_SCISSOR_VERT, 1, 1, "SCISSOR_VERT" },
+	{ TGR3D_VIEWPORT_X_BIAS, 1, 1, "VIEWPORT_X_BIAS" },
+	{ TGR3D_VIEWPORT_Y_BIAS, 1, 1, "VIEWPORT_Y_BIAS" },
+	{ TGR3D_VIEWPORT_Z_BIAS, 1, 1, "VIEWPORT_Z_BIAS" },
+	{ TGR3D_VIEWPORT_X_SCALE, 1, 1, "VIEWPORT_X_SCALE" },
+	{ TGR3D_VIEWPORT_Y_SCALE, 1, 1, "VIEWPORT_Y_SCALE" },
+	{ TGR3D_VIEWPORT_Z_SCALE, 1, 1, "VIEWPORT_Z_SCALE" },
+	{ TGR3D_GUARDBAND_WIDTH, 1, 1, "GUARDBAND_WIDTH" },
+	{ TGR3D_GUARDBAND_HEIGHT, 1, 1, "GUARDBAND_HEIGHT" },
+	{ TGR3D_GUARDBAND_DEPTH, 1, 1, "GUARDBAND_DEPTH" },
+	{ TGR3D_STENCIL_FRONT1, 1, 1, "STENCIL_FRONT1" },
+	{ TGR3D_STENCIL_BACK1, 1, 1, "STENCIL_BACK1" },
+	{ TGR3D_STENCIL_PARAMS, 1, 1, "STENCIL_PARAMS" },
+	{ TGR3D_DEPTH_TEST_PARAMS, 1, 1, "DEPTH_TEST_PARAMS" },
+	{ TGR3D_DEPTH_RANGE_NEAR, 1, 1, "DEPTH_RANGE_NEAR" },
+	{ TGR3D_DEPTH_RANGE_FAR, 1, 1, "DEPTH_RANGE_FAR" },
+	{ TGR3D_FP_PSEQ_UPLOAD_INST_BUFFER_FLUSH, 1, 1,
+	  "FP_PSEQ_UPLOAD_INST_BUFFER_FLUSH" },
+	{ TGR3D_FP_PSEQ_ENGINE_INST, 1, 1, "FP_PSEQ_ENGINE_INST" },
+	{ TGR3D_FP_PSEQ_UPLOAD_INST_ID, 1, 1, "FP_PSEQ_UPLOAD_INST_ID" },
+	{ TGR3D_FP_PSEQ_UPLOAD_INST, 1, 1, "FP_PSEQ_UPLOAD_INST" },
+	{ TGR3D_FP_PSEQ_QUAD_ID, 1, 1, "FP_PSEQ_QUAD_ID" },
+	{ TGR3D_FP_PSEQ_DW_CFG, 1, 1, "FP_PSEQ_DW_CFG" },
+	{ TGR3D_FP_UPLOAD_MFU_SCHED_ID, 1, 1, "FP_UPLOAD_MFU_SCHED_ID" },
+	{ TGR3D_FP_UPLOAD_MFU_SCHED, 1, 1, "FP_UPLOAD_MFU_SCHED" },
+	{ TGR3D_FP_UPLOAD_MFU_INST_ID, 1, 1, "FP_UPLOAD_MFU_INST_ID" },
+	{ TGR3D_FP_UPLOAD_MFU_INST, 1, 1, "FP_UPLOAD_MFU_INST" },
+	{ TGR3D_FP_UPLOAD_TEX_INST_ID, 1, 1, "FP_UPLOAD_TEX_INST_ID" },
+	{ TGR3D_FP_UPLOAD_TEX_INST, 1, 1, "FP_UPLOAD_TEX_INST" },
+	{ TGR3D_TEXTURE_POINTER(0), 1, 16, "TEXTURE_POINTER" },
+	{ TGR3D_TEXTURE_DESC1(0), 2, 16, "TEXTURE_DESC1" },
+	{ TGR3D_TEXTURE_DESC2(0), 2, 16, "TEXTURE_DESC2" },
+	{ TGR3D_FP_UPLOAD_ALU_SCHED_ID, 1, 1, "FP_UPLOAD_ALU_SCHED_ID" },
+	{ TGR3D_FP_UPLOAD_ALU_SCHED, 1, 1, "FP_UPLOAD_ALU_SCHED" },
+	{ TGR3D_FP_UPLOAD_ALU_INST_ID, 1, 1, "FP_UPLOAD_ALU_INST_ID" },
+	{ TGR3D_FP_UPLOAD_ALU_INST, 1, 1, "FP_UPLOAD_ALU_INST" },
+	{ TGR3D_FP_UPLOAD_ALU_INST_COMPLEMENT, 1, 1,
+	  "FP_UPLOAD_ALU_INST_COMPLEMENT" },
+	{ TGR3D_FP_CONST(0), 1, 32, "FP_CONST" },
+	{ TGR3D_FP_UPLOAD_DW_INST_ID, 1, 1, "FP_UPLOAD_DW_INST_ID" },
+	{ TGR3D_FP_UPLOAD_DW_INST, 1, 1, "FP_UPLOAD_DW_INST" },
+	{ TGR3D_RT_ENABLE, 1, 1, "RT_ENABLE" },
+	{ TGR3D_FDC_CONTROL, 1, 1, "FDC_CONTROL" },
+	{ TGR3D_RT_PTR(0), 1, 16, "RT_PTR" },
+	{ TGR3D_RT_PARAMS(0), 1, 16, "RT_PARAMS" },
+	{ TGR3D_ALU_BUFFER_SIZE, 1, 1, "ALU_BUFFER_SIZE" },
+	{ TGR3D_TRAM_SETUP, 1, 1, "TRAM_SETUP" },
+	{ TGR3D_FP_UPLOAD_INST_ID_COMMON, 1, 1, "FP_UPLOAD_INST_ID_COMMON" },
+	{ TGR3D_DITHER, 1, 1, "DITHER" },
+	{ TGR3D_STENCIL_FRONT2, 1, 1, "STENCIL_FRONT2" },
+	{ TGR3D_STENCIL_BACK2, 1, 1, "STENCIL_BACK2" },
+};
+
+struct reg_state {
+	uint32_t value;
+	bool valid;
+	uint64_t writes;
+	uint64_t unchanged;
+};
+
+struct class_state {
+	struct reg_state regs[NUM_REGS];
+};
+
+/* uploads are compared by a hash of their writes */
+#define UPLOAD_HASH_SIZE	4096
+
+struct upload_stats {
+	const char *name;
+
+	/* the upload since the last draw */
+	uint64_t hash;
+	unsigned int words;
+
+	uint64_t last;
+	uint64_t uploads;
+	uint64_t total_words;
+	uint64_t repeated;
+	uint64_t repeated_words;
+	uint64_t seen;
+	uint64_t seen_words;
+
+	uint64_t known[UPLOAD_HASH_SIZE];
+};
+
+static struct {
+	bool per_job;
+	unsigned int top;
+
+	uint8_t group[NUM_REGS];
+	uint8_t kind[NUM_REGS];
+
+	struct class_state *classes[NUM_CLASSES];
+	struct upload_stats uploads[NUM_UPLOADS];
+
+	uint64_t streams;
+	uint64_t frames;
+	uint64_t draws;
+	uint64_t errors;
+	uint64_t words[NUM_GROUPS];
+	uint64_t state_writes;
+	uint64_t unchanged;
+} stats = {
+	.top = 20,
+	.uploads = {
+		{ .name = "vertex program" },
+		{ .name = "vertex constants" },
+		{ .name = "fragment program" },
+	},
+};
+
+static void init_tables(void)
+{
+	const struct reg_range *range;
+	unsigned int i, offset;
+
+	for (i = 0; i < ARRAY_SIZE(tgr3d_ranges); i++) {
+		range = &tgr3d_ranges[i];
+
+		for (offset = range->first; offset <= range->last; offset++) {
+			stats.group[offset] = range->group;
+			stats.kind[offset] = range->kind;
+		}
+	}
+}
+
+static const char *reg_name(uint32_t classid, uint32_t offset)
+{
+	const struct reg_name *reg;
+	static char name[64];
+	unsigned int i, index;
+
+	for (i = 0; classid == CLASS_GR3D && i < ARRAY_SIZE(tgr3d_names);
+	     i++) {
+		reg = &tgr3d_names[i];
+
+		if (offset < reg->offset)
+			continue;
+
+		index = (offset - reg->offset) / reg->stride;
+
+		if (index >= reg->count ||
+		    (offset - reg->offset) % reg->stride)
+			continue;
+
+		if (reg->count == 1)
+			return reg->name;
+
+		snprintf(name, sizeof(name), "%s(%u)", reg->name, index);
+		return name;
+	}
+
+	snprintf(name, sizeof(name), "%02x:%03x", classid, offset);
+
+	return name;
+}
+
+static uint64_t hash_word(uint64_t hash, uint32_t word)
+{
+	unsigned int i;
+
+	/* FNV-1a */
+	for (i = 0; i < 4; i++, word >>= 8)
+		hash = (hash ^ (word & 0xff)) * 0x100000001b3ull;
+
+	return hash;
+}
+
+/* returns true if the upload is one seen before */
+static bool upload_known(struct upload_stats *up, uint64_t hash)
+{
+	unsigned int i, index = hash % UPLOAD_HASH_SIZE;
+
+	for (i = 0; i < UPLOAD_HASH_SIZE; i++) {
+		uint64_t *slot = &up->known[(index + i) % UPLOAD_HASH_SIZE];
+
+		if (*slot == hash)
+			return true;
+
+		if (!*slot) {
+			*slot = hash;
+			return false;
+		}
+	}
+
+	return false;
+}
+
+static void finish_uploads(void)
+{
+	struct upload_stats *up;
+	unsigned int i;
+
+	for (i = 0; i < NUM_UPLOADS; i++) {
+		up = &stats.uploads[i];
+
+		if (!up->words)
+			continue;
+
+		up->uploads++;
+		up->total_words += up->words;
+
+		if (up->hash == up->last) {
+			up->repeated++;
+			up->repeated_words += up->words;
+		} else if (upload_known(up, up->hash)) {
+			up->seen++;
+			up->seen_words += up->words;
+		}
+
+		up->last = up->hash;
+		up->hash = 0;
+		up->words = 0;
+	}
+}
+
+static void begin_stream(void)
+{
+	struct class_state *cls;
+	unsigned int i, k;
+
+	stats.streams++;
+
+	if (!stats.per_job)
+		return;
+
+	for (i = 0; i < NUM_CLASSES; i++) {
+		cls = stats.classes[i];
+
+		for (k = 0; cls && k < NUM_REGS; k++)
+			cls->regs[k].valid = false;
+	}
+}
+
+static void count_opcode(enum cdma_opcode opcode)
+{
+	/* the data of an immediate is counted as the register write */
+	if (opcode == CDMA_OPCODE_IMM)
+		return;
+
+	stats.words[GROUP_OPCODES] += opcode == CDMA_OPCODE_GATHER ? 2 : 1;
+}
+
+static void count_write(uint32_t classid, uint32_t offset, uint32_t value)
+{
+	enum reg_kind kind = KIND_STATE;
+	struct upload_stats *up;
+	struct class_state *cls;
+	struct reg_state *reg;
+
+	classid %= NUM_CLASSES;
+	offset %= NUM_REGS;
+
+	if (classid == CLASS_GR3D) {
+		stats.words[stats.group[offset]]++;
+		kind = stats.kind[offset];
+	} else {
+		stats.words[GROUP_OTHER_CLASSES]++;
+
+		/* the host1x methods of the class */
+		if (offset <= 0x8)
+			kind = KIND_PORT;
+	}
+
+	if (kind >= KIND_VP_INST) {
+		up = &stats.uploads[kind - KIND_VP_INST];
+		if (!up->words++)
+			up->hash = 0xcbf29ce484222325ull;
+
+		up->hash = hash_word(hash_word(up->hash, offset), value);
+		return;
+	}
+
+	if (kind == KIND_PORT) {
+		if (classid == CLASS_GR3D && offset == TGR3D_DRAW_PRIMITIVES) {
+			stats.draws++;
+			finish_uploads();
+		}
+		return;
+	}
+
+	cls = stats.classes[classid];
+	if (!cls) {
+		cls = calloc(1, sizeof(*cls));
+		if (!cls) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+
+		stats.classes[classid] = cls;
+	}
+
+	reg = &cls->regs[offset];
+	reg->writes++;
+	stats.state_writes++;
+
+	if (reg->valid && reg->value == value) {
+		reg->unchanged++;
+		stats.unchanged++;
+	}
+
+	reg->value = value;
+	reg->valid = true;
+}
+
+static void visit_op(void *user, const struct cdma_op *op)
+{
+	count_opcode(op->opcode);
+}
+
+static void visit_write(void *user, uint32_t classid, uint32_t offset,
+			uint32_t value)
+{
+	count_write(classid, offset, value);
+}
+
+static void visit_error(void *user, uint32_t word)
+{
+	if (!stats.errors++)
+		fprintf(stderr, "invalid opcode word 0x%08x\n", word);
+}
+
+static const struct cdma_visitor stats_visitor = {
+	.op = visit_op,
+	.write = visit_write,
+	.error = visit_error,
+};
+
+/* objects of a record are looked up by (id, ctx_id) */
+#define REC_HASH_BITS	10
+#define REC_HASH_SIZE	(1 << REC_HASH_BITS)
+
+struct rec_bo {
+	struct list_head node;
+	unsigned int id;
+	unsigned int ctx_id;
+	size_t size;
+	uint8_t *data;
+};
+
+struct rec_job_ctx {
+	struct list_head node;
+	unsigned int id;
+	bool gr2d;
+};
+
+static struct {
+	FILE *fp;
+	unsigned int version;
+	enum record_compression compression;
+	void *payload;
+	size_t payload_size;
+
+	struct list_head bos[REC_HASH_SIZE];
+	struct list_head job_ctxs[REC_HASH_SIZE];
+
+	/* ring of the loaded pages since version 7 */
+	uint8_t *page_store;
+	unsigned int page_store_next;
+
+#ifdef ENABLE_ZSTD
+	ZSTD_DCtx *zstd_dctx;
+	ZSTD_DDict *zstd_ddict;
+#endif
+} rec;
+
+static struct list_head *rec_hash(struct list_head *table, unsigned int id,
+				  unsigned int ctx_id)
+{
+	uint32_t hash = id * 0x9e3779b1u ^ ctx_id * 0x85ebca6bu;
+
+	return &table[hash >> (32 - REC_HASH_BITS)];
+}
+
+static struct rec_bo *lookup_bo(unsigned int id, unsigned int ctx_id)
+{
+	struct rec_bo *bo;
+
+	list_for_each_entry(bo, rec_hash(rec.bos, id, ctx_id), node)
+		if (bo->id == id && bo->ctx_id == ctx_id)
+			return bo;
+
+	return NULL;
+}
+
+static struct rec_job_ctx *lookup_job_ctx(unsigned int id)
+{
+	struct rec_job_ctx *job_ctx;
+
+	list_for_each_entry(job_ctx, rec_hash(rec.job_ctxs, id, 0), node)
+		if (job_ctx->id == id)
+			return job_ctx;
+
+	return NULL;
+}
+
+/* size of the action data, 0 for unknown actions */
+static size_t action_data_size(uint32_t act)
+{
+	struct record_act r;
+
+	/* timestamps were added by version 6 */
+	if (rec.version < 6) {
+		if (act == REC_DISP_FRAMEBUFFER)
+			return offsetof(struct disp_framebuffer, time);
+
+		if (act == REC_JOB_SUBMIT)
+			return offsetof(struct job_submit, time);
+	}
+
+	switch (act) {
+	case REC_START:			return sizeof(r.data.header);
+	case REC_INFO:			return sizeof(r.data.record_info);
+	case REC_CTX_CREATE:		return sizeof(r.data.ctx_create);
+	case REC_CTX_DESTROY:		return sizeof(r.data.ctx_destroy);
+	case REC_BO_CREATE:		return sizeof(r.data.bo_create);
+	case REC_BO_DESTROY:		return sizeof(r.data.bo_destroy);
+	case REC_BO_LOAD_DATA:		return sizeof(r.data.bo_load);
+	case REC_BO_SET_FLAGS:		return sizeof(r.data.bo_set_flags);
+	case REC_ADD_FRAMEBUFFER:	return sizeof(r.data.add_framebuffer);
+	case REC_DEL_FRAMEBUFFER:	return sizeof(r.data.del_framebuffer);
+	case REC_DISP_FRAMEBUFFER:	return sizeof(r.data.disp_framebuffer);
+	case REC_JOB_CTX_CREATE:	return sizeof(r.data.job_ctx_create);
+	case REC_JOB_CTX_DESTROY:	return sizeof(r.data.job_ctx_destroy);
+	case REC_JOB_SUBMIT:		return sizeof(r.data.job_submit);
+	case REC_BO_LOAD_EXTENT:	return sizeof(r.data.bo_load_extent);
+	case REC_ZSTD_DICT:		return sizeof(r.data.zstd_dict);
+	case REC_KEYFRAME:		return sizeof(r.data.keyframe);
+	case REC_INDEX:			return sizeof(r.data.index);
+	case REC_INDEX_END:		return sizeof(r.data.index_end);
+	case REC_BO_LOAD_STORED:	return sizeof(r.data.bo_load_stored);
+	}
+
+	return 0;
+}
+
+/* size of the data following the action */
+static size_t action_payload_size(const struct record_act *r)
+{
+	switch (r->act) {
+	case REC_BO_LOAD_DATA:
+		return r->data.bo_load.data_size ?: 4096;
+
+	case REC_BO_LOAD_EXTENT:
+		return r->data.bo_load_extent.data_size ?:
+		       r->data.bo_load_extent.num_pages * 4096;
+
+	case REC_JOB_SUBMIT:
+		return sizeof(struct record_gather) *
+				r->data.job_submit.num_gathers +
+		       sizeof(struct record_reloc) *
+				r->data.job_submit.num_relocs;
+
+	case REC_ZSTD_DICT:
+		return r->data.zstd_dict.size;
+
+	case REC_INDEX:
+		return sizeof(struct record_index_entry) *
+				r->data.index.num_entries;
+	}
+
+	return 0;
+}
+
+static int decompress(void *dest, size_t dest_size, size_t size)
+{
+#ifdef ENABLE_ZLIB
+	uLongf out_size = dest_size;
+
+	if (rec.compression == REC_ZLIB)
+		return uncompress(dest, &out_size, rec.payload, size) == Z_OK &&
+		       out_size == dest_size ? 0 : -EINVAL;
+#endif
+
+#ifdef ENABLE_LZ4
+	if (rec.compression == REC_LZ4)
+		return LZ4_decompress_safe(rec.payload, dest, size,
+					   dest_size) >= 0 ? 0 : -EINVAL;
+#endif
+
+#ifdef ENABLE_ZSTD
+	if (rec.compression == REC_ZSTD) {
+		size_t ret;
+
+		if (!rec.zstd_dctx)
+			rec.zstd_dctx = ZSTD_createDCtx();
+
+		if (!rec.zstd_dctx)
+			return -ENOMEM;
+
+		if (rec.zstd_ddict)
+			ret = ZSTD_decompress_usingDDict(rec.zstd_dctx, dest,
+							 dest_size, rec.payload,
+							 size, rec.zstd_ddict);
+		else
+			ret = ZSTD_decompressDCtx(rec.zstd_dctx, dest,
+						  dest_size, rec.payload,
+						  size);
+
+		return ZSTD_isError(ret) ? -EINVAL : 0;
+	}
+#endif
+
+	return -ENOTSUP;
+}
+
+static int load_bo(unsigned int id, unsigned int ctx_id, unsigned int page,
+		   unsigned int num_pages, size_t size)
+{
+	struct rec_bo *bo = lookup_bo(id, ctx_id);
+	size_t dest_size = num_pages * 4096;
+	unsigned int slot;
+	uint8_t *dest;
+	int err = 0;
+
+	if (!bo || (page + num_pages) * 4096ull > bo->size)
+		return -EINVAL;
+
+	dest = bo->data + page * 4096;
+
+	if (size)
+		err = decompress(dest, dest_size, size);
+	else
+		memcpy(dest, rec.payload, dest_size);
+
+	if (err)
+		return err;
+
+	if (rec.version < 7)
+		return 0;
+
+	if (!rec.page_store) {
+		rec.page_store = malloc(REC_PAGE_STORE_SIZE * 4096);
+		if (!rec.page_store)
+			return -ENOMEM;
+	}
+
+	for (; num_pages; num_pages--, dest += 4096) {
+		slot = rec.page_store_next++ % REC_PAGE_STORE_SIZE;
+		memcpy(rec.page_store + slot * 4096, dest, 4096);
+	}
+
+	return 0;
+}
+
+static int load_bo_stored(unsigned int id, unsigned int ctx_id,
+			  unsigned int page, unsigned int slot)
+{
+	struct rec_bo *bo = lookup_bo(id, ctx_id);
+
+	if (!bo || (page + 1) * 4096ull > bo->size || !rec.page_store ||
+	    slot >= REC_PAGE_STORE_SIZE)
+		return -EINVAL;
+
+	memcpy(bo->data + page * 4096, rec.page_store + slot * 4096, 4096);
+
+	return 0;
+}
+
+static int submit_job(unsigned int job_ctx_id, unsigned int num_gathers,
+		      unsigned int num_relocs)
+{
+	const struct record_gather *gathers = rec.payload;
+	const struct record_reloc *relocs;
+	struct rec_job_ctx *job_ctx;
+	struct cdma_decoder dec;
+	struct rec_bo *bo, *target;
+	unsigned int i, k;
+	uint32_t *word;
+
+	relocs = (const void *)(gathers + num_gathers);
+
+	job_ctx = lookup_job_ctx(job_ctx_id);
+	if (!job_ctx)
+		return -EINVAL;
+
+	begin_stream();
+
+	cdma_decoder_init(&dec, &stats_visitor, NULL,
+			  job_ctx->gr2d ? CLASS_GR2D : CLASS_GR3D);
+
+	for (i = 0; i < num_gathers; i++) {
+		bo = lookup_bo(gathers[i].id, gathers[i].ctx_id);
+		if (!bo || gathers[i].offset % 4 ||
+		    gathers[i].offset + gathers[i].num_words * 4ull > bo->size)
+			return -EINVAL;
+
+		/* a stand-in of the address, which is stable for a BO */
+		for (k = 0; k < num_relocs; k++) {
+			if (relocs[k].gather_id != gathers[i].id)
+				continue;
+
+			target = lookup_bo(relocs[k].id, relocs[k].ctx_id);
+			if (!target || relocs[k].patch_offset % 4 ||
+			    relocs[k].patch_offset + 4ull > bo->size)
+				return -EINVAL;
+
+			word = (uint32_t *)(bo->data + relocs[k].patch_offset);
+			*word = (target->id << 20) + relocs[k].offset;
+		}
+
+		cdma_decode(&dec, (uint32_t *)(bo->data + gathers[i].offset),
+			    gathers[i].num_words);
+	}
+
+	return 0;
+}
+
+static int handle_action(struct record_act *r, size_t size)
+{
+	struct rec_job_ctx *job_ctx;
+	struct rec_bo *bo;
+
+	switch (r->act) {
+	case REC_START:
+		if (memcmp(r->data.header.magic, REC_MAGIC,
+			   strlen(REC_MAGIC)))
+			return -EINVAL;
+
+		/* the size of actions depends on the version */
+		if (r->data.header.version < 4 || r->data.header.version > 7)
+			return -ENOTSUP;
+
+		rec.version = r->data.header.version;
+		break;
+
+	case REC_INFO:
+		rec.compression = r->data.record_info.compression;
+		break;
+
+	case REC_BO_CREATE:
+		bo = calloc(1, sizeof(*bo));
+		if (!bo)
+			return -ENOMEM;
+
+		bo->id = r->data.bo_create.id;
+		bo->ctx_id = r->data.bo_create.ctx_id;
+		bo->size = r->data.bo_create.num_pages * 4096ull;
+		bo->data = calloc(1, bo->size);
+		if (!bo->data) {
+			free(bo);
+			return -ENOMEM;
+		}
+
+		list_add_tail(&bo->node, rec_hash(rec.bos, bo->id,
+						  bo->ctx_id));
+		break;
+
+	case REC_BO_DESTROY:
+		bo = lookup_bo(r->data.bo_destroy.id,
+			       r->data.bo_destroy.ctx_id);
+		if (bo) {
+			list_del(&bo->node);
+			free(bo->data);
+			free(bo);
+		}
+		break;
+
+	case REC_BO_LOAD_DATA:
+		return load_bo(r->data.bo_load.id, r->data.bo_load.ctx_id,
+			       r->data.bo_load.page_id, 1,
+			       r->data.bo_load.data_size);
+
+	case REC_BO_LOAD_EXTENT:
+		return load_bo(r->data.bo_load_extent.id,
+			       r->data.bo_load_extent.ctx_id,
+			       r->data.bo_load_extent.page_id,
+			       r->data.bo_load_extent.num_pages,
+			       r->data.bo_load_extent.data_size);
+
+	case REC_BO_LOAD_STORED:
+		return load_bo_stored(r->data.bo_load_stored.id,
+				      r->data.bo_load_stored.ctx_id,
+				      r->data.bo_load_stored.page_id,
+				      r->data.bo_load_stored.slot);
+
+	case REC_KEYFRAME:
+		rec.page_store_next = 0;
+		break;
+
+	case REC_ZSTD_DICT:
+#ifdef ENABLE_ZSTD
+		rec.zstd_ddict = ZSTD_createDDict(rec.payload, size);
+		if (!rec.zstd_ddict)
+			return -EINVAL;
+#endif
+		break;
+
+	case REC_DISP_FRAMEBUFFER:
+		stats.frames++;
+		break;
+
+	case REC_JOB_CTX_CREATE:
+		job_ctx = calloc(1, sizeof(*job_ctx));
+		if (!job_ctx)
+			return -ENOMEM;
+
+		job_ctx->id = r->data.job_ctx_create.id;
+		job_ctx->gr2d = r->data.job_ctx_create.gr2d;
+
+		list_add_tail(&job_ctx->node,
+			      rec_hash(rec.job_ctxs, job_ctx->id, 0));
+		break;
+
+	case REC_JOB_CTX_DESTROY:
+		job_ctx = lookup_job_ctx(r->data.job_ctx_destroy.id);
+		if (job_ctx) {
+			list_del(&job_ctx->node);
+			free(job_ctx);
+		}
+		break;
+
+	case REC_JOB_SUBMIT:
+		return submit_job(r->data.job_submit.job_ctx_id,
+				  r->data.job_submit.num_gathers,
+				  r->data.job_submit.num_relocs);
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int scan_record(FILE *fp)
+{
+	struct record_act r;
+	size_t size;
+	int err;
+
+	rec.fp = fp;
+	rec.version = 6;
+
+	for (size = 0; size < REC_HASH_SIZE; size++) {
+		INIT_LIST_HEAD(&rec.bos[size]);
+		INIT_LIST_HEAD(&rec.job_ctxs[size]);
+	}
+
+	while (fread(&r.act, sizeof(r.act), 1, fp) == 1) {
+		size = action_data_size(r.act);
+		if (!size) {
+			fprintf(stderr, "invalid action %u\n", r.act);
+			return -EINVAL;
+		}
+
+		if (fread(&r.data, size, 1, fp) != 1)
+			return -ENODATA;
+
+		size = action_payload_size(&r);
+
+		if (size > rec.payload_size) {
+			free(rec.payload);
+
+			rec.payload = malloc(size);
+			if (!rec.payload)
+				return -ENOMEM;
+
+			rec.payload_size = size;
+		}
+
+		if (size && fread(rec.payload, size, 1, fp) != 1)
+			return -ENODATA;
+
+		err = handle_action(&r, size);
+		if (err < 0) {
+			fprintf(stderr, "failed to handle action %u: %s\n",
+				r.act, strerror(-err));
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+/* the words of a gather follow its record in the trace */
+static int scan_trace(FILE *fp)
+{
+	struct trace_header header;
+	struct trace_record r;
+	struct cdma_decoder dec;
+	bool decoding = false;
+	uint32_t words[4];
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+	    header.version != TRACE_VER ||
+	    header.record_size != sizeof(struct trace_record))
+		return -ENOTSUP;
+
+	while (fread(&r, sizeof(r), 1, fp) == 1) {
+		switch (r.type) {
+		case TRACE_COMMANDS:
+			begin_stream();
+			cdma_decoder_init(&dec, &stats_visitor, NULL,
+					  r.data[0]);
+			decoding = true;
+			break;
+
+		case TRACE_WORDS:
+			if (!decoding)
+				break;
+
+			memcpy(words, r.data, sizeof(words));
+			cdma_decode(&dec, words, MIN(r.count, 4));
+			break;
+
+		default:
+			decoding = false;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int scan_log(FILE *fp)
+{
+	uint32_t classid = CLASS_GR3D, offset, value;
+	char line[1024], *op;
+	unsigned int i;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (strstr(line, "    commands: ")) {
+			begin_stream();
+			continue;
+		}
+
+		op = strstr(line, "HOST1X_OPCODE_");
+		if (op) {
+			sscanf(op, "HOST1X_OPCODE_SETCL: offset:%*x classid:%x",
+			       &classid);
+
+			for (i = 0; i < ARRAY_SIZE(cdma_opcode_names); i++) {
+				if (cdma_opcode_names[i] &&
+				    !strncmp(op, cdma_opcode_names[i],
+					     strlen(cdma_opcode_names[i])))
+					count_opcode(i);
+			}
+			continue;
+		}
+
+		if (sscanf(line, " %x <= 0x%x", &offset, &value) == 2)
+			count_write(classid, offset, value);
+	}
+
+	return 0;
+}
+
+struct reg_entry {
+	uint32_t classid;
+	uint32_t offset;
+	const struct reg_state *reg;
+};
+
+static int compare_regs(const void *a, const void *b)
+{
+	const struct reg_entry *ra = a, *rb = b;
+
+	if (ra->reg->unchanged != rb->reg->unchanged)
+		return ra->reg->unchanged < rb->reg->unchanged ? 1 : -1;
+
+	return ra->reg->writes < rb->reg->writes ? 1 :
+	       ra->reg->writes > rb->reg->writes ? -1 : 0;
+}
+
+static double percent(uint64_t part, uint64_t total)
+{
+	return total ? part * 100.0 / total : 0.0;
+}
+
+static void report_registers(void)
+{
+	struct reg_entry *entries;
+	struct class_state *cls;
+	unsigned int num = 0, i, k;
+
+	printf("state writes: %ju, unchanged: %ju (%.1f%%)\n\n",
+	       (uintmax_t)stats.state_writes, (uintmax_t)stats.unchanged,
+	       percent(stats.unchanged, stats.state_writes));
+
+	entries = calloc(NUM_CLASSES * NUM_REGS, sizeof(*entries));
+	if (!entries)
+		return;
+
+	for (i = 0; i < NUM_CLASSES; i++) {
+		cls = stats.classes[i];
+
+		for (k = 0; cls && k < NUM_REGS; k++) {
+			if (!cls->regs[k].unchanged)
+				continue;
+
+			entries[num].classid = i;
+			entries[num].offset = k;
+			entries[num].reg = &cls->regs[k];
+			num++;
+		}
+	}
+
+	qsort(entries, num, sizeof(*entries), compare_regs);
+
+	printf("%-32s %12s %12s %7s\n", "register", "writes", "unchanged",
+	       "%");
+
+	for (i = 0; i < num && i < stats.top; i++)
+		printf("%-32s %12ju %12ju %6.1f%%\n",
+		       reg_name(entries[i].classid, entries[i].offset),
+		       (uintmax_t)entries[i].reg->writes,
+		       (uintmax_t)entries[i].reg->unchanged,
+		       percent(entries[i].reg->unchanged,
+			       entries[i].reg->writes));
+
+	printf("\n");
+	free(entries);
+}
+
+/* uploads repeating the last one are redundant, seen ones could be kept */
+static void report_uploads(void)
+{
+	const struct upload_stats *up;
+	unsigned int i;
+
+	printf("%-18s %10s %12s %10s %12s %10s %12s\n", "upload", "count",
+	       "words", "repeated", "words", "seen", "words");
+
+	for (i = 0; i < NUM_UPLOADS; i++) {
+		up = &stats.uploads[i];
+
+		printf("%-18s %10ju %12ju %10ju %12ju %10ju %12ju\n",
+		       up->name, (uintmax_t)up->uploads,
+		       (uintmax_t)up->total_words, (uintmax_t)up->repeated,
+		       (uintmax_t)up->repeated_words, (uintmax_t)up->seen,
+		       (uintmax_t)up->seen_words);
+	}
+
+	printf("\n");
+}
+
+static void report_groups(void)
+{
+	uint64_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < NUM_GROUPS; i++)
+		total += stats.words[i];
+
+	printf("%-18s %12s %10s %7s\n", "group", "words", "per draw", "%");
+
+	for (i = 0; i < NUM_GROUPS; i++) {
+		if (!stats.words[i])
+			continue;
+
+		printf("%-18s %12ju %10.1f %6.1f%%\n", group_names[i],
+		       (uintmax_t)stats.words[i],
+		       stats.draws ? (double)stats.words[i] / stats.draws : 0.0,
+		       percent(stats.words[i], total));
+	}
+
+	printf("%-18s %12ju %10.1f\n", "total", (uintmax_t)total,
+	       stats.draws ? (double)total / stats.draws : 0.0);
+}
+
+static void usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-j] [-n count] <record | trace | log>\n"
+		"  -j        registers are reset by every job\n"
+		"  -n count  number of registers listed\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+	char magic[4 + 8];
+	int opt, err;
+	FILE *fp;
+
+	while ((opt = getopt(argc, argv, "jn:h")) != -1) {
+		switch (opt) {
+		case 'j':
+			stats.per_job = true;
+			break;
+
+		case 'n':
+			stats.top = strtoul(optarg, NULL, 0);
+			break;
+
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	fp = fopen(argv[optind], "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s\n", argv[optind]);
+		return 1;
+	}
+
+	init_tables();
+
+	memset(magic, 0, sizeof(magic));
+
+	if (fread(magic, sizeof(magic), 1, fp) != 1 && ferror(fp)) {
+		fprintf(stderr, "failed to read %s\n", argv[optind]);
+		fclose(fp);
+		return 1;
+	}
+
+	rewind(fp);
+
+	/* a record starts with REC_START, which is followed by the magic */
+	if (!memcmp(magic, TRACE_MAGIC, strlen(TRACE_MAGIC)))
+		err = scan_trace(fp);
+	else if (!memcmp(magic + 4, REC_MAGIC, strlen(REC_MAGIC)))
+		err = scan_record(fp);
+	else
+		err = scan_log(fp);
+
+	fclose(fp);
+
+	if (err < 0) {
+		fprintf(stderr, "failed to scan %s: %s\n", argv[optind],
+			strerror(-err));
+		return 1;
+	}
+
+	finish_uploads();
+
+	printf("streams: %ju, frames: %ju, draws: %ju",
+	       (uintmax_t)stats.streams, (uintmax_t)stats.frames,
+	       (uintmax_t)stats.draws);
+
+	if (stats.errors)
+		printf(", invalid opcodes: %ju", (uintmax_t)stats.errors);
+
+	printf("\n\n");
+
+	report_registers();
+	report_uploads();
+	report_groups();
+
+	return 0;
+}
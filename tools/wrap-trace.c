@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) Dmitry Osipenko
+ * Copyright (c) Erik Faye-Lund
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Decodes a binary trace of libwrap, taken with LIBWRAP_TRACE_PATH set,
+ * into the text libwrap prints of ioctls and command streams:
+ *	tools/wrap-trace /path/trace.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/ioctl.h>
+
+#include "cdma_parser.h"
+#include "trace.h"
+
+#define MAX_NAMES	256
+
+struct trace_name {
+	unsigned long request;
+	char name[64];
+};
+
+static struct trace_name names[MAX_NAMES];
+static unsigned int num_names;
+
+static struct trace_record *records;
+static size_t *order;
+static size_t num_records;
+
+static struct trace_name *lookup_name(unsigned long request)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_names; i++)
+		if (names[i].request == request)
+			return &names[i];
+
+	return NULL;
+}
+
+static void add_name_chunk(const struct trace_record *r)
+{
+	struct trace_name *name = lookup_name(r->data[0]);
+	unsigned int offset = r->count * 12;
+
+	if (!name) {
+		if (num_names == MAX_NAMES)
+			return;
+
+		name = &names[num_names++];
+		name->request = r->data[0];
+	}
+
+	if (offset + 12 < sizeof(name->name))
+		memcpy(name->name + offset, &r->data[1], 12);
+}
+
+/* records of each thread are in order, hence the order of equal times */
+static int compare_records(const void *a, const void *b)
+{
+	size_t ia = *(const size_t *)a, ib = *(const size_t *)b;
+
+	if (records[ia].time != records[ib].time)
+		return records[ia].time < records[ib].time ? -1 : 1;
+
+	return ia < ib ? -1 : ia > ib;
+}
+
+static int load_trace(const char *path)
+{
+	struct trace_header header;
+	size_t max_records = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "failed to open %s\n", path);
+		return -1;
+	}
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+	    memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) ||
+	    header.version != TRACE_VER ||
+	    header.record_size != sizeof(struct trace_record)) {
+		fprintf(stderr, "%s isn't a trace of this version\n", path);
+		fclose(fp);
+		return -1;
+	}
+
+	while (true) {
+		if (num_records == max_records) {
+			max_records = max_records * 2 ?: 4096;
+			records = realloc(records,
+					  max_records * sizeof(*records));
+			if (!records) {
+				fprintf(stderr, "out of memory\n");
+				fclose(fp);
+				return -1;
+			}
+		}
+
+		if (fread(&records[num_records], sizeof(*records), 1, fp) != 1)
+			break;
+
+		num_records++;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static void decode_leave(const struct trace_record *r)
+{
+	unsigned long request = r->data[1];
+	struct trace_name *name = lookup_name(request);
+
+	if (!name) {
+		printf("  dir:%lx type:'%c' nr:%lx size:%lu\n",
+		       (unsigned long)_IOC_DIR(request),
+		       (char)_IOC_TYPE(request),
+		       (unsigned long)_IOC_NR(request),
+		       (unsigned long)_IOC_SIZE(request));
+	} else {
+		printf("  %s (%'ld us)\n", name->name, (long)r->data[3]);
+	}
+
+	printf("ioctl() = %d\n", (int)r->data[2]);
+}
+
+/* the words are written along with the commands record */
+static void decode_commands(size_t index)
+{
+	const struct trace_record *r = &records[index];
+	uint32_t classid = r->data[0];
+	unsigned int count = r->data[1];
+	unsigned int n = 0;
+	uint32_t *words;
+	size_t i;
+
+	words = calloc(count + 1, sizeof(*words));
+	if (!words)
+		abort();
+
+	for (i = index + 1; i < num_records && n < count; i++) {
+		if (records[i].type != TRACE_WORDS)
+			break;
+
+		memcpy(words + n, records[i].data,
+		       records[i].count * sizeof(*words));
+		n += records[i].count;
+	}
+
+	cdma_parse_commands(words, n, true, &classid, NULL, NULL);
+	free(words);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct trace_record *r;
+	size_t i;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s trace.bin\n", argv[0]);
+		return 2;
+	}
+
+	if (load_trace(argv[1]) < 0)
+		return 1;
+
+	order = calloc(num_records + 1, sizeof(*order));
+	if (!order) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < num_records; i++)
+		order[i] = i;
+
+	qsort(order, num_records, sizeof(*order), compare_records);
+
+	/* a name may be traced by another thread after its first use */
+	for (i = 0; i < num_records; i++)
+		if (records[i].type == TRACE_IOCTL_NAME)
+			add_name_chunk(&records[i]);
+
+	for (i = 0; i < num_records; i++) {
+		r = &records[order[i]];
+
+		switch (r->type) {
+		case TRACE_IOCTL_ENTER:
+			printf("ioctl(fd=%d, request=%#lx, arg=%p)\n",
+			       (int)r->data[0], (unsigned long)r->data[1],
+			       (void *)(uintptr_t)((uint64_t)r->data[3] << 32 |
+						   r->data[2]));
+			break;
+
+		case TRACE_IOCTL_LEAVE:
+			decode_leave(r);
+			break;
+
+		case TRACE_COMMANDS:
+			decode_commands(order[i]);
+			break;
+
+		case TRACE_DROPPED:
+			printf("%u records of thread %u dropped\n",
+			       r->data[0], r->tid);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	free(records);
+	free(order);
+
+	return 0;
+}